@@ -0,0 +1,266 @@
+#include "AsManager.h"
+
+static const D3D12_HEAP_PROPERTIES kDefaultHeapProps =
+{
+	D3D12_HEAP_TYPE_DEFAULT,
+	D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+	D3D12_MEMORY_POOL_UNKNOWN,
+	0,
+	0
+};
+
+static const D3D12_HEAP_PROPERTIES kReadbackHeapProps =
+{
+	D3D12_HEAP_TYPE_READBACK,
+	D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+	D3D12_MEMORY_POOL_UNKNOWN,
+	0,
+	0
+};
+
+static void uavBarrier(ID3D12GraphicsCommandList4Ptr pCmdList, ID3D12ResourcePtr pResource)
+{
+	D3D12_RESOURCE_BARRIER barrier = {};
+	barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+	barrier.UAV.pResource = pResource;
+	pCmdList->ResourceBarrier(1, &barrier);
+}
+
+static void transitionBarrier(ID3D12GraphicsCommandList4Ptr pCmdList, ID3D12ResourcePtr pResource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after)
+{
+	D3D12_RESOURCE_BARRIER barrier = {};
+	barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	barrier.Transition.pResource = pResource;
+	barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	barrier.Transition.StateBefore = before;
+	barrier.Transition.StateAfter = after;
+	pCmdList->ResourceBarrier(1, &barrier);
+}
+
+static std::wstring toWide(const std::string& s)
+{
+	return std::wstring(s.begin(), s.end());
+}
+
+ID3D12ResourcePtr AsManager::createBuffer(uint64_t size, D3D12_RESOURCE_STATES state, const D3D12_HEAP_PROPERTIES& heapProps, D3D12_RESOURCE_FLAGS flags, const std::wstring& name)
+{
+	D3D12_RESOURCE_DESC bufDesc = {};
+	bufDesc.Alignment = 0;
+	bufDesc.DepthOrArraySize = 1;
+	bufDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	bufDesc.Flags = flags;
+	bufDesc.Format = DXGI_FORMAT_UNKNOWN;
+	bufDesc.Height = 1;
+	bufDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+	bufDesc.MipLevels = 1;
+	bufDesc.SampleDesc.Count = 1;
+	bufDesc.SampleDesc.Quality = 0;
+	bufDesc.Width = size;
+
+	ID3D12ResourcePtr pBuffer;
+	d3d_call(mpDevice->CreateCommittedResource(&heapProps, D3D12_HEAP_FLAG_NONE, &bufDesc, state, nullptr, IID_PPV_ARGS(&pBuffer)));
+	pBuffer->SetName(name.c_str());
+	return pBuffer;
+}
+
+void AsManager::init(ID3D12Device5Ptr pDevice)
+{
+	mpDevice = pDevice;
+	mTracker = AsMemoryTracker();
+	mResults.clear();
+	mScratch.clear();
+	mRetired.clear();
+	mPostbuildIds.clear();
+	mReadbackIds.clear();
+	mpPostbuildInfo = createBuffer(kMaxAsPostbuildInfos * sizeof(uint64_t), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, kDefaultHeapProps, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"AS post-build info");
+	mpPostbuildReadback = createBuffer(kMaxAsPostbuildInfos * sizeof(uint64_t), D3D12_RESOURCE_STATE_COPY_DEST, kReadbackHeapProps, D3D12_RESOURCE_FLAG_NONE, L"AS post-build readback");
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS AsManager::prepareScratch(ID3D12GraphicsCommandList4Ptr pCmdList, const AsScratch& scratch)
+{
+	if (scratch.buffer == kInvalidAsId)
+	{
+		return 0;
+	}
+	if (mScratch.size() <= scratch.buffer)
+	{
+		mScratch.resize(scratch.buffer + 1);
+	}
+	if (scratch.create)
+	{
+		mScratch[scratch.buffer] = createBuffer(scratch.size, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, kDefaultHeapProps, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+			L"AS scratch " + std::to_wstring(scratch.buffer));
+	}
+	else if (scratch.needsBarrier)
+	{
+		// The previous build with this scratch has to finish before the next one overwrites it
+		uavBarrier(pCmdList, mScratch[scratch.buffer]);
+	}
+	return mScratch[scratch.buffer]->GetGPUVirtualAddress();
+}
+
+void AsManager::setResult(uint32_t id, ID3D12ResourcePtr pResult)
+{
+	if (mResults.size() <= id)
+	{
+		mResults.resize(id + 1);
+	}
+	mResults[id] = pResult;
+}
+
+uint32_t AsManager::buildBottomLevel(ID3D12GraphicsCommandList4Ptr pCmdList, const D3D12_RAYTRACING_GEOMETRY_DESC* pGeometries, uint32_t numGeometries, const std::string& owner)
+{
+	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
+	inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+	inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
+	inputs.NumDescs = numGeometries;
+	inputs.pGeometryDescs = pGeometries;
+	inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
+	mpDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &info);
+
+	AsScratch scratch;
+	uint32_t id = mTracker.beginBuild(owner, false, true, info.ResultDataMaxSizeInBytes, info.ScratchDataSizeInBytes, false, scratch);
+	setResult(id, createBuffer(mTracker.getInfo(id).maxResultSize, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, kDefaultHeapProps,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"BLAS " + toWide(owner)));
+
+	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+	asDesc.Inputs = inputs;
+	asDesc.DestAccelerationStructureData = mResults[id]->GetGPUVirtualAddress();
+	asDesc.ScratchAccelerationStructureData = prepareScratch(pCmdList, scratch);
+
+	// The compacted size goes to the next post-build slot, past the last one the BLAS just isn't compacted
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuildDesc = {};
+	postbuildDesc.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+	uint32_t numPostbuildDescs = 0;
+	if (mPostbuildIds.size() < kMaxAsPostbuildInfos)
+	{
+		postbuildDesc.DestBuffer = mpPostbuildInfo->GetGPUVirtualAddress() + mPostbuildIds.size() * sizeof(uint64_t);
+		mPostbuildIds.push_back(id);
+		numPostbuildDescs = 1;
+	}
+	pCmdList->BuildRaytracingAccelerationStructure(&asDesc, numPostbuildDescs, numPostbuildDescs ? &postbuildDesc : nullptr);
+
+	// Before the result is used in a TLAS build or a DispatchRays
+	uavBarrier(pCmdList, mResults[id]);
+	mTracker.endBuild(id);
+	return id;
+}
+
+uint32_t AsManager::buildTopLevel(ID3D12GraphicsCommandList4Ptr pCmdList, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& inputs, const std::string& owner)
+{
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
+	mpDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &info);
+
+	AsScratch scratch;
+	uint32_t id = mTracker.beginBuild(owner, true, false, info.ResultDataMaxSizeInBytes, std::max(info.ScratchDataSizeInBytes, info.UpdateScratchDataSizeInBytes), true, scratch);
+	setResult(id, createBuffer(mTracker.getInfo(id).maxResultSize, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, kDefaultHeapProps,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"TLAS " + toWide(owner)));
+
+	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+	asDesc.Inputs = inputs;
+	asDesc.DestAccelerationStructureData = mResults[id]->GetGPUVirtualAddress();
+	asDesc.ScratchAccelerationStructureData = prepareScratch(pCmdList, scratch);
+	pCmdList->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+
+	uavBarrier(pCmdList, mResults[id]);
+	mTracker.endBuild(id);
+	return id;
+}
+
+void AsManager::updateTopLevel(ID3D12GraphicsCommandList4Ptr pCmdList, uint32_t id, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& inputs, bool refit)
+{
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
+	mpDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &info);
+
+	// The TLAS was already used by a DispatchRays, which has to finish reading it first
+	uavBarrier(pCmdList, mResults[id]);
+
+	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+	asDesc.Inputs = inputs;
+	asDesc.DestAccelerationStructureData = mResults[id]->GetGPUVirtualAddress();
+	if (refit)
+	{
+		asDesc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		asDesc.SourceAccelerationStructureData = mResults[id]->GetGPUVirtualAddress();
+	}
+	asDesc.ScratchAccelerationStructureData = prepareScratch(pCmdList,
+		mTracker.getUpdateScratch(id, refit ? info.UpdateScratchDataSizeInBytes : info.ScratchDataSizeInBytes));
+	pCmdList->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+
+	uavBarrier(pCmdList, mResults[id]);
+}
+
+void AsManager::endBatch(ID3D12GraphicsCommandList4Ptr pCmdList)
+{
+	mReadbackIds = mPostbuildIds;
+	mPostbuildIds.clear();
+	if (mReadbackIds.empty())
+	{
+		return;
+	}
+	transitionBarrier(pCmdList, mpPostbuildInfo, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	pCmdList->CopyBufferRegion(mpPostbuildReadback, 0, mpPostbuildInfo, 0, mReadbackIds.size() * sizeof(uint64_t));
+	transitionBarrier(pCmdList, mpPostbuildInfo, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+}
+
+void AsManager::onBatchFinished()
+{
+	mTracker.finishBatch();
+	if (mReadbackIds.empty())
+	{
+		return;
+	}
+
+	D3D12_RANGE readRange = { 0, mReadbackIds.size() * sizeof(uint64_t) };
+	uint64_t* pSizes;
+	d3d_call(mpPostbuildReadback->Map(0, &readRange, (void**)&pSizes));
+	for (size_t slot = 0; slot < mReadbackIds.size(); slot++)
+	{
+		uint32_t id = mReadbackIds[slot];
+		if (mTracker.getInfo(id).live)
+		{
+			mTracker.setCompactedSize(id, pSizes[slot]);
+		}
+	}
+	D3D12_RANGE writeRange = { 0, 0 };
+	mpPostbuildReadback->Unmap(0, &writeRange);
+	mReadbackIds.clear();
+}
+
+uint32_t AsManager::compact(ID3D12GraphicsCommandList4Ptr pCmdList)
+{
+	std::vector<uint32_t> candidates = mTracker.getCompactionCandidates();
+	for (uint32_t id : candidates)
+	{
+		ID3D12ResourcePtr pCompacted = createBuffer(mTracker.getInfo(id).compactedSize, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, kDefaultHeapProps,
+			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, L"BLAS " + toWide(mTracker.getInfo(id).owner) + L" compacted");
+		pCmdList->CopyRaytracingAccelerationStructure(pCompacted->GetGPUVirtualAddress(), mResults[id]->GetGPUVirtualAddress(),
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+		mRetired.push_back(mResults[id]);
+		mResults[id] = pCompacted;
+		mTracker.setCompacted(id);
+	}
+	for (uint32_t id : candidates)
+	{
+		uavBarrier(pCmdList, mResults[id]);
+	}
+	return (uint32_t)candidates.size();
+}
+
+void AsManager::onCompactionFinished(uint64_t keepScratchBytes)
+{
+	mRetired.clear();
+	mTracker.finishBatch();
+	for (uint32_t buffer : mTracker.trimScratch(keepScratchBytes))
+	{
+		mScratch[buffer] = nullptr;
+	}
+}
+
+void AsManager::free(uint32_t id)
+{
+	mTracker.free(id);
+	mResults[id] = nullptr;
+}
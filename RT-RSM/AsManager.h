@@ -0,0 +1,60 @@
+#pragma once
+#include "Framework.h"
+#include "AsMemoryTracker.h"
+
+// BLAS builds per batch that can ask for their compacted size
+static const uint32_t kMaxAsPostbuildInfos = 4096;
+
+/*
+	Owner of the memory of every BLAS and TLAS, on top of the AsMemoryTracker policy. Results are committed buffers
+	sized by the prebuild info, scratch comes from the tracker's pool, and bottom level builds emit their compacted size.
+
+	One batch of builds:
+		buildBottomLevel / buildTopLevel ..., endBatch(pCmdList), submit and wait, onBatchFinished()
+		compact(pCmdList), submit and wait, onCompactionFinished()
+	Compaction moves the results, so instance descs have to be written with getAddress after it.
+*/
+class AsManager
+{
+public:
+	void init(ID3D12Device5Ptr pDevice);
+
+	// PREFER_FAST_TRACE | ALLOW_COMPACTION, returns the AS id
+	uint32_t buildBottomLevel(ID3D12GraphicsCommandList4Ptr pCmdList, const D3D12_RAYTRACING_GEOMETRY_DESC* pGeometries, uint32_t numGeometries, const std::string& owner);
+
+	// inputs must have InstanceDescs set. The TLAS keeps its scratch for updateTopLevel.
+	uint32_t buildTopLevel(ID3D12GraphicsCommandList4Ptr pCmdList, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& inputs, const std::string& owner);
+
+	// Refit in place, or build from scratch into the same buffer. inputs must match those of buildTopLevel.
+	void updateTopLevel(ID3D12GraphicsCommandList4Ptr pCmdList, uint32_t id, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& inputs, bool refit = true);
+
+	// Record the read back of the compacted sizes of the batch
+	void endBatch(ID3D12GraphicsCommandList4Ptr pCmdList);
+	void onBatchFinished();
+
+	// Record the compacting copies, returns how many there are. The old results live until onCompactionFinished.
+	uint32_t compact(ID3D12GraphicsCommandList4Ptr pCmdList);
+	void onCompactionFinished(uint64_t keepScratchBytes = 0);
+
+	void free(uint32_t id);
+
+	ID3D12ResourcePtr			getResult(uint32_t id) const { return mResults[id]; }
+	D3D12_GPU_VIRTUAL_ADDRESS	getAddress(uint32_t id) const { return mResults[id]->GetGPUVirtualAddress(); }
+	const AsMemoryTracker&		getTracker() const { return mTracker; }
+	std::string					getReport(uint32_t maxOwners = 0xffffffff) const { return mTracker.getReport(maxOwners); }
+
+private:
+	ID3D12ResourcePtr createBuffer(uint64_t size, D3D12_RESOURCE_STATES state, const D3D12_HEAP_PROPERTIES& heapProps, D3D12_RESOURCE_FLAGS flags, const std::wstring& name);
+	D3D12_GPU_VIRTUAL_ADDRESS prepareScratch(ID3D12GraphicsCommandList4Ptr pCmdList, const AsScratch& scratch);
+	void setResult(uint32_t id, ID3D12ResourcePtr pResult);
+
+	ID3D12Device5Ptr				mpDevice;
+	AsMemoryTracker					mTracker;
+	std::vector<ID3D12ResourcePtr>	mResults;				// by AS id
+	std::vector<ID3D12ResourcePtr>	mScratch;				// by scratch buffer id
+	std::vector<ID3D12ResourcePtr>	mRetired;				// replaced by compaction, released once the copies have run
+	ID3D12ResourcePtr				mpPostbuildInfo;		// one uint64 compacted size per slot, written by the builds
+	ID3D12ResourcePtr				mpPostbuildReadback;
+	std::vector<uint32_t>			mPostbuildIds;			// AS of each slot of the batch being recorded
+	std::vector<uint32_t>			mReadbackIds;			// slots copied by endBatch
+};
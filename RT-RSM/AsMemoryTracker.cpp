@@ -0,0 +1,283 @@
+#include "AsMemoryTracker.h"
+#include "GeometryAllocator.h"
+#include <algorithm>
+#include <assert.h>
+#include <map>
+#include <stdio.h>
+
+uint32_t AsMemoryTracker::beginBuild(const std::string& owner, bool topLevel, bool allowCompaction, uint64_t maxResultSize, uint64_t scratchSize, bool keepScratch, AsScratch& scratch)
+{
+	uint32_t id;
+	if (!mFreeIds.empty())
+	{
+		id = mFreeIds.back();
+		mFreeIds.pop_back();
+	}
+	else
+	{
+		id = (uint32_t)mInfos.size();
+		mInfos.push_back(AsInfo());
+	}
+
+	AsInfo& info = mInfos[id];
+	info = AsInfo();
+	info.owner = owner;
+	info.topLevel = topLevel;
+	info.allowCompaction = allowCompaction;
+	info.maxResultSize = alignUp(maxResultSize, kAsAlignment);
+	info.resultSize = info.maxResultSize;
+	info.keepScratch = keepScratch;
+	info.live = true;
+
+	scratch = acquireScratch(scratchSize);
+	info.scratch = scratch.buffer;
+	return id;
+}
+
+void AsMemoryTracker::endBuild(uint32_t id)
+{
+	AsInfo& info = mInfos[id];
+	if (!info.keepScratch && info.scratch != kInvalidAsId)
+	{
+		releaseScratch(info.scratch);
+		info.scratch = kInvalidAsId;
+	}
+}
+
+AsScratch AsMemoryTracker::getUpdateScratch(uint32_t id, uint64_t scratchSize)
+{
+	AsInfo& info = mInfos[id];
+	if (info.scratch != kInvalidAsId && mScratch[info.scratch].size >= scratchSize)
+	{
+		AsScratch scratch;
+		scratch.buffer = info.scratch;
+		scratch.size = mScratch[info.scratch].size;
+		return scratch;
+	}
+	if (info.scratch != kInvalidAsId)
+	{
+		releaseScratch(info.scratch);
+	}
+	AsScratch scratch = acquireScratch(scratchSize);
+	info.scratch = scratch.buffer;
+	return scratch;
+}
+
+void AsMemoryTracker::finishBatch()
+{
+	for (ScratchBuffer& buffer : mScratch)
+	{
+		buffer.usedInBatch = false;
+	}
+}
+
+AsScratch AsMemoryTracker::acquireScratch(uint64_t size)
+{
+	AsScratch scratch;
+	if (size == 0)
+	{
+		return scratch;
+	}
+
+	// Best fit, on a tie the buffer that doesn't need a barrier
+	uint32_t best = kInvalidAsId;
+	uint32_t freeSlot = kInvalidAsId;
+	for (uint32_t b = 0; b < (uint32_t)mScratch.size(); b++)
+	{
+		const ScratchBuffer& buffer = mScratch[b];
+		if (!buffer.live)
+		{
+			freeSlot = b;
+			continue;
+		}
+		if (buffer.inUse || buffer.size < size)
+		{
+			continue;
+		}
+		if (best == kInvalidAsId || buffer.size < mScratch[best].size ||
+			(buffer.size == mScratch[best].size && mScratch[best].usedInBatch && !buffer.usedInBatch))
+		{
+			best = b;
+		}
+	}
+
+	if (best != kInvalidAsId)
+	{
+		scratch.needsBarrier = mScratch[best].usedInBatch;
+		mNumScratchReused++;
+	}
+	else
+	{
+		if (freeSlot == kInvalidAsId)
+		{
+			freeSlot = (uint32_t)mScratch.size();
+			mScratch.push_back(ScratchBuffer());
+		}
+		best = freeSlot;
+		mScratch[best] = ScratchBuffer();
+		mScratch[best].size = alignUp(size, kAsScratchGranularity);
+		mScratch[best].live = true;
+		scratch.create = true;
+		mNumScratchCreated++;
+	}
+
+	mScratch[best].inUse = true;
+	mScratch[best].usedInBatch = true;
+	scratch.buffer = best;
+	scratch.size = mScratch[best].size;
+	return scratch;
+}
+
+void AsMemoryTracker::releaseScratch(uint32_t buffer)
+{
+	assert(mScratch[buffer].live && mScratch[buffer].inUse);
+	mScratch[buffer].inUse = false;
+}
+
+void AsMemoryTracker::setCompactedSize(uint32_t id, uint64_t size)
+{
+	mInfos[id].compactedSize = alignUp(size, kAsAlignment);
+}
+
+std::vector<uint32_t> AsMemoryTracker::getCompactionCandidates() const
+{
+	std::vector<uint32_t> candidates;
+	for (uint32_t id = 0; id < (uint32_t)mInfos.size(); id++)
+	{
+		const AsInfo& info = mInfos[id];
+		if (info.live && info.allowCompaction && !info.compacted && info.compactedSize > 0 &&
+			info.compactedSize + mMinCompactionSaving <= info.resultSize)
+		{
+			candidates.push_back(id);
+		}
+	}
+	return candidates;
+}
+
+void AsMemoryTracker::setCompacted(uint32_t id)
+{
+	AsInfo& info = mInfos[id];
+	assert(info.compactedSize > 0);
+	info.resultSize = info.compactedSize;
+	info.compacted = true;
+}
+
+void AsMemoryTracker::free(uint32_t id)
+{
+	AsInfo& info = mInfos[id];
+	assert(info.live);
+	if (info.scratch != kInvalidAsId)
+	{
+		releaseScratch(info.scratch);
+	}
+	info = AsInfo();
+	mFreeIds.push_back(id);
+}
+
+std::vector<uint32_t> AsMemoryTracker::trimScratch(uint64_t keepBytes)
+{
+	std::vector<uint32_t> idle;
+	uint64_t idleBytes = 0;
+	for (uint32_t b = 0; b < (uint32_t)mScratch.size(); b++)
+	{
+		if (mScratch[b].live && !mScratch[b].inUse)
+		{
+			idle.push_back(b);
+			idleBytes += mScratch[b].size;
+		}
+	}
+	std::sort(idle.begin(), idle.end(), [this](uint32_t a, uint32_t b) { return mScratch[a].size > mScratch[b].size; });
+
+	std::vector<uint32_t> released;
+	for (uint32_t b : idle)
+	{
+		if (idleBytes <= keepBytes)
+		{
+			break;
+		}
+		idleBytes -= mScratch[b].size;
+		mScratch[b] = ScratchBuffer();
+		released.push_back(b);
+	}
+	return released;
+}
+
+AsMemoryStats AsMemoryTracker::getStats() const
+{
+	AsMemoryStats stats;
+	for (const AsInfo& info : mInfos)
+	{
+		if (!info.live)
+		{
+			continue;
+		}
+		stats.resultBytes += info.resultSize;
+		(info.topLevel ? stats.topLevelBytes : stats.bottomLevelBytes) += info.resultSize;
+		(info.topLevel ? stats.numTopLevel : stats.numBottomLevel)++;
+		if (info.compacted)
+		{
+			stats.compactionSavedBytes += info.maxResultSize - info.resultSize;
+			stats.numCompacted++;
+		}
+	}
+	for (const ScratchBuffer& buffer : mScratch)
+	{
+		if (buffer.live)
+		{
+			stats.scratchBytes += buffer.size;
+			stats.scratchInUseBytes += buffer.inUse ? buffer.size : 0;
+			stats.numScratchBuffers++;
+		}
+	}
+	stats.numScratchCreated = mNumScratchCreated;
+	stats.numScratchReused = mNumScratchReused;
+	return stats;
+}
+
+std::string AsMemoryTracker::getReport(uint32_t maxOwners) const
+{
+	AsMemoryStats stats = getStats();
+	char line[256];
+	snprintf(line, sizeof(line), "Acceleration structures: %.2f MB in %u BLAS (%.2f MB) and %u TLAS (%.2f MB), %u compacted saving %.2f MB, "
+		"scratch %.2f MB in %u buffers (%.2f MB in use, %u created, %u reused)",
+		stats.resultBytes / (1024.0 * 1024.0),
+		stats.numBottomLevel,
+		stats.bottomLevelBytes / (1024.0 * 1024.0),
+		stats.numTopLevel,
+		stats.topLevelBytes / (1024.0 * 1024.0),
+		stats.numCompacted,
+		stats.compactionSavedBytes / (1024.0 * 1024.0),
+		stats.scratchBytes / (1024.0 * 1024.0),
+		stats.numScratchBuffers,
+		stats.scratchInUseBytes / (1024.0 * 1024.0),
+		stats.numScratchCreated,
+		stats.numScratchReused);
+	std::string report = line;
+
+	std::map<std::string, std::pair<uint64_t, uint32_t>> owners;	// owner -> bytes, count
+	for (const AsInfo& info : mInfos)
+	{
+		if (info.live)
+		{
+			owners[info.owner].first += info.resultSize;
+			owners[info.owner].second++;
+		}
+	}
+	std::vector<std::pair<uint64_t, std::string>> order;
+	for (const auto& owner : owners)
+	{
+		order.push_back(std::make_pair(owner.second.first, owner.first));
+	}
+	std::sort(order.begin(), order.end(), [](const std::pair<uint64_t, std::string>& a, const std::pair<uint64_t, std::string>& b) { return a.first > b.first; });
+	for (uint32_t i = 0; i < (uint32_t)order.size() && i < maxOwners; i++)
+	{
+		const auto& owner = order[i];
+		snprintf(line, sizeof(line), "\n  %-40s %10.1f KB in %u", owner.second.c_str(), owner.first / 1024.0, owners[owner.second].second);
+		report += line;
+	}
+	if (order.size() > maxOwners)
+	{
+		report += "\n  " + std::to_string(order.size() - maxOwners) + " more";
+	}
+	return report;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+static const uint32_t kInvalidAsId = 0xffffffff;
+
+// Result and scratch data of a build must be 256-byte aligned (D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT)
+static const uint64_t kAsAlignment = 256;
+
+// Scratch buffers are created in steps of this, so a buffer also fits later builds of a similar size
+static const uint64_t kAsScratchGranularity = 64 * 1024;
+
+// A compacting copy is only made if it saves at least this much
+static const uint64_t kMinAsCompactionSaving = 4 * 1024;
+
+// Scratch for one build
+struct AsScratch
+{
+	uint32_t	buffer = kInvalidAsId;	// in the scratch pool
+	uint64_t	size = 0;				// of the whole buffer
+	bool		create = false;			// a new buffer, has to be created with size
+	bool		needsBarrier = false;	// an earlier build of the batch used it, a UAV barrier has to go in between
+};
+
+struct AsInfo
+{
+	std::string	owner;					// mesh or model, for the report
+	bool		topLevel = false;
+	bool		allowCompaction = false;
+	uint64_t	maxResultSize = 0;		// from the prebuild info, what the result was allocated with
+	uint64_t	resultSize = 0;			// of the current result buffer
+	uint64_t	compactedSize = 0;		// from the post-build info, 0 until known
+	uint32_t	scratch = kInvalidAsId;	// kept for updates, or held until endBuild
+	bool		keepScratch = false;
+	bool		compacted = false;
+	bool		live = false;
+};
+
+struct AsMemoryStats
+{
+	uint64_t	resultBytes = 0;			// all live results
+	uint64_t	bottomLevelBytes = 0;
+	uint64_t	topLevelBytes = 0;
+	uint64_t	compactionSavedBytes = 0;	// max result size minus the size of the compacted ones
+	uint64_t	scratchBytes = 0;			// pooled scratch, in use or not
+	uint64_t	scratchInUseBytes = 0;
+	uint32_t	numBottomLevel = 0;
+	uint32_t	numTopLevel = 0;
+	uint32_t	numCompacted = 0;
+	uint32_t	numScratchBuffers = 0;
+	uint32_t	numScratchCreated = 0;		// over the lifetime of the tracker
+	uint32_t	numScratchReused = 0;
+};
+
+/*
+	Policy and accounting of acceleration structure memory. Like GeometryAllocator it only deals in sizes and ids and
+	never touches memory: AsManager backs it with D3D12 buffers, CpuAsManager with software BVHs.
+
+	A build takes the best fitting free scratch buffer of the pool, or a new one. Unless the AS keeps it for updates, the
+	scratch goes back to the pool as soon as the build is recorded, so the next build of the same batch reuses it behind
+	a UAV barrier instead of every build holding its own. Once the post-build compacted sizes are known,
+	getCompactionCandidates lists the ASes a compacting copy would shrink by at least the minimum saving.
+*/
+class AsMemoryTracker
+{
+public:
+	// Register an AS with a result of maxResultSize and take scratch for its build. Returns the id of the AS.
+	uint32_t beginBuild(const std::string& owner, bool topLevel, bool allowCompaction, uint64_t maxResultSize, uint64_t scratchSize, bool keepScratch, AsScratch& scratch);
+
+	// The build is recorded, scratch that isn't kept goes back to the pool
+	void endBuild(uint32_t id);
+
+	// Scratch for an update or rebuild of an AS that kept its scratch, grown if it is too small
+	AsScratch getUpdateScratch(uint32_t id, uint64_t scratchSize);
+
+	// Everything recorded so far has finished, the pooled scratch needs no more barriers
+	void finishBatch();
+
+	void setCompactedSize(uint32_t id, uint64_t size);
+	std::vector<uint32_t> getCompactionCandidates() const;
+
+	// The result of id was replaced by a compacted copy of compactedSize
+	void setCompacted(uint32_t id);
+	void free(uint32_t id);
+
+	// Release free scratch buffers, largest first, until at most keepBytes of free scratch are left. Returns the released buffers.
+	std::vector<uint32_t> trimScratch(uint64_t keepBytes = 0);
+
+	const AsInfo&	getInfo(uint32_t id) const { return mInfos[id]; }
+	uint32_t		getNumIds() const { return (uint32_t)mInfos.size(); }
+	void			setMinCompactionSaving(uint64_t bytes) { mMinCompactionSaving = bytes; }
+	AsMemoryStats	getStats() const;
+
+	// Totals, then the footprint of the largest maxOwners owners
+	std::string getReport(uint32_t maxOwners = 0xffffffff) const;
+
+private:
+	struct ScratchBuffer
+	{
+		uint64_t	size = 0;
+		bool		inUse = false;
+		bool		usedInBatch = false;
+		bool		live = false;
+	};
+
+	AsScratch acquireScratch(uint64_t size);
+	void releaseScratch(uint32_t buffer);
+
+	std::vector<AsInfo>			mInfos;			// indexed by AS id
+	std::vector<uint32_t>		mFreeIds;
+	std::vector<ScratchBuffer>	mScratch;		// indexed by scratch buffer id
+	uint32_t					mNumScratchCreated = 0;
+	uint32_t					mNumScratchReused = 0;
+	uint64_t					mMinCompactionSaving = kMinAsCompactionSaving;
+};
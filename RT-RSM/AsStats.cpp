@@ -0,0 +1,326 @@
+#include "AsStats.h"
+
+#ifdef AS_STATS
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+thread_local TraversalCounters gTraversalCounters;
+
+const char* getTraversalCounterName(TraversalCounter counter)
+{
+	switch (counter)
+	{
+	case TraversalCounter::Nodes: return "nodes";
+	case TraversalCounter::Triangles: return "triangles";
+	case TraversalCounter::Instances: return "instances";
+	default: return "unknown";
+	}
+}
+
+uint32_t TraversalCounters::get(TraversalCounter counter) const
+{
+	switch (counter)
+	{
+	case TraversalCounter::Nodes: return nodes;
+	case TraversalCounter::Triangles: return triangles;
+	case TraversalCounter::Instances: return instances;
+	default: return 0;
+	}
+}
+
+///////////////////////////////////////////
+// Per pixel counters
+///////////////////////////////////////////
+void TraversalStatsImage::resize(uint32_t width, uint32_t height)
+{
+	mWidth = width;
+	mHeight = height;
+	mPixels.assign((size_t)width * height, TraversalCounters());
+}
+
+void TraversalStatsImage::clear()
+{
+	std::fill(mPixels.begin(), mPixels.end(), TraversalCounters());
+}
+
+uint32_t TraversalStatsImage::getMax(TraversalCounter counter) const
+{
+	uint32_t maxValue = 0;
+	for (const TraversalCounters& pixel : mPixels)
+	{
+		maxValue = std::max(maxValue, pixel.get(counter));
+	}
+	return maxValue;
+}
+
+double TraversalStatsImage::getTotal(TraversalCounter counter) const
+{
+	double total = 0.0;
+	for (const TraversalCounters& pixel : mPixels)
+	{
+		total += pixel.get(counter);
+	}
+	return total;
+}
+
+void TraversalStatsImage::getHeatmap(TraversalCounter counter, uint32_t maxValue, std::vector<vec4>& pixels) const
+{
+	static const vec3 kRamp[] = { vec3(0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 1.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f) };
+	static const uint32_t kRampSteps = sizeof(kRamp) / sizeof(kRamp[0]) - 1;
+
+	maxValue = maxValue > 0 ? maxValue : std::max(getMax(counter), 1u);
+	pixels.resize(mPixels.size());
+	for (size_t p = 0; p < mPixels.size(); p++)
+	{
+		float x = std::min((float)mPixels[p].get(counter) / maxValue, 1.0f) * kRampSteps;
+		uint32_t step = std::min((uint32_t)x, kRampSteps - 1);
+		pixels[p] = vec4(mix(kRamp[step], kRamp[step + 1], x - step), 1.0f);
+	}
+}
+
+bool TraversalStatsImage::saveHeatmap(const char* pFileName, TraversalCounter counter, uint32_t maxValue) const
+{
+	std::vector<vec4> pixels;
+	getHeatmap(counter, maxValue, pixels);
+
+	std::ofstream file(pFileName, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+	// A negative scale means little endian
+	char header[64];
+	snprintf(header, sizeof(header), "PF\n%u %u\n-1.0\n", mWidth, mHeight);
+	file.write(header, strlen(header));
+	std::vector<float> row(3 * mWidth);
+	for (uint32_t y = mHeight; y-- > 0;)
+	{
+		for (uint32_t x = 0; x < mWidth; x++)
+		{
+			const vec4& pixel = pixels[y * mWidth + x];
+			row[3 * x] = pixel.r;
+			row[3 * x + 1] = pixel.g;
+			row[3 * x + 2] = pixel.b;
+		}
+		file.write((const char*)row.data(), row.size() * sizeof(float));
+	}
+	return file.good();
+}
+
+///////////////////////////////////////////
+// Tree quality
+///////////////////////////////////////////
+// Area of the part of the triangle inside the box, clipped against the six planes (Sutherland-Hodgman)
+static float getClippedArea(const vec3* pTriangle, const BvhBounds& box)
+{
+	// Every plane adds at most one vertex
+	vec3 polygons[2][9];
+	std::copy(pTriangle, pTriangle + 3, polygons[0]);
+	uint32_t count = 3;
+	uint32_t current = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int side = 0; side < 2; side++)
+		{
+			const vec3* pIn = polygons[current];
+			vec3* pOut = polygons[current ^ 1];
+			float plane = side ? box.max[axis] : box.min[axis];
+			float sign = side ? -1.0f : 1.0f;
+			uint32_t outCount = 0;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const vec3& a = pIn[i];
+				const vec3& b = pIn[(i + 1) % count];
+				float da = sign * (a[axis] - plane);
+				float db = sign * (b[axis] - plane);
+				if (da >= 0.0f)
+				{
+					pOut[outCount++] = a;
+				}
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					pOut[outCount++] = a + (b - a) * (da / (da - db));
+				}
+			}
+			count = outCount;
+			current ^= 1;
+			if (count < 3)
+			{
+				return 0.0f;
+			}
+		}
+	}
+
+	const vec3* pPolygon = polygons[current];
+	vec3 normal(0.0f);
+	for (uint32_t i = 1; i + 1 < count; i++)
+	{
+		normal += cross(pPolygon[i] - pPolygon[0], pPolygon[i + 1] - pPolygon[0]);
+	}
+	return 0.5f * length(normal);
+}
+
+static bool overlaps(const BvhBounds& a, const BvhNode& node)
+{
+	return all(lessThanEqual(a.min, node.boundsMax)) && all(lessThanEqual(node.boundsMin, a.max));
+}
+
+/*
+	Per triangle: walk down every node whose box it touches. Where none of its references (several with spatial splits)
+	is in the subtree, the clipped area counts for the node. Children lie inside their parent, so a node without any
+	of the triangle inside ends the walk.
+*/
+static float computeEpo(const std::vector<MeshView>& geometries, const Bvh& bvh, const BvhBuildSettings& settings, TaskPool& pool)
+{
+	std::vector<uint32_t> firstTriangle(geometries.size() + 1, 0);
+	for (size_t g = 0; g < geometries.size(); g++)
+	{
+		firstTriangle[g + 1] = firstTriangle[g] + geometries[g].indexCount / 3;
+	}
+
+	// Triangle in the high half, reference in the low half, sorted so the references of a triangle are next to each other
+	std::vector<uint64_t> keys(bvh.primitives.size());
+	for (uint32_t p = 0; p < (uint32_t)bvh.primitives.size(); p++)
+	{
+		keys[p] = (uint64_t)(firstTriangle[bvh.primitives[p].geometry] + bvh.primitives[p].triangle) << 32 | p;
+	}
+	std::sort(keys.begin(), keys.end());
+	std::vector<uint32_t> groups;
+	for (uint32_t k = 0; k < (uint32_t)keys.size(); k++)
+	{
+		if (k == 0 || (keys[k] >> 32) != (keys[k - 1] >> 32))
+		{
+			groups.push_back(k);
+		}
+	}
+	uint32_t numGroups = (uint32_t)groups.size();
+	groups.push_back((uint32_t)keys.size());
+
+	// References of every subtree, contiguous since leaves are stored in order. Children come after their parent.
+	std::vector<uint32_t> subtreeBegin(bvh.nodes.size()), subtreeEnd(bvh.nodes.size());
+	for (uint32_t n = bvh.getNumNodes(); n-- > 0;)
+	{
+		const BvhNode& node = bvh.nodes[n];
+		if (node.isLeaf())
+		{
+			subtreeBegin[n] = node.firstChildOrPrimitive;
+			subtreeEnd[n] = node.firstChildOrPrimitive + node.primitiveCount;
+		}
+		else
+		{
+			subtreeBegin[n] = std::min(subtreeBegin[node.firstChildOrPrimitive], subtreeBegin[node.firstChildOrPrimitive + 1]);
+			subtreeEnd[n] = std::max(subtreeEnd[node.firstChildOrPrimitive], subtreeEnd[node.firstChildOrPrimitive + 1]);
+		}
+	}
+
+	// Partial sums per range, added in order so the result doesn't depend on the threads
+	const uint32_t kGrainSize = 256;
+	std::vector<double> rangeOverlap((numGroups + kGrainSize - 1) / kGrainSize, 0.0);
+	std::vector<double> rangeArea(rangeOverlap.size(), 0.0);
+	pool.parallelForRange(numGroups, kGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		std::vector<uint32_t> stack;
+		double overlap = 0.0;
+		double area = 0.0;
+		for (uint32_t group = begin; group < end; group++)
+		{
+			const BvhPrimitive& primitive = bvh.primitives[(uint32_t)keys[groups[group]]];
+			const MeshView& geometry = geometries[primitive.geometry];
+			const uint32_t* pIndices = geometry.indices + 3 * primitive.triangle;
+			vec3 triangle[3] = { geometry.positions[pIndices[0]], geometry.positions[pIndices[1]], geometry.positions[pIndices[2]] };
+			BvhBounds bounds;
+			for (const vec3& v : triangle)
+			{
+				bounds.grow(v);
+			}
+			area += 0.5 * length(cross(triangle[1] - triangle[0], triangle[2] - triangle[0]));
+
+			stack.assign(1, 0);
+			while (!stack.empty())
+			{
+				uint32_t n = stack.back();
+				stack.pop_back();
+				const BvhNode& node = bvh.nodes[n];
+				if (!overlaps(bounds, node))
+				{
+					continue;
+				}
+				bool inSubtree = false;
+				for (uint32_t k = groups[group]; k < groups[group + 1] && !inSubtree; k++)
+				{
+					uint32_t reference = (uint32_t)keys[k];
+					inSubtree = reference >= subtreeBegin[n] && reference < subtreeEnd[n];
+				}
+				if (!inSubtree)
+				{
+					float clippedArea = getClippedArea(triangle, node.getBounds());
+					if (clippedArea == 0.0f)
+					{
+						continue;
+					}
+					overlap += clippedArea * (node.isLeaf() ? settings.intersectionCost * node.primitiveCount : settings.traversalCost);
+				}
+				if (!node.isLeaf())
+				{
+					stack.push_back(node.firstChildOrPrimitive + 1);
+					stack.push_back(node.firstChildOrPrimitive);
+				}
+			}
+		}
+		rangeOverlap[begin / kGrainSize] = overlap;
+		rangeArea[begin / kGrainSize] = area;
+	});
+
+	double overlap = 0.0;
+	double area = 0.0;
+	for (size_t r = 0; r < rangeOverlap.size(); r++)
+	{
+		overlap += rangeOverlap[r];
+		area += rangeArea[r];
+	}
+	return area > 0.0 ? (float)(overlap / area) : 0.0f;
+}
+
+BvhQuality computeBvhQuality(const std::vector<MeshView>& geometries, const Bvh& bvh, const BvhBuildSettings& settings, TaskPool* pPool)
+{
+	BvhQuality quality;
+	if (bvh.nodes.empty())
+	{
+		return quality;
+	}
+	quality.sahCost = computeSahCost(bvh, settings);
+	quality.overlap = computeBvhOverlap(bvh);
+	quality.numNodes = bvh.getNumNodes();
+
+	std::vector<uint32_t> depth(bvh.nodes.size(), 1);
+	for (uint32_t n = 0; n < bvh.getNumNodes(); n++)
+	{
+		const BvhNode& node = bvh.nodes[n];
+		quality.maxDepth = std::max(quality.maxDepth, depth[n]);
+		if (!node.isLeaf())
+		{
+			depth[node.firstChildOrPrimitive] = depth[node.firstChildOrPrimitive + 1] = depth[n] + 1;
+			continue;
+		}
+		quality.numLeaves++;
+		if (quality.leafSizes.size() <= node.primitiveCount)
+		{
+			quality.leafSizes.resize(node.primitiveCount + 1, 0);
+		}
+		quality.leafSizes[node.primitiveCount]++;
+		if (quality.leafDepths.size() <= depth[n])
+		{
+			quality.leafDepths.resize(depth[n] + 1, 0);
+		}
+		quality.leafDepths[depth[n]]++;
+	}
+
+	if (!geometries.empty())
+	{
+		quality.epo = computeEpo(geometries, bvh, settings, pPool ? *pPool : TaskPool::getGlobal());
+	}
+	return quality;
+}
+#endif
@@ -0,0 +1,116 @@
+#pragma once
+#include "Bvh.h"
+
+///////////////////////////////////////////
+// Acceleration structure statistics
+///////////////////////////////////////////
+/*
+	Instrumentation of the CPU acceleration structures, to tell a worse tree from slower shading when ray throughput
+	drops: quality metrics of a built Bvh, and counters of the node visits and triangle tests of every traversal in
+	CpuRaytracing and WideBvh, which can be recorded per pixel and written out as a heatmap.
+
+	Debug builds only. With NDEBUG nothing here is declared and AS_STATS_ADD in the traversal loops expands to nothing,
+	so release builds trace exactly as before. Define AS_STATS in the project to get them in an optimized build.
+*/
+#if !defined(NDEBUG) && !defined(AS_STATS)
+#define AS_STATS
+#endif
+
+#ifdef AS_STATS
+
+enum class TraversalCounter
+{
+	Nodes,		// BVH nodes entered, TLAS and BLAS. Binary leaves are nodes, the triangle blocks of a wide tree are not.
+	Triangles,	// triangle tests, a wide leaf counts all its triangles
+	Instances,	// BLASes traversed
+};
+
+const char* getTraversalCounterName(TraversalCounter counter);
+
+struct TraversalCounters
+{
+	uint32_t	nodes = 0;
+	uint32_t	triangles = 0;
+	uint32_t	instances = 0;
+
+	uint32_t get(TraversalCounter counter) const;
+	TraversalCounters& operator+=(const TraversalCounters& c) { nodes += c.nodes; triangles += c.triangles; instances += c.instances; return *this; }
+
+	// Wraps like the counters do, so the difference around a traversal is right even after they overflowed
+	TraversalCounters operator-(const TraversalCounters& c) const
+	{
+		TraversalCounters d;
+		d.nodes = nodes - c.nodes;
+		d.triangles = triangles - c.triangles;
+		d.instances = instances - c.instances;
+		return d;
+	}
+};
+
+// Counters of every traversal on this thread so far, the difference around a TraceRay gives the counts of that ray
+extern thread_local TraversalCounters gTraversalCounters;
+
+#define AS_STATS_ADD(counter, n) (gTraversalCounters.counter += (uint32_t)(n))
+
+/*
+	Counters per pixel, in the layout of the DispatchRays output: width x height pixels, row y (DispatchRaysIndex().y,
+	top down) at y * width. Rays of one pixel add up, so a pixel can hold its camera ray and all its shadow rays.
+*/
+class TraversalStatsImage
+{
+public:
+	void resize(uint32_t width, uint32_t height);
+	void clear();
+
+	// Not synchronized, threads must record disjoint pixels
+	void add(uint32_t x, uint32_t y, const TraversalCounters& counters) { mPixels[y * mWidth + x] += counters; }
+	const TraversalCounters& get(uint32_t x, uint32_t y) const { return mPixels[y * mWidth + x]; }
+
+	uint32_t	getWidth() const { return mWidth; }
+	uint32_t	getHeight() const { return mHeight; }
+	uint32_t	getMax(TraversalCounter counter) const;
+	double		getTotal(TraversalCounter counter) const;
+
+	/*
+		Heatmap of one counter as float4 pixels in the format and layout of the RT output textures (RGBA32F,
+		mpRtDirectOutput), so it can be uploaded in their place: black at 0, then blue, green, yellow and red at
+		maxValue and above. maxValue 0 takes the largest value of the image.
+	*/
+	void getHeatmap(TraversalCounter counter, uint32_t maxValue, std::vector<vec4>& pixels) const;
+
+	// The heatmap as a PFM, rows bottom up as the format wants. False if the file couldn't be written.
+	bool saveHeatmap(const char* pFileName, TraversalCounter counter, uint32_t maxValue = 0) const;
+
+private:
+	std::vector<TraversalCounters>	mPixels;
+	uint32_t						mWidth = 0;
+	uint32_t						mHeight = 0;
+};
+
+struct BvhQuality
+{
+	float					sahCost = 0.0f;		// computeSahCost
+	float					epo = 0.0f;			// end point overlap, see computeBvhQuality
+	float					overlap = 0.0f;		// computeBvhOverlap
+	uint32_t				numNodes = 0;
+	uint32_t				numLeaves = 0;
+	uint32_t				maxDepth = 0;		// computeBvhDepth
+	std::vector<uint32_t>	leafSizes;			// [n]: leaves with n primitives
+	std::vector<uint32_t>	leafDepths;			// [d]: leaves at depth d, the root is at depth 1
+};
+
+/*
+	SAH cost, overlap, histograms and the EPO (Aila et al. 2013) of a tree built over geometries. EPO is the area of the
+	triangles that lie inside the box of a node without being in its subtree, which rays hitting them have to visit in
+	vain, weighted with traversalCost for interior nodes and intersectionCost times the primitive count for leaves,
+	relative to the total triangle area. It sees the overlap SAH misses where boxes are small but full of other triangles.
+	The triangles are clipped against the boxes they touch, in parallel on the pool. A tree over boxes (a TLAS) has
+	no triangles, pass no geometries and the EPO stays 0.
+*/
+BvhQuality computeBvhQuality(const std::vector<MeshView>& geometries, const Bvh& bvh, const BvhBuildSettings& settings, TaskPool* pPool = nullptr);
+
+#else
+
+#define AS_STATS_ADD(counter, n) ((void)0)
+
+#endif
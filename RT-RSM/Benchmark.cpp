@@ -0,0 +1,3046 @@
+#include "Benchmark.h"
+#include "AsStats.h"
+#include "BlasRefitPolicy.h"
+#include "Bvh.h"
+#include "BvhCache.h"
+#include "CommandStream.h"
+#include "CpuAsManager.h"
+#include "CpuFrameScene.h"
+#include "CpuRaytracing.h"
+#include "FrustumCulling.h"
+#include "GeometryAllocator.h"
+#include "IndexOptimizer.h"
+#include "MeshCache.h"
+#include "MeshInstancing.h"
+#include "Meshlet.h"
+#include "MeshQuantization.h"
+#include "MeshSimplifier.h"
+#include "MeshUpload.h"
+#include "SceneInstances.h"
+#include "TlasUpdatePolicy.h"
+#include "Externals/GLM/glm/gtc/matrix_transform.hpp"
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdarg.h>
+#include <stdio.h>
+#include <algorithm>
+#include <assert.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+static const char* kBenchmarkScenes[] =
+{
+	"Data/Models/SunTemple/sunTemple2.fbx",
+	"Data/Models/sponza.fbx",
+	"Data/Models/room_complete.fbx",
+	"Data/Models/robot.fbx",
+	"Data/Models/teapot.fbx",
+};
+
+#ifdef CPU_BENCHMARKS
+/*
+	Every heap allocation of the process goes through here, so a benchmark can check that a path doesn't allocate. Only
+	with CPU_BENCHMARKS, the renderer keeps the CRT allocator otherwise. All replaceable forms are defined, so memory is
+	always freed by the allocator that allocated it.
+*/
+static std::atomic<uint64_t> gAllocationCount(0);
+static const bool kAllocationsCounted = true;
+
+static void* countedAlloc(size_t size)
+{
+	gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size > 0 ? size : 1);
+}
+
+static void* countedAlloc(size_t size, size_t alignment)
+{
+	gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	size = size > 0 ? size : 1;
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void* pData = nullptr;
+	return posix_memalign(&pData, std::max(alignment, sizeof(void*)), size) == 0 ? pData : nullptr;
+#endif
+}
+
+static void countedAlignedFree(void* pData)
+{
+#ifdef _WIN32
+	_aligned_free(pData);
+#else
+	free(pData);
+#endif
+}
+
+static void* throwIfNull(void* pData)
+{
+	if (pData == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return pData;
+}
+
+void* operator new(size_t size) { return throwIfNull(countedAlloc(size)); }
+void* operator new[](size_t size) { return throwIfNull(countedAlloc(size)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void operator delete(void* pData) noexcept { free(pData); }
+void operator delete[](void* pData) noexcept { free(pData); }
+void operator delete(void* pData, size_t) noexcept { free(pData); }
+void operator delete[](void* pData, size_t) noexcept { free(pData); }
+void operator delete(void* pData, const std::nothrow_t&) noexcept { free(pData); }
+void operator delete[](void* pData, const std::nothrow_t&) noexcept { free(pData); }
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment) { return throwIfNull(countedAlloc(size, (size_t)alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return throwIfNull(countedAlloc(size, (size_t)alignment)); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAlloc(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAlloc(size, (size_t)alignment); }
+void operator delete(void* pData, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete[](void* pData, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete(void* pData, size_t, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete[](void* pData, size_t, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete(void* pData, std::align_val_t, const std::nothrow_t&) noexcept { countedAlignedFree(pData); }
+void operator delete[](void* pData, std::align_val_t, const std::nothrow_t&) noexcept { countedAlignedFree(pData); }
+#endif
+
+static uint64_t getAllocationCount() { return gAllocationCount.load(); }
+#else
+// Without CPU_BENCHMARKS the allocations aren't counted and the checks that need them are skipped
+static const bool kAllocationsCounted = false;
+static uint64_t getAllocationCount() { return 0; }
+#endif
+
+static std::string format(const char* pFormat, ...)
+{
+	char buffer[1024];
+	va_list args;
+	va_start(args, pFormat);
+	vsnprintf(buffer, sizeof(buffer), pFormat, args);
+	va_end(args);
+	return buffer;
+}
+
+static bool fileExists(const char* pFileName)
+{
+	std::ifstream file(pFileName);
+	return file.good();
+}
+
+void benchmarkLog(const std::string& line)
+{
+#ifdef _WIN32
+	OutputDebugStringA((line + "\n").c_str());
+#endif
+	std::cout << line << std::endl;
+	std::ofstream report("benchmark.txt", std::ios::app);
+	report << line << std::endl;
+}
+
+// Copy every mesh into a staging area, standing in for the memcpy into the upload buffers
+static uint64_t stageMeshes(const MeshCache& cache, std::vector<uint8_t>& staging)
+{
+	uint64_t bytes = 0;
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		MeshView mesh = cache.getMesh(i);
+		bytes += 2 * mesh.vertexCount * sizeof(vec3) + mesh.indexCount * sizeof(uint32_t);
+	}
+	staging.resize(bytes);
+
+	uint8_t* pDst = staging.data();
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		MeshView mesh = cache.getMesh(i);
+		memcpy(pDst, mesh.positions, mesh.vertexCount * sizeof(vec3));
+		pDst += mesh.vertexCount * sizeof(vec3);
+		memcpy(pDst, mesh.normals, mesh.vertexCount * sizeof(vec3));
+		pDst += mesh.vertexCount * sizeof(vec3);
+		memcpy(pDst, mesh.indices, mesh.indexCount * sizeof(uint32_t));
+		pDst += mesh.indexCount * sizeof(uint32_t);
+	}
+	return bytes;
+}
+
+void benchmarkMeshCache(const char* pFileName)
+{
+	const int kWarmRuns = 5;
+	std::vector<uint8_t> staging;
+
+	// Cold: no cache on disk, full assimp import
+	remove(MeshCache::getCachePath(pFileName).c_str());
+	double coldMs;
+	uint64_t bytes;
+	{
+		BenchmarkTimer timer;
+		Assimp::Importer importer;
+		MeshCache cache;
+		if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+		{
+			benchmarkLog(format("Mesh cache: failed to import %s", pFileName));
+			return;
+		}
+		bytes = stageMeshes(cache, staging);
+		coldMs = timer.getElapsedMs();
+	}
+
+	// Warm: the cache written by the cold run is mapped, assimp is never touched
+	double warmMs = 0.0;
+	for (int run = 0; run < kWarmRuns; run++)
+	{
+		BenchmarkTimer timer;
+		MeshCache cache;
+		if (!cache.open(pFileName, kMultipleMeshProcessFlags))
+		{
+			benchmarkLog(format("Mesh cache: cache for %s could not be opened", pFileName));
+			return;
+		}
+		stageMeshes(cache, staging);
+		warmMs += timer.getElapsedMs();
+	}
+	warmMs /= kWarmRuns;
+
+	benchmarkLog(format("Mesh cache: %-40s %8.2f MB  cold import %9.2f ms  warm cache %8.2f ms  (%.1fx)",
+		pFileName, bytes / (1024.0 * 1024.0), coldMs, warmMs, coldMs / std::max(warmMs, 1e-3)));
+}
+
+// 1, 2, 4, ... up to the number of hardware threads
+static std::vector<uint32_t> getThreadCounts()
+{
+	std::vector<uint32_t> counts;
+	uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t n = 1; n < maxThreads; n *= 2)
+	{
+		counts.push_back(n);
+	}
+	counts.push_back(maxThreads);
+	return counts;
+}
+
+void benchmarkMeshIngestion(const char* pFileName)
+{
+	const int kRuns = 3;
+	Assimp::Importer importer;
+	const aiScene* pScene = importer.ReadFile(pFileName, kMultipleMeshProcessFlags);
+	if (pScene == nullptr)
+	{
+		benchmarkLog(format("Mesh ingestion: failed to import %s", pFileName));
+		return;
+	}
+
+	uint64_t numTriangles = 0;
+	for (uint32_t m = 0; m < pScene->mNumMeshes; m++)
+	{
+		numTriangles += pScene->mMeshes[m]->mNumFaces;
+	}
+	benchmarkLog(format("Mesh ingestion: %s, %u meshes, %llu triangles", pFileName, pScene->mNumMeshes, (unsigned long long)numTriangles));
+
+	double baseConvertMs = 0.0;
+	double baseCopyMs = 0.0;
+	for (uint32_t numThreads : getThreadCounts())
+	{
+		TaskPool pool(numThreads - 1);
+
+		double convertMs = 0.0;
+		ImportedScene scene;
+		for (int run = 0; run < kRuns; run++)
+		{
+			scene = ImportedScene();
+			BenchmarkTimer timer;
+			convertScene(pScene, scene, &pool);
+			convertMs += timer.getElapsedMs();
+		}
+		convertMs /= kRuns;
+
+		std::vector<MeshView> meshes;
+		for (const MeshData& mesh : scene.meshes)
+		{
+			meshes.push_back(mesh.view());
+		}
+		MeshUploadBatch batch;
+		batch.build(meshes);
+		std::vector<std::vector<uint8_t>> destinations(batch.getNumBuffers());
+		std::vector<uint8_t*> ppDst(batch.getNumBuffers());
+		for (uint32_t b = 0; b < batch.getNumBuffers(); b++)
+		{
+			destinations[b].resize(batch.getBuffers()[b].size);
+			ppDst[b] = destinations[b].data();
+		}
+		double copyMs = 0.0;
+		for (int run = 0; run < kRuns; run++)
+		{
+			BenchmarkTimer timer;
+			batch.copy(ppDst.data(), &pool);
+			copyMs += timer.getElapsedMs();
+		}
+		copyMs /= kRuns;
+
+		if (numThreads == 1)
+		{
+			baseConvertMs = convertMs;
+			baseCopyMs = copyMs;
+		}
+		benchmarkLog(format("  %2u threads: convert %8.2f ms (%.2fx)  upload copy %8.2f ms (%.2fx, %.1f MB)",
+			numThreads, convertMs, baseConvertMs / std::max(convertMs, 1e-3), copyMs, baseCopyMs / std::max(copyMs, 1e-3),
+			batch.getTotalSize() / (1024.0 * 1024.0)));
+	}
+}
+
+// Sanity check of the allocator state: live ranges must be aligned, inside the capacity and must not overlap
+static bool validateAllocations(const GeometryAllocator& allocator, const std::vector<GeometryAllocation>& allocations, const std::vector<uint64_t>& alignments)
+{
+	std::vector<std::pair<uint64_t, uint64_t>> ranges;
+	for (size_t i = 0; i < allocations.size(); i++)
+	{
+		if (allocations[i].id == kInvalidGeometryAllocation)
+		{
+			continue;
+		}
+		uint64_t offset = allocator.getOffset(allocations[i].id);
+		if (offset % alignments[i] != 0 || offset + allocations[i].size > allocator.getCapacity())
+		{
+			return false;
+		}
+		ranges.push_back(std::make_pair(offset, offset + allocations[i].size));
+	}
+	std::sort(ranges.begin(), ranges.end());
+	for (size_t i = 1; i < ranges.size(); i++)
+	{
+		if (ranges[i].first < ranges[i - 1].second)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void benchmarkGeometryAllocator(const char* pFileName)
+{
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Geometry allocator: failed to import %s", pFileName));
+		return;
+	}
+
+	// The buffers Model creates for every mesh, plus the colour and 256-byte aligned transform buffer of the model
+	std::vector<uint64_t> sizes;
+	std::vector<uint64_t> alignments;
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		MeshView mesh = cache.getMesh(i);
+		sizes.push_back(mesh.vertexCount * sizeof(vec3));
+		sizes.push_back(mesh.indexCount * sizeof(uint32_t));
+		sizes.push_back(mesh.vertexCount * sizeof(vec3));
+	}
+	sizes.push_back(cache.getNumMeshes() * sizeof(vec3));
+	alignments.assign(sizes.size(), kGeometryAlignment);
+	sizes.push_back(2 * sizeof(mat4));
+	alignments.push_back(256);
+
+	uint64_t dataSize = 0;
+	uint64_t committedSize = 0;
+	for (uint64_t size : sizes)
+	{
+		dataSize += size;
+		committedSize += alignUp(std::max<uint64_t>(size, 1), kCommittedResourceAlignment);
+	}
+
+	GeometryAllocator allocator(std::max(kGeometryArenaPageSize, alignUp(2 * dataSize, kCommittedResourceAlignment)));
+	std::vector<GeometryAllocation> allocations(sizes.size());
+	BenchmarkTimer allocTimer;
+	for (size_t i = 0; i < sizes.size(); i++)
+	{
+		allocator.allocate(sizes[i], alignments[i], allocations[i]);
+	}
+	double allocMs = allocTimer.getElapsedMs();
+	GeometryAllocatorStats stats = allocator.getStats();
+
+	benchmarkLog(format("Geometry allocator: %s, %u buffers, %.2f MB of data", pFileName, (uint32_t)sizes.size(), dataSize / (1024.0 * 1024.0)));
+	benchmarkLog(format("  committed resources: %8.2f MB (%.2f MB alignment waste)", committedSize / (1024.0 * 1024.0), (committedSize - dataSize) / (1024.0 * 1024.0)));
+	benchmarkLog(format("  arena:               %8.2f MB (%.1f KB alignment padding), allocated in %.3f ms",
+		(stats.usedBytes + stats.paddingBytes) / (1024.0 * 1024.0), stats.paddingBytes / 1024.0, allocMs));
+
+	// Churn: free every other buffer and allocate them again with shuffled sizes, as streaming models in and out would
+	std::vector<uint64_t> churnSizes = sizes;
+	uint32_t seed = 1;
+	for (size_t i = churnSizes.size(); i > 1; i--)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		std::swap(churnSizes[i - 1], churnSizes[seed % i]);
+	}
+	uint32_t failed = 0;
+	for (size_t i = 0; i < allocations.size(); i += 2)
+	{
+		allocator.free(allocations[i].id);
+		allocations[i] = GeometryAllocation();
+	}
+	for (size_t i = 0; i < allocations.size(); i += 2)
+	{
+		if (!allocator.allocate(churnSizes[i], alignments[i], allocations[i]))
+		{
+			allocations[i] = GeometryAllocation();
+			failed++;
+		}
+	}
+	bool valid = validateAllocations(allocator, allocations, alignments);
+	benchmarkLog(format("  after churn:         %s, %u failed%s", allocator.getReport().c_str(), failed, valid ? "" : ", INVALID STATE"));
+
+	BenchmarkTimer defragTimer;
+	std::vector<GeometryMove> moves = allocator.defragment();
+	double defragMs = defragTimer.getElapsedMs();
+	uint64_t movedBytes = 0;
+	for (const GeometryMove& move : moves)
+	{
+		movedBytes += move.size;
+	}
+	valid = validateAllocations(allocator, allocations, alignments);
+	benchmarkLog(format("  after defragment:    %s, %u moves (%.2f MB) in %.3f ms%s",
+		allocator.getReport().c_str(), (uint32_t)moves.size(), movedBytes / (1024.0 * 1024.0), defragMs, valid ? "" : ", INVALID STATE"));
+}
+
+void benchmarkMeshInstancing(const char* pFileName)
+{
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Mesh instancing: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> meshes(cache.getNumMeshes());
+	uint64_t totalBytes = 0;
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		meshes[i] = cache.getMesh(i);
+		totalBytes += 2 * meshes[i].vertexCount * sizeof(vec3) + meshes[i].indexCount * sizeof(uint32_t);
+	}
+
+	MeshInstancing instancing;
+	BenchmarkTimer timer;
+	findDuplicateMeshes(meshes, instancing);
+	double detectMs = timer.getElapsedMs();
+
+	uint64_t savedBytes = instancing.getSavedBytes(meshes);
+	benchmarkLog(format("Mesh instancing: %-40s BLAS %4u -> %4u  geometry %8.2f MB -> %8.2f MB (%.1f%% saved)  detection %.2f ms",
+		pFileName, (uint32_t)meshes.size(), instancing.getNumUnique(),
+		totalBytes / (1024.0 * 1024.0), (totalBytes - savedBytes) / (1024.0 * 1024.0),
+		totalBytes > 0 ? 100.0 * savedBytes / totalBytes : 0.0, detectMs));
+}
+
+// Time MeshUploadBatch::copy into host memory for the given vertex layout
+static double timeUploadCopy(const std::vector<MeshView>& meshes, VertexLayout layout, uint64_t& vertexStreamBytes)
+{
+	MeshUploadBatch batch;
+	batch.build(meshes, layout);
+	std::vector<std::vector<uint8_t>> destinations(batch.getNumBuffers());
+	std::vector<uint8_t*> ppDst(batch.getNumBuffers());
+	vertexStreamBytes = 0;
+	for (uint32_t b = 0; b < batch.getNumBuffers(); b++)
+	{
+		destinations[b].resize(batch.getBuffers()[b].size);
+		ppDst[b] = destinations[b].data();
+		if (batch.getBuffers()[b].type != MeshBufferType::Index)
+		{
+			vertexStreamBytes += batch.getBuffers()[b].size;
+		}
+	}
+	BenchmarkTimer timer;
+	batch.copy(ppDst.data());
+	return timer.getElapsedMs();
+}
+
+void benchmarkVertexQuantization(const char* pFileName)
+{
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Vertex quantization: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> meshes(cache.getNumMeshes());
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		meshes[i] = cache.getMesh(i);
+	}
+
+	// Worst mesh relative to its own bound, and the normal error over the whole scene
+	float worstPositionRatio = 0.0f;
+	float maxPositionError = 0.0f;
+	float maxNormalError = 0.0f;
+	double meanNormalError = 0.0;
+	uint64_t numVertices = 0;
+	for (const MeshView& mesh : meshes)
+	{
+		QuantizationError error = measureQuantizationError(mesh);
+		maxPositionError = std::max(maxPositionError, error.maxPositionError);
+		if (error.maxPositionErrorBound > 0.0f)
+		{
+			worstPositionRatio = std::max(worstPositionRatio, error.maxPositionError / error.maxPositionErrorBound);
+		}
+		maxNormalError = std::max(maxNormalError, error.maxNormalErrorDegrees);
+		meanNormalError += error.meanNormalErrorDegrees * mesh.vertexCount;
+		numVertices += mesh.vertexCount;
+	}
+	meanNormalError /= std::max<uint64_t>(numVertices, 1);
+
+	uint64_t floatBytes, quantizedBytes;
+	double floatMs = timeUploadCopy(meshes, VertexLayout::Float, floatBytes);
+	double quantizedMs = timeUploadCopy(meshes, VertexLayout::Quantized, quantizedBytes);
+
+	benchmarkLog(format("Vertex quantization: %s, %llu vertices", pFileName, (unsigned long long)numVertices));
+	benchmarkLog(format("  position error: max %.6f model units, %.2f of the AABB bound (must be <= 1)", maxPositionError, worstPositionRatio));
+	benchmarkLog(format("  normal error:   max %.4f deg, mean %.4f deg", maxNormalError, meanNormalError));
+	benchmarkLog(format("  vertex streams: %.2f MB -> %.2f MB (%.0f%%), upload copy %.2f ms -> %.2f ms",
+		floatBytes / (1024.0 * 1024.0), quantizedBytes / (1024.0 * 1024.0), 100.0 * quantizedBytes / std::max<uint64_t>(floatBytes, 1), floatMs, quantizedMs));
+}
+
+// Sum of the FIFO cache simulation over all meshes
+static VertexCacheStats simulateScene(const std::vector<MeshData>& meshes, uint32_t cacheSize)
+{
+	VertexCacheStats total;
+	total.cacheSize = cacheSize;
+	for (const MeshData& mesh : meshes)
+	{
+		VertexCacheStats stats = simulateVertexCache(mesh.indices.data(), (uint32_t)mesh.indices.size(), (uint32_t)mesh.positions.size(), cacheSize);
+		total.triangleCount += stats.triangleCount;
+		total.vertexCount += stats.vertexCount;
+		total.transformCount += stats.transformCount;
+	}
+	return total;
+}
+
+void benchmarkIndexOptimization(const char* pFileName)
+{
+	static const uint32_t kCacheSizes[] = { 16, 32 };
+
+	// Straight from assimp, importScene would already optimize the meshes
+	Assimp::Importer importer;
+	const aiScene* pScene = importer.ReadFile(pFileName, kMultipleMeshProcessFlags);
+	if (pScene == nullptr)
+	{
+		benchmarkLog(format("Index optimization: failed to import %s", pFileName));
+		return;
+	}
+	ImportedScene scene;
+	convertScene(pScene, scene);
+
+	std::vector<VertexCacheStats> before;
+	for (uint32_t cacheSize : kCacheSizes)
+	{
+		before.push_back(simulateScene(scene.meshes, cacheSize));
+	}
+
+	BenchmarkTimer timer;
+	TaskPool::getGlobal().parallelFor((uint32_t)scene.meshes.size(), [&](uint32_t m)
+	{
+		optimizeMesh(scene.meshes[m]);
+	});
+	double optimizeMs = timer.getElapsedMs();
+
+	uint64_t indexBytes32 = 0;
+	uint64_t indexBytes = 0;
+	uint32_t numShortMeshes = 0;
+	for (const MeshData& mesh : scene.meshes)
+	{
+		uint32_t vertexCount = (uint32_t)mesh.positions.size();
+		indexBytes32 += mesh.indices.size() * sizeof(uint32_t);
+		indexBytes += mesh.indices.size() * getIndexSize(vertexCount);
+		numShortMeshes += useShortIndices(vertexCount) ? 1 : 0;
+	}
+
+	benchmarkLog(format("Index optimization: %s, %u meshes, %u triangles, optimized in %.2f ms", pFileName, (uint32_t)scene.meshes.size(), before[0].triangleCount, optimizeMs));
+	for (uint32_t c = 0; c < (uint32_t)before.size(); c++)
+	{
+		VertexCacheStats after = simulateScene(scene.meshes, kCacheSizes[c]);
+		benchmarkLog(format("  FIFO %2u: ACMR %.3f -> %.3f  ATVR %.3f -> %.3f", kCacheSizes[c], before[c].getACMR(), after.getACMR(), before[c].getATVR(), after.getATVR()));
+	}
+	benchmarkLog(format("  index buffers: %u of %u meshes 16-bit, %.2f MB -> %.2f MB", numShortMeshes, (uint32_t)scene.meshes.size(),
+		indexBytes32 / (1024.0 * 1024.0), indexBytes / (1024.0 * 1024.0)));
+}
+
+void benchmarkMeshlets(const char* pFileName)
+{
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Meshlets: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> meshes(cache.getNumMeshes());
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		meshes[i] = cache.getMesh(i);
+	}
+	MeshInstancing instancing;
+	findDuplicateMeshes(meshes, instancing);
+
+	MeshletTable table;
+	BenchmarkTimer timer;
+	buildMeshletTable(meshes, &instancing, table);
+	double buildMs = timer.getElapsedMs();
+
+	uint64_t numVertices = 0;
+	uint64_t numTriangles = 0;
+	uint32_t numCullableCones = 0;
+	for (uint32_t m = 0; m < table.getNumMeshlets(); m++)
+	{
+		numVertices += table.vertexCount[m];
+		numTriangles += table.indexCount[m] / 3;
+		numCullableCones += table.normalCones[m].w < 1.0f ? 1 : 0;
+	}
+	uint32_t numMeshlets = std::max(table.getNumMeshlets(), 1u);
+	benchmarkLog(format("Meshlets: %-40s %6u meshlets  %5.1f vertices (%.0f%%)  %5.1f triangles (%.0f%%) per meshlet  %.0f%% with a normal cone  build %.2f ms",
+		pFileName, table.getNumMeshlets(),
+		(double)numVertices / numMeshlets, 100.0 * numVertices / ((double)numMeshlets * kMaxMeshletVertices),
+		(double)numTriangles / numMeshlets, 100.0 * numTriangles / ((double)numMeshlets * kMaxMeshletTriangles),
+		100.0 * numCullableCones / numMeshlets, buildMs));
+}
+
+void benchmarkMeshLods(const char* pFileName)
+{
+	// Straight from assimp, importScene would already build the LODs
+	Assimp::Importer importer;
+	const aiScene* pScene = importer.ReadFile(pFileName, kMultipleMeshProcessFlags);
+	if (pScene == nullptr)
+	{
+		benchmarkLog(format("Mesh LODs: failed to import %s", pFileName));
+		return;
+	}
+	ImportedScene scene;
+	convertScene(pScene, scene);
+	TaskPool::getGlobal().parallelFor((uint32_t)scene.meshes.size(), [&](uint32_t m)
+	{
+		optimizeMesh(scene.meshes[m]);
+	});
+
+	BenchmarkTimer timer;
+	TaskPool::getGlobal().parallelFor((uint32_t)scene.meshes.size(), [&](uint32_t m)
+	{
+		generateLods(scene.meshes[m]);
+	});
+	double simplifyMs = timer.getElapsedMs();
+
+	uint64_t triangles[kMaxMeshLods] = {};
+	uint32_t meshesWithLods[kMaxMeshLods] = {};
+	float maxError[kMaxMeshLods] = {};
+	for (const MeshData& mesh : scene.meshes)
+	{
+		MeshView view = mesh.view();
+		for (uint32_t l = 0; l < kMaxMeshLods; l++)
+		{
+			triangles[l] += getLodTriangleCount(view, l);
+		}
+		for (uint32_t l = 1; l <= view.lodCount; l++)
+		{
+			meshesWithLods[l]++;
+			maxError[l] = std::max(maxError[l], view.lods[l - 1].error);
+		}
+	}
+
+	benchmarkLog(format("Mesh LODs: %s, %u meshes, %llu triangles, simplified in %.2f ms", pFileName, (uint32_t)scene.meshes.size(), (unsigned long long)triangles[0], simplifyMs));
+	for (uint32_t l = 1; l < kMaxMeshLods; l++)
+	{
+		benchmarkLog(format("  LOD %u: %llu triangles (-%.1f%%), %u meshes simplified, max error %.4f of the mesh size", l, (unsigned long long)triangles[l],
+			triangles[0] ? 100.0 - 100.0 * triangles[l] / triangles[0] : 0.0, meshesWithLods[l], maxError[l]));
+	}
+}
+
+/*
+	Every triangle in exactly one leaf, children inside their parent and leaves around their triangles. With spatial
+	splits a triangle may be in several leaves, each around a part of it, so leaves only have to touch their triangles.
+*/
+static bool validateBvh(const std::vector<MeshView>& geometries, const Bvh& bvh, bool spatialSplits = false)
+{
+	std::vector<std::vector<uint8_t>> seen(geometries.size());
+	uint64_t numTriangles = 0;
+	for (size_t g = 0; g < geometries.size(); g++)
+	{
+		seen[g].resize(geometries[g].indexCount / 3, 0);
+		numTriangles += geometries[g].indexCount / 3;
+	}
+	if (spatialSplits ? bvh.primitives.size() < numTriangles : bvh.primitives.size() != numTriangles)
+	{
+		return false;
+	}
+
+	auto contains = [](const BvhBounds& outer, const BvhBounds& inner)
+	{
+		return all(lessThanEqual(outer.min, inner.min)) && all(greaterThanEqual(outer.max, inner.max));
+	};
+	auto touches = [](const BvhBounds& a, const BvhBounds& b)
+	{
+		return all(lessThanEqual(a.min, b.max)) && all(greaterThanEqual(a.max, b.min));
+	};
+	for (const BvhNode& node : bvh.nodes)
+	{
+		if (!node.isLeaf())
+		{
+			if (node.firstChildOrPrimitive + 1 >= bvh.getNumNodes() ||
+				!contains(node.getBounds(), bvh.nodes[node.firstChildOrPrimitive].getBounds()) ||
+				!contains(node.getBounds(), bvh.nodes[node.firstChildOrPrimitive + 1].getBounds()))
+			{
+				return false;
+			}
+			continue;
+		}
+		if (node.firstChildOrPrimitive + node.primitiveCount > bvh.primitives.size())
+		{
+			return false;
+		}
+		for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+		{
+			const BvhPrimitive& primitive = bvh.primitives[p];
+			BvhBounds triangleBounds = getTriangleBounds(geometries[primitive.geometry], primitive.triangle);
+			uint8_t& triangleSeen = seen[primitive.geometry][primitive.triangle];
+			if (spatialSplits ? !touches(node.getBounds(), triangleBounds) : triangleSeen != 0 || !contains(node.getBounds(), triangleBounds))
+			{
+				return false;
+			}
+			triangleSeen = 1;
+		}
+	}
+	for (const std::vector<uint8_t>& geometrySeen : seen)
+	{
+		if (std::find(geometrySeen.begin(), geometrySeen.end(), 0) != geometrySeen.end())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void benchmarkBvhBuild(const char* pFileName)
+{
+	const int kRuns = 3;
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("BVH build: failed to import %s", pFileName));
+		return;
+	}
+
+	// The whole model as one BLAS with one geometry per mesh
+	std::vector<MeshView> geometries(cache.getNumMeshes());
+	uint64_t numTriangles = 0;
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		geometries[i] = cache.getMesh(i);
+		numTriangles += geometries[i].indexCount / 3;
+	}
+
+	BvhBuildSettings settings;
+	Bvh reference;
+	double baseMs = 0.0;
+	for (uint32_t numThreads : getThreadCounts())
+	{
+		TaskPool pool(numThreads - 1);
+		Bvh bvh;
+		double buildMs = 0.0;
+		for (int run = 0; run < kRuns; run++)
+		{
+			BenchmarkTimer timer;
+			buildBvh(geometries, settings, bvh, &pool);
+			buildMs += timer.getElapsedMs();
+		}
+		buildMs /= kRuns;
+
+		if (numThreads == 1)
+		{
+			baseMs = buildMs;
+			if (!validateBvh(geometries, bvh))
+			{
+				benchmarkLog(format("BVH build: %s FAILED validation", pFileName));
+				return;
+			}
+			uint32_t numLeaves = 0;
+			for (const BvhNode& node : bvh.nodes)
+			{
+				numLeaves += node.isLeaf() ? 1 : 0;
+			}
+			benchmarkLog(format("BVH build: %s, %u geometries, %llu triangles, %u nodes, %u leaves, SAH cost %.2f, depth %u",
+				pFileName, cache.getNumMeshes(), (unsigned long long)numTriangles, bvh.getNumNodes(), numLeaves,
+				computeSahCost(bvh, settings), computeBvhDepth(bvh)));
+			reference = std::move(bvh);
+		}
+		else if (bvh.nodes.size() != reference.nodes.size() ||
+			memcmp(bvh.nodes.data(), reference.nodes.data(), bvh.nodes.size() * sizeof(BvhNode)) != 0 ||
+			memcmp(bvh.primitives.data(), reference.primitives.data(), bvh.primitives.size() * sizeof(BvhPrimitive)) != 0)
+		{
+			benchmarkLog(format("BVH build: %s, the %u thread tree differs from the single thread one", pFileName, numThreads));
+			return;
+		}
+		benchmarkLog(format("  %2u threads: build %8.2f ms (%.2fx, %.1f M triangles/s)",
+			numThreads, buildMs, baseMs / std::max(buildMs, 1e-3), numTriangles / (1000.0 * std::max(buildMs, 1e-3))));
+	}
+}
+
+/*
+	Two copies of the model: the original with mask 0xFF and a rotated, mirrored and scaled one beside it
+	with the area light mask 0x01. BLAS b is mesh b, as the accelerationStructure of the instance descs.
+*/
+static void createTestRaytracingScene(const std::vector<MeshView>& meshes, bool wide, std::vector<CpuBlas>& blases, SceneInstances& instances, std::vector<TlasInstanceDesc>& descs)
+{
+	blases.resize(meshes.size());
+	BvhBounds sceneBounds;
+	for (uint32_t m = 0; m < (uint32_t)meshes.size(); m++)
+	{
+		blases[m].build(std::vector<MeshView>(1, meshes[m]), BvhBuildSettings(), nullptr, wide);
+		sceneBounds.grow(blases[m].getBounds());
+	}
+
+	instances.clear();
+	vec3 size = sceneBounds.isEmpty() ? vec3(1.0f) : sceneBounds.max - sceneBounds.min;
+	mat4 copyTransform = translate(mat4(1.0f), vec3(0.6f * size.x, 0.0f, 0.0f)) * rotate(mat4(1.0f), 0.5f, vec3(0.0f, 1.0f, 0.0f)) * scale(mat4(1.0f), vec3(-0.5f, 0.5f, 0.5f));
+	for (uint32_t copy = 0; copy < 2; copy++)
+	{
+		uint32_t first = instances.addModel((uint32_t)meshes.size());
+		for (uint32_t m = 0; m < (uint32_t)meshes.size(); m++)
+		{
+			instances.setInstance(first + m, m, 2 * (first + m), copy ? 0x01 : 0xFF, copy ? 0 : kInstanceFlagForceOpaque, vec3(0.0f));
+		}
+		instances.setModelTransform(copy, copy ? copyTransform : mat4(1.0f));
+	}
+	descs.resize(instances.getNumInstances());
+	instances.writeInstanceDescs(descs.data());
+}
+
+// Closest hit over every triangle of every instance in world space, in double precision
+static CpuHit traceRayBruteForce(const std::vector<MeshView>& meshes, const SceneInstances& instances, const CpuRay& ray, uint32_t rayMask)
+{
+	CpuHit hit;
+	hit.t = ray.tMax;
+	dvec3 origin(ray.origin);
+	dvec3 direction(ray.direction);
+	std::vector<TlasInstanceDesc> descs(instances.getNumInstances());
+	instances.writeInstanceDescs(descs.data());
+	for (uint32_t i = 0; i < instances.getNumInstances(); i++)
+	{
+		if ((descs[i].instanceMask & rayMask) == 0)
+		{
+			continue;
+		}
+		dmat4 transform(instances.getTransform(i));
+		bool mirrored = determinant(transform) < 0.0;
+		const MeshView& mesh = meshes[descs[i].accelerationStructure];
+		for (uint32_t triangle = 0; triangle < mesh.indexCount / 3; triangle++)
+		{
+			dvec3 v[3];
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				v[k] = dvec3(transform * dvec4(dvec3(mesh.positions[mesh.indices[3 * triangle + k]]), 1.0));
+			}
+			// Moller-Trumbore
+			dvec3 e1 = v[1] - v[0];
+			dvec3 e2 = v[2] - v[0];
+			dvec3 p = cross(direction, e2);
+			double det = dot(e1, p);
+			if (det == 0.0)
+			{
+				continue;
+			}
+			dvec3 s = origin - v[0];
+			double u = dot(s, p) / det;
+			dvec3 q = cross(s, e1);
+			double w = dot(direction, q) / det;
+			double t = dot(e2, q) / det;
+			if (u < 0.0 || w < 0.0 || u + w > 1.0 || !(t > ray.tMin && t <= hit.t))
+			{
+				continue;
+			}
+			// Clockwise seen from the origin is front facing, in object space
+			bool clockwise = dot(cross(e1, e2), direction) < 0.0;
+			hit.t = (float)t;
+			hit.barycentrics = vec2((float)u, (float)w);
+			hit.primitiveIndex = triangle;
+			hit.geometryIndex = 0;
+			hit.instanceIndex = i;
+			hit.instanceID = descs[i].instanceID;
+			hit.hitKind = clockwise != mirrored ? kHitKindTriangleFrontFace : kHitKindTriangleBackFace;
+		}
+	}
+	return hit;
+}
+
+// Random origins inside bounds, random directions
+static std::vector<CpuRay> createTestRays(const BvhBounds& bounds, uint32_t count, uint32_t seed)
+{
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	std::vector<CpuRay> rays(count);
+	for (CpuRay& ray : rays)
+	{
+		ray.origin = mix(bounds.min, bounds.max, vec3(random(), random(), random()));
+		ray.direction = normalize(vec3(random(), random(), random()) * 2.0f - 1.0f + vec3(1e-6f));
+		ray.tMin = 0.0001f;
+		ray.tMax = 100000.0f;
+	}
+	return rays;
+}
+
+/*
+	Against the brute force reference: same hit or miss, same t and hit kind, and the barycentrics and primitive
+	of the hit giving back the hit point. Rays through an edge or between coplanar triangles may pick a different
+	triangle at the same t, that's why the point is compared rather than the primitive.
+*/
+static bool validateCpuRaytracing(const std::vector<MeshView>& meshes, const SceneInstances& instances, const CpuTlas& tlas, uint32_t& numMismatches)
+{
+	const uint32_t kRays = 256;
+	std::vector<CpuRay> rays = createTestRays(tlas.getBounds(), kRays, 11);
+	numMismatches = 0;
+	for (uint32_t r = 0; r < kRays; r++)
+	{
+		uint32_t rayMask = r % 2 ? 0xFE : 0xFF;
+		CpuHit hit;
+		tlas.traceRay(rays[r], kRayFlagNone, rayMask, hit);
+		CpuHit reference = traceRayBruteForce(meshes, instances, rays[r], rayMask);
+		if (hit.isHit() != reference.isHit())
+		{
+			numMismatches++;
+			continue;
+		}
+		if (!hit.isHit())
+		{
+			continue;
+		}
+		// The second copy has mask 0x01 and must be invisible to 0xFE rays
+		if (rayMask == 0xFE && hit.instanceIndex >= (uint32_t)meshes.size())
+		{
+			return false;
+		}
+		const MeshView& mesh = meshes[hit.instanceIndex % meshes.size()];
+		mat4 transform = instances.getTransform(hit.instanceIndex);
+		vec3 v0 = vec3(transform * vec4(mesh.positions[mesh.indices[3 * hit.primitiveIndex + 0]], 1.0f));
+		vec3 v1 = vec3(transform * vec4(mesh.positions[mesh.indices[3 * hit.primitiveIndex + 1]], 1.0f));
+		vec3 v2 = vec3(transform * vec4(mesh.positions[mesh.indices[3 * hit.primitiveIndex + 2]], 1.0f));
+		vec3 point = v0 + hit.barycentrics.x * (v1 - v0) + hit.barycentrics.y * (v2 - v0);
+		float tolerance = 1e-3f * std::max(hit.t, 1.0f);
+		if (fabsf(hit.t - reference.t) > tolerance || length(point - (rays[r].origin + hit.t * rays[r].direction)) > tolerance ||
+			(hit.instanceIndex == reference.instanceIndex && hit.primitiveIndex == reference.primitiveIndex && hit.hitKind != reference.hitKind))
+		{
+			numMismatches++;
+		}
+	}
+	// Allow for the odd ray through a crack of the model that only one of the two tests sees
+	return numMismatches <= kRays / 100;
+}
+
+void benchmarkCpuRaytracing(const char* pFileName)
+{
+	const uint32_t kRays = 200000;
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("CPU ray tracing: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> meshes(cache.getNumMeshes());
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		meshes[i] = cache.getMesh(i);
+	}
+
+	BenchmarkTimer buildTimer;
+	std::vector<CpuBlas> blases;
+	SceneInstances instances;
+	std::vector<TlasInstanceDesc> descs;
+	createTestRaytracingScene(meshes, true, blases, instances, descs);
+	CpuTlas tlas;
+	tlas.build(descs.data(), (uint32_t)descs.size(), blases.data(), (uint32_t)blases.size());
+	double buildMs = buildTimer.getElapsedMs();
+
+	uint32_t numMismatches;
+	if (!validateCpuRaytracing(meshes, instances, tlas, numMismatches))
+	{
+		benchmarkLog(format("CPU ray tracing: %s FAILED validation against the brute force reference, %u mismatches", pFileName, numMismatches));
+		return;
+	}
+
+	// Closest hit rays like the diffuse bounces, and shadow rays ending at the hit point of another ray
+	std::vector<CpuRay> rays = createTestRays(tlas.getBounds(), kRays, 5);
+	std::vector<CpuHit> hits(kRays);
+	BenchmarkTimer closestTimer;
+	TaskPool::getGlobal().parallelForRange(kRays, 1024, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t r = begin; r < end; r++)
+		{
+			tlas.traceRay(rays[r], kRayFlagNone, 0xFE, hits[r]);
+		}
+	});
+	double closestMs = closestTimer.getElapsedMs();
+
+	uint32_t numHits = 0;
+	std::vector<CpuRay> shadowRays(kRays);
+	for (uint32_t r = 0; r < kRays; r++)
+	{
+		numHits += hits[r].isHit() ? 1 : 0;
+		const CpuRay& other = rays[(r + 1) % kRays];
+		vec3 target = hits[(r + 1) % kRays].isHit() ? other.origin + hits[(r + 1) % kRays].t * other.direction : other.origin;
+		shadowRays[r].origin = rays[r].origin;
+		shadowRays[r].direction = target - rays[r].origin;
+		shadowRays[r].tMin = 0.001f;
+		shadowRays[r].tMax = 0.9999f;
+	}
+	BenchmarkTimer shadowTimer;
+	std::atomic<uint32_t> numOccluded(0);
+	TaskPool::getGlobal().parallelForRange(kRays, 1024, [&](uint32_t begin, uint32_t end)
+	{
+		uint32_t rangeOccluded = 0;
+		for (uint32_t r = begin; r < end; r++)
+		{
+			CpuHit hit;
+			rangeOccluded += tlas.traceRay(shadowRays[r], kRayFlagAcceptFirstHitAndEndSearch | kRayFlagSkipClosestHitShader, 0xFF, hit) ? 1 : 0;
+		}
+		numOccluded += rangeOccluded;
+	});
+	double shadowMs = shadowTimer.getElapsedMs();
+
+	benchmarkLog(format("CPU ray tracing: %-40s %u instances, build %.2f ms, %u/256 rays off the brute force reference, %u threads: closest hit %.2f Mrays/s (%.1f%% hit), shadow %.2f Mrays/s (%.1f%% occluded)",
+		pFileName, tlas.getNumInstances(), buildMs, numMismatches, TaskPool::getGlobal().getNumThreads(),
+		kRays / (1000.0 * std::max(closestMs, 1e-3)), 100.0 * numHits / kRays, kRays / (1000.0 * std::max(shadowMs, 1e-3)), 100.0 * numOccluded.load() / kRays));
+}
+
+// Closest hit and shadow rays through one BLAS, Mrays/s on the calling thread
+static void timeBlasRays(const CpuBlas& blas, const std::vector<CpuRay>& rays, std::vector<CpuHit>& hits, double& closestRate, double& shadowRate)
+{
+	hits.resize(rays.size());
+	BenchmarkTimer closestTimer;
+	for (size_t r = 0; r < rays.size(); r++)
+	{
+		hits[r] = CpuHit();
+		hits[r].t = rays[r].tMax;
+		blas.intersect(rays[r].origin, rays[r].direction, rays[r].tMin, kRayFlagNone, 0, hits[r]);
+	}
+	closestRate = rays.size() / (1000.0 * std::max(closestTimer.getElapsedMs(), 1e-3));
+
+	// Towards the hit point of the next ray
+	BenchmarkTimer shadowTimer;
+	for (size_t r = 0; r < rays.size(); r++)
+	{
+		const CpuRay& next = rays[(r + 1) % rays.size()];
+		vec3 target = next.origin + std::min(hits[(r + 1) % rays.size()].t, 10.0f) * next.direction;
+		CpuHit hit;
+		hit.t = 0.9999f;
+		blas.intersect(rays[r].origin, target - rays[r].origin, 0.001f, kRayFlagAcceptFirstHitAndEndSearch, 0, hit);
+	}
+	shadowRate = rays.size() / (1000.0 * std::max(shadowTimer.getElapsedMs(), 1e-3));
+}
+
+void benchmarkWideBvh(const char* pFileName)
+{
+	const uint32_t kRays = 100000;
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Wide BVH: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> geometries(cache.getNumMeshes());
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		geometries[i] = cache.getMesh(i);
+	}
+
+	CpuBlas binary, wide;
+	binary.build(geometries, BvhBuildSettings(), nullptr, false);
+	BenchmarkTimer collapseTimer;
+	wide.build(geometries);
+	double buildMs = collapseTimer.getElapsedMs();
+	const WideBvh& wideBvh = wide.getWideBvh();
+	benchmarkLog(format("Wide BVH: %s, %u binary nodes, %u wide nodes, %u leaves (%.1f triangles per leaf), %.1f MB, build with collapse %.2f ms",
+		pFileName, binary.getBvh().getNumNodes(), wideBvh.getNumNodes(), wideBvh.getNumLeaves(),
+		(double)binary.getBvh().primitives.size() / std::max(wideBvh.getNumLeaves(), 1u), wideBvh.getMemorySize() / (1024.0 * 1024.0), buildMs));
+
+	std::vector<CpuRay> rays = createTestRays(binary.getBounds(), kRays, 3);
+	std::vector<CpuHit> reference, hits;
+	double baseClosest, baseShadow;
+	timeBlasRays(binary, rays, reference, baseClosest, baseShadow);
+	benchmarkLog(format("  binary:  closest hit %6.2f Mrays/s  shadow %6.2f Mrays/s", baseClosest, baseShadow));
+
+	// Every kernel must report the closest hits of the binary tree, a different triangle is only allowed at the same t
+	for (WideBvhKernel kernel = WideBvhKernel::Scalar; kernel <= getBestWideBvhKernel(); kernel = (WideBvhKernel)((uint32_t)kernel + 1))
+	{
+		wide.setWideBvhKernel(kernel);
+		double closest, shadow;
+		timeBlasRays(wide, rays, hits, closest, shadow);
+		uint32_t numMismatches = 0;
+		for (uint32_t r = 0; r < kRays; r++)
+		{
+			numMismatches += hits[r].t != reference[r].t || hits[r].hitKind != reference[r].hitKind ? 1 : 0;
+		}
+		benchmarkLog(format("  %-7s  closest hit %6.2f Mrays/s (%.2fx)  shadow %6.2f Mrays/s (%.2fx)  %s",
+			getWideBvhKernelName(kernel), closest, closest / baseClosest, shadow, shadow / baseShadow,
+			numMismatches == 0 ? "same hits as the binary tree" : format("FAILED, %u hits differ from the binary tree", numMismatches).c_str()));
+	}
+}
+
+void benchmarkBvhBuilders(const char* pFileName)
+{
+	const int kRuns = 3;
+	const uint32_t kRays = 100000;
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("BVH builders: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> geometries(cache.getNumMeshes());
+	uint64_t numTriangles = 0;
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		geometries[i] = cache.getMesh(i);
+		numTriangles += geometries[i].indexCount / 3;
+	}
+
+	struct BuilderConfig
+	{
+		BvhBuilder	builder;
+		uint32_t	treeletPasses;
+	};
+	const BuilderConfig kConfigs[] = { { BvhBuilder::BinnedSah, 0 }, { BvhBuilder::Lbvh, 0 }, { BvhBuilder::Lbvh, 1 }, { BvhBuilder::Lbvh, 3 } };
+
+	benchmarkLog(format("BVH builders: %s, %llu triangles, %u threads", pFileName, (unsigned long long)numTriangles, TaskPool::getGlobal().getNumThreads()));
+	TaskPool twoThreads(1);
+	std::vector<CpuRay> rays;
+	std::vector<CpuHit> reference, hits;
+	double sahMs = 0.0, sahClosest = 0.0, sahShadow = 0.0;
+	for (const BuilderConfig& config : kConfigs)
+	{
+		BvhBuildSettings settings;
+		settings.builder = config.builder;
+		settings.treeletPasses = config.treeletPasses;
+		Bvh bvh;
+		double buildMs = 0.0;
+		for (int run = 0; run < kRuns; run++)
+		{
+			BenchmarkTimer timer;
+			buildBvh(geometries, settings, bvh, &TaskPool::getGlobal());
+			buildMs += timer.getElapsedMs();
+		}
+		buildMs /= kRuns;
+
+		// Same tree with another number of threads
+		Bvh other;
+		buildBvh(geometries, settings, other, &twoThreads);
+		bool valid = validateBvh(geometries, bvh) && other.nodes.size() == bvh.nodes.size() &&
+			memcmp(other.nodes.data(), bvh.nodes.data(), bvh.nodes.size() * sizeof(BvhNode)) == 0 &&
+			memcmp(other.primitives.data(), bvh.primitives.data(), bvh.primitives.size() * sizeof(BvhPrimitive)) == 0;
+
+		// Traced through the wide tree, like every CPU BLAS
+		CpuBlas blas;
+		blas.build(geometries, settings);
+		if (rays.empty())
+		{
+			rays = createTestRays(blas.getBounds(), kRays, 5);
+		}
+		double closest, shadow;
+		timeBlasRays(blas, rays, config.builder == BvhBuilder::BinnedSah ? reference : hits, closest, shadow);
+		uint32_t numMismatches = 0;
+		if (config.builder == BvhBuilder::BinnedSah)
+		{
+			sahMs = buildMs;
+			sahClosest = closest;
+			sahShadow = shadow;
+		}
+		else
+		{
+			for (uint32_t r = 0; r < kRays; r++)
+			{
+				numMismatches += hits[r].t != reference[r].t || hits[r].hitKind != reference[r].hitKind ? 1 : 0;
+			}
+		}
+
+		std::string name = config.treeletPasses ? format("%s+%u treelet", getBvhBuilderName(config.builder), config.treeletPasses) : getBvhBuilderName(config.builder);
+		benchmarkLog(format("  %-14s build %8.2f ms (%5.2fx)  SAH cost %7.2f  depth %3u  closest hit %6.2f Mrays/s (%.2fx)  shadow %6.2f Mrays/s (%.2fx)%s%s",
+			name.c_str(), buildMs, sahMs / std::max(buildMs, 1e-3), computeSahCost(bvh, settings), computeBvhDepth(bvh),
+			closest, closest / sahClosest, shadow, shadow / sahShadow,
+			valid ? "" : "  FAILED validation or differs on two threads",
+			numMismatches ? format("  FAILED, %u hits differ from SAH", numMismatches).c_str() : ""));
+	}
+}
+
+struct TraversalSteps
+{
+	uint64_t	nodes = 0;		// box tests
+	uint64_t	triangles = 0;	// triangle tests
+};
+
+// The binary traversal of CpuBlas::intersect counting its box and triangle tests, nearer child first. A shadow ray ends at its first hit.
+static void countTraversalSteps(const std::vector<MeshView>& geometries, const Bvh& bvh, const vec3& origin, const vec3& direction, float tMin, float tMax,
+	bool shadow, TraversalSteps& steps)
+{
+	const uint32_t kStackSize = 256;
+	TraversalRay ray(origin, direction);
+	uint32_t stack[kStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const BvhNode& node = bvh.nodes[stack[--stackSize]];
+		steps.nodes++;
+		if (ray.intersectBox(node, tMin, tMax) == FLT_MAX)
+		{
+			continue;
+		}
+		if (!node.isLeaf())
+		{
+			uint32_t left = node.firstChildOrPrimitive;
+			bool leftFirst = ray.intersectBox(bvh.nodes[left], tMin, tMax) <= ray.intersectBox(bvh.nodes[left + 1], tMin, tMax);
+			assert(stackSize + 2 <= kStackSize);
+			stack[stackSize++] = leftFirst ? left + 1 : left;
+			stack[stackSize++] = leftFirst ? left : left + 1;
+			continue;
+		}
+		for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+		{
+			const MeshView& geometry = geometries[bvh.primitives[p].geometry];
+			const uint32_t* pIndices = geometry.indices + 3 * bvh.primitives[p].triangle;
+			float t, det;
+			vec2 barycentrics;
+			steps.triangles++;
+			if (ray.intersectTriangle(geometry.positions[pIndices[0]], geometry.positions[pIndices[1]], geometry.positions[pIndices[2]], tMin, tMax, t, barycentrics, det))
+			{
+				tMax = t;
+				if (shadow)
+				{
+					return;
+				}
+			}
+		}
+	}
+}
+
+void benchmarkSpatialSplits(const char* pFileName)
+{
+	const uint32_t kRays = 100000;
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Spatial splits: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> geometries(cache.getNumMeshes());
+	uint64_t numTriangles = 0;
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		geometries[i] = cache.getMesh(i);
+		numTriangles += geometries[i].indexCount / 3;
+	}
+
+	const float kBudgets[] = { 0.0f, 0.1f, 0.3f, 1.0f };
+	benchmarkLog(format("Spatial splits: %s, %llu triangles, %u threads", pFileName, (unsigned long long)numTriangles, TaskPool::getGlobal().getNumThreads()));
+	std::vector<CpuRay> rays;
+	std::vector<CpuHit> reference, hits;
+	double sahMs = 0.0, sahClosest = 0.0, sahShadow = 0.0;
+	TraversalSteps sahClosestSteps, sahShadowSteps;
+	for (float budget : kBudgets)
+	{
+		// A budget of 0 is the plain SAH build
+		BvhBuildSettings settings;
+		settings.builder = budget > 0.0f ? BvhBuilder::Sbvh : BvhBuilder::BinnedSah;
+		settings.spatialSplitBudget = budget;
+		BenchmarkTimer timer;
+		CpuBlas blas;
+		blas.build(geometries, settings, &TaskPool::getGlobal());
+		double buildMs = timer.getElapsedMs();
+		const Bvh& bvh = blas.getBvh();
+		bool valid = validateBvh(geometries, bvh, settings.builder == BvhBuilder::Sbvh);
+
+		if (rays.empty())
+		{
+			rays = createTestRays(blas.getBounds(), kRays, 7);
+		}
+		double closest, shadow;
+		timeBlasRays(blas, rays, budget > 0.0f ? hits : reference, closest, shadow);
+
+		// The same closest hit and shadow rays as timeBlasRays, counted through the binary tree
+		TraversalSteps closestSteps, shadowSteps;
+		const std::vector<CpuHit>& rayHits = budget > 0.0f ? hits : reference;
+		uint32_t numMismatches = 0;
+		for (uint32_t r = 0; r < kRays; r++)
+		{
+			countTraversalSteps(geometries, bvh, rays[r].origin, rays[r].direction, rays[r].tMin, rays[r].tMax, false, closestSteps);
+			const CpuRay& next = rays[(r + 1) % kRays];
+			vec3 target = next.origin + std::min(rayHits[(r + 1) % kRays].t, 10.0f) * next.direction;
+			countTraversalSteps(geometries, bvh, rays[r].origin, target - rays[r].origin, 0.001f, 0.9999f, true, shadowSteps);
+			numMismatches += rayHits[r].t != reference[r].t ? 1 : 0;
+		}
+
+		if (budget == 0.0f)
+		{
+			sahMs = buildMs;
+			sahClosest = closest;
+			sahShadow = shadow;
+			sahClosestSteps = closestSteps;
+			sahShadowSteps = shadowSteps;
+		}
+		auto perRay = [&](uint64_t steps) { return (double)steps / kRays; };
+		auto change = [](uint64_t steps, uint64_t sahSteps) { return sahSteps ? 100.0 * steps / sahSteps - 100.0 : 0.0; };
+		benchmarkLog(format("  %-5s budget %.1f: build %8.2f ms (%.2fx SAH), %5.1f%% more references, SAH cost %6.2f  "
+			"shadow ray %6.1f nodes (%+5.1f%%) %5.1f triangles (%+5.1f%%) %6.2f Mrays/s (%.2fx)  closest hit %6.1f nodes (%+5.1f%%) %5.1f triangles %6.2f Mrays/s (%.2fx)%s%s",
+			getBvhBuilderName(settings.builder), budget, buildMs, buildMs / std::max(sahMs, 1e-3), 100.0 * bvh.primitives.size() / numTriangles - 100.0,
+			computeSahCost(bvh, settings),
+			perRay(shadowSteps.nodes), change(shadowSteps.nodes, sahShadowSteps.nodes), perRay(shadowSteps.triangles), change(shadowSteps.triangles, sahShadowSteps.triangles),
+			shadow, shadow / sahShadow, perRay(closestSteps.nodes), change(closestSteps.nodes, sahClosestSteps.nodes), perRay(closestSteps.triangles),
+			closest, closest / sahClosest,
+			valid ? "" : "  FAILED validation",
+			numMismatches ? format("  FAILED, %u hits differ from SAH", numMismatches).c_str() : ""));
+	}
+}
+
+// Geometric normal of the hit triangle in world space, facing the ray origin
+static vec3 getHitNormal(const std::vector<MeshView>& meshes, const SceneInstances& instances, const CpuHit& hit, const vec3& rayDirection)
+{
+	const MeshView& mesh = meshes[hit.instanceIndex % meshes.size()];
+	mat4 transform = instances.getTransform(hit.instanceIndex);
+	vec3 v[3];
+	for (uint32_t k = 0; k < 3; k++)
+	{
+		v[k] = vec3(transform * vec4(mesh.positions[mesh.indices[3 * hit.primitiveIndex + k]], 1.0f));
+	}
+	vec3 normal = cross(v[1] - v[0], v[2] - v[0]);
+	float len = length(normal);
+	normal = len > 0.0f ? normal / len : -rayDirection;
+	return dot(normal, rayDirection) > 0.0f ? -normal : normal;
+}
+
+// Pinhole looking from eye at target, LH like lookAtLH
+struct TestCamera
+{
+	vec3	eye, right, up, forward;
+	float	tanHalfFov;
+
+	TestCamera(const vec3& eyePosition, const vec3& target, float fov)
+	{
+		eye = eyePosition;
+		forward = normalize(target - eye);
+		right = normalize(cross(vec3(0.0f, 1.0f, 0.0f), forward));
+		up = cross(forward, right);
+		tanHalfFov = tanf(0.5f * fov);
+	}
+
+	// Through pixel (x, y) of a width x height image, y down
+	vec3 getDirection(float x, float y, uint32_t width, uint32_t height) const
+	{
+		float aspect = (float)width / height;
+		vec2 ndc(2.0f * x / width - 1.0f, 1.0f - 2.0f * y / height);
+		return normalize(forward + ndc.x * tanHalfFov * aspect * right + ndc.y * tanHalfFov * up);
+	}
+
+	// Pixel of a world position, like the shadow map lookup of sampleIndirectLight
+	vec2 project(const vec3& p, uint32_t width, uint32_t height) const
+	{
+		vec3 local(dot(p - eye, right), dot(p - eye, up), dot(p - eye, forward));
+		float aspect = (float)width / height;
+		vec2 uv = clamp(vec2(local.x / (local.z * tanHalfFov * aspect), local.y / (local.z * tanHalfFov)) * 0.5f + 0.5f, 0.0f, 1.0f);
+		return vec2(uv.x * width, (1.0f - uv.y) * height);
+	}
+};
+
+// Camera and RSM resolution of a replayed frame, rays are generated for the centered tile of pixels only
+struct ShadowRayFrameDesc
+{
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	tileWidth;
+	uint32_t	tileHeight;
+	uint32_t	rsmSize;
+};
+
+/*
+	The shadow rays of one RT-RSM frame, traced the way Hit.hlsl does: for every camera pixel the ray to the light,
+	then up to 200 visibility rays to RSM texels picked with density 1/r within 150 texels, with the same rejection
+	rules as sampleIndirectLight. The RSM is ray cast from the light on the CPU, the sampling radius is scaled with its size.
+*/
+static void createShadowRayFrame(const std::vector<MeshView>& meshes, const SceneInstances& instances, const CpuTlas& tlas, const ShadowRayFrameDesc& desc, std::vector<CpuRay>& shadowRays, uint32_t& numPixels)
+{
+	const uint32_t kRsmSize = desc.rsmSize;
+	const float kRsmRadius = 150.0f * kRsmSize / 512.0f;
+	const int kMaxSamples = 200;
+
+	BvhBounds modelBounds;
+	for (uint32_t i = 0; i < (uint32_t)meshes.size(); i++)
+	{
+		for (uint32_t v = 0; v < meshes[i].vertexCount; v++)
+		{
+			modelBounds.grow(meshes[i].positions[v]);
+		}
+	}
+	vec3 center = 0.5f * (modelBounds.min + modelBounds.max);
+	vec3 size = modelBounds.max - modelBounds.min;
+	TestCamera camera(center - vec3(0.3f * size.x, -0.05f * size.y, 0.05f * size.z), center + vec3(0.3f * size.x, 0.0f, 0.0f), half_pi<float>());
+	vec3 lightPosition = center + vec3(0.1f * size.x, 0.5f * size.y + 0.25f * length(size), 0.05f * size.z);
+	TestCamera light(lightPosition, center, quarter_pi<float>() * 1.5f);
+
+	// RSM: position and normal of the first surface seen from the light, w = 0 where nothing was hit
+	std::vector<vec4> rsmPosition(kRsmSize * kRsmSize);
+	std::vector<vec3> rsmNormal(kRsmSize * kRsmSize);
+	TaskPool::getGlobal().parallelFor(kRsmSize, [&](uint32_t y)
+	{
+		for (uint32_t x = 0; x < kRsmSize; x++)
+		{
+			CpuRay ray;
+			ray.origin = lightPosition;
+			ray.direction = light.getDirection(x + 0.5f, y + 0.5f, kRsmSize, kRsmSize);
+			ray.tMin = 0.0001f;
+			ray.tMax = 100000.0f;
+			CpuHit hit;
+			uint32_t texel = y * kRsmSize + x;
+			rsmPosition[texel] = vec4(0.0f);
+			if (tlas.traceRay(ray, kRayFlagNone, 0xFE, hit))
+			{
+				rsmPosition[texel] = vec4(ray.origin + hit.t * ray.direction, 1.0f);
+				rsmNormal[texel] = getHitNormal(meshes, instances, hit, ray.direction);
+			}
+		}
+	});
+
+	shadowRays.clear();
+	numPixels = desc.tileWidth * desc.tileHeight;
+	for (uint32_t tilePixel = 0; tilePixel < numPixels; tilePixel++)
+	{
+		uint32_t px = (desc.width - desc.tileWidth) / 2 + tilePixel % desc.tileWidth;
+		uint32_t py = (desc.height - desc.tileHeight) / 2 + tilePixel / desc.tileWidth;
+		uint32_t pixel = py * desc.width + px;
+		CpuRay cameraRay;
+		cameraRay.origin = camera.eye;
+		cameraRay.direction = camera.getDirection(px + 0.5f, py + 0.5f, desc.width, desc.height);
+		cameraRay.tMin = 0.0001f;
+		cameraRay.tMax = 100000.0f;
+		CpuHit hit;
+		if (!tlas.traceRay(cameraRay, kRayFlagNone, 0xFE, hit))
+		{
+			continue;
+		}
+		vec3 hitPoint = cameraRay.origin + hit.t * cameraRay.direction;
+		vec3 normal = getHitNormal(meshes, instances, hit, cameraRay.direction);
+
+		CpuRay shadowRay;
+		shadowRay.origin = hitPoint;
+		shadowRay.tMin = 0.001f;
+		vec3 toLight = lightPosition - hitPoint;
+		if (dot(normalize(toLight), normal) >= 0.0001f)
+		{
+			shadowRay.direction = normalize(toLight);
+			shadowRay.tMax = length(toLight) - 0.0001f;
+			shadowRays.push_back(shadowRay);
+		}
+
+		uint32_t seed = pixel * 9781u + 1u;
+		auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+		vec2 crd = floor(light.project(hitPoint, kRsmSize, kRsmSize));
+		int numRaySamples = 0;
+		for (int numSamples = 0; numSamples < kMaxSamples; numSamples++)
+		{
+			if (numSamples > 100 && numRaySamples == 0)
+			{
+				break;
+			}
+			float xi1 = random();
+			float xi2 = random();
+			int x = (int)crd.x + (int)floorf(kRsmRadius * xi1 * sinf(two_pi<float>() * xi2));
+			int y = (int)crd.y + (int)floorf(kRsmRadius * xi1 * cosf(two_pi<float>() * xi2));
+			if (x < 0 || y < 0 || x >= (int)kRsmSize || y >= (int)kRsmSize || rsmPosition[y * kRsmSize + x].w == 0.0f)
+			{
+				continue;
+			}
+			vec3 direction = vec3(rsmPosition[y * kRsmSize + x]) - hitPoint;
+			float distance = length(direction);
+			direction /= std::max(distance, 1e-20f);
+			if (dot(direction, normal) < 0.0001f || dot(-direction, rsmNormal[y * kRsmSize + x]) < 0.0001f)
+			{
+				continue;
+			}
+			numRaySamples++;
+			shadowRay.direction = direction;
+			shadowRay.tMax = distance - 0.0001f;
+			shadowRays.push_back(shadowRay);
+		}
+	}
+}
+
+void benchmarkOcclusionRays(const char* pFileName)
+{
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Occlusion rays: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> meshes(cache.getNumMeshes());
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		meshes[i] = cache.getMesh(i);
+	}
+	std::vector<CpuBlas> blases;
+	SceneInstances instances;
+	std::vector<TlasInstanceDesc> descs;
+	createTestRaytracingScene(meshes, true, blases, instances, descs);
+	CpuTlas tlas;
+	tlas.build(descs.data(), (uint32_t)descs.size(), blases.data(), (uint32_t)blases.size());
+
+	std::vector<CpuRay> rays;
+	uint32_t numPixels;
+	// Smaller than on the GPU to keep the run short
+	ShadowRayFrameDesc frame = { 160, 90, 160, 90, 256 };
+	createShadowRayFrame(meshes, instances, tlas, frame, rays, numPixels);
+	uint32_t numRays = (uint32_t)rays.size();
+	uint32_t numWords = (numRays + 31) / 32;
+
+	// TraceRay one ray at a time, as the reference
+	std::vector<uint32_t> reference(numWords, 0);
+	BenchmarkTimer traceTimer;
+	for (uint32_t r = 0; r < numRays; r++)
+	{
+		CpuHit hit;
+		reference[r / 32] |= tlas.traceRay(rays[r], kRayFlagAcceptFirstHitAndEndSearch | kRayFlagSkipClosestHitShader, 0xFF, hit) ? 0 : 1u << (r % 32);
+	}
+	double traceMs = traceTimer.getElapsedMs();
+
+	BenchmarkTimer occludedTimer;
+	uint32_t numMismatches = 0;
+	for (uint32_t r = 0; r < numRays; r++)
+	{
+		bool visible = !tlas.isOccluded(rays[r], kRayFlagNone, 0xFF);
+		numMismatches += visible != ((reference[r / 32] >> (r % 32)) & 1) ? 1 : 0;
+	}
+	double occludedMs = occludedTimer.getElapsedMs();
+
+	std::vector<uint32_t> visible(numWords);
+	TaskPool singleThread(0);
+	BenchmarkTimer batchTimer;
+	tlas.traceOcclusionRays(rays.data(), numRays, kRayFlagNone, 0xFF, visible.data(), &singleThread);
+	double batchMs = batchTimer.getElapsedMs();
+	numMismatches += visible != reference ? 1 : 0;
+
+	BenchmarkTimer poolTimer;
+	tlas.traceOcclusionRays(rays.data(), numRays, kRayFlagNone, 0xFF, visible.data());
+	double poolMs = poolTimer.getElapsedMs();
+	numMismatches += visible != reference ? 1 : 0;
+
+	uint32_t numVisible = 0;
+	for (uint32_t word : reference)
+	{
+		for (; word != 0; word &= word - 1)
+		{
+			numVisible++;
+		}
+	}
+	auto rate = [numRays](double ms) { return numRays / (1000.0 * std::max(ms, 1e-3)); };
+	benchmarkLog(format("Occlusion rays: %s, %u shadow rays of a %u pixel frame (%.1f per pixel, %.1f%% visible)%s",
+		pFileName, numRays, numPixels, (double)numRays / numPixels, 100.0 * numVisible / std::max(numRays, 1u),
+		numMismatches ? format(", FAILED: %u rays differ from TraceRay", numMismatches).c_str() : ""));
+	benchmarkLog(format("  TraceRay %.2f Mrays/s  isOccluded %.2f Mrays/s (%.2fx)  batched %.2f Mrays/s (%.2fx)  batched on %u threads %.2f Mrays/s (%.2fx)",
+		rate(traceMs), rate(occludedMs), traceMs / std::max(occludedMs, 1e-3), rate(batchMs), traceMs / std::max(batchMs, 1e-3),
+		TaskPool::getGlobal().getNumThreads(), rate(poolMs), traceMs / std::max(poolMs, 1e-3)));
+}
+
+void benchmarkShadowRaySorting(const char* pFileName)
+{
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("Shadow ray sorting: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> meshes(cache.getNumMeshes());
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		meshes[i] = cache.getMesh(i);
+	}
+	std::vector<CpuBlas> blases;
+	SceneInstances instances;
+	std::vector<TlasInstanceDesc> descs;
+	createTestRaytracingScene(meshes, true, blases, instances, descs);
+	CpuTlas tlas;
+	tlas.build(descs.data(), (uint32_t)descs.size(), blases.data(), (uint32_t)blases.size());
+
+	// A 1080p frame with the 512x512 RSM of the GPU path, rays of a 256x144 tile in the middle
+	std::vector<CpuRay> rays;
+	uint32_t numPixels;
+	ShadowRayFrameDesc frame = { 1920, 1080, 256, 144, 512 };
+	createShadowRayFrame(meshes, instances, tlas, frame, rays, numPixels);
+	uint32_t numRays = (uint32_t)rays.size();
+	std::vector<uint32_t> reference((numRays + 31) / 32);
+	std::vector<uint32_t> visible(reference.size());
+
+	BenchmarkTimer unsortedTimer;
+	tlas.traceOcclusionRays(rays.data(), numRays, kRayFlagNone, 0xFF, reference.data());
+	double unsortedMs = unsortedTimer.getElapsedMs();
+	benchmarkLog(format("Shadow ray sorting: %s, %u shadow rays of a %ux%u tile at %ux%u, %u threads, unsorted %.2f Mrays/s",
+		pFileName, numRays, frame.tileWidth, frame.tileHeight, frame.width, frame.height,
+		TaskPool::getGlobal().getNumThreads(), numRays / (1000.0 * std::max(unsortedMs, 1e-3))));
+
+	const uint32_t kBatchSizes[] = { 1024, 4096, 16384, 65536, 262144 };
+	for (uint32_t batchSize : kBatchSizes)
+	{
+		BenchmarkTimer sortedTimer;
+		tlas.traceOcclusionRaysSorted(rays.data(), numRays, kRayFlagNone, 0xFF, batchSize, visible.data());
+		double sortedMs = sortedTimer.getElapsedMs();
+		benchmarkLog(format("  batch %6u  %.2f Mrays/s (%.2fx)%s", batchSize, numRays / (1000.0 * std::max(sortedMs, 1e-3)),
+			unsortedMs / std::max(sortedMs, 1e-3), visible != reference ? "  FAILED: visibility differs from unsorted" : ""));
+	}
+}
+
+void benchmarkBvhCache(const char* pFileName)
+{
+	const int kWarmRuns = 5;
+	const uint32_t kRaysPerBlas = 64;
+	Assimp::Importer importer;
+	MeshCache meshCache;
+	if (!meshCache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("BVH cache: failed to import %s", pFileName));
+		return;
+	}
+
+	// One BLAS per mesh, like the submeshes of createAccelerationStructures
+	std::vector<std::vector<MeshView>> blasGeometries(meshCache.getNumMeshes());
+	for (uint32_t i = 0; i < meshCache.getNumMeshes(); i++)
+	{
+		blasGeometries[i].push_back(meshCache.getMesh(i));
+	}
+	BvhBuildSettings settings;
+
+	// Cold: no cache on disk, every BLAS is built and the cache is written
+	remove(BvhCache::getCachePath(pFileName).c_str());
+	std::vector<CpuBlas> built;
+	double coldMs;
+	{
+		BenchmarkTimer timer;
+		BvhCache cache;
+		cache.load(pFileName, blasGeometries, settings, built);
+		coldMs = timer.getElapsedMs();
+	}
+
+	// Warm: every tree is used from the mapping, only the keys are hashed
+	double warmMs = 0.0;
+	uint32_t numHits = 0;
+	for (int run = 0; run < kWarmRuns; run++)
+	{
+		BenchmarkTimer timer;
+		BvhCache cache;
+		std::vector<CpuBlas> cached;
+		cache.load(pFileName, blasGeometries, settings, cached);
+		warmMs += timer.getElapsedMs();
+		numHits = cache.getNumHits();
+	}
+	warmMs /= kWarmRuns;
+
+	// The mapped trees must give the same hits as the built ones
+	BvhCache cache;
+	std::vector<CpuBlas> cached;
+	cache.load(pFileName, blasGeometries, settings, cached);
+	uint32_t numMismatches = 0;
+	uint64_t bytes = 0;
+	for (uint32_t b = 0; b < (uint32_t)built.size(); b++)
+	{
+		bytes += built[b].getWideBvh().getMemorySize();
+		if (built[b].getBounds().isEmpty())
+		{
+			continue;
+		}
+		for (const CpuRay& ray : createTestRays(built[b].getBounds(), kRaysPerBlas, b + 1))
+		{
+			CpuHit builtHit, cachedHit;
+			builtHit.t = cachedHit.t = ray.tMax;
+			bool builtFound = built[b].intersect(ray.origin, ray.direction, ray.tMin, kRayFlagNone, 0, builtHit);
+			bool cachedFound = cached[b].intersect(ray.origin, ray.direction, ray.tMin, kRayFlagNone, 0, cachedHit);
+			if (builtFound != cachedFound || builtHit.t != cachedHit.t || builtHit.primitiveIndex != cachedHit.primitiveIndex)
+			{
+				numMismatches++;
+			}
+		}
+	}
+
+	benchmarkLog(format("BVH cache: %-40s %u BLASes, %8.2f MB  cold build %9.2f ms  warm cache %8.2f ms (%u/%u mapped)  %.2f ms saved%s",
+		pFileName, (uint32_t)built.size(), bytes / (1024.0 * 1024.0), coldMs, warmMs, numHits, (uint32_t)built.size(), coldMs - warmMs,
+		numMismatches ? format(", FAILED: %u rays differ", numMismatches).c_str() : ""));
+}
+
+void benchmarkAsMemory(const char* pFileName)
+{
+	const uint32_t kRaysPerBlas = 64;
+	Assimp::Importer importer;
+	MeshCache meshCache;
+	if (!meshCache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("AS memory: failed to import %s", pFileName));
+		return;
+	}
+
+	// One BLAS per mesh, like the submeshes of createAccelerationStructures, all in one batch
+	CpuAsManager manager;
+	std::vector<uint32_t> ids;
+	uint64_t unpooledScratchBytes = 0;
+	BenchmarkTimer buildTimer;
+	for (uint32_t i = 0; i < meshCache.getNumMeshes(); i++)
+	{
+		std::vector<MeshView> geometries(1, meshCache.getMesh(i));
+		unpooledScratchBytes += alignUp(CpuAsManager::getBottomLevelPrebuildInfo(geometries).scratchSize, kAsAlignment);
+		ids.push_back(manager.buildBottomLevel(geometries, format("%s mesh %u", pFileName, i), BvhBuildSettings(), &TaskPool::getGlobal()));
+	}
+	double buildMs = buildTimer.getElapsedMs();
+	manager.finishBatch();
+	AsMemoryStats built = manager.getTracker().getStats();
+
+	// The rays of every BLAS before compaction, to check the compacted copies against
+	std::vector<std::vector<CpuRay>> rays(ids.size());
+	std::vector<std::vector<CpuHit>> hits(ids.size());
+	for (uint32_t b = 0; b < (uint32_t)ids.size(); b++)
+	{
+		const CpuBlas& blas = manager.getBlas(ids[b]);
+		if (blas.getBounds().isEmpty())
+		{
+			continue;
+		}
+		rays[b] = createTestRays(blas.getBounds(), kRaysPerBlas, b + 1);
+		for (const CpuRay& ray : rays[b])
+		{
+			CpuHit hit;
+			hit.t = ray.tMax;
+			blas.intersect(ray.origin, ray.direction, ray.tMin, kRayFlagNone, 0, hit);
+			hits[b].push_back(hit);
+		}
+	}
+
+	BenchmarkTimer compactTimer;
+	uint32_t numCompacted = manager.compact();
+	double compactMs = compactTimer.getElapsedMs();
+	uint32_t numMismatches = 0;
+	for (uint32_t b = 0; b < (uint32_t)ids.size(); b++)
+	{
+		for (uint32_t r = 0; r < (uint32_t)rays[b].size(); r++)
+		{
+			const CpuRay& ray = rays[b][r];
+			CpuHit hit;
+			hit.t = ray.tMax;
+			manager.getBlas(ids[b]).intersect(ray.origin, ray.direction, ray.tMin, kRayFlagNone, 0, hit);
+			numMismatches += hit.t != hits[b][r].t || hit.primitiveIndex != hits[b][r].primitiveIndex ? 1 : 0;
+		}
+	}
+	uint32_t numReleased = (uint32_t)manager.trimScratch().size();
+	AsMemoryStats compacted = manager.getTracker().getStats();
+	bool accountingMatches = compacted.resultBytes == manager.getResultBytes() && compacted.scratchBytes == 0;
+
+	benchmarkLog(format("AS memory: %-40s %u BLASes built in %.2f ms, results %.2f MB -> %.2f MB compacted (%u compacted in %.2f ms), "
+		"scratch %.2f MB pooled in %u buffers instead of %.2f MB, %u released%s%s",
+		pFileName, built.numBottomLevel, buildMs, built.resultBytes / (1024.0 * 1024.0), compacted.resultBytes / (1024.0 * 1024.0), numCompacted, compactMs,
+		built.scratchBytes / (1024.0 * 1024.0), built.numScratchBuffers, unpooledScratchBytes / (1024.0 * 1024.0), numReleased,
+		numMismatches ? format(", FAILED: %u rays differ after compaction", numMismatches).c_str() : "",
+		accountingMatches ? "" : ", FAILED: the tracker doesn't match the result buffers"));
+	benchmarkLog(manager.getTracker().getReport(5));
+}
+
+// Twists the model around its vertical axis, by amount turns at the top and none at the bottom
+static void twistPositions(const std::vector<vec3>& rest, const BvhBounds& bounds, float amount, vec3* pPositions)
+{
+	vec3 center = (bounds.min + bounds.max) * 0.5f;
+	float height = std::max(bounds.max.y - bounds.min.y, 1e-6f);
+	for (size_t v = 0; v < rest.size(); v++)
+	{
+		float angle = amount * 6.2831853f * (rest[v].y - bounds.min.y) / height;
+		float c = cosf(angle), s = sinf(angle);
+		vec3 p = rest[v] - center;
+		pPositions[v] = center + vec3(c * p.x + s * p.z, p.y, c * p.z - s * p.x);
+	}
+}
+
+/*
+	The FBX files are loaded without their animation, so the deforming sequence is made up: the whole model as one
+	BLAS, twisted a bit more every frame. Each frame is refitted and also built from scratch to compare cost and
+	quality, the refitted tree is rebuilt whenever BlasRefitPolicy asks for it, and its hits are checked against the
+	fresh build.
+*/
+void benchmarkBlasRefit(const char* pFileName)
+{
+	const uint32_t kFrames = 60;
+	const uint32_t kRays = 4096;
+	const float kMaxTwist = 0.5f;
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("BLAS refit: failed to import %s", pFileName));
+		return;
+	}
+
+	// The geometries point at copies of the positions, which are deformed in place
+	std::vector<std::vector<vec3>> rest(cache.getNumMeshes()), positions(cache.getNumMeshes());
+	std::vector<MeshView> geometries(cache.getNumMeshes());
+	BvhBounds bounds;
+	uint64_t numTriangles = 0;
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		geometries[i] = cache.getMesh(i);
+		rest[i].assign(geometries[i].positions, geometries[i].positions + geometries[i].vertexCount);
+		positions[i] = rest[i];
+		geometries[i].positions = positions[i].data();
+		numTriangles += geometries[i].indexCount / 3;
+		for (const vec3& p : rest[i])
+		{
+			bounds.grow(p);
+		}
+	}
+
+	TaskPool& pool = TaskPool::getGlobal();
+	BvhBuildSettings settings;
+	CpuBlas blas;
+	blas.build(geometries, settings, &pool);
+	BlasRefitPolicy policy;
+	policy.onBuild(blas.getBvh());
+
+	// Refitting the rest pose must give back the trees of the build
+	Bvh builtBvh = blas.getBvh();
+	std::vector<WideBvhNode> builtNodes(blas.getWideBvh().getNodes(), blas.getWideBvh().getNodes() + blas.getWideBvh().getNumNodes());
+	blas.refit(geometries, &pool);
+	bool sameTrees = memcmp(builtBvh.nodes.data(), blas.getBvh().nodes.data(), builtBvh.nodes.size() * sizeof(BvhNode)) == 0 &&
+		memcmp(builtNodes.data(), blas.getWideBvh().getNodes(), builtNodes.size() * sizeof(WideBvhNode)) == 0;
+
+	double refitMs = 0.0, buildMs = 0.0, policyMs = 0.0;
+	float worstSahRatio = 1.0f;
+	uint32_t numRebuilds = 0, numMismatches = 0;
+	std::vector<std::string> frameLines;
+	for (uint32_t frame = 1; frame <= kFrames; frame++)
+	{
+		float twist = kMaxTwist * frame / kFrames;
+		for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+		{
+			twistPositions(rest[i], bounds, twist, positions[i].data());
+		}
+
+		BenchmarkTimer refitTimer;
+		blas.refit(geometries, &pool);
+		double frameRefitMs = refitTimer.getElapsedMs();
+		bool rebuild = policy.onRefit(blas.getBvh());
+
+		BenchmarkTimer buildTimer;
+		CpuBlas fresh;
+		fresh.build(geometries, settings, &pool);
+		double frameBuildMs = buildTimer.getElapsedMs();
+		float freshSah = computeSahCost(fresh.getBvh(), settings);
+		float freshOverlap = computeBvhOverlap(fresh.getBvh());
+
+		// Different trees may find another triangle at the same t, so only t and the hit kind are compared
+		for (const CpuRay& ray : createTestRays(fresh.getBounds(), kRays, frame))
+		{
+			CpuHit refitHit, freshHit;
+			refitHit.t = freshHit.t = ray.tMax;
+			blas.intersect(ray.origin, ray.direction, ray.tMin, kRayFlagNone, 0, refitHit);
+			fresh.intersect(ray.origin, ray.direction, ray.tMin, kRayFlagNone, 0, freshHit);
+			numMismatches += refitHit.t != freshHit.t || refitHit.hitKind != freshHit.hitKind ? 1 : 0;
+		}
+
+		float sahRatio = policy.getSahCost() / std::max(freshSah, 1e-6f);
+		worstSahRatio = std::max(worstSahRatio, sahRatio);
+		if (frame % 10 == 0 || rebuild)
+		{
+			frameLines.push_back(format("  frame %2u: refit %7.2f ms  build %7.2f ms  SAH %.2fx a fresh build  overlap %.3f (built %.3f, fresh %.3f)%s",
+				frame, frameRefitMs, frameBuildMs, sahRatio, policy.getOverlap(), policy.getBuildOverlap(), freshOverlap,
+				rebuild ? format(", rebuilt after %u refits", policy.getNumRefits()).c_str() : ""));
+		}
+
+		refitMs += frameRefitMs;
+		buildMs += frameBuildMs;
+		policyMs += frameRefitMs;
+		if (rebuild)
+		{
+			BenchmarkTimer rebuildTimer;
+			blas.build(geometries, settings, &pool);
+			policyMs += rebuildTimer.getElapsedMs();
+			policy.onBuild(blas.getBvh());
+			numRebuilds++;
+		}
+	}
+
+	// A BLAS with only the wide tree, like one from the BVH cache after detach, must get the same bounds from a refit
+	CpuBlas wideOnly;
+	wideOnly.attach(geometries, blas.getBounds(), blas.getWideBvh().getNodes(), blas.getWideBvh().getNumNodes(), blas.getWideBvh().getTriangles(),
+		blas.getWideBvh().getNumLeaves());
+	wideOnly.detach();
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		twistPositions(rest[i], bounds, -kMaxTwist, positions[i].data());
+	}
+	blas.refit(geometries, &pool);
+	wideOnly.refit(geometries, &pool);
+	bool sameBounds = wideOnly.getBounds().min == blas.getBounds().min && wideOnly.getBounds().max == blas.getBounds().max;
+
+	benchmarkLog(format("BLAS refit: %-40s %llu triangles, %u frames, %u threads: refit %.2f ms against build %.2f ms per frame (%.1fx), "
+		"with the policy %.2f ms per frame and %u rebuilds, refitted SAH up to %.2fx a fresh build%s%s%s",
+		pFileName, (unsigned long long)numTriangles, kFrames, pool.getNumThreads(), refitMs / kFrames, buildMs / kFrames,
+		buildMs / std::max(refitMs, 1e-3), policyMs / kFrames, numRebuilds, worstSahRatio,
+		sameTrees ? "" : ", FAILED: the refitted rest pose differs from the build",
+		sameBounds ? "" : ", FAILED: the refitted wide tree alone has other bounds",
+		numMismatches ? format(", FAILED: %u/%u rays differ from the fresh build", numMismatches, kFrames * kRays).c_str() : ""));
+	for (const std::string& line : frameLines)
+	{
+		benchmarkLog(line);
+	}
+}
+
+static std::string getSceneName(const char* pFileName)
+{
+	std::string name = pFileName;
+	size_t slash = name.find_last_of("/\\");
+	name = slash == std::string::npos ? name : name.substr(slash + 1);
+	return name.substr(0, name.find_last_of('.'));
+}
+
+#ifdef AS_STATS
+// Non-empty buckets of a histogram as bucket:percent
+static std::string formatHistogram(const std::vector<uint32_t>& histogram, uint32_t total)
+{
+	std::string line;
+	for (uint32_t i = 0; i < (uint32_t)histogram.size(); i++)
+	{
+		if (histogram[i] > 0)
+		{
+			line += format(" %u:%.1f%%", i, 100.0 * histogram[i] / std::max(total, 1u));
+		}
+	}
+	return line;
+}
+
+#endif
+
+void benchmarkAsStats(const char* pFileName)
+{
+#ifndef AS_STATS
+	benchmarkLog(format("AS statistics: %s, compiled out, define AS_STATS or use a debug build", pFileName));
+#else
+	Assimp::Importer importer;
+	MeshCache cache;
+	if (!cache.load(&importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("AS statistics: failed to import %s", pFileName));
+		return;
+	}
+	std::vector<MeshView> meshes(cache.getNumMeshes());
+	for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+	{
+		meshes[i] = cache.getMesh(i);
+	}
+	std::vector<CpuBlas> blases;
+	SceneInstances instances;
+	std::vector<TlasInstanceDesc> descs;
+	createTestRaytracingScene(meshes, true, blases, instances, descs);
+	CpuTlas tlas;
+	tlas.build(descs.data(), (uint32_t)descs.size(), blases.data(), (uint32_t)blases.size());
+
+	const uint32_t kWidth = 320;
+	const uint32_t kHeight = 180;
+	benchmarkLog(format("AS statistics: %s, %u instances, %ux%u pixels", pFileName, tlas.getNumInstances(), kWidth, kHeight));
+
+	// One BLAS over the whole model per builder, and the TLAS of the traced scene, which has no triangles for the EPO
+	const BvhBuilder kBuilders[] = { BvhBuilder::BinnedSah, BvhBuilder::Lbvh, BvhBuilder::Sbvh };
+	for (BvhBuilder builder : kBuilders)
+	{
+		BvhBuildSettings settings;
+		settings.builder = builder;
+		Bvh bvh;
+		buildBvh(meshes, settings, bvh, &TaskPool::getGlobal());
+		BvhQuality quality = computeBvhQuality(meshes, bvh, settings);
+		benchmarkLog(format("  %-5s BLAS: SAH cost %6.2f  EPO %6.3f  overlap %7.3f  %u nodes  depth %u  leaf sizes%s  leaf depths%s",
+			getBvhBuilderName(builder), quality.sahCost, quality.epo, quality.overlap, quality.numNodes, quality.maxDepth,
+			formatHistogram(quality.leafSizes, quality.numLeaves).c_str(), formatHistogram(quality.leafDepths, quality.numLeaves).c_str()));
+	}
+	BvhBuildSettings tlasSettings;
+	tlasSettings.maxLeafSize = 1;
+	BvhQuality tlasQuality = computeBvhQuality(std::vector<MeshView>(), tlas.getBvh(), tlasSettings);
+	benchmarkLog(format("  TLAS: SAH cost %6.2f  overlap %7.3f  %u nodes  depth %u", tlasQuality.sahCost, tlasQuality.overlap, tlasQuality.numNodes, tlasQuality.maxDepth));
+
+	// The camera and light of createShadowRayFrame, one camera ray and one ray to the light per pixel
+	BvhBounds modelBounds;
+	for (const MeshView& mesh : meshes)
+	{
+		for (uint32_t v = 0; v < mesh.vertexCount; v++)
+		{
+			modelBounds.grow(mesh.positions[v]);
+		}
+	}
+	vec3 center = 0.5f * (modelBounds.min + modelBounds.max);
+	vec3 size = modelBounds.max - modelBounds.min;
+	TestCamera camera(center - vec3(0.3f * size.x, -0.05f * size.y, 0.05f * size.z), center + vec3(0.3f * size.x, 0.0f, 0.0f), half_pi<float>());
+	vec3 lightPosition = center + vec3(0.1f * size.x, 0.5f * size.y + 0.25f * length(size), 0.05f * size.z);
+	auto tracePixel = [&](uint32_t x, uint32_t y, TraversalCounters& cameraCounters, TraversalCounters& shadowCounters)
+	{
+		CpuRay cameraRay;
+		cameraRay.origin = camera.eye;
+		cameraRay.direction = camera.getDirection(x + 0.5f, y + 0.5f, kWidth, kHeight);
+		cameraRay.tMin = 0.0001f;
+		cameraRay.tMax = 100000.0f;
+		TraversalCounters start = gTraversalCounters;
+		CpuHit hit;
+		bool isHit = tlas.traceRay(cameraRay, kRayFlagNone, 0xFE, hit);
+		TraversalCounters afterCamera = gTraversalCounters;
+		cameraCounters = afterCamera - start;
+		shadowCounters = TraversalCounters();
+		if (isHit)
+		{
+			CpuRay shadowRay;
+			shadowRay.origin = cameraRay.origin + hit.t * cameraRay.direction;
+			shadowRay.direction = normalize(lightPosition - shadowRay.origin);
+			shadowRay.tMin = 0.001f;
+			shadowRay.tMax = length(lightPosition - shadowRay.origin) - 0.0001f;
+			tlas.isOccluded(shadowRay, kRayFlagNone, 0xFF);
+			shadowCounters = gTraversalCounters - afterCamera;
+		}
+		return isHit;
+	};
+
+	TraversalStatsImage cameraStats, shadowStats;
+	cameraStats.resize(kWidth, kHeight);
+	shadowStats.resize(kWidth, kHeight);
+	std::vector<uint8_t> pixelHits(kWidth * kHeight);
+	TaskPool::getGlobal().parallelFor(kHeight, [&](uint32_t y)
+	{
+		for (uint32_t x = 0; x < kWidth; x++)
+		{
+			TraversalCounters cameraCounters, shadowCounters;
+			pixelHits[y * kWidth + x] = tracePixel(x, y, cameraCounters, shadowCounters) ? 1 : 0;
+			cameraStats.add(x, y, cameraCounters);
+			shadowStats.add(x, y, shadowCounters);
+		}
+	});
+
+	// The per thread counters of the pool add up to those of one thread tracing everything, and every hit tested a triangle
+	uint32_t numHits = 0;
+	uint32_t numFailures = 0;
+	TraversalCounters serialStart = gTraversalCounters;
+	for (uint32_t y = 0; y < kHeight; y++)
+	{
+		for (uint32_t x = 0; x < kWidth; x++)
+		{
+			TraversalCounters cameraCounters, shadowCounters;
+			tracePixel(x, y, cameraCounters, shadowCounters);
+			numHits += pixelHits[y * kWidth + x];
+			numFailures += pixelHits[y * kWidth + x] && cameraStats.get(x, y).triangles == 0 ? 1 : 0;
+		}
+	}
+	TraversalCounters serial = gTraversalCounters - serialStart;
+	const TraversalCounter kCounters[] = { TraversalCounter::Nodes, TraversalCounter::Triangles, TraversalCounter::Instances };
+	for (TraversalCounter counter : kCounters)
+	{
+		numFailures += (double)serial.get(counter) != cameraStats.getTotal(counter) + shadowStats.getTotal(counter) ? 1 : 0;
+	}
+
+	std::string sceneName = getSceneName(pFileName);
+	auto logRays = [&](const char* pName, const TraversalStatsImage& stats, uint32_t numRays)
+	{
+		std::string line = format("  %s rays (%u):", pName, numRays);
+		for (TraversalCounter counter : kCounters)
+		{
+			line += format("  %.1f %s per ray (pixel max %u)", stats.getTotal(counter) / std::max(numRays, 1u), getTraversalCounterName(counter), stats.getMax(counter));
+		}
+		for (TraversalCounter counter : { TraversalCounter::Nodes, TraversalCounter::Triangles })
+		{
+			std::string heatmap = format("%s_%s_%s.pfm", sceneName.c_str(), pName, getTraversalCounterName(counter));
+			line += stats.saveHeatmap(heatmap.c_str(), counter) ? "  " + heatmap : "  FAILED to write " + heatmap;
+		}
+		benchmarkLog(line);
+	};
+	logRays("camera", cameraStats, kWidth * kHeight);
+	logRays("shadow", shadowStats, numHits);
+	if (numFailures > 0)
+	{
+		benchmarkLog(format("  FAILED: %u checks of the per pixel counters", numFailures));
+	}
+#endif
+}
+
+// Time of every pass of one CPU frame in ms: TLAS, G-buffer, RSM, rays, temporal, spatial, tone mapping
+static void renderTimedFrame(CpuFrame& frame, const CpuFrameDesc& desc, double times[7])
+{
+	BenchmarkTimer timer;
+	frame.beginFrame(desc);
+	times[0] = timer.getElapsedMs();
+	timer.reset();
+	frame.renderGeometryBuffer();
+	times[1] = timer.getElapsedMs();
+	timer.reset();
+	frame.renderShadowMap();
+	times[2] = timer.getElapsedMs();
+	timer.reset();
+	frame.rayTrace();
+	times[3] = timer.getElapsedMs();
+	timer.reset();
+	frame.applyTemporalFilter();
+	times[4] = timer.getElapsedMs();
+	timer.reset();
+	frame.applySpatialFilter();
+	times[5] = timer.getElapsedMs();
+	timer.reset();
+	frame.applyToneMapping();
+	times[6] = timer.getElapsedMs();
+	frame.endFrame();
+}
+
+static std::string formatFrameTimes(const double times[7])
+{
+	return format("TLAS %.1f  G-buffer %.1f  RSM %.1f  rays %.1f  temporal %.1f  spatial %.1f  tone mapping %.1f ms",
+		times[0], times[1], times[2], times[3], times[4], times[5], times[6]);
+}
+
+// Pixels the G-buffer drew and how many of them passed the reprojection test
+static void countReprojectedPixels(const CpuFrame& frame, uint32_t& numDrawn, uint32_t& numAccepted)
+{
+	numDrawn = 0;
+	numAccepted = 0;
+	for (const vec4& motionVector : frame.getMotionVectors().texels)
+	{
+		numDrawn += motionVector.w != 0.0f ? 1 : 0;
+		numAccepted += motionVector.z != 0.0f ? 1 : 0;
+	}
+}
+
+// A model file as a CPU frame scene, the meshes point into the cache
+struct CpuFrameModel
+{
+	Assimp::Importer	importer;
+	MeshCache			cache;
+	CpuFrameScene		scene;
+};
+
+static bool loadCpuFrameModel(const char* pFileName, const char* pName, CpuFrameModel& model)
+{
+	if (!model.cache.load(&model.importer, pFileName, kMultipleMeshProcessFlags))
+	{
+		benchmarkLog(format("%s: failed to import %s", pName, pFileName));
+		return false;
+	}
+	std::vector<MeshView> meshes;
+	for (uint32_t i = 0; i < model.cache.getNumMeshes(); i++)
+	{
+		meshes.push_back(model.cache.getMesh(i));
+	}
+	if (!setupCpuFrameScene(meshes, 480, 270, model.scene))
+	{
+		benchmarkLog(format("%s: %s has no vertices", pName, pFileName));
+		return false;
+	}
+	return true;
+}
+
+void benchmarkCpuFrame(const char* pFileName)
+{
+	CpuFrameModel model;
+	if (!loadCpuFrameModel(pFileName, "CPU frame", model))
+	{
+		return;
+	}
+	const CpuFrameScene& scene = model.scene;
+	const std::vector<CpuFrameMesh>& meshes = scene.meshes;
+	const vec3& eye = scene.eye;
+	const vec3& target = scene.target;
+	const vec3& size = scene.size;
+	CpuFrameDesc desc = scene.desc;
+
+	BenchmarkTimer timer;
+	CpuFrame frame;
+	frame.setScene(meshes);
+	double setupMs = timer.getElapsedMs();
+	benchmarkLog(format("CPU frame: %s, %ux%u, RSM %u, %u threads, BLAS builds %.1f ms", pFileName, desc.width, desc.height, desc.rsmSize,
+		TaskPool::getGlobal().getNumThreads(), setupMs));
+
+	// Frame 0 has no history, every pixel traces the full 200 RSM samples
+	double times[7];
+	renderTimedFrame(frame, desc, times);
+	benchmarkLog("  frame 0: " + formatFrameTimes(times));
+
+	// The rasterized G-buffer against the camera rays of RayGeneration.hlsl, they differ on silhouettes only
+	uint32_t numCovered = 0;
+	uint32_t numDiffering = 0;
+	mat4 viewInv = inverse(desc.view);
+	mat4 projectionInv = inverse(desc.projection);
+	for (uint32_t y = 0; y < desc.height; y++)
+	{
+		for (uint32_t x = 0; x < desc.width; x++)
+		{
+			vec2 d = ((vec2((float)x, (float)y) + 0.5f) / vec2((float)desc.width, (float)desc.height)) * 2.0f - 1.0f;
+			CpuRay ray;
+			ray.origin = vec3(viewInv * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			ray.direction = vec3(viewInv * vec4(vec3(projectionInv * vec4(d.x, -d.y, 1.0f, 1.0f)), 0.0f));
+			ray.tMin = 0.0f;
+			ray.tMax = 100000.0f;
+			CpuHit hit;
+			int rayMeshID = frame.getTlas().traceRay(ray, kRayFlagNone, 0xFF, hit) ? (int)hit.instanceIndex + 1 : 0;
+			int rasterMeshID = (int)frame.getNormal().at(x, y).a;
+			numCovered += rayMeshID || rasterMeshID ? 1 : 0;
+			numDiffering += rayMeshID != rasterMeshID ? 1 : 0;
+		}
+	}
+	bool rasterFailed = numDiffering > numCovered / 50;
+	benchmarkLog(format("  G-buffer against camera rays: %u of %u covered pixels show another mesh (%.2f%%)%s", numDiffering, numCovered,
+		100.0 * numDiffering / std::max(numCovered, 1u), rasterFailed ? ", FAILED: more than 2%" : ""));
+
+	// Frame 1 turns the camera a little, frame 2 keeps it still so every drawn pixel must be reprojected
+	desc.frameCount = 1;
+	desc.view = lookAtLH(eye, target + vec3(0.0f, 0.0f, 0.02f * size.x), vec3(0.0f, 1.0f, 0.0f));
+	renderTimedFrame(frame, desc, times);
+	uint32_t numDrawn, numAccepted;
+	countReprojectedPixels(frame, numDrawn, numAccepted);
+	benchmarkLog(format("  frame 1, camera turned: %.1f%% of %u drawn pixels reprojected, %s", 100.0 * numAccepted / std::max(numDrawn, 1u), numDrawn, formatFrameTimes(times).c_str()));
+
+	desc.frameCount = 2;
+	renderTimedFrame(frame, desc, times);
+	countReprojectedPixels(frame, numDrawn, numAccepted);
+	benchmarkLog(format("  frame 2, still: %u of %u drawn pixels reprojected%s, %s", numAccepted, numDrawn,
+		numAccepted != numDrawn ? " FAILED" : "", formatFrameTimes(times).c_str()));
+
+	std::string prefix = getSceneName(pFileName) + "_cpu_frame";
+	benchmarkLog(frame.save(prefix.c_str()) ? format("  wrote %s_*.pfm and %s_output.ppm", prefix.c_str(), prefix.c_str()) : format("  FAILED to write %s_*", prefix.c_str()));
+
+	// The same small frame on two threads and on all of them must match to the bit
+	CpuFrameDesc smallDesc = desc;
+	smallDesc.width = 160;
+	smallDesc.height = 90;
+	smallDesc.projection = perspectiveFovLH_ZO(half_pi<float>(), (float)smallDesc.width, (float)smallDesc.height, 0.1f, 100.0f);
+	TaskPool twoThreads(1);
+	CpuFrame otherFrame;
+	otherFrame.setScene(meshes, &twoThreads);
+	otherFrame.render(smallDesc);
+	frame.render(smallDesc);
+	uint32_t numMismatches = 0;
+	for (size_t p = 0; p < frame.getOutput().texels.size(); p++)
+	{
+		numMismatches += memcmp(&frame.getOutput().texels[p], &otherFrame.getOutput().texels[p], sizeof(vec4)) != 0 ? 1 : 0;
+	}
+	benchmarkLog(format("  %ux%u on 2 threads against %u: %s", smallDesc.width, smallDesc.height, TaskPool::getGlobal().getNumThreads(),
+		numMismatches ? format("FAILED, %u pixels differ", numMismatches).c_str() : "identical"));
+}
+
+void benchmarkIndirectLight(const char* pFileName)
+{
+	CpuFrameModel model;
+	if (!loadCpuFrameModel(pFileName, "Indirect light", model))
+	{
+		return;
+	}
+	const CpuFrameScene& scene = model.scene;
+
+	// Frame 0 with the scalar port of Hit.hlsl and with the batched kernel, every pixel takes the full 200 RSM samples
+	CpuFrameDesc desc = scene.desc;
+	CpuFrame scalarFrame;
+	scalarFrame.setScene(scene.meshes);
+	CpuFrame batchedFrame;
+	batchedFrame.setScene(scene.meshes);
+	double times[7];
+	desc.batchedIndirectLight = false;
+	renderTimedFrame(scalarFrame, desc, times);
+	double scalarRaysMs = times[3];
+	desc.batchedIndirectLight = true;
+	renderTimedFrame(batchedFrame, desc, times);
+	double batchedRaysMs = times[3];
+	benchmarkLog(format("Indirect light: %s, %ux%u, RSM %u, rays pass %.1f ms scalar, %.1f ms batched", pFileName, desc.width, desc.height, desc.rsmSize,
+		scalarRaysMs, batchedRaysMs));
+
+	// Same operations in the same order, so the images match unless the compiler contracts the scalar ones into FMAs
+	const std::vector<vec4>& scalarTexels = scalarFrame.getRtOutput().texels;
+	const std::vector<vec4>& batchedTexels = batchedFrame.getRtOutput().texels;
+	uint32_t numIdentical = 0;
+	uint32_t numFar = 0;
+	double maxDifference = 0.0;
+	double sumDifference = 0.0;
+	for (size_t p = 0; p < scalarTexels.size(); p++)
+	{
+		vec3 a = vec3(scalarTexels[p]);
+		vec3 b = vec3(batchedTexels[p]);
+		numIdentical += a == b ? 1 : 0;
+		double difference = (double)length(a - b) / std::max((double)length(a), 1e-3);
+		maxDifference = std::max(maxDifference, difference);
+		sumDifference += difference;
+		numFar += difference > 0.01 ? 1 : 0;
+	}
+	uint32_t numPixels = (uint32_t)scalarTexels.size();
+	double meanDifference = sumDifference / std::max(numPixels, 1u);
+	bool imageFailed = meanDifference >= 1e-3 || numFar > numPixels / 1000;
+	benchmarkLog(format("  batched against scalar: %u of %u pixels identical, relative difference mean %.2e max %.2e, %u above 1%%%s", numIdentical, numPixels,
+		meanDifference, maxDifference, numFar, imageFailed ? ", FAILED" : ""));
+
+	// The kernel alone, on the G-buffer hit points with the RSM of that frame
+	std::vector<CpuIndirectLightQuery> queries;
+	const CpuImage<vec4>& position = batchedFrame.getPosition();
+	const CpuImage<vec4>& normal = batchedFrame.getNormal();
+	for (uint32_t p = 0; p < (uint32_t)normal.texels.size(); p++)
+	{
+		if (normal.texels[p].a == 0.0f)
+		{
+			continue;
+		}
+		CpuIndirectLightQuery query;
+		query.hitPoint = vec3(position.texels[p]);
+		query.normal = normalize(vec3(normal.texels[p]) * 2.0f - 1.0f);
+		query.seed = p * 0x9e3779b9u + 1;
+		queries.push_back(query);
+	}
+	std::vector<vec3> scalarColors(queries.size());
+	std::vector<vec3> batchedColors(queries.size());
+	BenchmarkTimer timer;
+	uint64_t numScalarSamples = batchedFrame.gatherIndirectLight(queries.data(), (uint32_t)queries.size(), scalarColors.data(), false);
+	double scalarMs = timer.getElapsedMs();
+	timer.reset();
+	uint64_t numBatchedSamples = batchedFrame.gatherIndirectLight(queries.data(), (uint32_t)queries.size(), batchedColors.data(), true);
+	double batchedMs = timer.getElapsedMs();
+	uint32_t numMismatches = 0;
+	for (size_t q = 0; q < queries.size(); q++)
+	{
+		numMismatches += scalarColors[q] != batchedColors[q] ? 1 : 0;
+	}
+	benchmarkLog(format("  %u hit points: scalar %.1f ms (%.1f M samples/s), batched %.1f ms (%.1f M samples/s), %.2fx%s", (uint32_t)queries.size(),
+		scalarMs, numScalarSamples / std::max(scalarMs, 1e-3) * 1e-3, batchedMs, numBatchedSamples / std::max(batchedMs, 1e-3) * 1e-3,
+		scalarMs / std::max(batchedMs, 1e-3), numScalarSamples != numBatchedSamples ? ", FAILED: sample counts differ" : ""));
+	benchmarkLog(format("  %u of %u hit points differ", numMismatches, (uint32_t)queries.size()));
+}
+
+// Camera at the origin looking down +z, like the LH projections of RtRsm
+static Frustum getTestFrustum()
+{
+	mat4 projection = perspectiveFovLH_ZO(radians(60.0f), 1920.0f, 1080.0f, 0.1f, 100.0f);
+	mat4 view = lookAtLH(vec3(0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f));
+	return extractFrustum(projection * view);
+}
+
+static bool isVisible(const Frustum& frustum, const vec3& center, const vec3& extent)
+{
+	BoundingBoxes boxes;
+	boxes.resize(1);
+	boxes.set(0, center, extent);
+	uint32_t visible;
+	return cullBoxes(frustum, boxes, &visible) == 1;
+}
+
+static bool validateFrustumCulling(const BoundingBoxes& randomBoxes)
+{
+	Frustum frustum = getTestFrustum();
+	struct Case
+	{
+		vec3 center;
+		vec3 extent;
+		bool visible;
+	};
+	const Case cases[] =
+	{
+		{ vec3(0.0f, 0.0f, 10.0f), vec3(1.0f), true },		// in front
+		{ vec3(0.0f, 0.0f, -10.0f), vec3(1.0f), false },	// behind
+		{ vec3(0.0f, 0.0f, 0.0f), vec3(0.5f), true },		// around the near plane
+		{ vec3(0.0f, 0.0f, 200.0f), vec3(1.0f), false },	// beyond the far plane
+		{ vec3(0.0f, 0.0f, 150.0f), vec3(60.0f), true },	// crossing the far plane
+		{ vec3(100.0f, 0.0f, 10.0f), vec3(1.0f), false },	// right of the frustum
+		{ vec3(0.0f, -100.0f, 10.0f), vec3(1.0f), false },	// below
+		{ vec3(0.0f, 0.0f, 50.0f), vec3(500.0f), true },	// contains the frustum
+	};
+	for (const Case& c : cases)
+	{
+		if (isVisible(frustum, c.center, c.extent) != c.visible)
+		{
+			benchmarkLog(format("Frustum culling: wrong result for the box at (%.1f, %.1f, %.1f)", c.center.x, c.center.y, c.center.z));
+			return false;
+		}
+	}
+
+	// Transformed boxes have to contain all transformed corners
+	mat4 transform = translate(mat4(), vec3(1.0f, 2.0f, 3.0f)) * rotate(mat4(), radians(30.0f), normalize(vec3(1.0f, 1.0f, 0.0f))) * scale(mat4(), vec3(2.0f, 0.5f, 1.0f));
+	vec3 center, extent;
+	transformBoundingBox(transform, vec3(1.0f), vec3(1.0f, 2.0f, 3.0f), center, extent);
+	for (uint32_t corner = 0; corner < 8; corner++)
+	{
+		vec3 sign((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+		vec3 p = vec3(transform * vec4(vec3(1.0f) + sign * vec3(1.0f, 2.0f, 3.0f), 1.0f));
+		if (any(greaterThan(abs(p - center), extent + 1e-4f)))
+		{
+			benchmarkLog("Frustum culling: transformed box doesn't contain its corners");
+			return false;
+		}
+	}
+
+	// The SSE path must agree with the reference, including the remainder that isn't a multiple of 4
+	std::vector<uint32_t> visible(randomBoxes.size());
+	std::vector<uint32_t> reference(randomBoxes.size());
+	uint32_t numVisible = cullBoxes(frustum, randomBoxes, visible.data());
+	uint32_t numReference = cullBoxesScalar(frustum, randomBoxes, reference.data());
+	if (numVisible != numReference || !std::equal(visible.begin(), visible.begin() + numVisible, reference.begin()))
+	{
+		benchmarkLog(format("Frustum culling: kernel and reference differ, %u versus %u visible boxes", numVisible, numReference));
+		return false;
+	}
+	return true;
+}
+
+void benchmarkFrustumCulling()
+{
+	const uint32_t kNumBoxes = 100 * 1000 + 3;
+	const int kRuns = 20;
+
+	// Boxes all around the camera, about 7% of them touch the frustum
+	BoundingBoxes boxes;
+	boxes.resize(kNumBoxes);
+	uint32_t seed = 1;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	for (uint32_t b = 0; b < kNumBoxes; b++)
+	{
+		vec3 center(random(), random(), random());
+		vec3 extent(random(), random(), random());
+		boxes.set(b, (center * 2.0f - 1.0f) * 120.0f, extent * 5.0f);
+	}
+
+	if (!validateFrustumCulling(boxes))
+	{
+		return;
+	}
+
+	Frustum frustum = getTestFrustum();
+	std::vector<uint32_t> visible(kNumBoxes);
+	uint32_t numVisible = 0;
+	BenchmarkTimer timer;
+	for (int run = 0; run < kRuns; run++)
+	{
+		numVisible = cullBoxesScalar(frustum, boxes, visible.data());
+	}
+	double scalarMs = timer.getElapsedMs() / kRuns;
+	timer.reset();
+	for (int run = 0; run < kRuns; run++)
+	{
+		numVisible = cullBoxes(frustum, boxes, visible.data());
+	}
+	double simdMs = timer.getElapsedMs() / kRuns;
+
+	benchmarkLog(format("Frustum culling: %u boxes, %u visible, validation passed", kNumBoxes, numVisible));
+	benchmarkLog(format("  scalar %.3f ms (%.2f ns/box), SSE %.3f ms (%.2f ns/box), %.2fx",
+		scalarMs, 1e6 * scalarMs / kNumBoxes, simdMs, 1e6 * simdMs / kNumBoxes, scalarMs / std::max(simdMs, 1e-6)));
+}
+
+// Instances of a few models with random mesh offsets, one hit group per instance
+static void createTestInstances(SceneInstances& instances)
+{
+	static const uint32_t kMeshesPerModel[] = { 40, 1, 7, 300 };
+	uint32_t seed = 7;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	instances.clear();
+	for (uint32_t meshes : kMeshesPerModel)
+	{
+		uint32_t first = instances.addModel(meshes);
+		for (uint32_t i = 0; i < meshes; i++)
+		{
+			vec3 offset = (vec3(random(), random(), random()) * 2.0f - 1.0f) * 10.0f;
+			instances.setInstance(first + i, 0x100000ull * (first + i), 2 * (first + i), i % 2 ? 0x01 : 0xFF, 4, offset);
+		}
+	}
+}
+
+static mat4 getTestTransform(ModelHandle model, uint32_t frame)
+{
+	return translate(mat4(), vec3(1.0f * model, 0.5f, -2.0f)) * rotate(mat4(), 0.01f * frame + model, normalize(vec3(1.0f, 2.0f, 0.5f))) * scale(mat4(), vec3(0.5f + model));
+}
+
+// Compare the instance descs against the full matrix product and the values given to setInstance
+static bool validateInstanceDescs(const SceneInstances& instances, const std::vector<TlasInstanceDesc>& descs, uint32_t frame)
+{
+	uint32_t seed = 7;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+	{
+		uint32_t first = instances.getFirstInstance(model);
+		for (uint32_t i = 0; i < instances.getInstanceCount(model); i++)
+		{
+			const TlasInstanceDesc& desc = descs[first + i];
+			vec3 offset = (vec3(random(), random(), random()) * 2.0f - 1.0f) * 10.0f;
+			mat4 expected = transpose(getTestTransform(model, frame) * translate(mat4(), offset));
+			float maxError = 0.0f;
+			for (int row = 0; row < 3; row++)
+			{
+				for (int column = 0; column < 4; column++)
+				{
+					maxError = std::max(maxError, std::abs(desc.transform[row][column] - expected[row][column]));
+				}
+			}
+			if (maxError > 1e-4f || desc.instanceID != i || desc.instanceMask != (i % 2 ? 0x01u : 0xFFu) ||
+				desc.hitGroupIndex != 2 * (first + i) || desc.flags != 4 || desc.accelerationStructure != 0x100000ull * (first + i))
+			{
+				benchmarkLog(format("Scene instances: wrong instance %u of model %u (transform error %g)", i, model, maxError));
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void benchmarkSceneInstances()
+{
+	const uint32_t kFrames = 1000;
+
+	SceneInstances instances;
+	createTestInstances(instances);
+	std::vector<TlasInstanceDesc> descs(instances.getNumInstances());
+
+	// The per-frame TLAS path: new transforms for every model, then the instance descs
+	uint64_t allocationsBefore = getAllocationCount();
+	BenchmarkTimer timer;
+	for (uint32_t frame = 0; frame < kFrames; frame++)
+	{
+		for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+		{
+			instances.setModelTransform(model, getTestTransform(model, frame));
+		}
+		instances.writeInstanceDescs(descs.data());
+	}
+	double frameMs = timer.getElapsedMs() / kFrames;
+	uint64_t allocations = getAllocationCount() - allocationsBefore;
+
+	if (!validateInstanceDescs(instances, descs, kFrames - 1))
+	{
+		return;
+	}
+	if (allocations != 0)
+	{
+		benchmarkLog(format("Scene instances: the TLAS update path made %llu allocations in %u frames, expected none", (unsigned long long)allocations, kFrames));
+		return;
+	}
+	benchmarkLog(format("Scene instances: %u models, %u instances, %.4f ms per TLAS update, %s in %u frames, validation passed",
+		instances.getNumModels(), instances.getNumInstances(), frameMs, kAllocationsCounted ? "0 allocations" : "allocations not counted", kFrames));
+}
+
+void benchmarkTlasUpdates()
+{
+	// Still scene, then one model turning in place, then 64 single instance models of debris flying apart
+	const uint32_t kStillFrames = 100;
+	const uint32_t kTurnFrames = 200;
+	const uint32_t kDebrisFrames = 300;
+	const uint32_t kFrames = kStillFrames + kTurnFrames + kDebrisFrames;
+	const uint32_t kNumDebris = 64;
+	const ModelHandle kTurningModel = 1;
+
+	SceneInstances instances;
+	createTestInstances(instances);
+	ModelHandle firstDebris = instances.getNumModels();
+	uint32_t seed = 11;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	std::vector<vec3> debrisStart, debrisVelocity;
+	for (uint32_t d = 0; d < kNumDebris; d++)
+	{
+		uint32_t instance = instances.addModel(1);
+		instances.setInstance(instance, 0x100000ull * instance, 2 * instance, 0xFF, 4, vec3(0.0f));
+		debrisStart.push_back((vec3(random(), random(), random()) * 2.0f - 1.0f) * 10.0f);
+		debrisVelocity.push_back(normalize(vec3(random(), random(), random()) * 2.0f - 1.0f) * 0.2f);
+	}
+	for (uint32_t i = 0; i < instances.getNumInstances(); i++)
+	{
+		instances.setInstanceBounds(i, vec3(random(), random(), random()) - 0.5f, vec3(0.2f) + vec3(random(), random(), random()));
+	}
+	auto getTransform = [&](ModelHandle model, uint32_t frame)
+	{
+		if (model >= firstDebris)
+		{
+			float t = (float)(frame > kStillFrames + kTurnFrames ? frame - kStillFrames - kTurnFrames : 0);
+			return translate(mat4(), debrisStart[model - firstDebris] + t * debrisVelocity[model - firstDebris]);
+		}
+		return getTestTransform(model, model == kTurningModel && frame >= kStillFrames ? frame : 0);
+	};
+	for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+	{
+		instances.setModelTransform(model, getTransform(model, 0));
+	}
+
+	// The mapped instance buffer of RtRsm::buildTopLevelAS, and what a full write gives
+	std::vector<TlasInstanceDesc> descs(instances.getNumInstances()), reference(instances.getNumInstances());
+	TlasUpdatePolicy policy;
+	instances.writeInstanceDescs(descs.data());
+	instances.clearDirty();
+	policy.onRebuild(instances);
+
+	uint32_t numFrames[3][3] = {};		// phase, build type
+	uint64_t numWritten[3] = {};
+	uint32_t numWrong = 0;
+	uint64_t allocations = 0;
+	double updateMs = 0.0;
+	float maxSahCost = 0.0f;
+	for (uint32_t frame = 0; frame < kFrames; frame++)
+	{
+		uint32_t phase = frame < kStillFrames ? 0 : frame < kStillFrames + kTurnFrames ? 1 : 2;
+		for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+		{
+			instances.setModelTransform(model, getTransform(model, frame));
+		}
+
+		uint64_t allocationsBefore = getAllocationCount();
+		BenchmarkTimer timer;
+		TlasBuildType type = policy.chooseBuild(instances);
+		uint32_t written = type == TlasBuildType::None ? 0 : instances.writeDirtyInstanceDescs(descs.data());
+		updateMs += timer.getElapsedMs();
+		if (type != TlasBuildType::Rebuild)
+		{
+			allocations += getAllocationCount() - allocationsBefore;
+		}
+		numFrames[phase][(uint32_t)type]++;
+		numWritten[phase] += written;
+		maxSahCost = std::max(maxSahCost, policy.getSahCost() / policy.getRebuildSahCost());
+
+		// Only the changed instances are written, the buffer must still match a full write
+		instances.writeInstanceDescs(reference.data());
+		numWrong += memcmp(descs.data(), reference.data(), descs.size() * sizeof(TlasInstanceDesc)) != 0 ? 1 : 0;
+		if (type == TlasBuildType::Rebuild && policy.getSahCost() != policy.getRebuildSahCost())
+		{
+			numWrong++;
+		}
+	}
+
+	const char* kPhases[] = { "still", "1 instance turning", "64 instances of debris" };
+	uint32_t phaseFrames[] = { kStillFrames, kTurnFrames, kDebrisFrames };
+	bool passed = numWrong == 0 && allocations == 0 && numFrames[0][(uint32_t)TlasBuildType::None] == kStillFrames &&
+		numFrames[1][(uint32_t)TlasBuildType::None] == 0 && numFrames[2][(uint32_t)TlasBuildType::Rebuild] > 0;
+	benchmarkLog(format("TLAS updates: %u instances, %u frames, %.4f ms per frame for the build choice and the dirty descs, refits up to %.2fx the rebuilt SAH cost, %s",
+		instances.getNumInstances(), kFrames, updateMs / kFrames, maxSahCost,
+		passed ? (kAllocationsCounted ? "validation passed" : "validation passed, allocations not counted") : format("FAILED: %u frames wrong, %llu allocations outside rebuilds", numWrong, (unsigned long long)allocations).c_str()));
+	for (uint32_t phase = 0; phase < 3; phase++)
+	{
+		benchmarkLog(format("  %-22s %3u unchanged  %3u refits  %3u rebuilds  %6.1f instances written per frame",
+			kPhases[phase], numFrames[phase][0], numFrames[phase][1], numFrames[phase][2], (double)numWritten[phase] / phaseFrames[phase]));
+	}
+}
+
+// Objects of the frame recordTestFrame records, in the order they are added
+enum TestCommandObject : uint32_t
+{
+	kTestHeap, kTestRtvHeap, kTestDsvHeap,
+	kTestGBufferRootSig, kTestGBufferPipeline, kTestMotionRootSig, kTestMotionPipeline, kTestShadowRootSig, kTestShadowPipeline,
+	kTestRtRootSig, kTestRtPipeline, kTestTemporalRootSig, kTestTemporalPipeline, kTestBlurRootSig, kTestBlurHorzPipeline,
+	kTestBlurVertPipeline, kTestToneMapRootSig, kTestToneMapPipeline,
+	kTestGeometry, kTestShaderTable, kTestDepth, kTestPreviousDepth, kTestNormal, kTestPreviousNormal, kTestColor,
+	kTestMotionVectors, kTestShadowDepth, kTestRtOutput, kTestIndirectHistory, kTestDirectHistory, kTestTemporalIndirect,
+	kTestTemporalDirect, kTestBlur1, kTestBlur2, kTestFiltered, kTestToneMapped, kTestBackBuffer,
+};
+
+static void createTestCommandObjects(CommandStream& stream)
+{
+	const uint64_t kPixels = 1920 * 1080;
+	stream.addObject(CommandObjectType::DescriptorHeap, "CBV/SRV/UAV heap", 64);
+	stream.addObject(CommandObjectType::DescriptorHeap, "RTV heap", 16);
+	stream.addObject(CommandObjectType::DescriptorHeap, "DSV heap", 4);
+	const char* kPasses[] = { "G-buffer", "Motion vectors", "Shadow map", "Ray trace", "Temporal filter" };
+	for (const char* pPass : kPasses)
+	{
+		stream.addObject(CommandObjectType::RootSignature, std::string(pPass) + " root signature");
+		stream.addObject(pPass == kPasses[3] ? CommandObjectType::StateObject : CommandObjectType::PipelineState, std::string(pPass) + " pipeline");
+	}
+	stream.addObject(CommandObjectType::RootSignature, "Spatial filter root signature");
+	stream.addObject(CommandObjectType::PipelineState, "Spatial filter horizontal pipeline");
+	stream.addObject(CommandObjectType::PipelineState, "Spatial filter vertical pipeline");
+	stream.addObject(CommandObjectType::RootSignature, "Tone mapping root signature");
+	stream.addObject(CommandObjectType::PipelineState, "Tone mapping pipeline");
+	stream.addObject(CommandObjectType::Resource, "Geometry arena page 0", 64 << 20);
+	stream.addObject(CommandObjectType::Resource, "Ray trace shader table", 64 << 10);
+	stream.addObject(CommandObjectType::Resource, "G-buffer depth", kPixels * 4);
+	stream.addObject(CommandObjectType::Resource, "G-buffer previous depth", kPixels * 4);
+	stream.addObject(CommandObjectType::Resource, "G-buffer normal", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "G-buffer previous normal", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "G-buffer color", kPixels * 8);
+	stream.addObject(CommandObjectType::Resource, "Motion vectors", kPixels * 8);
+	stream.addObject(CommandObjectType::Resource, "Shadow map depth", 2048 * 2048 * 4);
+	stream.addObject(CommandObjectType::Resource, "Ray trace indirect output", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Indirect color history", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Direct color history", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Temporal filter indirect output", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Temporal filter direct output", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Spatial filter pass 1 output", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Spatial filter pass 2 output", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Filtered indirect color", kPixels * 16);
+	stream.addObject(CommandObjectType::Resource, "Tone mapping output", kPixels * 4);
+	stream.addObject(CommandObjectType::Resource, "Swap chain buffer 0", kPixels * 4);
+}
+
+/*
+	Records what RtRsm::onFrameRender does, with the same passes, transitions and copies, and returns the number of
+	transitions. With injectErrors, a round trip and a transition to the same state (3 redundant transitions) and a
+	transition from the wrong state are added.
+*/
+static uint32_t recordTestFrame(CommandStream& stream, uint32_t numDraws, bool injectErrors)
+{
+	uint32_t numTransitions = 0;
+	auto transition = [&](uint32_t resource, uint32_t before, uint32_t after)
+	{
+		CommandBarrier barrier;
+		barrier.resource = resource;
+		barrier.before = before;
+		barrier.after = after;
+		stream.resourceBarrier(1, &barrier);
+		numTransitions++;
+	};
+	auto descriptor = [](uint32_t heap, uint32_t index)
+	{
+		CommandDescriptor d;
+		d.heap = heap;
+		d.index = index;
+		return d;
+	};
+	auto address = [](uint32_t resource, uint64_t offset)
+	{
+		CommandAddress a;
+		a.resource = resource;
+		a.offset = offset;
+		return a;
+	};
+	CommandViewport viewport;
+	viewport.width = 1920.0f;
+	viewport.height = 1080.0f;
+	CommandRect scissor;
+	scissor.right = 1920;
+	scissor.bottom = 1080;
+	const float kClearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const uint32_t kHeap = kTestHeap;
+	const CommandBindPoint kGraphics = CommandBindPoint::Graphics;
+	const CommandBindPoint kCompute = CommandBindPoint::Compute;
+	auto drawMeshes = [&](bool normals)
+	{
+		for (uint32_t d = 0; d < numDraws; d++)
+		{
+			uint64_t offset = (uint64_t)d << 16;
+			stream.setRootView(kGraphics, CommandRootView::ConstantBuffer, 1, address(kTestGeometry, offset));
+			if (normals)
+			{
+				stream.setRootView(kGraphics, CommandRootView::ShaderResource, 2, address(kTestGeometry, offset + 256));
+			}
+			CommandVertexBufferView vertices;
+			vertices.address = address(kTestGeometry, offset + 4096);
+			vertices.size = 12 * 1000;
+			vertices.stride = 12;
+			CommandIndexBufferView indices;
+			indices.address = address(kTestGeometry, offset + 16384);
+			indices.size = 4 * 3000;
+			indices.format = 42;		// DXGI_FORMAT_R32_UINT
+			stream.setVertexBuffers(0, 1, &vertices);
+			stream.setIndexBuffer(&indices);
+			float color[3] = { 0.5f, 0.5f, (float)d };
+			stream.setRoot32BitConstants(kGraphics, 3, 3, color, 0);
+			stream.drawIndexedInstanced(3000, 1, 0, 0, 0);
+		}
+	};
+	auto setGraphicsPass = [&](uint32_t rootSignature, uint32_t pipelineState)
+	{
+		stream.setPipelineState(pipelineState);
+		stream.setRootSignature(kGraphics, rootSignature);
+		stream.setViewports(1, &viewport);
+		stream.setScissorRects(1, &scissor);
+	};
+	const uint32_t kHeaps[] = { kTestHeap };
+	stream.setDescriptorHeaps(1, kHeaps);
+
+	stream.beginEvent("Render G-buffer");
+	transition(kTestDepth, kResourceStatePixelShaderResource, kResourceStateDepthWrite);
+	transition(kTestNormal, kResourceStatePixelShaderResource, kResourceStateRenderTarget);
+	transition(kTestColor, kResourceStatePixelShaderResource, kResourceStateRenderTarget);
+	setGraphicsPass(kTestGBufferRootSig, kTestGBufferPipeline);
+	stream.setRootDescriptorTable(kGraphics, 0, descriptor(kHeap, 1));
+	stream.setStencilRef(0);
+	CommandDescriptor gBufferRtvs[] = { descriptor(kTestRtvHeap, 3), descriptor(kTestRtvHeap, 4), descriptor(kTestRtvHeap, 5) };
+	CommandDescriptor depthDsv = descriptor(kTestDsvHeap, 1);
+	for (const CommandDescriptor& rtv : gBufferRtvs)
+	{
+		stream.clearRenderTargetView(rtv, kClearColor);
+	}
+	stream.clearDepthStencilView(depthDsv, 1, 1.0f, 0);
+	stream.setRenderTargets(3, gBufferRtvs, &depthDsv);
+	stream.setPrimitiveTopology(4);		// D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST
+	drawMeshes(true);
+	stream.endEvent();
+
+	stream.beginEvent("Render Motion Vectors");
+	transition(kTestMotionVectors, kResourceStatePixelShaderResource, kResourceStateRenderTarget);
+	transition(kTestNormal, kResourceStateRenderTarget, kResourceStatePixelShaderResource);
+	transition(kTestDepth, kResourceStateDepthWrite, kResourceStatePixelShaderResource);
+	setGraphicsPass(kTestMotionRootSig, kTestMotionPipeline);
+	stream.setRootDescriptorTable(kGraphics, 0, descriptor(kHeap, 1));
+	stream.setRootDescriptorTable(kGraphics, 2, descriptor(kHeap, 10));
+	CommandDescriptor motionRtv = descriptor(kTestRtvHeap, 6);
+	CommandDescriptor motionDsv = descriptor(kTestDsvHeap, 2);
+	stream.clearRenderTargetView(motionRtv, kClearColor);
+	stream.clearDepthStencilView(motionDsv, 1, 1.0f, 0);
+	stream.setRenderTargets(1, &motionRtv, &motionDsv);
+	drawMeshes(false);
+	transition(kTestMotionVectors, kResourceStateRenderTarget, kResourceStatePixelShaderResource);
+	stream.endEvent();
+
+	// History of depth and normals, outside of the events like in renderMotionVectors
+	const uint32_t kHistories[2][2] = { { kTestDepth, kTestPreviousDepth }, { kTestNormal, kTestPreviousNormal } };
+	for (const uint32_t* pCopy : kHistories)
+	{
+		transition(pCopy[0], kResourceStatePixelShaderResource, kResourceStateCopySource);
+		transition(pCopy[1], kResourceStatePixelShaderResource, kResourceStateCopyDest);
+		stream.copyResource(pCopy[1], pCopy[0]);
+		transition(pCopy[0], kResourceStateCopySource, kResourceStatePixelShaderResource);
+		transition(pCopy[1], kResourceStateCopyDest, kResourceStatePixelShaderResource);
+	}
+
+	stream.beginEvent("Rasterize shadow map");
+	stream.setPipelineState(kTestShadowPipeline);
+	stream.setRootSignature(kGraphics, kTestShadowRootSig);
+	stream.setDescriptorHeaps(1, kHeaps);
+	stream.setRootDescriptorTable(kGraphics, 0, descriptor(kHeap, 0));
+	stream.setViewports(1, &viewport);
+	stream.setScissorRects(1, &scissor);
+	transition(kTestShadowDepth, kResourceStateNonPixelShaderResource, kResourceStateDepthWrite);
+	CommandDescriptor shadowDsv = descriptor(kTestDsvHeap, 0);
+	stream.clearDepthStencilView(shadowDsv, 1, 1.0f, 0);
+	stream.setRenderTargets(0, nullptr, &shadowDsv);
+	drawMeshes(true);
+	transition(kTestShadowDepth, kResourceStateDepthWrite, kResourceStateNonPixelShaderResource);
+	stream.endEvent();
+
+	stream.beginEvent("Raytrace");
+	transition(kTestRtOutput, injectErrors ? kResourceStateNonPixelShaderResource : kResourceStatePixelShaderResource, kResourceStateUnorderedAccess);
+	stream.setRootSignature(kCompute, kTestRtRootSig);
+	stream.setPipelineState1(kTestRtPipeline);
+	CommandDispatchRays rays;
+	rays.rayGeneration.address = address(kTestShaderTable, 0);
+	rays.rayGeneration.size = 64;
+	rays.miss.address = address(kTestShaderTable, 64);
+	rays.miss.size = 128;
+	rays.miss.stride = 64;
+	rays.hitGroup.address = address(kTestShaderTable, 192);
+	rays.hitGroup.size = 64 * 60;
+	rays.hitGroup.stride = 64;
+	rays.width = 1920;
+	rays.height = 1080;
+	stream.dispatchRays(rays);
+	stream.endEvent();
+
+	stream.beginEvent("Temporal Filtering");
+	transition(kTestRtOutput, kResourceStateUnorderedAccess, kResourceStatePixelShaderResource);
+	transition(kTestIndirectHistory, kResourceStateNonPixelShaderResource, kResourceStatePixelShaderResource);
+	transition(kTestDirectHistory, kResourceStateCopyDest, kResourceStatePixelShaderResource);
+	transition(kTestTemporalIndirect, kResourceStateCopySource, kResourceStateRenderTarget);
+	transition(kTestTemporalDirect, kResourceStateCopySource, kResourceStateRenderTarget);
+	setGraphicsPass(kTestTemporalRootSig, kTestTemporalPipeline);
+	stream.setRootDescriptorTable(kGraphics, 0, descriptor(kHeap, 20));
+	stream.setRootDescriptorTable(kGraphics, 1, descriptor(kHeap, 22));
+	uint32_t dropHistory = 0;
+	stream.setRoot32BitConstants(kGraphics, 2, 1, &dropHistory, 0);
+	CommandDescriptor temporalRtvs[] = { descriptor(kTestRtvHeap, 7), descriptor(kTestRtvHeap, 8) };
+	stream.clearRenderTargetView(temporalRtvs[0], kClearColor);
+	stream.clearRenderTargetView(temporalRtvs[1], kClearColor);
+	stream.setRenderTargets(2, temporalRtvs, nullptr);
+	stream.setVertexBuffers(0, 0, nullptr);
+	stream.setIndexBuffer(nullptr);
+	stream.drawInstanced(6, 1, 0, 0);
+	const uint32_t kTemporalCopies[2][2] = { { kTestTemporalIndirect, kTestIndirectHistory }, { kTestTemporalDirect, kTestDirectHistory } };
+	for (const uint32_t* pCopy : kTemporalCopies)
+	{
+		transition(pCopy[0], kResourceStateRenderTarget, kResourceStateCopySource);
+		transition(pCopy[1], kResourceStatePixelShaderResource, kResourceStateCopyDest);
+		stream.copyResource(pCopy[1], pCopy[0]);
+	}
+	stream.endEvent();
+
+	stream.beginEvent("Spatial filter");
+	transition(kTestIndirectHistory, kResourceStateCopyDest, kResourceStateNonPixelShaderResource);
+	stream.setRootSignature(kCompute, kTestBlurRootSig);
+	stream.setDescriptorHeaps(1, kHeaps);
+	stream.setRootDescriptorTable(kCompute, 3, descriptor(kHeap, 10));
+	stream.setRootDescriptorTable(kCompute, 4, descriptor(kHeap, 12));
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		uint32_t iteration = i + 1;
+		stream.setRoot32BitConstants(kCompute, 0, 1, &iteration, 0);
+		stream.setPipelineState(kTestBlurHorzPipeline);
+		stream.setRootDescriptorTable(kCompute, 1, descriptor(kHeap, i == 0 ? 21 : 31));
+		stream.setRootDescriptorTable(kCompute, 2, descriptor(kHeap, 32));
+		stream.dispatch(8, 1080, 1);
+		transition(kTestBlur2, i == 0 ? kResourceStateCopySource : kResourceStateNonPixelShaderResource, kResourceStateUnorderedAccess);
+		transition(kTestBlur1, kResourceStateUnorderedAccess, kResourceStateNonPixelShaderResource);
+		stream.setPipelineState(kTestBlurVertPipeline);
+		stream.setRootDescriptorTable(kCompute, 1, descriptor(kHeap, 33));
+		stream.setRootDescriptorTable(kCompute, 2, descriptor(kHeap, 34));
+		stream.dispatch(1920, 5, 1);
+		transition(kTestBlur1, kResourceStateNonPixelShaderResource, kResourceStateUnorderedAccess);
+		transition(kTestBlur2, kResourceStateUnorderedAccess, kResourceStateNonPixelShaderResource);
+	}
+	transition(kTestBlur2, kResourceStateNonPixelShaderResource, kResourceStateCopySource);
+	transition(kTestFiltered, kResourceStatePixelShaderResource, kResourceStateCopyDest);
+	stream.copyResource(kTestFiltered, kTestBlur2);
+	stream.endEvent();
+
+	stream.beginEvent("Tone Mapping");
+	transition(kTestToneMapped, kResourceStateCopySource, kResourceStateRenderTarget);
+	transition(kTestFiltered, kResourceStateCopyDest, kResourceStatePixelShaderResource);
+	transition(kTestColor, kResourceStateRenderTarget, kResourceStatePixelShaderResource);
+	if (injectErrors)
+	{
+		transition(kTestColor, kResourceStatePixelShaderResource, kResourceStateRenderTarget);
+		transition(kTestColor, kResourceStateRenderTarget, kResourceStatePixelShaderResource);
+	}
+	setGraphicsPass(kTestToneMapRootSig, kTestToneMapPipeline);
+	stream.setDescriptorHeaps(1, kHeaps);
+	stream.setRootDescriptorTable(kGraphics, 0, descriptor(kHeap, 40));
+	CommandDescriptor toneMapRtv = descriptor(kTestRtvHeap, 9);
+	stream.clearRenderTargetView(toneMapRtv, kClearColor);
+	stream.setRenderTargets(1, &toneMapRtv, nullptr);
+	stream.setPrimitiveTopology(4);
+	stream.drawInstanced(6, 1, 0, 0);
+	transition(kTestToneMapped, kResourceStateRenderTarget, kResourceStateCopySource);
+	if (injectErrors)
+	{
+		transition(kTestToneMapped, kResourceStateCopySource, kResourceStateCopySource);
+	}
+	stream.endEvent();
+
+	stream.beginEvent("Copy to back buffer");
+	transition(kTestBackBuffer, kResourceStateCommon, kResourceStateCopyDest);
+	stream.copyResource(kTestBackBuffer, kTestToneMapped);
+	stream.endEvent();
+	transition(kTestBackBuffer, kResourceStateCopyDest, kResourceStateCommon);
+	return numTransitions;
+}
+
+void benchmarkCommandStream()
+{
+	const uint32_t kNumDraws = 200;
+	const uint32_t kRuns = 200;
+	bool passed = true;
+	std::string failure;
+	auto check = [&](bool condition, const char* pWhat)
+	{
+		if (!condition && passed)
+		{
+			failure = pWhat;
+		}
+		passed = passed && condition;
+	};
+
+	// The first frame finds out the states, the second one begins in the states the first left them in
+	CommandStream stream;
+	createTestCommandObjects(stream);
+	recordTestFrame(stream, kNumDraws, false);
+	stream.clear();
+	uint32_t numTransitions = recordTestFrame(stream, kNumDraws, false);
+	NullCommandDevice device;
+	check(stream.replay(device), "replay failed");
+	const CommandStreamStats& stats = device.getStats();
+	uint64_t expectedBytes = stream.getObject(kTestPreviousDepth).size + stream.getObject(kTestPreviousNormal).size + stream.getObject(kTestIndirectHistory).size +
+		stream.getObject(kTestDirectHistory).size + stream.getObject(kTestFiltered).size + stream.getObject(kTestBackBuffer).size;
+	check(device.getNumErrors() == 0, "errors in the clean frame");
+	check(stats.numCommands == stream.getNumCommands() && stats.numBarriers == numTransitions && stats.numTransitions == numTransitions, "wrong barrier count");
+	check(stats.numCopies == 6 && stats.bytesCopied == expectedBytes, "wrong bytes copied");
+	check(stats.numDraws == 3 * kNumDraws + 2 && stats.numDispatches == 11, "wrong draw or dispatch count");
+	check(stats.numRedundantTransitions == 0 && stats.numMismatchedTransitions == 0, "redundant or mismatched transitions in the clean frame");
+	check(stats.numRedundantBindings == 3, "SetDescriptorHeaps of the bound heap not counted");
+	check(device.getPasses().size() == 9 && device.getPasses().back().name == "outside of events", "wrong passes");
+
+	// Injected round trip, transition to the same state and transition from the wrong state
+	CommandStream injected;
+	createTestCommandObjects(injected);
+	recordTestFrame(injected, kNumDraws, false);
+	injected.clear();
+	recordTestFrame(injected, kNumDraws, true);
+	NullCommandDevice injectedDevice;
+	injected.replay(injectedDevice);
+	check(injectedDevice.getStats().numRedundantTransitions == 3, "injected redundant transitions not found");
+	check(injectedDevice.getStats().numMismatchedTransitions == 1 && injectedDevice.getNumErrors() == 1, "injected mismatch not found");
+
+	// Save and load give the same stream, a broken file is rejected
+	const char* kFileName = "command_stream_benchmark.rtcs";
+	const char* kBrokenFileName = "command_stream_benchmark_broken.rtcs";
+	CommandStream loaded;
+	check(stream.save(kFileName) && loaded.load(kFileName), "save or load failed");
+	check(loaded.getText() == stream.getText(), "loaded stream differs");
+	std::vector<char> bytes;
+	{
+		std::ifstream file(kFileName, std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+	uint32_t brokenLength = 0xffff00 | (uint32_t)CommandOp::DrawInstanced;
+	memcpy(&bytes[bytes.size() - 40], &brokenLength, sizeof(brokenLength));
+	{
+		std::ofstream file(kBrokenFileName, std::ios::binary);
+		file.write(bytes.data(), bytes.size() - 40 + sizeof(brokenLength));
+	}
+	check(!loaded.load(kBrokenFileName) && loaded.getNumCommands() == 0 && loaded.getNumObjects() == 0, "broken file loaded");
+	remove(kFileName);
+	remove(kBrokenFileName);
+
+	// Replaying into a stream records it again
+	CommandStream replayed;
+	stream.replay(replayed);
+	check(replayed.getText() == stream.getText(), "replayed stream differs");
+
+	// Recording and replay throughput
+	BenchmarkTimer timer;
+	for (uint32_t run = 0; run < kRuns; run++)
+	{
+		stream.clear();
+		recordTestFrame(stream, kNumDraws, false);
+	}
+	double recordMs = timer.getElapsedMs() / kRuns;
+	timer.reset();
+	for (uint32_t run = 0; run < kRuns; run++)
+	{
+		stream.replay(device);
+	}
+	double replayMs = timer.getElapsedMs() / kRuns;
+
+	benchmarkLog(format("Command stream: %u commands, %.1f KB per frame, %s", stream.getNumCommands(), stream.getSizeInBytes() / 1024.0,
+		passed ? "validation passed" : ("FAILED: " + failure).c_str()));
+	benchmarkLog(format("  record %.3f ms (%.1f M commands/s), null device replay %.3f ms (%.1f M commands/s)",
+		recordMs, stream.getNumCommands() / (1e3 * recordMs), replayMs, stream.getNumCommands() / (1e3 * replayMs)));
+	benchmarkLog(device.getReport());
+}
+
+void runCpuBenchmarks()
+{
+	benchmarkLog("==== RT-RSM CPU benchmarks ====");
+	benchmarkFrustumCulling();
+	benchmarkSceneInstances();
+	benchmarkTlasUpdates();
+	benchmarkCommandStream();
+	for (const char* pScene : kBenchmarkScenes)
+	{
+		if (!fileExists(pScene))
+		{
+			benchmarkLog(format("Skipping %s, file not found", pScene));
+			continue;
+		}
+		benchmarkMeshCache(pScene);
+		benchmarkMeshIngestion(pScene);
+		benchmarkGeometryAllocator(pScene);
+		benchmarkMeshInstancing(pScene);
+		benchmarkVertexQuantization(pScene);
+		benchmarkIndexOptimization(pScene);
+		benchmarkMeshlets(pScene);
+		benchmarkMeshLods(pScene);
+		benchmarkBvhBuild(pScene);
+		benchmarkCpuRaytracing(pScene);
+		benchmarkWideBvh(pScene);
+		benchmarkBvhBuilders(pScene);
+		benchmarkSpatialSplits(pScene);
+		benchmarkOcclusionRays(pScene);
+		benchmarkShadowRaySorting(pScene);
+		benchmarkBvhCache(pScene);
+		benchmarkAsMemory(pScene);
+		benchmarkBlasRefit(pScene);
+		benchmarkAsStats(pScene);
+		benchmarkCpuFrame(pScene);
+		benchmarkIndirectLight(pScene);
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <chrono>
+#include <string>
+
+// Define to run the CPU-only benchmarks before the scene is loaded, it also makes Benchmark.cpp count every heap allocation
+//#define CPU_BENCHMARKS
+
+/*
+	CPU-only benchmarks. They don't need a device and can be run from RtRsm::onLoad by defining
+	CPU_BENCHMARKS above, with rtrsm_headless -benchmarks from the CMake build, or from any other executable by
+	calling runCpuBenchmarks().
+	Results are written to the debugger output / stdout and appended to benchmark.txt.
+	The checks that a path doesn't allocate only run with CPU_BENCHMARKS defined. Correctness tests are in Tests/
+	and run with ctest from the CMake build, these only measure.
+*/
+class BenchmarkTimer
+{
+public:
+	BenchmarkTimer() { reset(); }
+	void reset() { mStart = std::chrono::high_resolution_clock::now(); }
+	double getElapsedMs() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - mStart).count();
+	}
+
+private:
+	std::chrono::high_resolution_clock::time_point mStart;
+};
+
+void benchmarkLog(const std::string& line);
+
+// Cold assimp import versus a warm mesh cache hit
+void benchmarkMeshCache(const char* pFileName);
+
+// Parallel mesh conversion and upload-batch copies for 1..N threads
+void benchmarkMeshIngestion(const char* pFileName);
+
+// Geometry arena allocator: packing of a scene's buffers versus committed resources, churn and defragmentation
+void benchmarkGeometryAllocator(const char* pFileName);
+
+// Duplicate mesh detection: BLAS count before and after instancing and the geometry memory saved
+void benchmarkMeshInstancing(const char* pFileName);
+
+// Quantized vertex streams: measured round trip error against the analytic bound, stream sizes and encode time
+void benchmarkVertexQuantization(const char* pFileName);
+
+// Index optimization: ACMR / ATVR of a simulated FIFO vertex cache before and after, 16-bit index savings
+void benchmarkIndexOptimization(const char* pFileName);
+
+// Meshlet decomposition: meshlet count, fill rate against the 64 vertex / 124 triangle limits and build time
+void benchmarkMeshlets(const char* pFileName);
+
+// Mesh simplification: triangles per LOD against LOD 0, how many meshes could be simplified, the largest error and the time
+void benchmarkMeshLods(const char* pFileName);
+
+// Binned SAH BVH over the whole model: build time for 1..N threads, SAH cost, depth, checked against a single thread build
+void benchmarkBvhBuild(const char* pFileName);
+
+// CPU TLAS / BLAS: checks closest hits and instance masks against brute force, then times closest hit and shadow rays
+void benchmarkCpuRaytracing(const char* pFileName);
+
+// 8-wide BVH: closest hit and shadow rays per second of every SIMD kernel against the binary tree, and that the hits are the same
+void benchmarkWideBvh(const char* pFileName);
+
+// SAH against LBVH with and without treelet passes: build time, SAH cost, depth and closest hit / shadow rays per second, checks the trees and hits
+void benchmarkBvhBuilders(const char* pFileName);
+// SBVH at several split budgets against SAH: build time, duplicate references, SAH cost and node / triangle tests per shadow and closest hit ray, checks the hits
+void benchmarkSpatialSplits(const char* pFileName);
+
+// Shadow rays of a replayed RT-RSM frame: TraceRay against isOccluded and the batched occlusion API, checks they agree
+void benchmarkOcclusionRays(const char* pFileName);
+
+// Shadow rays of a 1080p frame traced unsorted and with coherence sorting at several batch sizes
+void benchmarkShadowRaySorting(const char* pFileName);
+
+// Startup cost of the CPU BLASes: building them against mapping them from the BVH cache
+void benchmarkBvhCache(const char* pFileName);
+
+// AS memory policy on the software backend: result bytes before and after compaction, pooled against per-build scratch, same hits after compacting
+void benchmarkAsMemory(const char* pFileName);
+
+// Refit against rebuild of a twisting model: time per frame, SAH and overlap of the refitted tree, rebuilds of the refit policy, same hits as a fresh build
+void benchmarkBlasRefit(const char* pFileName);
+
+// AS instrumentation (debug builds): SAH cost, EPO, overlap, leaf size and depth histograms per builder, node / triangle tests per camera and shadow ray with per pixel heatmaps
+void benchmarkAsStats(const char* pFileName);
+
+// Headless CPU frame: time per pass, G-buffer against camera rays, reprojection over three frames, same image on 2 threads as on all, writes every buffer
+void benchmarkCpuFrame(const char* pFileName);
+
+// Batched SSE indirect light against the scalar Hit.hlsl port: same frame 0 within 0.1%, then samples per second of both on the G-buffer hit points
+void benchmarkIndirectLight(const char* pFileName);
+
+// Frustum culling kernel: checks the SSE path against known cases and the scalar reference, then times both over 100k boxes
+void benchmarkFrustumCulling();
+
+// Scene instances: checks the TLAS instance descs against the full matrix product and that a frame's update does no heap allocation
+void benchmarkSceneInstances();
+
+// Dirty tracked TLAS updates over still, turning and sliding models: build type per frame and instances written, checks the written descs
+void benchmarkTlasUpdates();
+
+// Command stream of a synthetic RT-RSM frame: null device stats and validation against known and injected errors, save / load and replay round trips, record and replay time
+void benchmarkCommandStream();
+
+void runCpuBenchmarks();
@@ -0,0 +1,19 @@
+#include "BlasRefitPolicy.h"
+#include <algorithm>
+
+void BlasRefitPolicy::onBuild(const Bvh& bvh)
+{
+	mBuildOverlap = mOverlap = computeBvhOverlap(bvh);
+	mBuildSahCost = mSahCost = computeSahCost(bvh, BvhBuildSettings());
+	mNumRefits = 0;
+}
+
+bool BlasRefitPolicy::onRefit(const Bvh& bvh)
+{
+	mOverlap = computeBvhOverlap(bvh);
+	mSahCost = computeSahCost(bvh, BvhBuildSettings());
+	mNumRefits++;
+
+	// A tree without any overlap after the build (a few triangles) compares against the smallest normal float instead of 0
+	return mOverlap > std::max(mBuildOverlap, FLT_MIN) * mRebuildOverlapRatio;
+}
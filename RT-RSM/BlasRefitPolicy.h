@@ -0,0 +1,37 @@
+#pragma once
+#include "Bvh.h"
+
+// A refitted BLAS is rebuilt once the overlap of sibling nodes has grown past this times its value right after the build
+static const float kBlasRebuildOverlapRatio = 1.5f;
+
+/*
+	Quality monitor of one vertex animated BLAS. Refits are much cheaper than builds but keep the topology the
+	builder chose for the first pose, so as the mesh deforms siblings start to overlap and rays visit both. After
+	every refit the overlap of the CPU tree is measured (computeBvhOverlap, one pass over the nodes), and once it
+	has grown past the ratio the BLAS is rebuilt. Only CpuBlas::refit uses it so far: the renderer has no vertex
+	animation, and its device BLASes are built once and compacted.
+*/
+class BlasRefitPolicy
+{
+public:
+	// bvh was just built
+	void onBuild(const Bvh& bvh);
+
+	// bvh was just refitted, returns true if it should be rebuilt now
+	bool onRefit(const Bvh& bvh);
+
+	float		getOverlap() const { return mOverlap; }
+	float		getBuildOverlap() const { return mBuildOverlap; }
+	float		getSahCost() const { return mSahCost; }
+	float		getBuildSahCost() const { return mBuildSahCost; }
+	uint32_t	getNumRefits() const { return mNumRefits; }		// since the last build
+	void		setRebuildOverlapRatio(float ratio) { mRebuildOverlapRatio = ratio; }
+
+private:
+	float		mOverlap = 0.0f;
+	float		mBuildOverlap = 0.0f;
+	float		mSahCost = 0.0f;
+	float		mBuildSahCost = 0.0f;
+	uint32_t	mNumRefits = 0;
+	float		mRebuildOverlapRatio = kBlasRebuildOverlapRatio;
+};
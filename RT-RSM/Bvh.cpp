@@ -0,0 +1,445 @@
+#include "Bvh.h"
+#include "BvhBinning.h"
+#include "Lbvh.h"
+#include "Sbvh.h"
+#include <algorithm>
+#include <atomic>
+
+struct BvhBuildContext
+{
+	const BvhBuildSettings*		pSettings;
+	TaskPool*					pPool;
+	const std::vector<MeshView>*	pGeometries = nullptr;	// for the triangle builds
+	std::vector<BvhBounds>		primitiveBounds;
+	std::vector<vec3>			centroids;
+	std::vector<uint32_t>		references;		// partitioned in place, leaves are contiguous ranges
+	std::vector<BvhNode>		nodes;
+	std::atomic<uint32_t>		numNodes;
+};
+
+const char* getBvhBuilderName(BvhBuilder builder)
+{
+	switch (builder)
+	{
+	case BvhBuilder::BinnedSah:	return "SAH";
+	case BvhBuilder::Lbvh:		return "LBVH";
+	case BvhBuilder::Sbvh:		return "SBVH";
+	}
+	return "";
+}
+
+BvhBounds getTriangleBounds(const MeshView& geometry, uint32_t triangle)
+{
+	BvhBounds bounds;
+	for (uint32_t k = 0; k < 3; k++)
+	{
+		bounds.grow(geometry.positions[geometry.indices[3 * triangle + k]]);
+	}
+	return bounds;
+}
+
+// Bounds of the primitives and of their centroids, split over the pool for large ranges
+static void computeRangeBounds(BvhBuildContext& context, uint32_t first, uint32_t count, BvhBounds& bounds, BvhBounds& centroidBounds)
+{
+	auto accumulate = [&](uint32_t begin, uint32_t end, BvhBounds& b, BvhBounds& c)
+	{
+		for (uint32_t r = begin; r < end; r++)
+		{
+			uint32_t primitive = context.references[r];
+			b.grow(context.primitiveBounds[primitive]);
+			c.grow(context.centroids[primitive]);
+		}
+	};
+
+	if (count <= context.pSettings->parallelThreshold)
+	{
+		accumulate(first, first + count, bounds, centroidBounds);
+		return;
+	}
+
+	uint32_t grainSize = std::max(count / (4 * context.pPool->getNumThreads()), 1024u);
+	uint32_t numRanges = (count + grainSize - 1) / grainSize;
+	std::vector<BvhBounds> rangeBounds(numRanges), rangeCentroidBounds(numRanges);
+	context.pPool->parallelForRange(count, grainSize, [&](uint32_t begin, uint32_t end)
+	{
+		accumulate(first + begin, first + end, rangeBounds[begin / grainSize], rangeCentroidBounds[begin / grainSize]);
+	});
+	for (uint32_t r = 0; r < numRanges; r++)
+	{
+		bounds.grow(rangeBounds[r]);
+		centroidBounds.grow(rangeCentroidBounds[r]);
+	}
+}
+
+// Bin the range on all three axes. Min / max are exact in any order, so the parallel result equals the serial one.
+static void binRange(BvhBuildContext& context, uint32_t first, uint32_t count, const BvhBinMapping& mapping, BvhBin* pBins)
+{
+	auto accumulate = [&](uint32_t begin, uint32_t end, BvhBin* pOut)
+	{
+		for (uint32_t r = begin; r < end; r++)
+		{
+			uint32_t primitive = context.references[r];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				BvhBin& bin = pOut[axis * kMaxBvhBins + mapping.getBin(context.centroids[primitive], axis)];
+				bin.bounds.grow(context.primitiveBounds[primitive]);
+				bin.count++;
+			}
+		}
+	};
+
+	if (count <= context.pSettings->parallelThreshold)
+	{
+		accumulate(first, first + count, pBins);
+		return;
+	}
+
+	uint32_t grainSize = std::max(count / (4 * context.pPool->getNumThreads()), 1024u);
+	uint32_t numRanges = (count + grainSize - 1) / grainSize;
+	std::vector<BvhBin> rangeBins(numRanges * 3 * kMaxBvhBins);
+	context.pPool->parallelForRange(count, grainSize, [&](uint32_t begin, uint32_t end)
+	{
+		accumulate(first + begin, first + end, &rangeBins[(begin / grainSize) * 3 * kMaxBvhBins]);
+	});
+	for (uint32_t r = 0; r < numRanges; r++)
+	{
+		for (uint32_t b = 0; b < 3 * kMaxBvhBins; b++)
+		{
+			pBins[b].bounds.grow(rangeBins[r * 3 * kMaxBvhBins + b].bounds);
+			pBins[b].count += rangeBins[r * 3 * kMaxBvhBins + b].count;
+		}
+	}
+}
+
+BvhSplit findBestSplit(const BvhBuildSettings& settings, const BvhBin* pBins, const BvhBounds& centroidBounds, uint32_t numBins, float nodeArea)
+{
+	BvhSplit best;
+	float rightArea[kMaxBvhBins];
+	uint32_t rightCount[kMaxBvhBins];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (centroidBounds.max[axis] <= centroidBounds.min[axis])
+		{
+			continue;
+		}
+		const BvhBin* pAxisBins = pBins + axis * kMaxBvhBins;
+
+		// Sweep from the right, rightArea[b] covers bins (b, numBins)
+		BvhBounds right;
+		uint32_t count = 0;
+		for (uint32_t b = numBins - 1; b > 0; b--)
+		{
+			right.grow(pAxisBins[b].bounds);
+			count += pAxisBins[b].count;
+			rightArea[b - 1] = right.getArea();
+			rightCount[b - 1] = count;
+		}
+
+		// Sweep from the left and evaluate every plane
+		BvhBounds left;
+		count = 0;
+		for (uint32_t b = 0; b < numBins - 1; b++)
+		{
+			left.grow(pAxisBins[b].bounds);
+			count += pAxisBins[b].count;
+			if (count == 0 || rightCount[b] == 0)
+			{
+				continue;
+			}
+			float cost = settings.traversalCost + settings.intersectionCost * (left.getArea() * count + rightArea[b] * rightCount[b]) / nodeArea;
+			if (cost < best.cost)
+			{
+				best.axis = axis;
+				best.bin = b;
+				best.cost = cost;
+			}
+		}
+	}
+	return best;
+}
+
+static void buildNode(BvhBuildContext& context, uint32_t nodeIndex, uint32_t first, uint32_t count)
+{
+	const BvhBuildSettings& settings = *context.pSettings;
+	BvhBounds bounds, centroidBounds;
+	computeRangeBounds(context, first, count, bounds, centroidBounds);
+
+	BvhNode& node = context.nodes[nodeIndex];
+	node.boundsMin = bounds.min;
+	node.boundsMax = bounds.max;
+	node.firstChildOrPrimitive = first;
+	node.primitiveCount = count;
+	if (count == 1)
+	{
+		return;
+	}
+
+	// Small nodes don't need more bins than primitives
+	uint32_t numBins = std::max(std::min(std::min(settings.numBins, kMaxBvhBins), count), 2u);
+	BvhBinMapping mapping(centroidBounds, numBins);
+	BvhBin bins[3 * kMaxBvhBins];
+	binRange(context, first, count, mapping, bins);
+	BvhSplit split = findBestSplit(settings, bins, centroidBounds, numBins, std::max(bounds.getArea(), FLT_MIN));
+
+	float leafCost = settings.intersectionCost * count;
+	if (count <= settings.maxLeafSize && (split.axis < 0 || split.cost >= leafCost))
+	{
+		return;
+	}
+
+	uint32_t* pReferences = context.references.data();
+	uint32_t middle = first + count / 2;
+	if (split.axis >= 0)
+	{
+		uint32_t* pMiddle = std::partition(pReferences + first, pReferences + first + count, [&](uint32_t primitive)
+		{
+			return mapping.getBin(context.centroids[primitive], split.axis) <= split.bin;
+		});
+		middle = (uint32_t)(pMiddle - pReferences);
+	}
+	// Otherwise all centroids are at one point and any split is as good as another
+
+	uint32_t left = context.numNodes.fetch_add(2);
+	node.firstChildOrPrimitive = left;
+	node.primitiveCount = 0;
+
+	if (count > settings.parallelThreshold)
+	{
+		context.pPool->parallelFor(2, [&](uint32_t child)
+		{
+			if (child == 0)
+			{
+				buildNode(context, left, first, middle - first);
+			}
+			else
+			{
+				buildNode(context, left + 1, middle, first + count - middle);
+			}
+		});
+	}
+	else
+	{
+		buildNode(context, left, first, middle - first);
+		buildNode(context, left + 1, middle, first + count - middle);
+	}
+}
+
+// Store the nodes depth first, with the two children of a node next to each other, independent of the order the tasks ran in
+static void storeDepthFirst(const std::vector<BvhNode>& nodes, uint32_t nodeIndex, uint32_t outIndex, std::vector<BvhNode>& out)
+{
+	out[outIndex] = nodes[nodeIndex];
+	if (!nodes[nodeIndex].isLeaf())
+	{
+		uint32_t children = (uint32_t)out.size();
+		out.push_back(BvhNode());
+		out.push_back(BvhNode());
+		out[outIndex].firstChildOrPrimitive = children;
+		storeDepthFirst(nodes, nodes[nodeIndex].firstChildOrPrimitive, children, out);
+		storeDepthFirst(nodes, nodes[nodeIndex].firstChildOrPrimitive + 1, children + 1, out);
+	}
+}
+
+// Build over context.primitiveBounds / centroids, bvh.primitives holds the primitive of every reference
+static void buildFromBounds(BvhBuildContext& context, Bvh& bvh)
+{
+	uint32_t numPrimitives = (uint32_t)context.references.size();
+	if (context.pSettings->builder == BvhBuilder::Lbvh)
+	{
+		buildLbvh(context.primitiveBounds, context.centroids, *context.pSettings, *context.pPool, bvh.nodes, context.references);
+	}
+	else if (context.pSettings->builder == BvhBuilder::Sbvh)
+	{
+		buildSbvh(context.primitiveBounds, context.pGeometries, bvh.primitives, *context.pSettings, *context.pPool, bvh.nodes, context.references);
+	}
+	else
+	{
+		// A binary tree with n leaves has 2n - 1 nodes
+		context.nodes.resize(2 * numPrimitives - 1);
+		context.numNodes = 1;
+		buildNode(context, 0, 0, numPrimitives);
+		context.nodes.resize(context.numNodes);
+
+		bvh.nodes.reserve(context.nodes.size());
+		bvh.nodes.resize(1);
+		storeDepthFirst(context.nodes, 0, 0, bvh.nodes);
+	}
+
+	// Primitives in leaf order
+	std::vector<BvhPrimitive> primitives(context.references.size());
+	for (size_t r = 0; r < context.references.size(); r++)
+	{
+		primitives[r] = bvh.primitives[context.references[r]];
+	}
+	bvh.primitives.swap(primitives);
+}
+
+void buildBvh(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings, Bvh& bvh, TaskPool* pPool)
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	bvh.clear();
+
+	std::vector<uint32_t> firstPrimitive(geometries.size() + 1, 0);
+	for (size_t g = 0; g < geometries.size(); g++)
+	{
+		firstPrimitive[g + 1] = firstPrimitive[g] + geometries[g].indexCount / 3;
+	}
+	uint32_t numPrimitives = firstPrimitive.back();
+	if (numPrimitives == 0)
+	{
+		return;
+	}
+
+	BvhBuildContext context;
+	context.pSettings = &settings;
+	context.pPool = &pool;
+	context.pGeometries = &geometries;
+	context.primitiveBounds.resize(numPrimitives);
+	context.centroids.resize(numPrimitives);
+	context.references.resize(numPrimitives);
+	bvh.primitives.resize(numPrimitives);
+	pool.parallelFor((uint32_t)geometries.size(), [&](uint32_t g)
+	{
+		for (uint32_t p = firstPrimitive[g]; p < firstPrimitive[g + 1]; p++)
+		{
+			BvhBounds bounds = getTriangleBounds(geometries[g], p - firstPrimitive[g]);
+			context.primitiveBounds[p] = bounds;
+			context.centroids[p] = 0.5f * (bounds.min + bounds.max);
+			context.references[p] = p;
+			bvh.primitives[p] = { g, p - firstPrimitive[g] };
+		}
+	});
+	buildFromBounds(context, bvh);
+}
+
+void buildBvh(const std::vector<BvhBounds>& primitiveBounds, const BvhBuildSettings& settings, Bvh& bvh, TaskPool* pPool)
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	bvh.clear();
+	uint32_t numPrimitives = (uint32_t)primitiveBounds.size();
+	if (numPrimitives == 0)
+	{
+		return;
+	}
+
+	BvhBuildContext context;
+	context.pSettings = &settings;
+	context.pPool = &pool;
+	context.primitiveBounds = primitiveBounds;
+	context.centroids.resize(numPrimitives);
+	context.references.resize(numPrimitives);
+	bvh.primitives.resize(numPrimitives);
+	for (uint32_t p = 0; p < numPrimitives; p++)
+	{
+		context.centroids[p] = 0.5f * (primitiveBounds[p].min + primitiveBounds[p].max);
+		context.references[p] = p;
+		bvh.primitives[p] = { 0, p };
+	}
+	buildFromBounds(context, bvh);
+}
+
+void refitBvh(const std::vector<MeshView>& geometries, Bvh& bvh, TaskPool* pPool)
+{
+	auto refitLeaves = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t n = begin; n < end; n++)
+		{
+			BvhNode& node = bvh.nodes[n];
+			if (!node.isLeaf())
+			{
+				continue;
+			}
+			BvhBounds bounds;
+			for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+			{
+				const BvhPrimitive& primitive = bvh.primitives[p];
+				bounds.grow(getTriangleBounds(geometries[primitive.geometry], primitive.triangle));
+			}
+			node.boundsMin = bounds.min;
+			node.boundsMax = bounds.max;
+		}
+	};
+	if (pPool)
+	{
+		pPool->parallelForRange(bvh.getNumNodes(), 4096, refitLeaves);
+	}
+	else
+	{
+		refitLeaves(0, bvh.getNumNodes());
+	}
+
+	// Children are stored after their parent
+	for (uint32_t n = bvh.getNumNodes(); n-- > 0;)
+	{
+		BvhNode& node = bvh.nodes[n];
+		if (!node.isLeaf())
+		{
+			BvhBounds bounds = bvh.nodes[node.firstChildOrPrimitive].getBounds();
+			bounds.grow(bvh.nodes[node.firstChildOrPrimitive + 1].getBounds());
+			node.boundsMin = bounds.min;
+			node.boundsMax = bounds.max;
+		}
+	}
+}
+
+float computeSahCost(const Bvh& bvh, const BvhBuildSettings& settings)
+{
+	if (bvh.nodes.empty())
+	{
+		return 0.0f;
+	}
+	double rootArea = std::max(bvh.nodes[0].getBounds().getArea(), FLT_MIN);
+	double cost = 0.0;
+	for (const BvhNode& node : bvh.nodes)
+	{
+		double area = node.getBounds().getArea() / rootArea;
+		cost += node.isLeaf() ? area * settings.intersectionCost * node.primitiveCount : area * settings.traversalCost;
+	}
+	return (float)cost;
+}
+
+uint32_t computeBvhDepth(const Bvh& bvh)
+{
+	if (bvh.nodes.empty())
+	{
+		return 0;
+	}
+	// Children always come after their parent, so one forward pass is enough
+	std::vector<uint32_t> depth(bvh.nodes.size(), 1);
+	uint32_t maxDepth = 1;
+	for (uint32_t n = 0; n < bvh.getNumNodes(); n++)
+	{
+		const BvhNode& node = bvh.nodes[n];
+		if (!node.isLeaf())
+		{
+			depth[node.firstChildOrPrimitive] = depth[node.firstChildOrPrimitive + 1] = depth[n] + 1;
+		}
+		maxDepth = std::max(maxDepth, depth[n]);
+	}
+	return maxDepth;
+}
+
+float computeBvhOverlap(const Bvh& bvh)
+{
+	if (bvh.nodes.empty())
+	{
+		return 0.0f;
+	}
+	double rootArea = std::max(bvh.nodes[0].getBounds().getArea(), FLT_MIN);
+	double overlap = 0.0;
+	for (const BvhNode& node : bvh.nodes)
+	{
+		if (!node.isLeaf())
+		{
+			const BvhNode& left = bvh.nodes[node.firstChildOrPrimitive];
+			const BvhNode& right = bvh.nodes[node.firstChildOrPrimitive + 1];
+			BvhBounds intersection;
+			intersection.min = glm::max(left.boundsMin, right.boundsMin);
+			intersection.max = glm::min(left.boundsMax, right.boundsMax);
+			if (all(lessThanEqual(intersection.min, intersection.max)))
+			{
+				overlap += intersection.getArea() / rootArea;
+			}
+		}
+	}
+	return (float)overlap;
+}
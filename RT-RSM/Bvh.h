@@ -0,0 +1,123 @@
+#pragma once
+#include "MeshData.h"
+#include "TaskPool.h"
+#include <float.h>
+
+///////////////////////////////////////////
+// CPU BVH
+///////////////////////////////////////////
+/*
+	Binary BVH over the triangles of one BLAS. The input is the same as for createBottomLevelAS:
+	one or more geometries, each with vec3 positions and 32-bit triangle indices (MeshView).
+	It doesn't replace the driver's acceleration structures, it gives us one we can measure,
+	tune and trace on the CPU without a device.
+*/
+struct BvhBounds
+{
+	vec3 min = vec3(FLT_MAX);
+	vec3 max = vec3(-FLT_MAX);
+
+	void grow(const vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void grow(const BvhBounds& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	bool isEmpty() const { return min.x > max.x; }
+	float getArea() const
+	{
+		if (isEmpty())
+		{
+			return 0.0f;
+		}
+		vec3 d = max - min;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+/*
+	32 bytes. An interior node has primitiveCount 0 and its children at firstChildOrPrimitive and
+	firstChildOrPrimitive + 1, a leaf references primitiveCount entries of Bvh::primitives.
+	Nodes are stored depth first, the root is node 0.
+*/
+struct BvhNode
+{
+	vec3		boundsMin;
+	uint32_t	firstChildOrPrimitive;
+	vec3		boundsMax;
+	uint32_t	primitiveCount;
+
+	bool isLeaf() const { return primitiveCount > 0; }
+	BvhBounds getBounds() const { BvhBounds b; b.min = boundsMin; b.max = boundsMax; return b; }
+};
+
+struct BvhPrimitive
+{
+	uint32_t	geometry;
+	uint32_t	triangle;
+};
+
+struct Bvh
+{
+	std::vector<BvhNode>		nodes;
+	std::vector<BvhPrimitive>	primitives;	// in leaf order
+
+	uint32_t getNumNodes() const { return (uint32_t)nodes.size(); }
+	void clear() { nodes.clear(); primitives.clear(); }
+};
+
+static const uint32_t kMaxBvhBins = 32;
+
+enum class BvhBuilder
+{
+	BinnedSah,	// best trees, for static geometry built once
+	Lbvh,		// Morton order, several times faster to build, for objects rebuilt every frame
+	Sbvh,		// binned SAH with spatial splits, for long thin triangles whose boxes overlap, slowest to build
+};
+
+const char* getBvhBuilderName(BvhBuilder builder);
+
+struct BvhBuildSettings
+{
+	BvhBuilder	builder = BvhBuilder::BinnedSah;
+	uint32_t	numBins = 16;			// at most kMaxBvhBins
+	uint32_t	maxLeafSize = 4;		// larger nodes are always split
+	float		traversalCost = 1.0f;	// SAH cost of a node visit relative to a triangle test
+	float		intersectionCost = 1.0f;
+	uint32_t	parallelThreshold = 4096;	// nodes with more primitives bin in parallel and build their children as tasks
+	uint32_t	treeletPasses = 0;		// Lbvh: bottom up passes restructuring treelets for a lower SAH cost, see buildLbvh
+	float		spatialSplitOverlap = 1e-5f;	// Sbvh: spatial splits are tried where the boxes of the best object split overlap by more than this part of the root area
+	float		spatialSplitBudget = 0.5f;		// Sbvh: at most this many duplicate triangle references per triangle
+};
+
+/*
+	Binned SAH (Wald 2007). Above settings.parallelThreshold primitives the binning is split over the pool
+	and both children are built as separate tasks, so the top levels, which dominate the build time, use every thread.
+	With settings.builder Lbvh the tree is a linear BVH instead (Lbvh.h), same layout and leaves. With Sbvh triangles may be
+	referenced by several leaves, each leaf bounding only its part of them (Sbvh.h), so bvh.primitives can be longer.
+	The result doesn't depend on the number of threads.
+*/
+void buildBvh(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings, Bvh& bvh, TaskPool* pPool = nullptr);
+
+// Same over arbitrary boxes, e.g. the instances of a TLAS. Primitive i is { 0, i }.
+void buildBvh(const std::vector<BvhBounds>& primitiveBounds, const BvhBuildSettings& settings, Bvh& bvh, TaskPool* pPool = nullptr);
+
+// Triangle bounds as used by the builder
+BvhBounds getTriangleBounds(const MeshView& geometry, uint32_t triangle);
+
+/*
+	Refit, like PERFORM_UPDATE: geometries has the same triangles the tree was built over with moved vertices. The leaf
+	bounds are recomputed (in parallel on the pool), then every interior node is grown from its children, bottom up.
+	The topology stays, so the tree degrades as the triangles move away from where the builder saw them.
+*/
+void refitBvh(const std::vector<MeshView>& geometries, Bvh& bvh, TaskPool* pPool = nullptr);
+
+/*
+	SAH cost of the tree: traversalCost times the area of all interior nodes plus intersectionCost times
+	the area times the primitive count of all leaves, relative to the area of the root.
+*/
+float computeSahCost(const Bvh& bvh, const BvhBuildSettings& settings);
+
+uint32_t computeBvhDepth(const Bvh& bvh);
+
+/*
+	Area of the intersection of the two children of every interior node, relative to the area of the root. Refits make
+	siblings overlap more and more, so rays have to visit both, the SAH cost sees that only through the growing node areas.
+*/
+float computeBvhOverlap(const Bvh& bvh);
@@ -0,0 +1,46 @@
+#pragma once
+#include "Bvh.h"
+#include <algorithm>
+
+// Binning shared by the SAH and SBVH builders
+
+struct BvhBin
+{
+	BvhBounds	bounds;
+	uint32_t	count = 0;
+};
+
+struct BvhSplit
+{
+	int			axis = -1;		// -1 if the centroids can't be separated
+	uint32_t	bin = 0;		// bins [0, bin] go left
+	float		cost = FLT_MAX;
+};
+
+// Bin of a centroid, identical for binning and partitioning
+struct BvhBinMapping
+{
+	vec3		origin;
+	vec3		scale;
+	uint32_t	numBins;
+
+	BvhBinMapping(const BvhBounds& centroidBounds, uint32_t bins)
+	{
+		origin = centroidBounds.min;
+		numBins = bins;
+		vec3 extent = centroidBounds.max - centroidBounds.min;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			scale[axis] = extent[axis] > 0.0f ? numBins * 0.99999f / extent[axis] : 0.0f;
+		}
+	}
+
+	uint32_t getBin(const vec3& centroid, int axis) const
+	{
+		uint32_t bin = (uint32_t)std::max((centroid[axis] - origin[axis]) * scale[axis], 0.0f);
+		return std::min(bin, numBins - 1);
+	}
+};
+
+// Cheapest plane between the bins of the three axes, the cost relative to nodeArea
+BvhSplit findBestSplit(const BvhBuildSettings& settings, const BvhBin* pBins, const BvhBounds& centroidBounds, uint32_t numBins, float nodeArea);
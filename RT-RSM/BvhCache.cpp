@@ -0,0 +1,215 @@
+#include "BvhCache.h"
+#include "Hash.h"
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + 63) & ~63ull;
+}
+
+uint64_t BvhCache::computeKey(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings)
+{
+	uint64_t hash = hashValue(kBvhCacheVersion);
+	hash = hashValue((uint32_t)settings.builder, hash);
+	hash = hashValue(settings.treeletPasses, hash);
+	hash = hashValue(settings.numBins, hash);
+	hash = hashValue(settings.maxLeafSize, hash);
+	hash = hashValue(settings.traversalCost, hash);
+	hash = hashValue(settings.intersectionCost, hash);
+	for (const MeshView& geometry : geometries)
+	{
+		hash = hashValue(geometry.vertexCount, hash);
+		hash = hashValue(geometry.indexCount, hash);
+		hash = hashBytes(geometry.positions, geometry.vertexCount * sizeof(vec3), hash);
+		hash = hashBytes(geometry.indices, geometry.indexCount * sizeof(uint32_t), hash);
+	}
+	return hash;
+}
+
+bool BvhCache::open(const char* pFileName)
+{
+	std::string cachePath = getCachePath(pFileName);
+	if (!mFile.open(cachePath.c_str()))
+	{
+		return false;
+	}
+
+	const uint8_t* pData = mFile.getData();
+	const uint64_t size = mFile.getSize();
+	BvhCacheHeader header;
+	if (size < sizeof(header))
+	{
+		close();
+		return false;
+	}
+	memcpy(&header, pData, sizeof(header));
+	if (header.magic != kBvhCacheMagic || header.version != kBvhCacheVersion ||
+		header.nodeSize != sizeof(WideBvhNode) || header.triangleSize != sizeof(WideBvhTriangles) ||
+		sizeof(BvhCacheHeader) + (uint64_t)header.entryCount * sizeof(BvhCacheEntry) > size)
+	{
+		close();
+		return false;
+	}
+
+	// Only the ranges are checked, the trees themselves are used as they are
+	const BvhCacheEntry* pEntries = (const BvhCacheEntry*)(pData + sizeof(BvhCacheHeader));
+	for (uint32_t i = 0; i < header.entryCount; i++)
+	{
+		const BvhCacheEntry& entry = pEntries[i];
+		if ((entry.nodeOffset & 63) != 0 || (entry.triangleOffset & 63) != 0 ||
+			entry.nodeOffset + (uint64_t)entry.nodeCount * sizeof(WideBvhNode) > size ||
+			entry.triangleOffset + (uint64_t)entry.leafCount * sizeof(WideBvhTriangles) > size)
+		{
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void BvhCache::close()
+{
+	mFile.close();
+}
+
+const BvhCacheEntry* BvhCache::find(uint64_t key) const
+{
+	if (!mFile.isOpen())
+	{
+		return nullptr;
+	}
+	const uint8_t* pData = mFile.getData();
+	const BvhCacheHeader* pHeader = (const BvhCacheHeader*)pData;
+	const BvhCacheEntry* pEntries = (const BvhCacheEntry*)(pData + sizeof(BvhCacheHeader));
+	for (uint32_t i = 0; i < pHeader->entryCount; i++)
+	{
+		if (pEntries[i].key == key)
+		{
+			return &pEntries[i];
+		}
+	}
+	return nullptr;
+}
+
+void BvhCache::attach(const BvhCacheEntry& entry, const std::vector<MeshView>& geometries, CpuBlas& blas) const
+{
+	const uint8_t* pData = mFile.getData();
+	BvhBounds bounds;
+	bounds.min = vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+	bounds.max = vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+	blas.attach(geometries, bounds, (const WideBvhNode*)(pData + entry.nodeOffset), entry.nodeCount,
+		(const WideBvhTriangles*)(pData + entry.triangleOffset), entry.leafCount);
+}
+
+void BvhCache::load(const char* pFileName, const std::vector<std::vector<MeshView>>& blasGeometries, const BvhBuildSettings& settings,
+	std::vector<CpuBlas>& blases, TaskPool* pPool)
+{
+	close();
+	open(pFileName);
+
+	std::vector<uint64_t> keys(blasGeometries.size());
+	std::vector<const BvhCacheEntry*> entries(blasGeometries.size());
+	mNumHits = 0;
+	for (size_t i = 0; i < blasGeometries.size(); i++)
+	{
+		keys[i] = computeKey(blasGeometries[i], settings);
+		entries[i] = find(keys[i]);
+		mNumHits += entries[i] ? 1 : 0;
+	}
+
+	blases.clear();
+	blases.resize(blasGeometries.size());
+	for (size_t i = 0; i < blasGeometries.size(); i++)
+	{
+		if (entries[i])
+		{
+			attach(*entries[i], blasGeometries[i], blases[i]);
+		}
+		else
+		{
+			blases[i].build(blasGeometries[i], settings, pPool);
+		}
+	}
+	if (mNumHits == blasGeometries.size())
+	{
+		return;
+	}
+
+	// The mapping can't stay open while the file is replaced
+	for (CpuBlas& blas : blases)
+	{
+		blas.detach();
+	}
+	close();
+	write(pFileName, blases, keys);
+}
+
+bool BvhCache::write(const char* pFileName, const std::vector<CpuBlas>& blases, const std::vector<uint64_t>& keys)
+{
+	BvhCacheHeader header = {};
+	header.magic = kBvhCacheMagic;
+	header.version = kBvhCacheVersion;
+	header.entryCount = (uint32_t)blases.size();
+	header.nodeSize = sizeof(WideBvhNode);
+	header.triangleSize = sizeof(WideBvhTriangles);
+
+	// Lay out the trees after the entry table
+	std::vector<BvhCacheEntry> entries(blases.size());
+	uint64_t offset = alignOffset(sizeof(BvhCacheHeader) + entries.size() * sizeof(BvhCacheEntry));
+	for (size_t i = 0; i < blases.size(); i++)
+	{
+		const WideBvh& wideBvh = blases[i].getWideBvh();
+		BvhBounds bounds = blases[i].getBounds();
+		BvhCacheEntry& entry = entries[i];
+		entry = {};
+		entry.key = keys[i];
+		entry.nodeCount = wideBvh.getNumNodes();
+		entry.leafCount = wideBvh.getNumLeaves();
+		memcpy(entry.boundsMin, &bounds.min, sizeof(entry.boundsMin));
+		memcpy(entry.boundsMax, &bounds.max, sizeof(entry.boundsMax));
+		entry.nodeOffset = offset;
+		offset = alignOffset(offset + entry.nodeCount * sizeof(WideBvhNode));
+		entry.triangleOffset = offset;
+		offset = alignOffset(offset + entry.leafCount * sizeof(WideBvhTriangles));
+	}
+
+	// Write to a temporary file first so an interrupted write never leaves a valid-looking cache behind
+	std::string cachePath = getCachePath(pFileName);
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.good())
+		{
+			return false;
+		}
+
+		const char padding[64] = {};
+		uint64_t written = 0;
+		auto writeBlock = [&](const void* pData, uint64_t size, uint64_t at)
+		{
+			file.write(padding, (std::streamsize)(at - written));
+			file.write((const char*)pData, (std::streamsize)size);
+			written = at + size;
+		};
+
+		writeBlock(&header, sizeof(header), 0);
+		writeBlock(entries.data(), entries.size() * sizeof(BvhCacheEntry), sizeof(header));
+		for (size_t i = 0; i < blases.size(); i++)
+		{
+			const WideBvh& wideBvh = blases[i].getWideBvh();
+			writeBlock(wideBvh.getNodes(), entries[i].nodeCount * sizeof(WideBvhNode), entries[i].nodeOffset);
+			writeBlock(wideBvh.getTriangles(), entries[i].leafCount * sizeof(WideBvhTriangles), entries[i].triangleOffset);
+		}
+		if (!file.good())
+		{
+			file.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	remove(cachePath.c_str());
+	return rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
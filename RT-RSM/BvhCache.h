@@ -0,0 +1,72 @@
+#pragma once
+#include "CpuRaytracing.h"
+#include "MappedFile.h"
+#include <string>
+
+/*
+	Versioned binary cache of built CPU BLASes, stored next to the scene file as <file>.bvhcache.
+
+	Layout (all offsets are from the start of the file and 64-byte aligned):
+		BvhCacheHeader
+		BvhCacheEntry[entryCount]
+		per entry: WideBvhNode[nodeCount], WideBvhTriangles[leafCount]
+
+	Every entry is keyed by a hash of the vertex and index data of its geometries and of the build settings,
+	so a changed mesh only rebuilds its own BLAS. The trees are stored exactly as WideBvh keeps them in memory,
+	with node and leaf indices instead of pointers, so a hit is traversed straight from the mapped pages.
+*/
+static const uint32_t kBvhCacheMagic = 0x48564252; // "RBVH"
+static const uint32_t kBvhCacheVersion = 1;
+
+struct BvhCacheHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	entryCount;
+	uint32_t	nodeSize;		// sizeof(WideBvhNode) and sizeof(WideBvhTriangles) of the writer
+	uint32_t	triangleSize;
+	uint32_t	reserved[3];
+};
+
+struct BvhCacheEntry
+{
+	uint64_t	key;
+	uint32_t	nodeCount;
+	uint32_t	leafCount;
+	uint64_t	nodeOffset;
+	uint64_t	triangleOffset;
+	float		boundsMin[3];
+	float		boundsMax[3];
+};
+
+class BvhCache
+{
+public:
+	/*
+		Give every BLAS its tree: attached to the mapped cache of pFileName if its key is there, built otherwise.
+		If anything had to be built, the cached trees are copied out and the cache is rewritten with all of them.
+		Attached BLASes point into the mapping, so the BvhCache must outlive them.
+	*/
+	void load(const char* pFileName, const std::vector<std::vector<MeshView>>& blasGeometries, const BvhBuildSettings& settings,
+		std::vector<CpuBlas>& blases, TaskPool* pPool = nullptr);
+
+	// Map and validate an existing cache
+	bool open(const char* pFileName);
+	void close();
+
+	// Entry with the given key, nullptr if there is none
+	const BvhCacheEntry* find(uint64_t key) const;
+
+	static bool write(const char* pFileName, const std::vector<CpuBlas>& blases, const std::vector<uint64_t>& keys);
+	static uint64_t computeKey(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings);
+	static std::string getCachePath(const char* pFileName) { return std::string(pFileName) + ".bvhcache"; }
+
+	// BLASes the last load took from the cache
+	uint32_t getNumHits() const { return mNumHits; }
+
+private:
+	void attach(const BvhCacheEntry& entry, const std::vector<MeshView>& geometries, CpuBlas& blas) const;
+
+	MappedFile	mFile;
+	uint32_t	mNumHits = 0;
+};
@@ -0,0 +1,752 @@
+#include "CommandRecorder.h"
+
+void CommandRecorder::init(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList)
+{
+	mpDevice = pDevice;
+	mpCmdList = pCmdList;
+}
+
+///////////////////////////////////////////
+// Objects
+///////////////////////////////////////////
+uint32_t CommandRecorder::addObject(void* pObject, CommandObjectType type, const std::string& name, uint64_t size)
+{
+	uint32_t id = mStream.addObject(type, name, size);
+	mIds[pObject] = id;
+	mObjects.push_back(pObject);
+	return id;
+}
+
+uint32_t CommandRecorder::registerObject(void* pObject, CommandObjectType type, const std::string& name)
+{
+	uint32_t id = getObjectId(pObject, type);
+	mStream.setObjectName(id, name);
+	return id;
+}
+
+uint32_t CommandRecorder::registerResource(ID3D12Resource* pResource, const std::string& name)
+{
+	uint32_t id = getResourceId(pResource);
+	mStream.setObjectName(id, name);
+	return id;
+}
+
+uint32_t CommandRecorder::registerPipelineState(ID3D12PipelineState* pPipelineState, const std::string& name)
+{
+	return registerObject(pPipelineState, CommandObjectType::PipelineState, name);
+}
+
+uint32_t CommandRecorder::registerStateObject(ID3D12StateObject* pStateObject, const std::string& name)
+{
+	return registerObject(pStateObject, CommandObjectType::StateObject, name);
+}
+
+uint32_t CommandRecorder::registerRootSignature(ID3D12RootSignature* pRootSignature, const std::string& name)
+{
+	return registerObject(pRootSignature, CommandObjectType::RootSignature, name);
+}
+
+uint32_t CommandRecorder::registerDescriptorHeap(ID3D12DescriptorHeap* pHeap, const std::string& name)
+{
+	uint32_t id = getHeapId(pHeap);
+	mStream.setObjectName(id, name);
+	return id;
+}
+
+uint32_t CommandRecorder::getObjectId(void* pObject, CommandObjectType type)
+{
+	if (!pObject)
+	{
+		return kNoCommandObject;
+	}
+	auto it = mIds.find(pObject);
+	if (it != mIds.end())
+	{
+		return it->second;
+	}
+	return addObject(pObject, type, getCommandObjectTypeName(type) + std::string(" ") + std::to_string(mObjects.size()));
+}
+
+// Sized by what a CopyResource of it moves: the width of a buffer, all subresources with their row pitch for a texture
+uint32_t CommandRecorder::getResourceId(ID3D12Resource* pResource)
+{
+	if (!pResource)
+	{
+		return kNoCommandObject;
+	}
+	auto it = mIds.find(pResource);
+	if (it != mIds.end())
+	{
+		return it->second;
+	}
+
+	D3D12_RESOURCE_DESC desc = pResource->GetDesc();
+	UINT64 size = desc.Width;
+	if (desc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER)
+	{
+		UINT arraySize = desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? 1 : desc.DepthOrArraySize;
+		UINT numSubresources = desc.MipLevels * arraySize * D3D12GetFormatPlaneCount(mpDevice, desc.Format);
+		mpDevice->GetCopyableFootprints(&desc, 0, numSubresources, 0, nullptr, nullptr, nullptr, &size);
+	}
+	uint32_t id = addObject(pResource, CommandObjectType::Resource, "resource " + std::to_string(mObjects.size()), size);
+	if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER && pResource->GetGPUVirtualAddress() != 0)
+	{
+		mBuffers[pResource->GetGPUVirtualAddress()] = id;
+	}
+	return id;
+}
+
+uint32_t CommandRecorder::getHeapId(ID3D12DescriptorHeap* pHeap)
+{
+	if (!pHeap)
+	{
+		return kNoCommandObject;
+	}
+	auto it = mIds.find(pHeap);
+	if (it != mIds.end())
+	{
+		return it->second;
+	}
+
+	D3D12_DESCRIPTOR_HEAP_DESC desc = pHeap->GetDesc();
+	Heap heap;
+	heap.id = addObject(pHeap, CommandObjectType::DescriptorHeap, "descriptor heap " + std::to_string(mObjects.size()), desc.NumDescriptors);
+	heap.cpuStart = pHeap->GetCPUDescriptorHandleForHeapStart().ptr;
+	heap.gpuStart = desc.Flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE ? pHeap->GetGPUDescriptorHandleForHeapStart().ptr : 0;
+	heap.increment = mpDevice->GetDescriptorHandleIncrementSize(desc.Type);
+	heap.numDescriptors = desc.NumDescriptors;
+	mHeaps.push_back(heap);
+	return heap.id;
+}
+
+CommandAddress CommandRecorder::getCommandAddress(D3D12_GPU_VIRTUAL_ADDRESS address) const
+{
+	CommandAddress commandAddress;
+	commandAddress.offset = address;
+	auto it = mBuffers.upper_bound(address);
+	if (address != 0 && it != mBuffers.begin())
+	{
+		--it;
+		if (address - it->first < mStream.getObject(it->second).size)
+		{
+			commandAddress.resource = it->second;
+			commandAddress.offset = address - it->first;
+		}
+	}
+	return commandAddress;
+}
+
+CommandDescriptor CommandRecorder::getCommandDescriptor(UINT64 handle, bool gpu) const
+{
+	CommandDescriptor descriptor;
+	for (const Heap& heap : mHeaps)
+	{
+		UINT64 start = gpu ? heap.gpuStart : heap.cpuStart;
+		if (start != 0 && handle >= start && handle < start + heap.numDescriptors * heap.increment)
+		{
+			descriptor.heap = heap.id;
+			descriptor.index = (uint32_t)((handle - start) / heap.increment);
+			break;
+		}
+	}
+	return descriptor;
+}
+
+CommandShaderTable CommandRecorder::getCommandShaderTable(D3D12_GPU_VIRTUAL_ADDRESS address, UINT64 size, UINT64 stride) const
+{
+	CommandShaderTable table;
+	table.address = getCommandAddress(address);
+	table.size = size;
+	table.stride = stride;
+	return table;
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS CommandRecorder::getAddress(const CommandAddress& address) const
+{
+	if (address.resource == kNoCommandObject)
+	{
+		return address.offset;
+	}
+	ID3D12Resource* pResource = static_cast<ID3D12Resource*>(getObject(address.resource));
+	return pResource ? pResource->GetGPUVirtualAddress() + address.offset : 0;
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE CommandRecorder::getCpuDescriptor(const CommandDescriptor& descriptor) const
+{
+	D3D12_CPU_DESCRIPTOR_HANDLE handle = {};
+	for (const Heap& heap : mHeaps)
+	{
+		if (heap.id == descriptor.heap)
+		{
+			handle.ptr = (SIZE_T)(heap.cpuStart + descriptor.index * heap.increment);
+		}
+	}
+	return handle;
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE CommandRecorder::getGpuDescriptor(const CommandDescriptor& descriptor) const
+{
+	D3D12_GPU_DESCRIPTOR_HANDLE handle = {};
+	for (const Heap& heap : mHeaps)
+	{
+		if (heap.id == descriptor.heap && heap.gpuStart != 0)
+		{
+			handle.ptr = heap.gpuStart + descriptor.index * heap.increment;
+		}
+	}
+	return handle;
+}
+
+///////////////////////////////////////////
+// Commands
+///////////////////////////////////////////
+void CommandRecorder::beginEvent(const char* pName)
+{
+	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, pName);
+	mStream.beginEvent(pName);
+}
+
+void CommandRecorder::endEvent()
+{
+	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mStream.endEvent();
+}
+
+void CommandRecorder::resourceBarrier(UINT numBarriers, const D3D12_RESOURCE_BARRIER* pBarriers)
+{
+	mpCmdList->ResourceBarrier(numBarriers, pBarriers);
+
+	std::vector<CommandBarrier> barriers(numBarriers);
+	for (UINT b = 0; b < numBarriers; b++)
+	{
+		const D3D12_RESOURCE_BARRIER& barrier = pBarriers[b];
+		barriers[b].type = (uint32_t)barrier.Type;
+		barriers[b].flags = (uint32_t)barrier.Flags;
+		switch (barrier.Type)
+		{
+		case D3D12_RESOURCE_BARRIER_TYPE_TRANSITION:
+			barriers[b].resource = getResourceId(barrier.Transition.pResource);
+			barriers[b].subresource = barrier.Transition.Subresource;
+			barriers[b].before = (uint32_t)barrier.Transition.StateBefore;
+			barriers[b].after = (uint32_t)barrier.Transition.StateAfter;
+			break;
+		case D3D12_RESOURCE_BARRIER_TYPE_ALIASING:
+			barriers[b].resource = getResourceId(barrier.Aliasing.pResourceBefore);
+			barriers[b].subresource = getResourceId(barrier.Aliasing.pResourceAfter);
+			break;
+		default:
+			barriers[b].resource = getResourceId(barrier.UAV.pResource);
+			break;
+		}
+	}
+	mStream.resourceBarrier(numBarriers, barriers.data());
+}
+
+void CommandRecorder::transition(ID3D12Resource* pResource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after)
+{
+	D3D12_RESOURCE_BARRIER barrier = {};
+	barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	barrier.Transition.pResource = pResource;
+	barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	barrier.Transition.StateBefore = before;
+	barrier.Transition.StateAfter = after;
+	resourceBarrier(1, &barrier);
+}
+
+void CommandRecorder::copyResource(ID3D12Resource* pDst, ID3D12Resource* pSrc)
+{
+	mpCmdList->CopyResource(pDst, pSrc);
+	mStream.copyResource(getResourceId(pDst), getResourceId(pSrc));
+}
+
+void CommandRecorder::setDescriptorHeaps(UINT numHeaps, ID3D12DescriptorHeap* const* ppHeaps)
+{
+	mpCmdList->SetDescriptorHeaps(numHeaps, ppHeaps);
+
+	std::vector<uint32_t> heaps(numHeaps);
+	for (UINT h = 0; h < numHeaps; h++)
+	{
+		heaps[h] = getHeapId(ppHeaps[h]);
+	}
+	mStream.setDescriptorHeaps(numHeaps, heaps.data());
+}
+
+void CommandRecorder::setPipelineState(ID3D12PipelineState* pPipelineState)
+{
+	mpCmdList->SetPipelineState(pPipelineState);
+	mStream.setPipelineState(getObjectId(pPipelineState, CommandObjectType::PipelineState));
+}
+
+void CommandRecorder::setPipelineState1(ID3D12StateObject* pStateObject)
+{
+	mpCmdList->SetPipelineState1(pStateObject);
+	mStream.setPipelineState1(getObjectId(pStateObject, CommandObjectType::StateObject));
+}
+
+void CommandRecorder::setGraphicsRootSignature(ID3D12RootSignature* pRootSignature)
+{
+	mpCmdList->SetGraphicsRootSignature(pRootSignature);
+	mStream.setRootSignature(CommandBindPoint::Graphics, getObjectId(pRootSignature, CommandObjectType::RootSignature));
+}
+
+void CommandRecorder::setComputeRootSignature(ID3D12RootSignature* pRootSignature)
+{
+	mpCmdList->SetComputeRootSignature(pRootSignature);
+	mStream.setRootSignature(CommandBindPoint::Compute, getObjectId(pRootSignature, CommandObjectType::RootSignature));
+}
+
+void CommandRecorder::setGraphicsRootDescriptorTable(UINT parameter, D3D12_GPU_DESCRIPTOR_HANDLE table)
+{
+	mpCmdList->SetGraphicsRootDescriptorTable(parameter, table);
+	mStream.setRootDescriptorTable(CommandBindPoint::Graphics, parameter, getCommandDescriptor(table.ptr, true));
+}
+
+void CommandRecorder::setComputeRootDescriptorTable(UINT parameter, D3D12_GPU_DESCRIPTOR_HANDLE table)
+{
+	mpCmdList->SetComputeRootDescriptorTable(parameter, table);
+	mStream.setRootDescriptorTable(CommandBindPoint::Compute, parameter, getCommandDescriptor(table.ptr, true));
+}
+
+void CommandRecorder::setGraphicsRoot32BitConstants(UINT parameter, UINT numValues, const void* pValues, UINT destOffset)
+{
+	mpCmdList->SetGraphicsRoot32BitConstants(parameter, numValues, pValues, destOffset);
+	mStream.setRoot32BitConstants(CommandBindPoint::Graphics, parameter, numValues, pValues, destOffset);
+}
+
+void CommandRecorder::setComputeRoot32BitConstants(UINT parameter, UINT numValues, const void* pValues, UINT destOffset)
+{
+	mpCmdList->SetComputeRoot32BitConstants(parameter, numValues, pValues, destOffset);
+	mStream.setRoot32BitConstants(CommandBindPoint::Compute, parameter, numValues, pValues, destOffset);
+}
+
+void CommandRecorder::setGraphicsRootConstantBufferView(UINT parameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+{
+	mpCmdList->SetGraphicsRootConstantBufferView(parameter, address);
+	mStream.setRootView(CommandBindPoint::Graphics, CommandRootView::ConstantBuffer, parameter, getCommandAddress(address));
+}
+
+void CommandRecorder::setGraphicsRootShaderResourceView(UINT parameter, D3D12_GPU_VIRTUAL_ADDRESS address)
+{
+	mpCmdList->SetGraphicsRootShaderResourceView(parameter, address);
+	mStream.setRootView(CommandBindPoint::Graphics, CommandRootView::ShaderResource, parameter, getCommandAddress(address));
+}
+
+void CommandRecorder::clearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE rtv, const FLOAT color[4])
+{
+	mpCmdList->ClearRenderTargetView(rtv, color, 0, nullptr);
+	mStream.clearRenderTargetView(getCommandDescriptor(rtv.ptr, false), color);
+}
+
+void CommandRecorder::clearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE dsv, D3D12_CLEAR_FLAGS flags, FLOAT depth, UINT8 stencil)
+{
+	mpCmdList->ClearDepthStencilView(dsv, flags, depth, stencil, 0, nullptr);
+	mStream.clearDepthStencilView(getCommandDescriptor(dsv.ptr, false), (uint32_t)flags, depth, stencil);
+}
+
+void CommandRecorder::setRenderTargets(UINT numRtvs, const D3D12_CPU_DESCRIPTOR_HANDLE* pRtvs, const D3D12_CPU_DESCRIPTOR_HANDLE* pDsv)
+{
+	mpCmdList->OMSetRenderTargets(numRtvs, pRtvs, false, pDsv);
+
+	std::vector<CommandDescriptor> rtvs(numRtvs);
+	for (UINT r = 0; r < numRtvs; r++)
+	{
+		rtvs[r] = getCommandDescriptor(pRtvs[r].ptr, false);
+	}
+	CommandDescriptor dsv = pDsv ? getCommandDescriptor(pDsv->ptr, false) : CommandDescriptor();
+	mStream.setRenderTargets(numRtvs, rtvs.data(), pDsv ? &dsv : nullptr);
+}
+
+void CommandRecorder::setStencilRef(UINT stencilRef)
+{
+	mpCmdList->OMSetStencilRef(stencilRef);
+	mStream.setStencilRef(stencilRef);
+}
+
+void CommandRecorder::setViewports(UINT numViewports, const D3D12_VIEWPORT* pViewports)
+{
+	mpCmdList->RSSetViewports(numViewports, pViewports);
+
+	std::vector<CommandViewport> viewports(numViewports);
+	for (UINT v = 0; v < numViewports; v++)
+	{
+		viewports[v].x = pViewports[v].TopLeftX;
+		viewports[v].y = pViewports[v].TopLeftY;
+		viewports[v].width = pViewports[v].Width;
+		viewports[v].height = pViewports[v].Height;
+		viewports[v].minDepth = pViewports[v].MinDepth;
+		viewports[v].maxDepth = pViewports[v].MaxDepth;
+	}
+	mStream.setViewports(numViewports, viewports.data());
+}
+
+void CommandRecorder::setScissorRects(UINT numRects, const D3D12_RECT* pRects)
+{
+	mpCmdList->RSSetScissorRects(numRects, pRects);
+
+	std::vector<CommandRect> rects(numRects);
+	for (UINT r = 0; r < numRects; r++)
+	{
+		rects[r].left = (int32_t)pRects[r].left;
+		rects[r].top = (int32_t)pRects[r].top;
+		rects[r].right = (int32_t)pRects[r].right;
+		rects[r].bottom = (int32_t)pRects[r].bottom;
+	}
+	mStream.setScissorRects(numRects, rects.data());
+}
+
+void CommandRecorder::setPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology)
+{
+	mpCmdList->IASetPrimitiveTopology(topology);
+	mStream.setPrimitiveTopology((uint32_t)topology);
+}
+
+void CommandRecorder::setVertexBuffers(UINT startSlot, UINT numViews, const D3D12_VERTEX_BUFFER_VIEW* pViews)
+{
+	mpCmdList->IASetVertexBuffers(startSlot, numViews, pViews);
+
+	std::vector<CommandVertexBufferView> views(numViews);
+	for (UINT v = 0; v < numViews; v++)
+	{
+		views[v].address = getCommandAddress(pViews[v].BufferLocation);
+		views[v].size = pViews[v].SizeInBytes;
+		views[v].stride = pViews[v].StrideInBytes;
+	}
+	mStream.setVertexBuffers(startSlot, numViews, views.data());
+}
+
+void CommandRecorder::setIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* pView)
+{
+	mpCmdList->IASetIndexBuffer(pView);
+
+	CommandIndexBufferView view;
+	if (pView)
+	{
+		view.address = getCommandAddress(pView->BufferLocation);
+		view.size = pView->SizeInBytes;
+		view.format = (uint32_t)pView->Format;
+	}
+	mStream.setIndexBuffer(pView ? &view : nullptr);
+}
+
+void CommandRecorder::drawInstanced(UINT vertexCount, UINT instanceCount, UINT startVertex, UINT startInstance)
+{
+	mpCmdList->DrawInstanced(vertexCount, instanceCount, startVertex, startInstance);
+	mStream.drawInstanced(vertexCount, instanceCount, startVertex, startInstance);
+}
+
+void CommandRecorder::drawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+	mpCmdList->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+	mStream.drawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+void CommandRecorder::dispatch(UINT x, UINT y, UINT z)
+{
+	mpCmdList->Dispatch(x, y, z);
+	mStream.dispatch(x, y, z);
+}
+
+void CommandRecorder::dispatchRays(const D3D12_DISPATCH_RAYS_DESC* pDesc)
+{
+	mpCmdList->DispatchRays(pDesc);
+
+	CommandDispatchRays desc;
+	desc.rayGeneration = getCommandShaderTable(pDesc->RayGenerationShaderRecord.StartAddress, pDesc->RayGenerationShaderRecord.SizeInBytes, 0);
+	desc.miss = getCommandShaderTable(pDesc->MissShaderTable.StartAddress, pDesc->MissShaderTable.SizeInBytes, pDesc->MissShaderTable.StrideInBytes);
+	desc.hitGroup = getCommandShaderTable(pDesc->HitGroupTable.StartAddress, pDesc->HitGroupTable.SizeInBytes, pDesc->HitGroupTable.StrideInBytes);
+	desc.callable = getCommandShaderTable(pDesc->CallableShaderTable.StartAddress, pDesc->CallableShaderTable.SizeInBytes, pDesc->CallableShaderTable.StrideInBytes);
+	desc.width = pDesc->Width;
+	desc.height = pDesc->Height;
+	desc.depth = pDesc->Depth;
+	mStream.dispatchRays(desc);
+}
+
+///////////////////////////////////////////
+// D3D12 replay
+///////////////////////////////////////////
+void D3D12CommandDevice::beginEvent(const char* pName)
+{
+	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, pName);
+}
+
+void D3D12CommandDevice::endEvent()
+{
+	PIXEndEvent(mpCmdList.GetInterfacePtr());
+}
+
+void D3D12CommandDevice::resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers)
+{
+	std::vector<D3D12_RESOURCE_BARRIER> barriers;
+	for (uint32_t b = 0; b < numBarriers; b++)
+	{
+		const CommandBarrier& barrier = pBarriers[b];
+		D3D12_RESOURCE_BARRIER d3dBarrier = {};
+		d3dBarrier.Type = (D3D12_RESOURCE_BARRIER_TYPE)barrier.type;
+		d3dBarrier.Flags = (D3D12_RESOURCE_BARRIER_FLAGS)barrier.flags;
+		if (barrier.type == kBarrierTypeTransition)
+		{
+			d3dBarrier.Transition.pResource = get<ID3D12Resource>(barrier.resource);
+			d3dBarrier.Transition.Subresource = barrier.subresource;
+			d3dBarrier.Transition.StateBefore = (D3D12_RESOURCE_STATES)barrier.before;
+			d3dBarrier.Transition.StateAfter = (D3D12_RESOURCE_STATES)barrier.after;
+			if (!d3dBarrier.Transition.pResource)
+			{
+				continue;
+			}
+		}
+		else if (barrier.type == kBarrierTypeAliasing)
+		{
+			d3dBarrier.Aliasing.pResourceBefore = get<ID3D12Resource>(barrier.resource);
+			d3dBarrier.Aliasing.pResourceAfter = get<ID3D12Resource>(barrier.subresource);
+		}
+		else
+		{
+			d3dBarrier.UAV.pResource = get<ID3D12Resource>(barrier.resource);
+		}
+		barriers.push_back(d3dBarrier);
+	}
+	if (!barriers.empty())
+	{
+		mpCmdList->ResourceBarrier((UINT)barriers.size(), barriers.data());
+	}
+}
+
+void D3D12CommandDevice::copyResource(uint32_t dst, uint32_t src)
+{
+	ID3D12Resource* pDst = get<ID3D12Resource>(dst);
+	ID3D12Resource* pSrc = get<ID3D12Resource>(src);
+	if (pDst && pSrc)
+	{
+		mpCmdList->CopyResource(pDst, pSrc);
+	}
+}
+
+void D3D12CommandDevice::setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps)
+{
+	std::vector<ID3D12DescriptorHeap*> heaps(numHeaps);
+	for (uint32_t h = 0; h < numHeaps; h++)
+	{
+		heaps[h] = get<ID3D12DescriptorHeap>(pHeaps[h]);
+		if (!heaps[h])
+		{
+			return;
+		}
+	}
+	mpCmdList->SetDescriptorHeaps(numHeaps, heaps.data());
+}
+
+void D3D12CommandDevice::setPipelineState(uint32_t pipelineState)
+{
+	if (ID3D12PipelineState* pPipelineState = get<ID3D12PipelineState>(pipelineState))
+	{
+		mpCmdList->SetPipelineState(pPipelineState);
+	}
+}
+
+void D3D12CommandDevice::setPipelineState1(uint32_t stateObject)
+{
+	if (ID3D12StateObject* pStateObject = get<ID3D12StateObject>(stateObject))
+	{
+		mpCmdList->SetPipelineState1(pStateObject);
+	}
+}
+
+void D3D12CommandDevice::setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature)
+{
+	ID3D12RootSignature* pRootSignature = get<ID3D12RootSignature>(rootSignature);
+	if (!pRootSignature)
+	{
+		return;
+	}
+	if (bindPoint == CommandBindPoint::Graphics)
+	{
+		mpCmdList->SetGraphicsRootSignature(pRootSignature);
+	}
+	else
+	{
+		mpCmdList->SetComputeRootSignature(pRootSignature);
+	}
+}
+
+void D3D12CommandDevice::setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table)
+{
+	D3D12_GPU_DESCRIPTOR_HANDLE handle = mRecorder.getGpuDescriptor(table);
+	if (handle.ptr == 0)
+	{
+		return;
+	}
+	if (bindPoint == CommandBindPoint::Graphics)
+	{
+		mpCmdList->SetGraphicsRootDescriptorTable(parameter, handle);
+	}
+	else
+	{
+		mpCmdList->SetComputeRootDescriptorTable(parameter, handle);
+	}
+}
+
+void D3D12CommandDevice::setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset)
+{
+	if (bindPoint == CommandBindPoint::Graphics)
+	{
+		mpCmdList->SetGraphicsRoot32BitConstants(parameter, numValues, pValues, destOffset);
+	}
+	else
+	{
+		mpCmdList->SetComputeRoot32BitConstants(parameter, numValues, pValues, destOffset);
+	}
+}
+
+void D3D12CommandDevice::setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address)
+{
+	D3D12_GPU_VIRTUAL_ADDRESS gpuAddress = mRecorder.getAddress(address);
+	if (bindPoint == CommandBindPoint::Graphics)
+	{
+		switch (view)
+		{
+		case CommandRootView::ConstantBuffer: mpCmdList->SetGraphicsRootConstantBufferView(parameter, gpuAddress); break;
+		case CommandRootView::ShaderResource: mpCmdList->SetGraphicsRootShaderResourceView(parameter, gpuAddress); break;
+		default: mpCmdList->SetGraphicsRootUnorderedAccessView(parameter, gpuAddress); break;
+		}
+	}
+	else
+	{
+		switch (view)
+		{
+		case CommandRootView::ConstantBuffer: mpCmdList->SetComputeRootConstantBufferView(parameter, gpuAddress); break;
+		case CommandRootView::ShaderResource: mpCmdList->SetComputeRootShaderResourceView(parameter, gpuAddress); break;
+		default: mpCmdList->SetComputeRootUnorderedAccessView(parameter, gpuAddress); break;
+		}
+	}
+}
+
+void D3D12CommandDevice::clearRenderTargetView(const CommandDescriptor& rtv, const float color[4])
+{
+	D3D12_CPU_DESCRIPTOR_HANDLE handle = mRecorder.getCpuDescriptor(rtv);
+	if (handle.ptr != 0)
+	{
+		mpCmdList->ClearRenderTargetView(handle, color, 0, nullptr);
+	}
+}
+
+void D3D12CommandDevice::clearDepthStencilView(const CommandDescriptor& dsv, uint32_t flags, float depth, uint32_t stencil)
+{
+	D3D12_CPU_DESCRIPTOR_HANDLE handle = mRecorder.getCpuDescriptor(dsv);
+	if (handle.ptr != 0)
+	{
+		mpCmdList->ClearDepthStencilView(handle, (D3D12_CLEAR_FLAGS)flags, depth, (UINT8)stencil, 0, nullptr);
+	}
+}
+
+void D3D12CommandDevice::setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv)
+{
+	std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> rtvs(numRtvs);
+	for (uint32_t r = 0; r < numRtvs; r++)
+	{
+		rtvs[r] = mRecorder.getCpuDescriptor(pRtvs[r]);
+	}
+	D3D12_CPU_DESCRIPTOR_HANDLE dsv = pDsv ? mRecorder.getCpuDescriptor(*pDsv) : D3D12_CPU_DESCRIPTOR_HANDLE();
+	mpCmdList->OMSetRenderTargets(numRtvs, rtvs.data(), false, pDsv ? &dsv : nullptr);
+}
+
+void D3D12CommandDevice::setStencilRef(uint32_t stencilRef)
+{
+	mpCmdList->OMSetStencilRef(stencilRef);
+}
+
+void D3D12CommandDevice::setViewports(uint32_t numViewports, const CommandViewport* pViewports)
+{
+	std::vector<D3D12_VIEWPORT> viewports(numViewports);
+	for (uint32_t v = 0; v < numViewports; v++)
+	{
+		viewports[v].TopLeftX = pViewports[v].x;
+		viewports[v].TopLeftY = pViewports[v].y;
+		viewports[v].Width = pViewports[v].width;
+		viewports[v].Height = pViewports[v].height;
+		viewports[v].MinDepth = pViewports[v].minDepth;
+		viewports[v].MaxDepth = pViewports[v].maxDepth;
+	}
+	mpCmdList->RSSetViewports(numViewports, viewports.data());
+}
+
+void D3D12CommandDevice::setScissorRects(uint32_t numRects, const CommandRect* pRects)
+{
+	std::vector<D3D12_RECT> rects(numRects);
+	for (uint32_t r = 0; r < numRects; r++)
+	{
+		rects[r].left = pRects[r].left;
+		rects[r].top = pRects[r].top;
+		rects[r].right = pRects[r].right;
+		rects[r].bottom = pRects[r].bottom;
+	}
+	mpCmdList->RSSetScissorRects(numRects, rects.data());
+}
+
+void D3D12CommandDevice::setPrimitiveTopology(uint32_t topology)
+{
+	mpCmdList->IASetPrimitiveTopology((D3D12_PRIMITIVE_TOPOLOGY)topology);
+}
+
+void D3D12CommandDevice::setVertexBuffers(uint32_t startSlot, uint32_t numViews, const CommandVertexBufferView* pViews)
+{
+	std::vector<D3D12_VERTEX_BUFFER_VIEW> views(numViews);
+	for (uint32_t v = 0; v < numViews; v++)
+	{
+		views[v].BufferLocation = mRecorder.getAddress(pViews[v].address);
+		views[v].SizeInBytes = pViews[v].size;
+		views[v].StrideInBytes = pViews[v].stride;
+	}
+	mpCmdList->IASetVertexBuffers(startSlot, numViews, numViews ? views.data() : nullptr);
+}
+
+void D3D12CommandDevice::setIndexBuffer(const CommandIndexBufferView* pView)
+{
+	if (!pView)
+	{
+		mpCmdList->IASetIndexBuffer(nullptr);
+		return;
+	}
+	D3D12_INDEX_BUFFER_VIEW view;
+	view.BufferLocation = mRecorder.getAddress(pView->address);
+	view.SizeInBytes = pView->size;
+	view.Format = (DXGI_FORMAT)pView->format;
+	mpCmdList->IASetIndexBuffer(&view);
+}
+
+void D3D12CommandDevice::drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertex, uint32_t startInstance)
+{
+	mpCmdList->DrawInstanced(vertexCount, instanceCount, startVertex, startInstance);
+}
+
+void D3D12CommandDevice::drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance)
+{
+	mpCmdList->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+void D3D12CommandDevice::dispatch(uint32_t x, uint32_t y, uint32_t z)
+{
+	mpCmdList->Dispatch(x, y, z);
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE D3D12CommandDevice::getShaderTable(const CommandShaderTable& table) const
+{
+	D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE range;
+	range.StartAddress = mRecorder.getAddress(table.address);
+	range.SizeInBytes = table.size;
+	range.StrideInBytes = table.stride;
+	return range;
+}
+
+void D3D12CommandDevice::dispatchRays(const CommandDispatchRays& desc)
+{
+	D3D12_DISPATCH_RAYS_DESC d3dDesc = {};
+	d3dDesc.RayGenerationShaderRecord.StartAddress = mRecorder.getAddress(desc.rayGeneration.address);
+	d3dDesc.RayGenerationShaderRecord.SizeInBytes = desc.rayGeneration.size;
+	d3dDesc.MissShaderTable = getShaderTable(desc.miss);
+	d3dDesc.HitGroupTable = getShaderTable(desc.hitGroup);
+	d3dDesc.CallableShaderTable = getShaderTable(desc.callable);
+	d3dDesc.Width = desc.width;
+	d3dDesc.Height = desc.height;
+	d3dDesc.Depth = desc.depth;
+	mpCmdList->DispatchRays(&d3dDesc);
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include "Framework.h"
+#include "CommandStream.h"
+#include <unordered_map>
+
+/*
+	The layer between the passes and the command list: every method forwards to the ID3D12GraphicsCommandList4 method
+	of the same name and records it into a CommandStream, with the D3D12 objects, descriptor handles and GPU addresses
+	turned into ids of the stream. Work recorded straight into the list, like the acceleration structure builds, isn't
+	in the stream.
+
+	Objects get their stream ids in the order they are registered or first used, so the streams of two runs that set
+	up the same objects in the same order can be compared id by id and replayed on each other's recorder.
+*/
+class CommandRecorder
+{
+public:
+	void init(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList);
+
+	/*
+		Give objects their names in the stream, or rename one that was already used. Objects that are used without being
+		registered get the name of their type and id. GPU addresses are only recorded as buffer and offset for buffers
+		the recorder knows, and descriptor handles only for known heaps, which RTV and DSV heaps are only by registering
+		them. The recorder doesn't hold references, the objects have to live as long as it.
+	*/
+	uint32_t registerResource(ID3D12Resource* pResource, const std::string& name);
+	uint32_t registerPipelineState(ID3D12PipelineState* pPipelineState, const std::string& name);
+	uint32_t registerStateObject(ID3D12StateObject* pStateObject, const std::string& name);
+	uint32_t registerRootSignature(ID3D12RootSignature* pRootSignature, const std::string& name);
+	uint32_t registerDescriptorHeap(ID3D12DescriptorHeap* pHeap, const std::string& name);
+
+	// Starts the stream of a frame after the command list was reset, the stream of the last frame is dropped
+	void beginFrame() { mStream.clear(); }
+
+	const CommandStream&			getStream() const { return mStream; }
+	ID3D12GraphicsCommandList4Ptr	getCommandList() const { return mpCmdList; }
+
+	// Back from the stream to D3D12, for D3D12CommandDevice. nullptr and 0 for what the recorder doesn't know.
+	void*						getObject(uint32_t id) const { return id < mObjects.size() ? mObjects[id] : nullptr; }
+	D3D12_GPU_VIRTUAL_ADDRESS	getAddress(const CommandAddress& address) const;
+	D3D12_CPU_DESCRIPTOR_HANDLE	getCpuDescriptor(const CommandDescriptor& descriptor) const;
+	D3D12_GPU_DESCRIPTOR_HANDLE	getGpuDescriptor(const CommandDescriptor& descriptor) const;
+
+	// PIX events, which group the commands into passes in the stream
+	void beginEvent(const char* pName);
+	void endEvent();
+
+	void resourceBarrier(UINT numBarriers, const D3D12_RESOURCE_BARRIER* pBarriers);
+	// A transition of all subresources
+	void transition(ID3D12Resource* pResource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after);
+	void copyResource(ID3D12Resource* pDst, ID3D12Resource* pSrc);
+
+	void setDescriptorHeaps(UINT numHeaps, ID3D12DescriptorHeap* const* ppHeaps);
+	void setPipelineState(ID3D12PipelineState* pPipelineState);
+	void setPipelineState1(ID3D12StateObject* pStateObject);
+	void setGraphicsRootSignature(ID3D12RootSignature* pRootSignature);
+	void setComputeRootSignature(ID3D12RootSignature* pRootSignature);
+	void setGraphicsRootDescriptorTable(UINT parameter, D3D12_GPU_DESCRIPTOR_HANDLE table);
+	void setComputeRootDescriptorTable(UINT parameter, D3D12_GPU_DESCRIPTOR_HANDLE table);
+	void setGraphicsRoot32BitConstants(UINT parameter, UINT numValues, const void* pValues, UINT destOffset);
+	void setComputeRoot32BitConstants(UINT parameter, UINT numValues, const void* pValues, UINT destOffset);
+	void setGraphicsRootConstantBufferView(UINT parameter, D3D12_GPU_VIRTUAL_ADDRESS address);
+	void setGraphicsRootShaderResourceView(UINT parameter, D3D12_GPU_VIRTUAL_ADDRESS address);
+
+	// Without rects, the whole view is cleared
+	void clearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE rtv, const FLOAT color[4]);
+	void clearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE dsv, D3D12_CLEAR_FLAGS flags, FLOAT depth, UINT8 stencil);
+	// One handle per render target, RTsSingleHandleToDescriptorRange false
+	void setRenderTargets(UINT numRtvs, const D3D12_CPU_DESCRIPTOR_HANDLE* pRtvs, const D3D12_CPU_DESCRIPTOR_HANDLE* pDsv);
+	void setStencilRef(UINT stencilRef);
+	void setViewports(UINT numViewports, const D3D12_VIEWPORT* pViewports);
+	void setScissorRects(UINT numRects, const D3D12_RECT* pRects);
+	void setPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY topology);
+	void setVertexBuffers(UINT startSlot, UINT numViews, const D3D12_VERTEX_BUFFER_VIEW* pViews);
+	void setIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* pView);
+
+	void drawInstanced(UINT vertexCount, UINT instanceCount, UINT startVertex, UINT startInstance);
+	void drawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance);
+	void dispatch(UINT x, UINT y, UINT z);
+	void dispatchRays(const D3D12_DISPATCH_RAYS_DESC* pDesc);
+
+private:
+	uint32_t addObject(void* pObject, CommandObjectType type, const std::string& name, uint64_t size = 0);
+	uint32_t registerObject(void* pObject, CommandObjectType type, const std::string& name);
+
+	// Ids of the objects, registering them if they are new. kNoCommandObject for nullptr.
+	uint32_t getResourceId(ID3D12Resource* pResource);
+	uint32_t getHeapId(ID3D12DescriptorHeap* pHeap);
+	uint32_t getObjectId(void* pObject, CommandObjectType type);
+
+	CommandAddress		getCommandAddress(D3D12_GPU_VIRTUAL_ADDRESS address) const;
+	CommandDescriptor	getCommandDescriptor(UINT64 handle, bool gpu) const;
+	CommandShaderTable	getCommandShaderTable(D3D12_GPU_VIRTUAL_ADDRESS address, UINT64 size, UINT64 stride) const;
+
+	struct Heap
+	{
+		uint32_t	id;
+		UINT64		cpuStart;
+		UINT64		gpuStart;		// 0 if it isn't shader visible
+		UINT64		increment;
+		uint32_t	numDescriptors;
+	};
+
+	ID3D12Device5Ptr							mpDevice;
+	ID3D12GraphicsCommandList4Ptr				mpCmdList;
+	CommandStream								mStream;
+	std::unordered_map<const void*, uint32_t>	mIds;
+	std::vector<void*>							mObjects;		// by stream id
+	std::map<D3D12_GPU_VIRTUAL_ADDRESS, uint32_t>	mBuffers;		// start address -> stream id
+	std::vector<Heap>							mHeaps;
+};
+
+/*
+	Replays a stream into a command list, with the objects of the recorder that recorded it. Commands that refer to
+	objects the recorder doesn't have are skipped.
+*/
+class D3D12CommandDevice : public CommandTarget
+{
+public:
+	D3D12CommandDevice(const CommandRecorder& recorder, ID3D12GraphicsCommandList4Ptr pCmdList) : mRecorder(recorder), mpCmdList(pCmdList) {}
+
+	void beginEvent(const char* pName) override;
+	void endEvent() override;
+	void resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers) override;
+	void copyResource(uint32_t dst, uint32_t src) override;
+	void setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps) override;
+	void setPipelineState(uint32_t pipelineState) override;
+	void setPipelineState1(uint32_t stateObject) override;
+	void setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature) override;
+	void setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table) override;
+	void setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset) override;
+	void setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address) override;
+	void clearRenderTargetView(const CommandDescriptor& rtv, const float color[4]) override;
+	void clearDepthStencilView(const CommandDescriptor& dsv, uint32_t flags, float depth, uint32_t stencil) override;
+	void setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv) override;
+	void setStencilRef(uint32_t stencilRef) override;
+	void setViewports(uint32_t numViewports, const CommandViewport* pViewports) override;
+	void setScissorRects(uint32_t numRects, const CommandRect* pRects) override;
+	void setPrimitiveTopology(uint32_t topology) override;
+	void setVertexBuffers(uint32_t startSlot, uint32_t numViews, const CommandVertexBufferView* pViews) override;
+	void setIndexBuffer(const CommandIndexBufferView* pView) override;
+	void drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertex, uint32_t startInstance) override;
+	void drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override;
+	void dispatch(uint32_t x, uint32_t y, uint32_t z) override;
+	void dispatchRays(const CommandDispatchRays& desc) override;
+
+private:
+	template<typename T>
+	T* get(uint32_t id) const { return static_cast<T*>(mRecorder.getObject(id)); }
+
+	D3D12_GPU_VIRTUAL_ADDRESS_RANGE_AND_STRIDE getShaderTable(const CommandShaderTable& table) const;
+
+	const CommandRecorder&			mRecorder;
+	ID3D12GraphicsCommandList4Ptr	mpCmdList;
+};
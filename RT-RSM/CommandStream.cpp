@@ -0,0 +1,1654 @@
+#include "CommandStream.h"
+#include <algorithm>
+#include <fstream>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// "RTCS", then the version of the file layout
+static const uint32_t kCommandStreamMagic = 0x53435452;
+static const uint32_t kCommandStreamVersion = 1;
+
+static std::string formatString(const char* pFormat, ...)
+{
+	char buffer[512];
+	va_list args;
+	va_start(args, pFormat);
+	vsnprintf(buffer, sizeof(buffer), pFormat, args);
+	va_end(args);
+	return buffer;
+}
+
+std::string getResourceStateName(uint32_t state)
+{
+	static const struct
+	{
+		uint32_t	state;
+		const char*	pName;
+	} kStateNames[] =
+	{
+		{ 0x1, "VERTEX_AND_CONSTANT_BUFFER" },
+		{ 0x2, "INDEX_BUFFER" },
+		{ 0x4, "RENDER_TARGET" },
+		{ 0x8, "UNORDERED_ACCESS" },
+		{ 0x10, "DEPTH_WRITE" },
+		{ 0x20, "DEPTH_READ" },
+		{ 0x40, "NON_PIXEL_SHADER_RESOURCE" },
+		{ 0x80, "PIXEL_SHADER_RESOURCE" },
+		{ 0x100, "STREAM_OUT" },
+		{ 0x200, "INDIRECT_ARGUMENT" },
+		{ 0x400, "COPY_DEST" },
+		{ 0x800, "COPY_SOURCE" },
+		{ 0x1000, "RESOLVE_DEST" },
+		{ 0x2000, "RESOLVE_SOURCE" },
+		{ 0x400000, "RAYTRACING_ACCELERATION_STRUCTURE" },
+		{ 0x1000000, "SHADING_RATE_SOURCE" },
+	};
+
+	if (state == kUnknownResourceState)
+	{
+		return "UNKNOWN";
+	}
+	if (state == kResourceStateCommon)
+	{
+		return "COMMON";
+	}
+	std::string name;
+	uint32_t rest = state;
+	for (const auto& entry : kStateNames)
+	{
+		if (state & entry.state)
+		{
+			name += (name.empty() ? "" : "|") + std::string(entry.pName);
+			rest &= ~entry.state;
+		}
+	}
+	if (rest)
+	{
+		name += (name.empty() ? "" : "|") + formatString("0x%x", rest);
+	}
+	return name;
+}
+
+const char* getCommandOpName(CommandOp op)
+{
+	switch (op)
+	{
+	case CommandOp::BeginEvent: return "BeginEvent";
+	case CommandOp::EndEvent: return "EndEvent";
+	case CommandOp::ResourceBarrier: return "ResourceBarrier";
+	case CommandOp::CopyResource: return "CopyResource";
+	case CommandOp::SetDescriptorHeaps: return "SetDescriptorHeaps";
+	case CommandOp::SetPipelineState: return "SetPipelineState";
+	case CommandOp::SetPipelineState1: return "SetPipelineState1";
+	case CommandOp::SetRootSignature: return "SetRootSignature";
+	case CommandOp::SetRootDescriptorTable: return "SetRootDescriptorTable";
+	case CommandOp::SetRoot32BitConstants: return "SetRoot32BitConstants";
+	case CommandOp::SetRootView: return "SetRootView";
+	case CommandOp::ClearRenderTargetView: return "ClearRenderTargetView";
+	case CommandOp::ClearDepthStencilView: return "ClearDepthStencilView";
+	case CommandOp::SetRenderTargets: return "OMSetRenderTargets";
+	case CommandOp::SetStencilRef: return "OMSetStencilRef";
+	case CommandOp::SetViewports: return "RSSetViewports";
+	case CommandOp::SetScissorRects: return "RSSetScissorRects";
+	case CommandOp::SetPrimitiveTopology: return "IASetPrimitiveTopology";
+	case CommandOp::SetVertexBuffers: return "IASetVertexBuffers";
+	case CommandOp::SetIndexBuffer: return "IASetIndexBuffer";
+	case CommandOp::DrawInstanced: return "DrawInstanced";
+	case CommandOp::DrawIndexedInstanced: return "DrawIndexedInstanced";
+	case CommandOp::Dispatch: return "Dispatch";
+	case CommandOp::DispatchRays: return "DispatchRays";
+	default: return "unknown";
+	}
+}
+
+const char* getCommandObjectTypeName(CommandObjectType type)
+{
+	switch (type)
+	{
+	case CommandObjectType::Resource: return "resource";
+	case CommandObjectType::PipelineState: return "pipeline state";
+	case CommandObjectType::StateObject: return "state object";
+	case CommandObjectType::RootSignature: return "root signature";
+	case CommandObjectType::DescriptorHeap: return "descriptor heap";
+	default: return "unknown";
+	}
+}
+
+static const char* getBindPointName(CommandBindPoint bindPoint)
+{
+	return bindPoint == CommandBindPoint::Graphics ? "graphics" : "compute";
+}
+
+///////////////////////////////////////////
+// Recording
+///////////////////////////////////////////
+uint32_t CommandStream::addObject(CommandObjectType type, const std::string& name, uint64_t size)
+{
+	CommandObject object;
+	object.type = type;
+	object.name = name;
+	object.size = size;
+	mObjects.push_back(object);
+	mStates.push_back(kUnknownResourceState);
+	return (uint32_t)mObjects.size() - 1;
+}
+
+void CommandStream::clear()
+{
+	for (size_t id = 0; id < mObjects.size(); id++)
+	{
+		mObjects[id].beginState = mStates[id];
+	}
+	mWords.clear();
+	mNumCommands = 0;
+}
+
+void CommandStream::begin(CommandOp op)
+{
+	mCommandBegin = mWords.size();
+	push((uint32_t)op);
+}
+
+void CommandStream::end()
+{
+	mWords[mCommandBegin] |= (uint32_t)(mWords.size() - mCommandBegin) << 8;
+	mNumCommands++;
+}
+
+void CommandStream::push(uint64_t value)
+{
+	push((uint32_t)value);
+	push((uint32_t)(value >> 32));
+}
+
+void CommandStream::push(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	push(bits);
+}
+
+void CommandStream::push(const CommandAddress& address)
+{
+	push(address.resource);
+	push(address.offset);
+}
+
+void CommandStream::push(const CommandDescriptor& descriptor)
+{
+	push(descriptor.heap);
+	push(descriptor.index);
+}
+
+void CommandStream::push(const CommandShaderTable& table)
+{
+	push(table.address);
+	push(table.size);
+	push(table.stride);
+}
+
+void CommandStream::push(const char* pString)
+{
+	uint32_t length = (uint32_t)strlen(pString);
+	push(length);
+	size_t first = mWords.size();
+	mWords.resize(first + (length + 3) / 4, 0);
+	memcpy(&mWords[first], pString, length);
+}
+
+void CommandStream::beginReplay(const std::vector<CommandObject>& objects)
+{
+	mObjects = objects;
+	mStates.resize(objects.size());
+	for (size_t id = 0; id < objects.size(); id++)
+	{
+		mStates[id] = objects[id].beginState;
+	}
+	mWords.clear();
+	mNumCommands = 0;
+}
+
+void CommandStream::beginEvent(const char* pName)
+{
+	begin(CommandOp::BeginEvent);
+	push(pName);
+	end();
+}
+
+void CommandStream::endEvent()
+{
+	begin(CommandOp::EndEvent);
+	end();
+}
+
+void CommandStream::resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers)
+{
+	begin(CommandOp::ResourceBarrier);
+	push(numBarriers);
+	for (uint32_t b = 0; b < numBarriers; b++)
+	{
+		const CommandBarrier& barrier = pBarriers[b];
+		push(barrier.type);
+		push(barrier.flags);
+		push(barrier.resource);
+		push(barrier.subresource);
+		push(barrier.before);
+		push(barrier.after);
+		if (barrier.type == kBarrierTypeTransition && barrier.resource < mStates.size())
+		{
+			mStates[barrier.resource] = barrier.after;
+		}
+	}
+	end();
+}
+
+void CommandStream::copyResource(uint32_t dst, uint32_t src)
+{
+	begin(CommandOp::CopyResource);
+	push(dst);
+	push(src);
+	end();
+}
+
+void CommandStream::setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps)
+{
+	begin(CommandOp::SetDescriptorHeaps);
+	push(numHeaps);
+	for (uint32_t h = 0; h < numHeaps; h++)
+	{
+		push(pHeaps[h]);
+	}
+	end();
+}
+
+void CommandStream::setPipelineState(uint32_t pipelineState)
+{
+	begin(CommandOp::SetPipelineState);
+	push(pipelineState);
+	end();
+}
+
+void CommandStream::setPipelineState1(uint32_t stateObject)
+{
+	begin(CommandOp::SetPipelineState1);
+	push(stateObject);
+	end();
+}
+
+void CommandStream::setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature)
+{
+	begin(CommandOp::SetRootSignature);
+	push((uint32_t)bindPoint);
+	push(rootSignature);
+	end();
+}
+
+void CommandStream::setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table)
+{
+	begin(CommandOp::SetRootDescriptorTable);
+	push((uint32_t)bindPoint);
+	push(parameter);
+	push(table);
+	end();
+}
+
+void CommandStream::setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset)
+{
+	begin(CommandOp::SetRoot32BitConstants);
+	push((uint32_t)bindPoint);
+	push(parameter);
+	push(destOffset);
+	push(numValues);
+	size_t first = mWords.size();
+	mWords.resize(first + numValues);
+	if (numValues > 0)
+	{
+		memcpy(&mWords[first], pValues, numValues * sizeof(uint32_t));
+	}
+	end();
+}
+
+void CommandStream::setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address)
+{
+	begin(CommandOp::SetRootView);
+	push((uint32_t)bindPoint);
+	push((uint32_t)view);
+	push(parameter);
+	push(address);
+	end();
+}
+
+void CommandStream::clearRenderTargetView(const CommandDescriptor& rtv, const float color[4])
+{
+	begin(CommandOp::ClearRenderTargetView);
+	push(rtv);
+	for (int c = 0; c < 4; c++)
+	{
+		push(color[c]);
+	}
+	end();
+}
+
+void CommandStream::clearDepthStencilView(const CommandDescriptor& dsv, uint32_t flags, float depth, uint32_t stencil)
+{
+	begin(CommandOp::ClearDepthStencilView);
+	push(dsv);
+	push(flags);
+	push(depth);
+	push(stencil);
+	end();
+}
+
+void CommandStream::setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv)
+{
+	begin(CommandOp::SetRenderTargets);
+	push(numRtvs);
+	for (uint32_t r = 0; r < numRtvs; r++)
+	{
+		push(pRtvs[r]);
+	}
+	push(pDsv ? 1u : 0u);
+	push(pDsv ? *pDsv : CommandDescriptor());
+	end();
+}
+
+void CommandStream::setStencilRef(uint32_t stencilRef)
+{
+	begin(CommandOp::SetStencilRef);
+	push(stencilRef);
+	end();
+}
+
+void CommandStream::setViewports(uint32_t numViewports, const CommandViewport* pViewports)
+{
+	begin(CommandOp::SetViewports);
+	push(numViewports);
+	for (uint32_t v = 0; v < numViewports; v++)
+	{
+		const CommandViewport& viewport = pViewports[v];
+		push(viewport.x);
+		push(viewport.y);
+		push(viewport.width);
+		push(viewport.height);
+		push(viewport.minDepth);
+		push(viewport.maxDepth);
+	}
+	end();
+}
+
+void CommandStream::setScissorRects(uint32_t numRects, const CommandRect* pRects)
+{
+	begin(CommandOp::SetScissorRects);
+	push(numRects);
+	for (uint32_t r = 0; r < numRects; r++)
+	{
+		push((uint32_t)pRects[r].left);
+		push((uint32_t)pRects[r].top);
+		push((uint32_t)pRects[r].right);
+		push((uint32_t)pRects[r].bottom);
+	}
+	end();
+}
+
+void CommandStream::setPrimitiveTopology(uint32_t topology)
+{
+	begin(CommandOp::SetPrimitiveTopology);
+	push(topology);
+	end();
+}
+
+void CommandStream::setVertexBuffers(uint32_t startSlot, uint32_t numViews, const CommandVertexBufferView* pViews)
+{
+	begin(CommandOp::SetVertexBuffers);
+	push(startSlot);
+	push(numViews);
+	for (uint32_t v = 0; v < numViews; v++)
+	{
+		push(pViews[v].address);
+		push(pViews[v].size);
+		push(pViews[v].stride);
+	}
+	end();
+}
+
+void CommandStream::setIndexBuffer(const CommandIndexBufferView* pView)
+{
+	begin(CommandOp::SetIndexBuffer);
+	CommandIndexBufferView view = pView ? *pView : CommandIndexBufferView();
+	push(pView ? 1u : 0u);
+	push(view.address);
+	push(view.size);
+	push(view.format);
+	end();
+}
+
+void CommandStream::drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertex, uint32_t startInstance)
+{
+	begin(CommandOp::DrawInstanced);
+	push(vertexCount);
+	push(instanceCount);
+	push(startVertex);
+	push(startInstance);
+	end();
+}
+
+void CommandStream::drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance)
+{
+	begin(CommandOp::DrawIndexedInstanced);
+	push(indexCount);
+	push(instanceCount);
+	push(startIndex);
+	push((uint32_t)baseVertex);
+	push(startInstance);
+	end();
+}
+
+void CommandStream::dispatch(uint32_t x, uint32_t y, uint32_t z)
+{
+	begin(CommandOp::Dispatch);
+	push(x);
+	push(y);
+	push(z);
+	end();
+}
+
+void CommandStream::dispatchRays(const CommandDispatchRays& desc)
+{
+	begin(CommandOp::DispatchRays);
+	push(desc.rayGeneration);
+	push(desc.miss);
+	push(desc.hitGroup);
+	push(desc.callable);
+	push(desc.width);
+	push(desc.height);
+	push(desc.depth);
+	end();
+}
+
+///////////////////////////////////////////
+// Decoding
+///////////////////////////////////////////
+// Arguments of one command. Reading past them gives 0 and clears ok, so a broken command is found before it is used.
+struct CommandReader
+{
+	const uint32_t*	pWords;
+	size_t			size;
+	size_t			pos = 0;
+	bool			ok = true;
+
+	CommandReader(const uint32_t* pWords, size_t size) : pWords(pWords), size(size) {}
+
+	// All arguments read, no more and no less
+	bool isComplete() const { return ok && pos == size; }
+
+	uint32_t read()
+	{
+		if (pos >= size)
+		{
+			ok = false;
+			return 0;
+		}
+		return pWords[pos++];
+	}
+
+	uint64_t read64()
+	{
+		uint64_t low = read();
+		return low | (uint64_t)read() << 32;
+	}
+
+	float readFloat()
+	{
+		uint32_t bits = read();
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	// Count of an array of items of itemWords words each, checked against what is left so a broken one can't allocate much
+	uint32_t readCount(uint32_t itemWords)
+	{
+		uint32_t count = read();
+		if ((uint64_t)count * itemWords > size - pos)
+		{
+			ok = false;
+			return 0;
+		}
+		return count;
+	}
+
+	CommandAddress readAddress()
+	{
+		CommandAddress address;
+		address.resource = read();
+		address.offset = read64();
+		return address;
+	}
+
+	CommandDescriptor readDescriptor()
+	{
+		CommandDescriptor descriptor;
+		descriptor.heap = read();
+		descriptor.index = read();
+		return descriptor;
+	}
+
+	CommandShaderTable readShaderTable()
+	{
+		CommandShaderTable table;
+		table.address = readAddress();
+		table.size = read64();
+		table.stride = read64();
+		return table;
+	}
+
+	std::string readString()
+	{
+		uint32_t length = read();
+		size_t words = ((size_t)length + 3) / 4;
+		if (!ok || words > size - pos)
+		{
+			ok = false;
+			return std::string();
+		}
+		std::string string((const char*)(pWords + pos), length);
+		pos += words;
+		return string;
+	}
+};
+
+bool CommandStream::decode(CommandTarget* pTarget) const
+{
+	// Kept over the commands so the arrays don't allocate every time
+	std::vector<CommandBarrier> barriers;
+	std::vector<uint32_t> values;
+	std::vector<CommandDescriptor> descriptors;
+	std::vector<CommandViewport> viewports;
+	std::vector<CommandRect> rects;
+	std::vector<CommandVertexBufferView> vertexBuffers;
+
+	if (pTarget)
+	{
+		pTarget->beginReplay(mObjects);
+	}
+	size_t word = 0;
+	while (word < mWords.size())
+	{
+		uint32_t header = mWords[word];
+		uint32_t op = header & 0xff;
+		uint32_t size = header >> 8;
+		if (op >= (uint32_t)CommandOp::Count || size == 0 || size > mWords.size() - word)
+		{
+			return false;
+		}
+		CommandReader r(&mWords[word + 1], size - 1);
+		word += size;
+
+		switch ((CommandOp)op)
+		{
+		case CommandOp::BeginEvent:
+		{
+			std::string name = r.readString();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->beginEvent(name.c_str());
+			break;
+		}
+		case CommandOp::EndEvent:
+		{
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->endEvent();
+			break;
+		}
+		case CommandOp::ResourceBarrier:
+		{
+			barriers.resize(r.readCount(6));
+			for (CommandBarrier& barrier : barriers)
+			{
+				barrier.type = r.read();
+				barrier.flags = r.read();
+				barrier.resource = r.read();
+				barrier.subresource = r.read();
+				barrier.before = r.read();
+				barrier.after = r.read();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->resourceBarrier((uint32_t)barriers.size(), barriers.data());
+			break;
+		}
+		case CommandOp::CopyResource:
+		{
+			uint32_t dst = r.read();
+			uint32_t src = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->copyResource(dst, src);
+			break;
+		}
+		case CommandOp::SetDescriptorHeaps:
+		{
+			values.resize(r.readCount(1));
+			for (uint32_t& heap : values)
+			{
+				heap = r.read();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setDescriptorHeaps((uint32_t)values.size(), values.data());
+			break;
+		}
+		case CommandOp::SetPipelineState:
+		case CommandOp::SetPipelineState1:
+		{
+			uint32_t object = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget && (CommandOp)op == CommandOp::SetPipelineState) pTarget->setPipelineState(object);
+			if (pTarget && (CommandOp)op == CommandOp::SetPipelineState1) pTarget->setPipelineState1(object);
+			break;
+		}
+		case CommandOp::SetRootSignature:
+		{
+			uint32_t bindPoint = r.read();
+			uint32_t rootSignature = r.read();
+			if (!r.isComplete() || bindPoint > (uint32_t)CommandBindPoint::Compute) return false;
+			if (pTarget) pTarget->setRootSignature((CommandBindPoint)bindPoint, rootSignature);
+			break;
+		}
+		case CommandOp::SetRootDescriptorTable:
+		{
+			uint32_t bindPoint = r.read();
+			uint32_t parameter = r.read();
+			CommandDescriptor table = r.readDescriptor();
+			if (!r.isComplete() || bindPoint > (uint32_t)CommandBindPoint::Compute) return false;
+			if (pTarget) pTarget->setRootDescriptorTable((CommandBindPoint)bindPoint, parameter, table);
+			break;
+		}
+		case CommandOp::SetRoot32BitConstants:
+		{
+			uint32_t bindPoint = r.read();
+			uint32_t parameter = r.read();
+			uint32_t destOffset = r.read();
+			values.resize(r.readCount(1));
+			for (uint32_t& value : values)
+			{
+				value = r.read();
+			}
+			if (!r.isComplete() || bindPoint > (uint32_t)CommandBindPoint::Compute) return false;
+			if (pTarget) pTarget->setRoot32BitConstants((CommandBindPoint)bindPoint, parameter, (uint32_t)values.size(), values.data(), destOffset);
+			break;
+		}
+		case CommandOp::SetRootView:
+		{
+			uint32_t bindPoint = r.read();
+			uint32_t view = r.read();
+			uint32_t parameter = r.read();
+			CommandAddress address = r.readAddress();
+			if (!r.isComplete() || bindPoint > (uint32_t)CommandBindPoint::Compute || view > (uint32_t)CommandRootView::UnorderedAccess) return false;
+			if (pTarget) pTarget->setRootView((CommandBindPoint)bindPoint, (CommandRootView)view, parameter, address);
+			break;
+		}
+		case CommandOp::ClearRenderTargetView:
+		{
+			CommandDescriptor rtv = r.readDescriptor();
+			float color[4];
+			for (float& c : color)
+			{
+				c = r.readFloat();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->clearRenderTargetView(rtv, color);
+			break;
+		}
+		case CommandOp::ClearDepthStencilView:
+		{
+			CommandDescriptor dsv = r.readDescriptor();
+			uint32_t flags = r.read();
+			float depth = r.readFloat();
+			uint32_t stencil = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->clearDepthStencilView(dsv, flags, depth, stencil);
+			break;
+		}
+		case CommandOp::SetRenderTargets:
+		{
+			descriptors.resize(r.readCount(2));
+			for (CommandDescriptor& rtv : descriptors)
+			{
+				rtv = r.readDescriptor();
+			}
+			bool hasDsv = r.read() != 0;
+			CommandDescriptor dsv = r.readDescriptor();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setRenderTargets((uint32_t)descriptors.size(), descriptors.data(), hasDsv ? &dsv : nullptr);
+			break;
+		}
+		case CommandOp::SetStencilRef:
+		{
+			uint32_t stencilRef = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setStencilRef(stencilRef);
+			break;
+		}
+		case CommandOp::SetViewports:
+		{
+			viewports.resize(r.readCount(6));
+			for (CommandViewport& viewport : viewports)
+			{
+				viewport.x = r.readFloat();
+				viewport.y = r.readFloat();
+				viewport.width = r.readFloat();
+				viewport.height = r.readFloat();
+				viewport.minDepth = r.readFloat();
+				viewport.maxDepth = r.readFloat();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setViewports((uint32_t)viewports.size(), viewports.data());
+			break;
+		}
+		case CommandOp::SetScissorRects:
+		{
+			rects.resize(r.readCount(4));
+			for (CommandRect& rect : rects)
+			{
+				rect.left = (int32_t)r.read();
+				rect.top = (int32_t)r.read();
+				rect.right = (int32_t)r.read();
+				rect.bottom = (int32_t)r.read();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setScissorRects((uint32_t)rects.size(), rects.data());
+			break;
+		}
+		case CommandOp::SetPrimitiveTopology:
+		{
+			uint32_t topology = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setPrimitiveTopology(topology);
+			break;
+		}
+		case CommandOp::SetVertexBuffers:
+		{
+			uint32_t startSlot = r.read();
+			vertexBuffers.resize(r.readCount(5));
+			for (CommandVertexBufferView& view : vertexBuffers)
+			{
+				view.address = r.readAddress();
+				view.size = r.read();
+				view.stride = r.read();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setVertexBuffers(startSlot, (uint32_t)vertexBuffers.size(), vertexBuffers.data());
+			break;
+		}
+		case CommandOp::SetIndexBuffer:
+		{
+			bool hasView = r.read() != 0;
+			CommandIndexBufferView view;
+			view.address = r.readAddress();
+			view.size = r.read();
+			view.format = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->setIndexBuffer(hasView ? &view : nullptr);
+			break;
+		}
+		case CommandOp::DrawInstanced:
+		{
+			uint32_t args[4];
+			for (uint32_t& arg : args)
+			{
+				arg = r.read();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->drawInstanced(args[0], args[1], args[2], args[3]);
+			break;
+		}
+		case CommandOp::DrawIndexedInstanced:
+		{
+			uint32_t args[5];
+			for (uint32_t& arg : args)
+			{
+				arg = r.read();
+			}
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->drawIndexedInstanced(args[0], args[1], args[2], (int32_t)args[3], args[4]);
+			break;
+		}
+		case CommandOp::Dispatch:
+		{
+			uint32_t x = r.read();
+			uint32_t y = r.read();
+			uint32_t z = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->dispatch(x, y, z);
+			break;
+		}
+		case CommandOp::DispatchRays:
+		{
+			CommandDispatchRays desc;
+			desc.rayGeneration = r.readShaderTable();
+			desc.miss = r.readShaderTable();
+			desc.hitGroup = r.readShaderTable();
+			desc.callable = r.readShaderTable();
+			desc.width = r.read();
+			desc.height = r.read();
+			desc.depth = r.read();
+			if (!r.isComplete()) return false;
+			if (pTarget) pTarget->dispatchRays(desc);
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+	if (pTarget)
+	{
+		pTarget->endReplay();
+	}
+	return true;
+}
+
+bool CommandStream::replay(CommandTarget& target) const
+{
+	return decode(&target);
+}
+
+///////////////////////////////////////////
+// Text and files
+///////////////////////////////////////////
+// Builds the text of getText from a replay
+class CommandTextWriter : public CommandTarget
+{
+public:
+	std::string text;
+
+	void beginReplay(const std::vector<CommandObject>& objects) override
+	{
+		mpObjects = &objects;
+		text += "objects\n";
+		for (uint32_t id = 0; id < (uint32_t)objects.size(); id++)
+		{
+			const CommandObject& object = objects[id];
+			text += formatString("  %u %s \"%s\"", id, getCommandObjectTypeName(object.type), object.name.c_str());
+			if (object.type == CommandObjectType::Resource)
+			{
+				text += formatString(" %llu bytes, begins in %s", (unsigned long long)object.size, getResourceStateName(object.beginState).c_str());
+			}
+			else if (object.type == CommandObjectType::DescriptorHeap)
+			{
+				text += formatString(" %llu descriptors", (unsigned long long)object.size);
+			}
+			text += "\n";
+		}
+		text += "commands\n";
+	}
+
+	void beginEvent(const char* pName) override
+	{
+		line("BeginEvent \"" + std::string(pName) + "\"");
+		mDepth++;
+	}
+
+	void endEvent() override
+	{
+		mDepth = mDepth > 0 ? mDepth - 1 : 0;
+		line("EndEvent");
+	}
+
+	void resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers) override
+	{
+		std::string barriers = "ResourceBarrier";
+		for (uint32_t b = 0; b < numBarriers; b++)
+		{
+			const CommandBarrier& barrier = pBarriers[b];
+			barriers += b > 0 ? ", " : " ";
+			if (barrier.type == kBarrierTypeTransition)
+			{
+				barriers += name(barrier.resource);
+				if (barrier.subresource != kAllSubresources)
+				{
+					barriers += formatString(" subresource %u", barrier.subresource);
+				}
+				barriers += " " + getResourceStateName(barrier.before) + " -> " + getResourceStateName(barrier.after);
+			}
+			else if (barrier.type == kBarrierTypeAliasing)
+			{
+				barriers += "aliasing " + name(barrier.resource) + " -> " + name(barrier.subresource);
+			}
+			else
+			{
+				barriers += "UAV " + name(barrier.resource);
+			}
+			if (barrier.flags)
+			{
+				barriers += formatString(" flags 0x%x", barrier.flags);
+			}
+		}
+		line(barriers);
+	}
+
+	void copyResource(uint32_t dst, uint32_t src) override
+	{
+		line("CopyResource " + name(dst) + " <- " + name(src));
+	}
+
+	void setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps) override
+	{
+		std::string heaps = "SetDescriptorHeaps";
+		for (uint32_t h = 0; h < numHeaps; h++)
+		{
+			heaps += " " + name(pHeaps[h]);
+		}
+		line(heaps);
+	}
+
+	void setPipelineState(uint32_t pipelineState) override
+	{
+		line("SetPipelineState " + name(pipelineState));
+	}
+
+	void setPipelineState1(uint32_t stateObject) override
+	{
+		line("SetPipelineState1 " + name(stateObject));
+	}
+
+	void setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature) override
+	{
+		line(formatString("SetRootSignature %s ", getBindPointName(bindPoint)) + name(rootSignature));
+	}
+
+	void setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table) override
+	{
+		line(formatString("SetRootDescriptorTable %s %u ", getBindPointName(bindPoint), parameter) + descriptor(table));
+	}
+
+	void setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset) override
+	{
+		std::string constants = formatString("SetRoot32BitConstants %s %u at %u:", getBindPointName(bindPoint), parameter, destOffset);
+		for (uint32_t v = 0; v < numValues; v++)
+		{
+			constants += formatString(" 0x%08x", ((const uint32_t*)pValues)[v]);
+		}
+		line(constants);
+	}
+
+	void setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address) override
+	{
+		static const char* kViewNames[] = { "CBV", "SRV", "UAV" };
+		line(formatString("SetRootView %s %s %u ", getBindPointName(bindPoint), kViewNames[(uint32_t)view], parameter) + this->address(address));
+	}
+
+	void clearRenderTargetView(const CommandDescriptor& rtv, const float color[4]) override
+	{
+		line("ClearRenderTargetView " + descriptor(rtv) + formatString(" (%g, %g, %g, %g)", color[0], color[1], color[2], color[3]));
+	}
+
+	void clearDepthStencilView(const CommandDescriptor& dsv, uint32_t flags, float depth, uint32_t stencil) override
+	{
+		line("ClearDepthStencilView " + descriptor(dsv) + formatString(" flags 0x%x depth %g stencil %u", flags, depth, stencil));
+	}
+
+	void setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv) override
+	{
+		std::string targets = "OMSetRenderTargets";
+		for (uint32_t r = 0; r < numRtvs; r++)
+		{
+			targets += " " + descriptor(pRtvs[r]);
+		}
+		targets += pDsv ? " depth " + descriptor(*pDsv) : " no depth";
+		line(targets);
+	}
+
+	void setStencilRef(uint32_t stencilRef) override
+	{
+		line(formatString("OMSetStencilRef %u", stencilRef));
+	}
+
+	void setViewports(uint32_t numViewports, const CommandViewport* pViewports) override
+	{
+		std::string viewports = "RSSetViewports";
+		for (uint32_t v = 0; v < numViewports; v++)
+		{
+			const CommandViewport& viewport = pViewports[v];
+			viewports += formatString(" (%g, %g, %g x %g, %g - %g)", viewport.x, viewport.y, viewport.width, viewport.height, viewport.minDepth, viewport.maxDepth);
+		}
+		line(viewports);
+	}
+
+	void setScissorRects(uint32_t numRects, const CommandRect* pRects) override
+	{
+		std::string rects = "RSSetScissorRects";
+		for (uint32_t r = 0; r < numRects; r++)
+		{
+			rects += formatString(" (%d, %d, %d, %d)", pRects[r].left, pRects[r].top, pRects[r].right, pRects[r].bottom);
+		}
+		line(rects);
+	}
+
+	void setPrimitiveTopology(uint32_t topology) override
+	{
+		line(formatString("IASetPrimitiveTopology %u", topology));
+	}
+
+	void setVertexBuffers(uint32_t startSlot, uint32_t numViews, const CommandVertexBufferView* pViews) override
+	{
+		std::string views = formatString("IASetVertexBuffers %u", startSlot);
+		for (uint32_t v = 0; v < numViews; v++)
+		{
+			views += " " + address(pViews[v].address) + formatString(" %u bytes stride %u", pViews[v].size, pViews[v].stride);
+		}
+		line(views);
+	}
+
+	void setIndexBuffer(const CommandIndexBufferView* pView) override
+	{
+		line(pView ? "IASetIndexBuffer " + address(pView->address) + formatString(" %u bytes format %u", pView->size, pView->format) : "IASetIndexBuffer null");
+	}
+
+	void drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertex, uint32_t startInstance) override
+	{
+		line(formatString("DrawInstanced %u x %u from %u, %u", vertexCount, instanceCount, startVertex, startInstance));
+	}
+
+	void drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override
+	{
+		line(formatString("DrawIndexedInstanced %u x %u from %u, %d, %u", indexCount, instanceCount, startIndex, baseVertex, startInstance));
+	}
+
+	void dispatch(uint32_t x, uint32_t y, uint32_t z) override
+	{
+		line(formatString("Dispatch %u %u %u", x, y, z));
+	}
+
+	void dispatchRays(const CommandDispatchRays& desc) override
+	{
+		line(formatString("DispatchRays %u %u %u raygen ", desc.width, desc.height, desc.depth) + shaderTable(desc.rayGeneration) +
+			" miss " + shaderTable(desc.miss) + " hit " + shaderTable(desc.hitGroup) + " callable " + shaderTable(desc.callable));
+	}
+
+private:
+	void line(const std::string& command)
+	{
+		text += std::string(2 * (mDepth + 1), ' ') + command + "\n";
+	}
+
+	std::string name(uint32_t id) const
+	{
+		if (id == kNoCommandObject)
+		{
+			return "null";
+		}
+		return id < mpObjects->size() ? "\"" + (*mpObjects)[id].name + "\"" : formatString("unknown %u", id);
+	}
+
+	std::string address(const CommandAddress& address) const
+	{
+		if (address.resource == kNoCommandObject)
+		{
+			return formatString("0x%llx", (unsigned long long)address.offset);
+		}
+		return name(address.resource) + formatString("+%llu", (unsigned long long)address.offset);
+	}
+
+	std::string descriptor(const CommandDescriptor& descriptor) const
+	{
+		return name(descriptor.heap) + formatString("[%u]", descriptor.index);
+	}
+
+	std::string shaderTable(const CommandShaderTable& table) const
+	{
+		return address(table.address) + formatString(" %llu bytes stride %llu", (unsigned long long)table.size, (unsigned long long)table.stride);
+	}
+
+	const std::vector<CommandObject>*	mpObjects = nullptr;
+	uint32_t							mDepth = 0;
+};
+
+std::string CommandStream::getText() const
+{
+	CommandTextWriter writer;
+	if (!replay(writer))
+	{
+		writer.text += "broken command\n";
+	}
+	return writer.text;
+}
+
+// Object table and commands as little endian words
+bool CommandStream::save(const char* pFileName) const
+{
+	CommandStream file;
+	file.push(kCommandStreamMagic);
+	file.push(kCommandStreamVersion);
+	file.push((uint32_t)mObjects.size());
+	for (const CommandObject& object : mObjects)
+	{
+		file.push((uint32_t)object.type);
+		file.push(object.size);
+		file.push(object.beginState);
+		file.push(object.name.c_str());
+	}
+	file.push(mNumCommands);
+	file.push((uint32_t)mWords.size());
+
+	std::ofstream stream(pFileName, std::ios::binary | std::ios::trunc);
+	if (!stream)
+	{
+		return false;
+	}
+	stream.write((const char*)file.mWords.data(), file.getSizeInBytes());
+	stream.write((const char*)mWords.data(), getSizeInBytes());
+	return stream.good();
+}
+
+bool CommandStream::load(const char* pFileName)
+{
+	*this = CommandStream();
+
+	std::ifstream stream(pFileName, std::ios::binary | std::ios::ate);
+	if (!stream)
+	{
+		return false;
+	}
+	size_t bytes = (size_t)stream.tellg();
+	if (bytes % sizeof(uint32_t))
+	{
+		return false;
+	}
+	std::vector<uint32_t> words(bytes / sizeof(uint32_t));
+	stream.seekg(0);
+	if (!stream.read((char*)words.data(), bytes))
+	{
+		return false;
+	}
+
+	CommandStream loaded;
+	CommandReader r(words.data(), words.size());
+	if (r.read() != kCommandStreamMagic || r.read() != kCommandStreamVersion)
+	{
+		return false;
+	}
+	uint32_t numObjects = r.readCount(5);
+	for (uint32_t id = 0; id < numObjects && r.ok; id++)
+	{
+		uint32_t type = r.read();
+		uint64_t size = r.read64();
+		uint32_t beginState = r.read();
+		std::string name = r.readString();
+		if (type > (uint32_t)CommandObjectType::DescriptorHeap)
+		{
+			return false;
+		}
+		loaded.addObject((CommandObjectType)type, name, size);
+		loaded.mObjects.back().beginState = beginState;
+		loaded.mStates.back() = beginState;
+	}
+	uint32_t numCommands = r.read();
+	uint32_t numWords = r.readCount(1);
+	if (!r.ok || r.pos + numWords != words.size())
+	{
+		return false;
+	}
+	loaded.mWords.assign(words.begin() + r.pos, words.end());
+	loaded.mNumCommands = numCommands;
+
+	// Every command has to decode, and the count has to match, before the stream is taken
+	uint32_t decoded = 0;
+	for (size_t word = 0; word < loaded.mWords.size() && (loaded.mWords[word] >> 8) > 0; word += loaded.mWords[word] >> 8)
+	{
+		decoded++;
+	}
+	if (decoded != numCommands || !loaded.decode(nullptr))
+	{
+		return false;
+	}
+	*this = loaded;
+	return true;
+}
+
+///////////////////////////////////////////
+// Null device
+///////////////////////////////////////////
+CommandStreamStats& CommandStreamStats::operator+=(const CommandStreamStats& s)
+{
+	numCommands += s.numCommands;
+	numDraws += s.numDraws;
+	numDispatches += s.numDispatches;
+	numCopies += s.numCopies;
+	bytesCopied += s.bytesCopied;
+	numBarrierCalls += s.numBarrierCalls;
+	numMergeableBarrierCalls += s.numMergeableBarrierCalls;
+	numBarriers += s.numBarriers;
+	numTransitions += s.numTransitions;
+	numRedundantTransitions += s.numRedundantTransitions;
+	numMismatchedTransitions += s.numMismatchedTransitions;
+	numRedundantBindings += s.numRedundantBindings;
+	return *this;
+}
+
+void NullCommandDevice::beginReplay(const std::vector<CommandObject>& objects)
+{
+	*this = NullCommandDevice();
+	mObjects = objects;
+	mTracking.resize(objects.size());
+	for (size_t id = 0; id < objects.size(); id++)
+	{
+		mTracking[id].state = objects[id].beginState;
+	}
+	mOutside.name = "outside of events";
+}
+
+void NullCommandDevice::endReplay()
+{
+	if (mEventDepth > 0)
+	{
+		addError(formatString("%u events not ended", mEventDepth));
+		endPass();
+	}
+	if (mOutside.stats.numCommands > 0)
+	{
+		mPasses.push_back(mOutside);
+	}
+	for (const Pass& pass : mPasses)
+	{
+		mStats += pass.stats;
+	}
+}
+
+CommandStreamStats& NullCommandDevice::count(bool barrierCall)
+{
+	CommandStreamStats& stats = mEventDepth > 0 ? mPass.stats : mOutside.stats;
+	stats.numCommands++;
+	if (barrierCall)
+	{
+		stats.numBarrierCalls++;
+		stats.numMergeableBarrierCalls += mLastWasBarrier ? 1 : 0;
+	}
+	mLastWasBarrier = barrierCall;
+	return stats;
+}
+
+void NullCommandDevice::endPass()
+{
+	mPasses.push_back(mPass);
+	mPass = Pass();
+	mEventDepth = 0;
+}
+
+void NullCommandDevice::addError(const std::string& error)
+{
+	if (mErrors.size() < kMaxErrors)
+	{
+		mErrors.push_back(error);
+	}
+	mNumErrors++;
+}
+
+const char* NullCommandDevice::getName(uint32_t id) const
+{
+	return id < mObjects.size() ? mObjects[id].name.c_str() : "unknown";
+}
+
+bool NullCommandDevice::checkObject(uint32_t id, CommandObjectType type, const char* pCommand)
+{
+	if (id >= mObjects.size())
+	{
+		addError(formatString("%s: unknown object %u", pCommand, id));
+		return false;
+	}
+	if (mObjects[id].type != type)
+	{
+		addError(formatString("%s: %s is a %s, not a %s", pCommand, getName(id), getCommandObjectTypeName(mObjects[id].type), getCommandObjectTypeName(type)));
+		return false;
+	}
+	return true;
+}
+
+void NullCommandDevice::checkDescriptor(const CommandDescriptor& descriptor, bool shaderVisible, const char* pCommand)
+{
+	if (!checkObject(descriptor.heap, CommandObjectType::DescriptorHeap, pCommand))
+	{
+		return;
+	}
+	if (descriptor.index >= mObjects[descriptor.heap].size)
+	{
+		addError(formatString("%s: descriptor %u outside of %s, which has %llu", pCommand, descriptor.index, getName(descriptor.heap), (unsigned long long)mObjects[descriptor.heap].size));
+	}
+	if (shaderVisible && std::find(mHeaps.begin(), mHeaps.end(), descriptor.heap) == mHeaps.end())
+	{
+		addError(formatString("%s: %s isn't bound", pCommand, getName(descriptor.heap)));
+	}
+}
+
+void NullCommandDevice::checkRootParameter(CommandBindPoint bindPoint, uint32_t parameter, const char* pCommand)
+{
+	if (mRootSignatures[(uint32_t)bindPoint] == kNoCommandObject)
+	{
+		addError(formatString("%s without a %s root signature", pCommand, getBindPointName(bindPoint)));
+	}
+	if (parameter >= kMaxRootSignatureDwords)
+	{
+		addError(formatString("%s of root parameter %u, a root signature has at most %u", pCommand, parameter, kMaxRootSignatureDwords));
+	}
+}
+
+void NullCommandDevice::checkDraw(CommandBindPoint bindPoint, const char* pCommand)
+{
+	if (mPipelineState == kNoCommandObject)
+	{
+		addError(formatString("%s without a pipeline state", pCommand));
+	}
+	if (mRootSignatures[(uint32_t)bindPoint] == kNoCommandObject)
+	{
+		addError(formatString("%s without a %s root signature", pCommand, getBindPointName(bindPoint)));
+	}
+}
+
+void NullCommandDevice::beginEvent(const char* pName)
+{
+	if (mEventDepth++ == 0)
+	{
+		mPass.name = pName;
+	}
+	count();
+}
+
+void NullCommandDevice::endEvent()
+{
+	if (mEventDepth == 0)
+	{
+		addError("EndEvent without BeginEvent");
+		count();
+		return;
+	}
+	count();
+	if (--mEventDepth == 0)
+	{
+		endPass();
+	}
+}
+
+void NullCommandDevice::resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers)
+{
+	CommandStreamStats& stats = count(true);
+	stats.numBarriers += numBarriers;
+	for (uint32_t b = 0; b < numBarriers; b++)
+	{
+		const CommandBarrier& barrier = pBarriers[b];
+		if (barrier.type == kBarrierTypeUav)
+		{
+			// A null resource stands for all UAV accesses
+			if (barrier.resource != kNoCommandObject)
+			{
+				checkObject(barrier.resource, CommandObjectType::Resource, "UAV barrier");
+			}
+			continue;
+		}
+		if (barrier.type == kBarrierTypeAliasing)
+		{
+			continue;
+		}
+
+		stats.numTransitions++;
+		if (!checkObject(barrier.resource, CommandObjectType::Resource, "Transition"))
+		{
+			continue;
+		}
+		Tracking& tracking = mTracking[barrier.resource];
+		if (tracking.state != kUnknownResourceState && tracking.state != barrier.before)
+		{
+			stats.numMismatchedTransitions++;
+			addError(formatString("Transition of %s from %s, it is in %s", getName(barrier.resource),
+				getResourceStateName(barrier.before).c_str(), getResourceStateName(tracking.state).c_str()));
+		}
+
+		// States are tracked per resource, transitions of single subresources are taken for all of them
+		if (barrier.before == barrier.after)
+		{
+			stats.numRedundantTransitions++;
+		}
+		else if (tracking.stateBeforeLast == barrier.after && tracking.state == barrier.before && tracking.workAtLast == mWork)
+		{
+			stats.numRedundantTransitions += 2;
+			tracking.state = barrier.after;
+			tracking.stateBeforeLast = kUnknownResourceState;
+			continue;
+		}
+		tracking.stateBeforeLast = barrier.before;
+		tracking.state = barrier.after;
+		tracking.workAtLast = mWork;
+	}
+}
+
+void NullCommandDevice::copyResource(uint32_t dst, uint32_t src)
+{
+	CommandStreamStats& stats = count();
+	stats.numCopies++;
+	mWork++;
+	if (!checkObject(dst, CommandObjectType::Resource, "CopyResource") || !checkObject(src, CommandObjectType::Resource, "CopyResource"))
+	{
+		return;
+	}
+	stats.bytesCopied += mObjects[dst].size;
+	if (mTracking[dst].state != kUnknownResourceState && mTracking[dst].state != kResourceStateCopyDest)
+	{
+		addError(formatString("CopyResource to %s in %s", getName(dst), getResourceStateName(mTracking[dst].state).c_str()));
+	}
+	if (mTracking[src].state != kUnknownResourceState && mTracking[src].state != kResourceStateCopySource)
+	{
+		addError(formatString("CopyResource from %s in %s", getName(src), getResourceStateName(mTracking[src].state).c_str()));
+	}
+}
+
+void NullCommandDevice::setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps)
+{
+	CommandStreamStats& stats = count();
+	std::vector<uint32_t> heaps(pHeaps, pHeaps + numHeaps);
+	if (heaps == mHeaps)
+	{
+		stats.numRedundantBindings++;
+	}
+	for (uint32_t heap : heaps)
+	{
+		checkObject(heap, CommandObjectType::DescriptorHeap, "SetDescriptorHeaps");
+	}
+	mHeaps = heaps;
+}
+
+void NullCommandDevice::setPipelineState(uint32_t pipelineState)
+{
+	CommandStreamStats& stats = count();
+	stats.numRedundantBindings += pipelineState == mPipelineState ? 1 : 0;
+	checkObject(pipelineState, CommandObjectType::PipelineState, "SetPipelineState");
+	mPipelineState = pipelineState;
+}
+
+void NullCommandDevice::setPipelineState1(uint32_t stateObject)
+{
+	CommandStreamStats& stats = count();
+	stats.numRedundantBindings += stateObject == mPipelineState ? 1 : 0;
+	checkObject(stateObject, CommandObjectType::StateObject, "SetPipelineState1");
+	mPipelineState = stateObject;
+}
+
+void NullCommandDevice::setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature)
+{
+	CommandStreamStats& stats = count();
+	uint32_t& bound = mRootSignatures[(uint32_t)bindPoint];
+	stats.numRedundantBindings += rootSignature == bound ? 1 : 0;
+	checkObject(rootSignature, CommandObjectType::RootSignature, "SetRootSignature");
+	bound = rootSignature;
+}
+
+void NullCommandDevice::setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table)
+{
+	count();
+	checkRootParameter(bindPoint, parameter, "SetRootDescriptorTable");
+	checkDescriptor(table, true, "SetRootDescriptorTable");
+}
+
+void NullCommandDevice::setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset)
+{
+	count();
+	checkRootParameter(bindPoint, parameter, "SetRoot32BitConstants");
+	if (numValues == 0 || pValues == nullptr)
+	{
+		addError("SetRoot32BitConstants without values");
+	}
+	else if ((uint64_t)destOffset + numValues > kMaxRootSignatureDwords)
+	{
+		addError(formatString("SetRoot32BitConstants of constants %u to %u, a root signature holds at most %u", destOffset, destOffset + numValues - 1, kMaxRootSignatureDwords));
+	}
+}
+
+void NullCommandDevice::setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address)
+{
+	count();
+	checkRootParameter(bindPoint, parameter, "SetRootView");
+	if (address.resource != kNoCommandObject)
+	{
+		checkObject(address.resource, CommandObjectType::Resource, "SetRootView");
+	}
+	if (view == CommandRootView::ConstantBuffer && address.offset % kConstantBufferAlignment != 0)
+	{
+		addError(formatString("SetRootView of a constant buffer at offset %llu, not a multiple of %u", (unsigned long long)address.offset, kConstantBufferAlignment));
+	}
+}
+
+void NullCommandDevice::clearRenderTargetView(const CommandDescriptor& rtv, const float[4])
+{
+	count();
+	mWork++;
+	checkDescriptor(rtv, false, "ClearRenderTargetView");
+}
+
+void NullCommandDevice::clearDepthStencilView(const CommandDescriptor& dsv, uint32_t, float, uint32_t)
+{
+	count();
+	mWork++;
+	checkDescriptor(dsv, false, "ClearDepthStencilView");
+}
+
+void NullCommandDevice::setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv)
+{
+	count();
+	for (uint32_t r = 0; r < numRtvs; r++)
+	{
+		checkDescriptor(pRtvs[r], false, "OMSetRenderTargets");
+	}
+	if (pDsv)
+	{
+		checkDescriptor(*pDsv, false, "OMSetRenderTargets");
+	}
+}
+
+void NullCommandDevice::setStencilRef(uint32_t)
+{
+	count();
+}
+
+void NullCommandDevice::setViewports(uint32_t, const CommandViewport*)
+{
+	count();
+}
+
+void NullCommandDevice::setScissorRects(uint32_t, const CommandRect*)
+{
+	count();
+}
+
+void NullCommandDevice::setPrimitiveTopology(uint32_t)
+{
+	count();
+}
+
+void NullCommandDevice::setVertexBuffers(uint32_t, uint32_t numViews, const CommandVertexBufferView* pViews)
+{
+	count();
+	for (uint32_t v = 0; v < numViews; v++)
+	{
+		if (pViews[v].address.resource != kNoCommandObject)
+		{
+			checkObject(pViews[v].address.resource, CommandObjectType::Resource, "IASetVertexBuffers");
+		}
+	}
+}
+
+void NullCommandDevice::setIndexBuffer(const CommandIndexBufferView* pView)
+{
+	count();
+	if (pView && pView->address.resource != kNoCommandObject)
+	{
+		checkObject(pView->address.resource, CommandObjectType::Resource, "IASetIndexBuffer");
+	}
+}
+
+void NullCommandDevice::drawInstanced(uint32_t, uint32_t, uint32_t, uint32_t)
+{
+	count().numDraws++;
+	mWork++;
+	checkDraw(CommandBindPoint::Graphics, "DrawInstanced");
+}
+
+void NullCommandDevice::drawIndexedInstanced(uint32_t, uint32_t, uint32_t, int32_t, uint32_t)
+{
+	count().numDraws++;
+	mWork++;
+	checkDraw(CommandBindPoint::Graphics, "DrawIndexedInstanced");
+}
+
+void NullCommandDevice::dispatch(uint32_t, uint32_t, uint32_t)
+{
+	count().numDispatches++;
+	mWork++;
+	checkDraw(CommandBindPoint::Compute, "Dispatch");
+}
+
+void NullCommandDevice::dispatchRays(const CommandDispatchRays& desc)
+{
+	count().numDispatches++;
+	mWork++;
+	checkDraw(CommandBindPoint::Compute, "DispatchRays");
+	const CommandShaderTable* tables[] = { &desc.rayGeneration, &desc.miss, &desc.hitGroup, &desc.callable };
+	for (const CommandShaderTable* pTable : tables)
+	{
+		if (pTable->address.resource != kNoCommandObject)
+		{
+			checkObject(pTable->address.resource, CommandObjectType::Resource, "DispatchRays");
+		}
+	}
+}
+
+std::string NullCommandDevice::getReport() const
+{
+	std::string report = formatString("Command stream: %u commands, %u draws, %u dispatches, %u copies of %.2f MB, %u barriers in %u calls (%u mergeable), "
+		"%u transitions (%u redundant, %u mismatched), %u redundant bindings, %u errors",
+		mStats.numCommands,
+		mStats.numDraws,
+		mStats.numDispatches,
+		mStats.numCopies,
+		mStats.bytesCopied / (1024.0 * 1024.0),
+		mStats.numBarriers,
+		mStats.numBarrierCalls,
+		mStats.numMergeableBarrierCalls,
+		mStats.numTransitions,
+		mStats.numRedundantTransitions,
+		mStats.numMismatchedTransitions,
+		mStats.numRedundantBindings,
+		mNumErrors);
+	report += formatString("\n  %-28s %8s %6s %10s %6s %9s %8s %6s %9s %9s %10s %7s", "pass", "commands", "draws", "dispatches", "copies", "MB copied",
+		"barriers", "calls", "mergeable", "redundant", "mismatched", "rebinds");
+	for (const Pass& pass : mPasses)
+	{
+		const CommandStreamStats& s = pass.stats;
+		report += formatString("\n  %-28s %8u %6u %10u %6u %9.2f %8u %6u %9u %9u %10u %7u", pass.name.c_str(), s.numCommands, s.numDraws, s.numDispatches,
+			s.numCopies, s.bytesCopied / (1024.0 * 1024.0), s.numBarriers, s.numBarrierCalls, s.numMergeableBarrierCalls, s.numRedundantTransitions,
+			s.numMismatchedTransitions, s.numRedundantBindings);
+	}
+	for (const std::string& error : mErrors)
+	{
+		report += "\n  error: " + error;
+	}
+	if (mNumErrors > mErrors.size())
+	{
+		report += formatString("\n  %u more errors", mNumErrors - (uint32_t)mErrors.size());
+	}
+	return report;
+}
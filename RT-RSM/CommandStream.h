@@ -0,0 +1,423 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+///////////////////////////////////////////
+// Command stream
+///////////////////////////////////////////
+/*
+	Compact binary recording of what the passes put into the command list: barriers, copies, root bindings, render
+	targets, draws and dispatches. Objects are referred to by ids into the object table of the stream instead of by
+	pointer, descriptors by heap and index and GPU addresses by buffer and offset, so a stream recorded on one run can
+	be saved, loaded and diffed against one of another run or commit. CommandRecorder records it from D3D12 calls.
+
+	Replaying walks the commands into a CommandTarget: NullCommandDevice checks and counts them, D3D12CommandDevice
+	issues them to a command list, and a CommandStream is a target as well, which records them again.
+
+	The stream also tracks the state every resource is left in by the transitions. clear() starts the next frame with
+	those states, so each stream carries the states its frame began with.
+*/
+
+static const uint32_t kNoCommandObject = 0xffffffff;
+
+// State of a resource that hasn't been transitioned yet. The first transition tells what it was.
+static const uint32_t kUnknownResourceState = 0xffffffff;
+
+// D3D12_RESOURCE_STATES, the stream keeps the D3D12 values so it can be read without d3d12.h
+static const uint32_t kResourceStateCommon = 0x0;
+static const uint32_t kResourceStateVertexAndConstantBuffer = 0x1;
+static const uint32_t kResourceStateIndexBuffer = 0x2;
+static const uint32_t kResourceStateRenderTarget = 0x4;
+static const uint32_t kResourceStateUnorderedAccess = 0x8;
+static const uint32_t kResourceStateDepthWrite = 0x10;
+static const uint32_t kResourceStateDepthRead = 0x20;
+static const uint32_t kResourceStateNonPixelShaderResource = 0x40;
+static const uint32_t kResourceStatePixelShaderResource = 0x80;
+static const uint32_t kResourceStateCopyDest = 0x400;
+static const uint32_t kResourceStateCopySource = 0x800;
+static const uint32_t kResourceStateRaytracingAccelerationStructure = 0x400000;
+
+// D3D12_RESOURCE_BARRIER_TYPE and D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES
+static const uint32_t kBarrierTypeTransition = 0;
+static const uint32_t kBarrierTypeAliasing = 1;
+static const uint32_t kBarrierTypeUav = 2;
+static const uint32_t kAllSubresources = 0xffffffff;
+
+// Names of the set bits, "COMMON" for 0
+std::string getResourceStateName(uint32_t state);
+
+enum class CommandObjectType : uint32_t
+{
+	Resource,
+	PipelineState,
+	StateObject,		// ray tracing pipeline
+	RootSignature,
+	DescriptorHeap,
+};
+
+const char* getCommandObjectTypeName(CommandObjectType type);
+
+struct CommandObject
+{
+	CommandObjectType	type = CommandObjectType::Resource;
+	std::string			name;
+	uint64_t			size = 0;							// resources: bytes a CopyResource of it moves, heaps: descriptors
+	uint32_t			beginState = kUnknownResourceState;	// resources: state at the start of the stream
+};
+
+enum class CommandOp : uint32_t
+{
+	BeginEvent,
+	EndEvent,
+	ResourceBarrier,
+	CopyResource,
+	SetDescriptorHeaps,
+	SetPipelineState,
+	SetPipelineState1,
+	SetRootSignature,
+	SetRootDescriptorTable,
+	SetRoot32BitConstants,
+	SetRootView,
+	ClearRenderTargetView,
+	ClearDepthStencilView,
+	SetRenderTargets,
+	SetStencilRef,
+	SetViewports,
+	SetScissorRects,
+	SetPrimitiveTopology,
+	SetVertexBuffers,
+	SetIndexBuffer,
+	DrawInstanced,
+	DrawIndexedInstanced,
+	Dispatch,
+	DispatchRays,
+	Count
+};
+
+const char* getCommandOpName(CommandOp op);
+
+enum class CommandBindPoint : uint32_t
+{
+	Graphics,
+	Compute,
+};
+
+// Root CBV, SRV or UAV
+enum class CommandRootView : uint32_t
+{
+	ConstantBuffer,
+	ShaderResource,
+	UnorderedAccess,
+};
+
+// GPU virtual address. One that isn't in a known buffer has no resource and the raw address as offset.
+struct CommandAddress
+{
+	uint32_t	resource = kNoCommandObject;
+	uint64_t	offset = 0;
+};
+
+// CPU or GPU descriptor handle
+struct CommandDescriptor
+{
+	uint32_t	heap = kNoCommandObject;
+	uint32_t	index = 0;
+};
+
+// D3D12_RESOURCE_BARRIER. Aliasing barriers keep the resource before in resource and the one after in subresource.
+struct CommandBarrier
+{
+	uint32_t	type = kBarrierTypeTransition;
+	uint32_t	flags = 0;
+	uint32_t	resource = kNoCommandObject;
+	uint32_t	subresource = kAllSubresources;
+	uint32_t	before = kResourceStateCommon;
+	uint32_t	after = kResourceStateCommon;
+};
+
+struct CommandViewport
+{
+	float	x = 0.0f;
+	float	y = 0.0f;
+	float	width = 0.0f;
+	float	height = 0.0f;
+	float	minDepth = 0.0f;
+	float	maxDepth = 1.0f;
+};
+
+struct CommandRect
+{
+	int32_t	left = 0;
+	int32_t	top = 0;
+	int32_t	right = 0;
+	int32_t	bottom = 0;
+};
+
+struct CommandVertexBufferView
+{
+	CommandAddress	address;
+	uint32_t		size = 0;
+	uint32_t		stride = 0;
+};
+
+struct CommandIndexBufferView
+{
+	CommandAddress	address;
+	uint32_t		size = 0;
+	uint32_t		format = 0;		// DXGI_FORMAT
+};
+
+struct CommandShaderTable
+{
+	CommandAddress	address;
+	uint64_t		size = 0;
+	uint64_t		stride = 0;		// 0 for the ray generation record
+};
+
+struct CommandDispatchRays
+{
+	CommandShaderTable	rayGeneration;
+	CommandShaderTable	miss;
+	CommandShaderTable	hitGroup;
+	CommandShaderTable	callable;
+	uint32_t			width = 0;
+	uint32_t			height = 0;
+	uint32_t			depth = 1;
+};
+
+/*
+	Where a replay goes, a method per command in the terms of the stream. beginReplay gets the object table of the
+	stream before the first command and endReplay comes after the last.
+*/
+class CommandTarget
+{
+public:
+	virtual ~CommandTarget() {}
+
+	virtual void beginReplay(const std::vector<CommandObject>&) {}
+	virtual void endReplay() {}
+
+	virtual void beginEvent(const char* pName) = 0;
+	virtual void endEvent() = 0;
+	virtual void resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers) = 0;
+	virtual void copyResource(uint32_t dst, uint32_t src) = 0;
+	virtual void setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps) = 0;
+	virtual void setPipelineState(uint32_t pipelineState) = 0;
+	virtual void setPipelineState1(uint32_t stateObject) = 0;
+	virtual void setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature) = 0;
+	virtual void setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table) = 0;
+	virtual void setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset) = 0;
+	virtual void setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address) = 0;
+	virtual void clearRenderTargetView(const CommandDescriptor& rtv, const float color[4]) = 0;
+	virtual void clearDepthStencilView(const CommandDescriptor& dsv, uint32_t flags, float depth, uint32_t stencil) = 0;
+	virtual void setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv) = 0;
+	virtual void setStencilRef(uint32_t stencilRef) = 0;
+	virtual void setViewports(uint32_t numViewports, const CommandViewport* pViewports) = 0;
+	virtual void setScissorRects(uint32_t numRects, const CommandRect* pRects) = 0;
+	virtual void setPrimitiveTopology(uint32_t topology) = 0;
+	virtual void setVertexBuffers(uint32_t startSlot, uint32_t numViews, const CommandVertexBufferView* pViews) = 0;
+	virtual void setIndexBuffer(const CommandIndexBufferView* pView) = 0;
+	virtual void drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertex, uint32_t startInstance) = 0;
+	virtual void drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) = 0;
+	virtual void dispatch(uint32_t x, uint32_t y, uint32_t z) = 0;
+	virtual void dispatchRays(const CommandDispatchRays& desc) = 0;
+};
+
+/*
+	Every command is a header word, the op in the low 8 bits and the length in words (the header included) above, then
+	its arguments as 32 bit words, 64 bit values low word first. Variable length arguments start with their count.
+*/
+class CommandStream : public CommandTarget
+{
+public:
+	uint32_t addObject(CommandObjectType type, const std::string& name, uint64_t size = 0);
+	const CommandObject& getObject(uint32_t id) const { return mObjects[id]; }
+	const std::vector<CommandObject>& getObjects() const { return mObjects; }
+	uint32_t getNumObjects() const { return (uint32_t)mObjects.size(); }
+	void setObjectName(uint32_t id, const std::string& name) { mObjects[id].name = name; }
+
+	// Of a resource, where the recorded transitions left it
+	uint32_t getState(uint32_t resource) const { return mStates[resource]; }
+
+	// Drops the commands and keeps the objects, which now begin in the states the commands left them in
+	void clear();
+
+	// Replays the commands in order. Stops at a broken one and returns false, only a bad file (see load) has those.
+	bool replay(CommandTarget& target) const;
+
+	/*
+		One line per object, then one per command with the names of the objects it uses, indented by the events. Made
+		to be diffed, nothing in it depends on the run but the raw addresses outside of known buffers.
+	*/
+	std::string getText() const;
+
+	// Binary, as recorded. load checks every command and leaves the stream empty if the file is broken.
+	bool save(const char* pFileName) const;
+	bool load(const char* pFileName);
+
+	uint32_t	getNumCommands() const { return mNumCommands; }
+	size_t		getSizeInBytes() const { return mWords.size() * sizeof(uint32_t); }
+
+	void beginReplay(const std::vector<CommandObject>& objects) override;
+	void beginEvent(const char* pName) override;
+	void endEvent() override;
+	void resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers) override;
+	void copyResource(uint32_t dst, uint32_t src) override;
+	void setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps) override;
+	void setPipelineState(uint32_t pipelineState) override;
+	void setPipelineState1(uint32_t stateObject) override;
+	void setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature) override;
+	void setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table) override;
+	void setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset) override;
+	void setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address) override;
+	void clearRenderTargetView(const CommandDescriptor& rtv, const float color[4]) override;
+	void clearDepthStencilView(const CommandDescriptor& dsv, uint32_t flags, float depth, uint32_t stencil) override;
+	void setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv) override;
+	void setStencilRef(uint32_t stencilRef) override;
+	void setViewports(uint32_t numViewports, const CommandViewport* pViewports) override;
+	void setScissorRects(uint32_t numRects, const CommandRect* pRects) override;
+	void setPrimitiveTopology(uint32_t topology) override;
+	void setVertexBuffers(uint32_t startSlot, uint32_t numViews, const CommandVertexBufferView* pViews) override;
+	void setIndexBuffer(const CommandIndexBufferView* pView) override;
+	void drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertex, uint32_t startInstance) override;
+	void drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override;
+	void dispatch(uint32_t x, uint32_t y, uint32_t z) override;
+	void dispatchRays(const CommandDispatchRays& desc) override;
+
+private:
+	void begin(CommandOp op);
+	void end();
+	void push(uint32_t value) { mWords.push_back(value); }
+	void push(uint64_t value);
+	void push(float value);
+	void push(const CommandAddress& address);
+	void push(const CommandDescriptor& descriptor);
+	void push(const CommandShaderTable& table);
+	void push(const char* pString);
+
+	// Decodes the commands into pTarget, or only checks them without one
+	bool decode(CommandTarget* pTarget) const;
+
+	std::vector<CommandObject>	mObjects;
+	std::vector<uint32_t>		mStates;		// by object id, resources only
+	std::vector<uint32_t>		mWords;
+	uint32_t					mNumCommands = 0;
+	size_t						mCommandBegin = 0;
+};
+
+struct CommandStreamStats
+{
+	uint32_t	numCommands = 0;
+	uint32_t	numDraws = 0;
+	uint32_t	numDispatches = 0;				// Dispatch and DispatchRays
+	uint32_t	numCopies = 0;
+	uint64_t	bytesCopied = 0;				// by CopyResource, the size of the destination
+	uint32_t	numBarrierCalls = 0;			// ResourceBarrier calls
+	uint32_t	numMergeableBarrierCalls = 0;	// right after another ResourceBarrier call, could have been part of it
+	uint32_t	numBarriers = 0;				// all types
+	uint32_t	numTransitions = 0;
+	uint32_t	numRedundantTransitions = 0;	// see NullCommandDevice
+	uint32_t	numMismatchedTransitions = 0;	// the state before isn't the one the resource is in
+	uint32_t	numRedundantBindings = 0;		// heaps, pipeline or root signature set to what is bound already
+
+	CommandStreamStats& operator+=(const CommandStreamStats& s);
+};
+
+/*
+	Replays without a device: tracks the resource states and bindings, counts the commands per frame and per top level
+	event, and checks what the debug layer would complain about.
+
+	A transition is redundant if it doesn't change the state, or if it takes a resource back to the state its last
+	transition came from with no draw, dispatch, copy or clear recorded in between, in which case both count. It is
+	mismatched if its state before isn't the one the resource is in, and the resource is taken to be in the state after
+	anyway. Errors are also reported for descriptor tables outside the bound heaps or the heap, draws and dispatches
+	without a pipeline and root signature, root parameters and constants past the 64 DWORDs of a root signature,
+	unaligned root constant buffer views, unknown objects and unbalanced events.
+*/
+class NullCommandDevice : public CommandTarget
+{
+public:
+	struct Pass
+	{
+		std::string			name;
+		CommandStreamStats	stats;
+	};
+
+	// All of the last replay
+	const CommandStreamStats&		getStats() const { return mStats; }
+	const std::vector<Pass>&		getPasses() const { return mPasses; }
+	const std::vector<std::string>&	getErrors() const { return mErrors; }	// the first kMaxErrors
+	uint32_t						getNumErrors() const { return mNumErrors; }
+
+	// The stats as a table, a row per pass, then the errors
+	std::string getReport() const;
+
+	static const uint32_t kMaxErrors = 64;
+
+	// D3D12_MAX_ROOT_COST, and D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT for the address of a root CBV
+	static const uint32_t kMaxRootSignatureDwords = 64;
+	static const uint32_t kConstantBufferAlignment = 256;
+
+	void beginReplay(const std::vector<CommandObject>& objects) override;
+	void endReplay() override;
+	void beginEvent(const char* pName) override;
+	void endEvent() override;
+	void resourceBarrier(uint32_t numBarriers, const CommandBarrier* pBarriers) override;
+	void copyResource(uint32_t dst, uint32_t src) override;
+	void setDescriptorHeaps(uint32_t numHeaps, const uint32_t* pHeaps) override;
+	void setPipelineState(uint32_t pipelineState) override;
+	void setPipelineState1(uint32_t stateObject) override;
+	void setRootSignature(CommandBindPoint bindPoint, uint32_t rootSignature) override;
+	void setRootDescriptorTable(CommandBindPoint bindPoint, uint32_t parameter, const CommandDescriptor& table) override;
+	void setRoot32BitConstants(CommandBindPoint bindPoint, uint32_t parameter, uint32_t numValues, const void* pValues, uint32_t destOffset) override;
+	void setRootView(CommandBindPoint bindPoint, CommandRootView view, uint32_t parameter, const CommandAddress& address) override;
+	void clearRenderTargetView(const CommandDescriptor& rtv, const float color[4]) override;
+	void clearDepthStencilView(const CommandDescriptor& dsv, uint32_t flags, float depth, uint32_t stencil) override;
+	void setRenderTargets(uint32_t numRtvs, const CommandDescriptor* pRtvs, const CommandDescriptor* pDsv) override;
+	void setStencilRef(uint32_t stencilRef) override;
+	void setViewports(uint32_t numViewports, const CommandViewport* pViewports) override;
+	void setScissorRects(uint32_t numRects, const CommandRect* pRects) override;
+	void setPrimitiveTopology(uint32_t topology) override;
+	void setVertexBuffers(uint32_t startSlot, uint32_t numViews, const CommandVertexBufferView* pViews) override;
+	void setIndexBuffer(const CommandIndexBufferView* pView) override;
+	void drawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertex, uint32_t startInstance) override;
+	void drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override;
+	void dispatch(uint32_t x, uint32_t y, uint32_t z) override;
+	void dispatchRays(const CommandDispatchRays& desc) override;
+
+private:
+	// Per resource
+	struct Tracking
+	{
+		uint32_t	state = kUnknownResourceState;
+		uint32_t	stateBeforeLast = kUnknownResourceState;	// where the last transition came from
+		uint32_t	workAtLast = 0;								// mWork at the last transition
+	};
+
+	// Counts a command into the current pass and returns its stats
+	CommandStreamStats& count(bool barrierCall = false);
+	void endPass();
+	bool checkObject(uint32_t id, CommandObjectType type, const char* pCommand);
+	void checkDescriptor(const CommandDescriptor& descriptor, bool shaderVisible, const char* pCommand);
+	void checkRootParameter(CommandBindPoint bindPoint, uint32_t parameter, const char* pCommand);
+	void checkDraw(CommandBindPoint bindPoint, const char* pCommand);
+	void addError(const std::string& error);
+	const char* getName(uint32_t id) const;
+
+	std::vector<CommandObject>	mObjects;
+	std::vector<Tracking>		mTracking;
+	std::vector<uint32_t>		mHeaps;
+	uint32_t					mPipelineState = kNoCommandObject;
+	uint32_t					mRootSignatures[2] = { kNoCommandObject, kNoCommandObject };
+	uint32_t					mWork = 0;				// draws, dispatches, copies and clears so far
+	bool						mLastWasBarrier = false;
+	uint32_t					mEventDepth = 0;
+
+	CommandStreamStats			mStats;
+	Pass						mPass;					// the current top level event
+	Pass						mOutside;				// commands outside of the top level events, the last pass
+	std::vector<Pass>			mPasses;
+	std::vector<std::string>	mErrors;
+	uint32_t					mNumErrors = 0;
+};
@@ -0,0 +1,118 @@
+#include "CpuAsManager.h"
+#include "GeometryAllocator.h"
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+// Wide nodes first, the triangle blocks after them at this alignment
+static const uint64_t kCpuAsTriangleAlignment = 64;
+
+static uint64_t getResultSize(uint32_t numNodes, uint32_t numLeaves)
+{
+	return alignUp(numNodes * sizeof(WideBvhNode), kCpuAsTriangleAlignment) + numLeaves * sizeof(WideBvhTriangles);
+}
+
+CpuAsPrebuildInfo CpuAsManager::getBottomLevelPrebuildInfo(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings)
+{
+	uint64_t numTriangles = 0;
+	for (const MeshView& geometry : geometries)
+	{
+		numTriangles += geometry.indexCount / 3;
+	}
+	if (settings.builder == BvhBuilder::Sbvh)
+	{
+		// Spatial splits reference a triangle more than once, up to the budget
+		numTriangles += (uint64_t)(numTriangles * std::max(settings.spatialSplitBudget, 0.0f));
+	}
+
+	// At worst every triangle is a leaf of its own, and there are never more wide nodes than leaves
+	CpuAsPrebuildInfo info;
+	info.maxResultSize = getResultSize((uint32_t)numTriangles, (uint32_t)numTriangles);
+	info.scratchSize = (2 * numTriangles) * sizeof(BvhNode) + numTriangles * sizeof(BvhPrimitive);
+	return info;
+}
+
+void CpuAsManager::attach(Entry& entry, const std::vector<MeshView>& geometries)
+{
+	const uint8_t* pData = entry.result.data();
+	entry.blas.attach(geometries, entry.bounds, (const WideBvhNode*)pData, entry.numNodes,
+		(const WideBvhTriangles*)(pData + alignUp(entry.numNodes * sizeof(WideBvhNode), kCpuAsTriangleAlignment)), entry.numLeaves);
+}
+
+uint32_t CpuAsManager::buildBottomLevel(const std::vector<MeshView>& geometries, const std::string& owner, const BvhBuildSettings& settings, TaskPool* pPool)
+{
+	CpuAsPrebuildInfo prebuild = getBottomLevelPrebuildInfo(geometries, settings);
+	AsScratch scratch;
+	uint32_t id = mTracker.beginBuild(owner, false, true, prebuild.maxResultSize, prebuild.scratchSize, false, scratch);
+	while (mEntries.size() <= id)
+	{
+		mEntries.push_back(Entry());
+	}
+
+	// The build writes into the result buffer like the device does, the binary tree is dropped afterwards
+	CpuBlas built;
+	built.build(geometries, settings, pPool);
+	assert(built.getBvh().nodes.size() * sizeof(BvhNode) + built.getBvh().primitives.size() * sizeof(BvhPrimitive) <= scratch.size || scratch.size == 0);
+	const WideBvh& wideBvh = built.getWideBvh();
+
+	Entry& entry = mEntries[id];
+	entry.result.assign(mTracker.getInfo(id).maxResultSize, 0);
+	entry.numNodes = wideBvh.getNumNodes();
+	entry.numLeaves = wideBvh.getNumLeaves();
+	entry.usedSize = getResultSize(entry.numNodes, entry.numLeaves);
+	entry.bounds = built.getBounds();
+	assert(entry.usedSize <= entry.result.size());
+	memcpy(entry.result.data(), wideBvh.getNodes(), entry.numNodes * sizeof(WideBvhNode));
+	memcpy(entry.result.data() + alignUp(entry.numNodes * sizeof(WideBvhNode), kCpuAsTriangleAlignment), wideBvh.getTriangles(), entry.numLeaves * sizeof(WideBvhTriangles));
+	attach(entry, geometries);
+
+	mTracker.endBuild(id);
+	mPending.push_back(id);
+	return id;
+}
+
+void CpuAsManager::finishBatch()
+{
+	for (uint32_t id : mPending)
+	{
+		if (mTracker.getInfo(id).live)
+		{
+			mTracker.setCompactedSize(id, mEntries[id].usedSize);
+		}
+	}
+	mPending.clear();
+	mTracker.finishBatch();
+}
+
+uint32_t CpuAsManager::compact()
+{
+	std::vector<uint32_t> candidates = mTracker.getCompactionCandidates();
+	for (uint32_t id : candidates)
+	{
+		Entry& entry = mEntries[id];
+		std::vector<uint8_t> compacted(mTracker.getInfo(id).compactedSize);
+		memcpy(compacted.data(), entry.result.data(), entry.usedSize);
+		entry.result.swap(compacted);
+
+		std::vector<MeshView> geometries = entry.blas.getGeometries();
+		attach(entry, geometries);
+		mTracker.setCompacted(id);
+	}
+	return (uint32_t)candidates.size();
+}
+
+void CpuAsManager::free(uint32_t id)
+{
+	mTracker.free(id);
+	mEntries[id] = Entry();
+}
+
+uint64_t CpuAsManager::getResultBytes() const
+{
+	uint64_t bytes = 0;
+	for (const Entry& entry : mEntries)
+	{
+		bytes += entry.result.size();
+	}
+	return bytes;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "AsMemoryTracker.h"
+#include "CpuRaytracing.h"
+#include <deque>
+
+struct CpuAsPrebuildInfo
+{
+	uint64_t	maxResultSize;
+	uint64_t	scratchSize;
+};
+
+/*
+	Software backend of AsMemoryTracker, so the build, compaction and scratch policy runs and can be checked without a device.
+	Like ResultDataMaxSizeInBytes, the prebuild result size is a worst case from the triangle count. The BLAS is built into
+	a result buffer of that size, the post-build size is what its wide BVH really takes, and compact() copies it into a
+	buffer of exactly that. The binary tree the wide BVH is collapsed from stands in for the scratch data: its worst case
+	is the scratch size, while the builder keeps using its own memory.
+*/
+class CpuAsManager
+{
+public:
+	static CpuAsPrebuildInfo getBottomLevelPrebuildInfo(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings = BvhBuildSettings());
+
+	// Returns the AS id, the BLAS stays at the same address until it is freed
+	uint32_t buildBottomLevel(const std::vector<MeshView>& geometries, const std::string& owner, const BvhBuildSettings& settings = BvhBuildSettings(), TaskPool* pPool = nullptr);
+
+	// The batch has run: scratch needs no barriers any more and the compacted sizes are known
+	void finishBatch();
+
+	// Copy every candidate of the tracker into a tight buffer, returns how many were compacted
+	uint32_t compact();
+
+	void free(uint32_t id);
+	std::vector<uint32_t> trimScratch(uint64_t keepBytes = 0) { return mTracker.trimScratch(keepBytes); }
+
+	const CpuBlas&			getBlas(uint32_t id) const { return mEntries[id].blas; }
+	const AsMemoryTracker&	getTracker() const { return mTracker; }
+
+	// Bytes of the live result buffers, which the tracker's resultBytes must match
+	uint64_t getResultBytes() const;
+
+private:
+	struct Entry
+	{
+		std::vector<uint8_t>	result;
+		CpuBlas					blas;
+		uint64_t				usedSize = 0;	// post-build size
+		uint32_t				numNodes = 0;
+		uint32_t				numLeaves = 0;
+		BvhBounds				bounds;
+	};
+
+	void attach(Entry& entry, const std::vector<MeshView>& geometries);
+
+	AsMemoryTracker			mTracker;
+	std::deque<Entry>		mEntries;		// indexed by AS id, a deque so the BLASes never move
+	std::vector<uint32_t>	mPending;		// built in this batch, their post-build sizes are reported by finishBatch
+};
@@ -0,0 +1,1421 @@
+#include "CpuFrame.h"
+#include "Externals/GLM/glm/gtc/constants.hpp"
+#include "Externals/GLM/glm/gtc/packing.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CPU_FRAME_SSE
+#include <emmintrin.h>
+#endif
+
+// Square tiles of the rasterizer and of the rays, each is one task on the pool
+static const uint32_t kRasterTileSize = 32;
+static const uint32_t kRayTileSize = 8;
+
+// Triangles per setup task
+static const uint32_t kSetupGrainSize = 4096;
+
+// Vertices are clipped to this many viewports around the viewport only, so the fixed point edge functions fit in 64 bits
+static const float kGuardBand = 8.0f;
+
+// 16.8 fixed point, the subpixel precision of D3D12 rasterization
+static const int kSubpixelBits = 8;
+static const int kSubpixelScale = 1 << kSubpixelBits;
+
+// Ray tiles per task of rayTrace, which share the buffers of the batched indirect light
+static const uint32_t kRayTilesPerTask = 4;
+
+static const int kDirectLightSamples = 50;
+static const float kRsmRadius = 150.0f;
+
+// RSM samples of sampleIndirectLight, it gives up if none of the first kEarlyExitSamples is a candidate VPL
+static const int kIndirectLightSamples = 200;
+static const int kReprojectedIndirectLightSamples = 20;
+static const int kEarlyExitSamples = 101;
+
+///////////////////////////////////////////
+// Shader helpers
+///////////////////////////////////////////
+// hlslUtils.hlsli
+static uint32_t initRand(uint32_t val0, uint32_t val1, uint32_t backoff = 16)
+{
+	uint32_t v0 = val0, v1 = val1, s0 = 0;
+	for (uint32_t n = 0; n < backoff; n++)
+	{
+		s0 += 0x9e3779b9;
+		v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+		v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+	}
+	return v0;
+}
+
+static float nextRand(uint32_t& s)
+{
+	s = (1664525u * s + 1013904223u);
+	return float(s & 0x00FFFFFF) / float(0x01000000);
+}
+
+// Common.hlsli
+static float makeDepthLinear(float depth)
+{
+	const float f = 100.0f;
+	const float n = 0.1f;
+	float z = f * n / (f - depth * (f - n));
+	return z * depth / f;
+}
+
+static float asfloat(uint32_t value)
+{
+	float f;
+	memcpy(&f, &value, sizeof(f));
+	return f;
+}
+
+static uint32_t asuint(float value)
+{
+	uint32_t u;
+	memcpy(&u, &value, sizeof(u));
+	return u;
+}
+
+static uint32_t dirToOct(const vec3& normal)
+{
+	vec2 p = vec2(normal) * (1.0f / dot(abs(normal), vec3(1.0f)));
+	vec2 e = normal.z > 0.0f ? p : (1.0f - abs(vec2(p.y, p.x))) * (step(vec2(0.0f), p) * 2.0f - 1.0f);
+	return ((uint32_t)packHalf1x16(e.y) << 16) + (uint32_t)packHalf1x16(e.x);
+}
+
+static vec3 octToDir(uint32_t octo)
+{
+	vec2 e(unpackHalf1x16((uint16_t)(octo & 0xffff)), unpackHalf1x16((uint16_t)((octo >> 16) & 0xffff)));
+	vec3 v(e, 1.0f - fabsf(e.x) - fabsf(e.y));
+	if (v.z < 0.0f)
+	{
+		vec2 xy = (1.0f - abs(vec2(v.y, v.x))) * (step(vec2(0.0f), vec2(v)) * 2.0f - 1.0f);
+		v.x = xy.x;
+		v.y = xy.y;
+	}
+	return normalize(v);
+}
+
+// ToneMapping.hlsli
+static vec3 filmicToneMapping(vec3 color)
+{
+	const float A = 0.15f;
+	const float B = 0.5f;
+	const float C = 0.1f;
+	const float D = 0.2f;
+	const float E = 0.02f;
+	const float F = 0.3f;
+	vec3 linearWhite(11.2f);
+	color *= 4.0f;
+	color = ((color * (A * color + C * B) + D * E) / (color * (A * color + B) + D * F)) - (E / F);
+	linearWhite = ((linearWhite * (A * linearWhite + C * B) + D * E) / (linearWhite * (A * linearWhite + B) + D * F)) - (E / F);
+	return color / linearWhite;
+}
+
+static vec3 linearToSrgb(const vec3& c)
+{
+	vec3 sq1 = sqrt(c);
+	vec3 sq2 = sqrt(sq1);
+	vec3 sq3 = sqrt(sq2);
+	return 0.662002687f * sq1 + 0.684122060f * sq2 - 0.323583601f * sq3 - 0.0225411470f * c;
+}
+
+static vec3 transformNormal(const mat4& transform, const vec3& normal)
+{
+	return normalize(vec3(transform * vec4(normal, 0.0f)));
+}
+
+///////////////////////////////////////////
+// Rasterizer
+///////////////////////////////////////////
+/*
+	A triangle after clipping and snapping, counter clockwise in pixels with y down so all edge functions are positive
+	inside. Edge k is the one opposite vertex k, E = a x + b y + c at a 16.8 sample position, with c one lower for
+	edges that aren't top or left edges so a sample on them is outside.
+*/
+struct RasterTriangle
+{
+	int64_t		a[3];
+	int64_t		b[3];
+	int64_t		c[3];
+	float		invArea;
+	float		z[3];			// z / w
+	float		invW[3];
+	vec3		weights[3];		// of the vertex on the three vertices of the mesh triangle
+	uint32_t	mesh;
+	uint32_t	triangle;
+	int32_t		minX, minY, maxX, maxY;	// pixels whose center may be covered
+};
+
+struct ClipVertex
+{
+	vec4	position;
+	vec3	weights;
+};
+
+static const vec4 kClipPlanes[] =
+{
+	vec4(0.0f, 0.0f, 1.0f, 0.0f),
+	vec4(0.0f, 0.0f, -1.0f, 1.0f),
+	vec4(1.0f, 0.0f, 0.0f, kGuardBand),
+	vec4(-1.0f, 0.0f, 0.0f, kGuardBand),
+	vec4(0.0f, 1.0f, 0.0f, kGuardBand),
+	vec4(0.0f, -1.0f, 0.0f, kGuardBand),
+};
+static const uint32_t kNumClipPlanes = sizeof(kClipPlanes) / sizeof(kClipPlanes[0]);
+
+// Bit p set where the vertex is outside plane p, with a guard band of guardBand viewports
+static uint32_t getOutcode(const vec4& position, float guardBand)
+{
+	uint32_t outcode = 0;
+	outcode |= position.z < 0.0f ? 0x01 : 0;
+	outcode |= position.z > position.w ? 0x02 : 0;
+	outcode |= position.x < -guardBand * position.w ? 0x04 : 0;
+	outcode |= position.x > guardBand * position.w ? 0x08 : 0;
+	outcode |= position.y < -guardBand * position.w ? 0x10 : 0;
+	outcode |= position.y > guardBand * position.w ? 0x20 : 0;
+	return outcode;
+}
+
+// Sutherland-Hodgman against the planes in outcode, pPolygon has room for 3 + kNumClipPlanes vertices. Returns the vertex count.
+static uint32_t clipPolygon(ClipVertex* pPolygon, uint32_t outcode)
+{
+	ClipVertex buffer[3 + kNumClipPlanes];
+	ClipVertex* pIn = pPolygon;
+	ClipVertex* pOut = buffer;
+	uint32_t count = 3;
+	for (uint32_t p = 0; p < kNumClipPlanes && count >= 3; p++)
+	{
+		if (!(outcode & (1 << p)))
+		{
+			continue;
+		}
+		uint32_t outCount = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const ClipVertex& v0 = pIn[i];
+			const ClipVertex& v1 = pIn[(i + 1) % count];
+			float d0 = dot(kClipPlanes[p], v0.position);
+			float d1 = dot(kClipPlanes[p], v1.position);
+			if (d0 >= 0.0f)
+			{
+				pOut[outCount++] = v0;
+			}
+			if ((d0 >= 0.0f) != (d1 >= 0.0f))
+			{
+				float t = d0 / (d0 - d1);
+				pOut[outCount].position = mix(v0.position, v1.position, t);
+				pOut[outCount].weights = mix(v0.weights, v1.weights, t);
+				outCount++;
+			}
+		}
+		count = outCount;
+		std::swap(pIn, pOut);
+	}
+	if (pIn != pPolygon)
+	{
+		std::copy(pIn, pIn + count, pPolygon);
+	}
+	return count >= 3 ? count : 0;
+}
+
+// Viewport transform and snapping of a clipped triangle, false if no pixel center lies in its bounds
+static bool setupTriangle(const ClipVertex* pVertices[3], uint32_t width, uint32_t height, RasterTriangle& triangle);
+
+template<typename Shader>
+void CpuFrame::rasterize(const mat4& viewProjection, CpuImage<float>& depth, const Shader& shader)
+{
+	struct SetupJob
+	{
+		uint32_t	mesh;
+		uint32_t	firstTriangle;
+		uint32_t	numTriangles;
+	};
+	std::vector<SetupJob> jobs;
+	for (uint32_t m = 0; m < (uint32_t)mMeshes.size(); m++)
+	{
+		uint32_t numTriangles = mMeshes[m].mesh.indexCount / 3;
+		for (uint32_t first = 0; first < numTriangles; first += kSetupGrainSize)
+		{
+			jobs.push_back({ m, first, std::min(kSetupGrainSize, numTriangles - first) });
+		}
+	}
+
+	// Vertex stage, clipping and setup. Every job keeps its triangles in order, which keeps the submission order.
+	uint32_t width = depth.width;
+	uint32_t height = depth.height;
+	std::vector<std::vector<RasterTriangle>> jobTriangles(jobs.size());
+	TaskPool& pool = getPool();
+	pool.parallelFor((uint32_t)jobs.size(), [&](uint32_t j)
+	{
+		const SetupJob& job = jobs[j];
+		const MeshView& mesh = mMeshes[job.mesh].mesh;
+		mat4 transform = viewProjection * mMeshes[job.mesh].modelToWorld;
+		std::vector<RasterTriangle>& triangles = jobTriangles[j];
+		for (uint32_t t = job.firstTriangle; t < job.firstTriangle + job.numTriangles; t++)
+		{
+			ClipVertex polygon[3 + kNumClipPlanes];
+			uint32_t viewportOutcode = ~0u;
+			uint32_t guardBandOutcode = 0;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				polygon[k].position = transform * vec4(mesh.positions[mesh.indices[3 * t + k]], 1.0f);
+				polygon[k].weights = vec3(0.0f);
+				polygon[k].weights[k] = 1.0f;
+				viewportOutcode &= getOutcode(polygon[k].position, 1.0f);
+				guardBandOutcode |= getOutcode(polygon[k].position, kGuardBand);
+			}
+			// All three outside the same plane of the viewport
+			if (viewportOutcode)
+			{
+				continue;
+			}
+			uint32_t count = guardBandOutcode ? clipPolygon(polygon, guardBandOutcode) : 3;
+			for (uint32_t k = 1; k + 1 < count; k++)
+			{
+				const ClipVertex* pVertices[3] = { &polygon[0], &polygon[k], &polygon[k + 1] };
+				RasterTriangle triangle;
+				if (setupTriangle(pVertices, width, height, triangle))
+				{
+					triangle.mesh = job.mesh;
+					triangle.triangle = t;
+					triangles.push_back(triangle);
+				}
+			}
+		}
+	});
+	std::vector<RasterTriangle> triangles;
+	for (std::vector<RasterTriangle>& job : jobTriangles)
+	{
+		triangles.insert(triangles.end(), job.begin(), job.end());
+		std::vector<RasterTriangle>().swap(job);
+	}
+
+	// Binning, a row of tiles per task, the bins list the triangles in order
+	uint32_t numTilesX = (width + kRasterTileSize - 1) / kRasterTileSize;
+	uint32_t numTilesY = (height + kRasterTileSize - 1) / kRasterTileSize;
+	std::vector<std::vector<uint32_t>> bins(numTilesX * numTilesY);
+	pool.parallelFor(numTilesY, [&](uint32_t tileY)
+	{
+		int32_t rowMin = (int32_t)(tileY * kRasterTileSize);
+		int32_t rowMax = rowMin + (int32_t)kRasterTileSize - 1;
+		for (uint32_t t = 0; t < (uint32_t)triangles.size(); t++)
+		{
+			const RasterTriangle& triangle = triangles[t];
+			if (triangle.maxY < rowMin || triangle.minY > rowMax)
+			{
+				continue;
+			}
+			for (uint32_t tileX = (uint32_t)triangle.minX / kRasterTileSize; tileX <= (uint32_t)triangle.maxX / kRasterTileSize; tileX++)
+			{
+				bins[tileY * numTilesX + tileX].push_back(t);
+			}
+		}
+	});
+
+	// Pixels, LESS depth test, then the shader
+	pool.parallelFor(numTilesX * numTilesY, [&](uint32_t tile)
+	{
+		int32_t tileMinX = (int32_t)((tile % numTilesX) * kRasterTileSize);
+		int32_t tileMinY = (int32_t)((tile / numTilesX) * kRasterTileSize);
+		int32_t tileMaxX = std::min(tileMinX + (int32_t)kRasterTileSize, (int32_t)width) - 1;
+		int32_t tileMaxY = std::min(tileMinY + (int32_t)kRasterTileSize, (int32_t)height) - 1;
+		for (uint32_t t : bins[tile])
+		{
+			const RasterTriangle& triangle = triangles[t];
+			int32_t minX = std::max(triangle.minX, tileMinX);
+			int32_t maxX = std::min(triangle.maxX, tileMaxX);
+			int32_t minY = std::max(triangle.minY, tileMinY);
+			int32_t maxY = std::min(triangle.maxY, tileMaxY);
+			for (int32_t y = minY; y <= maxY; y++)
+			{
+				int64_t sampleY = (int64_t)y * kSubpixelScale + kSubpixelScale / 2;
+				for (int32_t x = minX; x <= maxX; x++)
+				{
+					int64_t sampleX = (int64_t)x * kSubpixelScale + kSubpixelScale / 2;
+					int64_t e[3];
+					for (int k = 0; k < 3; k++)
+					{
+						e[k] = triangle.a[k] * sampleX + triangle.b[k] * sampleY + triangle.c[k];
+					}
+					if ((e[0] | e[1] | e[2]) < 0)
+					{
+						continue;
+					}
+					vec3 l(e[0] * triangle.invArea, e[1] * triangle.invArea, e[2] * triangle.invArea);
+					float z = clamp(l.x * triangle.z[0] + l.y * triangle.z[1] + l.z * triangle.z[2], 0.0f, 1.0f);
+					float& depthValue = depth.at((uint32_t)x, (uint32_t)y);
+					if (!(z < depthValue))
+					{
+						continue;
+					}
+					depthValue = z;
+
+					// Perspective correct weights of the mesh triangle's vertices
+					vec3 p(l.x * triangle.invW[0], l.y * triangle.invW[1], l.z * triangle.invW[2]);
+					p /= p.x + p.y + p.z;
+					vec3 weights = p.x * triangle.weights[0] + p.y * triangle.weights[1] + p.z * triangle.weights[2];
+					shader((uint32_t)x, (uint32_t)y, triangle.mesh, triangle.triangle, weights);
+				}
+			}
+		}
+	});
+}
+
+static bool setupTriangle(const ClipVertex* pVertices[3], uint32_t width, uint32_t height, RasterTriangle& triangle)
+{
+	int64_t x[3], y[3];
+	for (int k = 0; k < 3; k++)
+	{
+		const vec4& position = pVertices[k]->position;
+		float invW = 1.0f / position.w;
+		vec3 ndc = vec3(position) * invW;
+		float screenX = (ndc.x * 0.5f + 0.5f) * width;
+		float screenY = (0.5f - ndc.y * 0.5f) * height;
+		x[k] = (int64_t)floorf(screenX * kSubpixelScale + 0.5f);
+		y[k] = (int64_t)floorf(screenY * kSubpixelScale + 0.5f);
+		triangle.z[k] = ndc.z;
+		triangle.invW[k] = invW;
+		triangle.weights[k] = pVertices[k]->weights;
+	}
+
+	int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (area == 0)
+	{
+		return false;
+	}
+	// No culling, clockwise triangles are flipped
+	if (area < 0)
+	{
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		std::swap(triangle.z[1], triangle.z[2]);
+		std::swap(triangle.invW[1], triangle.invW[2]);
+		std::swap(triangle.weights[1], triangle.weights[2]);
+		area = -area;
+	}
+	triangle.invArea = 1.0f / (float)area;
+
+	for (int k = 0; k < 3; k++)
+	{
+		int from = (k + 1) % 3;
+		int to = (k + 2) % 3;
+		int64_t dx = x[to] - x[from];
+		int64_t dy = y[to] - y[from];
+		triangle.a[k] = -dy;
+		triangle.b[k] = dx;
+		triangle.c[k] = dy * x[from] - dx * y[from];
+		// Top-left rule: the inside is below a top edge and right of a left edge
+		bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+		if (!topLeft)
+		{
+			triangle.c[k] -= 1;
+		}
+	}
+
+	// Pixels whose center lies in the bounds
+	int64_t minX = std::min(std::min(x[0], x[1]), x[2]);
+	int64_t maxX = std::max(std::max(x[0], x[1]), x[2]);
+	int64_t minY = std::min(std::min(y[0], y[1]), y[2]);
+	int64_t maxY = std::max(std::max(y[0], y[1]), y[2]);
+	triangle.minX = std::max((int32_t)ceil((double)(minX - kSubpixelScale / 2) / kSubpixelScale), 0);
+	triangle.maxX = std::min((int32_t)floor((double)(maxX - kSubpixelScale / 2) / kSubpixelScale), (int32_t)width - 1);
+	triangle.minY = std::max((int32_t)ceil((double)(minY - kSubpixelScale / 2) / kSubpixelScale), 0);
+	triangle.maxY = std::min((int32_t)floor((double)(maxY - kSubpixelScale / 2) / kSubpixelScale), (int32_t)height - 1);
+	return triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY;
+}
+
+///////////////////////////////////////////
+// Batched indirect light
+///////////////////////////////////////////
+/*
+	sampleIndirectLight in three steps over a batch of hit points. The samples of a hit point are drawn as in the scalar
+	loop and the RSM texels that pass the bounds and empty texel tests are gathered as structure of arrays, where the
+	cosine terms of four candidate VPLs at a time are computed with SSE. Those that pass become the visibility rays of
+	the batch, which go to CpuTlas::traceOcclusionRays in one call, then the unblocked ones are added up in the order
+	of the scalar loop. The early exit needs the cosine terms of the first kEarlyExitSamples, so they are evaluated
+	first and the rest only if one of them passed.
+*/
+struct CpuIndirectLightBatch
+{
+	// Candidates of the current hit point, padded to a whole group of four
+	static const int kMaxCandidates = kIndirectLightSamples + 4;
+	alignas(16) float		positionX[kMaxCandidates];
+	alignas(16) float		positionY[kMaxCandidates];
+	alignas(16) float		positionZ[kMaxCandidates];
+	alignas(16) uint32_t	octo[kMaxCandidates];		// RSM normal, asuint of the position's w
+	alignas(16) float		directionX[kMaxCandidates];
+	alignas(16) float		directionY[kMaxCandidates];
+	alignas(16) float		directionZ[kMaxCandidates];
+	alignas(16) float		distance[kMaxCandidates];
+	alignas(16) float		weight[kMaxCandidates];		// angleHitPoint * angleLightPoint
+	alignas(16) uint32_t	passed[kMaxCandidates];		// all bits set if both cosine terms pass
+	uint32_t				texel[kMaxCandidates];
+	float					xi1[kMaxCandidates];
+
+	// Visibility rays of the batch and what their VPL adds
+	struct Vpl
+	{
+		uint32_t	texel;
+		float		xi1;
+		float		weight;
+		float		distance;
+	};
+	std::vector<CpuRay>		rays;
+	std::vector<Vpl>		vpls;
+	std::vector<uint32_t>	visible;
+	std::vector<uint32_t>	firstRay;				// per hit point, and the end
+	std::vector<uint32_t>	numSamples;				// per hit point
+};
+
+// Direction, distance and cosine terms of candidate c, in the order of the scalar loop
+static void evaluateVpl(CpuIndirectLightBatch& batch, int c, const vec3& hitPoint, const vec3& hitPointNormal)
+{
+	vec3 direction = vec3(batch.positionX[c], batch.positionY[c], batch.positionZ[c]) - hitPoint;
+	float distance = length(direction);
+	direction = normalize(direction);
+	float angleHitPoint = clamp(dot(direction, hitPointNormal), 0.0f, 1.0f);
+	float angleLightPoint = clamp(dot(-direction, octToDir(batch.octo[c])), 0.0f, 1.0f);
+	batch.directionX[c] = direction.x;
+	batch.directionY[c] = direction.y;
+	batch.directionZ[c] = direction.z;
+	batch.distance[c] = distance;
+	batch.weight[c] = angleHitPoint * angleLightPoint;
+	batch.passed[c] = angleHitPoint < 0.0001f || angleLightPoint < 0.0001f ? 0 : 0xffffffff;
+}
+
+#ifdef CPU_FRAME_SSE
+// unpackHalf1x16 of the low 16 bits: moved into the float's exponent and mantissa, zero and denormals by subtracting the implicit one
+static __m128 unpackHalf4(__m128i bits)
+{
+	const __m128i kExponent = _mm_set1_epi32(0x7c00 << 13);
+	__m128i shifted = _mm_slli_epi32(_mm_and_si128(bits, _mm_set1_epi32(0x7fff)), 13);
+	__m128i exponent = _mm_and_si128(shifted, kExponent);
+	shifted = _mm_add_epi32(shifted, _mm_set1_epi32((127 - 15) << 23));
+	shifted = _mm_add_epi32(shifted, _mm_and_si128(_mm_cmpeq_epi32(exponent, kExponent), _mm_set1_epi32((128 - 16) << 23)));
+	__m128i denormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+	shifted = _mm_add_epi32(shifted, _mm_and_si128(denormal, _mm_set1_epi32(1 << 23)));
+	__m128 value = _mm_sub_ps(_mm_castsi128_ps(shifted), _mm_and_ps(_mm_castsi128_ps(denormal), _mm_castsi128_ps(_mm_set1_epi32(113 << 23))));
+	__m128i sign = _mm_slli_epi32(_mm_and_si128(bits, _mm_set1_epi32(0x8000)), 16);
+	return _mm_or_ps(value, _mm_castsi128_ps(sign));
+}
+
+static __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+// evaluateVpl of candidates [0, count), four at a time with SSE, the same operations in the same order
+static void evaluateVpls(CpuIndirectLightBatch& batch, int count, const vec3& hitPoint, const vec3& hitPointNormal)
+{
+	int c = 0;
+
+#ifdef CPU_FRAME_SSE
+	const __m128 hx = _mm_set1_ps(hitPoint.x);
+	const __m128 hy = _mm_set1_ps(hitPoint.y);
+	const __m128 hz = _mm_set1_ps(hitPoint.z);
+	const __m128 nx = _mm_set1_ps(hitPointNormal.x);
+	const __m128 ny = _mm_set1_ps(hitPointNormal.y);
+	const __m128 nz = _mm_set1_ps(hitPointNormal.z);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minAngle = _mm_set1_ps(0.0001f);
+	const __m128 signBit = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	for (; c + 4 <= count; c += 4)
+	{
+		// normalize(position - hitPoint) and its length
+		__m128 dx = _mm_sub_ps(_mm_load_ps(&batch.positionX[c]), hx);
+		__m128 dy = _mm_sub_ps(_mm_load_ps(&batch.positionY[c]), hy);
+		__m128 dz = _mm_sub_ps(_mm_load_ps(&batch.positionZ[c]), hz);
+		__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 distance = _mm_sqrt_ps(lengthSquared);
+		__m128 invLength = _mm_div_ps(one, distance);
+		dx = _mm_mul_ps(dx, invLength);
+		dy = _mm_mul_ps(dy, invLength);
+		dz = _mm_mul_ps(dz, invLength);
+		__m128 angleHitPoint = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, nx), _mm_mul_ps(dy, ny)), _mm_mul_ps(dz, nz));
+		angleHitPoint = _mm_min_ps(_mm_max_ps(angleHitPoint, zero), one);
+
+		// octToDir: the folded lower hemisphere takes (1 - |y|, 1 - |x|) with the signs of x and y, +0 and -0 both positive
+		__m128i octo = _mm_load_si128((const __m128i*)&batch.octo[c]);
+		__m128 ex = unpackHalf4(_mm_and_si128(octo, _mm_set1_epi32(0xffff)));
+		__m128 ey = unpackHalf4(_mm_srli_epi32(octo, 16));
+		__m128 absX = _mm_andnot_ps(signBit, ex);
+		__m128 absY = _mm_andnot_ps(signBit, ey);
+		__m128 lz = _mm_sub_ps(_mm_sub_ps(one, absX), absY);
+		__m128 folded = _mm_cmplt_ps(lz, zero);
+		__m128 foldedX = _mm_xor_ps(_mm_sub_ps(one, absY), _mm_and_ps(_mm_cmplt_ps(ex, zero), signBit));
+		__m128 foldedY = _mm_xor_ps(_mm_sub_ps(one, absX), _mm_and_ps(_mm_cmplt_ps(ey, zero), signBit));
+		__m128 lx = select4(folded, foldedX, ex);
+		__m128 ly = select4(folded, foldedY, ey);
+		__m128 invNormalLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz))));
+		lx = _mm_mul_ps(lx, invNormalLength);
+		ly = _mm_mul_ps(ly, invNormalLength);
+		lz = _mm_mul_ps(lz, invNormalLength);
+
+		// dot(-direction, lightNormal)
+		__m128 angleLightPoint = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_xor_ps(dx, signBit), lx), _mm_mul_ps(_mm_xor_ps(dy, signBit), ly)),
+			_mm_mul_ps(_mm_xor_ps(dz, signBit), lz));
+		angleLightPoint = _mm_min_ps(_mm_max_ps(angleLightPoint, zero), one);
+
+		_mm_store_ps(&batch.directionX[c], dx);
+		_mm_store_ps(&batch.directionY[c], dy);
+		_mm_store_ps(&batch.directionZ[c], dz);
+		_mm_store_ps(&batch.distance[c], distance);
+		_mm_store_ps(&batch.weight[c], _mm_mul_ps(angleHitPoint, angleLightPoint));
+		_mm_store_ps((float*)&batch.passed[c], _mm_and_ps(_mm_cmpnlt_ps(angleHitPoint, minAngle), _mm_cmpnlt_ps(angleLightPoint, minAngle)));
+	}
+#endif
+
+	// Remainder, or everything without SSE
+	for (; c < count; c++)
+	{
+		evaluateVpl(batch, c, hitPoint, hitPointNormal);
+	}
+}
+
+/*
+	Draws the samples of one hit point, evaluates the candidates and appends the visibility rays of those that pass to
+	the batch. Returns the number of samples the scalar loop takes.
+*/
+uint32_t CpuFrame::gatherVpls(const CpuIndirectLightQuery& query, CpuIndirectLightBatch& batch) const
+{
+	uint32_t shadowWidth = mRsmPosition.width;
+	uint32_t shadowHeight = mRsmPosition.height;
+	uint32_t crdX, crdY;
+	getRsmTexel(query.hitPoint, crdX, crdY);
+
+	uint32_t seed = query.seed;
+	int maxNumTot = query.acceptedReprojection ? kReprojectedIndirectLightSamples : kIndirectLightSamples;
+	int numRaySamples = 0;
+	int begin = 0;
+	while (begin < maxNumTot)
+	{
+		int end = begin == 0 ? std::min(maxNumTot, kEarlyExitSamples) : maxNumTot;
+		int count = 0;
+		for (int sample = begin; sample < end; sample++)
+		{
+			float xi1 = nextRand(seed);
+			float xi2 = nextRand(seed);
+			int i = (int)floorf(kRsmRadius * xi1 * sinf(2.0f * pi<float>() * xi2));
+			int j = (int)floorf(kRsmRadius * xi1 * cosf(2.0f * pi<float>() * xi2));
+			uint32_t texelX = crdX + (uint32_t)i;
+			uint32_t texelY = crdY + (uint32_t)j;
+			if (texelX >= shadowWidth || texelY >= shadowHeight)
+			{
+				continue;
+			}
+			uint32_t texel = texelY * shadowWidth + texelX;
+			const vec4& lightPosData = mRsmPosition.texels[texel];
+			if (lightPosData.w == 2.0f)
+			{
+				continue;
+			}
+			batch.positionX[count] = lightPosData.x;
+			batch.positionY[count] = lightPosData.y;
+			batch.positionZ[count] = lightPosData.z;
+			batch.octo[count] = asuint(lightPosData.w);
+			batch.texel[count] = texel;
+			batch.xi1[count] = xi1;
+			count++;
+		}
+
+		evaluateVpls(batch, count, query.hitPoint, query.normal);
+		for (int c = 0; c < count; c++)
+		{
+			if (!batch.passed[c])
+			{
+				continue;
+			}
+			CpuRay ray;
+			ray.origin = query.hitPoint;
+			ray.direction = vec3(batch.directionX[c], batch.directionY[c], batch.directionZ[c]);
+			ray.tMin = 0.001f;
+			ray.tMax = batch.distance[c] - 0.0001f;
+			batch.rays.push_back(ray);
+			CpuIndirectLightBatch::Vpl vpl;
+			vpl.texel = batch.texel[c];
+			vpl.xi1 = batch.xi1[c];
+			vpl.weight = batch.weight[c];
+			vpl.distance = batch.distance[c];
+			batch.vpls.push_back(vpl);
+			numRaySamples++;
+		}
+
+		if (numRaySamples == 0 && end < maxNumTot)
+		{
+			return (uint32_t)end;
+		}
+		begin = end;
+	}
+	return (uint32_t)maxNumTot;
+}
+
+uint64_t CpuFrame::sampleIndirectLight(const CpuIndirectLightQuery* pQueries, uint32_t count, vec3* pColors, CpuIndirectLightBatch& batch) const
+{
+	batch.rays.clear();
+	batch.vpls.clear();
+	batch.firstRay.resize(count + 1);
+	batch.numSamples.resize(count);
+	uint64_t numSamples = 0;
+	for (uint32_t q = 0; q < count; q++)
+	{
+		batch.firstRay[q] = (uint32_t)batch.rays.size();
+		batch.numSamples[q] = gatherVpls(pQueries[q], batch);
+		numSamples += batch.numSamples[q];
+	}
+	batch.firstRay[count] = (uint32_t)batch.rays.size();
+
+	uint32_t numRays = (uint32_t)batch.rays.size();
+	batch.visible.resize((numRays + 31) / 32);
+	mTlas.traceOcclusionRays(batch.rays.data(), numRays, kRayFlagAcceptFirstHitAndEndSearch, 0xFF, batch.visible.data(), mpPool);
+
+	for (uint32_t q = 0; q < count; q++)
+	{
+		vec3 indirectColor(0.0f);
+		for (uint32_t r = batch.firstRay[q]; r < batch.firstRay[q + 1]; r++)
+		{
+			if (batch.visible[r / 32] & (1u << (r % 32)))
+			{
+				const CpuIndirectLightBatch::Vpl& vpl = batch.vpls[r];
+				indirectColor += vpl.weight * vec3(mRsmFlux.texels[vpl.texel]) * vpl.xi1 * 150.0f / std::max(vpl.distance * vpl.distance, 0.01f);
+			}
+		}
+		if (batch.firstRay[q + 1] > batch.firstRay[q])
+		{
+			indirectColor /= (float)batch.numSamples[q];
+		}
+		pColors[q] = indirectColor;
+	}
+	return numSamples;
+}
+
+uint64_t CpuFrame::gatherIndirectLight(const CpuIndirectLightQuery* pQueries, uint32_t count, vec3* pColors, bool batched) const
+{
+	const uint32_t kGrainSize = kRayTileSize * kRayTileSize;
+	std::atomic<uint64_t> numSamples(0);
+	getPool().parallelForRange(count, kGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		uint64_t rangeSamples = 0;
+		if (batched)
+		{
+			CpuIndirectLightBatch batch;
+			rangeSamples = sampleIndirectLight(pQueries + begin, end - begin, pColors + begin, batch);
+		}
+		else
+		{
+			CpuTlas::OccluderCache cache;
+			for (uint32_t q = begin; q < end; q++)
+			{
+				uint32_t seed = pQueries[q].seed;
+				uint32_t querySamples = 0;
+				pColors[q] = sampleIndirectLight(pQueries[q].hitPoint, pQueries[q].normal, seed, pQueries[q].acceptedReprojection, cache, &querySamples);
+				rangeSamples += querySamples;
+			}
+		}
+		numSamples += rangeSamples;
+	});
+	return numSamples;
+}
+
+///////////////////////////////////////////
+// Frame
+///////////////////////////////////////////
+void CpuFrame::setScene(const std::vector<CpuFrameMesh>& meshes, TaskPool* pPool)
+{
+	mpPool = pPool;
+	mMeshes = meshes;
+	mModelToWorldPrev.resize(meshes.size());
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		mModelToWorldPrev[m] = meshes[m].modelToWorld;
+	}
+	mBlases.clear();
+	mBlases.resize(meshes.size());
+	getPool().parallelFor((uint32_t)meshes.size(), [&](uint32_t m)
+	{
+		mBlases[m].build(std::vector<MeshView>(1, mMeshes[m].mesh), BvhBuildSettings(), mpPool);
+	});
+	mHasHistory = false;
+}
+
+void CpuFrame::render(const CpuFrameDesc& desc)
+{
+	beginFrame(desc);
+	renderGeometryBuffer();
+	renderShadowMap();
+	rayTrace();
+	applyTemporalFilter();
+	applySpatialFilter();
+	applyToneMapping();
+	endFrame();
+}
+
+void CpuFrame::beginFrame(const CpuFrameDesc& desc)
+{
+	bool resized = desc.width != mDesc.width || desc.height != mDesc.height || mDepth.texels.empty();
+	mDesc = desc;
+	if (resized || !mHasHistory)
+	{
+		mDepthPrev.resize(desc.width, desc.height, 1.0f);
+		mNormalPrev.resize(desc.width, desc.height, vec4(0.0f));
+		mColorHistory.resize(desc.width, desc.height, vec4(0.0f));
+		mViewPrev = desc.view;
+		mHasHistory = true;
+	}
+	mViewInv = inverse(desc.view);
+	mProjectionInv = inverse(desc.projection);
+
+	// Instance i is mesh i, as the BLAS index in accelerationStructure
+	std::vector<TlasInstanceDesc> instanceDescs(mMeshes.size());
+	for (uint32_t m = 0; m < (uint32_t)mMeshes.size(); m++)
+	{
+		TlasInstanceDesc& instanceDesc = instanceDescs[m];
+		for (int row = 0; row < 3; row++)
+		{
+			for (int column = 0; column < 4; column++)
+			{
+				instanceDesc.transform[row][column] = mMeshes[m].modelToWorld[column][row];
+			}
+		}
+		instanceDesc.instanceID = m;
+		instanceDesc.instanceMask = 0xFF;
+		instanceDesc.hitGroupIndex = 0;
+		instanceDesc.flags = 0;
+		instanceDesc.accelerationStructure = m;
+	}
+	mTlas.build(instanceDescs.data(), (uint32_t)instanceDescs.size(), mBlases.data(), (uint32_t)mBlases.size(), mpPool);
+}
+
+void CpuFrame::endFrame()
+{
+	mViewPrev = mDesc.view;
+	for (size_t m = 0; m < mMeshes.size(); m++)
+	{
+		mModelToWorldPrev[m] = mMeshes[m].modelToWorld;
+	}
+}
+
+void CpuFrame::renderGeometryBuffer()
+{
+	uint32_t width = mDesc.width;
+	uint32_t height = mDesc.height;
+	mDepth.resize(width, height, 1.0f);
+	mNormal.resize(width, height, vec4(0.0f));
+	mColor.resize(width, height, vec4(0.0f));
+	mPosition.resize(width, height, vec4(0.0f));
+	mMotionVectors.resize(width, height, vec4(0.0f));
+
+	std::vector<mat4> toPrevClip(mMeshes.size());
+	for (size_t m = 0; m < mMeshes.size(); m++)
+	{
+		toPrevClip[m] = mDesc.projection * mViewPrev * mModelToWorldPrev[m];
+	}
+	mat4 viewProjection = mDesc.projection * mDesc.view;
+
+	/*
+		GBuffer.hlsl, and the motion vectors of MotionVectors.hlsl, which draws the same triangles with the same depth
+		test. Clip positions are linear in the vertex position, so they are transformed after interpolating it.
+		zw of the motion vectors hold the screen coordinates of the pixel until the reprojection test below.
+	*/
+	rasterize(viewProjection, mDepth, [&](uint32_t x, uint32_t y, uint32_t m, uint32_t t, const vec3& weights)
+	{
+		const CpuFrameMesh& mesh = mMeshes[m];
+		const uint32_t* pIndices = mesh.mesh.indices + 3 * t;
+		vec3 position(0.0f);
+		vec3 normal(0.0f);
+		for (int k = 0; k < 3; k++)
+		{
+			position += weights[k] * mesh.mesh.positions[pIndices[k]];
+			normal += weights[k] * (transformNormal(mesh.modelToWorld, mesh.mesh.normals[pIndices[k]]) * 0.5f + 0.5f);
+		}
+		vec4 worldPosition = mesh.modelToWorld * vec4(position, 1.0f);
+		mNormal.at(x, y) = vec4(normal, (float)mesh.meshID);
+		mColor.at(x, y) = vec4(mesh.color, 1.0f);
+		mPosition.at(x, y) = worldPosition;
+
+		vec4 positionCurr = viewProjection * worldPosition;
+		vec4 positionPrev = toPrevClip[m] * vec4(position, 1.0f);
+		vec2 ndcCurr = vec2(positionCurr) / positionCurr.w;
+		vec2 ndcPrev = vec2(positionPrev) / positionPrev.w;
+		vec2 crd = ndcCurr * 0.5f + 0.5f;
+		crd.y = 1.0f - crd.y;
+		mMotionVectors.at(x, y) = vec4(0.5f * (ndcCurr - ndcPrev), crd);
+	});
+
+	// acceptReprojection of MotionVectors.hlsli
+	getPool().parallelForRange(height, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				vec4& motionVector = mMotionVectors.at(x, y);
+				if (mDepth.at(x, y) == 1.0f)
+				{
+					continue;
+				}
+				vec2 crd(motionVector.z, motionVector.w);
+				bool accept = true;
+				float depthCurr = makeDepthLinear(mDepth.sample(crd));
+				if (depthCurr > 0.9999f)
+				{
+					accept = false;
+				}
+				else
+				{
+					vec2 reprojectedCrd = crd - vec2(motionVector.x, -motionVector.y);
+					if (reprojectedCrd.x < 0.0f || reprojectedCrd.x > 1.0f || reprojectedCrd.y < 0.0f || reprojectedCrd.y > 1.0f)
+					{
+						accept = false;
+					}
+					else
+					{
+						vec4 normalAndMeshIDPrevious = mNormalPrev.sample(reprojectedCrd);
+						vec4 normalAndMeshIDCurrent = mNormal.sample(crd);
+						if (fabsf(normalAndMeshIDCurrent.a - normalAndMeshIDPrevious.a) > 0.1f)
+						{
+							accept = false;
+						}
+						else if (fabsf(dot(vec3(normalAndMeshIDCurrent) * 2.0f - 1.0f, vec3(normalAndMeshIDPrevious) * 2.0f - 1.0f)) < 0.5f)
+						{
+							accept = false;
+						}
+						else
+						{
+							float depthPreviousReprojected = makeDepthLinear(mDepthPrev.sample(reprojectedCrd));
+							accept = fabsf(1.0f - depthCurr / depthPreviousReprojected) < 0.1f;
+						}
+					}
+				}
+				motionVector.z = accept ? 1.0f : 0.0f;
+				motionVector.w = 1.0f;
+			}
+		}
+	});
+
+	// Copied to the history after the motion vectors, as renderMotionVectors does
+	mDepthPrev = mDepth;
+	mNormalPrev = mNormal;
+}
+
+void CpuFrame::renderShadowMap()
+{
+	uint32_t size = mDesc.rsmSize;
+	mRsmDepth.resize(size, size, 1.0f);
+	mRsmPosition.resize(size, size, vec4(0.0f, 0.0f, 0.0f, 2.0f));
+	mRsmNormal.resize(size, size, vec4(0.0f));
+	mRsmFlux.resize(size, size, vec4(0.0f));
+
+	// ShadowMap.hlsl, the vertex normals are normalized, interpolated and only the packed one normalized again
+	rasterize(mDesc.lightProjection * mDesc.lightView, mRsmDepth, [&](uint32_t x, uint32_t y, uint32_t m, uint32_t t, const vec3& weights)
+	{
+		const CpuFrameMesh& mesh = mMeshes[m];
+		const uint32_t* pIndices = mesh.mesh.indices + 3 * t;
+		vec3 position(0.0f);
+		vec3 normal(0.0f);
+		for (int k = 0; k < 3; k++)
+		{
+			position += weights[k] * mesh.mesh.positions[pIndices[k]];
+			normal += weights[k] * transformNormal(mesh.modelToWorld, mesh.mesh.normals[pIndices[k]]);
+		}
+		vec4 worldPosition = mesh.modelToWorld * vec4(position, 1.0f);
+		mRsmPosition.at(x, y) = vec4(vec3(worldPosition), asfloat(dirToOct(normalize(normal))));
+		mRsmNormal.at(x, y) = vec4(normal * 0.5f + 0.5f, 1.0f);
+		mRsmFlux.at(x, y) = vec4(mesh.color * 8.0f, 1.0f);
+	});
+}
+
+void CpuFrame::rayTrace()
+{
+	uint32_t width = mDesc.width;
+	uint32_t height = mDesc.height;
+	mRtOutput.resize(width, height, vec4(0.0f));
+
+	// The direct light pixel by pixel, then the indirect light of the tile's hit points in one go
+	uint32_t numTilesX = (width + kRayTileSize - 1) / kRayTileSize;
+	uint32_t numTilesY = (height + kRayTileSize - 1) / kRayTileSize;
+	getPool().parallelForRange(numTilesX * numTilesY, kRayTilesPerTask, [&](uint32_t begin, uint32_t end)
+	{
+		CpuIndirectLightBatch batch;
+		CpuTlas::OccluderCache cache;
+		for (uint32_t tile = begin; tile < end; tile++)
+		{
+			uint32_t minX = (tile % numTilesX) * kRayTileSize;
+			uint32_t minY = (tile / numTilesX) * kRayTileSize;
+			CpuIndirectLightQuery queries[kRayTileSize * kRayTileSize];
+			vec4* pOutputs[kRayTileSize * kRayTileSize];
+			uint32_t numQueries = 0;
+			for (uint32_t y = minY; y < std::min(minY + kRayTileSize, height); y++)
+			{
+				for (uint32_t x = minX; x < std::min(minX + kRayTileSize, width); x++)
+				{
+					vec4& output = mRtOutput.at(x, y);
+					if (traceHitPoint(x, y, cache, queries[numQueries], output.w))
+					{
+						pOutputs[numQueries++] = &output;
+					}
+				}
+			}
+
+			vec3 colors[kRayTileSize * kRayTileSize];
+			if (mDesc.batchedIndirectLight)
+			{
+				sampleIndirectLight(queries, numQueries, colors, batch);
+			}
+			else
+			{
+				for (uint32_t q = 0; q < numQueries; q++)
+				{
+					uint32_t seed = queries[q].seed;
+					colors[q] = sampleIndirectLight(queries[q].hitPoint, queries[q].normal, seed, queries[q].acceptedReprojection, cache);
+				}
+			}
+			for (uint32_t q = 0; q < numQueries; q++)
+			{
+				*pOutputs[q] = vec4(colors[q], pOutputs[q]->w);
+			}
+		}
+	});
+}
+
+/*
+	rayGen of RayGeneration.hlsl, then modelChs of Hit.hlsl up to sampleIndirectLight, which is left to the caller with
+	query. False for the miss shader, which writes 0.
+*/
+bool CpuFrame::traceHitPoint(uint32_t x, uint32_t y, CpuTlas::OccluderCache& cache, CpuIndirectLightQuery& query, float& directColor) const
+{
+	vec2 crd((float)x, (float)y);
+	vec2 dims((float)mDesc.width, (float)mDesc.height);
+	vec2 d = ((crd + 0.5f) / dims) * 2.0f - 1.0f;
+
+	CpuRay ray;
+	ray.origin = vec3(mViewInv * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	vec4 target = mProjectionInv * vec4(d.x, -d.y, 1.0f, 1.0f);
+	ray.direction = vec3(mViewInv * vec4(vec3(target), 0.0f));
+	ray.tMin = 0.0f;
+	ray.tMax = 100000.0f;
+
+	uint32_t seed = initRand(x + y * mDesc.width, (uint32_t)mDesc.frameCount, 16);
+	nextRand(seed);
+
+	CpuHit hit;
+	directColor = 0.0f;
+	if (!mTlas.traceRay(ray, kRayFlagNone, 0xFF, hit))
+	{
+		return false;
+	}
+	vec3 hitPoint = ray.origin + ray.direction * hit.t;
+
+	const CpuFrameMesh& mesh = mMeshes[hit.instanceIndex];
+	const uint32_t* pIndices = mesh.mesh.indices + 3 * hit.primitiveIndex;
+	vec3 normal = mesh.mesh.normals[pIndices[0]] * (1.0f - hit.barycentrics.x - hit.barycentrics.y)
+		+ mesh.mesh.normals[pIndices[1]] * hit.barycentrics.x
+		+ mesh.mesh.normals[pIndices[2]] * hit.barycentrics.y;
+	normal = transformNormal(mesh.modelToWorld, normal);
+
+	for (int i = 0; i < kDirectLightSamples; i++)
+	{
+		directColor += sampleDirectLight(hitPoint, normal, seed, cache);
+	}
+	directColor /= (float)kDirectLightSamples;
+
+	query.hitPoint = hitPoint;
+	query.normal = normal;
+	query.seed = seed;
+	query.acceptedReprojection = mMotionVectors.at(x, y).z != 0.0f;
+	return true;
+}
+
+/*
+	One shadow ray to a point of the disk light of radius 0.5 facing the hit point (Ray Tracing Gems 16.5.1.2).
+	As in the shader the ray direction isn't normalized, so tMax reaches past the light.
+*/
+float CpuFrame::sampleDirectLight(const vec3& hitPoint, const vec3& hitPointNormal, uint32_t& seed, CpuTlas::OccluderCache& cache) const
+{
+	vec3 direction = mDesc.lightPosition - hitPoint;
+	float distance = length(direction);
+
+	vec3 n = normalize(mDesc.lightPosition - hitPoint);
+	vec3 rvec = vec3(normalize(vec4(hitPoint, 1.0f) * mDesc.lightView));
+	vec3 b1 = normalize(rvec - n * dot(rvec, n));
+	vec3 b2 = cross(n, b1);
+
+	float xi1 = nextRand(seed);
+	float xi2 = nextRand(seed);
+	const float R = 0.5f;
+	float a = 2.0f * xi1 - 1.0f;
+	float b = 2.0f * xi2 - 1.0f;
+	float r;
+	float phi;
+	if (a * a > b * b)
+	{
+		r = R * a;
+		phi = (pi<float>() / 4.0f) * (b / a);
+	}
+	else
+	{
+		r = R * b;
+		phi = (pi<float>() / 2.0f) - (pi<float>() / 4.0f) * (a / b);
+	}
+	vec2 diskSample(r * cosf(phi), r * sinf(phi));
+	vec3 sampleDirection = mDesc.lightPosition + (diskSample.x * b1 + diskSample.y * b2) - hitPoint;
+
+	direction = normalize(direction);
+	float angle = clamp(dot(direction, hitPointNormal), 0.0f, 1.0f);
+	if (angle < 0.0001f)
+	{
+		return 0.0f;
+	}
+
+	CpuRay rayShadow;
+	rayShadow.origin = hitPoint;
+	rayShadow.direction = sampleDirection;
+	rayShadow.tMin = 0.001f;
+	rayShadow.tMax = distance - 0.0001f;
+	return mTlas.isOccluded(rayShadow, kRayFlagAcceptFirstHitAndEndSearch, 0xFF, &cache) ? 0.0f : angle * 8.0f;
+}
+
+// The RSM texel of the hit point: projected into the light, divided by z once more as the shader does
+void CpuFrame::getRsmTexel(const vec3& hitPoint, uint32_t& crdX, uint32_t& crdY) const
+{
+	vec4 newPosition = mDesc.lightProjection * (mDesc.lightView * vec4(hitPoint, 1.0f));
+	newPosition /= newPosition.w;
+	float px = newPosition.x / newPosition.z;
+	float py = newPosition.y / newPosition.z;
+	px = clamp(px * 0.5f + 0.5f, 0.0f, 1.0f);
+	py = clamp(py * 0.5f + 0.5f, 0.0f, 1.0f);
+	px = px * mRsmPosition.width;
+	py = (1.0f - py) * mRsmPosition.height;
+	crdX = (uint32_t)floorf(px);
+	crdY = (uint32_t)floorf(py);
+}
+
+// Up to 200 RSM texels within 150 texels of the hit point's texel, with density 1/r, 20 where the history is reused
+vec3 CpuFrame::sampleIndirectLight(const vec3& hitPoint, const vec3& hitPointNormal, uint32_t& seed, bool acceptedReprojection, CpuTlas::OccluderCache& cache, uint32_t* pNumSamples) const
+{
+	uint32_t shadowWidth = mRsmPosition.width;
+	uint32_t shadowHeight = mRsmPosition.height;
+	uint32_t crdX, crdY;
+	getRsmTexel(hitPoint, crdX, crdY);
+
+	vec3 indirectColor(0.0f);
+	CpuRay rayShadow;
+	rayShadow.origin = hitPoint;
+	rayShadow.tMin = 0.001f;
+
+	int numRaySamples = 0;
+	int numTotSamples = 0;
+	int maxNumTot = acceptedReprojection ? kReprojectedIndirectLightSamples : kIndirectLightSamples;
+	for (int sample = 0; sample < maxNumTot; sample++)
+	{
+		if (numTotSamples >= kEarlyExitSamples && numRaySamples == 0)
+		{
+			break;
+		}
+
+		float xi1 = nextRand(seed);
+		float xi2 = nextRand(seed);
+		int i = (int)floorf(kRsmRadius * xi1 * sinf(2.0f * pi<float>() * xi2));
+		int j = (int)floorf(kRsmRadius * xi1 * cosf(2.0f * pi<float>() * xi2));
+		numTotSamples++;
+
+		// Unsigned like the uint2 of the shader, so negative texels wrap and fail the test too
+		uint32_t texelX = crdX + (uint32_t)i;
+		uint32_t texelY = crdY + (uint32_t)j;
+		if (texelX >= shadowWidth || texelY >= shadowHeight)
+		{
+			continue;
+		}
+
+		const vec4& lightPosData = mRsmPosition.at(texelX, texelY);
+		if (lightPosData.w == 2.0f)
+		{
+			continue;
+		}
+
+		vec3 direction = vec3(lightPosData) - hitPoint;
+		float distance = length(direction);
+		direction = normalize(direction);
+
+		float angleHitPoint = clamp(dot(direction, hitPointNormal), 0.0f, 1.0f);
+		if (angleHitPoint < 0.0001f)
+		{
+			continue;
+		}
+		vec3 pixelLightNormal = octToDir(asuint(lightPosData.w));
+		float angleLightPoint = clamp(dot(-direction, pixelLightNormal), 0.0f, 1.0f);
+		if (angleLightPoint < 0.0001f)
+		{
+			continue;
+		}
+		numRaySamples++;
+
+		rayShadow.tMax = distance - 0.0001f;
+		rayShadow.direction = direction;
+		if (!mTlas.isOccluded(rayShadow, kRayFlagAcceptFirstHitAndEndSearch, 0xFF, &cache))
+		{
+			indirectColor += angleHitPoint * angleLightPoint * vec3(mRsmFlux.at(texelX, texelY)) * xi1 * 150.0f / std::max(distance * distance, 0.01f);
+		}
+	}
+
+	if (numRaySamples > 0)
+	{
+		indirectColor /= (float)numTotSamples;
+	}
+	if (pNumSamples)
+	{
+		*pNumSamples = (uint32_t)numTotSamples;
+	}
+	return indirectColor;
+}
+
+// TemporalFilter.hlsl without OFFLINE: the output becomes the history of the next frame
+void CpuFrame::applyTemporalFilter()
+{
+	uint32_t width = mDesc.width;
+	uint32_t height = mDesc.height;
+	mTemporalOutput.resize(width, height, vec4(0.0f));
+	getPool().parallelForRange(height, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				vec2 crd(((float)x + 0.5f) / width, ((float)y + 0.5f) / height);
+				vec3 motionVector = vec3(mMotionVectors.sample(crd));
+				motionVector.y *= -1.0f;
+				vec2 reprojectedCrd = crd - vec2(motionVector);
+				bool acceptReprojection = motionVector.z != 0.0f;
+
+				vec4 colorCurrent = mRtOutput.sample(crd);
+				vec4 colorOutput = colorCurrent;
+				if (acceptReprojection && !mDesc.dropHistory)
+				{
+					vec4 colorHistory = mColorHistory.sample(reprojectedCrd);
+					colorOutput = vec4(0.04f * vec3(colorCurrent) + (1.0f - 0.04f) * vec3(colorHistory), 0.3f * colorCurrent.a + (1.0f - 0.3f) * colorHistory.a);
+				}
+				mTemporalOutput.at(x, y) = colorOutput;
+			}
+		}
+	});
+	std::swap(mColorHistory, mTemporalOutput);
+}
+
+// HorzBlurCS / VertBlurCS of SpatialFilter.hlsl, taps outside the image are clamped to the edge
+void CpuFrame::blur(const CpuImage<vec4>& input, CpuImage<vec4>& output, int itr, bool vertical)
+{
+	static const float kWeights[5] = { 0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f };
+
+	uint32_t width = input.width;
+	uint32_t height = input.height;
+	output.resize(width, height, vec4(0.0f));
+	int blurRadius = 1 << ((itr == 1) ? 1 : (6 - itr));
+	int blurHalfRadius = blurRadius >> 1;
+	float sigmaDirect = 0.1f + float(itr - 2) / 14.0f;
+	getPool().parallelForRange(height, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const vec4& colorCenter = input.at(x, y);
+				const vec4& normalCenterData = mNormal.at(x, y);
+				// Sky, don't blend
+				if (normalCenterData.a == 0.0f)
+				{
+					output.at(x, y) = colorCenter;
+					continue;
+				}
+
+				float depthCenter = makeDepthLinear(mDepth.at(x, y));
+				vec3 normalCenter = vec3(normalCenterData) * 2.0f - 1.0f;
+				vec4 blurColor(0.0f);
+				vec2 weightSum(0.0f);
+				for (int i = -2; i <= 2; i++)
+				{
+					int kx = vertical ? (int)x : clamp((int)x + i * blurHalfRadius, 0, (int)width - 1);
+					int ky = vertical ? clamp((int)y + i * blurHalfRadius, 0, (int)height - 1) : (int)y;
+					const vec4& colorK = input.at((uint32_t)kx, (uint32_t)ky);
+					float w_n = powf(std::max(0.0f, dot(normalCenter, vec3(mNormal.at((uint32_t)kx, (uint32_t)ky)) * 2.0f - 1.0f)), 16.0f);
+					float w_z = expf(-fabsf(depthCenter - makeDepthLinear(mDepth.at((uint32_t)kx, (uint32_t)ky))) / 0.01f);
+
+					float w_c_indirect = (itr == 1) ? 1.0f : expf(-length(vec3(colorCenter) - vec3(colorK)) / 0.1f);
+					float w_indirect = w_n * w_z * w_c_indirect;
+					blurColor += vec4(kWeights[i + 2] * w_indirect * vec3(colorK), 0.0f);
+					weightSum.x += kWeights[i + 2] * w_indirect;
+
+					float w_c_direct = (itr == 1) ? 1.0f : expf(-fabsf(colorCenter.a - colorK.a) / sigmaDirect);
+					float w_direct = w_n * w_z * w_c_direct;
+					blurColor.a += kWeights[i + 2] * w_direct * colorK.a;
+					weightSum.y += kWeights[i + 2] * w_direct;
+				}
+				if (weightSum.x > 0.0f)
+				{
+					blurColor = vec4(vec3(blurColor) / weightSum.x, blurColor.a);
+				}
+				if (weightSum.y > 0.0f)
+				{
+					blurColor.a /= weightSum.y;
+				}
+				output.at(x, y) = blurColor;
+			}
+		}
+	});
+}
+
+// applySpatialFilter(true): the first iteration reads the history, the others the last vertical pass
+void CpuFrame::applySpatialFilter()
+{
+	for (int itr = 1; itr <= 5; itr++)
+	{
+		blur(itr == 1 ? mColorHistory : mFiltered, mBlur, itr, false);
+		blur(mBlur, mFiltered, itr, true);
+	}
+}
+
+// ToneMapping.hlsl with the RSM normals and the motion vectors drawn over the top left corner
+void CpuFrame::applyToneMapping()
+{
+	uint32_t width = mDesc.width;
+	uint32_t height = mDesc.height;
+	uint32_t shadowWidth = mRsmNormal.width;
+	uint32_t shadowHeight = mRsmNormal.height;
+	const uint32_t scale = 4;
+	mOutput.resize(width, height, vec4(0.0f));
+	getPool().parallelForRange(height, 1, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const vec4& light = mFiltered.at(x, y);
+				vec3 indirectLight = vec3(light);
+				vec3 directLight = light.a * vec3(1.0f, 1.0f, 0.984f);
+				vec3 output = (indirectLight + directLight * 0.5f) * vec3(mColor.at(x, y));
+				output = mMotionVectors.at(x, y).w < 0.5f ? vec3(10.0f) : output;
+				output = linearToSrgb(filmicToneMapping(2.5f * output));
+
+				if (x < shadowWidth / scale && y < shadowHeight / scale)
+				{
+					output = vec3(mRsmNormal.load((int)(x * scale), (int)(y * scale)));
+				}
+				else if (x < shadowWidth / scale && y < 2 * shadowHeight / scale)
+				{
+					uint32_t coordsY = y - shadowHeight / scale;
+					vec4 motionVectors = mMotionVectors.load((int)(x * scale * 2), (int)(coordsY * scale * 2));
+					motionVectors.y *= -1.0f;
+					output = vec3(5.0f * vec2(motionVectors) + 0.5f, 1.0f - 0.5f * motionVectors.z);
+				}
+				mOutput.at(x, y) = vec4(output, 1.0f);
+			}
+		}
+	});
+}
+
+///////////////////////////////////////////
+// Output
+///////////////////////////////////////////
+// channels 1 or 3, rows top down in data, written bottom up with a negative scale for little endian
+static bool savePfm(const std::string& fileName, uint32_t width, uint32_t height, uint32_t channels, const std::vector<float>& data)
+{
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+	char header[64];
+	snprintf(header, sizeof(header), "%s\n%u %u\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+	file.write(header, strlen(header));
+	for (uint32_t y = height; y-- > 0;)
+	{
+		file.write((const char*)&data[(size_t)y * width * channels], (size_t)width * channels * sizeof(float));
+	}
+	return file.good();
+}
+
+static bool saveRgb(const std::string& fileName, const CpuImage<vec4>& image)
+{
+	std::vector<float> data(image.texels.size() * 3);
+	for (size_t p = 0; p < image.texels.size(); p++)
+	{
+		data[3 * p] = image.texels[p].r;
+		data[3 * p + 1] = image.texels[p].g;
+		data[3 * p + 2] = image.texels[p].b;
+	}
+	return savePfm(fileName, image.width, image.height, 3, data);
+}
+
+static bool saveChannel(const std::string& fileName, const CpuImage<vec4>& image, int channel)
+{
+	std::vector<float> data(image.texels.size());
+	for (size_t p = 0; p < image.texels.size(); p++)
+	{
+		data[p] = image.texels[p][channel];
+	}
+	return savePfm(fileName, image.width, image.height, 1, data);
+}
+
+static bool saveDepth(const std::string& fileName, const CpuImage<float>& image)
+{
+	return savePfm(fileName, image.width, image.height, 1, image.texels);
+}
+
+static bool savePpm(const std::string& fileName, const CpuImage<vec4>& image)
+{
+	std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+	char header[64];
+	snprintf(header, sizeof(header), "P6\n%u %u\n255\n", image.width, image.height);
+	file.write(header, strlen(header));
+	std::vector<uint8_t> row(3 * image.width);
+	for (uint32_t y = 0; y < image.height; y++)
+	{
+		for (uint32_t x = 0; x < image.width; x++)
+		{
+			vec3 color = clamp(vec3(image.at(x, y)), 0.0f, 1.0f);
+			for (int c = 0; c < 3; c++)
+			{
+				row[3 * x + c] = (uint8_t)(color[c] * 255.0f + 0.5f);
+			}
+		}
+		file.write((const char*)row.data(), row.size());
+	}
+	return file.good();
+}
+
+bool CpuFrame::save(const char* pPrefix) const
+{
+	std::string prefix = std::string(pPrefix) + "_";
+	bool saved = true;
+	saved &= saveDepth(prefix + "gbuffer_depth.pfm", mDepth);
+	saved &= saveRgb(prefix + "gbuffer_normal.pfm", mNormal);
+	saved &= saveChannel(prefix + "gbuffer_meshid.pfm", mNormal, 3);
+	saved &= saveRgb(prefix + "gbuffer_color.pfm", mColor);
+	saved &= saveRgb(prefix + "gbuffer_position.pfm", mPosition);
+	saved &= saveRgb(prefix + "motion_vectors.pfm", mMotionVectors);
+	saved &= saveDepth(prefix + "rsm_depth.pfm", mRsmDepth);
+	saved &= saveRgb(prefix + "rsm_position.pfm", mRsmPosition);
+	saved &= saveRgb(prefix + "rsm_normal.pfm", mRsmNormal);
+	saved &= saveRgb(prefix + "rsm_flux.pfm", mRsmFlux);
+	saved &= saveRgb(prefix + "rt_indirect.pfm", mRtOutput);
+	saved &= saveChannel(prefix + "rt_direct.pfm", mRtOutput, 3);
+	saved &= saveRgb(prefix + "temporal_indirect.pfm", mColorHistory);
+	saved &= saveChannel(prefix + "temporal_direct.pfm", mColorHistory, 3);
+	saved &= saveRgb(prefix + "filtered_indirect.pfm", mFiltered);
+	saved &= saveChannel(prefix + "filtered_direct.pfm", mFiltered, 3);
+	saved &= saveRgb(prefix + "output.pfm", mOutput);
+	saved &= savePpm(prefix + "output.ppm", mOutput);
+	return saved;
+}
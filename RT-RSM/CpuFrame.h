@@ -0,0 +1,199 @@
+#pragma once
+#include "CpuRaytracing.h"
+
+///////////////////////////////////////////
+// CPU reference frame
+///////////////////////////////////////////
+/*
+	Headless software version of RtRsm::onFrameRender, so the whole pipeline can be regression tested and profiled
+	without a DXR device or a window, e.g. by rtrsm_headless (Headless/HeadlessMain.cpp). Every pass follows the math of
+	its shader in Data/ and writes the same buffers:
+
+		renderGeometryBuffer	GBuffer.hlsl and MotionVectors.hlsl, then depth and normal are kept for the next frame
+		renderShadowMap			ShadowMap.hlsl, the RSM position (normal packed in w), normal and flux
+		rayTrace				RayGeneration.hlsl and Hit.hlsl, indirect and direct light through a CpuTlas, the indirect
+								light of a tile's hit points gathered in one batch
+		applyTemporalFilter		TemporalFilter.hlsl, into the indirect color history
+		applySpatialFilter		SpatialFilter.hlsl, 5 iterations of the horizontal and vertical a-trous pass
+		applyToneMapping		ToneMapping.hlsl with the RSM normal and motion vector insets
+
+	The rasterizer works like the D3D12 one the passes are drawn with: no culling, 16.8 fixed point vertices with the
+	top-left rule, pixel centers at +0.5, perspective correct attributes, clipping to 0 <= z <= w and LESS depth with
+	triangles of a tile drawn in submission order, so it gives the same pixels no matter how many threads there are.
+	Textures are read like the shaders do, Load returns 0 outside and SampleLevel filters bilinearly with a transparent
+	black border, as the static samplers of the passes. The rasterizer and the rays split the image into tiles on the
+	pool, the filters split it into rows.
+*/
+
+// One render target, row y (top down) at y * width like the D3D12 textures
+template<typename T>
+struct CpuImage
+{
+	uint32_t		width = 0;
+	uint32_t		height = 0;
+	std::vector<T>	texels;
+
+	void resize(uint32_t w, uint32_t h, const T& clearValue) { width = w; height = h; texels.assign((size_t)w * h, clearValue); }
+	void clear(const T& clearValue) { std::fill(texels.begin(), texels.end(), clearValue); }
+
+	T&			at(uint32_t x, uint32_t y) { return texels[(size_t)y * width + x]; }
+	const T&	at(uint32_t x, uint32_t y) const { return texels[(size_t)y * width + x]; }
+
+	// Texture2D.Load, 0 outside
+	T load(int x, int y) const
+	{
+		return x >= 0 && y >= 0 && x < (int)width && y < (int)height ? at((uint32_t)x, (uint32_t)y) : T(0.0f);
+	}
+
+	// SampleLevel(gSampler, uv, 0): bilinear, texels outside are 0
+	T sample(const vec2& uv) const
+	{
+		vec2 texel = uv * vec2((float)width, (float)height) - 0.5f;
+		vec2 base = floor(texel);
+		vec2 f = texel - base;
+		int x = (int)base.x;
+		int y = (int)base.y;
+		return (load(x, y) * (1.0f - f.x) + load(x + 1, y) * f.x) * (1.0f - f.y)
+			+ (load(x, y + 1) * (1.0f - f.x) + load(x + 1, y + 1) * f.x) * f.y;
+	}
+};
+
+// One draw of the G-buffer and shadow map passes, what Model passes in the ModelTransform and color constant buffers
+struct CpuFrameMesh
+{
+	MeshView	mesh;
+	mat4		modelToWorld;		// Model::getTransformMatrix
+	vec3		color;				// Model::getColor
+	int			meshID = 0;			// of the draw list, from 1, written to the alpha of the G-buffer normal
+};
+
+struct CpuFrameDesc
+{
+	uint32_t	width = 1920;
+	uint32_t	height = 1080;
+	mat4		view;				// camera lookAtLH
+	mat4		projection;			// perspectiveFovLH_ZO with the near and far plane of makeDepthLinear, 0.1 and 100
+	mat4		lightView;
+	mat4		lightProjection;
+	vec3		lightPosition;
+	uint32_t	rsmSize = 512;		// kShadowMapWidth
+	int			frameCount = 0;		// seeds the rays like the global frameCount
+	bool		dropHistory = false;
+	bool		batchedIndirectLight = true;	// the SSE kernel with batched shadow rays for sampleIndirectLight, false for the scalar one
+};
+
+// A hit point of sampleIndirectLight, seed is the state of the pixel's random sequence when Hit.hlsl calls it
+struct CpuIndirectLightQuery
+{
+	vec3		hitPoint;
+	vec3		normal;
+	uint32_t	seed = 0;
+	bool		acceptedReprojection = false;
+};
+
+struct CpuIndirectLightBatch;
+
+class CpuFrame
+{
+public:
+	/*
+		A BLAS per mesh, built on the pool, and the TLAS over them. The mesh data must outlive the frame.
+		Drops the history, the first frame has nothing to reproject from.
+	*/
+	void setScene(const std::vector<CpuFrameMesh>& meshes, TaskPool* pPool = nullptr);
+
+	// Takes effect in the next beginFrame, the motion vectors compare it against the transform of the last frame
+	void setTransform(uint32_t mesh, const mat4& modelToWorld) { mMeshes[mesh].modelToWorld = modelToWorld; }
+
+	// All passes in the order of onFrameRender
+	void render(const CpuFrameDesc& desc);
+
+	// The passes one by one, for timing them: beginFrame, the passes in the order of render, endFrame
+	void beginFrame(const CpuFrameDesc& desc);
+	void renderGeometryBuffer();
+	void renderShadowMap();
+	void rayTrace();
+	void applyTemporalFilter();
+	void applySpatialFilter();
+	void applyToneMapping();
+	void endFrame();
+
+	/*
+		Every buffer of the last frame as <pPrefix>_<buffer>.pfm, float RGB or grayscale with the rows bottom up, alpha
+		channels that hold data of their own (direct light, mesh ID) as separate grayscale files. The tone mapped frame is
+		also written as an 8 bit <pPrefix>_output.ppm. False if a file couldn't be written.
+	*/
+	bool save(const char* pPrefix) const;
+
+	/*
+		sampleIndirectLight of Hit.hlsl at any hit points, against the RSM and TLAS of the last frame, split over the pool.
+		Batched runs the SSE kernel on a ray tile worth of queries at a time, otherwise each one goes through the scalar
+		version. Both take the same samples and give the same colors up to rounding. Returns the number of RSM samples.
+	*/
+	uint64_t gatherIndirectLight(const CpuIndirectLightQuery* pQueries, uint32_t count, vec3* pColors, bool batched) const;
+
+	const CpuImage<float>&	getDepth() const { return mDepth; }
+	const CpuImage<vec4>&	getNormal() const { return mNormal; }				// world normal * 0.5 + 0.5, meshID
+	const CpuImage<vec4>&	getColor() const { return mColor; }
+	const CpuImage<vec4>&	getPosition() const { return mPosition; }
+	const CpuImage<vec4>&	getMotionVectors() const { return mMotionVectors; }	// ndc motion / 2, accepted reprojection, 1 where drawn
+	const CpuImage<vec4>&	getRsmPosition() const { return mRsmPosition; }		// world position, asfloat(dirToOct(normal))
+	const CpuImage<vec4>&	getRsmNormal() const { return mRsmNormal; }
+	const CpuImage<vec4>&	getRsmFlux() const { return mRsmFlux; }
+	const CpuImage<vec4>&	getRtOutput() const { return mRtOutput; }			// indirect, direct
+	const CpuImage<vec4>&	getColorHistory() const { return mColorHistory; }	// temporal filter output
+	const CpuImage<vec4>&	getFiltered() const { return mFiltered; }			// spatial filter output
+	const CpuImage<vec4>&	getOutput() const { return mOutput; }				// tone mapped, sRGB
+	const CpuTlas&			getTlas() const { return mTlas; }
+	const CpuFrameMesh&		getMesh(uint32_t mesh) const { return mMeshes[mesh]; }
+	uint32_t				getNumMeshes() const { return (uint32_t)mMeshes.size(); }
+
+private:
+	template<typename Shader>
+	void rasterize(const mat4& viewProjection, CpuImage<float>& depth, const Shader& shader);
+
+	bool traceHitPoint(uint32_t x, uint32_t y, CpuTlas::OccluderCache& cache, CpuIndirectLightQuery& query, float& directColor) const;
+	float sampleDirectLight(const vec3& hitPoint, const vec3& hitPointNormal, uint32_t& seed, CpuTlas::OccluderCache& cache) const;
+	vec3 sampleIndirectLight(const vec3& hitPoint, const vec3& hitPointNormal, uint32_t& seed, bool acceptedReprojection, CpuTlas::OccluderCache& cache, uint32_t* pNumSamples = nullptr) const;
+	uint64_t sampleIndirectLight(const CpuIndirectLightQuery* pQueries, uint32_t count, vec3* pColors, CpuIndirectLightBatch& batch) const;
+	uint32_t gatherVpls(const CpuIndirectLightQuery& query, CpuIndirectLightBatch& batch) const;
+	void getRsmTexel(const vec3& hitPoint, uint32_t& crdX, uint32_t& crdY) const;
+	void blur(const CpuImage<vec4>& input, CpuImage<vec4>& output, int itr, bool vertical);
+
+	TaskPool&	getPool() const { return mpPool ? *mpPool : TaskPool::getGlobal(); }
+
+	std::vector<CpuFrameMesh>	mMeshes;
+	std::vector<mat4>			mModelToWorldPrev;
+	std::vector<CpuBlas>		mBlases;
+	CpuTlas						mTlas;
+	TaskPool*					mpPool = nullptr;
+
+	CpuFrameDesc				mDesc;
+	mat4						mViewPrev;
+	mat4						mViewInv;
+	mat4						mProjectionInv;
+	bool						mHasHistory = false;
+
+	// G-buffer and motion vectors, depth and normal of the last frame for the reprojection test
+	CpuImage<float>				mDepth;
+	CpuImage<vec4>				mNormal;
+	CpuImage<vec4>				mColor;
+	CpuImage<vec4>				mPosition;
+	CpuImage<vec4>				mMotionVectors;
+	CpuImage<float>				mDepthPrev;
+	CpuImage<vec4>				mNormalPrev;
+
+	// RSM
+	CpuImage<float>				mRsmDepth;
+	CpuImage<vec4>				mRsmPosition;
+	CpuImage<vec4>				mRsmNormal;
+	CpuImage<vec4>				mRsmFlux;
+
+	// Ray tracing and filters
+	CpuImage<vec4>				mRtOutput;
+	CpuImage<vec4>				mColorHistory;
+	CpuImage<vec4>				mTemporalOutput;
+	CpuImage<vec4>				mBlur;
+	CpuImage<vec4>				mFiltered;
+	CpuImage<vec4>				mOutput;
+};
@@ -0,0 +1,126 @@
+#include "CpuFrameScene.h"
+#include "Externals/GLM/glm/gtc/constants.hpp"
+#include "Externals/GLM/glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+
+vec3 getTestMeshColor(uint32_t materialIndex)
+{
+	switch (materialIndex)
+	{
+	case 0: return vec3(0.9f, 0.9f, 0.9f);
+	case 1: return vec3(0.9f, 0.2f, 0.2f);
+	case 2: return vec3(0.9f, 0.9f, 0.2f);
+	case 3: return vec3(0.2f, 0.4f, 0.9f);
+	case 4: return vec3(0.2f, 0.9f, 0.2f);
+	case 5: case 6: case 7: case 8: return vec3(0.9f, 0.2f, 0.2f);
+	default: return vec3(0.75f, 0.75f, 0.75f);
+	}
+}
+
+bool setupCpuFrameScene(const std::vector<MeshView>& meshes, uint32_t width, uint32_t height, CpuFrameScene& scene)
+{
+	BvhBounds bounds;
+	for (const MeshView& mesh : meshes)
+	{
+		for (uint32_t v = 0; v < mesh.vertexCount; v++)
+		{
+			bounds.grow(mesh.positions[v]);
+		}
+	}
+	if (bounds.isEmpty())
+	{
+		return false;
+	}
+	vec3& size = scene.size;
+	size = bounds.max - bounds.min;
+	mat4 modelToWorld = scale(mat4(1.0f), vec3(20.0f / std::max(length(size), 1e-6f))) * translate(mat4(1.0f), -0.5f * (bounds.min + bounds.max));
+	scene.meshes.resize(meshes.size());
+	for (uint32_t i = 0; i < (uint32_t)meshes.size(); i++)
+	{
+		scene.meshes[i].mesh = meshes[i];
+		scene.meshes[i].modelToWorld = modelToWorld;
+		scene.meshes[i].color = getTestMeshColor(meshes[i].materialIndex);
+		scene.meshes[i].meshID = (int)i + 1;
+	}
+	size *= 20.0f / std::max(length(size), 1e-6f);
+
+	CpuFrameDesc& desc = scene.desc;
+	desc.width = width;
+	desc.height = height;
+	scene.eye = vec3(-0.3f * size.x, 0.05f * size.y, -0.05f * size.z);
+	scene.target = vec3(0.3f * size.x, 0.0f, 0.0f);
+	desc.view = lookAtLH(scene.eye, scene.target, vec3(0.0f, 1.0f, 0.0f));
+	desc.projection = perspectiveFovLH_ZO(half_pi<float>(), (float)desc.width, (float)desc.height, 0.1f, 100.0f);
+	const float kLightRadius = 27.9128f;
+	const float kLightPhi = 0.75f;
+	const float kLightTheta = 0.209f;
+	desc.lightPosition = kLightRadius * vec3(cosf(kLightTheta) * sinf(kLightPhi), cosf(kLightPhi), sinf(kLightTheta) * sinf(kLightPhi));
+	desc.lightView = lookAtLH(desc.lightPosition, vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+	desc.lightProjection = perspectiveFovLH_ZO(quarter_pi<float>() * 1.5f, (float)desc.rsmSize, (float)desc.rsmSize, 0.1f, 100.0f);
+	return true;
+}
+
+// Two triangles spanning origin + u, origin + v, facing cross(u, v)
+static void addQuad(MeshData& mesh, const vec3& origin, const vec3& u, const vec3& v)
+{
+	vec3 normal = normalize(cross(u, v));
+	uint32_t base = (uint32_t)mesh.positions.size();
+	vec3 corners[] = { origin, origin + u, origin + v, origin + u + v };
+	for (const vec3& corner : corners)
+	{
+		mesh.positions.push_back(corner);
+		mesh.normals.push_back(normal);
+	}
+	uint32_t indices[] = { base, base + 1, base + 2, base + 2, base + 1, base + 3 };
+	mesh.indices.insert(mesh.indices.end(), indices, indices + 6);
+}
+
+static void addSphere(MeshData& mesh, const vec3& center, float radius, uint32_t rings, uint32_t segments)
+{
+	uint32_t base = (uint32_t)mesh.positions.size();
+	for (uint32_t r = 0; r <= rings; r++)
+	{
+		float theta = pi<float>() * r / rings;
+		for (uint32_t s = 0; s <= segments; s++)
+		{
+			float phi = two_pi<float>() * s / segments;
+			vec3 normal(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+			mesh.positions.push_back(center + radius * normal);
+			mesh.normals.push_back(normal);
+		}
+	}
+	for (uint32_t r = 0; r < rings; r++)
+	{
+		for (uint32_t s = 0; s < segments; s++)
+		{
+			uint32_t a = base + r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+			uint32_t indices[] = { a, a + 1, b + 1, a, b + 1, b };
+			mesh.indices.insert(mesh.indices.end(), indices, indices + 6);
+		}
+	}
+}
+
+void createTestMeshes(std::vector<MeshData>& meshes)
+{
+	meshes.clear();
+	uint32_t seed = 3;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+	for (uint32_t s = 0; s < 12; s++)
+	{
+		MeshData sphere;
+		vec3 center(20.0f * random(), 3.0f * random(), 20.0f * random());
+		addSphere(sphere, center, 0.5f + 2.0f * random(), 24, 48);
+		sphere.materialIndex = s % 5;
+		meshes.push_back(std::move(sphere));
+	}
+
+	MeshData floor, backWall, sideWall;
+	addQuad(floor, vec3(-5.0f, -1.0f, -5.0f), vec3(0.0f, 0.0f, 35.0f), vec3(35.0f, 0.0f, 0.0f));
+	addQuad(backWall, vec3(-5.0f, -1.0f, 25.0f), vec3(0.0f, 12.0f, 0.0f), vec3(35.0f, 0.0f, 0.0f));
+	addQuad(sideWall, vec3(25.0f, -1.0f, -5.0f), vec3(0.0f, 0.0f, 30.0f), vec3(0.0f, 12.0f, 0.0f));
+	sideWall.materialIndex = 3;
+	meshes.push_back(std::move(floor));
+	meshes.push_back(std::move(backWall));
+	meshes.push_back(std::move(sideWall));
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "CpuFrame.h"
+
+///////////////////////////////////////////
+// CPU frame scenes
+///////////////////////////////////////////
+// Colors Model gives the Sun Temple materials, the white of the model otherwise
+vec3 getTestMeshColor(uint32_t materialIndex);
+
+// Draw list, camera and light of a CPU frame, the meshes point into geometry owned by the caller
+struct CpuFrameScene
+{
+	std::vector<CpuFrameMesh>	meshes;
+	CpuFrameDesc				desc;
+	vec3						eye;
+	vec3						target;
+	vec3						size;		// of the scaled model
+};
+
+/*
+	The meshes as one model scaled to a diagonal of 20 around the origin, the size of the Sun Temple in RtRsm, so the
+	light and the near and far plane fit. The camera is the one of the shadow ray benchmarks, the light is where RtRsm
+	puts it. False if the meshes have no vertices.
+*/
+bool setupCpuFrameScene(const std::vector<MeshView>& meshes, uint32_t width, uint32_t height, CpuFrameScene& scene);
+
+// A scene that needs no model file: spheres of every material color on a floor between two walls
+void createTestMeshes(std::vector<MeshData>& meshes);
@@ -0,0 +1,175 @@
+#pragma once
+#include "Bvh.h"
+#include <algorithm>
+
+///////////////////////////////////////////
+// CPU rays
+///////////////////////////////////////////
+/*
+	Ray, hit and flags of the CPU ray tracers (CpuRaytracing, WideBvh), with the values and meaning of
+	their DXR counterparts.
+*/
+
+// D3D12_RAY_FLAGS
+static const uint32_t kRayFlagNone = 0x00;
+static const uint32_t kRayFlagForceOpaque = 0x01;
+static const uint32_t kRayFlagForceNonOpaque = 0x02;
+static const uint32_t kRayFlagAcceptFirstHitAndEndSearch = 0x04;
+static const uint32_t kRayFlagSkipClosestHitShader = 0x08;
+static const uint32_t kRayFlagCullBackFacingTriangles = 0x10;
+static const uint32_t kRayFlagCullFrontFacingTriangles = 0x20;
+static const uint32_t kRayFlagCullOpaque = 0x40;
+static const uint32_t kRayFlagCullNonOpaque = 0x80;
+
+// D3D12_RAYTRACING_INSTANCE_FLAGS
+static const uint32_t kInstanceFlagTriangleCullDisable = 0x1;
+static const uint32_t kInstanceFlagTriangleFrontCounterClockwise = 0x2;
+static const uint32_t kInstanceFlagForceOpaque = 0x4;
+static const uint32_t kInstanceFlagForceNonOpaque = 0x8;
+
+// D3D12_HIT_KIND
+static const uint32_t kHitKindTriangleFrontFace = 0xFE;
+static const uint32_t kHitKindTriangleBackFace = 0xFF;
+
+static const uint32_t kCpuNoHit = 0xffffffff;
+
+// HLSL RayDesc
+struct CpuRay
+{
+	vec3	origin;
+	float	tMin = 0.0f;
+	vec3	direction;
+	float	tMax = FLT_MAX;
+};
+
+struct CpuHit
+{
+	float		t = FLT_MAX;					// RayTCurrent()
+	vec2		barycentrics = vec2(0.0f);		// BuiltInTriangleIntersectionAttributes: weights of the second and third vertex
+	uint32_t	primitiveIndex = kCpuNoHit;		// PrimitiveIndex(), triangle of the geometry
+	uint32_t	geometryIndex = kCpuNoHit;
+	uint32_t	instanceIndex = kCpuNoHit;		// InstanceIndex()
+	uint32_t	instanceID = 0;					// InstanceID()
+	uint32_t	instanceContribution = 0;		// InstanceContributionToHitGroupIndex
+	uint32_t	hitKind = 0;					// HitKind()
+
+	bool isHit() const { return instanceIndex != kCpuNoHit; }
+
+	// Shader table record TraceRay would run, same arguments as TraceRay
+	uint32_t getHitGroupRecord(uint32_t rayContribution, uint32_t geometryMultiplier) const
+	{
+		return instanceContribution + rayContribution + geometryMultiplier * geometryIndex;
+	}
+};
+
+// Ray data shared by all nodes and triangles of one BVH traversal
+struct TraversalRay
+{
+	vec3		origin;
+	vec3		direction;
+	vec3		invDirection;
+
+	// Watertight triangle test (Woop et al. 2013): the ray is sheared onto +z, edges shared by two triangles never leak
+	int			kx, ky, kz;
+	vec3		shear;
+
+	TraversalRay(const vec3& o, const vec3& d)
+	{
+		origin = o;
+		direction = d;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// Keep the slabs finite for axis aligned rays
+			float dir = fabsf(d[axis]) > 1e-20f ? d[axis] : (d[axis] < 0.0f ? -1e-20f : 1e-20f);
+			invDirection[axis] = 1.0f / dir;
+		}
+
+		vec3 absDirection = abs(d);
+		kz = absDirection.x > absDirection.y ? (absDirection.x > absDirection.z ? 0 : 2) : (absDirection.y > absDirection.z ? 1 : 2);
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		if (d[kz] < 0.0f)
+		{
+			std::swap(kx, ky);
+		}
+		shear = vec3(d[kx] / d[kz], d[ky] / d[kz], 1.0f / d[kz]);
+	}
+
+	// Entry distance into the box, FLT_MAX if it is missed or further than tMax
+	float intersectBox(const BvhNode& node, float tMin, float tMax) const
+	{
+		vec3 t0 = (node.boundsMin - origin) * invDirection;
+		vec3 t1 = (node.boundsMax - origin) * invDirection;
+		vec3 tNear = min(t0, t1);
+		vec3 tFar = max(t0, t1);
+		float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+		return entry <= exit ? entry : FLT_MAX;
+	}
+
+	// t in (tMin, tMax], barycentrics of v1 and v2 and the sign of the determinant, positive for clockwise triangles seen from the origin
+	bool intersectTriangle(const vec3& v0, const vec3& v1, const vec3& v2, float tMin, float tMax, float& t, vec2& barycentrics, float& det) const
+	{
+		vec3 a = v0 - origin;
+		vec3 b = v1 - origin;
+		vec3 c = v2 - origin;
+		float ax = a[kx] - shear.x * a[kz];
+		float ay = a[ky] - shear.y * a[kz];
+		float bx = b[kx] - shear.x * b[kz];
+		float by = b[ky] - shear.y * b[kz];
+		float cx = c[kx] - shear.x * c[kz];
+		float cy = c[ky] - shear.y * c[kz];
+
+		float u = cx * by - cy * bx;
+		float v = ax * cy - ay * cx;
+		float w = bx * ay - by * ax;
+		if (u == 0.0f || v == 0.0f || w == 0.0f)
+		{
+			// On an edge in single precision, decide in double so neighbouring triangles agree
+			u = (float)((double)cx * by - (double)cy * bx);
+			v = (float)((double)ax * cy - (double)ay * cx);
+			w = (float)((double)bx * ay - (double)by * ax);
+		}
+		if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+		{
+			return false;
+		}
+		det = u + v + w;
+		if (det == 0.0f)
+		{
+			return false;
+		}
+
+		float scaledT = shear.z * (u * a[kz] + v * b[kz] + w * c[kz]);
+		t = scaledT / det;
+		if (!(t > tMin && t <= tMax))
+		{
+			return false;
+		}
+		barycentrics = vec2(v / det, w / det);
+		return true;
+	}
+};
+
+// Face culling of one BLAS traversal, from the ray and instance flags
+struct FaceCulling
+{
+	bool	cullFront;
+	bool	cullBack;
+	float	frontSign;
+
+	FaceCulling(uint32_t rayFlags, uint32_t instanceFlags)
+	{
+		bool cullDisable = (instanceFlags & kInstanceFlagTriangleCullDisable) != 0;
+		cullBack = !cullDisable && (rayFlags & kRayFlagCullBackFacingTriangles) != 0;
+		cullFront = !cullDisable && (rayFlags & kRayFlagCullFrontFacingTriangles) != 0;
+		frontSign = (instanceFlags & kInstanceFlagTriangleFrontCounterClockwise) ? -1.0f : 1.0f;
+	}
+
+	// det as returned by TraversalRay::intersectTriangle
+	bool isCulled(float det, bool& frontFace) const
+	{
+		frontFace = det * frontSign > 0.0f;
+		return frontFace ? cullFront : cullBack;
+	}
+};
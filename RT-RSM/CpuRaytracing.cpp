@@ -0,0 +1,448 @@
+#include "CpuRaytracing.h"
+#include "AsStats.h"
+#include <algorithm>
+#include <assert.h>
+
+// Deep enough for any tree of the binned builder on real scenes, the traversal keeps at most one entry per level
+static const uint32_t kTraversalStackSize = 64;
+
+void CpuBlas::build(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings, TaskPool* pPool, bool wide)
+{
+	mGeometries = geometries;
+	mWideBvh.clear();
+	if (!wide)
+	{
+		buildBvh(mGeometries, settings, mBvh, pPool);
+	}
+	else
+	{
+		// A wide leaf holds one block of eight triangles
+		BvhBuildSettings binarySettings = settings;
+		binarySettings.maxLeafSize = std::min(settings.maxLeafSize, kWideBvhWidth);
+		buildBvh(mGeometries, binarySettings, mBvh, pPool);
+		mWideBvh.build(mBvh, mGeometries);
+	}
+	mBounds = mBvh.nodes.empty() ? BvhBounds() : mBvh.nodes[0].getBounds();
+}
+
+void CpuBlas::attach(const std::vector<MeshView>& geometries, const BvhBounds& bounds, const WideBvhNode* pNodes, uint32_t numNodes, const WideBvhTriangles* pTriangles, uint32_t numLeaves)
+{
+	mGeometries = geometries;
+	mBvh.clear();
+	mWideBvh.attach(pNodes, numNodes, pTriangles, numLeaves);
+	mBounds = numNodes > 0 ? bounds : BvhBounds();
+}
+
+void CpuBlas::refit(const std::vector<MeshView>& geometries, TaskPool* pPool)
+{
+	assert(geometries.size() == mGeometries.size());
+	mGeometries = geometries;
+	BvhBounds wideBounds;
+	if (!mBvh.nodes.empty())
+	{
+		refitBvh(mGeometries, mBvh, pPool);
+	}
+	if (!mWideBvh.isEmpty())
+	{
+		wideBounds = mWideBvh.refit(mGeometries, pPool);
+	}
+	// A BLAS from the BVH cache that was detached only has the wide tree
+	mBounds = !mBvh.nodes.empty() ? mBvh.nodes[0].getBounds() : wideBounds;
+}
+
+bool CpuBlas::intersect(const vec3& origin, const vec3& direction, float tMin, uint32_t rayFlags, uint32_t instanceFlags, CpuHit& hit) const
+{
+	if (!mWideBvh.isEmpty())
+	{
+		return mWideBvh.intersect(origin, direction, tMin, rayFlags, instanceFlags, hit);
+	}
+	if (mBvh.nodes.empty())
+	{
+		return false;
+	}
+
+	FaceCulling culling(rayFlags, instanceFlags);
+	bool acceptFirstHit = (rayFlags & kRayFlagAcceptFirstHitAndEndSearch) != 0;
+
+	TraversalRay ray(origin, direction);
+	bool found = false;
+	uint32_t stack[kTraversalStackSize];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+	if (ray.intersectBox(mBvh.nodes[0], tMin, hit.t) == FLT_MAX)
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		const BvhNode& node = mBvh.nodes[nodeIndex];
+		AS_STATS_ADD(nodes, 1);
+		if (node.isLeaf())
+		{
+			for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+			{
+				AS_STATS_ADD(triangles, 1);
+				const BvhPrimitive& primitive = mBvh.primitives[p];
+				const MeshView& geometry = mGeometries[primitive.geometry];
+				const uint32_t* pIndices = geometry.indices + 3 * primitive.triangle;
+				float t, det;
+				vec2 barycentrics;
+				if (!ray.intersectTriangle(geometry.positions[pIndices[0]], geometry.positions[pIndices[1]], geometry.positions[pIndices[2]], tMin, hit.t, t, barycentrics, det))
+				{
+					continue;
+				}
+				bool frontFace;
+				if (culling.isCulled(det, frontFace))
+				{
+					continue;
+				}
+				hit.t = t;
+				hit.barycentrics = barycentrics;
+				hit.primitiveIndex = primitive.triangle;
+				hit.geometryIndex = primitive.geometry;
+				hit.hitKind = frontFace ? kHitKindTriangleFrontFace : kHitKindTriangleBackFace;
+				found = true;
+				if (acceptFirstHit)
+				{
+					return true;
+				}
+			}
+		}
+		else
+		{
+			// Nearer child first, the other one is tested again when popped since hit.t may have shrunk
+			uint32_t left = node.firstChildOrPrimitive;
+			float tLeft = ray.intersectBox(mBvh.nodes[left], tMin, hit.t);
+			float tRight = ray.intersectBox(mBvh.nodes[left + 1], tMin, hit.t);
+			if (tLeft != FLT_MAX || tRight != FLT_MAX)
+			{
+				if (tLeft == FLT_MAX || tRight == FLT_MAX)
+				{
+					nodeIndex = tLeft != FLT_MAX ? left : left + 1;
+				}
+				else
+				{
+					nodeIndex = tLeft <= tRight ? left : left + 1;
+					assert(stackSize < kTraversalStackSize);
+					stack[stackSize++] = tLeft <= tRight ? left + 1 : left;
+				}
+				continue;
+			}
+		}
+
+		// Pop the next node that still overlaps the ray
+		for (;;)
+		{
+			if (stackSize == 0)
+			{
+				return found;
+			}
+			nodeIndex = stack[--stackSize];
+			if (ray.intersectBox(mBvh.nodes[nodeIndex], tMin, hit.t) != FLT_MAX)
+			{
+				break;
+			}
+		}
+	}
+}
+
+bool CpuBlas::occluded(const vec3& origin, const vec3& direction, float tMin, float tMax, uint32_t rayFlags, uint32_t instanceFlags, uint32_t& leaf) const
+{
+	if (!mWideBvh.isEmpty())
+	{
+		return mWideBvh.occluded(origin, direction, tMin, tMax, rayFlags, instanceFlags, leaf);
+	}
+	CpuHit hit;
+	hit.t = tMax;
+	return intersect(origin, direction, tMin, rayFlags | kRayFlagAcceptFirstHitAndEndSearch, instanceFlags, hit);
+}
+
+void CpuTlas::build(const TlasInstanceDesc* pDescs, uint32_t numInstances, const CpuBlas* pBlases, uint32_t numBlases, TaskPool* pPool)
+{
+	mInstances.clear();
+	std::vector<BvhBounds> instanceBounds;
+	for (uint32_t i = 0; i < numInstances; i++)
+	{
+		const TlasInstanceDesc& desc = pDescs[i];
+		if (desc.accelerationStructure >= numBlases || pBlases[desc.accelerationStructure].getBounds().isEmpty())
+		{
+			continue;
+		}
+
+		// GLM is column major, the instance rows are the rows of the 3x4 object to world matrix
+		mat4 objectToWorld = transpose(mat4(
+			vec4(desc.transform[0][0], desc.transform[0][1], desc.transform[0][2], desc.transform[0][3]),
+			vec4(desc.transform[1][0], desc.transform[1][1], desc.transform[1][2], desc.transform[1][3]),
+			vec4(desc.transform[2][0], desc.transform[2][1], desc.transform[2][2], desc.transform[2][3]),
+			vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+		mat4 worldToObjectRows = transpose(inverse(objectToWorld));
+
+		Instance instance;
+		instance.worldToObject[0] = worldToObjectRows[0];
+		instance.worldToObject[1] = worldToObjectRows[1];
+		instance.worldToObject[2] = worldToObjectRows[2];
+		instance.pBlas = &pBlases[desc.accelerationStructure];
+		instance.index = i;
+		instance.instanceID = desc.instanceID;
+		instance.mask = desc.instanceMask;
+		instance.contribution = desc.hitGroupIndex;
+		instance.flags = desc.flags;
+		mInstances.push_back(instance);
+
+		// World bounds of the eight corners of the BLAS bounds
+		BvhBounds objectBounds = instance.pBlas->getBounds();
+		BvhBounds worldBounds;
+		for (uint32_t corner = 0; corner < 8; corner++)
+		{
+			vec3 p((corner & 1) ? objectBounds.max.x : objectBounds.min.x, (corner & 2) ? objectBounds.max.y : objectBounds.min.y, (corner & 4) ? objectBounds.max.z : objectBounds.min.z);
+			worldBounds.grow(vec3(objectToWorld * vec4(p, 1.0f)));
+		}
+		instanceBounds.push_back(worldBounds);
+	}
+
+	BvhBuildSettings settings;
+	settings.maxLeafSize = 1;
+	buildBvh(instanceBounds, settings, mBvh, pPool);
+}
+
+bool CpuTlas::acceptsRay(const Instance& instance, uint32_t rayFlags, uint32_t rayMask)
+{
+	if ((instance.mask & rayMask) == 0)
+	{
+		return false;
+	}
+
+	// Every geometry is opaque unless the instance or the ray says otherwise
+	bool opaque = (instance.flags & kInstanceFlagForceNonOpaque) == 0;
+	opaque = (rayFlags & kRayFlagForceOpaque) ? true : (rayFlags & kRayFlagForceNonOpaque) ? false : opaque;
+	return !((opaque && (rayFlags & kRayFlagCullOpaque)) || (!opaque && (rayFlags & kRayFlagCullNonOpaque)));
+}
+
+void CpuTlas::toObjectSpace(const Instance& instance, const CpuRay& ray, vec3& origin, vec3& direction)
+{
+	// The object space direction isn't normalized, so t is the same in both spaces
+	vec4 worldOrigin(ray.origin, 1.0f);
+	origin = vec3(dot(instance.worldToObject[0], worldOrigin), dot(instance.worldToObject[1], worldOrigin), dot(instance.worldToObject[2], worldOrigin));
+	direction = vec3(dot(vec3(instance.worldToObject[0]), ray.direction), dot(vec3(instance.worldToObject[1]), ray.direction), dot(vec3(instance.worldToObject[2]), ray.direction));
+}
+
+bool CpuTlas::traceRay(const CpuRay& ray, uint32_t rayFlags, uint32_t rayMask, CpuHit& hit) const
+{
+	hit = CpuHit();
+	hit.t = ray.tMax;
+	if (mBvh.nodes.empty())
+	{
+		return false;
+	}
+
+	TraversalRay worldRay(ray.origin, ray.direction);
+	uint32_t stack[kTraversalStackSize];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+	if (worldRay.intersectBox(mBvh.nodes[0], ray.tMin, hit.t) == FLT_MAX)
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		const BvhNode& node = mBvh.nodes[nodeIndex];
+		AS_STATS_ADD(nodes, 1);
+		if (node.isLeaf())
+		{
+			for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+			{
+				const Instance& instance = mInstances[mBvh.primitives[p].triangle];
+				if (!acceptsRay(instance, rayFlags, rayMask))
+				{
+					continue;
+				}
+				vec3 origin, direction;
+				toObjectSpace(instance, ray, origin, direction);
+				AS_STATS_ADD(instances, 1);
+				if (instance.pBlas->intersect(origin, direction, ray.tMin, rayFlags, instance.flags, hit))
+				{
+					hit.instanceIndex = instance.index;
+					hit.instanceID = instance.instanceID;
+					hit.instanceContribution = instance.contribution;
+					if (rayFlags & kRayFlagAcceptFirstHitAndEndSearch)
+					{
+						return true;
+					}
+				}
+			}
+		}
+		else
+		{
+			uint32_t left = node.firstChildOrPrimitive;
+			float tLeft = worldRay.intersectBox(mBvh.nodes[left], ray.tMin, hit.t);
+			float tRight = worldRay.intersectBox(mBvh.nodes[left + 1], ray.tMin, hit.t);
+			if (tLeft != FLT_MAX || tRight != FLT_MAX)
+			{
+				if (tLeft == FLT_MAX || tRight == FLT_MAX)
+				{
+					nodeIndex = tLeft != FLT_MAX ? left : left + 1;
+				}
+				else
+				{
+					nodeIndex = tLeft <= tRight ? left : left + 1;
+					assert(stackSize < kTraversalStackSize);
+					stack[stackSize++] = tLeft <= tRight ? left + 1 : left;
+				}
+				continue;
+			}
+		}
+
+		for (;;)
+		{
+			if (stackSize == 0)
+			{
+				return hit.isHit();
+			}
+			nodeIndex = stack[--stackSize];
+			if (worldRay.intersectBox(mBvh.nodes[nodeIndex], ray.tMin, hit.t) != FLT_MAX)
+			{
+				break;
+			}
+		}
+	}
+}
+
+bool CpuTlas::isOccluded(const CpuRay& ray, uint32_t rayFlags, uint32_t rayMask, OccluderCache* pCache) const
+{
+	if (mBvh.nodes.empty())
+	{
+		return false;
+	}
+
+	// The instance of the previous occluder first, starting at its leaf. If it doesn't block the ray the traversal skips it.
+	uint32_t cachedInstance = pCache ? pCache->instance : kCpuNoHit;
+	if (cachedInstance != kCpuNoHit)
+	{
+		const Instance& instance = mInstances[cachedInstance];
+		vec3 origin, direction;
+		toObjectSpace(instance, ray, origin, direction);
+		AS_STATS_ADD(instances, 1);
+		if (acceptsRay(instance, rayFlags, rayMask) && instance.pBlas->occluded(origin, direction, ray.tMin, ray.tMax, rayFlags, instance.flags, pCache->leaf))
+		{
+			return true;
+		}
+	}
+
+	// Children in any order, the first hit ends the search
+	TraversalRay worldRay(ray.origin, ray.direction);
+	uint32_t stack[kTraversalStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const BvhNode& node = mBvh.nodes[stack[--stackSize]];
+		if (worldRay.intersectBox(node, ray.tMin, ray.tMax) == FLT_MAX)
+		{
+			continue;
+		}
+		AS_STATS_ADD(nodes, 1);
+		if (!node.isLeaf())
+		{
+			assert(stackSize + 2 <= kTraversalStackSize);
+			stack[stackSize++] = node.firstChildOrPrimitive + 1;
+			stack[stackSize++] = node.firstChildOrPrimitive;
+			continue;
+		}
+		for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+		{
+			uint32_t instanceIndex = mBvh.primitives[p].triangle;
+			const Instance& instance = mInstances[instanceIndex];
+			if (instanceIndex == cachedInstance || !acceptsRay(instance, rayFlags, rayMask))
+			{
+				continue;
+			}
+			vec3 origin, direction;
+			toObjectSpace(instance, ray, origin, direction);
+			AS_STATS_ADD(instances, 1);
+			uint32_t blasLeaf = kCpuNoHit;
+			if (instance.pBlas->occluded(origin, direction, ray.tMin, ray.tMax, rayFlags, instance.flags, blasLeaf))
+			{
+				if (pCache)
+				{
+					pCache->instance = instanceIndex;
+					pCache->leaf = blasLeaf;
+				}
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void CpuTlas::traceOcclusionRays(const CpuRay* pRays, uint32_t count, uint32_t rayFlags, uint32_t rayMask, uint32_t* pVisible, TaskPool* pPool) const
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	const uint32_t kGrainSize = 32 * 16;
+	pool.parallelForRange(count, kGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		OccluderCache cache;
+		for (uint32_t word = begin; word < end; word += 32)
+		{
+			uint32_t bits = 0;
+			for (uint32_t r = word; r < std::min(word + 32, end); r++)
+			{
+				bits |= isOccluded(pRays[r], rayFlags, rayMask, &cache) ? 0 : 1u << (r - word);
+			}
+			pVisible[word / 32] = bits;
+		}
+	});
+}
+
+// Spreads the low 10 bits of v to every third bit
+static uint32_t expandBits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+/*
+	21-bit Morton code of the origin above a 9-bit Morton code of the direction. The top bit of each direction
+	component is its sign, so rays from one cell are grouped by octant first.
+*/
+static uint32_t getRayCoherenceKey(const CpuRay& ray, const vec3& boundsMin, const vec3& invExtent)
+{
+	vec3 p = clamp((ray.origin - boundsMin) * invExtent, 0.0f, 1.0f) * 127.0f;
+	vec3 d = clamp(ray.direction * 0.5f + 0.5f, 0.0f, 1.0f) * 7.0f;
+	uint32_t origin = (expandBits((uint32_t)p.x) << 2) | (expandBits((uint32_t)p.y) << 1) | expandBits((uint32_t)p.z);
+	uint32_t direction = (expandBits((uint32_t)d.x) << 2) | (expandBits((uint32_t)d.y) << 1) | expandBits((uint32_t)d.z);
+	return origin << 9 | direction;
+}
+
+void CpuTlas::traceOcclusionRaysSorted(const CpuRay* pRays, uint32_t count, uint32_t rayFlags, uint32_t rayMask, uint32_t batchSize, uint32_t* pVisible, TaskPool* pPool) const
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	BvhBounds bounds = getBounds();
+	vec3 invExtent = 1.0f / max(bounds.max - bounds.min, vec3(1e-20f));
+	batchSize = std::max((batchSize + 31) / 32 * 32, 32u);
+	pool.parallelForRange(count, batchSize, [&](uint32_t begin, uint32_t end)
+	{
+		// Key in the high half, ray in the batch in the low half
+		std::vector<uint64_t> order(end - begin);
+		for (uint32_t r = begin; r < end; r++)
+		{
+			order[r - begin] = (uint64_t)getRayCoherenceKey(pRays[r], bounds.min, invExtent) << 32 | (r - begin);
+		}
+		std::sort(order.begin(), order.end());
+
+		std::fill(pVisible + begin / 32, pVisible + (end + 31) / 32, 0u);
+		OccluderCache cache;
+		for (uint64_t key : order)
+		{
+			uint32_t r = begin + (uint32_t)key;
+			if (!isOccluded(pRays[r], rayFlags, rayMask, &cache))
+			{
+				pVisible[r / 32] |= 1u << (r % 32);
+			}
+		}
+	});
+}
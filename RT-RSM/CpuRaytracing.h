@@ -0,0 +1,115 @@
+#pragma once
+#include "CpuRay.h"
+#include "SceneInstances.h"
+#include "WideBvh.h"
+
+///////////////////////////////////////////
+// CPU ray tracing
+///////////////////////////////////////////
+/*
+	Software two-level acceleration structure with the semantics of DXR, so the ray tracing passes can be
+	validated and profiled without a device. The TLAS is built from the same TlasInstanceDesc array that
+	buildTopLevelAS copies into the instance buffer, with accelerationStructure holding the index of the
+	CpuBlas instead of its GPU address. A hit reports what the closest hit shader sees: RayTCurrent(),
+	PrimitiveIndex(), InstanceID(), InstanceIndex(), HitKind() and the triangle barycentrics.
+*/
+
+/*
+	Bottom level: a BVH over one or more geometries, all opaque like the D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE
+	geometries of createBottomLevelAS. Only the MeshViews are kept, the vertex and index data must outlive the BLAS.
+	With wide set, the binary tree is also collapsed into a WideBvh, which intersect then uses.
+*/
+class CpuBlas
+{
+public:
+	void build(const std::vector<MeshView>& geometries, const BvhBuildSettings& settings = BvhBuildSettings(), TaskPool* pPool = nullptr, bool wide = true);
+
+	// BLAS over geometries using a wide tree stored elsewhere, see WideBvh::attach. There is no binary tree, getBvh() is empty.
+	void attach(const std::vector<MeshView>& geometries, const BvhBounds& bounds, const WideBvhNode* pNodes, uint32_t numNodes, const WideBvhTriangles* pTriangles, uint32_t numLeaves);
+	void detach() { mWideBvh.detach(); }
+
+	// Vertex animation: geometries are the built ones with moved vertices, both trees keep their topology, see refitBvh
+	void refit(const std::vector<MeshView>& geometries, TaskPool* pPool = nullptr);
+
+	/*
+		Object space ray against the triangles, with hit.t as the current tMax. Face culling follows the ray
+		and instance flags. Sets t, barycentrics, primitive, geometry and hit kind of a closer hit and returns true if there was one.
+	*/
+	bool intersect(const vec3& origin, const vec3& direction, float tMin, uint32_t rayFlags, uint32_t instanceFlags, CpuHit& hit) const;
+
+	// Any triangle in (tMin, tMax]? leaf as WideBvh::occluded, left alone without a wide tree.
+	bool occluded(const vec3& origin, const vec3& direction, float tMin, float tMax, uint32_t rayFlags, uint32_t instanceFlags, uint32_t& leaf) const;
+
+	const Bvh&		getBvh() const { return mBvh; }
+	const WideBvh&	getWideBvh() const { return mWideBvh; }
+	void		setWideBvhKernel(WideBvhKernel kernel) { mWideBvh.setKernel(kernel); }
+	BvhBounds	getBounds() const { return mBounds; }
+	uint32_t	getNumGeometries() const { return (uint32_t)mGeometries.size(); }
+	const std::vector<MeshView>& getGeometries() const { return mGeometries; }
+
+private:
+	std::vector<MeshView>	mGeometries;
+	Bvh						mBvh;
+	WideBvh					mWideBvh;
+	BvhBounds				mBounds;
+};
+
+/*
+	Top level: a BVH over the world bounds of the instances. The instances keep pointers to the BLASes,
+	which must not move or be rebuilt while the TLAS is in use.
+*/
+class CpuTlas
+{
+public:
+	void build(const TlasInstanceDesc* pDescs, uint32_t numInstances, const CpuBlas* pBlases, uint32_t numBlases, TaskPool* pPool = nullptr);
+
+	// TraceRay: instances with (InstanceMask & rayMask) == 0 are skipped. Returns hit.isHit().
+	bool traceRay(const CpuRay& ray, uint32_t rayFlags, uint32_t rayMask, CpuHit& hit) const;
+
+	// Last occluder of a stream of shadow rays, tested first for the next ray
+	struct OccluderCache
+	{
+		uint32_t	instance = kCpuNoHit;
+		uint32_t	leaf = kCpuNoHit;
+	};
+
+	// Shadow ray: anything between tMin and tMax? Same answer as traceRay with kRayFlagAcceptFirstHitAndEndSearch.
+	bool isOccluded(const CpuRay& ray, uint32_t rayFlags, uint32_t rayMask, OccluderCache* pCache = nullptr) const;
+
+	/*
+		Batched shadow rays, for throughput: bit r of pVisible, (count + 31) / 32 words, is set if nothing blocks ray r.
+		The rays are split over the pool in runs of whole words, each run keeps an OccluderCache, so rays from one shading
+		point next to each other, as RT-RSM's visibility rays are, often stop at the first leaf they test.
+	*/
+	void traceOcclusionRays(const CpuRay* pRays, uint32_t count, uint32_t rayFlags, uint32_t rayMask, uint32_t* pVisible, TaskPool* pPool = nullptr) const;
+
+	/*
+		traceOcclusionRays with a reordering stage: each batch of batchSize rays (rounded up to whole words) is sorted by
+		the Morton code of the origin in the TLAS bounds, then by quantized direction, traced in that order and the
+		results scattered back. Batches are the unit of work on the pool, so very large ones leave threads idle.
+	*/
+	void traceOcclusionRaysSorted(const CpuRay* pRays, uint32_t count, uint32_t rayFlags, uint32_t rayMask, uint32_t batchSize, uint32_t* pVisible, TaskPool* pPool = nullptr) const;
+
+	uint32_t	getNumInstances() const { return (uint32_t)mInstances.size(); }	// non-empty ones
+	const Bvh&	getBvh() const { return mBvh; }
+	BvhBounds	getBounds() const { return mBvh.nodes.empty() ? BvhBounds() : mBvh.nodes[0].getBounds(); }
+
+private:
+	struct Instance
+	{
+		vec4			worldToObject[3];	// rows of the inverse of the 3x4 instance transform
+		const CpuBlas*	pBlas;
+		uint32_t		index;				// in the instance desc array, instances with an empty BLAS are dropped
+		uint32_t		instanceID;
+		uint32_t		mask;
+		uint32_t		contribution;
+		uint32_t		flags;
+	};
+
+	// Mask and the opaque culling flags, which apply to the whole instance as every geometry is opaque
+	static bool acceptsRay(const Instance& instance, uint32_t rayFlags, uint32_t rayMask);
+	static void toObjectSpace(const Instance& instance, const CpuRay& ray, vec3& origin, vec3& direction);
+
+	std::vector<Instance>	mInstances;
+	Bvh						mBvh;
+};
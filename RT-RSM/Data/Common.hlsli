@@ -59,4 +59,48 @@ float3 oct_to_dir(uint octo)
     if (v.z < 0.0)
         v.xy = (1.0 - abs(v.yx)) * (step(0.0, v.xy) * 2.0 - (float2) (1.0));
     return normalize(v);
-}
\ No newline at end of file
+}
+
+//// Vertex streams ///////////////
+// QUANTIZED_VERTICES is defined by the application when the models use the quantized layout (see Model.h).
+// Positions are then 16-bit SNORM relative to the mesh AABB and normals octahedral 2x16, packed like dirToOct.
+#ifdef QUANTIZED_VERTICES
+#define NormalBuffer StructuredBuffer<uint>
+float3 loadNormal(StructuredBuffer<uint> normals, uint index)
+{
+    return oct_to_dir(normals[index]);
+}
+#else
+#define NormalBuffer StructuredBuffer<float3>
+float3 loadNormal(StructuredBuffer<float3> normals, uint index)
+{
+    return normals[index];
+}
+#endif
+
+// scale and bias come from the ModelTransform constant buffer
+float3 decodePosition(float3 position, float4 scale, float4 bias)
+{
+#ifdef QUANTIZED_VERTICES
+    return position * scale.xyz + bias.xyz;
+#else
+    return position;
+#endif
+}
+
+// Vertex indices of one triangle. Meshes with fewer than 65536 vertices have 16-bit index buffers (see IndexOptimizer.h),
+// indexStride (2 or 4) comes from the shader table.
+uint3 loadTriangleIndices(ByteAddressBuffer indices, uint primitive, uint indexStride)
+{
+    if (indexStride == 2)
+    {
+        uint offset = 6 * primitive;
+        uint2 words = indices.Load2(offset & ~3);
+        if (offset & 2)
+        {
+            return uint3(words.x >> 16, words.y & 0xffff, words.y >> 16);
+        }
+        return uint3(words.x & 0xffff, words.x >> 16, words.y & 0xffff);
+    }
+    return indices.Load3(12 * primitive);
+}
@@ -1,3 +1,5 @@
+#include "Common.hlsli"
+
 cbuffer CameraMatrixBuffer : register(b0)
 {
     float4x4 worldToViewCurr;
@@ -9,6 +11,8 @@ cbuffer ModelTransform : register(b1)
 {
     float4x4 modelToWorldCurr;
     float4x4 modelToWorldPrev;
+    float4 positionScale;
+    float4 positionBias;
 };
 
 cbuffer color : register(b2)
@@ -20,7 +24,7 @@ cbuffer color : register(b2)
 };
 
 
-StructuredBuffer<float3> normals : register(t0);
+NormalBuffer normals : register(t0);
 
 struct PSInput
 {
@@ -35,7 +39,7 @@ PSInput VSMain(float3 position : POSITION, uint index : SV_VertexID)
 {
     PSInput vsOutput;
 	// world position
-		float4 positionWorldCurr = float4(position, 1.0);
+		float4 positionWorldCurr = float4(decodePosition(position, positionScale, positionBias), 1.0);
 		positionWorldCurr = mul(modelToWorldCurr, positionWorldCurr);
 		vsOutput.worldPosition = positionWorldCurr;
 	// position screen space
@@ -43,7 +47,7 @@ PSInput VSMain(float3 position : POSITION, uint index : SV_VertexID)
 		positionScreenCurr = mul(projection, positionScreenCurr);
 		vsOutput.positionCurr = positionScreenCurr;
 	// normal
-		float3 normal = normals[index];
+		float3 normal = loadNormal(normals, index);
 		normal = normalize(mul(modelToWorldCurr, float4(normal, 0.0f)).xyz);
 		normal = normal * 0.5 + 0.5;
 		vsOutput.normal = normal;
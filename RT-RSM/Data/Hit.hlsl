@@ -8,8 +8,13 @@ void sampleRay(in float3 hitPoint, in float3 direction, inout RayPayload payload
 
 RaytracingAccelerationStructure gRtScene : register(t0);
 
-StructuredBuffer<uint> indices : register(t1);
-StructuredBuffer<float3> normals : register(t2);
+ByteAddressBuffer indices : register(t1);
+NormalBuffer normals : register(t2);
+
+cbuffer MeshIndexFormat : register(b0, space2)
+{
+    uint indexStride;
+};
 
 cbuffer LightBuffer : register(b0, space1)
 {
@@ -40,10 +45,10 @@ void modelChs(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes
     uint2 pixelCrd = DispatchRaysIndex().xy;
 
 	// get normal
-    uint vertIndex = 3 * PrimitiveIndex();
-    float3 n0 = normals[indices[vertIndex + 0]];
-    float3 n1 = normals[indices[vertIndex + 1]];
-    float3 n2 = normals[indices[vertIndex + 2]];
+    uint3 vertIndices = loadTriangleIndices(indices, PrimitiveIndex(), indexStride);
+    float3 n0 = loadNormal(normals, vertIndices.x);
+    float3 n1 = loadNormal(normals, vertIndices.y);
+    float3 n2 = loadNormal(normals, vertIndices.z);
     float3 normal = n0 * (1 - attribs.barycentrics.x - attribs.barycentrics.y)
 				+ n1 * attribs.barycentrics.x
 				+ n2 * attribs.barycentrics.y;
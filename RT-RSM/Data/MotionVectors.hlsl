@@ -11,6 +11,8 @@ cbuffer ModelTransform : register(b1)
 {
     float4x4 modelToWorldCurr;
     float4x4 modelToWorldPrev;
+    float4 positionScale;
+    float4 positionBias;
 };
 
 Texture2D<float> gDepthCurrent : register(t0);
@@ -33,7 +35,7 @@ PSInput VSMain(float3 position : POSITION, uint index : SV_VertexID)
     PSInput vsOutput;
 
 	// current position screen space
-		float4 positionWorldCurr = float4(position, 1.0);
+		float4 positionWorldCurr = float4(decodePosition(position, positionScale, positionBias), 1.0);
 		positionWorldCurr = mul(modelToWorldCurr, positionWorldCurr);
 		float4 positionScreenCurr = mul(worldToViewCurr, positionWorldCurr);
 		positionScreenCurr = mul(projection, positionScreenCurr);
@@ -43,7 +45,7 @@ PSInput VSMain(float3 position : POSITION, uint index : SV_VertexID)
 		vsOutput.positionCurr = positionScreenCurr;
 
 	// prev position screen space
-		float4 positionWorldPrev = float4(position, 1.0);
+		float4 positionWorldPrev = float4(decodePosition(position, positionScale, positionBias), 1.0);
 		positionWorldPrev = mul(modelToWorldPrev, positionWorldPrev);
 		float4 positionScreenPrev = mul(worldToViewPrev, positionWorldPrev);
 		positionScreenPrev = mul(projection, positionScreenPrev);
@@ -9,6 +9,9 @@ cbuffer LightBuffer : register(b0)
 cbuffer ModelTransform : register(b1)
 {
     float4x4 modelToWorld;
+    float4x4 modelToWorldPrev;
+    float4 positionScale;
+    float4 positionBias;
 };
 
 cbuffer color : register(b2)
@@ -18,7 +21,7 @@ cbuffer color : register(b2)
     float b;
 };
 
-StructuredBuffer<float3> normals : register(t0);
+NormalBuffer normals : register(t0);
 
 struct PSInput
 {
@@ -33,7 +36,7 @@ PSInput VSMain(float3 position : POSITION, uint index : SV_VertexID)
     PSInput vsOutput;
 
 	// position
-    float4 newPosition = float4(position, 1.0);
+    float4 newPosition = float4(decodePosition(position, positionScale, positionBias), 1.0);
 	newPosition = mul(modelToWorld, newPosition);
     vsOutput.worldPosition = newPosition;
     newPosition = mul(worldToView, newPosition);
@@ -41,7 +44,7 @@ PSInput VSMain(float3 position : POSITION, uint index : SV_VertexID)
     vsOutput.position = newPosition;
 
 	// normal
-    float3 normal = normals[index];
+    float3 normal = loadNormal(normals, index);
     normal = normalize(mul(modelToWorld, float4(normal, 0.0f)).xyz);
     normal = normal; // * 0.5 + 0.5;
     vsOutput.normal = normal;
@@ -0,0 +1,172 @@
+#include "FrustumCulling.h"
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define FRUSTUM_CULLING_SSE
+#include <emmintrin.h>
+#endif
+
+void BoundingBoxes::resize(uint32_t count)
+{
+	centerX.resize(count);
+	centerY.resize(count);
+	centerZ.resize(count);
+	extentX.resize(count);
+	extentY.resize(count);
+	extentZ.resize(count);
+}
+
+void BoundingBoxes::set(uint32_t idx, const vec3& center, const vec3& extent)
+{
+	centerX[idx] = center.x;
+	centerY[idx] = center.y;
+	centerZ[idx] = center.z;
+	extentX[idx] = extent.x;
+	extentY[idx] = extent.y;
+	extentZ[idx] = extent.z;
+}
+
+void computeBoundingBox(const vec3* pPositions, uint32_t count, vec3& center, vec3& extent)
+{
+	if (count == 0)
+	{
+		center = vec3(0.0f);
+		extent = vec3(0.0f);
+		return;
+	}
+	vec3 minPos = pPositions[0];
+	vec3 maxPos = pPositions[0];
+	for (uint32_t v = 1; v < count; v++)
+	{
+		minPos = min(minPos, pPositions[v]);
+		maxPos = max(maxPos, pPositions[v]);
+	}
+	center = 0.5f * (minPos + maxPos);
+	extent = 0.5f * (maxPos - minPos);
+}
+
+void transformBoundingBox(const mat4& transform, const vec3& center, const vec3& extent, vec3& outCenter, vec3& outExtent)
+{
+	outCenter = vec3(transform * vec4(center, 1.0f));
+	mat3 absRotation(abs(vec3(transform[0])), abs(vec3(transform[1])), abs(vec3(transform[2])));
+	outExtent = absRotation * extent;
+}
+
+static vec4 getRow(const mat4& m, int row)
+{
+	return vec4(m[0][row], m[1][row], m[2][row], m[3][row]);
+}
+
+Frustum extractFrustum(const mat4& viewProj)
+{
+	// Gribb and Hartmann: -w <= x <= w, -w <= y <= w, 0 <= z <= w
+	vec4 x = getRow(viewProj, 0);
+	vec4 y = getRow(viewProj, 1);
+	vec4 z = getRow(viewProj, 2);
+	vec4 w = getRow(viewProj, 3);
+
+	Frustum frustum;
+	frustum.planes[0] = w + x;
+	frustum.planes[1] = w - x;
+	frustum.planes[2] = w + y;
+	frustum.planes[3] = w - y;
+	frustum.planes[4] = z;
+	frustum.planes[5] = w - z;
+	for (vec4& plane : frustum.planes)
+	{
+		plane /= length(vec3(plane));
+	}
+	return frustum;
+}
+
+// Signed distance of the centre plus the projected extent, negative if the box is completely outside the plane
+static bool isOutside(const vec4& plane, float cx, float cy, float cz, float ex, float ey, float ez)
+{
+	float distance = plane.x * cx + plane.y * cy + plane.z * cz + plane.w;
+	float radius = std::abs(plane.x) * ex + std::abs(plane.y) * ey + std::abs(plane.z) * ez;
+	return distance + radius < 0.0f;
+}
+
+static bool isOutside(const Frustum& frustum, const BoundingBoxes& boxes, uint32_t b)
+{
+	bool outside = false;
+	for (const vec4& plane : frustum.planes)
+	{
+		outside = outside || isOutside(plane, boxes.centerX[b], boxes.centerY[b], boxes.centerZ[b], boxes.extentX[b], boxes.extentY[b], boxes.extentZ[b]);
+	}
+	return outside;
+}
+
+uint32_t cullBoxesScalar(const Frustum& frustum, const BoundingBoxes& boxes, uint32_t* pVisible)
+{
+	uint32_t numVisible = 0;
+	for (uint32_t b = 0; b < boxes.size(); b++)
+	{
+		if (!isOutside(frustum, boxes, b))
+		{
+			pVisible[numVisible++] = b;
+		}
+	}
+	return numVisible;
+}
+
+uint32_t cullBoxes(const Frustum& frustum, const BoundingBoxes& boxes, uint32_t* pVisible)
+{
+	uint32_t numBoxes = boxes.size();
+	uint32_t numVisible = 0;
+	uint32_t b = 0;
+
+#ifdef FRUSTUM_CULLING_SSE
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+	for (int p = 0; p < 6; p++)
+	{
+		const vec4& plane = frustum.planes[p];
+		planeX[p] = _mm_set1_ps(plane.x);
+		planeY[p] = _mm_set1_ps(plane.y);
+		planeZ[p] = _mm_set1_ps(plane.z);
+		planeW[p] = _mm_set1_ps(plane.w);
+		absX[p] = _mm_set1_ps(std::abs(plane.x));
+		absY[p] = _mm_set1_ps(std::abs(plane.y));
+		absZ[p] = _mm_set1_ps(std::abs(plane.z));
+	}
+	const __m128 zero = _mm_setzero_ps();
+
+	// Four boxes at a time, same operations in the same order as isOutside
+	for (; b + 4 <= numBoxes; b += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&boxes.centerX[b]);
+		__m128 cy = _mm_loadu_ps(&boxes.centerY[b]);
+		__m128 cz = _mm_loadu_ps(&boxes.centerZ[b]);
+		__m128 ex = _mm_loadu_ps(&boxes.extentX[b]);
+		__m128 ey = _mm_loadu_ps(&boxes.extentY[b]);
+		__m128 ez = _mm_loadu_ps(&boxes.extentZ[b]);
+
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)), _mm_mul_ps(planeZ[p], cz)), planeW[p]);
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		// Compact the visible lanes
+		int visibleMask = ~_mm_movemask_ps(outside) & 0xf;
+		while (visibleMask != 0)
+		{
+			int lane = visibleMask & 1 ? 0 : visibleMask & 2 ? 1 : visibleMask & 4 ? 2 : 3;
+			pVisible[numVisible++] = b + lane;
+			visibleMask &= visibleMask - 1;
+		}
+	}
+#endif
+
+	// Remainder, or everything without SSE
+	for (; b < numBoxes; b++)
+	{
+		if (!isOutside(frustum, boxes, b))
+		{
+			pVisible[numVisible++] = b;
+		}
+	}
+	return numVisible;
+}
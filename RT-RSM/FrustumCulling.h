@@ -0,0 +1,48 @@
+#pragma once
+#include "MeshData.h"
+
+///////////////////////////////////////////
+// Frustum culling
+///////////////////////////////////////////
+/*
+	Axis aligned boxes as structure of arrays (centre and half extent), so the kernel can test four
+	boxes per iteration with SSE. The same layout is used for the world bounds of every Model.
+*/
+struct BoundingBoxes
+{
+	std::vector<float>	centerX, centerY, centerZ;
+	std::vector<float>	extentX, extentY, extentZ;
+
+	uint32_t size() const { return (uint32_t)centerX.size(); }
+	void resize(uint32_t count);
+	void set(uint32_t idx, const vec3& center, const vec3& extent);
+	vec3 getCenter(uint32_t idx) const { return vec3(centerX[idx], centerY[idx], centerZ[idx]); }
+	vec3 getExtent(uint32_t idx) const { return vec3(extentX[idx], extentY[idx], extentZ[idx]); }
+};
+
+// Box around the positions, as centre and half extent
+void computeBoundingBox(const vec3* pPositions, uint32_t count, vec3& center, vec3& extent);
+
+// Box that contains the transformed box (Arvo's method)
+void transformBoundingBox(const mat4& transform, const vec3& center, const vec3& extent, vec3& outCenter, vec3& outExtent);
+
+/*
+	Six planes (xyz normal pointing inside, w distance) of a view-projection matrix with D3D clip space, 0 <= z <= w.
+	Order: left, right, bottom, top, near, far.
+*/
+struct Frustum
+{
+	vec4 planes[6];
+};
+
+Frustum extractFrustum(const mat4& viewProj);
+
+/*
+	Write the indices of all boxes that intersect or are inside the frustum to pVisible, in increasing order,
+	and return how many there are. pVisible needs room for boxes.size() entries.
+	A box is only culled if it is completely outside one of the planes, so boxes near a corner may be kept.
+*/
+uint32_t cullBoxes(const Frustum& frustum, const BoundingBoxes& boxes, uint32_t* pVisible);
+
+// Reference implementation, same test one box at a time
+uint32_t cullBoxesScalar(const Frustum& frustum, const BoundingBoxes& boxes, uint32_t* pVisible);
@@ -0,0 +1,185 @@
+#include "GeometryAllocator.h"
+#include <algorithm>
+#include <iterator>
+#include <stdio.h>
+
+GeometryAllocator::GeometryAllocator(uint64_t capacity)
+{
+	reset(capacity);
+}
+
+void GeometryAllocator::reset(uint64_t capacity)
+{
+	mCapacity = capacity;
+	mFreeBlocks.clear();
+	mBlocks.clear();
+	mFreeIds.clear();
+	if (capacity > 0)
+	{
+		mFreeBlocks[0] = capacity;
+	}
+}
+
+bool GeometryAllocator::allocate(uint64_t size, uint64_t alignment, GeometryAllocation& allocation)
+{
+	alignment = std::max<uint64_t>(alignment, 1);
+	size = std::max<uint64_t>(size, 1);
+
+	// Best fit: the smallest free block the aligned range fits in
+	auto best = mFreeBlocks.end();
+	for (auto it = mFreeBlocks.begin(); it != mFreeBlocks.end(); ++it)
+	{
+		uint64_t offset = alignUp(it->first, alignment);
+		if (offset + size <= it->first + it->second && (best == mFreeBlocks.end() || it->second < best->second))
+		{
+			best = it;
+		}
+	}
+	if (best == mFreeBlocks.end())
+	{
+		return false;
+	}
+
+	uint64_t start = best->first;
+	uint64_t end = start + best->second;
+	uint64_t offset = alignUp(start, alignment);
+	mFreeBlocks.erase(best);
+	if (offset + size < end)
+	{
+		mFreeBlocks[offset + size] = end - offset - size;
+	}
+
+	uint32_t id;
+	if (!mFreeIds.empty())
+	{
+		id = mFreeIds.back();
+		mFreeIds.pop_back();
+	}
+	else
+	{
+		id = (uint32_t)mBlocks.size();
+		mBlocks.push_back(Block());
+	}
+
+	Block& block = mBlocks[id];
+	block.start = start;
+	block.offset = offset;
+	block.size = size;
+	block.alignment = alignment;
+	block.live = true;
+
+	allocation.id = id;
+	allocation.offset = offset;
+	allocation.size = size;
+	return true;
+}
+
+void GeometryAllocator::free(uint32_t id)
+{
+	if (id >= mBlocks.size() || !mBlocks[id].live)
+	{
+		return;
+	}
+	Block& block = mBlocks[id];
+	block.live = false;
+	addFreeBlock(block.start, block.offset + block.size - block.start);
+	mFreeIds.push_back(id);
+}
+
+void GeometryAllocator::addFreeBlock(uint64_t start, uint64_t size)
+{
+	auto next = mFreeBlocks.lower_bound(start);
+
+	// Merge with the following block
+	if (next != mFreeBlocks.end() && next->first == start + size)
+	{
+		size += next->second;
+		next = mFreeBlocks.erase(next);
+	}
+
+	// Merge with the preceding block
+	if (next != mFreeBlocks.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == start)
+		{
+			prev->second += size;
+			return;
+		}
+	}
+	mFreeBlocks[start] = size;
+}
+
+GeometryAllocatorStats GeometryAllocator::getStats() const
+{
+	GeometryAllocatorStats stats;
+	stats.capacity = mCapacity;
+	for (const Block& block : mBlocks)
+	{
+		if (block.live)
+		{
+			stats.usedBytes += block.size;
+			stats.paddingBytes += block.offset - block.start;
+			stats.numAllocations++;
+		}
+	}
+	for (const auto& freeBlock : mFreeBlocks)
+	{
+		stats.freeBytes += freeBlock.second;
+		stats.largestFreeBlock = std::max(stats.largestFreeBlock, freeBlock.second);
+		stats.numFreeBlocks++;
+	}
+	return stats;
+}
+
+std::string GeometryAllocator::getReport() const
+{
+	GeometryAllocatorStats stats = getStats();
+	char line[256];
+	snprintf(line, sizeof(line), "%u allocations, %.2f / %.2f MB used, %.1f KB alignment padding, %.2f MB free in %u blocks (largest %.2f MB, fragmentation %.1f%%)",
+		stats.numAllocations,
+		stats.usedBytes / (1024.0 * 1024.0),
+		stats.capacity / (1024.0 * 1024.0),
+		stats.paddingBytes / 1024.0,
+		stats.freeBytes / (1024.0 * 1024.0),
+		stats.numFreeBlocks,
+		stats.largestFreeBlock / (1024.0 * 1024.0),
+		100.0f * stats.getFragmentation());
+	return line;
+}
+
+std::vector<GeometryMove> GeometryAllocator::defragment()
+{
+	std::vector<uint32_t> order;
+	for (uint32_t id = 0; id < (uint32_t)mBlocks.size(); id++)
+	{
+		if (mBlocks[id].live)
+		{
+			order.push_back(id);
+		}
+	}
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return mBlocks[a].offset < mBlocks[b].offset; });
+
+	// Allocations only ever move towards the start, so copying them in this order never overwrites live data
+	std::vector<GeometryMove> moves;
+	uint64_t cursor = 0;
+	for (uint32_t id : order)
+	{
+		Block& block = mBlocks[id];
+		uint64_t offset = alignUp(cursor, block.alignment);
+		if (offset != block.offset)
+		{
+			moves.push_back({ id, block.offset, offset, block.size });
+		}
+		block.start = cursor;
+		block.offset = offset;
+		cursor = offset + block.size;
+	}
+
+	mFreeBlocks.clear();
+	if (cursor < mCapacity)
+	{
+		mFreeBlocks[cursor] = mCapacity - cursor;
+	}
+	return moves;
+}
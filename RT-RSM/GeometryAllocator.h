@@ -0,0 +1,93 @@
+#pragma once
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+static const uint32_t kInvalidGeometryAllocation = 0xffffffff;
+
+// Size of one geometry arena buffer. Larger requests get a page of their own.
+static const uint64_t kGeometryArenaPageSize = 64 * 1024 * 1024;
+
+// Vertex, normal and index data only need 4-byte alignment for the IA, DXR and raw SRVs. 16 keeps vec4 loads aligned.
+static const uint64_t kGeometryAlignment = 16;
+
+// Every committed resource is placed at this alignment (D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT)
+static const uint64_t kCommittedResourceAlignment = 64 * 1024;
+
+inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+struct GeometryAllocation
+{
+	uint32_t	id = kInvalidGeometryAllocation;
+	uint64_t	offset = 0;		// aligned start of the range
+	uint64_t	size = 0;
+};
+
+struct GeometryAllocatorStats
+{
+	uint64_t	capacity = 0;
+	uint64_t	usedBytes = 0;			// sum of the requested sizes
+	uint64_t	paddingBytes = 0;		// lost to alignment in front of allocations
+	uint64_t	freeBytes = 0;
+	uint64_t	largestFreeBlock = 0;
+	uint32_t	numFreeBlocks = 0;
+	uint32_t	numAllocations = 0;
+
+	// 0 when all free memory is one block, close to 1 when it is split into many small ones
+	float getFragmentation() const { return freeBytes > 0 ? 1.0f - (float)largestFreeBlock / (float)freeBytes : 0.0f; }
+};
+
+// One allocation that defragment() moved. Copying the moves in order is safe even if the ranges overlap (use memmove).
+struct GeometryMove
+{
+	uint32_t	id;
+	uint64_t	srcOffset;
+	uint64_t	dstOffset;
+	uint64_t	size;
+};
+
+/*
+	Offset allocator for the geometry arena. It only manages [0, capacity) ranges and never touches memory,
+	so the same logic works for any buffer and can be tested on the CPU.
+	Best fit over an offset ordered free list, neighbouring free blocks are merged on free().
+*/
+class GeometryAllocator
+{
+public:
+	explicit GeometryAllocator(uint64_t capacity = 0);
+	void reset(uint64_t capacity);
+
+	// alignment must be a power of two. Returns false if no free block is large enough.
+	bool allocate(uint64_t size, uint64_t alignment, GeometryAllocation& allocation);
+	void free(uint32_t id);
+
+	// Offsets change when defragmenting, so users that keep allocations around should look them up again
+	uint64_t getOffset(uint32_t id) const { return mBlocks[id].offset; }
+	uint64_t getCapacity() const { return mCapacity; }
+	GeometryAllocatorStats getStats() const;
+	std::string getReport() const;
+
+	// Pack all allocations to the start of the range, in offset order, and return what has to be copied
+	std::vector<GeometryMove> defragment();
+
+private:
+	struct Block
+	{
+		uint64_t	start = 0;		// start of the block including the alignment padding
+		uint64_t	offset = 0;
+		uint64_t	size = 0;
+		uint64_t	alignment = 1;
+		bool		live = false;
+	};
+
+	void addFreeBlock(uint64_t start, uint64_t size);
+
+	uint64_t					mCapacity = 0;
+	std::map<uint64_t, uint64_t> mFreeBlocks;	// start -> size
+	std::vector<Block>			mBlocks;		// indexed by allocation id
+	std::vector<uint32_t>		mFreeIds;
+};
@@ -0,0 +1,119 @@
+#include "GeometryArena.h"
+
+static const D3D12_HEAP_PROPERTIES kUploadHeapProps =
+{
+	D3D12_HEAP_TYPE_UPLOAD,
+	D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+	D3D12_MEMORY_POOL_UNKNOWN,
+	0,
+	0,
+};
+
+void GeometryArena::init(ID3D12Device5Ptr pDevice, uint64_t pageSize)
+{
+	mpDevice = pDevice;
+	mPageSize = pageSize;
+	mPages.clear();
+	mCommittedEquivalentSize = 0;
+}
+
+uint32_t GeometryArena::addPage(uint64_t size)
+{
+	D3D12_RESOURCE_DESC bufDesc = {};
+	bufDesc.Alignment = 0;
+	bufDesc.DepthOrArraySize = 1;
+	bufDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+	bufDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
+	bufDesc.Format = DXGI_FORMAT_UNKNOWN;
+	bufDesc.Height = 1;
+	bufDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+	bufDesc.MipLevels = 1;
+	bufDesc.SampleDesc.Count = 1;
+	bufDesc.SampleDesc.Quality = 0;
+	bufDesc.Width = size;
+
+	Page page;
+	d3d_call(mpDevice->CreateCommittedResource(&kUploadHeapProps, D3D12_HEAP_FLAG_NONE, &bufDesc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&page.pBuffer)));
+	page.pBuffer->SetName((L"Geometry arena page " + std::to_wstring(mPages.size())).c_str());
+
+	// Upload heap buffers can stay mapped for their whole lifetime
+	d3d_call(page.pBuffer->Map(0, nullptr, (void**)&page.pData));
+	page.allocator.reset(size);
+
+	mPages.push_back(page);
+	return (uint32_t)mPages.size() - 1;
+}
+
+GeometryRange GeometryArena::allocate(uint64_t size, uint64_t alignment)
+{
+	GeometryRange range;
+	GeometryAllocation allocation;
+
+	uint32_t pageIndex = 0;
+	while (pageIndex < mPages.size() && !mPages[pageIndex].allocator.allocate(size, alignment, allocation))
+	{
+		pageIndex++;
+	}
+	if (pageIndex == mPages.size())
+	{
+		pageIndex = addPage(std::max(mPageSize, alignUp(size, kCommittedResourceAlignment)));
+		if (!mPages[pageIndex].allocator.allocate(size, alignment, allocation))
+		{
+			msgBox("Geometry arena: failed to allocate " + std::to_string(size) + " bytes");
+			return range;
+		}
+	}
+
+	const Page& page = mPages[pageIndex];
+	range.page = pageIndex;
+	range.allocation = allocation.id;
+	range.offset = allocation.offset;
+	range.size = allocation.size;
+	range.gpuAddress = page.pBuffer->GetGPUVirtualAddress() + allocation.offset;
+	range.pCpuData = page.pData + allocation.offset;
+
+	mCommittedEquivalentSize += alignUp(allocation.size, kCommittedResourceAlignment);
+	return range;
+}
+
+GeometryRange GeometryArena::upload(const void* pData, uint64_t size, uint64_t alignment)
+{
+	GeometryRange range = allocate(size, alignment);
+	if (range.isValid())
+	{
+		memcpy(range.pCpuData, pData, (size_t)size);
+	}
+	return range;
+}
+
+void GeometryArena::free(const GeometryRange& range)
+{
+	if (!range.isValid() || range.page >= mPages.size())
+	{
+		return;
+	}
+	mPages[range.page].allocator.free(range.allocation);
+	mCommittedEquivalentSize -= alignUp(range.size, kCommittedResourceAlignment);
+}
+
+std::string GeometryArena::getReport() const
+{
+	std::string report;
+	uint64_t arenaSize = 0;
+	uint64_t usedSize = 0;
+	for (uint32_t i = 0; i < (uint32_t)mPages.size(); i++)
+	{
+		report += "Geometry arena page " + std::to_string(i) + ": " + mPages[i].allocator.getReport() + "\n";
+		arenaSize += mPages[i].allocator.getCapacity();
+		usedSize += mPages[i].allocator.getStats().usedBytes;
+	}
+
+	char line[256];
+	snprintf(line, sizeof(line), "Geometry arena: %.2f MB in %u buffers for %.2f MB of data, committed resources would take %.2f MB (%.2f MB alignment waste)",
+		arenaSize / (1024.0 * 1024.0),
+		(uint32_t)mPages.size(),
+		usedSize / (1024.0 * 1024.0),
+		mCommittedEquivalentSize / (1024.0 * 1024.0),
+		(mCommittedEquivalentSize - usedSize) / (1024.0 * 1024.0));
+	return report + line;
+}
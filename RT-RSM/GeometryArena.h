@@ -0,0 +1,55 @@
+#pragma once
+#include "Framework.h"
+#include "GeometryAllocator.h"
+
+/*
+	A sub-range of one of the arena buffers. The buffers live on the upload heap and stay mapped,
+	so pCpuData can be written at any time.
+*/
+struct GeometryRange
+{
+	uint32_t					page = 0;
+	uint32_t					allocation = kInvalidGeometryAllocation;
+	uint64_t					offset = 0;
+	uint64_t					size = 0;
+	D3D12_GPU_VIRTUAL_ADDRESS	gpuAddress = 0;
+	uint8_t*					pCpuData = nullptr;
+
+	bool isValid() const { return allocation != kInvalidGeometryAllocation; }
+};
+
+/*
+	Geometry arena: a few large buffers that all vertex, index, normal, colour and transform data of the
+	models is sub-allocated from, instead of one committed resource (and 64KB of alignment) per buffer.
+*/
+class GeometryArena
+{
+public:
+	void init(ID3D12Device5Ptr pDevice, uint64_t pageSize = kGeometryArenaPageSize);
+
+	GeometryRange allocate(uint64_t size, uint64_t alignment = kGeometryAlignment);
+	GeometryRange upload(const void* pData, uint64_t size, uint64_t alignment = kGeometryAlignment);
+	void free(const GeometryRange& range);
+
+	// Per page allocator stats, and how much memory a committed resource per allocation would have taken
+	std::string getReport() const;
+
+	// The buffers the ranges are in, a page per buffer
+	uint32_t			getNumPages() const { return (uint32_t)mPages.size(); }
+	ID3D12ResourcePtr	getPageBuffer(uint32_t page) const { return mPages[page].pBuffer; }
+
+private:
+	struct Page
+	{
+		ID3D12ResourcePtr	pBuffer;
+		uint8_t*			pData = nullptr;
+		GeometryAllocator	allocator;
+	};
+
+	uint32_t addPage(uint64_t size);
+
+	ID3D12Device5Ptr	mpDevice;
+	uint64_t			mPageSize = kGeometryArenaPageSize;
+	std::vector<Page>	mPages;
+	uint64_t			mCommittedEquivalentSize = 0;
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+static const uint64_t kHashSeed = 0xcbf29ce484222325ull;
+
+// 64-bit FNV-1a, consuming 8 bytes per step. Not cryptographic, only used as a content key.
+inline uint64_t hashBytes(const void* pData, size_t size, uint64_t hash = kHashSeed)
+{
+	const uint64_t prime = 0x100000001b3ull;
+	const uint8_t* pBytes = (const uint8_t*)pData;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, pBytes + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < size; i++)
+	{
+		hash = (hash ^ pBytes[i]) * prime;
+	}
+	return hash;
+}
+
+template<typename T>
+inline uint64_t hashValue(const T& value, uint64_t hash = kHashSeed)
+{
+	return hashBytes(&value, sizeof(T), hash);
+}
@@ -0,0 +1,189 @@
+#include "Benchmark.h"
+#include "CpuFrameScene.h"
+#include "Externals/GLM/glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HEADLESS_MODEL_IMPORT
+#include "MeshCache.h"
+#endif
+
+/*
+	Renders CpuFrame, the software version of RtRsm::onFrameRender, without a window or a device. The scene is a
+	built-in one, or a model file if the driver was built with Assimp. The camera turns a little every frame so the
+	temporal filter has something to reproject. Prints the time of every pass and writes the buffers of the last frame
+	with CpuFrame::save. Returns 0 if the frames rendered, something was drawn and the files were written.
+	Built with Assimp it also runs the CPU benchmarks of Benchmark.h on request.
+*/
+static void printUsage()
+{
+	printf("Usage: rtrsm_headless [options]\n"
+		"  -size <width> <height>  frame size, 480 270 by default\n"
+		"  -frames <count>         frames to render, 4 by default\n"
+		"  -threads <count>        threads of the task pool, at least 2, all hardware threads by default\n"
+		"  -out <prefix>           prefix of the written buffers, headless by default\n"
+		"  -model <file>           render a model instead of the built-in scene, needs Assimp\n"
+		"  -benchmarks             run the CPU benchmarks instead, needs Assimp\n");
+}
+
+// Time of every pass of one frame in ms: TLAS, G-buffer, RSM, rays, temporal, spatial, tone mapping
+static void renderTimedFrame(CpuFrame& frame, const CpuFrameDesc& desc, double times[7])
+{
+	BenchmarkTimer timer;
+	frame.beginFrame(desc);
+	times[0] = timer.getElapsedMs();
+	timer.reset();
+	frame.renderGeometryBuffer();
+	times[1] = timer.getElapsedMs();
+	timer.reset();
+	frame.renderShadowMap();
+	times[2] = timer.getElapsedMs();
+	timer.reset();
+	frame.rayTrace();
+	times[3] = timer.getElapsedMs();
+	timer.reset();
+	frame.applyTemporalFilter();
+	times[4] = timer.getElapsedMs();
+	timer.reset();
+	frame.applySpatialFilter();
+	times[5] = timer.getElapsedMs();
+	timer.reset();
+	frame.applyToneMapping();
+	times[6] = timer.getElapsedMs();
+	frame.endFrame();
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t width = 480;
+	uint32_t height = 270;
+	uint32_t numFrames = 4;
+	uint32_t numThreads = 0;
+	const char* pPrefix = "headless";
+	const char* pModel = nullptr;
+	for (int a = 1; a < argc; a++)
+	{
+		if (strcmp(argv[a], "-size") == 0 && a + 2 < argc)
+		{
+			width = (uint32_t)atoi(argv[++a]);
+			height = (uint32_t)atoi(argv[++a]);
+		}
+		else if (strcmp(argv[a], "-frames") == 0 && a + 1 < argc)
+		{
+			numFrames = (uint32_t)atoi(argv[++a]);
+		}
+		else if (strcmp(argv[a], "-threads") == 0 && a + 1 < argc)
+		{
+			numThreads = (uint32_t)atoi(argv[++a]);
+		}
+		else if (strcmp(argv[a], "-out") == 0 && a + 1 < argc)
+		{
+			pPrefix = argv[++a];
+		}
+		else if (strcmp(argv[a], "-model") == 0 && a + 1 < argc)
+		{
+			pModel = argv[++a];
+		}
+		else if (strcmp(argv[a], "-benchmarks") == 0)
+		{
+#ifdef HEADLESS_MODEL_IMPORT
+			runCpuBenchmarks();
+			return 0;
+#else
+			printf("rtrsm_headless was built without Assimp, -benchmarks is not available\n");
+			return 1;
+#endif
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (width == 0 || height == 0 || numFrames == 0 || numThreads == 1)
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::vector<MeshView> views;
+	std::vector<MeshData> testMeshes;
+#ifdef HEADLESS_MODEL_IMPORT
+	Assimp::Importer importer;
+	MeshCache cache;
+#endif
+	if (pModel)
+	{
+#ifdef HEADLESS_MODEL_IMPORT
+		if (!cache.load(&importer, pModel, kMultipleMeshProcessFlags))
+		{
+			printf("Failed to import %s\n", pModel);
+			return 1;
+		}
+		for (uint32_t i = 0; i < cache.getNumMeshes(); i++)
+		{
+			views.push_back(cache.getMesh(i));
+		}
+#else
+		printf("rtrsm_headless was built without Assimp, -model is not available\n");
+		return 1;
+#endif
+	}
+	else
+	{
+		createTestMeshes(testMeshes);
+		for (const MeshData& mesh : testMeshes)
+		{
+			views.push_back(mesh.view());
+		}
+	}
+
+	CpuFrameScene scene;
+	if (!setupCpuFrameScene(views, width, height, scene))
+	{
+		printf("%s has no vertices\n", pModel ? pModel : "The scene");
+		return 1;
+	}
+
+	std::unique_ptr<TaskPool> pPool(numThreads ? new TaskPool(numThreads - 1) : nullptr);
+	TaskPool* pFramePool = pPool ? pPool.get() : &TaskPool::getGlobal();
+	BenchmarkTimer timer;
+	CpuFrame frame;
+	frame.setScene(scene.meshes, pFramePool);
+	printf("%s, %u meshes, %ux%u, RSM %u, %u threads, BLAS builds %.1f ms\n", pModel ? pModel : "Built-in scene", (uint32_t)scene.meshes.size(),
+		width, height, scene.desc.rsmSize, pFramePool->getNumThreads(), timer.getElapsedMs());
+
+	CpuFrameDesc desc = scene.desc;
+	for (uint32_t f = 0; f < numFrames; f++)
+	{
+		desc.frameCount = (int)f;
+		desc.view = lookAtLH(scene.eye, scene.target + vec3(0.0f, 0.0f, 0.005f * f * scene.size.x), vec3(0.0f, 1.0f, 0.0f));
+		double times[7];
+		renderTimedFrame(frame, desc, times);
+
+		uint32_t numDrawn = 0;
+		uint32_t numAccepted = 0;
+		for (const vec4& motionVector : frame.getMotionVectors().texels)
+		{
+			numDrawn += motionVector.w != 0.0f ? 1 : 0;
+			numAccepted += motionVector.z != 0.0f ? 1 : 0;
+		}
+		printf("frame %u: TLAS %.1f  G-buffer %.1f  RSM %.1f  rays %.1f  temporal %.1f  spatial %.1f  tone mapping %.1f ms, %.1f%% of %u drawn pixels reprojected\n",
+			f, times[0], times[1], times[2], times[3], times[4], times[5], times[6], 100.0 * numAccepted / std::max(numDrawn, 1u), numDrawn);
+		if (numDrawn == 0)
+		{
+			printf("Nothing was drawn\n");
+			return 1;
+		}
+	}
+
+	if (!frame.save(pPrefix))
+	{
+		printf("Failed to write %s_*\n", pPrefix);
+		return 1;
+	}
+	printf("Wrote %s_*.pfm and %s_output.ppm\n", pPrefix, pPrefix);
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include "IndexOptimizer.h"
+#include <algorithm>
+
+static const uint32_t kUnusedVertex = 0xffffffff;
+
+VertexCacheStats simulateVertexCache(const uint32_t* pIndices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats;
+	stats.cacheSize = cacheSize;
+	stats.triangleCount = indexCount / 3;
+
+	// A vertex is in the FIFO if it was pushed less than cacheSize misses ago
+	std::vector<uint32_t> pushTime(vertexCount, 0);
+	std::vector<bool> used(vertexCount, false);
+	uint32_t time = cacheSize + 1;
+	for (uint32_t i = 0; i < stats.triangleCount * 3; i++)
+	{
+		uint32_t v = pIndices[i];
+		if (!used[v])
+		{
+			used[v] = true;
+			stats.vertexCount++;
+		}
+		if (time - pushTime[v] > cacheSize)
+		{
+			pushTime[v] = time++;
+			stats.transformCount++;
+		}
+	}
+	return stats;
+}
+
+/*
+	Tipsify: fan around the current vertex, emitting all of its remaining triangles, then continue with the
+	vertex that will still be in the cache after its own fan is emitted and has been in it the longest.
+	If no candidate qualifies, take the most recently touched vertex that still has triangles (the dead-end
+	stack) or the next one in input order.
+*/
+void optimizeVertexCache(uint32_t* pIndices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+	uint32_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || vertexCount == 0)
+	{
+		return;
+	}
+
+	// Vertex to triangle adjacency, as offsets into one array
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		liveTriangles[pIndices[i]]++;
+	}
+	std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+	}
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		adjacency[fill[pIndices[i]]++] = i / 3;
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	uint32_t time = cacheSize + 1;
+	uint32_t cursor = 0;
+	uint32_t fanVertex = 0;
+	while (fanVertex != kUnusedVertex)
+	{
+		candidates.clear();
+		for (uint32_t a = adjacencyOffset[fanVertex]; a < adjacencyOffset[fanVertex + 1]; a++)
+		{
+			uint32_t t = adjacency[a];
+			if (emitted[t])
+			{
+				continue;
+			}
+			emitted[t] = true;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t v = pIndices[3 * t + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > cacheSize)
+				{
+					cacheTime[v] = time++;
+				}
+			}
+		}
+
+		// Best candidate: still cached after emitting its own fan (up to two new vertices per triangle), oldest first
+		fanVertex = kUnusedVertex;
+		int bestPriority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (liveTriangles[v] == 0)
+			{
+				continue;
+			}
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+			{
+				priority = (int)(time - cacheTime[v]);
+			}
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanVertex = v;
+			}
+		}
+
+		while (fanVertex == kUnusedVertex && !deadEnd.empty())
+		{
+			uint32_t v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[v] > 0)
+			{
+				fanVertex = v;
+			}
+		}
+		while (fanVertex == kUnusedVertex && cursor < vertexCount)
+		{
+			if (liveTriangles[cursor] > 0)
+			{
+				fanVertex = cursor;
+			}
+			cursor++;
+		}
+	}
+
+	std::copy(output.begin(), output.end(), pIndices);
+}
+
+void optimizeVertexFetch(MeshData& mesh)
+{
+	uint32_t vertexCount = (uint32_t)mesh.positions.size();
+	std::vector<uint32_t> remap(vertexCount, kUnusedVertex);
+	uint32_t newCount = 0;
+	for (uint32_t& index : mesh.indices)
+	{
+		if (remap[index] == kUnusedVertex)
+		{
+			remap[index] = newCount++;
+		}
+		index = remap[index];
+	}
+
+	std::vector<vec3> positions(newCount);
+	std::vector<vec3> normals(newCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] != kUnusedVertex)
+		{
+			positions[remap[v]] = mesh.positions[v];
+			normals[remap[v]] = mesh.normals[v];
+		}
+	}
+	mesh.positions.swap(positions);
+	mesh.normals.swap(normals);
+}
+
+void optimizeMesh(MeshData& mesh)
+{
+	optimizeVertexCache(mesh.indices.data(), (uint32_t)mesh.indices.size(), (uint32_t)mesh.positions.size());
+	optimizeVertexFetch(mesh);
+}
+
+void convertToShortIndices(const uint32_t* pIndices, uint32_t count, uint16_t* pDst)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		pDst[i] = (uint16_t)pIndices[i];
+	}
+}
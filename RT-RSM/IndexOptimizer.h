@@ -0,0 +1,49 @@
+#pragma once
+#include "MeshData.h"
+
+///////////////////////////////////////////
+// Index buffer optimization
+///////////////////////////////////////////
+/*
+	Runs once at import (see importScene), so the mesh cache already stores the optimized order.
+	Triangles are reordered for the post-transform vertex cache with Tipsify (Sander, Nehab and Barczak,
+	"Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007), then the vertices are
+	renumbered in order of first use so the vertex fetch walks the buffers front to back.
+*/
+
+// FIFO size that the triangle order is tuned for and that the statistics are measured with
+static const uint32_t kVertexCacheSize = 16;
+
+// Meshes with fewer vertices than this are uploaded with R16_UINT indices
+static const uint32_t kMaxShortIndexVertices = 65536;
+
+inline bool useShortIndices(uint32_t vertexCount) { return vertexCount < kMaxShortIndexVertices; }
+inline uint32_t getIndexSize(uint32_t vertexCount) { return useShortIndices(vertexCount) ? (uint32_t)sizeof(uint16_t) : (uint32_t)sizeof(uint32_t); }
+
+// Result of running an index buffer through a simulated FIFO vertex cache
+struct VertexCacheStats
+{
+	uint32_t	cacheSize = 0;
+	uint32_t	triangleCount = 0;
+	uint32_t	vertexCount = 0;
+	uint32_t	transformCount = 0;	// cache misses, i.e. vertex shader invocations
+
+	// Average cache miss ratio, transformed vertices per triangle: 3 without any reuse, 0.5 at best for a regular grid
+	float getACMR() const { return triangleCount > 0 ? (float)transformCount / triangleCount : 0.0f; }
+	// Average transform to vertex ratio, 1 means every vertex is shaded exactly once
+	float getATVR() const { return vertexCount > 0 ? (float)transformCount / vertexCount : 0.0f; }
+};
+
+VertexCacheStats simulateVertexCache(const uint32_t* pIndices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize = kVertexCacheSize);
+
+// Reorder the triangles of a list in place. vertexCount must be larger than every index.
+void optimizeVertexCache(uint32_t* pIndices, uint32_t indexCount, uint32_t vertexCount, uint32_t cacheSize = kVertexCacheSize);
+
+// Renumber the vertices in order of first use and remap positions, normals and indices. Unreferenced vertices are dropped.
+void optimizeVertexFetch(MeshData& mesh);
+
+// Both of the above, in that order
+void optimizeMesh(MeshData& mesh);
+
+// Narrow indices for an R16_UINT index buffer, all of them must be below kMaxShortIndexVertices
+void convertToShortIndices(const uint32_t* pIndices, uint32_t count, uint16_t* pDst);
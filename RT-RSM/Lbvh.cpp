@@ -0,0 +1,455 @@
+#include "Lbvh.h"
+#include <algorithm>
+#include <atomic>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Primitives per task of the parallel passes
+static const uint32_t kLbvhGrainSize = 4096;
+
+// Three passes of 10 bits sort the 30-bit Morton codes
+static const uint32_t kRadixBits = 10;
+static const uint32_t kRadixSize = 1u << kRadixBits;
+
+// A treelet of seven leaves has 127 subsets, small enough to find its best topology exhaustively
+static const uint32_t kTreeletLeaves = 7;
+static const uint32_t kNoTreelets = 0xffffffff;
+
+static const uint32_t kNoParent = 0xffffffff;
+
+/*
+	Interior nodes are 0 .. n - 2 with the root at 0, leaf k is node n - 1 + k and holds the k-th primitive in
+	Morton order. With one primitive the root is leaf 0.
+*/
+struct LbvhTree
+{
+	uint32_t							numPrimitives = 0;
+	std::vector<uint64_t>				keys;		// Morton code << 32 | primitive, unique
+	std::vector<uint32_t>				children;	// two per interior node
+	std::vector<uint32_t>				parents;
+	std::vector<BvhBounds>				bounds;
+	std::vector<float>					costs;		// SAH cost of the subtree, relative to nothing
+	std::vector<uint32_t>				counts;		// primitives in the subtree
+	std::vector<uint8_t>				collapsed;	// the subtree is stored as one leaf
+	std::vector<std::atomic<uint32_t>>	visits;		// children done, the second one goes on up
+
+	bool isLeaf(uint32_t node) const { return node >= numPrimitives - 1; }
+};
+
+static uint32_t countLeadingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return 63 - (uint32_t)index;
+#else
+	return (uint32_t)__builtin_clzll(value);
+#endif
+}
+
+// Ten bits to every third bit
+static uint32_t expandBits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+static void computeKeys(const std::vector<vec3>& centroids, TaskPool& pool, std::vector<uint64_t>& keys)
+{
+	uint32_t count = (uint32_t)centroids.size();
+	uint32_t numChunks = (count + kLbvhGrainSize - 1) / kLbvhGrainSize;
+	std::vector<BvhBounds> chunkBounds(numChunks);
+	pool.parallelForRange(count, kLbvhGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		BvhBounds& bounds = chunkBounds[begin / kLbvhGrainSize];
+		for (uint32_t i = begin; i < end; i++)
+		{
+			bounds.grow(centroids[i]);
+		}
+	});
+	BvhBounds centroidBounds;
+	for (const BvhBounds& bounds : chunkBounds)
+	{
+		centroidBounds.grow(bounds);
+	}
+
+	vec3 extent = centroidBounds.max - centroidBounds.min;
+	vec3 scale;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		scale[axis] = extent[axis] > 0.0f ? 1023.0f / extent[axis] : 0.0f;
+	}
+	keys.resize(count);
+	pool.parallelForRange(count, kLbvhGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			vec3 cell = glm::clamp((centroids[i] - centroidBounds.min) * scale, vec3(0.0f), vec3(1023.0f));
+			uint32_t code = expandBits((uint32_t)cell.x) << 2 | expandBits((uint32_t)cell.y) << 1 | expandBits((uint32_t)cell.z);
+			keys[i] = (uint64_t)code << 32 | i;
+		}
+	});
+}
+
+// Stable LSD radix sort on the Morton code, chunks count and scatter in parallel. The primitive bits start out sorted.
+static void sortKeys(std::vector<uint64_t>& keys, TaskPool& pool)
+{
+	uint32_t count = (uint32_t)keys.size();
+	uint32_t numChunks = (count + kLbvhGrainSize - 1) / kLbvhGrainSize;
+	std::vector<uint64_t> sorted(count);
+	std::vector<uint32_t> offsets(numChunks * kRadixSize);
+	for (uint32_t shift = 32; shift < 62; shift += kRadixBits)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		pool.parallelForRange(count, kLbvhGrainSize, [&](uint32_t begin, uint32_t end)
+		{
+			uint32_t* pCounts = &offsets[begin / kLbvhGrainSize * kRadixSize];
+			for (uint32_t i = begin; i < end; i++)
+			{
+				pCounts[(keys[i] >> shift) & (kRadixSize - 1)]++;
+			}
+		});
+
+		// Digit major, chunk minor, so equal digits keep their order
+		uint32_t sum = 0;
+		for (uint32_t digit = 0; digit < kRadixSize; digit++)
+		{
+			for (uint32_t chunk = 0; chunk < numChunks; chunk++)
+			{
+				uint32_t& offset = offsets[chunk * kRadixSize + digit];
+				uint32_t digitCount = offset;
+				offset = sum;
+				sum += digitCount;
+			}
+		}
+
+		pool.parallelForRange(count, kLbvhGrainSize, [&](uint32_t begin, uint32_t end)
+		{
+			uint32_t* pOffsets = &offsets[begin / kLbvhGrainSize * kRadixSize];
+			for (uint32_t i = begin; i < end; i++)
+			{
+				sorted[pOffsets[(keys[i] >> shift) & (kRadixSize - 1)]++] = keys[i];
+			}
+		});
+		keys.swap(sorted);
+	}
+}
+
+// Length of the common prefix of keys i and j, -1 outside the keys
+static int getCommonPrefix(const LbvhTree& tree, int i, int j)
+{
+	if (j < 0 || j >= (int)tree.numPrimitives)
+	{
+		return -1;
+	}
+	return (int)countLeadingZeros(tree.keys[i] ^ tree.keys[j]);
+}
+
+// Karras 2012, figure 4: the range of keys below interior node i and where it splits
+static void emitInteriorNode(LbvhTree& tree, int i)
+{
+	int direction = getCommonPrefix(tree, i, i + 1) > getCommonPrefix(tree, i, i - 1) ? 1 : -1;
+	int minPrefix = getCommonPrefix(tree, i, i - direction);
+	int maxLength = 2;
+	while (getCommonPrefix(tree, i, i + maxLength * direction) > minPrefix)
+	{
+		maxLength *= 2;
+	}
+	int length = 0;
+	for (int step = maxLength / 2; step >= 1; step /= 2)
+	{
+		if (getCommonPrefix(tree, i, i + (length + step) * direction) > minPrefix)
+		{
+			length += step;
+		}
+	}
+	int j = i + length * direction;
+
+	int nodePrefix = getCommonPrefix(tree, i, j);
+	int split = 0;
+	int step = length;
+	do
+	{
+		step = (step + 1) / 2;
+		if (getCommonPrefix(tree, i, i + (split + step) * direction) > nodePrefix)
+		{
+			split += step;
+		}
+	} while (step > 1);
+	split = i + split * direction + std::min(direction, 0);
+
+	uint32_t firstLeaf = tree.numPrimitives - 1;
+	uint32_t left = std::min(i, j) == split ? firstLeaf + split : split;
+	uint32_t right = std::max(i, j) == split + 1 ? firstLeaf + split + 1 : split + 1;
+	tree.children[2 * i] = left;
+	tree.children[2 * i + 1] = right;
+	tree.parents[left] = (uint32_t)i;
+	tree.parents[right] = (uint32_t)i;
+}
+
+// Bounds, count and cost of an interior node from its children, collapsed if one leaf is cheaper
+static void updateNode(LbvhTree& tree, const BvhBuildSettings& settings, uint32_t node)
+{
+	uint32_t left = tree.children[2 * node];
+	uint32_t right = tree.children[2 * node + 1];
+	BvhBounds bounds = tree.bounds[left];
+	bounds.grow(tree.bounds[right]);
+	uint32_t count = tree.counts[left] + tree.counts[right];
+	float area = bounds.getArea();
+	float splitCost = settings.traversalCost * area + tree.costs[left] + tree.costs[right];
+	float leafCost = settings.intersectionCost * area * count;
+	bool collapse = count <= settings.maxLeafSize && leafCost <= splitCost;
+
+	tree.bounds[node] = bounds;
+	tree.counts[node] = count;
+	tree.costs[node] = collapse ? leafCost : splitCost;
+	tree.collapsed[node] = collapse ? 1 : 0;
+}
+
+struct Treelet
+{
+	uint32_t	leaves[kTreeletLeaves];
+	uint32_t	interiors[kTreeletLeaves - 1];		// the root first
+	uint8_t		partitions[1 << kTreeletLeaves];	// best left side of every subset
+};
+
+static uint32_t linkTreeletNode(LbvhTree& tree, const BvhBuildSettings& settings, const Treelet& treelet, uint32_t subset, uint32_t& nextInterior)
+{
+	if ((subset & (subset - 1)) == 0)
+	{
+		uint32_t leaf = 0;
+		while ((subset & (1u << leaf)) == 0)
+		{
+			leaf++;
+		}
+		return treelet.leaves[leaf];
+	}
+	uint32_t node = treelet.interiors[nextInterior++];
+	uint32_t left = linkTreeletNode(tree, settings, treelet, treelet.partitions[subset], nextInterior);
+	uint32_t right = linkTreeletNode(tree, settings, treelet, subset ^ treelet.partitions[subset], nextInterior);
+	tree.children[2 * node] = left;
+	tree.children[2 * node + 1] = right;
+	tree.parents[left] = node;
+	tree.parents[right] = node;
+	updateNode(tree, settings, node);
+	return node;
+}
+
+/*
+	The treelet under root grows by opening its largest interior leaf until it has seven leaves. The cheapest
+	binary tree over every subset of the leaves is found smallest subset first, and if the one over all of them
+	beats the current subtree the treelet is relinked, reusing its interior nodes. The root stays where it is.
+*/
+static void optimizeTreelet(LbvhTree& tree, const BvhBuildSettings& settings, uint32_t root)
+{
+	Treelet treelet;
+	treelet.leaves[0] = tree.children[2 * root];
+	treelet.leaves[1] = tree.children[2 * root + 1];
+	treelet.interiors[0] = root;
+	uint32_t numLeaves = 2;
+	while (numLeaves < kTreeletLeaves)
+	{
+		int largest = -1;
+		float largestArea = -1.0f;
+		for (uint32_t l = 0; l < numLeaves; l++)
+		{
+			float area = tree.bounds[treelet.leaves[l]].getArea();
+			if (!tree.isLeaf(treelet.leaves[l]) && area > largestArea)
+			{
+				largest = (int)l;
+				largestArea = area;
+			}
+		}
+		if (largest < 0)
+		{
+			break;
+		}
+		uint32_t node = treelet.leaves[largest];
+		treelet.interiors[numLeaves - 1] = node;
+		treelet.leaves[largest] = tree.children[2 * node];
+		treelet.leaves[numLeaves++] = tree.children[2 * node + 1];
+	}
+	if (numLeaves < 3)
+	{
+		return;
+	}
+
+	// Bounds of a subset from those of the subset without its highest leaf
+	BvhBounds bounds[1 << kTreeletLeaves];
+	float areas[1 << kTreeletLeaves];
+	float costs[1 << kTreeletLeaves];
+	uint32_t counts[1 << kTreeletLeaves];
+	uint32_t numSubsets = 1u << numLeaves;
+	bounds[0] = BvhBounds();
+	counts[0] = 0;
+	for (uint32_t l = 0; l < numLeaves; l++)
+	{
+		uint32_t leaf = treelet.leaves[l];
+		for (uint32_t subset = 1u << l; subset < 2u << l; subset++)
+		{
+			bounds[subset] = bounds[subset ^ (1u << l)];
+			bounds[subset].grow(tree.bounds[leaf]);
+			areas[subset] = bounds[subset].getArea();
+			counts[subset] = counts[subset ^ (1u << l)] + tree.counts[leaf];
+		}
+		costs[1u << l] = tree.costs[leaf];
+	}
+
+	// A proper subset is a smaller number, so it is done before the sets it is part of
+	for (uint32_t subset = 1; subset < numSubsets; subset++)
+	{
+		if ((subset & (subset - 1)) == 0)
+		{
+			continue;
+		}
+		// Every partition once: the left side is the lowest leaf plus a proper subset of the others
+		uint32_t lowest = subset & (0u - subset);
+		uint32_t others = subset ^ lowest;
+		float bestCost = FLT_MAX;
+		uint32_t bestPartition = 0;
+		for (uint32_t rest = (others - 1) & others; ; rest = (rest - 1) & others)
+		{
+			uint32_t left = lowest | rest;
+			float cost = costs[left] + costs[subset ^ left];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestPartition = left;
+			}
+			if (rest == 0)
+			{
+				break;
+			}
+		}
+		float splitCost = settings.traversalCost * areas[subset] + bestCost;
+		float leafCost = settings.intersectionCost * areas[subset] * counts[subset];
+		costs[subset] = counts[subset] <= settings.maxLeafSize ? std::min(splitCost, leafCost) : splitCost;
+		treelet.partitions[subset] = (uint8_t)bestPartition;
+	}
+
+	if (costs[numSubsets - 1] >= tree.costs[root])
+	{
+		return;
+	}
+	uint32_t nextInterior = 0;
+	linkTreeletNode(tree, settings, treelet, numSubsets - 1, nextInterior);
+}
+
+/*
+	Every leaf walks up, the first child to arrive at a node stops there and the second one updates it and goes on,
+	so a node is only touched once its whole subtree is final. Subtrees of at least minTreeletPrimitives get their
+	treelet optimized right after their update.
+*/
+static void updateBottomUp(LbvhTree& tree, const BvhBuildSettings& settings, TaskPool& pool, uint32_t minTreeletPrimitives)
+{
+	uint32_t numPrimitives = tree.numPrimitives;
+	for (uint32_t i = 0; i + 1 < numPrimitives; i++)
+	{
+		tree.visits[i].store(0, std::memory_order_relaxed);
+	}
+	pool.parallelForRange(numPrimitives, kLbvhGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t k = begin; k < end; k++)
+		{
+			uint32_t node = tree.parents[numPrimitives - 1 + k];
+			while (node != kNoParent && tree.visits[node].fetch_add(1) == 1)
+			{
+				updateNode(tree, settings, node);
+				if (tree.counts[node] >= minTreeletPrimitives)
+				{
+					optimizeTreelet(tree, settings, node);
+				}
+				node = tree.parents[node];
+			}
+		}
+	});
+}
+
+static void gatherLeaves(const LbvhTree& tree, uint32_t node, std::vector<uint32_t>& references)
+{
+	if (tree.isLeaf(node))
+	{
+		references.push_back((uint32_t)tree.keys[node - (tree.numPrimitives - 1)]);
+		return;
+	}
+	gatherLeaves(tree, tree.children[2 * node], references);
+	gatherLeaves(tree, tree.children[2 * node + 1], references);
+}
+
+// Like storeDepthFirst of the SAH builder, collapsed subtrees become leaves
+static void storeDepthFirst(const LbvhTree& tree, uint32_t node, uint32_t outIndex, std::vector<BvhNode>& nodes, std::vector<uint32_t>& references)
+{
+	nodes[outIndex].boundsMin = tree.bounds[node].min;
+	nodes[outIndex].boundsMax = tree.bounds[node].max;
+	if (tree.collapsed[node])
+	{
+		nodes[outIndex].firstChildOrPrimitive = (uint32_t)references.size();
+		nodes[outIndex].primitiveCount = tree.counts[node];
+		gatherLeaves(tree, node, references);
+		return;
+	}
+	uint32_t children = (uint32_t)nodes.size();
+	nodes.resize(children + 2);
+	nodes[outIndex].firstChildOrPrimitive = children;
+	nodes[outIndex].primitiveCount = 0;
+	storeDepthFirst(tree, tree.children[2 * node], children, nodes, references);
+	storeDepthFirst(tree, tree.children[2 * node + 1], children + 1, nodes, references);
+}
+
+void buildLbvh(const std::vector<BvhBounds>& primitiveBounds, const std::vector<vec3>& centroids, const BvhBuildSettings& settings, TaskPool& pool,
+	std::vector<BvhNode>& nodes, std::vector<uint32_t>& references)
+{
+	uint32_t numPrimitives = (uint32_t)centroids.size();
+	LbvhTree tree;
+	tree.numPrimitives = numPrimitives;
+	computeKeys(centroids, pool, tree.keys);
+	sortKeys(tree.keys, pool);
+
+	uint32_t numNodes = 2 * numPrimitives - 1;
+	tree.children.resize(2 * (numPrimitives - 1));
+	tree.parents.resize(numNodes);
+	tree.bounds.resize(numNodes);
+	tree.costs.resize(numNodes);
+	tree.counts.resize(numNodes);
+	tree.collapsed.resize(numNodes);
+	tree.visits = std::vector<std::atomic<uint32_t>>(numPrimitives - 1);
+	tree.parents[0] = kNoParent;
+	pool.parallelForRange(numPrimitives - 1, kLbvhGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			emitInteriorNode(tree, (int)i);
+		}
+	});
+	pool.parallelForRange(numPrimitives, kLbvhGrainSize, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t k = begin; k < end; k++)
+		{
+			uint32_t leaf = numPrimitives - 1 + k;
+			tree.bounds[leaf] = primitiveBounds[(uint32_t)tree.keys[k]];
+			tree.counts[leaf] = 1;
+			tree.costs[leaf] = settings.intersectionCost * tree.bounds[leaf].getArea();
+			tree.collapsed[leaf] = 1;
+		}
+	});
+
+	// The first pass computes the bounds, with the first treelet pass on top
+	uint32_t numPasses = std::max(settings.treeletPasses, 1u);
+	for (uint32_t pass = 0; pass < numPasses; pass++)
+	{
+		// Treelets whose leaves could all be leaf sized, and like Karras and Aila later passes only go over larger subtrees
+		updateBottomUp(tree, settings, pool, pass < settings.treeletPasses ? (kTreeletLeaves * std::max(settings.maxLeafSize, 1u)) << pass : kNoTreelets);
+	}
+
+	nodes.clear();
+	nodes.reserve(numNodes);
+	nodes.resize(1);
+	references.clear();
+	references.reserve(numPrimitives);
+	storeDepthFirst(tree, 0, 0, nodes, references);
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "Bvh.h"
+
+/*
+	Linear BVH (Karras 2012), the BvhBuilder::Lbvh path of buildBvh. The centroids get 30-bit Morton codes, which are
+	radix sorted in parallel, and every interior node of the binary radix tree over the sorted codes finds its range and
+	split on its own, so the hierarchy is emitted in one parallel pass. Bounds and SAH costs are then computed bottom up
+	in parallel, collapsing small subtrees into leaves, and optionally treelets of seven leaves are restructured to
+	their best SAH topology on the way up (Karras and Aila 2013), settings.treeletPasses times.
+
+	Writes the nodes depth first like the SAH builder and the primitive of every reference in leaf order.
+	The result doesn't depend on the number of threads.
+*/
+void buildLbvh(const std::vector<BvhBounds>& primitiveBounds, const std::vector<vec3>& centroids, const BvhBuildSettings& settings, TaskPool& pool,
+	std::vector<BvhNode>& nodes, std::vector<uint32_t>& references);
@@ -0,0 +1,105 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const char* pFileName)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(pFileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	void* pData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (pData == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	mFile = file;
+	mMapping = mapping;
+	mpData = (const uint8_t*)pData;
+	mSize = (uint64_t)size.QuadPart;
+#else
+	int file = ::open(pFileName, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat st;
+	if (fstat(file, &st) != 0 || st.st_size == 0)
+	{
+		::close(file);
+		return false;
+	}
+	void* pData = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	if (pData == MAP_FAILED)
+	{
+		::close(file);
+		return false;
+	}
+	mFile = file;
+	mpData = (const uint8_t*)pData;
+	mSize = (uint64_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (mpData)
+	{
+		UnmapViewOfFile(mpData);
+	}
+	if (mMapping)
+	{
+		CloseHandle(mMapping);
+	}
+	if (mFile)
+	{
+		CloseHandle(mFile);
+	}
+	mFile = nullptr;
+	mMapping = nullptr;
+#else
+	if (mpData)
+	{
+		munmap((void*)mpData, (size_t)mSize);
+	}
+	if (mFile >= 0)
+	{
+		::close(mFile);
+	}
+	mFile = -1;
+#endif
+	mpData = nullptr;
+	mSize = 0;
+}
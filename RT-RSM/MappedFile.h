@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+/*
+	Read-only memory mapping of a whole file. Used by the on-disk caches so
+	their contents can be consumed straight from the mapped pages.
+*/
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* pFileName);
+	void close();
+
+	bool			isOpen() const { return mpData != nullptr; }
+	const uint8_t*	getData() const { return mpData; }
+	uint64_t		getSize() const { return mSize; }
+
+private:
+#ifdef _WIN32
+	void*			mFile = nullptr;
+	void*			mMapping = nullptr;
+#else
+	int				mFile = -1;
+#endif
+	const uint8_t*	mpData = nullptr;
+	uint64_t		mSize = 0;
+};
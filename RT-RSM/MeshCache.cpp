@@ -0,0 +1,225 @@
+#include "MeshCache.h"
+#include "Hash.h"
+#include "Externals/GLM/glm/gtc/type_ptr.hpp"
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + 15) & ~15ull;
+}
+
+// Written so a corrupted offset can't wrap around the file size
+static bool isInFile(uint64_t offset, uint64_t count, uint64_t stride, uint64_t size)
+{
+	return offset <= size && count * stride <= size - offset;
+}
+
+static bool areIndicesValid(const uint32_t* pIndices, uint32_t indexCount, uint32_t vertexCount)
+{
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		if (pIndices[i] >= vertexCount)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t MeshCache::hashFile(const char* pFileName)
+{
+	MappedFile file;
+	if (!file.open(pFileName))
+	{
+		return 0;
+	}
+	return hashBytes(file.getData(), (size_t)file.getSize(), hashValue(file.getSize()));
+}
+
+bool MeshCache::open(const char* pFileName, uint32_t processFlags)
+{
+	mMeshes.clear();
+	mCacheHit = false;
+
+	std::string cachePath = getCachePath(pFileName);
+	if (!mFile.open(cachePath.c_str()))
+	{
+		return false;
+	}
+
+	const uint8_t* pData = mFile.getData();
+	const uint64_t size = mFile.getSize();
+	if (size < sizeof(MeshCacheHeader))
+	{
+		mFile.close();
+		return false;
+	}
+
+	MeshCacheHeader header;
+	memcpy(&header, pData, sizeof(header));
+	if (header.magic != kMeshCacheMagic || header.version != kMeshCacheVersion || header.processFlags != processFlags ||
+		sizeof(MeshCacheHeader) + (uint64_t)header.meshCount * sizeof(MeshCacheEntry) > size ||
+		header.sourceHash != hashFile(pFileName))
+	{
+		mFile.close();
+		return false;
+	}
+
+	const MeshCacheEntry* pEntries = (const MeshCacheEntry*)(pData + sizeof(MeshCacheHeader));
+	mMeshes.resize(header.meshCount);
+	for (uint32_t i = 0; i < header.meshCount; i++)
+	{
+		const MeshCacheEntry& entry = pEntries[i];
+		if (!isInFile(entry.positionOffset, entry.vertexCount, sizeof(vec3), size) ||
+			!isInFile(entry.normalOffset, entry.vertexCount, sizeof(vec3), size) ||
+			!isInFile(entry.indexOffset, entry.indexCount, sizeof(uint32_t), size) ||
+			entry.lodCount >= kMaxMeshLods || !isInFile(entry.lodOffset, entry.lodCount, sizeof(MeshCacheLod), size) ||
+			!areIndicesValid((const uint32_t*)(pData + entry.indexOffset), entry.indexCount, entry.vertexCount))
+		{
+			mMeshes.clear();
+			mFile.close();
+			return false;
+		}
+
+		MeshView& mesh = mMeshes[i];
+		mesh.positions = (const vec3*)(pData + entry.positionOffset);
+		mesh.normals = (const vec3*)(pData + entry.normalOffset);
+		mesh.indices = (const uint32_t*)(pData + entry.indexOffset);
+		mesh.vertexCount = entry.vertexCount;
+		mesh.indexCount = entry.indexCount;
+		mesh.materialIndex = entry.materialIndex;
+
+		const MeshCacheLod* pLods = (const MeshCacheLod*)(pData + entry.lodOffset);
+		mesh.lodCount = entry.lodCount;
+		for (uint32_t l = 0; l < entry.lodCount; l++)
+		{
+			if (!isInFile(pLods[l].indexOffset, pLods[l].indexCount, sizeof(uint32_t), size) ||
+				!areIndicesValid((const uint32_t*)(pData + pLods[l].indexOffset), pLods[l].indexCount, entry.vertexCount))
+			{
+				mMeshes.clear();
+				mFile.close();
+				return false;
+			}
+			mesh.lods[l].indices = (const uint32_t*)(pData + pLods[l].indexOffset);
+			mesh.lods[l].indexCount = pLods[l].indexCount;
+			mesh.lods[l].error = pLods[l].error;
+		}
+	}
+	mRootTransform = make_mat4(header.rootTransform);
+
+	mCacheHit = true;
+	return true;
+}
+
+bool MeshCache::load(Assimp::Importer* pImporter, const char* pFileName, uint32_t processFlags)
+{
+	if (open(pFileName, processFlags))
+	{
+		return true;
+	}
+
+	mImported = ImportedScene();
+	if (!importScene(pImporter, pFileName, processFlags, mImported))
+	{
+		return false;
+	}
+	pImporter->FreeScene();
+	write(pFileName, processFlags, mImported);
+
+	mMeshes.resize(mImported.meshes.size());
+	for (size_t i = 0; i < mImported.meshes.size(); i++)
+	{
+		mMeshes[i] = mImported.meshes[i].view();
+	}
+	mRootTransform = mImported.rootTransform;
+	return true;
+}
+
+bool MeshCache::write(const char* pFileName, uint32_t processFlags, const ImportedScene& scene)
+{
+	MeshCacheHeader header = {};
+	header.magic = kMeshCacheMagic;
+	header.version = kMeshCacheVersion;
+	header.sourceHash = hashFile(pFileName);
+	header.processFlags = processFlags;
+	header.meshCount = (uint32_t)scene.meshes.size();
+	memcpy(header.rootTransform, value_ptr(scene.rootTransform), sizeof(header.rootTransform));
+
+	// Lay out the mesh data after the entry table
+	std::vector<MeshCacheEntry> entries(scene.meshes.size());
+	std::vector<std::vector<MeshCacheLod>> lods(scene.meshes.size());
+	uint64_t offset = alignOffset(sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry));
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+	{
+		const MeshData& mesh = scene.meshes[i];
+		MeshCacheEntry& entry = entries[i];
+		entry = {};
+		entry.vertexCount = (uint32_t)mesh.positions.size();
+		entry.indexCount = (uint32_t)mesh.indices.size();
+		entry.materialIndex = mesh.materialIndex;
+		entry.positionOffset = offset;
+		offset = alignOffset(offset + entry.vertexCount * sizeof(vec3));
+		entry.normalOffset = offset;
+		offset = alignOffset(offset + entry.vertexCount * sizeof(vec3));
+		entry.indexOffset = offset;
+		offset = alignOffset(offset + entry.indexCount * sizeof(uint32_t));
+
+		entry.lodCount = (uint32_t)mesh.lods.size();
+		entry.lodOffset = offset;
+		offset = alignOffset(offset + entry.lodCount * sizeof(MeshCacheLod));
+		lods[i].resize(mesh.lods.size());
+		for (size_t l = 0; l < mesh.lods.size(); l++)
+		{
+			lods[i][l].indexCount = (uint32_t)mesh.lods[l].indices.size();
+			lods[i][l].error = mesh.lods[l].error;
+			lods[i][l].indexOffset = offset;
+			offset = alignOffset(offset + lods[i][l].indexCount * sizeof(uint32_t));
+		}
+	}
+
+	// Write to a temporary file first so an interrupted write never leaves a valid-looking cache behind
+	std::string cachePath = getCachePath(pFileName);
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.good())
+		{
+			return false;
+		}
+
+		const char padding[16] = {};
+		uint64_t written = 0;
+		auto writeBlock = [&](const void* pData, uint64_t size, uint64_t at)
+		{
+			file.write(padding, (std::streamsize)(at - written));
+			file.write((const char*)pData, (std::streamsize)size);
+			written = at + size;
+		};
+
+		writeBlock(&header, sizeof(header), 0);
+		writeBlock(entries.data(), entries.size() * sizeof(MeshCacheEntry), sizeof(header));
+		for (size_t i = 0; i < scene.meshes.size(); i++)
+		{
+			const MeshData& mesh = scene.meshes[i];
+			writeBlock(mesh.positions.data(), entries[i].vertexCount * sizeof(vec3), entries[i].positionOffset);
+			writeBlock(mesh.normals.data(), entries[i].vertexCount * sizeof(vec3), entries[i].normalOffset);
+			writeBlock(mesh.indices.data(), entries[i].indexCount * sizeof(uint32_t), entries[i].indexOffset);
+			writeBlock(lods[i].data(), entries[i].lodCount * sizeof(MeshCacheLod), entries[i].lodOffset);
+			for (size_t l = 0; l < mesh.lods.size(); l++)
+			{
+				writeBlock(mesh.lods[l].indices.data(), lods[i][l].indexCount * sizeof(uint32_t), lods[i][l].indexOffset);
+			}
+		}
+		if (!file.good())
+		{
+			file.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	remove(cachePath.c_str());
+	return rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "MeshImport.h"
+#include "MappedFile.h"
+#include <string>
+
+/*
+	Versioned binary cache of post-processed meshes, stored next to the source file as <file>.meshcache.
+
+	Layout (all offsets are from the start of the file and 16-byte aligned):
+		MeshCacheHeader
+		MeshCacheEntry[meshCount]
+		per mesh: positions (vec3[vertexCount]), normals (vec3[vertexCount]), indices (uint32_t[indexCount]),
+			MeshCacheLod[lodCount], then the indices of every LOD (uint32_t[indexCount])
+
+	The cache is valid if the version matches, the source file hashes to the same value and the
+	assimp post-processing flags are the same. On a hit the meshes are used straight from the mapped file.
+*/
+static const uint32_t kMeshCacheMagic = 0x48534d52; // "RMSH"
+static const uint32_t kMeshCacheVersion = 3; // 2: vertex cache optimized index order, 3: LOD chain
+
+struct MeshCacheHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	sourceHash;
+	uint32_t	processFlags;
+	uint32_t	meshCount;
+	uint32_t	reserved[2];
+	float		rootTransform[16];
+};
+
+struct MeshCacheEntry
+{
+	uint32_t	vertexCount;
+	uint32_t	indexCount;
+	uint32_t	materialIndex;
+	uint32_t	lodCount;
+	uint64_t	positionOffset;
+	uint64_t	normalOffset;
+	uint64_t	indexOffset;
+	uint64_t	lodOffset;
+};
+
+struct MeshCacheLod
+{
+	uint32_t	indexCount;
+	float		error;
+	uint64_t	indexOffset;
+};
+
+class MeshCache
+{
+public:
+	/*
+		Map the cache of pFileName if it is valid, otherwise import the file with assimp and write a new cache.
+		Returns false only if the file can't be imported at all.
+	*/
+	bool load(Assimp::Importer* pImporter, const char* pFileName, uint32_t processFlags);
+
+	// Map and validate an existing cache, without falling back to assimp
+	bool open(const char* pFileName, uint32_t processFlags);
+
+	static bool write(const char* pFileName, uint32_t processFlags, const ImportedScene& scene);
+	static uint64_t hashFile(const char* pFileName);
+	static std::string getCachePath(const char* pFileName) { return std::string(pFileName) + ".meshcache"; }
+
+	bool		isCacheHit() const { return mCacheHit; }
+	uint32_t	getNumMeshes() const { return (uint32_t)mMeshes.size(); }
+	MeshView	getMesh(uint32_t idx) const { return mMeshes[idx]; }
+	const mat4&	getRootTransform() const { return mRootTransform; }
+
+private:
+	MappedFile				mFile;
+	ImportedScene			mImported;	// only used on a cache miss
+	std::vector<MeshView>	mMeshes;
+	mat4					mRootTransform;
+	bool					mCacheHit = false;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#define GLM_FORCE_CTOR_INIT
+#include "Externals/GLM/glm/glm.hpp"
+#include <stdint.h>
+#include <vector>
+
+using namespace glm;
+
+///////////////////////////////////////////
+// CPU side mesh data
+///////////////////////////////////////////
+// Index buffers per mesh: the full mesh (LOD 0) and up to kMaxMeshLods - 1 simplified ones (MeshSimplifier.h)
+static const uint32_t kMaxMeshLods = 3;
+
+// One simplified index buffer over the vertices of its mesh
+struct MeshLodView
+{
+	const uint32_t*	indices = nullptr;
+	uint32_t		indexCount = 0;
+	float			error = 0.0f;	// relative to the diagonal of the mesh AABB
+};
+
+/*
+	Non-owning view of one post-processed mesh: the positions, normals and 32-bit triangle indices that
+	end up in the vertex, normal and index buffers. It may point into a MeshData or into a mapped mesh cache.
+*/
+struct MeshView
+{
+	const vec3*		positions = nullptr;
+	const vec3*		normals = nullptr;
+	const uint32_t*	indices = nullptr;
+	uint32_t		vertexCount = 0;
+	uint32_t		indexCount = 0;
+	uint32_t		materialIndex = 0;
+	MeshLodView		lods[kMaxMeshLods - 1];	// LOD 1 and up
+	uint32_t		lodCount = 0;
+};
+
+struct MeshLod
+{
+	std::vector<uint32_t>	indices;
+	float					error = 0.0f;
+};
+
+/*
+	Owning, upload-ready copy of one mesh
+*/
+struct MeshData
+{
+	std::vector<vec3>		positions;
+	std::vector<vec3>		normals;
+	std::vector<uint32_t>	indices;
+	uint32_t				materialIndex = 0;
+	std::vector<MeshLod>	lods;	// LOD 1 and up
+
+	MeshView view() const
+	{
+		MeshView v;
+		v.positions = positions.data();
+		v.normals = normals.data();
+		v.indices = indices.data();
+		v.vertexCount = (uint32_t)positions.size();
+		v.indexCount = (uint32_t)indices.size();
+		v.materialIndex = materialIndex;
+		v.lodCount = (uint32_t)lods.size();
+		for (uint32_t l = 0; l < v.lodCount; l++)
+		{
+			v.lods[l].indices = lods[l].indices.data();
+			v.lods[l].indexCount = (uint32_t)lods[l].indices.size();
+			v.lods[l].error = lods[l].error;
+		}
+		return v;
+	}
+};
@@ -0,0 +1,187 @@
+#include "MeshImport.h"
+#include "IndexOptimizer.h"
+#include "MeshSimplifier.h"
+#include <algorithm>
+
+mat4 aiMatrix4x4ToGlm(const aiMatrix4x4* from)
+{
+	// from: https://stackoverflow.com/questions/29184311/how-to-rotate-a-skinned-models-bones-in-c-using-assimp
+	mat4 to;
+
+	to[0][0] = (float)from->a1; to[0][1] = (float)from->b1;  to[0][2] = (float)from->c1; to[0][3] = (float)from->d1;
+	to[1][0] = (float)from->a2; to[1][1] = (float)from->b2;  to[1][2] = (float)from->c2; to[1][3] = (float)from->d2;
+	to[2][0] = (float)from->a3; to[2][1] = (float)from->b3;  to[2][2] = (float)from->c3; to[2][3] = (float)from->d3;
+	to[3][0] = (float)from->a4; to[3][1] = (float)from->b4;  to[3][2] = (float)from->c4; to[3][3] = (float)from->d4;
+
+	return to;
+}
+
+// By assignment, glm vectors aren't trivially copyable with GLM_FORCE_CTOR_INIT
+static void copyVectors(const aiVector3D* pSrc, uint32_t count, vec3* pDst)
+{
+	for (uint32_t v = 0; v < count; v++)
+	{
+		pDst[v] = vec3(pSrc[v].x, pSrc[v].y, pSrc[v].z);
+	}
+}
+
+void convertMesh(const aiMesh* pMesh, MeshData& mesh)
+{
+	mesh.materialIndex = pMesh->mMaterialIndex;
+	mesh.positions.resize(pMesh->mNumVertices);
+	copyVectors(pMesh->mVertices, pMesh->mNumVertices, mesh.positions.data());
+	mesh.normals.resize(pMesh->mNumVertices);
+	if (pMesh->mNormals)
+	{
+		copyVectors(pMesh->mNormals, pMesh->mNumVertices, mesh.normals.data());
+	}
+
+	mesh.indices.resize(pMesh->mNumFaces * 3);
+	uint32_t* pIndex = mesh.indices.data();
+	for (uint32_t i = 0; i < pMesh->mNumFaces; i++)
+	{
+		const aiFace& face = pMesh->mFaces[i];
+		if (face.mNumIndices != 3)
+		{
+			continue;
+		}
+		pIndex[0] = face.mIndices[0];
+		pIndex[1] = face.mIndices[1];
+		pIndex[2] = face.mIndices[2];
+		pIndex += 3;
+	}
+	mesh.indices.resize(pIndex - mesh.indices.data());
+}
+
+// Faces or vertices converted by one task
+static const uint32_t kIngestGrainSize = 32 * 1024;
+
+struct IngestRange
+{
+	uint32_t	mesh;
+	uint32_t	begin;
+	uint32_t	end;
+	bool		faces;
+};
+
+void convertScene(const aiScene* pScene, ImportedScene& scene, TaskPool* pPool)
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	const uint32_t numMeshes = pScene->mNumMeshes;
+	scene.meshes.resize(numMeshes);
+
+	// Split every mesh into ranges of faces and vertices
+	std::vector<IngestRange> ranges;
+	std::vector<uint32_t> firstFaceRange(numMeshes);
+	for (uint32_t m = 0; m < numMeshes; m++)
+	{
+		const aiMesh* pMesh = pScene->mMeshes[m];
+		firstFaceRange[m] = (uint32_t)ranges.size();
+		for (uint32_t begin = 0; begin < pMesh->mNumFaces; begin += kIngestGrainSize)
+		{
+			ranges.push_back({ m, begin, std::min(begin + kIngestGrainSize, pMesh->mNumFaces), true });
+		}
+	}
+	const uint32_t numFaceRanges = (uint32_t)ranges.size();
+	for (uint32_t m = 0; m < numMeshes; m++)
+	{
+		const aiMesh* pMesh = pScene->mMeshes[m];
+		for (uint32_t begin = 0; begin < pMesh->mNumVertices; begin += kIngestGrainSize)
+		{
+			ranges.push_back({ m, begin, std::min(begin + kIngestGrainSize, pMesh->mNumVertices), false });
+		}
+	}
+
+	// Stage 1: count the triangles of every face range, non-triangle faces are dropped
+	std::vector<uint32_t> triangleOffset(numFaceRanges + 1, 0);
+	pool.parallelFor(numFaceRanges, [&](uint32_t r)
+	{
+		const IngestRange& range = ranges[r];
+		const aiFace* pFaces = pScene->mMeshes[range.mesh]->mFaces;
+		uint32_t count = 0;
+		for (uint32_t f = range.begin; f < range.end; f++)
+		{
+			count += pFaces[f].mNumIndices == 3 ? 1 : 0;
+		}
+		triangleOffset[r] = count;
+	});
+
+	// Prefix sums per mesh and allocation of the packed arrays
+	for (uint32_t m = 0; m < numMeshes; m++)
+	{
+		const aiMesh* pMesh = pScene->mMeshes[m];
+		uint32_t end = m + 1 < numMeshes ? firstFaceRange[m + 1] : numFaceRanges;
+		uint32_t numTriangles = 0;
+		for (uint32_t r = firstFaceRange[m]; r < end; r++)
+		{
+			uint32_t count = triangleOffset[r];
+			triangleOffset[r] = numTriangles;
+			numTriangles += count;
+		}
+
+		MeshData& mesh = scene.meshes[m];
+		mesh.materialIndex = pMesh->mMaterialIndex;
+		mesh.positions.resize(pMesh->mNumVertices);
+		mesh.normals.resize(pMesh->mNumVertices);
+		mesh.indices.resize(numTriangles * 3);
+	}
+
+	// Stage 2: pack indices and copy vertices
+	pool.parallelFor((uint32_t)ranges.size(), [&](uint32_t r)
+	{
+		const IngestRange& range = ranges[r];
+		const aiMesh* pMesh = pScene->mMeshes[range.mesh];
+		MeshData& mesh = scene.meshes[range.mesh];
+		if (range.faces)
+		{
+			uint32_t* pIndex = mesh.indices.data() + 3 * triangleOffset[r];
+			for (uint32_t f = range.begin; f < range.end; f++)
+			{
+				const aiFace& face = pMesh->mFaces[f];
+				if (face.mNumIndices != 3)
+				{
+					continue;
+				}
+				pIndex[0] = face.mIndices[0];
+				pIndex[1] = face.mIndices[1];
+				pIndex[2] = face.mIndices[2];
+				pIndex += 3;
+			}
+		}
+		else
+		{
+			uint32_t count = range.end - range.begin;
+			copyVectors(pMesh->mVertices + range.begin, count, mesh.positions.data() + range.begin);
+			if (pMesh->mNormals)
+			{
+				copyVectors(pMesh->mNormals + range.begin, count, mesh.normals.data() + range.begin);
+			}
+		}
+	});
+
+	scene.rootTransform = mat4();
+	if (pScene->mRootNode && pScene->mRootNode->mNumChildren > 0)
+	{
+		aiMatrix4x4 transform = pScene->mRootNode->mChildren[0]->mTransformation;
+		scene.rootTransform = aiMatrix4x4ToGlm(&transform);
+	}
+}
+
+bool importScene(Assimp::Importer* pImporter, const char* pFileName, uint32_t processFlags, ImportedScene& scene, TaskPool* pPool)
+{
+	const aiScene* pScene = pImporter->ReadFile(pFileName, processFlags);
+	if (pScene == nullptr)
+	{
+		return false;
+	}
+	convertScene(pScene, scene, pPool);
+
+	// Vertex cache and fetch order and the LOD chain, done once here so the mesh cache stores the results
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	pool.parallelFor((uint32_t)scene.meshes.size(), [&](uint32_t m)
+	{
+		optimizeMesh(scene.meshes[m]);
+		generateLods(scene.meshes[m]);
+	});
+	return true;
+}
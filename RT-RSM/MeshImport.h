@@ -0,0 +1,54 @@
+#pragma once
+#include "MeshData.h"
+#include "TaskPool.h"
+#include "Externals/Assimp/include/assimp/Importer.hpp"
+#include "Externals/Assimp/include/assimp/postprocess.h"
+#include "Externals/Assimp/include/assimp/scene.h"
+
+// Post-processing used by Model::loadMultipleModelsFromFile
+static const uint32_t kMultipleMeshProcessFlags =
+	aiProcess_CalcTangentSpace |
+	aiProcess_JoinIdenticalVertices |
+	aiProcess_Triangulate |
+	aiProcess_GenNormals |
+	/*aiProcess_FixInfacingNormals |*/
+	aiProcess_GenUVCoords |
+	aiProcess_TransformUVCoords |
+	/*aiProcess_MakeLeftHanded |*/
+	aiProcess_FindInvalidData;
+
+// Post-processing used by Model::loadModelFromFile
+static const uint32_t kSingleMeshProcessFlags =
+	aiProcess_CalcTangentSpace |
+	aiProcess_JoinIdenticalVertices |
+	aiProcess_Triangulate |
+	aiProcess_GenNormals |
+	aiProcess_FixInfacingNormals |
+	aiProcess_GenUVCoords |
+	aiProcess_TransformUVCoords |
+	aiProcess_MakeLeftHanded |
+	aiProcess_FindInvalidData;
+
+/*
+	All meshes of a file, converted to upload-ready arrays
+*/
+struct ImportedScene
+{
+	std::vector<MeshData>	meshes;
+	mat4					rootTransform;	// transform of the first child of the root node, identity if there is none
+};
+
+mat4 aiMatrix4x4ToGlm(const aiMatrix4x4* from);
+
+// Convert one assimp mesh. Faces that are not triangles (points and lines left by aiProcess_Triangulate) are dropped.
+void convertMesh(const aiMesh* pMesh, MeshData& mesh);
+
+/*
+	Convert all meshes of a scene in parallel. Work is split per mesh and, for large meshes, per range
+	of faces and vertices, so it scales with both the mesh count and the triangle count.
+	pPool == nullptr uses the global pool.
+*/
+void convertScene(const aiScene* pScene, ImportedScene& scene, TaskPool* pPool = nullptr);
+
+// Import a file with assimp, convert all of its meshes, optimize their index order (IndexOptimizer.h) and build their LODs (MeshSimplifier.h). Returns false if assimp fails.
+bool importScene(Assimp::Importer* pImporter, const char* pFileName, uint32_t processFlags, ImportedScene& scene, TaskPool* pPool = nullptr);
@@ -0,0 +1,111 @@
+#include "MeshInstancing.h"
+#include "Hash.h"
+#include <algorithm>
+#include <unordered_map>
+
+// Limits the pairwise comparisons if many different meshes share a topology (e.g. boxes)
+static const uint32_t kMaxCandidatesPerHash = 16;
+
+static uint64_t hashMeshTopology(const MeshView& mesh)
+{
+	uint64_t hash = hashValue(mesh.vertexCount);
+	hash = hashValue(mesh.indexCount, hash);
+	return hashBytes(mesh.indices, mesh.indexCount * sizeof(uint32_t), hash);
+}
+
+static float getMeshSize(const MeshView& mesh)
+{
+	if (mesh.vertexCount == 0)
+	{
+		return 0.0f;
+	}
+	vec3 minPos = mesh.positions[0];
+	vec3 maxPos = mesh.positions[0];
+	for (uint32_t v = 1; v < mesh.vertexCount; v++)
+	{
+		minPos = min(minPos, mesh.positions[v]);
+		maxPos = max(maxPos, mesh.positions[v]);
+	}
+	return length(maxPos - minPos);
+}
+
+// Returns true and the translation if copy is prototype moved by a constant offset
+static bool matchMeshes(const MeshView& prototype, const MeshView& copy, float tolerance, vec3& offset)
+{
+	if (prototype.vertexCount != copy.vertexCount || prototype.indexCount != copy.indexCount ||
+		memcmp(prototype.indices, copy.indices, copy.indexCount * sizeof(uint32_t)) != 0)
+	{
+		return false;
+	}
+	offset = copy.vertexCount > 0 ? copy.positions[0] - prototype.positions[0] : vec3(0.0f);
+	float maxPositionError = tolerance * std::max(getMeshSize(prototype), 1e-6f);
+	for (uint32_t v = 0; v < copy.vertexCount; v++)
+	{
+		vec3 positionError = abs(copy.positions[v] - prototype.positions[v] - offset);
+		vec3 normalError = abs(copy.normals[v] - prototype.normals[v]);
+		if (max(positionError.x, max(positionError.y, positionError.z)) > maxPositionError ||
+			max(normalError.x, max(normalError.y, normalError.z)) > 1e-3f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t MeshInstancing::getSavedBytes(const std::vector<MeshView>& meshes) const
+{
+	uint64_t bytes = 0;
+	for (uint32_t i = 0; i < (uint32_t)meshes.size(); i++)
+	{
+		if (!isPrototype(i))
+		{
+			bytes += 2 * meshes[i].vertexCount * sizeof(vec3) + meshes[i].indexCount * sizeof(uint32_t);
+		}
+	}
+	return bytes;
+}
+
+void findDuplicateMeshes(const std::vector<MeshView>& meshes, MeshInstancing& instancing, float tolerance, TaskPool* pPool)
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	uint32_t numMeshes = (uint32_t)meshes.size();
+
+	std::vector<uint64_t> hashes(numMeshes);
+	pool.parallelFor(numMeshes, [&](uint32_t i)
+	{
+		hashes[i] = hashMeshTopology(meshes[i]);
+	});
+
+	instancing.uniqueMeshes.clear();
+	instancing.meshToUnique.resize(numMeshes);
+	instancing.offsets.assign(numMeshes, vec3(0.0f));
+
+	// In mesh order, so the first occurrence of a mesh becomes the prototype and the result is deterministic
+	std::unordered_map<uint64_t, std::vector<uint32_t>> candidates;
+	for (uint32_t i = 0; i < numMeshes; i++)
+	{
+		std::vector<uint32_t>& bucket = candidates[hashes[i]];
+		bool found = false;
+		for (uint32_t unique : bucket)
+		{
+			vec3 offset;
+			if (matchMeshes(meshes[instancing.uniqueMeshes[unique]], meshes[i], tolerance, offset))
+			{
+				instancing.meshToUnique[i] = unique;
+				instancing.offsets[i] = offset;
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+		{
+			uint32_t unique = (uint32_t)instancing.uniqueMeshes.size();
+			instancing.uniqueMeshes.push_back(i);
+			instancing.meshToUnique[i] = unique;
+			if (bucket.size() < kMaxCandidatesPerHash)
+			{
+				bucket.push_back(unique);
+			}
+		}
+	}
+}
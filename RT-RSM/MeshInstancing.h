@@ -0,0 +1,31 @@
+#pragma once
+#include "MeshData.h"
+#include "TaskPool.h"
+
+// Maximum vertex distance between two copies, relative to the size of the mesh
+static const float kDuplicateMeshTolerance = 1e-5f;
+
+/*
+	Result of the duplicate mesh detection. Every mesh maps to a unique mesh (its prototype) and the
+	translation that moves the prototype onto it. The scenes are exported with their node transforms
+	baked into the vertices, so copies of a pillar or a lamp only differ by where they are placed.
+*/
+struct MeshInstancing
+{
+	std::vector<uint32_t>	uniqueMeshes;	// mesh index of every prototype
+	std::vector<uint32_t>	meshToUnique;	// per mesh, index into uniqueMeshes
+	std::vector<vec3>		offsets;		// per mesh, translation from the prototype
+
+	uint32_t getNumUnique() const { return (uint32_t)uniqueMeshes.size(); }
+	bool isPrototype(uint32_t mesh) const { return uniqueMeshes[meshToUnique[mesh]] == mesh; }
+
+	// Bytes of vertex, normal and index data that don't have to be uploaded
+	uint64_t getSavedBytes(const std::vector<MeshView>& meshes) const;
+};
+
+/*
+	Hash every mesh by its translation invariant content (counts and indices), then compare the candidates
+	that share a hash vertex by vertex. Two meshes are only merged if all positions match up to a common
+	translation and all normals match, within the tolerance.
+*/
+void findDuplicateMeshes(const std::vector<MeshView>& meshes, MeshInstancing& instancing, float tolerance = kDuplicateMeshTolerance, TaskPool* pPool = nullptr);
@@ -0,0 +1,128 @@
+#include "MeshQuantization.h"
+#include "Externals/GLM/glm/gtc/packing.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Keeps flat meshes (e.g. a plane with zero height) from dividing by zero
+static const float kMinHalfExtent = 1e-6f;
+
+PositionQuantization computePositionQuantization(const vec3* pPositions, uint32_t count)
+{
+	PositionQuantization quantization;
+	if (count == 0)
+	{
+		return quantization;
+	}
+	vec3 minPos = pPositions[0];
+	vec3 maxPos = pPositions[0];
+	for (uint32_t v = 1; v < count; v++)
+	{
+		minPos = min(minPos, pPositions[v]);
+		maxPos = max(maxPos, pPositions[v]);
+	}
+	quantization.center = 0.5f * (minPos + maxPos);
+	quantization.halfExtent = max(0.5f * (maxPos - minPos), vec3(kMinHalfExtent));
+	return quantization;
+}
+
+static int16_t toSnorm16(float value)
+{
+	return (int16_t)std::round(clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+// Same conversion as the input assembler, -32768 and -32767 both decode to -1
+static float fromSnorm16(int16_t value)
+{
+	return std::max(value / 32767.0f, -1.0f);
+}
+
+void quantizePositions(const vec3* pPositions, uint32_t count, const PositionQuantization& quantization, QuantizedPosition* pDst)
+{
+	vec3 invHalfExtent = 1.0f / quantization.halfExtent;
+	for (uint32_t v = 0; v < count; v++)
+	{
+		vec3 p = (pPositions[v] - quantization.center) * invHalfExtent;
+		pDst[v].x = toSnorm16(p.x);
+		pDst[v].y = toSnorm16(p.y);
+		pDst[v].z = toSnorm16(p.z);
+		pDst[v].w = 0;
+	}
+}
+
+vec3 dequantizePosition(const QuantizedPosition& position, const PositionQuantization& quantization)
+{
+	vec3 p(fromSnorm16(position.x), fromSnorm16(position.y), fromSnorm16(position.z));
+	return p * quantization.halfExtent + quantization.center;
+}
+
+uint32_t encodeOctahedralNormal(vec3 normal)
+{
+	float l1 = abs(normal.x) + abs(normal.y) + abs(normal.z);
+	if (l1 == 0.0f)
+	{
+		return packHalf2x16(vec2(0.0f));
+	}
+	vec2 p = vec2(normal.x, normal.y) * (1.0f / l1);
+	if (normal.z <= 0.0f)
+	{
+		vec2 signs(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+		p = (1.0f - abs(vec2(p.y, p.x))) * signs;
+	}
+	return packHalf2x16(p);
+}
+
+vec3 decodeOctahedralNormal(uint32_t octahedral)
+{
+	vec2 e = unpackHalf2x16(octahedral);
+	vec3 v(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	if (v.z < 0.0f)
+	{
+		vec2 signs(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+		vec2 xy = (1.0f - abs(vec2(v.y, v.x))) * signs;
+		v.x = xy.x;
+		v.y = xy.y;
+	}
+	return normalize(v);
+}
+
+void encodeOctahedralNormals(const vec3* pNormals, uint32_t count, uint32_t* pDst)
+{
+	for (uint32_t v = 0; v < count; v++)
+	{
+		pDst[v] = encodeOctahedralNormal(pNormals[v]);
+	}
+}
+
+QuantizationError measureQuantizationError(const MeshView& mesh)
+{
+	QuantizationError error;
+	if (mesh.vertexCount == 0)
+	{
+		return error;
+	}
+
+	PositionQuantization quantization = computePositionQuantization(mesh.positions, mesh.vertexCount);
+	std::vector<QuantizedPosition> positions(mesh.vertexCount);
+	quantizePositions(mesh.positions, mesh.vertexCount, quantization, positions.data());
+
+	// Rounding to the nearest of 65535 steps over [-halfExtent, halfExtent]
+	error.maxPositionErrorBound = length(quantization.halfExtent) / 32767.0f * 0.5f;
+
+	double normalErrorSum = 0.0;
+	for (uint32_t v = 0; v < mesh.vertexCount; v++)
+	{
+		error.maxPositionError = std::max(error.maxPositionError, length(dequantizePosition(positions[v], quantization) - mesh.positions[v]));
+
+		if (dot(mesh.normals[v], mesh.normals[v]) == 0.0f)
+		{
+			continue;
+		}
+		vec3 normal = normalize(mesh.normals[v]);
+		vec3 decoded = decodeOctahedralNormal(encodeOctahedralNormal(normal));
+		float angle = degrees(acos(clamp(dot(normal, decoded), -1.0f, 1.0f)));
+		error.maxNormalErrorDegrees = std::max(error.maxNormalErrorDegrees, angle);
+		normalErrorSum += angle;
+	}
+	error.meanNormalErrorDegrees = (float)(normalErrorSum / mesh.vertexCount);
+	return error;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "MeshData.h"
+
+///////////////////////////////////////////
+// Quantized vertex streams
+///////////////////////////////////////////
+/*
+	Positions are stored as 16-bit SNORM relative to the mesh AABB: the centre maps to 0 and the faces of the box
+	to -1 and 1, so the error per axis is at most halfExtent / 32767 / 2. The w component is padding.
+	Normals use the octahedral mapping packed as two halfs, the same encoding as dirToOct in Common.hlsli.
+*/
+struct QuantizedPosition
+{
+	int16_t x, y, z, w;
+};
+
+struct PositionQuantization
+{
+	vec3 center = vec3(0.0f);
+	vec3 halfExtent = vec3(1.0f);
+
+	// Decoded position = snorm * scale + bias
+	vec4 getScale() const { return vec4(halfExtent, 0.0f); }
+	vec4 getBias() const { return vec4(center, 0.0f); }
+};
+
+PositionQuantization computePositionQuantization(const vec3* pPositions, uint32_t count);
+void quantizePositions(const vec3* pPositions, uint32_t count, const PositionQuantization& quantization, QuantizedPosition* pDst);
+vec3 dequantizePosition(const QuantizedPosition& position, const PositionQuantization& quantization);
+
+uint32_t encodeOctahedralNormal(vec3 normal);
+vec3 decodeOctahedralNormal(uint32_t octahedral);
+void encodeOctahedralNormals(const vec3* pNormals, uint32_t count, uint32_t* pDst);
+
+// Round trip error of one mesh, measured over all of its vertices
+struct QuantizationError
+{
+	float maxPositionError = 0.0f;			// in model units
+	float maxPositionErrorBound = 0.0f;		// analytic bound from the AABB
+	float maxNormalErrorDegrees = 0.0f;
+	float meanNormalErrorDegrees = 0.0f;
+};
+
+QuantizationError measureQuantizationError(const MeshView& mesh);
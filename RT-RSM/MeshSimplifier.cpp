@@ -0,0 +1,320 @@
+#include "MeshSimplifier.h"
+#include "IndexOptimizer.h"
+#include <algorithm>
+#include <float.h>
+#include <string.h>
+#include <unordered_map>
+
+// Symmetric 4x4 matrix of the plane equations ax + by + cz + d, squared distance to the planes is p^T Q p
+struct Quadric
+{
+	double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+	double b2 = 0.0, bc = 0.0, bd = 0.0;
+	double c2 = 0.0, cd = 0.0;
+	double d2 = 0.0;
+
+	void addPlane(double a, double b, double c, double d, double weight)
+	{
+		a2 += weight * a * a; ab += weight * a * b; ac += weight * a * c; ad += weight * a * d;
+		b2 += weight * b * b; bc += weight * b * c; bd += weight * b * d;
+		c2 += weight * c * c; cd += weight * c * d;
+		d2 += weight * d * d;
+	}
+
+	void add(const Quadric& q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double evaluate(const vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double error = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+			2.0 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z);
+		return std::max(error, 0.0);
+	}
+};
+
+struct Collapse
+{
+	uint32_t	from;
+	uint32_t	to;
+	double		cost;
+};
+
+static uint64_t getEdgeKey(uint32_t a, uint32_t b)
+{
+	return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+// Border vertices (an edge used by one triangle only) and seam vertices (another vertex at the same position) are locked
+static std::vector<bool> findLockedVertices(const MeshView& mesh)
+{
+	std::vector<bool> locked(mesh.vertexCount, false);
+
+	std::unordered_map<uint64_t, uint32_t> edgeUse;
+	edgeUse.reserve(mesh.indexCount);
+	for (uint32_t i = 0; i < mesh.indexCount; i += 3)
+	{
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			edgeUse[getEdgeKey(mesh.indices[i + k], mesh.indices[i + (k + 1) % 3])]++;
+		}
+	}
+	for (const auto& edge : edgeUse)
+	{
+		if (edge.second == 1)
+		{
+			locked[edge.first >> 32] = true;
+			locked[edge.first & 0xffffffff] = true;
+		}
+	}
+
+	struct PositionHash
+	{
+		size_t operator()(const vec3& p) const
+		{
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+		}
+	};
+	std::unordered_map<vec3, uint32_t, PositionHash> firstAtPosition;
+	firstAtPosition.reserve(mesh.vertexCount);
+	for (uint32_t v = 0; v < mesh.vertexCount; v++)
+	{
+		auto inserted = firstAtPosition.insert(std::make_pair(mesh.positions[v], v));
+		if (!inserted.second)
+		{
+			locked[v] = true;
+			locked[inserted.first->second] = true;
+		}
+	}
+	return locked;
+}
+
+static vec3 getTriangleNormal(const vec3& p0, const vec3& p1, const vec3& p2)
+{
+	return cross(p1 - p0, p2 - p0);
+}
+
+// True if moving from onto to flips, collapses or turns by more than about 75 degrees any triangle around from that doesn't contain to
+static bool flipsTriangles(const MeshView& mesh, const std::vector<uint32_t>& indices, const std::vector<uint32_t>& adjacencyOffset,
+	const std::vector<uint32_t>& adjacency, uint32_t from, uint32_t to)
+{
+	for (uint32_t a = adjacencyOffset[from]; a < adjacencyOffset[from + 1]; a++)
+	{
+		const uint32_t* pTriangle = &indices[3 * adjacency[a]];
+		if (pTriangle[0] == to || pTriangle[1] == to || pTriangle[2] == to)
+		{
+			continue;
+		}
+		vec3 p[3], q[3];
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			p[k] = mesh.positions[pTriangle[k]];
+			q[k] = mesh.positions[pTriangle[k] == from ? to : pTriangle[k]];
+		}
+		vec3 before = getTriangleNormal(p[0], p[1], p[2]);
+		vec3 after = getTriangleNormal(q[0], q[1], q[2]);
+		if (dot(before, after) <= 0.25f * length(before) * length(after))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+float simplifyMesh(const MeshView& mesh, uint32_t targetIndexCount, float maxError, std::vector<uint32_t>& indices)
+{
+	indices.assign(mesh.indices, mesh.indices + mesh.indexCount);
+	if (mesh.vertexCount == 0 || mesh.indexCount <= targetIndexCount)
+	{
+		return 0.0f;
+	}
+
+	vec3 minPos = mesh.positions[0];
+	vec3 maxPos = mesh.positions[0];
+	for (uint32_t v = 1; v < mesh.vertexCount; v++)
+	{
+		minPos = min(minPos, mesh.positions[v]);
+		maxPos = max(maxPos, mesh.positions[v]);
+	}
+	double scale = std::max((double)length(maxPos - minPos), 1e-12);
+	double maxCost = (double)maxError * maxError * scale * scale;
+
+	// Area weighted plane quadric of every triangle on each of its vertices
+	std::vector<Quadric> quadrics(mesh.vertexCount);
+	for (uint32_t i = 0; i < mesh.indexCount; i += 3)
+	{
+		vec3 p0 = mesh.positions[mesh.indices[i]];
+		vec3 normal = getTriangleNormal(p0, mesh.positions[mesh.indices[i + 1]], mesh.positions[mesh.indices[i + 2]]);
+		float area2 = length(normal);
+		if (area2 == 0.0f)
+		{
+			continue;
+		}
+		normal /= area2;
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			quadrics[mesh.indices[i + k]].addPlane(normal.x, normal.y, normal.z, -dot(normal, p0), 0.5 * area2);
+		}
+	}
+
+	std::vector<bool> locked = findLockedVertices(mesh);
+	std::vector<uint32_t> adjacencyOffset(mesh.vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<bool> touched(mesh.vertexCount);
+	std::vector<uint32_t> remap(mesh.vertexCount);
+	double reachedCost = 0.0;
+
+	// Each pass collapses a set of independent edges in order of cost, then compacts the index buffer
+	while (indices.size() > targetIndexCount)
+	{
+		uint32_t triangleCount = (uint32_t)indices.size() / 3;
+		std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+		for (uint32_t index : indices)
+		{
+			adjacencyOffset[index + 1]++;
+		}
+		for (uint32_t v = 0; v < mesh.vertexCount; v++)
+		{
+			adjacencyOffset[v + 1] += adjacencyOffset[v];
+		}
+		adjacency.resize(indices.size());
+		std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (uint32_t i = 0; i < (uint32_t)indices.size(); i++)
+		{
+			adjacency[fill[indices[i]]++] = i / 3;
+		}
+
+		collapses.clear();
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t a = indices[3 * t + k];
+				uint32_t b = indices[3 * t + (k + 1) % 3];
+				for (uint32_t direction = 0; direction < 2; direction++)
+				{
+					uint32_t from = direction == 0 ? a : b;
+					uint32_t to = direction == 0 ? b : a;
+					if (locked[from] || from == to)
+					{
+						continue;
+					}
+					Quadric q = quadrics[from];
+					q.add(quadrics[to]);
+					collapses.push_back({ from, to, q.evaluate(mesh.positions[to]) });
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+		{
+			return a.cost < b.cost || (a.cost == b.cost && (a.from < b.from || (a.from == b.from && a.to < b.to)));
+		});
+
+		for (uint32_t v = 0; v < mesh.vertexCount; v++)
+		{
+			remap[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+		uint32_t removedTriangles = 0;
+		uint32_t numCollapsed = 0;
+		uint32_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.cost > maxCost || removedTriangles >= trianglesToRemove)
+			{
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to] ||
+				flipsTriangles(mesh, indices, adjacencyOffset, adjacency, collapse.from, collapse.to))
+			{
+				continue;
+			}
+
+			// Lock the whole neighbourhood for this pass so the flip test above stays valid
+			for (uint32_t a = adjacencyOffset[collapse.from]; a < adjacencyOffset[collapse.from + 1]; a++)
+			{
+				const uint32_t* pTriangle = &indices[3 * adjacency[a]];
+				bool shared = pTriangle[0] == collapse.to || pTriangle[1] == collapse.to || pTriangle[2] == collapse.to;
+				removedTriangles += shared ? 1 : 0;
+				touched[pTriangle[0]] = touched[pTriangle[1]] = touched[pTriangle[2]] = true;
+			}
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			reachedCost = std::max(reachedCost, collapse.cost);
+			numCollapsed++;
+		}
+		if (numCollapsed == 0)
+		{
+			break;
+		}
+
+		// Remap and drop the triangles that became degenerate
+		uint32_t write = 0;
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			uint32_t i0 = remap[indices[3 * t + 0]];
+			uint32_t i1 = remap[indices[3 * t + 1]];
+			uint32_t i2 = remap[indices[3 * t + 2]];
+			if (i0 != i1 && i1 != i2 && i0 != i2)
+			{
+				indices[write++] = i0;
+				indices[write++] = i1;
+				indices[write++] = i2;
+			}
+		}
+		indices.resize(write);
+	}
+
+	return (float)(sqrt(reachedCost) / scale);
+}
+
+void generateLods(MeshData& mesh)
+{
+	mesh.lods.clear();
+	MeshView view = mesh.view();
+	uint32_t previousCount = view.indexCount;
+	for (uint32_t l = 0; l < kMaxMeshLods - 1; l++)
+	{
+		uint32_t target = (uint32_t)(view.indexCount / 3 * kLodTriangleRatio[l]) * 3;
+		MeshLod lod;
+		lod.error = simplifyMesh(view, target, kLodMaxError[l], lod.indices);
+		if (lod.indices.empty() || lod.indices.size() > previousCount * kMinLodReduction)
+		{
+			break;
+		}
+		optimizeVertexCache(lod.indices.data(), (uint32_t)lod.indices.size(), view.vertexCount);
+		previousCount = (uint32_t)lod.indices.size();
+		mesh.lods.push_back(std::move(lod));
+	}
+}
+
+float LodPolicy::getProjectedSize(const vec3& center, float radius) const
+{
+	float depth = (viewMat * vec4(center, 1.0f)).z;
+	if (depth - radius <= nearPlane)
+	{
+		return FLT_MAX;
+	}
+	return 2.0f * radius * projScale / depth * 0.5f * viewportHeight;
+}
+
+uint32_t LodPolicy::selectLod(const vec3& center, float radius, const float* lodErrors, uint32_t lodCount) const
+{
+	float size = getProjectedSize(center, radius);
+	for (uint32_t l = lodCount; l > 0; l--)
+	{
+		if (lodErrors[l - 1] * size <= maxErrorPixels)
+		{
+			return l;
+		}
+	}
+	return 0;
+}
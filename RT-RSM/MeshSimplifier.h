@@ -0,0 +1,52 @@
+#pragma once
+#include "MeshData.h"
+
+///////////////////////////////////////////
+// Mesh simplification
+///////////////////////////////////////////
+/*
+	Quadric error simplification (Garland and Heckbert 1997) by half-edge collapses: a vertex is merged
+	into one of its neighbours, so the result is a new index buffer over the same vertex and normal
+	buffers and a LOD costs nothing but its indices. Vertices on open borders and on attribute seams
+	(several vertices at one position) never move, which keeps the LODs crack free.
+	Errors are distances relative to the diagonal of the mesh AABB.
+*/
+
+// Triangle ratio and largest relative error of LOD 1, 2, ...
+static const float kLodTriangleRatio[kMaxMeshLods - 1] = { 0.25f, 0.0625f };
+static const float kLodMaxError[kMaxMeshLods - 1] = { 0.01f, 0.04f };
+
+// A LOD is only kept if it has at most this fraction of the triangles of the previous one
+static const float kMinLodReduction = 0.8f;
+
+// Simplify to at most targetIndexCount indices, or as far as possible without exceeding maxError. Returns the error reached.
+float simplifyMesh(const MeshView& mesh, uint32_t targetIndexCount, float maxError, std::vector<uint32_t>& indices);
+
+// Fill mesh.lods with up to kMaxMeshLods - 1 simplified index buffers in vertex cache order
+void generateLods(MeshData& mesh);
+
+// Triangles drawn for a LOD, meshes with fewer LODs use their coarsest one
+inline uint32_t getLodTriangleCount(const MeshView& mesh, uint32_t lod)
+{
+	uint32_t available = lod < mesh.lodCount ? lod : mesh.lodCount;
+	return (available == 0 ? mesh.indexCount : mesh.lods[available - 1].indexCount) / 3;
+}
+
+/*
+	Per-pass LOD choice. A pass without a policy draws LOD 0. With one, every mesh uses the coarsest LOD whose
+	error, scaled by the projected size of the mesh, stays below maxErrorPixels.
+*/
+struct LodPolicy
+{
+	mat4	viewMat;
+	float	projScale = 1.0f;		// projMat[1][1], cot(fovY / 2)
+	float	nearPlane = 0.1f;
+	float	viewportHeight = 1.0f;
+	float	maxErrorPixels = 1.0f;
+
+	// Diameter in pixels of a bounding sphere in the space viewMat transforms from, FLT_MAX if it reaches the near plane
+	float getProjectedSize(const vec3& center, float radius) const;
+
+	// lodErrors[l] is the error of LOD l + 1
+	uint32_t selectLod(const vec3& center, float radius, const float* lodErrors, uint32_t lodCount) const;
+};
@@ -0,0 +1,90 @@
+#include "MeshUpload.h"
+#include <algorithm>
+#include <string.h>
+
+// Large buffers are split so a single big mesh doesn't serialize the copy
+static const uint64_t kCopyChunkSize = 1024 * 1024;
+
+void MeshUploadBatch::build(const std::vector<MeshView>& meshes, VertexLayout layout, TaskPool* pPool)
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	uint32_t numMeshes = (uint32_t)meshes.size();
+	bool quantized = layout == VertexLayout::Quantized;
+	uint32_t positionStride = quantized ? sizeof(QuantizedPosition) : sizeof(vec3);
+	uint32_t normalStride = quantized ? sizeof(uint32_t) : sizeof(vec3);
+
+	mLayout = layout;
+	mBuffers.clear();
+	mTotalSize = 0;
+	for (uint32_t i = 0; i < numMeshes; i++)
+	{
+		const MeshView& mesh = meshes[i];
+		mBuffers.push_back({ i, MeshBufferType::Vertex, mesh.positions, (uint64_t)mesh.vertexCount * positionStride, mesh.vertexCount, positionStride, 0 });
+		// 16-bit buffers are padded to 4 bytes, the hit shaders read them with 32-bit raw loads
+		uint32_t indexStride = getIndexSize(mesh.vertexCount);
+		mBuffers.push_back({ i, MeshBufferType::Index, mesh.indices, ((uint64_t)mesh.indexCount * indexStride + 3) & ~3ull, mesh.indexCount, indexStride, 0 });
+		for (uint32_t l = 0; l < mesh.lodCount; l++)
+		{
+			const MeshLodView& lod = mesh.lods[l];
+			mBuffers.push_back({ i, MeshBufferType::Index, lod.indices, ((uint64_t)lod.indexCount * indexStride + 3) & ~3ull, lod.indexCount, indexStride, l + 1 });
+		}
+		mBuffers.push_back({ i, MeshBufferType::Normal, mesh.normals, (uint64_t)mesh.vertexCount * normalStride, mesh.vertexCount, normalStride, 0 });
+	}
+	for (const MeshUploadBuffer& buffer : mBuffers)
+	{
+		mTotalSize += buffer.size;
+	}
+
+	mPositionQuantization.assign(numMeshes, PositionQuantization());
+	if (quantized)
+	{
+		pool.parallelFor(numMeshes, [&](uint32_t i)
+		{
+			mPositionQuantization[i] = computePositionQuantization(meshes[i].positions, meshes[i].vertexCount);
+		});
+	}
+}
+
+void MeshUploadBatch::copy(uint8_t* const* ppDst, TaskPool* pPool) const
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+
+	struct CopyChunk
+	{
+		uint32_t buffer;
+		uint32_t first;
+		uint32_t count;
+	};
+	std::vector<CopyChunk> chunks;
+	for (uint32_t i = 0; i < (uint32_t)mBuffers.size(); i++)
+	{
+		uint32_t chunkElements = (uint32_t)std::max<uint64_t>(kCopyChunkSize / mBuffers[i].stride, 1);
+		for (uint32_t first = 0; first < mBuffers[i].count; first += chunkElements)
+		{
+			chunks.push_back({ i, first, std::min(chunkElements, mBuffers[i].count - first) });
+		}
+	}
+
+	pool.parallelFor((uint32_t)chunks.size(), [&](uint32_t c)
+	{
+		const CopyChunk& chunk = chunks[c];
+		const MeshUploadBuffer& buffer = mBuffers[chunk.buffer];
+		uint8_t* pDst = ppDst[chunk.buffer] + (uint64_t)chunk.first * buffer.stride;
+		if (mLayout == VertexLayout::Quantized && buffer.type == MeshBufferType::Vertex)
+		{
+			quantizePositions((const vec3*)buffer.pSrc + chunk.first, chunk.count, mPositionQuantization[buffer.mesh], (QuantizedPosition*)pDst);
+		}
+		else if (mLayout == VertexLayout::Quantized && buffer.type == MeshBufferType::Normal)
+		{
+			encodeOctahedralNormals((const vec3*)buffer.pSrc + chunk.first, chunk.count, (uint32_t*)pDst);
+		}
+		else if (buffer.type == MeshBufferType::Index && buffer.stride == sizeof(uint16_t))
+		{
+			convertToShortIndices((const uint32_t*)buffer.pSrc + chunk.first, chunk.count, (uint16_t*)pDst);
+		}
+		else
+		{
+			memcpy(pDst, (const uint8_t*)buffer.pSrc + (uint64_t)chunk.first * buffer.stride, (size_t)chunk.count * buffer.stride);
+		}
+	});
+}
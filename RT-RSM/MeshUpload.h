@@ -0,0 +1,60 @@
+#pragma once
+#include "MeshData.h"
+#include "IndexOptimizer.h"
+#include "MeshQuantization.h"
+#include "TaskPool.h"
+
+enum class MeshBufferType
+{
+	Vertex,
+	Normal,
+	Index,
+};
+
+// Layout of the vertex and normal streams on the GPU
+enum class VertexLayout
+{
+	Float,		// vec3 positions and normals
+	Quantized,	// QuantizedPosition and octahedral normals, see MeshQuantization.h
+};
+
+struct MeshUploadBuffer
+{
+	uint32_t		mesh;
+	MeshBufferType	type;
+	const void*		pSrc;
+	uint64_t		size;		// size of the GPU buffer
+	uint32_t		count;		// number of elements
+	uint32_t		stride;		// size of one element in the GPU buffer
+	uint32_t		lod;		// LOD of an index buffer, 0 for the full mesh and for all other buffers
+};
+
+/*
+	Submission stage of the mesh ingestion. The batch lists every vertex, normal and index buffer
+	of a set of meshes, plus one index buffer per LOD; the caller allocates and maps them in one go
+	and copy() then fills all of them in parallel, encoding the vertex streams on the way if the layout is quantized.
+	Index buffers are narrowed to 16 bits for meshes with fewer than 65536 vertices (see useShortIndices).
+	Nothing here touches the device, so it can be benchmarked with plain host memory.
+*/
+class MeshUploadBatch
+{
+public:
+	void build(const std::vector<MeshView>& meshes, VertexLayout layout = VertexLayout::Float, TaskPool* pPool = nullptr);
+
+	const std::vector<MeshUploadBuffer>& getBuffers() const { return mBuffers; }
+	uint32_t getNumBuffers() const { return (uint32_t)mBuffers.size(); }
+	uint64_t getTotalSize() const { return mTotalSize; }
+	VertexLayout getLayout() const { return mLayout; }
+
+	// Per mesh AABB mapping of the quantized positions, identity for the float layout
+	const PositionQuantization& getPositionQuantization(uint32_t mesh) const { return mPositionQuantization[mesh]; }
+
+	// ppDst[i] is the mapped destination of buffer i
+	void copy(uint8_t* const* ppDst, TaskPool* pPool = nullptr) const;
+
+private:
+	std::vector<MeshUploadBuffer>		mBuffers;
+	std::vector<PositionQuantization>	mPositionQuantization;
+	VertexLayout						mLayout = VertexLayout::Float;
+	uint64_t							mTotalSize = 0;
+};
@@ -0,0 +1,168 @@
+#include "Meshlet.h"
+#include <algorithm>
+
+void MeshletTable::clear()
+{
+	firstIndex.clear();
+	indexCount.clear();
+	vertexCount.clear();
+	boundingSpheres.clear();
+	normalCones.clear();
+	meshFirstMeshlet.clear();
+	meshMeshletCount.clear();
+}
+
+// Face normal oriented like the vertex normals, so the cone doesn't depend on the winding of the exporter
+static vec3 getFaceNormal(const MeshView& mesh, uint32_t triangle)
+{
+	uint32_t i0 = mesh.indices[3 * triangle + 0];
+	uint32_t i1 = mesh.indices[3 * triangle + 1];
+	uint32_t i2 = mesh.indices[3 * triangle + 2];
+	vec3 normal = cross(mesh.positions[i1] - mesh.positions[i0], mesh.positions[i2] - mesh.positions[i0]);
+	float len = length(normal);
+	if (len == 0.0f)
+	{
+		return vec3(0.0f);
+	}
+	normal /= len;
+	return dot(normal, mesh.normals[i0] + mesh.normals[i1] + mesh.normals[i2]) < 0.0f ? -normal : normal;
+}
+
+// Bounding sphere around the AABB centre and normal cone of triangles [firstTriangle, firstTriangle + triangleCount)
+static void computeMeshletBounds(const MeshView& mesh, const std::vector<uint32_t>& vertices, uint32_t firstTriangle, uint32_t triangleCount, vec4& sphere, vec4& cone)
+{
+	vec3 minPos = mesh.positions[vertices[0]];
+	vec3 maxPos = minPos;
+	for (uint32_t v : vertices)
+	{
+		minPos = min(minPos, mesh.positions[v]);
+		maxPos = max(maxPos, mesh.positions[v]);
+	}
+	vec3 center = 0.5f * (minPos + maxPos);
+	float radius = 0.0f;
+	for (uint32_t v : vertices)
+	{
+		radius = std::max(radius, length(mesh.positions[v] - center));
+	}
+	sphere = vec4(center, radius);
+
+	vec3 axis(0.0f);
+	for (uint32_t t = firstTriangle; t < firstTriangle + triangleCount; t++)
+	{
+		axis += getFaceNormal(mesh, t);
+	}
+	float axisLength = length(axis);
+	if (axisLength == 0.0f)
+	{
+		cone = vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		return;
+	}
+	axis /= axisLength;
+
+	// The cone has to contain every normal: cutoff = sin(half angle) = sqrt(1 - minDot^2)
+	float minDot = 1.0f;
+	for (uint32_t t = firstTriangle; t < firstTriangle + triangleCount; t++)
+	{
+		vec3 normal = getFaceNormal(mesh, t);
+		if (normal != vec3(0.0f))
+		{
+			minDot = std::min(minDot, dot(normal, axis));
+		}
+	}
+	// Half angle of 90 degrees or more, there is no direction from which all triangles are back facing
+	float cutoff = minDot <= 0.0f ? 1.0f : sqrt(1.0f - minDot * minDot);
+	cone = vec4(axis, cutoff);
+}
+
+void buildMeshlets(const MeshView& mesh, MeshletTable& table)
+{
+	uint32_t triangleCount = mesh.indexCount / 3;
+	std::vector<uint32_t> localIndex(mesh.vertexCount, 0xffffffff);
+	std::vector<uint32_t> vertices;
+	vertices.reserve(kMaxMeshletVertices);
+	uint32_t firstTriangle = 0;
+
+	for (uint32_t t = 0; t <= triangleCount; t++)
+	{
+		// Vertices of triangle t that aren't in the current meshlet yet
+		uint32_t newVertices = 0;
+		if (t < triangleCount)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t v = mesh.indices[3 * t + k];
+				bool repeated = (k > 0 && v == mesh.indices[3 * t]) || (k > 1 && v == mesh.indices[3 * t + 1]);
+				newVertices += localIndex[v] == 0xffffffff && !repeated ? 1 : 0;
+			}
+		}
+
+		// Close the meshlet if the triangle doesn't fit, or at the end of the mesh
+		bool full = (uint32_t)vertices.size() + newVertices > kMaxMeshletVertices || t - firstTriangle == kMaxMeshletTriangles;
+		if ((full || t == triangleCount) && t > firstTriangle)
+		{
+			vec4 sphere, cone;
+			computeMeshletBounds(mesh, vertices, firstTriangle, t - firstTriangle, sphere, cone);
+			table.firstIndex.push_back(3 * firstTriangle);
+			table.indexCount.push_back((uint16_t)(3 * (t - firstTriangle)));
+			table.vertexCount.push_back((uint8_t)vertices.size());
+			table.boundingSpheres.push_back(sphere);
+			table.normalCones.push_back(cone);
+
+			for (uint32_t v : vertices)
+			{
+				localIndex[v] = 0xffffffff;
+			}
+			vertices.clear();
+			firstTriangle = t;
+		}
+
+		if (t < triangleCount)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t v = mesh.indices[3 * t + k];
+				if (localIndex[v] == 0xffffffff)
+				{
+					localIndex[v] = (uint32_t)vertices.size();
+					vertices.push_back(v);
+				}
+			}
+		}
+	}
+}
+
+void buildMeshletTable(const std::vector<MeshView>& meshes, const MeshInstancing* pInstancing, MeshletTable& table, TaskPool* pPool)
+{
+	TaskPool& pool = pPool ? *pPool : TaskPool::getGlobal();
+	uint32_t numMeshes = (uint32_t)meshes.size();
+	uint32_t numUnique = pInstancing ? pInstancing->getNumUnique() : numMeshes;
+
+	// One table per unique mesh in parallel, then concatenated in mesh order
+	std::vector<MeshletTable> uniqueTables(numUnique);
+	pool.parallelFor(numUnique, [&](uint32_t u)
+	{
+		buildMeshlets(meshes[pInstancing ? pInstancing->uniqueMeshes[u] : u], uniqueTables[u]);
+	});
+
+	table.clear();
+	std::vector<uint32_t> uniqueFirstMeshlet(numUnique);
+	for (uint32_t u = 0; u < numUnique; u++)
+	{
+		const MeshletTable& src = uniqueTables[u];
+		uniqueFirstMeshlet[u] = table.getNumMeshlets();
+		table.firstIndex.insert(table.firstIndex.end(), src.firstIndex.begin(), src.firstIndex.end());
+		table.indexCount.insert(table.indexCount.end(), src.indexCount.begin(), src.indexCount.end());
+		table.vertexCount.insert(table.vertexCount.end(), src.vertexCount.begin(), src.vertexCount.end());
+		table.boundingSpheres.insert(table.boundingSpheres.end(), src.boundingSpheres.begin(), src.boundingSpheres.end());
+		table.normalCones.insert(table.normalCones.end(), src.normalCones.begin(), src.normalCones.end());
+	}
+
+	table.meshFirstMeshlet.resize(numMeshes);
+	table.meshMeshletCount.resize(numMeshes);
+	for (uint32_t i = 0; i < numMeshes; i++)
+	{
+		uint32_t u = pInstancing ? pInstancing->meshToUnique[i] : i;
+		table.meshFirstMeshlet[i] = uniqueFirstMeshlet[u];
+		table.meshMeshletCount[i] = uniqueTables[u].getNumMeshlets();
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "MeshData.h"
+#include "MeshInstancing.h"
+#include "TaskPool.h"
+
+///////////////////////////////////////////
+// Meshlets
+///////////////////////////////////////////
+/*
+	Every mesh is cut into meshlets of at most kMaxMeshletVertices vertices and kMaxMeshletTriangles triangles.
+	A meshlet is a contiguous run of the mesh's index buffer, which is already in vertex cache order
+	(IndexOptimizer.h), so it can be drawn with DrawIndexedInstanced(indexCount, 1, firstIndex, 0, 0)
+	and no extra index data is needed. The bounds are in the space of the mesh's vertices.
+*/
+static const uint32_t kMaxMeshletVertices = 64;
+static const uint32_t kMaxMeshletTriangles = 124;
+
+/*
+	Structure of arrays over all meshlets of a model, culling only touches the bounds.
+	normalCones.w is the sine of the cone's half angle, or 1 if the triangles face too many directions to cull.
+*/
+struct MeshletTable
+{
+	std::vector<uint32_t>	firstIndex;			// into the index buffer of the mesh
+	std::vector<uint16_t>	indexCount;
+	std::vector<uint8_t>	vertexCount;
+	std::vector<vec4>		boundingSpheres;	// xyz centre, w radius
+	std::vector<vec4>		normalCones;		// xyz axis, w cutoff
+
+	// Meshlets of every mesh of the model, copies of an instanced mesh point at the prototype's range
+	std::vector<uint32_t>	meshFirstMeshlet;
+	std::vector<uint32_t>	meshMeshletCount;
+
+	uint32_t getNumMeshlets() const { return (uint32_t)firstIndex.size(); }
+	void clear();
+};
+
+// Append the meshlets of one mesh to the table. Does not touch the per mesh ranges.
+void buildMeshlets(const MeshView& mesh, MeshletTable& table);
+
+// Build the meshlets of all meshes in parallel. With pInstancing only the prototypes get meshlets and their copies share them.
+void buildMeshletTable(const std::vector<MeshView>& meshes, const MeshInstancing* pInstancing, MeshletTable& table, TaskPool* pPool = nullptr);
+
+// True if every triangle of the meshlet faces away from the camera. cameraPosition is in the space of the bounds.
+inline bool isMeshletBackfacing(const vec4& sphere, const vec4& cone, const vec3& cameraPosition)
+{
+	vec3 toCenter = vec3(sphere) - cameraPosition;
+	return dot(toCenter, vec3(cone)) >= cone.w * length(toCenter) + sphere.w;
+}
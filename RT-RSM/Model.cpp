@@ -5,15 +5,6 @@
 // Create buffers
 ///////////////////////////////////////////
 
-static const D3D12_HEAP_PROPERTIES kUploadHeapProps =
-{
-	D3D12_HEAP_TYPE_UPLOAD,
-	D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
-	D3D12_MEMORY_POOL_UNKNOWN,
-	0,
-	0,
-};
-
 static const D3D12_HEAP_PROPERTIES kDefaultHeapProps =
 {
 	D3D12_HEAP_TYPE_DEFAULT,
@@ -43,7 +34,7 @@ ID3D12ResourcePtr Model::createBuffer(ID3D12Device5Ptr pDevice, uint64_t size, D
 	return pBuffer;
 }
 
-ID3D12ResourcePtr Model::createPlaneVB(ID3D12Device5Ptr pDevice)
+GeometryRange Model::createPlaneVB(GeometryArena* pArena)
 {
 	VertexType vertices[4];
 	vertices[0].position = vec3(0, 0, 0);
@@ -55,16 +46,10 @@ ID3D12ResourcePtr Model::createPlaneVB(ID3D12Device5Ptr pDevice)
 	vertices[3].position = vec3(1, 0, 0);
 	vertices[3].uv = vec2(1, 0);
 
-	// For simplicity, we create the vertex buffer on the upload heap, but that's not required
-	ID3D12ResourcePtr pBuffer = createBuffer(pDevice, sizeof(vertices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	uint8_t* pData;
-	pBuffer->Map(0, nullptr, (void**)&pData);
-	memcpy(pData, vertices, sizeof(vertices));
-	pBuffer->Unmap(0, nullptr);
-	return pBuffer;
+	return pArena->upload(vertices, sizeof(vertices));
 }
 
-ID3D12ResourcePtr Model::createPlaneIB(ID3D12Device5Ptr pDevice)
+GeometryRange Model::createPlaneIB(GeometryArena* pArena)
 {
 	const uint indices[] =
 	{
@@ -76,16 +61,10 @@ ID3D12ResourcePtr Model::createPlaneIB(ID3D12Device5Ptr pDevice)
 		1
 	};// left hand oriented!
 
-	// For simplicity, we create the vertex buffer on the upload heap, but that's not required
-	ID3D12ResourcePtr pBuffer = createBuffer(pDevice, sizeof(indices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	uint8_t* pData;
-	pBuffer->Map(0, nullptr, (void**)&pData);
-	memcpy(pData, indices, sizeof(indices));
-	pBuffer->Unmap(0, nullptr);
-	return pBuffer;
+	return pArena->upload(indices, sizeof(indices));
 }
 
-ID3D12ResourcePtr Model::createPlaneNB(ID3D12Device5Ptr pDevice)
+GeometryRange Model::createPlaneNB(GeometryArena* pArena)
 {
 	const vec3 normals[] =
 	{
@@ -95,155 +74,130 @@ ID3D12ResourcePtr Model::createPlaneNB(ID3D12Device5Ptr pDevice)
 		vec3(0, 1, 0)
 	};
 
-	// For simplicity, we create the vertex buffer on the upload heap, but that's not required
-	ID3D12ResourcePtr pBuffer = createBuffer(pDevice, sizeof(normals), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	uint8_t* pData;
-	pBuffer->Map(0, nullptr, (void**)&pData);
-	memcpy(pData, normals, sizeof(normals));
-	pBuffer->Unmap(0, nullptr);
-	return pBuffer;
+	return pArena->upload(normals, sizeof(normals));
 }
 
-ID3D12ResourcePtr Model::createVB(ID3D12Device5Ptr pDevice, aiVector3D* aiVertecies, int numVertices)
+GeometryRange Model::createCB(GeometryArena* pArena)
 {
-	ID3D12ResourcePtr pBuffer = createBuffer(pDevice, numVertices * sizeof(vec3), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	uint8_t* pData;
-	pBuffer->Map(0, nullptr, (void**)&pData);
-	memcpy(pData, aiVertecies, numVertices * sizeof(vec3));
-	pBuffer->Unmap(0, nullptr);
-	return pBuffer;
+	return pArena->upload(multipleMeshes? mColors.data() : &mColor, mNumMeshes * sizeof(vec3));
 }
 
-ID3D12ResourcePtr Model::createIB(ID3D12Device5Ptr pDevice, aiFace* aiFaces, int numFaces)
+// One transform per mesh, each bound as a root CBV, so they need constant buffer alignment
+GeometryRange Model::createTransformBuffer(GeometryArena* pArena)
 {
-	ID3D12ResourcePtr pBuffer = createBuffer(pDevice, numFaces * 3 * sizeof(uint), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	uint8_t* pData;
-	pBuffer->Map(0, nullptr, (void**)&pData);
-	for (int i = 0; i < numFaces; i++)
-	{
-		memcpy(pData + i * 3 * sizeof(uint), aiFaces[i].mIndices, 3 * sizeof(uint));
-	}
-	pBuffer->Unmap(0, nullptr);
-	return pBuffer;
+	return pArena->allocate(mNumMeshes * kTransformStride, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
 }
 
-ID3D12ResourcePtr Model::createNB(ID3D12Device5Ptr pDevice, aiVector3D* aiNormals, int numNormals)
+// Row major 3x4 matrix that the BLAS build applies to the SNORM positions, so the BLAS ends up in model space
+GeometryRange Model::createDequantizeTransform(GeometryArena* pArena, const PositionQuantization& quantization)
 {
-	ID3D12ResourcePtr pBuffer = createBuffer(pDevice, numNormals * sizeof(vec3), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	uint8_t* pData;
-	pBuffer->Map(0, nullptr, (void**)&pData);
-	memcpy(pData, aiNormals, numNormals * sizeof(vec3));
-	pBuffer->Unmap(0, nullptr);
-	return pBuffer;
+	if (kVertexLayout != VertexLayout::Quantized)
+	{
+		return GeometryRange();
+	}
+	const float transform[3][4] =
+	{
+		{ quantization.halfExtent.x, 0.0f, 0.0f, quantization.center.x },
+		{ 0.0f, quantization.halfExtent.y, 0.0f, quantization.center.y },
+		{ 0.0f, 0.0f, quantization.halfExtent.z, quantization.center.z },
+	};
+	return pArena->upload(transform, sizeof(transform), D3D12_RAYTRACING_TRANSFORM3X4_BYTE_ALIGNMENT);
 }
 
-ID3D12ResourcePtr Model::createCB(ID3D12Device5Ptr pDevice)
+/*
+	Sub-allocate the vertex, normal and index buffers of the meshes from the arena and fill them all in parallel,
+	encoding the vertex streams to kVertexLayout. Appends one position quantization per mesh.
+	lodIndexRanges gets kMaxMeshLods - 1 slots per mesh for the LOD index buffers.
+*/
+void Model::uploadMeshes(GeometryArena* pArena, const std::vector<MeshView>& meshes, std::vector<GeometryRange>& vertexRanges, std::vector<GeometryRange>& normalRanges, std::vector<GeometryRange>& indexRanges, std::vector<GeometryRange>& lodIndexRanges)
 {
-	ID3D12ResourcePtr pBuffer = createBuffer(pDevice, mNumMeshes * sizeof(vec3), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	uint8_t* pData;
-	pBuffer->Map(0, nullptr, (void**)&pData);
-		memcpy(pData, multipleMeshes? mColors.data() : &mColor, mNumMeshes * sizeof(vec3));
-	pBuffer->Unmap(0, nullptr);
-	return pBuffer;
+	MeshUploadBatch uploadBatch;
+	uploadBatch.build(meshes, kVertexLayout);
+	std::vector<uint8_t*> mappedBuffers(uploadBatch.getNumBuffers());
+	vertexRanges.resize(meshes.size());
+	normalRanges.resize(meshes.size());
+	indexRanges.resize(meshes.size());
+	lodIndexRanges.assign(meshes.size() * (kMaxMeshLods - 1), GeometryRange());
+	for (uint b = 0; b < uploadBatch.getNumBuffers(); b++)
+	{
+		const MeshUploadBuffer& buffer = uploadBatch.getBuffers()[b];
+		GeometryRange range = pArena->allocate(buffer.size);
+		switch (buffer.type)
+		{
+		case MeshBufferType::Vertex: vertexRanges[buffer.mesh] = range; break;
+		case MeshBufferType::Normal: normalRanges[buffer.mesh] = range; break;
+		case MeshBufferType::Index:
+			if (buffer.lod == 0)
+			{
+				indexRanges[buffer.mesh] = range;
+			}
+			else
+			{
+				lodIndexRanges[buffer.mesh * (kMaxMeshLods - 1) + buffer.lod - 1] = range;
+			}
+			break;
+		}
+		mappedBuffers[b] = range.pCpuData;
+	}
+	uploadBatch.copy(mappedBuffers.data());
+
+	for (uint i = 0; i < (uint)meshes.size(); i++)
+	{
+		mPositionQuantization.push_back(uploadBatch.getPositionQuantization(i));
+		mDequantizeTransforms.push_back(createDequantizeTransform(pArena, mPositionQuantization.back()));
+	}
 }
 
-AccelerationStructureBuffers Model::createBottomLevelAS(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, ID3D12ResourcePtr pVB, const uint32_t vertexCount, ID3D12ResourcePtr pIB, const uint32_t indexCount)
+uint32_t Model::createBottomLevelAS(AsManager* pAsManager, ID3D12GraphicsCommandList4Ptr pCmdList, const GeometryRange& vb, const uint32_t vertexCount, const GeometryRange& ib, const uint32_t indexCount, DXGI_FORMAT indexFormat, const GeometryRange& transform, const std::string& owner)
 {
 	D3D12_RAYTRACING_GEOMETRY_DESC geomDesc;
 	geomDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-	geomDesc.Triangles.VertexBuffer.StartAddress = pVB->GetGPUVirtualAddress();
-	geomDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(vec3);
+	geomDesc.Triangles.VertexBuffer.StartAddress = vb.gpuAddress;
+	geomDesc.Triangles.VertexBuffer.StrideInBytes = kPositionStride;
 	geomDesc.Triangles.VertexCount = vertexCount;
-	geomDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-	geomDesc.Triangles.IndexBuffer = pIB->GetGPUVirtualAddress();
-	geomDesc.Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
+	geomDesc.Triangles.VertexFormat = kPositionFormat;
+	geomDesc.Triangles.IndexBuffer = ib.gpuAddress;
+	geomDesc.Triangles.IndexFormat = indexFormat;
 	geomDesc.Triangles.IndexCount = indexCount;
-	geomDesc.Triangles.Transform3x4 = NULL;
+	geomDesc.Triangles.Transform3x4 = transform.gpuAddress; // dequantization, NULL for float positions
 	geomDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE | D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
-	
-
-	// Get the size requirements for the scratch and AS buffers
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
-	inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-	inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION;
-	inputs.NumDescs = 1;
-	inputs.pGeometryDescs = &geomDesc;
-	inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-
-	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
-	pDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &info);
-
-	// Create the buffers. They need to support UAV, and since we are going to immediately use them, we create them with an unordered-access state
-	AccelerationStructureBuffers buffers;
-	buffers.pScratch = createBuffer(pDevice, info.ScratchDataSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, kDefaultHeapProps);
-	buffers.pResult = createBuffer(pDevice, info.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, kDefaultHeapProps);
-
-	// Create the bottom-level AS
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
-	asDesc.Inputs = inputs;
-	asDesc.DestAccelerationStructureData = buffers.pResult->GetGPUVirtualAddress();
-	asDesc.ScratchAccelerationStructureData = buffers.pScratch->GetGPUVirtualAddress();
-
-	pCmdList->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
-
-	// We need to insert a UAV barrier before using the acceleration structures in a raytracing operation
-	D3D12_RESOURCE_BARRIER uavBarrier = {};
-	uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-	uavBarrier.UAV.pResource = buffers.pResult;
-	pCmdList->ResourceBarrier(1, &uavBarrier);
-
-	return buffers;
-}
-
-inline glm::mat4 aiMatrix4x4ToGlm(const aiMatrix4x4* from)
-{
-	// from: https://stackoverflow.com/questions/29184311/how-to-rotate-a-skinned-models-bones-in-c-using-assimp
-	glm::mat4 to;
-
-	to[0][0] = (f32)from->a1; to[0][1] = (f32)from->b1;  to[0][2] = (f32)from->c1; to[0][3] = (f32)from->d1;
-	to[1][0] = (f32)from->a2; to[1][1] = (f32)from->b2;  to[1][2] = (f32)from->c2; to[1][3] = (f32)from->d2;
-	to[2][0] = (f32)from->a3; to[2][1] = (f32)from->b3;  to[2][2] = (f32)from->c3; to[2][3] = (f32)from->d3;
-	to[3][0] = (f32)from->a4; to[3][1] = (f32)from->b4;  to[3][2] = (f32)from->c4; to[3][3] = (f32)from->d4;
 
-	return to;
+	// The manager sizes the result, takes the scratch from its pool and records the UAV barrier
+	return pAsManager->buildBottomLevel(pCmdList, &geomDesc, 1, owner);
 }
 
 ///////////////////////////////////////////
 // Callbacks
 ///////////////////////////////////////////
 
-void Model::loadModelHardCodedPlane(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList)
+void Model::loadModelHardCodedPlane(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, GeometryArena* pArena)
 {
 	// create and set up VB, IB and NB
-	mpVertexBuffer = createPlaneVB(pDevice);
-	mpVertexBuffer->SetName((std::wstring(mName) + L" Vertex Buffer").c_str());
-	mpIndexBuffer = createPlaneIB(pDevice);
-	mpIndexBuffer->SetName((std::wstring(mName) + L" Index Buffer").c_str());
-	//mpNormalBuffer = createPlaneNB(pDevice);
-	//mpNormalBuffer->SetName((std::wstring(mName) + L" Normal Buffer").c_str());
+	mVertexRange = createPlaneVB(pArena);
+	mIndexRange = createPlaneIB(pArena);
+	//mNormalRange = createPlaneNB(pArena);
 
 	// VB view
-	mVertexBufferView.BufferLocation = mpVertexBuffer->GetGPUVirtualAddress();
+	mVertexBufferView.BufferLocation = mVertexRange.gpuAddress;
 	mVertexBufferView.StrideInBytes = sizeof(VertexType);
 	mVertexBufferView.SizeInBytes = 4 * sizeof(VertexType);
 
 	// IB view
-	mIndexBufferView.BufferLocation = mpIndexBuffer->GetGPUVirtualAddress();
+	mIndexBufferView.BufferLocation = mIndexRange.gpuAddress;
 	mIndexBufferView.Format = DXGI_FORMAT_R32_UINT;
 	mIndexBufferView.SizeInBytes = 6 * sizeof(uint);
 
 	//// create transform buffer
-	//mpTransformBuffer = createBuffer(pDevice, sizeof(mat4), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	//mpTransformBuffer->SetName((std::wstring(mName) + L" Transform").c_str());
+	//mTransformRange = createTransformBuffer(pArena);
 
 
 	//// BLAS
 	//AccelerationStructureBuffers bottomLevelBuffer = createBottomLevelAS(
 	//															pDevice,
 	//															pCmdList,
-	//															mpVertexBuffer,
+	//															mVertexRange,
 	//															4,
-	//															mpIndexBuffer,
+	//															mIndexRange,
 	//															6
 	//														);
 
@@ -253,121 +207,171 @@ void Model::loadModelHardCodedPlane(ID3D12Device5Ptr pDevice, ID3D12GraphicsComm
 /*
 	Load a single mesh from a file using assimp and create all the buffers and BLAS
 */
-AccelerationStructureBuffers Model::loadModelFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform)
+uint32_t Model::loadModelFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, GeometryArena* pArena, AsManager* pAsManager, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform)
 {
-	const aiScene* scene = pImporter->ReadFile(pFileName,
-		aiProcess_CalcTangentSpace |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_Triangulate |
-		aiProcess_GenNormals |
-		aiProcess_FixInfacingNormals |
-		aiProcess_GenUVCoords |
-		aiProcess_TransformUVCoords |
-		aiProcess_MakeLeftHanded |
-		aiProcess_FindInvalidData);
-	aiMesh* mesh = scene->mMeshes[0];
+	// Go through the mesh cache, assimp is only used if there is no valid cache for the file
+	MeshCache meshCache;
+	if (!meshCache.load(pImporter, pFileName, kSingleMeshProcessFlags) || meshCache.getNumMeshes() == 0)
+	{
+		msgBox("Failed to load " + std::string(pFileName));
+		return kInvalidAsId;
+	}
+	MeshView mesh = meshCache.getMesh(0);
+	computeLocalBounds(std::vector<MeshView>(1, mesh));
 
 	// create and set up VB, IB and NB
-	mpVertexBuffer = createVB(pDevice, mesh->mVertices, mesh->mNumVertices);
-	mpVertexBuffer->SetName((std::wstring(mName) + L" Vertex Buffer").c_str());
-	mpIndexBuffer = createIB(pDevice, mesh->mFaces, mesh->mNumFaces);
-	mpIndexBuffer->SetName((std::wstring(mName) + L" Index Buffer").c_str());
-	mpNormalBuffer = createNB(pDevice, mesh->mNormals, mesh->mNumVertices);
-	mpNormalBuffer->SetName((std::wstring(mName) + L" Normal Buffer").c_str());
+	std::vector<GeometryRange> vertexRanges, normalRanges, indexRanges;
+	uploadMeshes(pArena, std::vector<MeshView>(1, mesh), vertexRanges, normalRanges, indexRanges, mLodIndexRanges);
+	mVertexRange = vertexRanges[0];
+	mIndexRange = indexRanges[0];
+	mNormalRange = normalRanges[0];
 
 	// VB view
-	mVertexBufferView.BufferLocation = mpVertexBuffer->GetGPUVirtualAddress();
-	mVertexBufferView.StrideInBytes = sizeof(vec3);
-	mVertexBufferView.SizeInBytes = mesh->mNumVertices * sizeof(vec3);
+	mVertexBufferView.BufferLocation = mVertexRange.gpuAddress;
+	mVertexBufferView.StrideInBytes = kPositionStride;
+	mVertexBufferView.SizeInBytes = mesh.vertexCount * kPositionStride;
 
 	// IB view
-	mIndexBufferView.BufferLocation = mpIndexBuffer->GetGPUVirtualAddress();
-	mIndexBufferView.Format = DXGI_FORMAT_R32_UINT;
-	mIndexBufferView.SizeInBytes = mesh->mNumFaces * 3 * sizeof(uint);
+	mIndexBufferView.BufferLocation = mIndexRange.gpuAddress;
+	mIndexBufferView.Format = getIndexFormat(mesh.vertexCount);
+	mIndexBufferView.SizeInBytes = mesh.indexCount * getIndexSize(mesh.vertexCount);
+	createLodIndexBufferViews(std::vector<MeshView>(1, mesh));
 
 	// Color buffer
-	mpColorBuffer = createCB(pDevice);
-	mpColorBuffer->SetName((std::wstring(mName) + L" Color").c_str());
+	mColorRange = createCB(pArena);
 
 	// create transform buffer
-	mpTransformBuffer = createBuffer(pDevice, 2*sizeof(mat4), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	mpTransformBuffer->SetName((std::wstring(mName) + L" Transform").c_str());
+	mTransformRange = createTransformBuffer(pArena);
 	if (loadTransform)
 	{
-		aiMatrix4x4 transform = scene->mRootNode->mChildren[0]->mTransformation;
-		mVertexToModel = aiMatrix4x4ToGlm(&transform);
+		mVertexToModel = meshCache.getRootTransform();
 	}
 	// BLAS
-	AccelerationStructureBuffers bottomLevelBuffer = createBottomLevelAS(
-																pDevice,
-																pCmdList,
-																mpVertexBuffer,
-																mesh->mNumVertices,
-																mpIndexBuffer,
-																mesh->mNumFaces * 3
-															);
-
-	return bottomLevelBuffer;
+	return createBottomLevelAS(
+								pAsManager,
+								pCmdList,
+								mVertexRange,
+								mesh.vertexCount,
+								mIndexRange,
+								mesh.indexCount,
+								mIndexBufferView.Format,
+								mDequantizeTransforms[0],
+								pFileName
+							);
+}
+
+// Triangles of the whole file at every LOD, for the load log
+static std::string getLodSummary(const std::vector<MeshView>& meshes)
+{
+	std::string summary = "triangles per LOD";
+	for (uint l = 0; l < kMaxMeshLods; l++)
+	{
+		uint64_t triangles = 0;
+		for (const MeshView& mesh : meshes)
+		{
+			triangles += getLodTriangleCount(mesh, l);
+		}
+		summary += (l == 0 ? " " : " / ") + std::to_string(triangles);
+	}
+	return summary;
 }
 
 /*
-	Load multiple meshes from a file using assimp, and create all the buffers and BLAS
+	Load multiple meshes from a file and create all the buffers and BLAS.
+	The CPU work runs in stages: the meshes are converted to packed arrays in parallel (or mapped from the mesh cache),
+	then all buffers are allocated and filled as one batch before the views and BLAS are set up.
 */
-std::vector<AccelerationStructureBuffers> Model::loadMultipleModelsFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform)
+std::vector<uint32_t> Model::loadMultipleModelsFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, GeometryArena* pArena, AsManager* pAsManager, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform)
 {
-	const aiScene* scene = pImporter->ReadFile(pFileName,
-		aiProcess_CalcTangentSpace |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_Triangulate |
-		aiProcess_GenNormals |
-		/*aiProcess_FixInfacingNormals |*/
-		aiProcess_GenUVCoords |
-		aiProcess_TransformUVCoords |
-		/*aiProcess_MakeLeftHanded |*/
-		aiProcess_FindInvalidData);
-
-	mNumMeshes = scene->mNumMeshes;
+	std::vector<uint32_t> bottomLevelIds;
+
+	// Ingestion: map the mesh cache, or import with assimp and convert the meshes in parallel if there is no valid cache
+	MeshCache meshCache;
+	if (!meshCache.load(pImporter, pFileName, kMultipleMeshProcessFlags))
+	{
+		msgBox("Failed to load " + std::string(pFileName));
+		return bottomLevelIds;
+	}
+
+	mNumMeshes = meshCache.getNumMeshes();
 	multipleMeshes = true;
-	std::vector<AccelerationStructureBuffers> bottomLevelBuffers;
-	for (uint i = 0; i < scene->mNumMeshes; i++)
+	std::vector<MeshView> meshes(mNumMeshes);
+	for (uint i = 0; i < mNumMeshes; i++)
 	{
-		aiMesh* mesh = scene->mMeshes[i];
+		meshes[i] = meshCache.getMesh(i);
+	}
 
-		// create and set up VB, IB and NB
-		mpVertexBuffers.push_back(createVB(pDevice, mesh->mVertices, mesh->mNumVertices));
-		mpVertexBuffers[i]->SetName((std::wstring(mName) + L" sub" + std::to_wstring(i) + L" Vertex Buffer").c_str());
-		mpIndexBuffers.push_back(createIB(pDevice, mesh->mFaces, mesh->mNumFaces));
-		mpIndexBuffers[i]->SetName((std::wstring(mName) + L" sub" + std::to_wstring(i) + L" Index Buffer").c_str());
-		mpNormalBuffers.push_back(createNB(pDevice, mesh->mNormals, mesh->mNumVertices));
-		mpNormalBuffers[i]->SetName((std::wstring(mName) + L" sub" + std::to_wstring(i) + L" Normal Buffer").c_str());
+	// Instancing: copies of the same mesh share the buffers and the BLAS of the first one and only keep their own offset
+	findDuplicateMeshes(meshes, mInstancing);
+	std::vector<MeshView> uniqueMeshes(mInstancing.getNumUnique());
+	for (uint u = 0; u < mInstancing.getNumUnique(); u++)
+	{
+		uniqueMeshes[u] = meshes[mInstancing.uniqueMeshes[u]];
+	}
+
+	// Submission: sub-allocate every buffer of the batch from the arena, then fill them all in parallel
+	std::vector<GeometryRange> vertexRanges, normalRanges, indexRanges, lodIndexRanges;
+	uploadMeshes(pArena, uniqueMeshes, vertexRanges, normalRanges, indexRanges, lodIndexRanges);
+	mVertexRanges.resize(mNumMeshes);
+	mIndexRanges.resize(mNumMeshes);
+	mNormalRanges.resize(mNumMeshes);
+	mLodIndexRanges.resize(mNumMeshes * (kMaxMeshLods - 1));
+	for (uint i = 0; i < mNumMeshes; i++)
+	{
+		uint unique = mInstancing.meshToUnique[i];
+		mVertexRanges[i] = vertexRanges[unique];
+		mNormalRanges[i] = normalRanges[unique];
+		mIndexRanges[i] = indexRanges[unique];
+		for (uint l = 0; l < kMaxMeshLods - 1; l++)
+		{
+			mLodIndexRanges[i * (kMaxMeshLods - 1) + l] = lodIndexRanges[unique * (kMaxMeshLods - 1) + l];
+		}
+	}
+	createLodIndexBufferViews(meshes);
+	mNumBottomLevelAS = mInstancing.getNumUnique();
+
+	computeLocalBounds(meshes);
+
+	OutputDebugStringA((std::string(pFileName) + ": " + std::to_string(mNumMeshes) + " meshes, " + std::to_string(mNumBottomLevelAS) + " BLAS after instancing, " +
+		std::to_string(mInstancing.getSavedBytes(meshes) / 1024) + " KB of geometry saved, " + getLodSummary(meshes) + "\n").c_str());
+
+	for (uint i = 0; i < mNumMeshes; i++)
+	{
+		const MeshView& mesh = meshes[i];
 
 		// VB view
 		D3D12_VERTEX_BUFFER_VIEW vbView;
-		vbView.BufferLocation = mpVertexBuffers[i]->GetGPUVirtualAddress();
-		vbView.StrideInBytes = sizeof(vec3);
-		vbView.SizeInBytes = mesh->mNumVertices * sizeof(vec3);
+		vbView.BufferLocation = mVertexRanges[i].gpuAddress;
+		vbView.StrideInBytes = kPositionStride;
+		vbView.SizeInBytes = mesh.vertexCount * kPositionStride;
 		mVertexBufferViews.push_back(vbView);
 
 		// IB view
 		D3D12_INDEX_BUFFER_VIEW ibView;
-		ibView.BufferLocation = mpIndexBuffers[i]->GetGPUVirtualAddress();
-		ibView.Format = DXGI_FORMAT_R32_UINT;
-		ibView.SizeInBytes = mesh->mNumFaces * 3 * sizeof(uint);
+		ibView.BufferLocation = mIndexRanges[i].gpuAddress;
+		ibView.Format = getIndexFormat(mesh.vertexCount);
+		ibView.SizeInBytes = mesh.indexCount * getIndexSize(mesh.vertexCount);
 		mIndexBufferViews.push_back(ibView);
 
-		// BLAS
-		bottomLevelBuffers.push_back(createBottomLevelAS(
-			pDevice,
-			pCmdList,
-			mpVertexBuffers[i],
-			mesh->mNumVertices,
-			mpIndexBuffers[i],
-			mesh->mNumFaces * 3
-		));
+		// BLAS, only for the first copy of each mesh
+		if (mInstancing.isPrototype(i))
+		{
+			bottomLevelIds.push_back(createBottomLevelAS(
+				pAsManager,
+				pCmdList,
+				mVertexRanges[i],
+				mesh.vertexCount,
+				mIndexRanges[i],
+				mesh.indexCount,
+				ibView.Format,
+				mDequantizeTransforms[mInstancing.meshToUnique[i]],
+				std::string(pFileName) + " mesh " + std::to_string(i)
+			));
+		}
 
 		// colour
 		vec3 color;
-		switch (mesh->mMaterialIndex)
+		switch (mesh.materialIndex)
 		{
 			
 			//// bistro
@@ -408,28 +412,86 @@ std::vector<AccelerationStructureBuffers> Model::loadMultipleModelsFromFile(ID3D
 	}
 
 	// create colour buffer
-	mpColorBuffer = createCB(pDevice);
-	mpColorBuffer->SetName((std::wstring(mName) + L" Colors").c_str());
+	mColorRange = createCB(pArena);
 
 	// create transform buffer
-	mpTransformBuffer = createBuffer(pDevice, 2 * sizeof(mat4), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-	mpTransformBuffer->SetName((std::wstring(mName) + L" Transform").c_str());
+	mTransformRange = createTransformBuffer(pArena);
 	if (loadTransform)
 	{
-		aiMatrix4x4 transform = scene->mRootNode->mChildren[0]->mTransformation;
-		mVertexToModel = aiMatrix4x4ToGlm(&transform);
+		mVertexToModel = meshCache.getRootTransform();
 	}
 
-	return bottomLevelBuffers;
+	return bottomLevelIds;
 }
 
 void Model::updateTransformBuffer()
 {
-	uint8_t* pData;
-	d3d_call(mpTransformBuffer->Map(0, nullptr, (void**)&pData));
-		memcpy(pData, &mModelToWorld, sizeof(mat4));
-		memcpy(pData + sizeof(mModelToWorld), &mModelToWorldPrev, sizeof(mat4));
-	mpTransformBuffer->Unmap(0, nullptr);
+	// The arena stays mapped
+	for (uint i = 0; i < mNumMeshes; i++)
+	{
+		uint8_t* pData = mTransformRange.pCpuData + i * kTransformStride;
+		mat4 modelToWorld = getTransformMatrix(i);
+		mat4 modelToWorldPrev = mModelToWorldPrev * translate(mat4(), getMeshOffset(i));
+		const PositionQuantization& quantization = mPositionQuantization[getBottomLevelASIndex(i)];
+		vec4 dequantize[2] = { quantization.getScale(), quantization.getBias() };
+		memcpy(pData, &modelToWorld, sizeof(mat4));
+		memcpy(pData + sizeof(mat4), &modelToWorldPrev, sizeof(mat4));
+		memcpy(pData + 2 * sizeof(mat4), dequantize, sizeof(dequantize));
+	}
+}
+
+/*
+	Index buffer views of the LODs in mLodIndexRanges, same format as LOD 0 since they index the same vertices
+*/
+void Model::createLodIndexBufferViews(const std::vector<MeshView>& meshes)
+{
+	mLodCounts.assign(meshes.size(), 0);
+	mLodErrors.assign(meshes.size() * (kMaxMeshLods - 1), 0.0f);
+	mLodIndexBufferViews.assign(meshes.size() * (kMaxMeshLods - 1), D3D12_INDEX_BUFFER_VIEW());
+	for (uint i = 0; i < (uint)meshes.size(); i++)
+	{
+		const MeshView& mesh = meshes[i];
+		mLodCounts[i] = mesh.lodCount;
+		for (uint l = 0; l < mesh.lodCount; l++)
+		{
+			uint slot = i * (kMaxMeshLods - 1) + l;
+			mLodErrors[slot] = mesh.lods[l].error;
+			mLodIndexBufferViews[slot].BufferLocation = mLodIndexRanges[slot].gpuAddress;
+			mLodIndexBufferViews[slot].Format = getIndexFormat(mesh.vertexCount);
+			mLodIndexBufferViews[slot].SizeInBytes = mesh.lods[l].indexCount * getIndexSize(mesh.vertexCount);
+		}
+	}
+}
+
+/*
+	Bounds of every mesh from its own positions, copies of an instanced mesh already sit at their offset
+*/
+void Model::computeLocalBounds(const std::vector<MeshView>& meshes)
+{
+	mLocalBounds.resize((uint)meshes.size());
+	TaskPool::getGlobal().parallelFor((uint)meshes.size(), [&](uint i)
+	{
+		vec3 center, extent;
+		computeBoundingBox(meshes[i].positions, meshes[i].vertexCount, center, extent);
+		mLocalBounds.set(i, center, extent);
+	});
+	updateWorldBounds(true);
+}
+
+void Model::updateWorldBounds(bool force)
+{
+	if (!force && mModelToWorld == mWorldBoundsTransform)
+	{
+		return;
+	}
+	mWorldBoundsTransform = mModelToWorld;
+	mWorldBounds.resize(mLocalBounds.size());
+	for (uint i = 0; i < mLocalBounds.size(); i++)
+	{
+		vec3 center, extent;
+		transformBoundingBox(mModelToWorld, mLocalBounds.getCenter(i), mLocalBounds.getExtent(i), center, extent);
+		mWorldBounds.set(i, center, extent);
+	}
 }
 
 Model::Model(LPCWSTR name, uint8_t idx, vec3 color)
@@ -1,5 +1,28 @@
 #pragma once
 #include "Framework.h"
+#include "AsManager.h"
+#include "FrustumCulling.h"
+#include "GeometryArena.h"
+#include "MeshCache.h"
+#include "MeshInstancing.h"
+#include "MeshSimplifier.h"
+#include "MeshUpload.h"
+
+// Define to store positions as 16-bit SNORM relative to the mesh AABB and normals as octahedral 2x16 (MeshQuantization.h).
+// The shaders are compiled with the same define, see compileLibrary.
+#define QUANTIZED_VERTICES
+#ifdef QUANTIZED_VERTICES
+static const VertexLayout kVertexLayout = VertexLayout::Quantized;
+static const DXGI_FORMAT kPositionFormat = DXGI_FORMAT_R16G16B16A16_SNORM;
+static const uint32_t kPositionStride = sizeof(QuantizedPosition);
+#else
+static const VertexLayout kVertexLayout = VertexLayout::Float;
+static const DXGI_FORMAT kPositionFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+static const uint32_t kPositionStride = sizeof(vec3);
+#endif
+
+// Index buffers are R16_UINT for meshes with fewer than 65536 vertices (IndexOptimizer.h)
+inline DXGI_FORMAT getIndexFormat(uint32_t vertexCount) { return useShortIndices(vertexCount) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT; }
 
 class Model
 {
@@ -7,6 +30,11 @@ class Model
 public:
 	Model(LPCWSTR name, uint8_t idx, vec3 color);
 	Model() { mName = L"unnamed model"; mModelIndex = 0; mColor = vec3(1.0f, 1.0f, 1.0f); };
+	// Models are owned by the SceneRegistry and only ever moved
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+	Model(Model&&) = default;
+	Model& operator=(Model&&) = default;
 
 	LPCWSTR getName() { return mName; }
 	uint8_t getModelIndex() { return mModelIndex; }
@@ -14,20 +42,37 @@ public:
 	bool	hasMultipleMeshes() { return multipleMeshes; }
 
 	D3D12_VERTEX_BUFFER_VIEW* getVertexBufferView(int idx) { return multipleMeshes? &mVertexBufferViews[idx] : &mVertexBufferView; }
-	D3D12_INDEX_BUFFER_VIEW* getIndexBufferView(int idx) { return multipleMeshes? &mIndexBufferViews[idx] : &mIndexBufferView; }
-	mat4 getTransformMatrix() { return mModelToWorld; }
-	D3D12_GPU_VIRTUAL_ADDRESS getIndexBufferGPUAdress(int idx) { return multipleMeshes? mpIndexBuffers[idx]->GetGPUVirtualAddress() : mpIndexBuffer->GetGPUVirtualAddress(); }
-	D3D12_GPU_VIRTUAL_ADDRESS getNormalBufferGPUAdress(int idx) { return multipleMeshes? mpNormalBuffers[idx]->GetGPUVirtualAddress() : mpNormalBuffer->GetGPUVirtualAddress(); }
-	D3D12_GPU_VIRTUAL_ADDRESS getColorBufferGPUAdress() { return mpColorBuffer->GetGPUVirtualAddress(); }
-	D3D12_GPU_VIRTUAL_ADDRESS getTransformBufferGPUAdress() { return mpTransformBuffer->GetGPUVirtualAddress(); }
+	D3D12_INDEX_BUFFER_VIEW* getIndexBufferView(int idx, uint lod = 0) { return lod > 0 ? &mLodIndexBufferViews[idx * (kMaxMeshLods - 1) + lod - 1] : multipleMeshes? &mIndexBufferViews[idx] : &mIndexBufferView; }
+	uint getIndexStride(int idx) { return getIndexBufferView(idx)->Format == DXGI_FORMAT_R16_UINT ? (uint)sizeof(uint16_t) : (uint)sizeof(uint); }
+	uint getIndexCount(int idx, uint lod = 0) { return getIndexBufferView(idx, lod)->SizeInBytes / getIndexStride(idx); }
+	// LODs share the vertex buffers of LOD 0 and only have their own index buffer (MeshSimplifier.h)
+	uint getNumLods(int idx) { return mLodCounts.empty() ? 1 : mLodCounts[idx] + 1; }
+	const float* getLodErrors(int idx) { return mLodErrors.empty() ? nullptr : &mLodErrors[idx * (kMaxMeshLods - 1)]; }
+	// Copies of an instanced mesh are placed by their offset from the prototype on top of the model transform
+	vec3 getMeshOffset(int idx) { return multipleMeshes? mInstancing.offsets[idx] : vec3(0.0f); }
+	mat4 getTransformMatrix(int idx) { return mModelToWorld * translate(mat4(), getMeshOffset(idx)); }
+	const mat4& getModelToWorld() const { return mModelToWorld; }
+	D3D12_GPU_VIRTUAL_ADDRESS getIndexBufferGPUAdress(int idx) { return multipleMeshes? mIndexRanges[idx].gpuAddress : mIndexRange.gpuAddress; }
+	D3D12_GPU_VIRTUAL_ADDRESS getNormalBufferGPUAdress(int idx) { return multipleMeshes? mNormalRanges[idx].gpuAddress : mNormalRange.gpuAddress; }
+	D3D12_GPU_VIRTUAL_ADDRESS getColorBufferGPUAdress() { return mColorRange.gpuAddress; }
+	D3D12_GPU_VIRTUAL_ADDRESS getTransformBufferGPUAdress(int idx) { return mTransformRange.gpuAddress + idx * kTransformStride; }
 	uint getNumMeshes() { return mNumMeshes; }
-
-	AccelerationStructureBuffers loadModelFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform);
-	std::vector<AccelerationStructureBuffers> loadMultipleModelsFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform);
-	void loadModelHardCodedPlane(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList);
+	uint getNumBottomLevelAS() { return mNumBottomLevelAS; }
+	uint getBottomLevelASIndex(int idx) { return multipleMeshes? mInstancing.meshToUnique[idx] : 0; }
+	// Model space AABB of every mesh. Empty for the hard coded plane.
+	const BoundingBoxes& getLocalBounds() const { return mLocalBounds; }
+	// World space AABB of every mesh, refreshed when the transform changes. Empty for the hard coded plane.
+	const BoundingBoxes& getWorldBounds() { return mWorldBounds; }
+
+	// All geometry, colour and transform data is sub-allocated from pArena, the BLASes are owned by pAsManager.
+	// Return the AS ids of the BLASes, built but not compacted yet.
+	uint32_t loadModelFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, GeometryArena* pArena, AsManager* pAsManager, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform);
+	std::vector<uint32_t> loadMultipleModelsFromFile(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, GeometryArena* pArena, AsManager* pAsManager, const char* pFileName, Assimp::Importer* pImporter, bool loadTransform);
+	void loadModelHardCodedPlane(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, GeometryArena* pArena);
 
 	void setTransform(mat4 transform) { mModelToWorldPrev = mModelToWorld; 
-											mModelToWorld = transform * mVertexToModel; }
+											mModelToWorld = transform * mVertexToModel;
+											updateWorldBounds(); }
 	void updateTransformBuffer();
 
 protected:
@@ -36,48 +81,71 @@ protected:
 	uint8_t mModelIndex;
 
 	// Single mesh
-	ID3D12ResourcePtr mpVertexBuffer;
-	ID3D12ResourcePtr mpIndexBuffer;
-	ID3D12ResourcePtr mpNormalBuffer;
+	GeometryRange mVertexRange;
+	GeometryRange mIndexRange;
+	GeometryRange mNormalRange;
 
 	D3D12_VERTEX_BUFFER_VIEW	mVertexBufferView;
 	D3D12_INDEX_BUFFER_VIEW		mIndexBufferView;
 	
 	vec3 mColor;
-	ID3D12ResourcePtr mpColorBuffer;
+	GeometryRange mColorRange;
 
 	// Multiple meshes
 	uint mNumMeshes = 1;
 	bool multipleMeshes = false;
-	std::vector<ID3D12ResourcePtr> mpVertexBuffers;
-	std::vector<ID3D12ResourcePtr> mpIndexBuffers;
-	std::vector<ID3D12ResourcePtr> mpNormalBuffers;
+	std::vector<GeometryRange> mVertexRanges;
+	std::vector<GeometryRange> mIndexRanges;
+	std::vector<GeometryRange> mNormalRanges;
 
 	std::vector < D3D12_VERTEX_BUFFER_VIEW>	mVertexBufferViews;
 	std::vector < D3D12_INDEX_BUFFER_VIEW>		mIndexBufferViews;
 
 	std::vector < vec3 > mColors;
 
+	// Duplicate meshes, they share buffers and BLAS
+	MeshInstancing mInstancing;
+	uint mNumBottomLevelAS = 1;
+
+	// Per mesh kMaxMeshLods - 1 slots for the simplified index buffers and their errors, empty for the hard coded plane
+	std::vector<uint> mLodCounts;
+	std::vector<float> mLodErrors;
+	std::vector<GeometryRange> mLodIndexRanges;
+	std::vector < D3D12_INDEX_BUFFER_VIEW>		mLodIndexBufferViews;
+	void createLodIndexBufferViews(const std::vector<MeshView>& meshes);
+
+	// Per mesh AABB in vertex space (including the instance offset) and in world space for culling
+	BoundingBoxes mLocalBounds;
+	BoundingBoxes mWorldBounds;
+	mat4 mWorldBoundsTransform;
+	void computeLocalBounds(const std::vector<MeshView>& meshes);
+	void updateWorldBounds(bool force = false);
+
+	// Per BLAS: mapping of the quantized positions and the same mapping as 3x4 matrix for the BLAS build
+	std::vector<PositionQuantization> mPositionQuantization;
+	std::vector<GeometryRange> mDequantizeTransforms;
+
 	// help functions to create the buffers
 	ID3D12ResourcePtr createBuffer(ID3D12Device5Ptr pDevice, uint64_t size, D3D12_RESOURCE_FLAGS flags, D3D12_RESOURCE_STATES initState, const D3D12_HEAP_PROPERTIES& heapProps);
-	ID3D12ResourcePtr createVB(ID3D12Device5Ptr pDevice, aiVector3D* aiVertecies, int numVertices);
-	ID3D12ResourcePtr createIB(ID3D12Device5Ptr pDevice, aiFace* aiFaces, int numFaces);
-	ID3D12ResourcePtr createNB(ID3D12Device5Ptr pDevice, aiVector3D* aiNormals, int numNormals);
-	ID3D12ResourcePtr createCB(ID3D12Device5Ptr pDevice);
+	GeometryRange createCB(GeometryArena* pArena);
+	GeometryRange createTransformBuffer(GeometryArena* pArena);
+	GeometryRange createDequantizeTransform(GeometryArena* pArena, const PositionQuantization& quantization);
+	void uploadMeshes(GeometryArena* pArena, const std::vector<MeshView>& meshes, std::vector<GeometryRange>& vertexRanges, std::vector<GeometryRange>& normalRanges, std::vector<GeometryRange>& indexRanges, std::vector<GeometryRange>& lodIndexRanges);
 
 
-	ID3D12ResourcePtr createPlaneVB(ID3D12Device5Ptr pDevice);
-	ID3D12ResourcePtr createPlaneIB(ID3D12Device5Ptr pDevice);
-	ID3D12ResourcePtr createPlaneNB(ID3D12Device5Ptr pDevice);
+	GeometryRange createPlaneVB(GeometryArena* pArena);
+	GeometryRange createPlaneIB(GeometryArena* pArena);
+	GeometryRange createPlaneNB(GeometryArena* pArena);
 
-	AccelerationStructureBuffers createBottomLevelAS(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, ID3D12ResourcePtr pVB, const uint32_t vertexCount, ID3D12ResourcePtr pIB, const uint32_t indexCount);
+	uint32_t createBottomLevelAS(AsManager* pAsManager, ID3D12GraphicsCommandList4Ptr pCmdList, const GeometryRange& vb, const uint32_t vertexCount, const GeometryRange& ib, const uint32_t indexCount, DXGI_FORMAT indexFormat, const GeometryRange& transform, const std::string& owner);
 
 
-	// transform
+	// transform, current and previous frame for every mesh, followed by the position dequantization (scale, bias)
+	static const uint kTransformStride = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
 	mat4 mVertexToModel;
 	mat4 mModelToWorld;
 	mat4 mModelToWorldPrev;
-	ID3D12ResourcePtr mpTransformBuffer;
+	GeometryRange mTransformRange;
 
 
 	// for plane only
@@ -212,6 +212,7 @@ void RtRsm::initDXR(HWND winHandle, uint32_t winWidth, uint32_t winHeight)
 
 	// Create the command-list
 	d3d_call(mpDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, mFrameObjects[0].pCmdAllocator, nullptr, IID_PPV_ARGS(&mpCmdList)));
+	mCommands.init(mpDevice, mpCmdList);
 
 	// Create a fence and the event
 	d3d_call(mpDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mpFence)));
@@ -220,15 +221,18 @@ void RtRsm::initDXR(HWND winHandle, uint32_t winWidth, uint32_t winHeight)
 
 uint32_t RtRsm::beginFrame()
 {
+	mCommands.beginFrame();
+
 	// Bind the descriptor heaps
 	ID3D12DescriptorHeap* heaps[] = { mpCbvSrvUavHeap };
-	mpCmdList->SetDescriptorHeaps(arraysize(heaps), heaps);
+	mCommands.setDescriptorHeaps(arraysize(heaps), heaps);
 	return mpSwapChain->GetCurrentBackBufferIndex();
 }
 
 void RtRsm::endFrame(uint32_t rtvIndex)
 {
-	resourceBarrier(mpCmdList, mFrameObjects[rtvIndex].pSwapChainBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PRESENT);
+	mCommands.transition(mFrameObjects[rtvIndex].pSwapChainBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PRESENT);
+	checkCommandStream();
 	mFenceValue = submitCommandList(mpCmdList, mpCmdQueue, mpFence, mFenceValue);
 	mpSwapChain->Present(0, 0);
 
@@ -243,6 +247,105 @@ void RtRsm::endFrame(uint32_t rtvIndex)
 	mpCmdList->Reset(mFrameObjects[bufferIndex].pCmdAllocator, nullptr);
 }
 
+void RtRsm::registerCommandObjects()
+{
+	// Descriptor heaps, the RTV and DSV heaps so the render target handles are recorded as heap and index
+	mCommands.registerDescriptorHeap(mpCbvSrvUavHeap, "CBV/SRV/UAV heap");
+	mCommands.registerDescriptorHeap(mRtvHeap.pHeap, "Swap chain RTV heap");
+	mCommands.registerDescriptorHeap(mpShadowMapDsvHeap, "DSV heap");
+	mCommands.registerDescriptorHeap(mpShadowMapRtvHeap, "RTV heap");
+
+	// Pipelines
+	mCommands.registerRootSignature(mpRasterRootSig, "Shadow map root signature");
+	mCommands.registerPipelineState(mpRasterPipelineState, "Shadow map pipeline");
+	mCommands.registerRootSignature(mpEmptyRootSig, "Ray trace root signature");
+	mCommands.registerStateObject(mpRtPipelineState, "Ray trace pipeline");
+	mCommands.registerRootSignature(mpPathTracerEmptyRootSig, "Path tracer root signature");
+	mCommands.registerStateObject(mpPathTracerPipelineState, "Path tracer pipeline");
+	mCommands.registerRootSignature(mpGeometryBufferRootSig, "G-buffer root signature");
+	mCommands.registerPipelineState(mpGeometryBufferState, "G-buffer pipeline");
+	mCommands.registerRootSignature(mpMotionVectorsRootSig, "Motion vectors root signature");
+	mCommands.registerPipelineState(mpMotionVectorsState, "Motion vectors pipeline");
+	mCommands.registerRootSignature(mpTemporalFilterRootSig, "Temporal filter root signature");
+	mCommands.registerPipelineState(mpTemporalFilterState, "Temporal filter pipeline");
+	mCommands.registerRootSignature(mpSpatialFilterRootSig, "Spatial filter root signature");
+	mCommands.registerPipelineState(mpSpatialFilterStateHorz, "Spatial filter horizontal pipeline");
+	mCommands.registerPipelineState(mpSpatialFilterStateVert, "Spatial filter vertical pipeline");
+	mCommands.registerRootSignature(mpToneMappingRootSig, "Tone mapping root signature");
+	mCommands.registerPipelineState(mpToneMappingState, "Tone mapping pipeline");
+
+	// Buffers that root views, vertex and index buffers and shader tables point into
+	for (uint32_t page = 0; page < mGeometryArena.getNumPages(); page++)
+	{
+		mCommands.registerResource(mGeometryArena.getPageBuffer(page), "Geometry arena page " + std::to_string(page));
+	}
+	mCommands.registerResource(mpShaderTable, "Ray trace shader table");
+	mCommands.registerResource(mpPathTracerShaderTable, "Path tracer shader table");
+
+	// Render targets and the textures of the passes
+	mCommands.registerResource(mpShadowMapTexture_Depth, "Shadow map depth");
+	mCommands.registerResource(mpShadowMapTexture_Position, "Shadow map position");
+	mCommands.registerResource(mpShadowMapTexture_Normal, "Shadow map normal");
+	mCommands.registerResource(mpShadowMapTexture_Flux, "Shadow map flux");
+	mCommands.registerResource(mpGeometryBuffer_Depth, "G-buffer depth");
+	mCommands.registerResource(mpGeometryBuffer_Previous_Depth, "G-buffer previous depth");
+	mCommands.registerResource(mpGeometryBuffer_Normal, "G-buffer normal");
+	mCommands.registerResource(mpGeometryBuffer_Previous_Normal, "G-buffer previous normal");
+	mCommands.registerResource(mpGeometryBuffer_Color, "G-buffer color");
+	mCommands.registerResource(mpGeometryBuffer_Position, "G-buffer position");
+	mCommands.registerResource(mpGeometryBuffer_MotionVectors, "Motion vectors");
+	mCommands.registerResource(mpGeometryBuffer_MotionVectors_depth, "Motion vectors depth");
+	mCommands.registerResource(mpRtIndirectOutput, "Ray trace indirect output");
+	mCommands.registerResource(mpRtDirectOutput, "Ray trace direct output");
+	mCommands.registerResource(mpIndirectColorHistory, "Indirect color history");
+	mCommands.registerResource(mpDirectColorHistory, "Direct color history");
+	mCommands.registerResource(mpTemporalFilterIndirectOutput, "Temporal filter indirect output");
+	mCommands.registerResource(mpTemporalFilterDirectOutput, "Temporal filter direct output");
+	mCommands.registerResource(mpBlurPass1Output, "Spatial filter pass 1 output");
+	mCommands.registerResource(mpBlurPass2Output, "Spatial filter pass 2 output");
+	mCommands.registerResource(mpFilteredIndirectColor, "Filtered indirect color");
+	mCommands.registerResource(mpFilteredDirectColor, "Filtered direct color");
+	mCommands.registerResource(mpToneMappingOutput, "Tone mapping output");
+	for (uint32_t i = 0; i < arraysize(mFrameObjects); i++)
+	{
+		mCommands.registerResource(mFrameObjects[i].pSwapChainBuffer, "Swap chain buffer " + std::to_string(i));
+	}
+}
+
+void RtRsm::checkCommandStream()
+{
+#ifndef _DEBUG
+	// The replay costs CPU time and allocations, release builds only check the frames captured with C
+	if (!mCaptureCommands)
+	{
+		return;
+	}
+#endif
+
+	// Replay the frame on the null device, it tracks the resource states and counts what the GPU would have to do
+	const CommandStream& stream = mCommands.getStream();
+	NullCommandDevice device;
+	stream.replay(device);
+
+	// Report the first frame, and whenever the number of validation errors changes
+	if (mCaptureCommands || mCommandErrors != device.getNumErrors() || !mCommandStreamReported)
+	{
+		OutputDebugStringA((device.getReport() + "\n").c_str());
+		mCommandErrors = device.getNumErrors();
+		mCommandStreamReported = true;
+	}
+
+	if (mCaptureCommands)
+	{
+		// The binary stream can be loaded and replayed later, the text is for diffing frames
+		stream.save("frame_commands.rtcs");
+		std::ofstream text("frame_commands.txt");
+		text << stream.getText();
+		OutputDebugStringA("Saved the frame to frame_commands.rtcs and frame_commands.txt\n");
+		mCaptureCommands = false;
+	}
+}
+
 static const D3D12_HEAP_PROPERTIES kUploadHeapProps =
 {
 	D3D12_HEAP_TYPE_UPLOAD,
@@ -384,68 +487,27 @@ void RtRsm::buildTransforms(float rotation)
 
 #ifdef OFFLINE
 	// area light
-	mModels["Area light"].setTransform(translate(mat4(), mLight.eye) * scale((0.00517905410f/0.255999625f)*vec3(1.0f, 1.0f, 1.0f)));
+	mScene.setTransform(mAreaLight, translate(mat4(), mLight.eye) * scale((0.00517905410f/0.255999625f)*vec3(1.0f, 1.0f, 1.0f)));
 #endif
 	// Sun temple
-	mModels["Sun temple"].setTransform(translate(mat4(), vec3(0.0, 0.0, -25.0/*5.0*/)) * scale(/*0.005f*/0.01f*vec3(1.0f, 1.0f, 1.0f))*mat4());
+	mScene.setTransform(mSunTemple, translate(mat4(), vec3(0.0, 0.0, -25.0/*5.0*/)) * scale(/*0.005f*/0.01f*vec3(1.0f, 1.0f, 1.0f))*mat4());
 	//mModels["Sphere"].setTransform(translate(mat4(), vec3(13.0, 6.5, 6.0*sin(rotation*0.3f)))* scale(0.025f*vec3(1.0f, 1.0f, 1.0f)));
 }
 
-AccelerationStructureBuffers createBottomLevelAS(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, ID3D12ResourcePtr pVB[], const uint32_t vertexCount[], ID3D12ResourcePtr pIB[], const uint32_t indexCount[], uint32_t geometryCount)
+void RtRsm::buildTopLevelAS(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, uint64_t& tlasSize, bool update, SceneInstances& instances, AccelerationStructureBuffers& buffers)
 {
-	std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDesc;
-	geomDesc.resize(geometryCount);
+	int numInstances = mNumInstances;//14/*48*/; // keep in sync with mNumInstances
+	assert(instances.getNumInstances() == (uint)numInstances);
 
-	for (uint32_t i = 0; i < geometryCount; i++)
+	// An update only writes the instances that changed, and skips the build if none did
+	mTlasUpdateStats = TlasUpdateStats();
+	mTlasUpdateStats.type = update ? mTlasUpdatePolicy.chooseBuild(instances) : TlasBuildType::Rebuild;
+	if (mTlasUpdateStats.type == TlasBuildType::None)
 	{
-		geomDesc[i].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-		geomDesc[i].Triangles.VertexBuffer.StartAddress = pVB[i]->GetGPUVirtualAddress();
-		geomDesc[i].Triangles.VertexBuffer.StrideInBytes = sizeof(vec3);
-		geomDesc[i].Triangles.VertexCount = vertexCount[i];
-		geomDesc[i].Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-		geomDesc[i].Triangles.IndexBuffer = pIB[i]->GetGPUVirtualAddress();
-		geomDesc[i].Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
-		geomDesc[i].Triangles.IndexCount = indexCount[i];
-		geomDesc[i].Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
+		PIXSetMarker(pCmdList.GetInterfacePtr(), 0, L"TLAS unchanged");
+		return;
 	}
 
-	// Get the size requirements for the scratch and AS buffers
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
-	inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-	inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;//D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
-	inputs.NumDescs = geometryCount;
-	inputs.pGeometryDescs = geomDesc.data();
-	inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-
-	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
-	pDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &info);
-
-	// Create the buffers. They need to support UAV, and since we are going to immediately use them, we create them with an unordered-access state
-	AccelerationStructureBuffers buffers;
-	buffers.pScratch = createBuffer(pDevice, info.ScratchDataSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, kDefaultHeapProps);
-	buffers.pResult = createBuffer(pDevice, info.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, kDefaultHeapProps);
-
-	// Create the bottom-level AS
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
-	asDesc.Inputs = inputs;
-	asDesc.DestAccelerationStructureData = buffers.pResult->GetGPUVirtualAddress();
-	asDesc.ScratchAccelerationStructureData = buffers.pScratch->GetGPUVirtualAddress();
-
-	pCmdList->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
-
-	// We need to insert a UAV barrier before using the acceleration structures in a raytracing operation
-	D3D12_RESOURCE_BARRIER uavBarrier = {};
-	uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-	uavBarrier.UAV.pResource = buffers.pResult;
-	pCmdList->ResourceBarrier(1, &uavBarrier);
-
-	return buffers;
-}
-
-void RtRsm::buildTopLevelAS(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4Ptr pCmdList, ID3D12ResourcePtr pBottomLevelAS[], uint64_t& tlasSize, bool update, std::map<std::string, Model> models, AccelerationStructureBuffers& buffers)
-{
-	int numInstances = mNumInstances;//14/*48*/; // keep in sync with mNumInstances
-
 	// First, get the size of the TLAS buffers and create them
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
 	inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
@@ -453,86 +515,65 @@ void RtRsm::buildTopLevelAS(ID3D12Device5Ptr pDevice, ID3D12GraphicsCommandList4
 	inputs.NumDescs = numInstances;
 	inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
 
-	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
-	pDevice->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &info);
-
-	if (update)
-	{
-		// If this a request for an update, then the TLAS was already used in a DispatchRay() call. We need a UAV barrier to make sure the read operation ends before updating the buffer
-		D3D12_RESOURCE_BARRIER uavBarrier = {};
-		uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-		uavBarrier.UAV.pResource = buffers.pResult;
-		pCmdList->ResourceBarrier(1, &uavBarrier);
-	}
-	else
+	if (!update)
 	{
-		// If this is not an update operation then we need to create the buffers, otherwise we will refit in-place
-		buffers.pScratch = createBuffer(pDevice, info.ScratchDataSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, kDefaultHeapProps);
-		buffers.pScratch->SetName(L"TLAS Scratch");
-		buffers.pResult = createBuffer(pDevice, info.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, kDefaultHeapProps);
-		buffers.pResult->SetName(L"TLAS Results");
+		// The result and scratch are owned by the AS manager, only the instance descs are created here
 		buffers.pInstanceDesc = createBuffer(pDevice, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * numInstances, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
 		buffers.pInstanceDesc->SetName(L"TLAS InstanceDesc");
-		tlasSize = info.ResultDataMaxSizeInBytes;
 	}
 
-	// Map the instance desc buffer
+	// Map the instance desc buffer and copy the instances, their InstanceContributionToHitGroupIndex matches the shader-table layout specified in createShaderTable()
+	static_assert(sizeof(TlasInstanceDesc) == sizeof(D3D12_RAYTRACING_INSTANCE_DESC), "TlasInstanceDesc must match D3D12_RAYTRACING_INSTANCE_DESC");
 	D3D12_RAYTRACING_INSTANCE_DESC* instanceDescs;
-	buffers.pInstanceDesc->Map(0, nullptr, (void**)&instanceDescs);
-	ZeroMemory(instanceDescs, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * numInstances);
-
-	// The InstanceContributionToHitGroupIndex is set based on the shader-table layout specified in createShaderTable()
-	int instanceIdx = 0;
-
-	// Create the desc for the models
-	for (auto it = models.begin(); it != models.end(); ++it)
+	D3D12_RANGE readRange = { 0, 0 };
+	buffers.pInstanceDesc->Map(0, &readRange, (void**)&instanceDescs);
+	if (update)
 	{
-		for (uint i = 0; i < it->second.getNumMeshes(); i++)
-		{
-			instanceDescs[instanceIdx].InstanceID = i; // This value will be exposed to the shader via InstanceID()
-			instanceDescs[instanceIdx].InstanceContributionToHitGroupIndex = mNbrHitGroups * instanceIdx;  // hard coded
-			instanceDescs[instanceIdx].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_FORCE_OPAQUE;
-			mat4 m = transpose(it->second.getTransformMatrix()); // GLM is column major, the INSTANCE_DESC is row major
-			memcpy(instanceDescs[instanceIdx].Transform, &m, sizeof(instanceDescs[instanceIdx].Transform));
-			instanceDescs[instanceIdx].AccelerationStructure = pBottomLevelAS[it->second.getModelIndex() + i]->GetGPUVirtualAddress();
-			instanceDescs[instanceIdx].InstanceMask = 0xFF;
-#ifdef OFFLINE
-			if (it->first == "Area light")
-			{
-				instanceDescs[instanceIdx].InstanceMask = 0x01;
-			}
-#endif // OFFLINE
-
-
-			instanceIdx++;
-		}
+		mTlasUpdateStats.numWritten = instances.writeDirtyInstanceDescs((TlasInstanceDesc*)instanceDescs);
+	}
+	else
+	{
+		instances.writeInstanceDescs((TlasInstanceDesc*)instanceDescs);
+		instances.clearDirty();
+		mTlasUpdateStats.numWritten = numInstances;
+		mTlasUpdatePolicy.onRebuild(instances);
 	}
-
-	assert(instanceIdx == numInstances);
 
 	// Unmap
 	buffers.pInstanceDesc->Unmap(0, nullptr);
 
-	// Create the TLAS
-	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
-	asDesc.Inputs = inputs;
-	asDesc.Inputs.InstanceDescs = buffers.pInstanceDesc->GetGPUVirtualAddress();
-	asDesc.DestAccelerationStructureData = buffers.pResult->GetGPUVirtualAddress();
-	asDesc.ScratchAccelerationStructureData = buffers.pScratch->GetGPUVirtualAddress();
-	// If this is an update operation, set the source buffer and the perform_update flag
+	// Build the TLAS, refit it in place or rebuild it in its buffer. The manager records the UAV barriers before and after.
+	inputs.InstanceDescs = buffers.pInstanceDesc->GetGPUVirtualAddress();
 	if (update)
 	{
-		asDesc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
-		asDesc.SourceAccelerationStructureData = buffers.pResult->GetGPUVirtualAddress();
+		mAsManager.updateTopLevel(pCmdList, mTopLevelAsId, inputs, mTlasUpdateStats.type == TlasBuildType::Refit);
+	}
+	else
+	{
+		if (mTopLevelAsId != kInvalidAsId)
+		{
+			mAsManager.free(mTopLevelAsId);
+		}
+		mTopLevelAsId = mAsManager.buildTopLevel(pCmdList, inputs, "TLAS");
+		buffers.pResult = mAsManager.getResult(mTopLevelAsId);
+		buffers.pScratch = nullptr;
+		tlasSize = mAsManager.getTracker().getInfo(mTopLevelAsId).resultSize;
 	}
 
-	pCmdList->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
-
-	// We need to insert a UAV barrier before using the acceleration structures in a raytracing operation
-	D3D12_RESOURCE_BARRIER uavBarrier = {};
-	uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
-	uavBarrier.UAV.pResource = buffers.pResult;
-	pCmdList->ResourceBarrier(1, &uavBarrier);
+	// Per frame in a capture, the rebuilds also in the debug output. The marker is formatted on the stack, refits don't allocate.
+	mTlasUpdateStats.sahCost = mTlasUpdatePolicy.getSahCost();
+	mTlasUpdateStats.rebuildSahCost = mTlasUpdatePolicy.getRebuildSahCost();
+	wchar_t marker[256];
+	swprintf_s(marker, L"TLAS %S, %u of %d instances written, SAH %f (%f at the last rebuild)", getTlasBuildTypeName(mTlasUpdateStats.type),
+		mTlasUpdateStats.numWritten, numInstances, mTlasUpdateStats.sahCost, mTlasUpdateStats.rebuildSahCost);
+	PIXSetMarker(pCmdList.GetInterfacePtr(), 0, marker);
+	if (mTlasUpdateStats.type == TlasBuildType::Rebuild)
+	{
+		std::string summary = std::string("TLAS ") + getTlasBuildTypeName(mTlasUpdateStats.type) + ", " + std::to_string(mTlasUpdateStats.numWritten) + " of " +
+			std::to_string(numInstances) + " instances written, SAH " + std::to_string(mTlasUpdateStats.sahCost) + " (" + std::to_string(mTlasUpdateStats.rebuildSahCost) + " at the last rebuild)";
+		OutputDebugStringA((summary + ", frames so far: " + std::to_string(mTlasUpdatePolicy.getNumFrames(TlasBuildType::None)) + " unchanged, " +
+			std::to_string(mTlasUpdatePolicy.getNumFrames(TlasBuildType::Refit)) + " refits, " + std::to_string(mTlasUpdatePolicy.getNumFrames(TlasBuildType::Rebuild)) + " rebuilds\n").c_str());
+	}
 }
 
 void RtRsm::createAccelerationStructures()
@@ -544,15 +585,18 @@ void RtRsm::createAccelerationStructures()
 	vec3 pureRed = vec3(1.0f, 0.0f, 0.0f);
 	uint8_t modelIndex = 0;
 
+	// All model geometry is sub-allocated from a few large buffers, all acceleration structures are owned by the AS manager
+	mGeometryArena.init(mpDevice);
+	mAsManager.init(mpDevice);
+	std::vector<uint32_t> bottomLevelIds;
+
 	// Sun temple
 	// Load left wall extended
-	Model sunTemple(L"Sun temple", modelIndex, white);
-	mModels["Sun temple"] = sunTemple;
-	std::vector<AccelerationStructureBuffers> sunTempleAS = mModels["Sun temple"].loadMultipleModelsFromFile(mpDevice, mpCmdList, "Data/Models/SunTemple/sunTemple2.fbx", &importer, false);
+	mSunTemple = mScene.addModel("Sun temple", Model(L"Sun temple", modelIndex, white));
+	std::vector<uint32_t> sunTempleAS = mScene.getModel(mSunTemple).loadMultipleModelsFromFile(mpDevice, mpCmdList, &mGeometryArena, &mAsManager, "Data/Models/SunTemple/sunTemple2.fbx", &importer, false);
 	for (int i = 0; i < sunTempleAS.size(); i++)
 	{
-		mpBottomLevelAS[modelIndex] = sunTempleAS.at(i).pResult;
-		mpBottomLevelAS[modelIndex]->SetName((L"BLAS Sun temple sub" + std::to_wstring(i)).c_str());
+		bottomLevelIds.push_back(sunTempleAS.at(i));
 		modelIndex++;
 	}
 
@@ -678,16 +722,37 @@ void RtRsm::createAccelerationStructures()
 
 #ifdef OFFLINE
 	// Load sphere for area light
-	Model areaLight(L"Area light", modelIndex, pureWhite);
-	mModels["Area light"] = areaLight;
-	AccelerationStructureBuffers areaLightAS = mModels["Area light"].loadModelFromFile(mpDevice, mpCmdList, "Data/Models/sphere.fbx", &importer, true);
-	mpBottomLevelAS[modelIndex] = areaLightAS.pResult;
-	mpBottomLevelAS[modelIndex]->SetName(L"Area light");
+	mAreaLight = mScene.addModel("Area light", Model(L"Area light", modelIndex, pureWhite), kModelFlagAreaLight);
+	bottomLevelIds.push_back(mScene.getModel(mAreaLight).loadModelFromFile(mpDevice, mpCmdList, &mGeometryArena, &mAsManager, "Data/Models/sphere.fbx", &importer, true));
 	modelIndex++;
 #endif
 
+	OutputDebugStringA((mGeometryArena.getReport() + "\n").c_str());
+
+	// Wait for the BLAS builds to read back their compacted sizes, then compact. The scratch of the builds isn't needed after that.
+	mAsManager.endBatch(mpCmdList);
+	mFenceValue = submitCommandList(mpCmdList, mpCmdQueue, mpFence, mFenceValue);
+	mpFence->SetEventOnCompletion(mFenceValue, mFenceEvent);
+	WaitForSingleObject(mFenceEvent, INFINITE);
+	mpCmdList->Reset(mFrameObjects[0].pCmdAllocator, nullptr);
+	mAsManager.onBatchFinished();
+
+	mAsManager.compact(mpCmdList);
+	mFenceValue = submitCommandList(mpCmdList, mpCmdQueue, mpFence, mFenceValue);
+	mpFence->SetEventOnCompletion(mFenceValue, mFenceEvent);
+	WaitForSingleObject(mFenceEvent, INFINITE);
+	mpCmdList->Reset(mFrameObjects[0].pCmdAllocator, nullptr);
+	mAsManager.onCompactionFinished();
+
+	// Compaction moved the BLASes, so the instances are created from the final results
+	for (uint i = 0; i < (uint)bottomLevelIds.size(); i++)
+	{
+		mpBottomLevelAS[i] = mAsManager.getResult(bottomLevelIds[i]);
+	}
+
 	// Create the TLAS
-	buildTopLevelAS(mpDevice, mpCmdList, mpBottomLevelAS, mTlasSize, false, mModels, mTopLevelBuffers);
+	mScene.createInstances(mpBottomLevelAS, mNbrHitGroups);
+	buildTopLevelAS(mpDevice, mpCmdList, mTlasSize, false, mScene.getInstances(), mTopLevelBuffers);
 
 	// The tutorial doesn't have any resource lifetime management, so we flush and sync here. 
 	//This is not required by the DXR spec - you can submit the list whenever you like as long as you take care of the resources lifetime.
@@ -695,6 +760,9 @@ void RtRsm::createAccelerationStructures()
 	mpFence->SetEventOnCompletion(mFenceValue, mFenceEvent);
 	WaitForSingleObject(mFenceEvent, INFINITE);
 	mpCmdList->Reset(mFrameObjects[0].pCmdAllocator, nullptr);
+	mAsManager.onBatchFinished();
+
+	OutputDebugStringA((mAsManager.getReport() + "\n").c_str());
 }
 
 ID3DBlobPtr compileLibrary(const WCHAR* filename, const WCHAR* entryPoint, const WCHAR* targetString)
@@ -723,9 +791,13 @@ ID3DBlobPtr compileLibrary(const WCHAR* filename, const WCHAR* entryPoint, const
 	IDxcBlobEncodingPtr pTextBlob;
 	d3d_call(pLibrary->CreateBlobWithEncodingFromPinned((LPBYTE)shader.c_str(), (uint32_t)shader.size(), 0, &pTextBlob));
 
-	// Compile
+	// Compile, with the defines that have to match the C++ side
+	std::vector<DxcDefine> defines;
+#ifdef QUANTIZED_VERTICES
+	defines.push_back({ L"QUANTIZED_VERTICES", L"1" });
+#endif
 	IDxcOperationResultPtr pResult;
-	d3d_call(pCompiler->Compile(pTextBlob, filename, entryPoint, targetString, nullptr, 0, nullptr, 0, dxcIncludeHandler, &pResult));
+	d3d_call(pCompiler->Compile(pTextBlob, filename, entryPoint, targetString, nullptr, 0, defines.data(), (UINT32)defines.size(), dxcIncludeHandler, &pResult));
 
 	// Verify the result
 	HRESULT resultCode;
@@ -877,7 +949,7 @@ RootSignatureDesc createModelHitRootDesc()
 	desc.range[7].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
 	desc.range[7].OffsetInDescriptorsFromTableStart = 0;
 
-	desc.rootParams.resize(5);
+	desc.rootParams.resize(6);
 	// TLAS
 	desc.rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
 	desc.rootParams[0].DescriptorTable.NumDescriptorRanges = 1;
@@ -903,7 +975,13 @@ RootSignatureDesc createModelHitRootDesc()
 	desc.rootParams[4].DescriptorTable.NumDescriptorRanges = 1;
 	desc.rootParams[4].DescriptorTable.pDescriptorRanges = desc.range.data() + 7;
 
-	desc.desc.NumParameters = 5;
+	// index stride, 2 or 4 bytes
+	desc.rootParams[5].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+	desc.rootParams[5].Constants.Num32BitValues = 1;
+	desc.rootParams[5].Constants.RegisterSpace = 2;
+	desc.rootParams[5].Constants.ShaderRegister = 0;//b0
+
+	desc.desc.NumParameters = 6;
 	desc.desc.pParameters = desc.rootParams.data();
 	desc.desc.Flags = D3D12_ROOT_SIGNATURE_FLAG_LOCAL_ROOT_SIGNATURE;
 
@@ -1022,7 +1100,7 @@ RootSignatureDesc createOfflineModelHitRootDesc()
 	desc.range[2].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV;
 	desc.range[2].OffsetInDescriptorsFromTableStart = 4;
 
-	desc.rootParams.resize(4);
+	desc.rootParams.resize(5);
 	desc.rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
 	desc.rootParams[0].DescriptorTable.NumDescriptorRanges = 3;
 	desc.rootParams[0].DescriptorTable.pDescriptorRanges = desc.range.data();
@@ -1042,8 +1120,13 @@ RootSignatureDesc createOfflineModelHitRootDesc()
 	desc.rootParams[3].Descriptor.RegisterSpace = 0;
 	desc.rootParams[3].Descriptor.ShaderRegister = 3;//t3
 
+	// index stride, 2 or 4 bytes
+	desc.rootParams[4].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+	desc.rootParams[4].Constants.Num32BitValues = 1;
+	desc.rootParams[4].Constants.RegisterSpace = 2;
+	desc.rootParams[4].Constants.ShaderRegister = 0;//b0
 
-	desc.desc.NumParameters = 4;
+	desc.desc.NumParameters = 5;
 	desc.desc.pParameters = desc.rootParams.data();
 	desc.desc.Flags = D3D12_ROOT_SIGNATURE_FLAG_LOCAL_ROOT_SIGNATURE;
 
@@ -1334,6 +1417,7 @@ void RtRsm::createShaderTable()
 	// Calculate the size and create the buffer
 	mShaderTableEntrySize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
 	mShaderTableEntrySize += 5 * sizeof(UINT64); // The hit shader constant-buffer descriptor
+	mShaderTableEntrySize += sizeof(UINT); // index stride
 	mShaderTableEntrySize = align_to(D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT, mShaderTableEntrySize);
 	uint32_t shaderTableSize = mShaderTableEntrySize * numShaderTableEntries;
 	if (mShaderTableEntrySize % D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT != 0)
@@ -1393,9 +1477,10 @@ void RtRsm::createShaderTable()
 	}
 
 	// Entry 3 - Model, primary ray. ProgramID and index-buffer
-	for (auto it = mModels.begin(); it != mModels.end(); ++it)
+	for (ModelHandle handle = 0; handle < mScene.getNumModels(); handle++)
 	{
-		for (uint i = 0; i < it->second.getNumMeshes(); i++)
+		Model& model = mScene.getModel(handle);
+		for (uint i = 0; i < model.getNumMeshes(); i++)
 		{
 			uint8_t* pEntry4 = pData + mShaderTableEntrySize * entryIndex;
 			memcpy(pEntry4, pRtsoProps->GetShaderIdentifier(kModelHitGroup), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
@@ -1404,16 +1489,19 @@ void RtRsm::createShaderTable()
 			*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry4 = heapStart + 2 * mHeapEntrySize;
 			pEntry4 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS);
 			// Index buffer
-			*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry4 = it->second.getIndexBufferGPUAdress(i);
+			*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry4 = model.getIndexBufferGPUAdress(i);
 			pEntry4 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS);
 			// Normal buffer
-			*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry4 = it->second.getNormalBufferGPUAdress(i);
+			*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry4 = model.getNormalBufferGPUAdress(i);
 			pEntry4 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS*);
 			// Light buffers and Shadow maps
 			*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry4 = heapStart + mLightBufferHeapIndex * mHeapEntrySize;
 			pEntry4 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS*);
 			// Motion vectors (for adaptive sampling)
 			*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry4 = heapStart + mGeomteryBuffer_MotionVectors_SrvHeapIndex * mHeapEntrySize;
+			pEntry4 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS);
+			// Index stride, 16-bit or 32-bit index buffer
+			*(UINT*)pEntry4 = model.getIndexStride(i);
 			entryIndex++;
 
 	// Entry 4 - Model, shadow ray
@@ -1528,6 +1616,7 @@ void RtRsm::createPathTracerShaderTable()
 	// Calculate the size and create the buffer
 	mPathTracerShaderTableEntrySize = D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
 	mPathTracerShaderTableEntrySize += 4 * sizeof(UINT64); // The hit shader constant-buffer descriptor
+	mPathTracerShaderTableEntrySize += sizeof(UINT); // index stride
 	mPathTracerShaderTableEntrySize = align_to(D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT, mPathTracerShaderTableEntrySize);
 	uint32_t shaderTableSize = mPathTracerShaderTableEntrySize * numShaderTableEntries;
 	if (mPathTracerShaderTableEntrySize % D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT != 0)
@@ -1576,16 +1665,17 @@ void RtRsm::createPathTracerShaderTable()
 	}
 
 	// Entry 2 - Model, primary ray. ProgramID and index-buffer
-	for (auto it = mModels.begin(); it != mModels.end(); ++it)
+	for (ModelHandle handle = 0; handle < mScene.getNumModels(); handle++)
 	{
-		if (it->first == "Area light")
+		Model& model = mScene.getModel(handle);
+		if (mScene.hasFlag(handle, kModelFlagAreaLight))
 		{
 			uint8_t* pEntry2 = pData + mPathTracerShaderTableEntrySize * entryIndex;
 			memcpy(pEntry2, pRtsoProps->GetShaderIdentifier(kAreaLightHitGroup), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
 			entryIndex++;
 		}
 		else {
-			for (uint i = 0; i < it->second.getNumMeshes(); i++)
+			for (uint i = 0; i < model.getNumMeshes(); i++)
 			{
 				uint8_t* pEntry2 = pData + mPathTracerShaderTableEntrySize * entryIndex;
 				memcpy(pEntry2, pRtsoProps->GetShaderIdentifier(kModelHitGroup), D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
@@ -1594,13 +1684,16 @@ void RtRsm::createPathTracerShaderTable()
 				*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry2 = heapStart + 2 * mHeapEntrySize;
 				pEntry2 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS);
 				// Index buffer
-				*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry2 = it->second.getIndexBufferGPUAdress(i);
+				*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry2 = model.getIndexBufferGPUAdress(i);
 				pEntry2 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS);
 				// Normal buffer
-				*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry2 = it->second.getNormalBufferGPUAdress(i);
+				*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry2 = model.getNormalBufferGPUAdress(i);
 				pEntry2 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS*);
 				// Color
-				*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry2 = it->second.getColorBufferGPUAdress();
+				*(D3D12_GPU_VIRTUAL_ADDRESS*)pEntry2 = model.getColorBufferGPUAdress();
+				pEntry2 += sizeof(D3D12_GPU_VIRTUAL_ADDRESS);
+				// Index stride, 16-bit or 32-bit index buffer
+				*(UINT*)pEntry2 = model.getIndexStride(i);
 
 				entryIndex++;
 			}
@@ -2112,6 +2205,12 @@ void RtRsm::readKeyboardInput(bool *gKeys)
 		mDropHistory = false;
 	}
 
+	// Capture the command stream of the frame (once per key press)
+	if (gKeys['C'] && !mCaptureKeyDown)
+	{
+		mCaptureCommands = true;
+	}
+	mCaptureKeyDown = gKeys['C'];
 }
 
 void RtRsm::createCameraBuffers()
@@ -2253,7 +2352,7 @@ void RtRsm::createShadowMapPipelineState()
 	// Define the vertex input layout.
 	D3D12_INPUT_ELEMENT_DESC inputElementDescs[] =
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+		{ "POSITION", 0, kPositionFormat, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
 	};
 
 	// Create the graphics pipeline state object (PSO).
@@ -2346,12 +2445,73 @@ void RtRsm::updateLightBuffer()
 
 void RtRsm::updateTransformBuffers()
 {
-	for (auto it = mModels.begin(); it != mModels.end(); ++it)
+	for (ModelHandle handle = 0; handle < mScene.getNumModels(); handle++)
 	{
-		it->second.updateTransformBuffer();
+		mScene.getModel(handle).updateTransformBuffer();
 	}
 }
 
+/*
+	Test the world bounds of all meshes against a view and append the visible ones to the draw list.
+	Mesh ids count every mesh of every model, culled or not, so they match between frames.
+	With a LOD policy every visible mesh gets the LOD that fits the size of its bounding sphere in that view.
+*/
+void RtRsm::cullModels(const mat4& viewProj, bool shadowCasters, const LodPolicy* pLodPolicy, std::vector<DrawItem>& drawList)
+{
+	Frustum frustum = extractFrustum(viewProj);
+	drawList.clear();
+	int meshID = 1;
+	for (ModelHandle handle = 0; handle < mScene.getNumModels(); handle++)
+	{
+		Model& model = mScene.getModel(handle);
+		uint numMeshes = model.getNumMeshes();
+		if (shadowCasters && mScene.hasFlag(handle, kModelFlagAreaLight))
+		{
+			meshID += numMeshes;
+			continue;
+		}
+
+		const BoundingBoxes& bounds = model.getWorldBounds();
+		if (bounds.size() != numMeshes)
+		{
+			// no bounds (hard coded plane), always drawn
+			for (uint i = 0; i < numMeshes; i++)
+			{
+				drawList.push_back({ &model, i, meshID + (int)i, 0 });
+			}
+		}
+		else
+		{
+			mVisibleMeshes.resize(numMeshes);
+			uint numVisible = cullBoxes(frustum, bounds, mVisibleMeshes.data());
+			for (uint v = 0; v < numVisible; v++)
+			{
+				uint i = mVisibleMeshes[v];
+				uint lod = 0;
+				if (pLodPolicy && model.getNumLods(i) > 1)
+				{
+					lod = pLodPolicy->selectLod(bounds.getCenter(i), length(bounds.getExtent(i)), model.getLodErrors(i), model.getNumLods(i) - 1);
+				}
+				drawList.push_back({ &model, i, meshID + (int)i, lod });
+			}
+		}
+		meshID += numMeshes;
+	}
+}
+
+void RtRsm::buildDrawLists()
+{
+	// The G-buffer always uses LOD 0, the 512x512 shadow map can use much coarser meshes
+	cullModels(mCamera.projMat * mCamera.viewMat, false, nullptr, mCameraDrawList);
+
+	LodPolicy shadowLodPolicy;
+	shadowLodPolicy.viewMat = mLight.viewMat;
+	shadowLodPolicy.projScale = mLight.projMat[1][1];
+	shadowLodPolicy.nearPlane = 0.1f;
+	shadowLodPolicy.viewportHeight = (float)kShadowMapHeight;
+	cullModels(mLight.projMat * mLight.viewMat, true, &shadowLodPolicy, mLightDrawList);
+}
+
 void RtRsm::createShadowMapTextures()
 {
 	D3D12_RESOURCE_DESC shadowTexDesc;
@@ -2803,7 +2963,7 @@ void RtRsm::createGeometryBufferPipeline()
 	// Define the vertex input layout.
 	D3D12_INPUT_ELEMENT_DESC inputElementDescs[] =
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+		{ "POSITION", 0, kPositionFormat, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
 	};
 
 	// Create the graphics pipeline state object (PSO).
@@ -3264,98 +3424,93 @@ void RtRsm::createTemporalFilterPipeline()
 
 void RtRsm::renderShadowMap()
 {
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Rasterize shadow map");
+	mCommands.beginEvent("Rasterize shadow map");
 
 	// Set pipeline state
-	mpCmdList->SetPipelineState(mpRasterPipelineState);
+	mCommands.setPipelineState(mpRasterPipelineState);
 
 	// Set Root signature
-	mpCmdList->SetGraphicsRootSignature(mpRasterRootSig.GetInterfacePtr());
+	mCommands.setGraphicsRootSignature(mpRasterRootSig.GetInterfacePtr());
 
 	// Set descriptor heaps
 	ID3D12DescriptorHeap* ppHeaps[] = { mpCbvSrvUavHeap.GetInterfacePtr() };
-	mpCmdList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+	mCommands.setDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 
 	// set "Shader Table", i.e. resources for root signature
 	D3D12_GPU_DESCRIPTOR_HANDLE lightBufferHandle = mpCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart();
 	lightBufferHandle.ptr += mLightBufferHeapIndex * mpDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-	mpCmdList->SetGraphicsRootDescriptorTable(0, lightBufferHandle); // b0
+	mCommands.setGraphicsRootDescriptorTable(0, lightBufferHandle); // b0
 
 	// viewport
-	mpCmdList->RSSetViewports(1, &mRasterViewPort);
-	mpCmdList->RSSetScissorRects(1, &mRasterScissorRect);
+	mCommands.setViewports(1, &mRasterViewPort);
+	mCommands.setScissorRects(1, &mRasterScissorRect);
 
-	mpCmdList->OMSetStencilRef(0);
+	mCommands.setStencilRef(0);
 
-	mpCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mpShadowMapTexture_Depth, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE));
+	mCommands.transition(mpShadowMapTexture_Depth, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE);
 
 	// clear shadow map
-	mpCmdList->ClearDepthStencilView(mShadowMapDsv_Depth, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+	mCommands.clearDepthStencilView(mShadowMapDsv_Depth, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0);
 	float clearColorPos[4] = { 0.0f, 0.0f, 0.0f, 2.0f };
-	mpCmdList->ClearRenderTargetView(mShadowMapRtv_Position, clearColorPos, 0, nullptr);
+	mCommands.clearRenderTargetView(mShadowMapRtv_Position, clearColorPos);
 	float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	mpCmdList->ClearRenderTargetView(mShadowMapRtv_Flux, clearColor, 0, nullptr);
-	mpCmdList->ClearRenderTargetView(mShadowMapRtv_Normal, clearColor, 0, nullptr);
+	mCommands.clearRenderTargetView(mShadowMapRtv_Flux, clearColor);
+	mCommands.clearRenderTargetView(mShadowMapRtv_Normal, clearColor);
 
 	// set render target
-	mpCmdList->OMSetRenderTargets(
+	mCommands.setRenderTargets(
 		3,
 		mShadowMapRTVs,
-		false,
 		&mShadowMapDsv_Depth
 	);
 
-	mpCmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	mCommands.setPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-	// render models
-	for (auto it = mModels.begin(); it != mModels.end(); ++it)
+	// render the models inside the light frustum
+	for (const DrawItem& draw : mLightDrawList)
 	{
-		if (it->first != "Area light")
-		{
-			for (uint i = 0; i < it->second.getNumMeshes(); i++)
-			{
-				// Model to World Transform
-				mpCmdList->SetGraphicsRootConstantBufferView(1, it->second.getTransformBufferGPUAdress());
-				// Normal buffer
-				mpCmdList->SetGraphicsRootShaderResourceView(2, it->second.getNormalBufferGPUAdress(i));
-				// Vertex and Index buffers
-				mpCmdList->IASetVertexBuffers(0, 1, it->second.getVertexBufferView(i));
-				mpCmdList->IASetIndexBuffer(it->second.getIndexBufferView(i));
-				// Color
-				mpCmdList->SetGraphicsRoot32BitConstants(3, 3, &it->second.getColor(i), 0);
-
-				// Draw
-				mpCmdList->DrawIndexedInstanced(it->second.getIndexBufferView(i)->SizeInBytes / sizeof(uint), 1, 0, 0, 0);
-			}
-		}
+		Model& model = *draw.pModel;
+		uint i = draw.mesh;
+		// Model to World Transform
+		mCommands.setGraphicsRootConstantBufferView(1, model.getTransformBufferGPUAdress(i));
+		// Normal buffer
+		mCommands.setGraphicsRootShaderResourceView(2, model.getNormalBufferGPUAdress(i));
+		// Vertex and Index buffers
+		mCommands.setVertexBuffers(0, 1, model.getVertexBufferView(i));
+		mCommands.setIndexBuffer(model.getIndexBufferView(i, draw.lod));
+		// Color
+		mCommands.setGraphicsRoot32BitConstants(3, 3, &model.getColor(i), 0);
+
+		// Draw
+		mCommands.drawIndexedInstanced(model.getIndexCount(i, draw.lod), 1, 0, 0, 0);
 	}
 
 
 	// submit command list and reset
-	mpCmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(mpShadowMapTexture_Depth, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+	mCommands.transition(mpShadowMapTexture_Depth, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	//mFenceValue = submitCommandList(mpCmdList, mpCmdQueue, mpFence, mFenceValue);
 	//mpFence->SetEventOnCompletion(mFenceValue, mFenceEvent);
 	//WaitForSingleObject(mFenceEvent, INFINITE);
 	//mFrameObjects[mpSwapChain->GetCurrentBackBufferIndex()].pCmdAllocator->Reset();
 	//mpCmdList->Reset(mFrameObjects[mpSwapChain->GetCurrentBackBufferIndex()].pCmdAllocator, nullptr);
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 }
 
 void RtRsm::rayTrace()
 {
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Build TLAS");
+	mCommands.beginEvent("Build TLAS");
 
 	// Refit the top-level acceleration structure
-	buildTopLevelAS(mpDevice, mpCmdList, mpBottomLevelAS, mTlasSize, true, mModels, mTopLevelBuffers);
+	buildTopLevelAS(mpDevice, mpCmdList, mTlasSize, true, mScene.getInstances(), mTopLevelBuffers);
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Raytrace");
+	mCommands.beginEvent("Raytrace");
 
 	// Let's ray trace
-	resourceBarrier(mpCmdList, mpRtIndirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	resourceBarrier(mpCmdList, mpRtDirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	mCommands.transition(mpRtIndirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	mCommands.transition(mpRtDirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 
 	D3D12_DISPATCH_RAYS_DESC raytraceDesc = {};
 	raytraceDesc.Width = mSwapChainSize.x;
@@ -3379,23 +3534,23 @@ void RtRsm::rayTrace()
 	raytraceDesc.HitGroupTable.SizeInBytes = mShaderTableEntrySize * 2 * mNumInstances;    // 2 hit-entries per model
 
 	// Bind the empty root signature
-	mpCmdList->SetComputeRootSignature(mpEmptyRootSig);
+	mCommands.setComputeRootSignature(mpEmptyRootSig);
 
 	// Dispatch
-	mpCmdList->SetPipelineState1(mpRtPipelineState.GetInterfacePtr());
-	mpCmdList->DispatchRays(&raytraceDesc);
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.setPipelineState1(mpRtPipelineState.GetInterfacePtr());
+	mCommands.dispatchRays(&raytraceDesc);
+	mCommands.endEvent();
 }
 
 void RtRsm::offlinePathTrace()
 {
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Offline Path trace");
+	mCommands.beginEvent("Offline Path trace");
 
 	// Let's path trace
-	resourceBarrier(mpCmdList, mpRtDirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	resourceBarrier(mpCmdList, mpRtIndirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	mCommands.transition(mpRtDirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	mCommands.transition(mpRtIndirectOutput, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 
-	buildTopLevelAS(mpDevice, mpCmdList, mpBottomLevelAS, mTlasSize, true, mModels, mTopLevelBuffers);
+	buildTopLevelAS(mpDevice, mpCmdList, mTlasSize, true, mScene.getInstances(), mTopLevelBuffers);
 
 	D3D12_DISPATCH_RAYS_DESC raytraceDesc = {};
 	raytraceDesc.Width = mSwapChainSize.x;
@@ -3419,240 +3574,233 @@ void RtRsm::offlinePathTrace()
 	raytraceDesc.HitGroupTable.SizeInBytes = mPathTracerShaderTableEntrySize * mNumInstances;    // 1 hit-entry per model
 
 	// Bind the empty root signature
-	mpCmdList->SetComputeRootSignature(mpPathTracerEmptyRootSig);
+	mCommands.setComputeRootSignature(mpPathTracerEmptyRootSig);
 
 	// Dispatch
-	mpCmdList->SetPipelineState1(mpPathTracerPipelineState.GetInterfacePtr());
-	mpCmdList->DispatchRays(&raytraceDesc);
+	mCommands.setPipelineState1(mpPathTracerPipelineState.GetInterfacePtr());
+	mCommands.dispatchRays(&raytraceDesc);
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 }
 
 void RtRsm::renderGeometryBuffer()
 {
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Render G-buffer");
+	mCommands.beginEvent("Render G-buffer");
 
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Color, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	mCommands.transition(mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	mCommands.transition(mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	mCommands.transition(mpGeometryBuffer_Color, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
 
 
 	// Set pipeline state
-	mpCmdList->SetPipelineState(mpGeometryBufferState);
+	mCommands.setPipelineState(mpGeometryBufferState);
 
 	// Set Root signature
-	mpCmdList->SetGraphicsRootSignature(mpGeometryBufferRootSig.GetInterfacePtr());
+	mCommands.setGraphicsRootSignature(mpGeometryBufferRootSig.GetInterfacePtr());
 
 	// Set descriptor heaps
 	/*ID3D12DescriptorHeap* ppHeaps[] = { mpCbvSrvUavHeap.GetInterfacePtr() };
-	mpCmdList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);*/
+	mCommands.setDescriptorHeaps(_countof(ppHeaps), ppHeaps);*/
 
 	// set "Shader Table", i.e. resources for root signature
 	D3D12_GPU_DESCRIPTOR_HANDLE cameraMatrixBufferHandle = mpCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart();
 	cameraMatrixBufferHandle.ptr += mCameraMatrixBufferHeapIndex * mpDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-	mpCmdList->SetGraphicsRootDescriptorTable(0, cameraMatrixBufferHandle); // b0
+	mCommands.setGraphicsRootDescriptorTable(0, cameraMatrixBufferHandle); // b0
 
 	// viewport
-	mpCmdList->RSSetViewports(1, &mPostProcessingViewPort);
-	mpCmdList->RSSetScissorRects(1, &mPostProcessingScissorRect);
+	mCommands.setViewports(1, &mPostProcessingViewPort);
+	mCommands.setScissorRects(1, &mPostProcessingScissorRect);
 
-	mpCmdList->OMSetStencilRef(0);
+	mCommands.setStencilRef(0);
 
 	// clear render targets
 	float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	mpCmdList->ClearRenderTargetView(mGeometryBufferRtv_Normal, clearColor, 0, nullptr);
-	mpCmdList->ClearRenderTargetView(mGeometryBufferRtv_Color, clearColor, 0, nullptr);
-	mpCmdList->ClearRenderTargetView(mGeometryBufferRtv_Position, clearColor, 0, nullptr);
-	mpCmdList->ClearDepthStencilView(mGeometryBufferDsv_Depth, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+	mCommands.clearRenderTargetView(mGeometryBufferRtv_Normal, clearColor);
+	mCommands.clearRenderTargetView(mGeometryBufferRtv_Color, clearColor);
+	mCommands.clearRenderTargetView(mGeometryBufferRtv_Position, clearColor);
+	mCommands.clearDepthStencilView(mGeometryBufferDsv_Depth, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0);
 
 	// set render target
-	mpCmdList->OMSetRenderTargets(
+	mCommands.setRenderTargets(
 		3,
 		mGeometryBufferRTVs,
-		false,
 		&mGeometryBufferDsv_Depth
 	);
 
-	mpCmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	mCommands.setPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-	// render models
-	int meshID = 1;
-	for (auto it = mModels.begin(); it != mModels.end(); ++it)
+	// render the models inside the camera frustum
+	for (const DrawItem& draw : mCameraDrawList)
 	{
-		for (uint i = 0; i < it->second.getNumMeshes(); i++)
-		{
-			// Model to World Transform
-			mpCmdList->SetGraphicsRootConstantBufferView(1, it->second.getTransformBufferGPUAdress());
-			// Normal buffer
-			mpCmdList->SetGraphicsRootShaderResourceView(2, it->second.getNormalBufferGPUAdress(i));
-			// Vertex and Index buffers
-			mpCmdList->IASetVertexBuffers(0, 1, it->second.getVertexBufferView(i));
-			mpCmdList->IASetIndexBuffer(it->second.getIndexBufferView(i));
-			// Color
-			mpCmdList->SetGraphicsRoot32BitConstants(3, 3, &it->second.getColor(i), 0);
-			// mesh id
-			mpCmdList->SetGraphicsRoot32BitConstants(3, 1, &meshID, 3);
-			meshID++;
-
-			// Draw
-			mpCmdList->DrawIndexedInstanced(it->second.getIndexBufferView(i)->SizeInBytes / sizeof(uint), 1, 0, 0, 0);
-		}
+		Model& model = *draw.pModel;
+		uint i = draw.mesh;
+		// Model to World Transform
+		mCommands.setGraphicsRootConstantBufferView(1, model.getTransformBufferGPUAdress(i));
+		// Normal buffer
+		mCommands.setGraphicsRootShaderResourceView(2, model.getNormalBufferGPUAdress(i));
+		// Vertex and Index buffers
+		mCommands.setVertexBuffers(0, 1, model.getVertexBufferView(i));
+		mCommands.setIndexBuffer(model.getIndexBufferView(i));
+		// Color
+		mCommands.setGraphicsRoot32BitConstants(3, 3, &model.getColor(i), 0);
+		// mesh id
+		mCommands.setGraphicsRoot32BitConstants(3, 1, &draw.meshID, 3);
+
+		// Draw
+		mCommands.drawIndexedInstanced(model.getIndexCount(i), 1, 0, 0, 0);
 	}
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 }
 void RtRsm::renderMotionVectors()
 {
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Render Motion Vectors");
-	resourceBarrier(mpCmdList, mpGeometryBuffer_MotionVectors, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE );
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.beginEvent("Render Motion Vectors");
+	mCommands.transition(mpGeometryBuffer_MotionVectors, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	mCommands.transition(mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE );
+	mCommands.transition(mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 
 	// Set pipeline state
-	mpCmdList->SetPipelineState(mpMotionVectorsState);
+	mCommands.setPipelineState(mpMotionVectorsState);
 
 	// Set Root signature
-	mpCmdList->SetGraphicsRootSignature(mpMotionVectorsRootSig.GetInterfacePtr());
+	mCommands.setGraphicsRootSignature(mpMotionVectorsRootSig.GetInterfacePtr());
 
 	// set "Shader Table", i.e. resources for root signature
 	D3D12_GPU_DESCRIPTOR_HANDLE handle = mpCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart();
 	UINT stepSize = mpDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 	// camera matrix
 	handle.ptr += mCameraMatrixBufferHeapIndex * stepSize;
-	mpCmdList->SetGraphicsRootDescriptorTable(0, handle); // b0
+	mCommands.setGraphicsRootDescriptorTable(0, handle); // b0
 	// depth, current and previous
 	handle = mpCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart();
 	handle.ptr += mGeomteryBuffer_Depth_SrvHeapIndex * stepSize;
-	mpCmdList->SetGraphicsRootDescriptorTable(2, handle); // t0, t1
+	mCommands.setGraphicsRootDescriptorTable(2, handle); // t0, t1
 
 	// clear render targets
 	float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	mpCmdList->ClearRenderTargetView(mGeometryBufferRtv_MotionVectors, clearColor, 0, nullptr);
-	mpCmdList->ClearDepthStencilView(mGeometryBufferDsv_MotionVectors, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+	mCommands.clearRenderTargetView(mGeometryBufferRtv_MotionVectors, clearColor);
+	mCommands.clearDepthStencilView(mGeometryBufferDsv_MotionVectors, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0);
 
 
 	// set render target
-	mpCmdList->OMSetRenderTargets(
+	mCommands.setRenderTargets(
 		1,
 		&mGeometryBufferRtv_MotionVectors,
-		false,
 		&mGeometryBufferDsv_MotionVectors
 	);
 
-	// render models
-	for (auto it = mModels.begin(); it != mModels.end(); ++it)
+	// render the models inside the camera frustum
+	for (const DrawItem& draw : mCameraDrawList)
 	{
-		for (uint i = 0; i < it->second.getNumMeshes(); i++)
-		{
-			// Model to World Transform
-			mpCmdList->SetGraphicsRootConstantBufferView(1, it->second.getTransformBufferGPUAdress());
-			// Vertex and Index buffers
-			mpCmdList->IASetVertexBuffers(0, 1, it->second.getVertexBufferView(i));
-			mpCmdList->IASetIndexBuffer(it->second.getIndexBufferView(i));
-
-			// Draw
-			mpCmdList->DrawIndexedInstanced(it->second.getIndexBufferView(i)->SizeInBytes / sizeof(uint), 1, 0, 0, 0);
-		}
+		Model& model = *draw.pModel;
+		uint i = draw.mesh;
+		// Model to World Transform
+		mCommands.setGraphicsRootConstantBufferView(1, model.getTransformBufferGPUAdress(i));
+		// Vertex and Index buffers
+		mCommands.setVertexBuffers(0, 1, model.getVertexBufferView(i));
+		mCommands.setIndexBuffer(model.getIndexBufferView(i));
+
+		// Draw
+		mCommands.drawIndexedInstanced(model.getIndexCount(i), 1, 0, 0, 0);
 	}
 
-	resourceBarrier(mpCmdList, mpGeometryBuffer_MotionVectors, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.transition(mpGeometryBuffer_MotionVectors, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.endEvent();
 
 	// copy depth, and normal+meshID to history
 	// depth
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Previous_Depth, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+	mCommands.transition(mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	mCommands.transition(mpGeometryBuffer_Previous_Depth, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
 
-	mpCmdList->CopyResource(mpGeometryBuffer_Previous_Depth, mpGeometryBuffer_Depth);
+	mCommands.copyResource(mpGeometryBuffer_Previous_Depth, mpGeometryBuffer_Depth);
 
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Previous_Depth, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpGeometryBuffer_Depth, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpGeometryBuffer_Previous_Depth, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 
 	// normal+meshID
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Previous_Normal, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+	mCommands.transition(mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	mCommands.transition(mpGeometryBuffer_Previous_Normal, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
 
-	mpCmdList->CopyResource(mpGeometryBuffer_Previous_Normal, mpGeometryBuffer_Normal);
+	mCommands.copyResource(mpGeometryBuffer_Previous_Normal, mpGeometryBuffer_Normal);
 
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Previous_Normal, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpGeometryBuffer_Normal, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpGeometryBuffer_Previous_Normal, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 
 }
 
 void RtRsm::applyTemporalFilter()
 {
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Temporal Filtering");
+	mCommands.beginEvent("Temporal Filtering");
 
 	// resource barriers
-	resourceBarrier(mpCmdList, mpRtIndirectOutput, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	resourceBarrier(mpCmdList, mpRtDirectOutput,   D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	resourceBarrier(mpCmdList, mpIndirectColorHistory, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	resourceBarrier(mpCmdList, mpDirectColorHistory, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	resourceBarrier(mpCmdList, mpTemporalFilterIndirectOutput, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
-	resourceBarrier(mpCmdList, mpTemporalFilterDirectOutput,   D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	mCommands.transition(mpRtIndirectOutput, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpRtDirectOutput,   D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpIndirectColorHistory, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpDirectColorHistory, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpTemporalFilterIndirectOutput, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	mCommands.transition(mpTemporalFilterDirectOutput,   D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
 
 	// Set pipeline state
-	mpCmdList->SetPipelineState(mpTemporalFilterState);
+	mCommands.setPipelineState(mpTemporalFilterState);
 
 	// Set Root signature
-	mpCmdList->SetGraphicsRootSignature(mpTemporalFilterRootSig.GetInterfacePtr());
+	mCommands.setGraphicsRootSignature(mpTemporalFilterRootSig.GetInterfacePtr());
 
 	// //Set descriptor heaps
 	//ID3D12DescriptorHeap* ppHeaps[] = { mpCbvSrvUavHeap.GetInterfacePtr() };
-	//mpCmdList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+	//mCommands.setDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 
 	// set "Shader Table", i.e. resources for root signature
 	D3D12_GPU_DESCRIPTOR_HANDLE handle = mHeapStart;
 	handle.ptr += mRtIndirectOutputHeapIndex * mHeapEntrySize;
-	mpCmdList->SetGraphicsRootDescriptorTable(0, handle); // t0-1, current RT outputs
+	mCommands.setGraphicsRootDescriptorTable(0, handle); // t0-1, current RT outputs
 
 	handle = mHeapStart;
 	handle.ptr += mIndirectColorHistoryHeapIndex * mHeapEntrySize;
-	mpCmdList->SetGraphicsRootDescriptorTable(1, handle); // t2-4, color history and motion vector
+	mCommands.setGraphicsRootDescriptorTable(1, handle); // t2-4, color history and motion vector
 
 	// set constants
-	mpCmdList->SetGraphicsRoot32BitConstants(2, 1, &mDropHistory, 0);
-	mpCmdList->SetGraphicsRoot32BitConstants(2, 1, &mOffline, 1);
+	mCommands.setGraphicsRoot32BitConstants(2, 1, &mDropHistory, 0);
+	mCommands.setGraphicsRoot32BitConstants(2, 1, &mOffline, 1);
 
 
 	// viewport
-	mpCmdList->RSSetViewports(1, &mPostProcessingViewPort);
-	mpCmdList->RSSetScissorRects(1, &mPostProcessingScissorRect);
+	mCommands.setViewports(1, &mPostProcessingViewPort);
+	mCommands.setScissorRects(1, &mPostProcessingScissorRect);
 
 	// clear render target
 	float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	mpCmdList->ClearRenderTargetView(mTemporalFilterIndirectRtv, clearColor, 0, nullptr);
-	mpCmdList->ClearRenderTargetView(mTemporalFilterDirectRtv, clearColor, 0, nullptr);
+	mCommands.clearRenderTargetView(mTemporalFilterIndirectRtv, clearColor);
+	mCommands.clearRenderTargetView(mTemporalFilterDirectRtv, clearColor);
 
 
 	// set render target
-	mpCmdList->OMSetRenderTargets(
+	mCommands.setRenderTargets(
 		2,
 		mTemporalFilterRtvs,
-		false,
 		nullptr
 	);
 
-	mpCmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	mCommands.setPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	// draw
-	mpCmdList->IASetVertexBuffers(0, 0, nullptr);
-	mpCmdList->IASetIndexBuffer(nullptr);
-	mpCmdList->DrawInstanced(6, 1, 0, 0);
+	mCommands.setVertexBuffers(0, 0, nullptr);
+	mCommands.setIndexBuffer(nullptr);
+	mCommands.drawInstanced(6, 1, 0, 0);
 
 	// resource barriers
 
 	// copy RTV to color history
-	resourceBarrier(mpCmdList, mpTemporalFilterIndirectOutput, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
-	resourceBarrier(mpCmdList, mpIndirectColorHistory, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
-		mpCmdList->CopyResource(mpIndirectColorHistory, mpTemporalFilterIndirectOutput);
+	mCommands.transition(mpTemporalFilterIndirectOutput, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	mCommands.transition(mpIndirectColorHistory, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+		mCommands.copyResource(mpIndirectColorHistory, mpTemporalFilterIndirectOutput);
 
-	resourceBarrier(mpCmdList, mpTemporalFilterDirectOutput, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
-	resourceBarrier(mpCmdList, mpDirectColorHistory, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
-		mpCmdList->CopyResource(mpDirectColorHistory, mpTemporalFilterDirectOutput);
+	mCommands.transition(mpTemporalFilterDirectOutput, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	mCommands.transition(mpDirectColorHistory, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+		mCommands.copyResource(mpDirectColorHistory, mpTemporalFilterDirectOutput);
 
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 }
 
 void RtRsm::applySpatialFilter(bool indirect)
@@ -3677,43 +3825,43 @@ void RtRsm::applySpatialFilter(bool indirect)
 	}
 
 	// Post processing
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Spatial filter");
+	mCommands.beginEvent("Spatial filter");
 
 	// resource barriers
-	resourceBarrier(mpCmdList, inputResource, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(inputResource, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 
 	// Set Root signature
-	mpCmdList->SetComputeRootSignature(mpSpatialFilterRootSig.GetInterfacePtr());
+	mCommands.setComputeRootSignature(mpSpatialFilterRootSig.GetInterfacePtr());
 
 	// Set descriptor heaps
 	ID3D12DescriptorHeap* ppHeaps[] = { mpCbvSrvUavHeap.GetInterfacePtr() };
-	mpCmdList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+	mCommands.setDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 
 	auto heapStart = mpCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart();
 	auto heapEntrySize = mpDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 	D3D12_GPU_DESCRIPTOR_HANDLE handle;
 
 	// Set constants
-	mpCmdList->SetComputeRoot32BitConstants(0, 1, &mBlurRadius, 0);
+	mCommands.setComputeRoot32BitConstants(0, 1, &mBlurRadius, 0);
 
 	// Set Depth input
 	handle = heapStart;
 	handle.ptr += mGeomteryBuffer_Depth_SrvHeapIndex * heapEntrySize;
-	mpCmdList->SetComputeRootDescriptorTable(3, handle); // t1
+	mCommands.setComputeRootDescriptorTable(3, handle); // t1
 
 	// Set Normal input
 	handle = heapStart;
 	handle.ptr += mGeomteryBuffer_Normal_SrvHeapIndex * heapEntrySize;
-	mpCmdList->SetComputeRootDescriptorTable(4, handle); // t2
+	mCommands.setComputeRootDescriptorTable(4, handle); // t2
 
 	for (int i = 0; i < 5; i++)
 	{
 		mSpatialItr = i + 1;
-		mpCmdList->SetComputeRoot32BitConstants(0, 1, &mSpatialItr, 0);
+		mCommands.setComputeRoot32BitConstants(0, 1, &mSpatialItr, 0);
 		//////////////
 		// Pass 1
 		//////////////
-		mpCmdList->SetPipelineState(mpSpatialFilterStateHorz);
+		mCommands.setPipelineState(mpSpatialFilterStateHorz);
 
 		// set "Shader Table", i.e. resources for root signature
 		handle = heapStart;
@@ -3724,79 +3872,79 @@ void RtRsm::applySpatialFilter(bool indirect)
 		{
 			handle.ptr += mBlur2OutputSrvHeapIndex * heapEntrySize;
 		}
-		mpCmdList->SetComputeRootDescriptorTable(1, handle); // t0
+		mCommands.setComputeRootDescriptorTable(1, handle); // t0
 		handle = heapStart;
 		handle.ptr += mBlur1OutputUavHeapIndex * heapEntrySize;
-		mpCmdList->SetComputeRootDescriptorTable(2, handle); // u0
+		mCommands.setComputeRootDescriptorTable(2, handle); // u0
 
 
 		// dispatch
 		UINT numGroupsX = (UINT)ceilf(mSwapChainSize[0] / 256.0f);
-		mpCmdList->Dispatch(numGroupsX, mSwapChainSize[1], 1);
+		mCommands.dispatch(numGroupsX, mSwapChainSize[1], 1);
 
 		if (i == 0)
 		{
-			resourceBarrier(mpCmdList, mpBlurPass2Output, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			mCommands.transition(mpBlurPass2Output, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 		}
 		else
 		{
-			resourceBarrier(mpCmdList, mpBlurPass2Output, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			mCommands.transition(mpBlurPass2Output, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 		}
-		resourceBarrier(mpCmdList, mpBlurPass1Output, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		mCommands.transition(mpBlurPass1Output, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 
 
 		//////////////
 		// Pass 2
 		//////////////
 
-		mpCmdList->SetPipelineState(mpSpatialFilterStateVert);
+		mCommands.setPipelineState(mpSpatialFilterStateVert);
 
 		// set "Shader Table", i.e. resources for root signature
 		handle = heapStart;
 		handle.ptr += mBlur1OutputSrvHeapIndex * heapEntrySize;
-		mpCmdList->SetComputeRootDescriptorTable(1, handle); // t0
+		mCommands.setComputeRootDescriptorTable(1, handle); // t0
 		handle = heapStart;
 		handle.ptr += mBlur2OutputUavHeapIndex * heapEntrySize;
 	
-		mpCmdList->SetComputeRootDescriptorTable(2, handle); // u0
+		mCommands.setComputeRootDescriptorTable(2, handle); // u0
 
 		// dispatch
 		UINT numGroupsY = (UINT)ceilf(mSwapChainSize[1] / 256.0f);
-		mpCmdList->Dispatch(mSwapChainSize[0], numGroupsY, 1);
+		mCommands.dispatch(mSwapChainSize[0], numGroupsY, 1);
 
-		resourceBarrier(mpCmdList, mpBlurPass1Output, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-		resourceBarrier(mpCmdList, mpBlurPass2Output, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		mCommands.transition(mpBlurPass1Output, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		mCommands.transition(mpBlurPass2Output, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 
 	}
 
 	// copy final output
-	resourceBarrier(mpCmdList, mpBlurPass2Output, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
-	resourceBarrier(mpCmdList, outputResource, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
-	mpCmdList->CopyResource(outputResource, mpBlurPass2Output);
+	mCommands.transition(mpBlurPass2Output, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	mCommands.transition(outputResource, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+	mCommands.copyResource(outputResource, mpBlurPass2Output);
 
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 }
 
 void RtRsm::applyToneMapping()
 {
-	PIXBeginEvent(mpCmdList.GetInterfacePtr(), 0, L"Tone Mapping");
+	mCommands.beginEvent("Tone Mapping");
 
-	resourceBarrier(mpCmdList, mpToneMappingOutput, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
-	resourceBarrier(mpCmdList, mpFilteredIndirectColor, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	//resourceBarrier(mpCmdList, mpFilteredDirectColor, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-	resourceBarrier(mpCmdList, mpGeometryBuffer_Color, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE );
+	mCommands.transition(mpToneMappingOutput, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	mCommands.transition(mpFilteredIndirectColor, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	//mCommands.transition(mpFilteredDirectColor, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	mCommands.transition(mpGeometryBuffer_Color, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE );
 
 
 	// Set pipeline state
-	mpCmdList->SetPipelineState(mpToneMappingState);
+	mCommands.setPipelineState(mpToneMappingState);
 
 	// Set Root signature
-	mpCmdList->SetGraphicsRootSignature(mpToneMappingRootSig.GetInterfacePtr());
+	mCommands.setGraphicsRootSignature(mpToneMappingRootSig.GetInterfacePtr());
 
 	// Set descriptor heaps
 	ID3D12DescriptorHeap* ppHeaps[] = { mpCbvSrvUavHeap.GetInterfacePtr() };
-	mpCmdList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+	mCommands.setDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 
 	// set "Shader Table", i.e. resources for root signature
 	D3D12_GPU_DESCRIPTOR_HANDLE heapStart = mpCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart();
@@ -3804,49 +3952,48 @@ void RtRsm::applyToneMapping()
 
 	D3D12_GPU_DESCRIPTOR_HANDLE handle = heapStart;
 	handle.ptr += mFilteredIndirectColorHeapIndex * heapEntrySize;
-	mpCmdList->SetGraphicsRootDescriptorTable(0, handle); // t0-1, input textures SRV
+	mCommands.setGraphicsRootDescriptorTable(0, handle); // t0-1, input textures SRV
 
 	handle = heapStart;
 	handle.ptr += mShadowMaps_normal_HeapIndex * heapEntrySize;
-	mpCmdList->SetGraphicsRootDescriptorTable(1, handle); // t2, RSM normal
+	mCommands.setGraphicsRootDescriptorTable(1, handle); // t2, RSM normal
 
 	handle = heapStart;
 	handle.ptr += mGeomteryBuffer_MotionVectors_SrvHeapIndex * heapEntrySize;
-	mpCmdList->SetGraphicsRootDescriptorTable(2, handle); // t3, Motion Vectors
+	mCommands.setGraphicsRootDescriptorTable(2, handle); // t3, Motion Vectors
 
 	handle = heapStart;
 	handle.ptr += mGeomteryBuffer_Color_SrvHeapIndex * heapEntrySize;
-	mpCmdList->SetGraphicsRootDescriptorTable(3, handle); // t4, G-buffer Color
+	mCommands.setGraphicsRootDescriptorTable(3, handle); // t4, G-buffer Color
 
 
 
 	// viewport
-	mpCmdList->RSSetViewports(1, &mPostProcessingViewPort);
-	mpCmdList->RSSetScissorRects(1, &mPostProcessingScissorRect);
+	mCommands.setViewports(1, &mPostProcessingViewPort);
+	mCommands.setScissorRects(1, &mPostProcessingScissorRect);
 
 	// clear render target
 	float clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	mpCmdList->ClearRenderTargetView(mToneMappingRtv, clearColor, 0, nullptr);
+	mCommands.clearRenderTargetView(mToneMappingRtv, clearColor);
 
 	// set render target
-	mpCmdList->OMSetRenderTargets(
+	mCommands.setRenderTargets(
 		1,
 		&mToneMappingRtv,
-		false,
 		nullptr
 	);
 
-	mpCmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	mCommands.setPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	// draw
-	mpCmdList->IASetVertexBuffers(0, 0, nullptr);
-	mpCmdList->IASetIndexBuffer(nullptr);
-	mpCmdList->DrawInstanced(6, 1, 0, 0);
+	mCommands.setVertexBuffers(0, 0, nullptr);
+	mCommands.setIndexBuffer(nullptr);
+	mCommands.drawInstanced(6, 1, 0, 0);
 
-	resourceBarrier(mpCmdList, mpToneMappingOutput, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	mCommands.transition(mpToneMappingOutput, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE);
 
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -3855,6 +4002,9 @@ void RtRsm::applyToneMapping()
 void RtRsm::onLoad(HWND winHandle, uint32_t winWidth, uint32_t winHeight)
 {
 	initDXR(winHandle, winWidth, winHeight);        
+#ifdef CPU_BENCHMARKS
+	runCpuBenchmarks();
+#endif
 	createAccelerationStructures();                 // Load models and build AS
 	buildTransforms(mRotation);
 	createRtPipelineState();       
@@ -3882,6 +4032,8 @@ void RtRsm::onLoad(HWND winHandle, uint32_t winWidth, uint32_t winHeight)
 
 	// get heap info from GPU
 	mHeapStart = mpCbvSrvUavHeap->GetGPUDescriptorHandleForHeapStart();
+
+	registerCommandObjects();
 }
 
 void RtRsm::onFrameRender(bool *gKeys)
@@ -3903,6 +4055,9 @@ void RtRsm::onFrameRender(bool *gKeys)
 	// Update transform buffer
 	updateTransformBuffers();
 
+	// Per-view draw lists for the raster passes
+	buildDrawLists();
+
 	uint32_t rtvIndex = beginFrame();
 
 	//////////////////////
@@ -3943,11 +4098,12 @@ void RtRsm::onFrameRender(bool *gKeys)
 
 
 	// Copy the results to the back-buffer
-	//resourceBarrier(mpCmdList, mpOutputResource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
-	resourceBarrier(mpCmdList, mFrameObjects[rtvIndex].pSwapChainBuffer, D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_COPY_DEST);
-	mpCmdList->CopyResource(mFrameObjects[rtvIndex].pSwapChainBuffer, mpToneMappingOutput);
+	mCommands.beginEvent("Copy to back buffer");
+	//mCommands.transition(mpOutputResource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	mCommands.transition(mFrameObjects[rtvIndex].pSwapChainBuffer, D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_COPY_DEST);
+	mCommands.copyResource(mFrameObjects[rtvIndex].pSwapChainBuffer, mpToneMappingOutput);
 
-	PIXEndEvent(mpCmdList.GetInterfacePtr());
+	mCommands.endEvent();
 
 	endFrame(rtvIndex);
 }
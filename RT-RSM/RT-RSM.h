@@ -28,6 +28,10 @@
 #pragma once
 #include "Framework.h"
 #include "Model.h"
+#include "SceneRegistry.h"
+#include "TlasUpdatePolicy.h"
+#include "Benchmark.h"
+#include "CommandRecorder.h"
 ///////////////////////////////
 /* To swich between offline path tracer and real-time ray tracer with RSM, 
 simply define/undefine OFFLINE. Also note that you choose if you want 
@@ -36,6 +40,7 @@ the spatial filter or not inside that shader.
 Control camera with WASDQE
 Control light with YGHJTU
 Reset accumulated color history with R
+Capture the command stream of a frame with C
 */
 ///////////////////////////////
 //#define OFFLINE
@@ -82,6 +87,16 @@ private:
 		D3D12_CPU_DESCRIPTOR_HANDLE rtvHandle;
 	} mFrameObjects[kDefaultSwapChainBuffers];
 
+	// The passes record through mCommands. Debug builds check each frame on a NullCommandDevice before it is submitted,
+	// release builds only the frames captured with C.
+	void registerCommandObjects();
+	void checkCommandStream();
+	CommandRecorder					mCommands;
+	bool							mCaptureCommands = false;
+	bool							mCaptureKeyDown = false;
+	bool							mCommandStreamReported = false;
+	uint32_t						mCommandErrors = 0;
+
 
 	// Heap data
 	struct HeapData
@@ -103,8 +118,11 @@ private:
 
 	static const int mNumInstances = 30 + mOffline; // Bistro: 39, Sponza: 20, Room: 14, Sun temple: 48
 
-	// models
-	std::map<std::string, Model> mModels;
+	// models, looked up by name once at load time and by handle afterwards
+	SceneRegistry mScene;
+	ModelHandle mSunTemple = kInvalidModelHandle;
+	ModelHandle mAreaLight = kInvalidModelHandle;
+	GeometryArena mGeometryArena;
 
 	void buildTransforms(float rotation);
 	float mRotation = 0;
@@ -114,14 +132,33 @@ private:
 	void createAccelerationStructures();
 	void buildTopLevelAS(ID3D12Device5Ptr pDevice, 
 						ID3D12GraphicsCommandList4Ptr pCmdList, 
-						ID3D12ResourcePtr pBottomLevelAS[], 
 						uint64_t& tlasSize, 
 						bool update, 
-						std::map<std::string, Model> models, 
+						SceneInstances& instances, 
 						AccelerationStructureBuffers& buffers);
+	AsManager						mAsManager;
 	ID3D12ResourcePtr				mpBottomLevelAS[mNumInstances];
-	AccelerationStructureBuffers	mTopLevelBuffers;
+	AccelerationStructureBuffers	mTopLevelBuffers;		// pResult is owned by mAsManager
+	uint32_t						mTopLevelAsId = kInvalidAsId;
 	uint64_t						mTlasSize = 0;
+	TlasUpdatePolicy				mTlasUpdatePolicy;
+	TlasUpdateStats					mTlasUpdateStats;		// of the last frame
+
+	//////////////////////////////////////////////////////////////////////////
+	// Culling
+	//////////////////////////////////////////////////////////////////////////
+	struct DrawItem
+	{
+		Model*	pModel;
+		uint	mesh;
+		int		meshID;	// written to the G-buffer, stays the same whether other meshes are culled or not
+		uint	lod;	// 0 unless the pass has a LodPolicy
+	};
+	void buildDrawLists();
+	void cullModels(const mat4& viewProj, bool shadowCasters, const LodPolicy* pLodPolicy, std::vector<DrawItem>& drawList);
+	std::vector<DrawItem>	mCameraDrawList;	// G-buffer and motion vectors
+	std::vector<DrawItem>	mLightDrawList;		// shadow map, LODs picked by the projected size in the shadow map
+	std::vector<uint32_t>	mVisibleMeshes;
 
 	//////////////////////////////////////////////////////////////////////////
 	// Ray tracing
@@ -0,0 +1,457 @@
+#include "Sbvh.h"
+#include "BvhBinning.h"
+#include <algorithm>
+#include <atomic>
+
+// Relative rounding of the clipped triangle parts
+static const float kClipEpsilon = 4.0f * FLT_EPSILON;
+
+struct SbvhReference
+{
+	BvhBounds	bounds;		// of the part of the primitive this reference covers
+	uint32_t	primitive;
+};
+
+struct SbvhSpatialBin
+{
+	BvhBounds	bounds;		// clipped to the bin
+	uint32_t	enter = 0;	// references starting in the bin
+	uint32_t	exit = 0;	// references ending in it
+};
+
+struct SbvhBuildContext
+{
+	const BvhBuildSettings*			pSettings;
+	TaskPool*						pPool;
+	const std::vector<MeshView>*	pGeometries;
+	const BvhPrimitive*				pPrimitives;
+	float							rootArea;
+	std::vector<BvhNode>			nodes;
+	std::atomic<uint32_t>			numNodes;
+	std::vector<uint32_t>			leafPrimitives;		// of every leaf, in the order the leaves were finished
+	std::atomic<uint32_t>			numLeafPrimitives;
+};
+
+static bool isValid(const BvhBounds& bounds)
+{
+	return all(lessThanEqual(bounds.min, bounds.max));
+}
+
+static BvhBounds intersectBounds(const BvhBounds& a, const BvhBounds& b)
+{
+	BvhBounds bounds;
+	bounds.min = glm::max(a.min, b.min);
+	bounds.max = glm::min(a.max, b.max);
+	return isValid(bounds) ? bounds : BvhBounds();
+}
+
+static vec3 getCentroid(const SbvhReference& reference)
+{
+	return 0.5f * (reference.bounds.min + reference.bounds.max);
+}
+
+/*
+	The parts of a reference crossing the plane at position on axis. The triangle is clipped against the plane and
+	what is left is limited to the reference bounds. A part may come out empty, e.g. when the triangle only passes the
+	corner of a box that was itself clipped before.
+*/
+static void splitReference(const SbvhBuildContext& context, const SbvhReference& reference, int axis, float position, BvhBounds& left, BvhBounds& right)
+{
+	BvhBounds leftBounds = reference.bounds;
+	BvhBounds rightBounds = reference.bounds;
+	if (context.pGeometries)
+	{
+		const BvhPrimitive& primitive = context.pPrimitives[reference.primitive];
+		const MeshView& geometry = (*context.pGeometries)[primitive.geometry];
+		vec3 vertices[3];
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			vertices[k] = geometry.positions[geometry.indices[3 * primitive.triangle + k]];
+		}
+
+		leftBounds = BvhBounds();
+		rightBounds = BvhBounds();
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			const vec3& a = vertices[k];
+			const vec3& b = vertices[(k + 1) % 3];
+			if (a[axis] <= position)
+			{
+				leftBounds.grow(a);
+			}
+			if (a[axis] >= position)
+			{
+				rightBounds.grow(a);
+			}
+			if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position))
+			{
+				vec3 crossing = glm::mix(a, b, (position - a[axis]) / (b[axis] - a[axis]));
+				crossing[axis] = position;
+				leftBounds.grow(crossing);
+				rightBounds.grow(crossing);
+			}
+		}
+
+		// The crossings are rounded, grow the parts by a few ulps of the coordinates so they stay around the triangle
+		vec3 magnitude = glm::max(glm::max(abs(vertices[0]), abs(vertices[1])), abs(vertices[2]));
+		vec3 epsilon = magnitude * kClipEpsilon;
+		leftBounds.min -= epsilon;
+		leftBounds.max += epsilon;
+		rightBounds.min -= epsilon;
+		rightBounds.max += epsilon;
+	}
+	leftBounds.max[axis] = std::min(leftBounds.max[axis], position);
+	rightBounds.min[axis] = std::max(rightBounds.min[axis], position);
+	left = intersectBounds(leftBounds, reference.bounds);
+	right = intersectBounds(rightBounds, reference.bounds);
+}
+
+// The cheapest spatial plane on one axis, like findBestSplit with the references chopped into every bin they cross
+static BvhSplit findSpatialSplit(const SbvhBuildContext& context, const std::vector<SbvhReference>& references, const BvhBounds& nodeBounds,
+	uint32_t numBins, float nodeArea, int axis)
+{
+	const BvhBuildSettings& settings = *context.pSettings;
+	BvhSplit best;
+	float extent = nodeBounds.max[axis] - nodeBounds.min[axis];
+	if (extent <= 0.0f)
+	{
+		return best;
+	}
+	float binSize = extent / numBins;
+	auto getBin = [&](float x)
+	{
+		return std::min((uint32_t)std::max((x - nodeBounds.min[axis]) / binSize, 0.0f), numBins - 1);
+	};
+
+	SbvhSpatialBin bins[kMaxBvhBins];
+	for (const SbvhReference& reference : references)
+	{
+		uint32_t first = getBin(reference.bounds.min[axis]);
+		uint32_t last = getBin(reference.bounds.max[axis]);
+		SbvhReference rest = reference;
+		for (uint32_t b = first; b < last; b++)
+		{
+			BvhBounds left;
+			splitReference(context, rest, axis, nodeBounds.min[axis] + (b + 1) * binSize, left, rest.bounds);
+			bins[b].bounds.grow(left);
+		}
+		bins[last].bounds.grow(rest.bounds);
+		bins[first].enter++;
+		bins[last].exit++;
+	}
+
+	float rightArea[kMaxBvhBins];
+	uint32_t rightCount[kMaxBvhBins];
+	BvhBounds right;
+	uint32_t count = 0;
+	for (uint32_t b = numBins - 1; b > 0; b--)
+	{
+		right.grow(bins[b].bounds);
+		count += bins[b].exit;
+		rightArea[b - 1] = right.getArea();
+		rightCount[b - 1] = count;
+	}
+	BvhBounds left;
+	count = 0;
+	for (uint32_t b = 0; b < numBins - 1; b++)
+	{
+		left.grow(bins[b].bounds);
+		count += bins[b].enter;
+		if (count == 0 || rightCount[b] == 0)
+		{
+			continue;
+		}
+		float cost = settings.traversalCost + settings.intersectionCost * (left.getArea() * count + rightArea[b] * rightCount[b]) / nodeArea;
+		if (cost < best.cost)
+		{
+			best.axis = axis;
+			best.bin = b;
+			best.cost = cost;
+		}
+	}
+	return best;
+}
+
+// The three axes are binned in parallel for large nodes, the best one is picked in axis order either way
+static BvhSplit findSpatialSplit(const SbvhBuildContext& context, const std::vector<SbvhReference>& references, const BvhBounds& nodeBounds,
+	uint32_t numBins, float nodeArea)
+{
+	BvhSplit axisSplits[3];
+	if (references.size() > context.pSettings->parallelThreshold)
+	{
+		context.pPool->parallelFor(3, [&](uint32_t axis)
+		{
+			axisSplits[axis] = findSpatialSplit(context, references, nodeBounds, numBins, nodeArea, (int)axis);
+		});
+	}
+	else
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			axisSplits[axis] = findSpatialSplit(context, references, nodeBounds, numBins, nodeArea, axis);
+		}
+	}
+	BvhSplit best;
+	for (const BvhSplit& split : axisSplits)
+	{
+		if (split.cost < best.cost)
+		{
+			best = split;
+		}
+	}
+	return best;
+}
+
+/*
+	References on one side of the plane go there, those crossing it are split, or moved to one side entirely when
+	that is cheaper (Stich's reference unsplitting) or the budget is used up. Returns the number of duplicates.
+*/
+static uint32_t partitionSpatial(const SbvhBuildContext& context, const std::vector<SbvhReference>& references, int axis, float position, uint32_t budget,
+	std::vector<SbvhReference>& left, std::vector<SbvhReference>& right)
+{
+	BvhBounds leftBounds, rightBounds;
+	std::vector<uint32_t> crossing;
+	for (uint32_t r = 0; r < (uint32_t)references.size(); r++)
+	{
+		const SbvhReference& reference = references[r];
+		if (reference.bounds.max[axis] <= position)
+		{
+			left.push_back(reference);
+			leftBounds.grow(reference.bounds);
+		}
+		else if (reference.bounds.min[axis] >= position)
+		{
+			right.push_back(reference);
+			rightBounds.grow(reference.bounds);
+		}
+		else
+		{
+			crossing.push_back(r);
+		}
+	}
+
+	// Counted on both sides until they are decided, like the binning did
+	uint32_t leftCount = (uint32_t)(left.size() + crossing.size());
+	uint32_t rightCount = (uint32_t)(right.size() + crossing.size());
+	uint32_t numDuplicates = 0;
+	for (uint32_t r : crossing)
+	{
+		const SbvhReference& reference = references[r];
+		BvhBounds leftPart, rightPart;
+		splitReference(context, reference, axis, position, leftPart, rightPart);
+		BvhBounds splitLeft = leftBounds, splitRight = rightBounds, allLeft = leftBounds, allRight = rightBounds;
+		splitLeft.grow(leftPart);
+		splitRight.grow(rightPart);
+		allLeft.grow(reference.bounds);
+		allRight.grow(reference.bounds);
+
+		float splitCost = splitLeft.getArea() * leftCount + splitRight.getArea() * rightCount;
+		float leftCost = allLeft.getArea() * leftCount + rightBounds.getArea() * (rightCount - 1);
+		float rightCost = leftBounds.getArea() * (leftCount - 1) + allRight.getArea() * rightCount;
+		bool canSplit = numDuplicates < budget && !leftPart.isEmpty() && !rightPart.isEmpty();
+		if (canSplit && splitCost < std::min(leftCost, rightCost))
+		{
+			left.push_back({ leftPart, reference.primitive });
+			right.push_back({ rightPart, reference.primitive });
+			leftBounds = splitLeft;
+			rightBounds = splitRight;
+			numDuplicates++;
+		}
+		else if (leftCost <= rightCost)
+		{
+			left.push_back(reference);
+			leftBounds = allLeft;
+			rightCount--;
+		}
+		else
+		{
+			right.push_back(reference);
+			rightBounds = allRight;
+			leftCount--;
+		}
+	}
+	return numDuplicates;
+}
+
+static void buildNode(SbvhBuildContext& context, uint32_t nodeIndex, std::vector<SbvhReference>& references, uint32_t budget)
+{
+	const BvhBuildSettings& settings = *context.pSettings;
+	uint32_t count = (uint32_t)references.size();
+	BvhBounds bounds, centroidBounds;
+	for (const SbvhReference& reference : references)
+	{
+		bounds.grow(reference.bounds);
+		centroidBounds.grow(getCentroid(reference));
+	}
+
+	BvhNode& node = context.nodes[nodeIndex];
+	node.boundsMin = bounds.min;
+	node.boundsMax = bounds.max;
+	node.primitiveCount = 0;
+
+	bool leaf = count == 1;
+	BvhSplit objectSplit, spatialSplit;
+	uint32_t numBins = std::max(std::min(std::min(settings.numBins, kMaxBvhBins), count), 2u);
+	BvhBinMapping mapping(centroidBounds, numBins);
+	if (!leaf)
+	{
+		float nodeArea = std::max(bounds.getArea(), FLT_MIN);
+		BvhBin bins[3 * kMaxBvhBins];
+		for (const SbvhReference& reference : references)
+		{
+			vec3 centroid = getCentroid(reference);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				BvhBin& bin = bins[axis * kMaxBvhBins + mapping.getBin(centroid, axis)];
+				bin.bounds.grow(reference.bounds);
+				bin.count++;
+			}
+		}
+		objectSplit = findBestSplit(settings, bins, centroidBounds, numBins, nodeArea);
+
+		// Overlap of the object split's children, all of the node if the centroids can't be separated
+		float overlap = nodeArea;
+		if (objectSplit.axis >= 0)
+		{
+			BvhBounds left, right;
+			for (uint32_t b = 0; b < numBins; b++)
+			{
+				(b <= objectSplit.bin ? left : right).grow(bins[objectSplit.axis * kMaxBvhBins + b].bounds);
+			}
+			BvhBounds intersection = intersectBounds(left, right);
+			overlap = intersection.getArea();
+		}
+		if (budget > 0 && overlap > settings.spatialSplitOverlap * context.rootArea)
+		{
+			spatialSplit = findSpatialSplit(context, references, bounds, numBins, nodeArea);
+		}
+
+		float leafCost = settings.intersectionCost * count;
+		leaf = count <= settings.maxLeafSize && std::min(objectSplit.cost, spatialSplit.cost) >= leafCost;
+	}
+
+	if (leaf)
+	{
+		uint32_t first = context.numLeafPrimitives.fetch_add(count);
+		for (uint32_t r = 0; r < count; r++)
+		{
+			context.leafPrimitives[first + r] = references[r].primitive;
+		}
+		node.firstChildOrPrimitive = first;
+		node.primitiveCount = count;
+		std::vector<SbvhReference>().swap(references);
+		return;
+	}
+
+	std::vector<SbvhReference> left, right;
+	uint32_t numDuplicates = 0;
+	if (spatialSplit.axis >= 0 && spatialSplit.cost < objectSplit.cost)
+	{
+		float binSize = (bounds.max[spatialSplit.axis] - bounds.min[spatialSplit.axis]) / numBins;
+		numDuplicates = partitionSpatial(context, references, spatialSplit.axis, bounds.min[spatialSplit.axis] + (spatialSplit.bin + 1) * binSize, budget, left, right);
+		if (left.empty() || right.empty())
+		{
+			left.clear();
+			right.clear();
+			numDuplicates = 0;
+		}
+	}
+	if (left.empty())
+	{
+		// Otherwise all centroids are at one point and any split is as good as another
+		uint32_t middle = count / 2;
+		if (objectSplit.axis >= 0)
+		{
+			auto pMiddle = std::partition(references.begin(), references.end(), [&](const SbvhReference& reference)
+			{
+				return mapping.getBin(getCentroid(reference), objectSplit.axis) <= objectSplit.bin;
+			});
+			middle = (uint32_t)(pMiddle - references.begin());
+		}
+		left.assign(references.begin(), references.begin() + middle);
+		right.assign(references.begin() + middle, references.end());
+	}
+	std::vector<SbvhReference>().swap(references);
+
+	// What is left of the budget goes to the children by their share of the references
+	uint32_t remaining = budget - numDuplicates;
+	uint32_t leftBudget = (uint32_t)((uint64_t)remaining * left.size() / (left.size() + right.size()));
+	uint32_t rightBudget = remaining - leftBudget;
+
+	uint32_t children = context.numNodes.fetch_add(2);
+	node.firstChildOrPrimitive = children;
+	if (count > settings.parallelThreshold)
+	{
+		context.pPool->parallelFor(2, [&](uint32_t child)
+		{
+			if (child == 0)
+			{
+				buildNode(context, children, left, leftBudget);
+			}
+			else
+			{
+				buildNode(context, children + 1, right, rightBudget);
+			}
+		});
+	}
+	else
+	{
+		buildNode(context, children, left, leftBudget);
+		buildNode(context, children + 1, right, rightBudget);
+	}
+}
+
+// Like storeDepthFirst of the SAH builder, and the leaf primitives in the same order
+static void storeDepthFirst(const SbvhBuildContext& context, uint32_t nodeIndex, uint32_t outIndex, std::vector<BvhNode>& nodes, std::vector<uint32_t>& references)
+{
+	const BvhNode& node = context.nodes[nodeIndex];
+	nodes[outIndex] = node;
+	if (node.isLeaf())
+	{
+		nodes[outIndex].firstChildOrPrimitive = (uint32_t)references.size();
+		references.insert(references.end(), context.leafPrimitives.begin() + node.firstChildOrPrimitive,
+			context.leafPrimitives.begin() + node.firstChildOrPrimitive + node.primitiveCount);
+		return;
+	}
+	uint32_t children = (uint32_t)nodes.size();
+	nodes.resize(children + 2);
+	nodes[outIndex].firstChildOrPrimitive = children;
+	storeDepthFirst(context, node.firstChildOrPrimitive, children, nodes, references);
+	storeDepthFirst(context, node.firstChildOrPrimitive + 1, children + 1, nodes, references);
+}
+
+void buildSbvh(const std::vector<BvhBounds>& primitiveBounds, const std::vector<MeshView>* pGeometries, const std::vector<BvhPrimitive>& primitives,
+	const BvhBuildSettings& settings, TaskPool& pool, std::vector<BvhNode>& nodes, std::vector<uint32_t>& references)
+{
+	uint32_t numPrimitives = (uint32_t)primitiveBounds.size();
+	uint32_t budget = (uint32_t)(numPrimitives * std::max(settings.spatialSplitBudget, 0.0f));
+
+	SbvhBuildContext context;
+	context.pSettings = &settings;
+	context.pPool = &pool;
+	context.pGeometries = pGeometries;
+	context.pPrimitives = primitives.data();
+	std::vector<SbvhReference> rootReferences(numPrimitives);
+	BvhBounds rootBounds;
+	for (uint32_t p = 0; p < numPrimitives; p++)
+	{
+		rootReferences[p] = { primitiveBounds[p], p };
+		rootBounds.grow(primitiveBounds[p]);
+	}
+	context.rootArea = rootBounds.getArea();
+
+	// Every duplicate adds a reference, and a binary tree with n leaves has 2n - 1 nodes
+	uint32_t maxReferences = numPrimitives + budget;
+	context.nodes.resize(2 * maxReferences - 1);
+	context.numNodes = 1;
+	context.leafPrimitives.resize(maxReferences);
+	context.numLeafPrimitives = 0;
+	buildNode(context, 0, rootReferences, budget);
+
+	nodes.clear();
+	nodes.reserve(context.numNodes);
+	nodes.resize(1);
+	references.clear();
+	references.reserve(context.numLeafPrimitives);
+	storeDepthFirst(context, 0, 0, nodes, references);
+}
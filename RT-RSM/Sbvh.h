@@ -0,0 +1,16 @@
+#pragma once
+#include "Bvh.h"
+
+/*
+	Spatial split BVH (Stich et al. 2009), the BvhBuilder::Sbvh path of buildBvh. Every node bins its references like
+	the SAH builder, and where the two boxes of the best object split overlap by more than settings.spatialSplitOverlap
+	of the root area it also bins them spatially: the triangles are clipped against the bin planes, so a long triangle
+	only adds its part to every bin it crosses. If the spatial split is cheaper the references crossing the plane are
+	split in two, unless putting one on one side only costs less. Each duplicate takes one reference of the budget,
+	spatialSplitBudget times the number of primitives, which the children share in proportion to their references.
+
+	Leaves bound the clipped parts of their triangles. Without geometries (boxes) references are split by clipping the box.
+	The result doesn't depend on the number of threads.
+*/
+void buildSbvh(const std::vector<BvhBounds>& primitiveBounds, const std::vector<MeshView>* pGeometries, const std::vector<BvhPrimitive>& primitives,
+	const BvhBuildSettings& settings, TaskPool& pool, std::vector<BvhNode>& nodes, std::vector<uint32_t>& references);
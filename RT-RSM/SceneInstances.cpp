@@ -0,0 +1,152 @@
+#include "SceneInstances.h"
+#include <algorithm>
+#include <string.h>
+
+uint32_t SceneInstances::addModel(uint32_t numMeshes)
+{
+	uint32_t first = getNumInstances();
+	mModelFirstInstance.push_back(first);
+	mModelInstanceCount.push_back(numMeshes);
+
+	uint32_t count = first + numMeshes;
+	mBlasAddress.resize(count, 0);
+	mIdAndMask.resize(count, 0);
+	mHitGroupAndFlags.resize(count, 0);
+	mMeshOffset.resize(count, vec3(0.0f));
+	mRow0.resize(count, vec4(1.0f, 0.0f, 0.0f, 0.0f));
+	mRow1.resize(count, vec4(0.0f, 1.0f, 0.0f, 0.0f));
+	mRow2.resize(count, vec4(0.0f, 0.0f, 1.0f, 0.0f));
+	mLocalCenter.resize(count, vec3(0.0f));
+	mLocalExtent.resize(count, vec3(0.0f));
+	mDirty.resize(count, 1);
+	mNumDirty += numMeshes;
+	for (uint32_t i = 0; i < numMeshes; i++)
+	{
+		mIdAndMask[first + i] = i | 0xff000000;
+	}
+	return first;
+}
+
+void SceneInstances::setInstance(uint32_t instance, uint64_t blasAddress, uint32_t hitGroupIndex, uint8_t mask, uint8_t flags, const vec3& meshOffset)
+{
+	mBlasAddress[instance] = blasAddress;
+	mIdAndMask[instance] = (mIdAndMask[instance] & 0xffffff) | ((uint32_t)mask << 24);
+	mHitGroupAndFlags[instance] = (hitGroupIndex & 0xffffff) | ((uint32_t)flags << 24);
+	mMeshOffset[instance] = meshOffset;
+	setDirty(instance);
+}
+
+void SceneInstances::setInstanceBounds(uint32_t instance, const vec3& center, const vec3& extent)
+{
+	mLocalCenter[instance] = center;
+	mLocalExtent[instance] = extent;
+	setDirty(instance);
+}
+
+void SceneInstances::setDirty(uint32_t instance)
+{
+	mNumDirty += mDirty[instance] ? 0 : 1;
+	mDirty[instance] = 1;
+}
+
+void SceneInstances::clear()
+{
+	mBlasAddress.clear();
+	mIdAndMask.clear();
+	mHitGroupAndFlags.clear();
+	mMeshOffset.clear();
+	mRow0.clear();
+	mRow1.clear();
+	mRow2.clear();
+	mLocalCenter.clear();
+	mLocalExtent.clear();
+	mDirty.clear();
+	mNumDirty = 0;
+	mModelFirstInstance.clear();
+	mModelInstanceCount.clear();
+}
+
+void SceneInstances::setModelTransform(ModelHandle model, const mat4& modelToWorld)
+{
+	// GLM is column major, the instance matrix is row major
+	mat4 rows = transpose(modelToWorld);
+	uint32_t end = mModelFirstInstance[model] + mModelInstanceCount[model];
+	for (uint32_t i = mModelFirstInstance[model]; i < end; i++)
+	{
+		// The offset only moves the translation column: row.w += dot(row.xyz, offset)
+		vec3 offset = mMeshOffset[i];
+		vec4 row0 = vec4(vec3(rows[0]), rows[0].w + dot(vec3(rows[0]), offset));
+		vec4 row1 = vec4(vec3(rows[1]), rows[1].w + dot(vec3(rows[1]), offset));
+		vec4 row2 = vec4(vec3(rows[2]), rows[2].w + dot(vec3(rows[2]), offset));
+		if (row0 != mRow0[i] || row1 != mRow1[i] || row2 != mRow2[i])
+		{
+			mRow0[i] = row0;
+			mRow1[i] = row1;
+			mRow2[i] = row2;
+			setDirty(i);
+		}
+	}
+}
+
+TlasInstanceDesc SceneInstances::getInstanceDesc(uint32_t instance) const
+{
+	TlasInstanceDesc desc;
+	memcpy(desc.transform[0], &mRow0[instance], sizeof(vec4));
+	memcpy(desc.transform[1], &mRow1[instance], sizeof(vec4));
+	memcpy(desc.transform[2], &mRow2[instance], sizeof(vec4));
+	desc.instanceID = mIdAndMask[instance] & 0xffffff;
+	desc.instanceMask = mIdAndMask[instance] >> 24;
+	desc.hitGroupIndex = mHitGroupAndFlags[instance] & 0xffffff;
+	desc.flags = mHitGroupAndFlags[instance] >> 24;
+	desc.accelerationStructure = mBlasAddress[instance];
+	return desc;
+}
+
+void SceneInstances::writeInstanceDescs(TlasInstanceDesc* pDescs) const
+{
+	for (uint32_t i = 0; i < getNumInstances(); i++)
+	{
+		pDescs[i] = getInstanceDesc(i);
+	}
+}
+
+uint32_t SceneInstances::writeDirtyInstanceDescs(TlasInstanceDesc* pDescs)
+{
+	uint32_t numWritten = 0;
+	for (uint32_t i = 0; i < getNumInstances() && numWritten < mNumDirty; i++)
+	{
+		if (mDirty[i])
+		{
+			pDescs[i] = getInstanceDesc(i);
+			mDirty[i] = 0;
+			numWritten++;
+		}
+	}
+	mNumDirty = 0;
+	return numWritten;
+}
+
+void SceneInstances::clearDirty()
+{
+	std::fill(mDirty.begin(), mDirty.end(), (uint8_t)0);
+	mNumDirty = 0;
+}
+
+mat4 SceneInstances::getTransform(uint32_t instance) const
+{
+	return transpose(mat4(mRow0[instance], mRow1[instance], mRow2[instance], vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+void SceneInstances::getWorldBounds(uint32_t instance, vec3& center, vec3& extent) const
+{
+	// Arvo's method on the rows of the instance matrix
+	const vec3& localCenter = mLocalCenter[instance];
+	const vec3& localExtent = mLocalExtent[instance];
+	const vec4* pRows[3] = { &mRow0[instance], &mRow1[instance], &mRow2[instance] };
+	for (int r = 0; r < 3; r++)
+	{
+		vec3 row = vec3(*pRows[r]);
+		center[r] = dot(row, localCenter) + pRows[r]->w;
+		extent[r] = dot(abs(row), localExtent);
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "MeshData.h"
+
+///////////////////////////////////////////
+// Scene instances
+///////////////////////////////////////////
+/*
+	Models are referred to by a stable integer handle, their index in the SceneRegistry.
+	Every mesh of every model is one TLAS instance. The instances of a model are contiguous and in
+	mesh order, and the models are in handle order, so instance and shader table indices match.
+*/
+typedef uint32_t ModelHandle;
+static const ModelHandle kInvalidModelHandle = 0xffffffff;
+
+// Same layout as D3D12_RAYTRACING_INSTANCE_DESC, written straight into the mapped instance buffer
+struct TlasInstanceDesc
+{
+	float		transform[3][4];
+	uint32_t	instanceID : 24;
+	uint32_t	instanceMask : 8;
+	uint32_t	hitGroupIndex : 24;
+	uint32_t	flags : 8;
+	uint64_t	accelerationStructure;
+};
+
+/*
+	Everything the TLAS needs per instance, as structure of arrays. The world transforms are kept as the
+	three rows of the 3x4 instance matrix. Nothing here allocates after the instances have been added,
+	so the per-frame path (setModelTransform, writeInstanceDescs) is allocation free.
+	An instance is dirty from the moment its desc changes until writeDirtyInstanceDescs or clearDirty,
+	setting the transform it already has doesn't count as a change.
+*/
+class SceneInstances
+{
+public:
+	// Append numMeshes instances for the next model, returns the first one
+	uint32_t addModel(uint32_t numMeshes);
+	void setInstance(uint32_t instance, uint64_t blasAddress, uint32_t hitGroupIndex, uint8_t mask, uint8_t flags, const vec3& meshOffset);
+	void clear();
+
+	// Box around the BLAS in its own space, as centre and half extent. Only used for getWorldBounds, a point at the origin by default.
+	void setInstanceBounds(uint32_t instance, const vec3& center, const vec3& extent);
+
+	// Transform of all instances of a model: modelToWorld * translate(meshOffset)
+	void setModelTransform(ModelHandle model, const mat4& modelToWorld);
+
+	// pDescs needs room for getNumInstances() entries
+	void writeInstanceDescs(TlasInstanceDesc* pDescs) const;
+
+	// Only the dirty entries of pDescs are written, then nothing is dirty. Returns how many were written.
+	uint32_t writeDirtyInstanceDescs(TlasInstanceDesc* pDescs);
+	void clearDirty();
+	uint32_t getNumDirty() const { return mNumDirty; }
+
+	uint32_t getNumInstances() const { return (uint32_t)mBlasAddress.size(); }
+	uint32_t getNumModels() const { return (uint32_t)mModelFirstInstance.size(); }
+	uint32_t getFirstInstance(ModelHandle model) const { return mModelFirstInstance[model]; }
+	uint32_t getInstanceCount(ModelHandle model) const { return mModelInstanceCount[model]; }
+	mat4 getTransform(uint32_t instance) const;
+
+	// Box around the instance bounds under the instance transform
+	void getWorldBounds(uint32_t instance, vec3& center, vec3& extent) const;
+
+private:
+	TlasInstanceDesc getInstanceDesc(uint32_t instance) const;
+	void setDirty(uint32_t instance);
+
+	// Per instance
+	std::vector<uint64_t>	mBlasAddress;
+	std::vector<uint32_t>	mIdAndMask;			// instance ID (mesh index in its model) | mask << 24
+	std::vector<uint32_t>	mHitGroupAndFlags;	// hit group index | flags << 24
+	std::vector<vec3>		mMeshOffset;
+	std::vector<vec4>		mRow0, mRow1, mRow2;
+	std::vector<vec3>		mLocalCenter, mLocalExtent;
+	std::vector<uint8_t>	mDirty;
+	uint32_t				mNumDirty = 0;
+
+	// Per model
+	std::vector<uint32_t>	mModelFirstInstance;
+	std::vector<uint32_t>	mModelInstanceCount;
+};
@@ -0,0 +1,61 @@
+#include "SceneRegistry.h"
+
+ModelHandle SceneRegistry::addModel(const std::string& name, Model&& model, uint32_t flags)
+{
+	ModelHandle handle = (ModelHandle)mModels.size();
+	mModels.push_back(std::move(model));
+	mNames.push_back(name);
+	mFlags.push_back(flags);
+	return handle;
+}
+
+ModelHandle SceneRegistry::findModel(const std::string& name) const
+{
+	for (ModelHandle handle = 0; handle < getNumModels(); handle++)
+	{
+		if (mNames[handle] == name)
+		{
+			return handle;
+		}
+	}
+	return kInvalidModelHandle;
+}
+
+void SceneRegistry::clear()
+{
+	mModels.clear();
+	mNames.clear();
+	mFlags.clear();
+	mInstances.clear();
+}
+
+void SceneRegistry::createInstances(const ID3D12ResourcePtr* pBottomLevelAS, uint32_t hitGroupsPerInstance)
+{
+	mInstances.clear();
+	for (ModelHandle handle = 0; handle < getNumModels(); handle++)
+	{
+		Model& model = mModels[handle];
+		uint32_t first = mInstances.addModel(model.getNumMeshes());
+		uint8_t mask = hasFlag(handle, kModelFlagAreaLight) ? 0x01 : 0xFF;
+		for (uint i = 0; i < model.getNumMeshes(); i++)
+		{
+			// Copies of the same mesh share one BLAS
+			uint64_t blasAddress = pBottomLevelAS[model.getModelIndex() + model.getBottomLevelASIndex(i)]->GetGPUVirtualAddress();
+			mInstances.setInstance(first + i, blasAddress, hitGroupsPerInstance * (first + i), mask, D3D12_RAYTRACING_INSTANCE_FLAG_FORCE_OPAQUE, model.getMeshOffset(i));
+
+			// The mesh bounds are in model space, the BLAS of a copy sits at the mesh offset
+			if (model.getLocalBounds().size() == model.getNumMeshes())
+			{
+				mInstances.setInstanceBounds(first + i, model.getLocalBounds().getCenter(i) - model.getMeshOffset(i), model.getLocalBounds().getExtent(i));
+			}
+		}
+		mInstances.setModelTransform(handle, model.getModelToWorld());
+	}
+}
+
+void SceneRegistry::setTransform(ModelHandle handle, const mat4& transform)
+{
+	Model& model = mModels[handle];
+	model.setTransform(transform);
+	mInstances.setModelTransform(handle, model.getModelToWorld());
+}
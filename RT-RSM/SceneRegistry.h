@@ -0,0 +1,45 @@
+#pragma once
+#include "Model.h"
+#include "SceneInstances.h"
+#include <string>
+
+// The sphere of the offline renderer's area light: not drawn to the shadow map, ray mask 0x01 and its own hit group
+static const uint32_t kModelFlagAreaLight = 1;
+
+/*
+	Owner of all models of the scene. Models live in one dense array and are referred to by their
+	ModelHandle, which never changes once added. Names are only used to look a handle up at load time,
+	the per-frame code keeps the handles. The TLAS data is mirrored in a SceneInstances, refreshed by setTransform.
+*/
+class SceneRegistry
+{
+public:
+	ModelHandle addModel(const std::string& name, Model&& model, uint32_t flags = 0);
+	ModelHandle findModel(const std::string& name) const;
+	void clear();
+
+	uint32_t		getNumModels() const { return (uint32_t)mModels.size(); }
+	Model&			getModel(ModelHandle handle) { return mModels[handle]; }
+	const Model&	getModel(ModelHandle handle) const { return mModels[handle]; }
+	const std::string& getName(ModelHandle handle) const { return mNames[handle]; }
+	bool			hasFlag(ModelHandle handle, uint32_t flag) const { return (mFlags[handle] & flag) != 0; }
+
+	/*
+		Create one instance per mesh once all models are loaded. pBottomLevelAS is indexed by
+		Model::getModelIndex() + Model::getBottomLevelASIndex(), every instance gets hitGroupsPerInstance shader table entries.
+		The instance bounds come from the mesh bounds of the models, so the TLAS update policy sees the instance extents.
+	*/
+	void createInstances(const ID3D12ResourcePtr* pBottomLevelAS, uint32_t hitGroupsPerInstance);
+
+	// Model::setTransform plus the instance transforms
+	void setTransform(ModelHandle handle, const mat4& transform);
+
+	const SceneInstances&	getInstances() const { return mInstances; }
+	SceneInstances&			getInstances() { return mInstances; }
+
+private:
+	std::vector<Model>			mModels;
+	std::vector<std::string>	mNames;
+	std::vector<uint32_t>		mFlags;
+	SceneInstances				mInstances;
+};
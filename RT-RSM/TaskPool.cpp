@@ -0,0 +1,141 @@
+#include "TaskPool.h"
+#include <algorithm>
+
+TaskPool::TaskPool(uint32_t numThreads)
+{
+	if (numThreads == 0)
+	{
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		numThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+	for (uint32_t i = 0; i < numThreads; i++)
+	{
+		mThreads.emplace_back(&TaskPool::workerLoop, this);
+	}
+}
+
+TaskPool::~TaskPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mCondition.notify_all();
+	for (std::thread& thread : mThreads)
+	{
+		thread.join();
+	}
+}
+
+TaskPool& TaskPool::getGlobal()
+{
+	static TaskPool pool;
+	return pool;
+}
+
+void TaskPool::runIndices(Job* pJob)
+{
+	for (uint32_t i = pJob->next.fetch_add(1); i < pJob->count; i = pJob->next.fetch_add(1))
+	{
+		(*pJob->pFunc)(i);
+		pJob->done.fetch_add(1);
+	}
+}
+
+// Take part in the oldest job that still has indices left. Returns false if there was nothing to do.
+bool TaskPool::helpOnce()
+{
+	Job* pJob = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		while (!mJobs.empty() && mJobs.front()->next.load() >= mJobs.front()->count)
+		{
+			mJobs.pop_front();
+		}
+		if (mJobs.empty())
+		{
+			return false;
+		}
+		pJob = mJobs.front();
+		pJob->users.fetch_add(1); // keeps the job alive until we are done with it
+	}
+	runIndices(pJob);
+	pJob->users.fetch_sub(1);
+	return true;
+}
+
+void TaskPool::workerLoop()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this] { return mStop || !mJobs.empty(); });
+			if (mStop)
+			{
+				return;
+			}
+		}
+		helpOnce();
+	}
+}
+
+void TaskPool::parallelFor(uint32_t count, const std::function<void(uint32_t)>& func)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	if (count == 1 || mThreads.empty())
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			func(i);
+		}
+		return;
+	}
+
+	Job job;
+	job.pFunc = &func;
+	job.count = count;
+	job.next = 0;
+	job.done = 0;
+	job.users = 0;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(&job);
+	}
+	mCondition.notify_all();
+
+	runIndices(&job);
+
+	// Make sure no worker can pick up the job any more
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = std::find(mJobs.begin(), mJobs.end(), &job);
+		if (it != mJobs.end())
+		{
+			mJobs.erase(it);
+		}
+	}
+
+	// Wait for the indices still running on other threads, helping with other jobs (e.g. nested ones) meanwhile
+	while (job.done.load() < count || job.users.load() > 0)
+	{
+		if (!helpOnce())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void TaskPool::parallelForRange(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& func)
+{
+	grainSize = std::max(grainSize, 1u);
+	uint32_t numRanges = (count + grainSize - 1) / grainSize;
+	parallelFor(numRanges, [&](uint32_t range)
+	{
+		uint32_t begin = range * grainSize;
+		func(begin, std::min(begin + grainSize, count));
+	});
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+/*
+	Minimal fork-join thread pool for the CPU side work (mesh ingestion, BVH builds, ...).
+	parallelFor may be called from inside a task, the waiting thread helps with other work meanwhile.
+*/
+class TaskPool
+{
+public:
+	// numThreads is the number of worker threads, 0 means one per hardware thread minus the caller
+	explicit TaskPool(uint32_t numThreads = 0);
+	~TaskPool();
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	// Number of threads that take part in a parallelFor, including the calling thread
+	uint32_t getNumThreads() const { return (uint32_t)mThreads.size() + 1; }
+
+	// Run func(i) for i in [0, count) and return when all calls have finished
+	void parallelFor(uint32_t count, const std::function<void(uint32_t)>& func);
+
+	// Split [0, count) into ranges of at most grainSize and run func(begin, end) on each
+	void parallelForRange(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t, uint32_t)>& func);
+
+	// Shared pool, created on first use
+	static TaskPool& getGlobal();
+
+private:
+	struct Job
+	{
+		const std::function<void(uint32_t)>* pFunc;
+		uint32_t				count;
+		std::atomic<uint32_t>	next;
+		std::atomic<uint32_t>	done;
+		std::atomic<uint32_t>	users;
+	};
+
+	void workerLoop();
+	bool helpOnce();
+	static void runIndices(Job* pJob);
+
+	std::vector<std::thread>	mThreads;
+	std::mutex					mMutex;
+	std::condition_variable		mCondition;
+	std::deque<Job*>			mJobs;
+	bool						mStop = false;
+};
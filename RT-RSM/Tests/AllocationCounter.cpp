@@ -0,0 +1,73 @@
+#include "AllocationCounter.h"
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+// All replaceable forms are defined, so memory is always freed by the allocator that allocated it
+static std::atomic<uint64_t> gAllocationCount(0);
+
+uint64_t getAllocationCount()
+{
+	return gAllocationCount.load();
+}
+
+static void* countedAlloc(size_t size)
+{
+	gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size > 0 ? size : 1);
+}
+
+static void* throwIfNull(void* pData)
+{
+	if (pData == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return pData;
+}
+
+void* operator new(size_t size) { return throwIfNull(countedAlloc(size)); }
+void* operator new[](size_t size) { return throwIfNull(countedAlloc(size)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void operator delete(void* pData) noexcept { free(pData); }
+void operator delete[](void* pData) noexcept { free(pData); }
+void operator delete(void* pData, size_t) noexcept { free(pData); }
+void operator delete[](void* pData, size_t) noexcept { free(pData); }
+void operator delete(void* pData, const std::nothrow_t&) noexcept { free(pData); }
+void operator delete[](void* pData, const std::nothrow_t&) noexcept { free(pData); }
+
+#ifdef __cpp_aligned_new
+static void* countedAlloc(size_t size, size_t alignment)
+{
+	gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	size = size > 0 ? size : 1;
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void* pData = nullptr;
+	return posix_memalign(&pData, std::max(alignment, sizeof(void*)), size) == 0 ? pData : nullptr;
+#endif
+}
+
+static void countedAlignedFree(void* pData)
+{
+#ifdef _WIN32
+	_aligned_free(pData);
+#else
+	free(pData);
+#endif
+}
+
+void* operator new(size_t size, std::align_val_t alignment) { return throwIfNull(countedAlloc(size, (size_t)alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return throwIfNull(countedAlloc(size, (size_t)alignment)); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAlloc(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAlloc(size, (size_t)alignment); }
+void operator delete(void* pData, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete[](void* pData, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete(void* pData, size_t, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete[](void* pData, size_t, std::align_val_t) noexcept { countedAlignedFree(pData); }
+void operator delete(void* pData, std::align_val_t, const std::nothrow_t&) noexcept { countedAlignedFree(pData); }
+void operator delete[](void* pData, std::align_val_t, const std::nothrow_t&) noexcept { countedAlignedFree(pData); }
+#endif
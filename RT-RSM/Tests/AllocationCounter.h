@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+/*
+	rtrsm_tests replaces the global operator new, so a test can check that a path doesn't allocate.
+	Only the heap allocations made through new are counted, on every thread.
+*/
+uint64_t getAllocationCount();
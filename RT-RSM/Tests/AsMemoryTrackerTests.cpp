@@ -0,0 +1,159 @@
+#include "Test.h"
+#include "AsMemoryTracker.h"
+
+TEST(AsMemoryTracker, ScratchIsReusedWithinABatch)
+{
+	AsMemoryTracker tracker;
+	AsScratch first, second, third;
+	uint32_t a = tracker.beginBuild("a", false, true, 1000, 10000, false, first);
+	CHECK(first.create && !first.needsBarrier);
+	CHECK(first.size == kAsScratchGranularity);
+	CHECK(tracker.getInfo(a).maxResultSize == 1024);
+	tracker.endBuild(a);
+
+	// Same batch: the pooled buffer is taken again, behind a barrier
+	uint32_t b = tracker.beginBuild("b", false, true, 1000, 20000, false, second);
+	CHECK(!second.create && second.needsBarrier);
+	CHECK(second.buffer == first.buffer);
+	tracker.endBuild(b);
+
+	// Next batch: no barrier any more
+	tracker.finishBatch();
+	uint32_t c = tracker.beginBuild("c", false, true, 1000, 30000, false, third);
+	CHECK(!third.create && !third.needsBarrier);
+	tracker.endBuild(c);
+
+	AsMemoryStats stats = tracker.getStats();
+	CHECK(stats.numScratchBuffers == 1);
+	CHECK(stats.numScratchCreated == 1);
+	CHECK(stats.numScratchReused == 2);
+	CHECK(stats.scratchInUseBytes == 0);
+	CHECK(stats.numBottomLevel == 3);
+	CHECK(stats.resultBytes == 3 * 1024);
+}
+
+TEST(AsMemoryTracker, ScratchBestFit)
+{
+	AsMemoryTracker tracker;
+	AsScratch small, large, scratch;
+	uint32_t a = tracker.beginBuild("a", false, false, 256, kAsScratchGranularity, false, small);
+	uint32_t b = tracker.beginBuild("b", false, false, 256, 3 * kAsScratchGranularity, false, large);
+	CHECK(small.buffer != large.buffer);
+	tracker.endBuild(a);
+	tracker.endBuild(b);
+
+	uint32_t c = tracker.beginBuild("c", false, false, 256, 100, false, scratch);
+	CHECK(scratch.buffer == small.buffer);
+	// The small one is in use, the large one fits too
+	uint32_t d = tracker.beginBuild("d", false, false, 256, 100, false, scratch);
+	CHECK(scratch.buffer == large.buffer);
+	// Nothing free fits, a new buffer
+	uint32_t e = tracker.beginBuild("e", false, false, 256, 100, false, scratch);
+	CHECK(scratch.create);
+	tracker.endBuild(c);
+	tracker.endBuild(d);
+	tracker.endBuild(e);
+
+	// No scratch at all for an empty build
+	uint32_t f = tracker.beginBuild("f", false, false, 256, 0, false, scratch);
+	CHECK(scratch.buffer == kInvalidAsId && !scratch.create);
+	tracker.endBuild(f);
+	CHECK(tracker.getStats().numScratchBuffers == 3);
+}
+
+TEST(AsMemoryTracker, KeptScratch)
+{
+	AsMemoryTracker tracker;
+	AsScratch scratch, other;
+	uint32_t tlas = tracker.beginBuild("tlas", true, false, 4096, 1000, true, scratch);
+	tracker.endBuild(tlas);
+	CHECK(tracker.getStats().scratchInUseBytes == scratch.size);
+
+	// Kept for updates, so another build can't take it
+	uint32_t blas = tracker.beginBuild("blas", false, true, 4096, 1000, false, other);
+	CHECK(other.buffer != scratch.buffer);
+	tracker.endBuild(blas);
+
+	// Updates use the kept buffer while it is large enough, and grow it otherwise
+	CHECK(tracker.getUpdateScratch(tlas, 2000).buffer == scratch.buffer);
+	AsScratch grown = tracker.getUpdateScratch(tlas, 2 * kAsScratchGranularity);
+	CHECK(grown.size >= 2 * kAsScratchGranularity);
+	CHECK(tracker.getInfo(tlas).scratch == grown.buffer);
+
+	// Freeing the AS returns its scratch
+	tracker.free(tlas);
+	CHECK(tracker.getStats().scratchInUseBytes == 0);
+	CHECK(tracker.getStats().numTopLevel == 0);
+}
+
+TEST(AsMemoryTracker, CompactionCandidates)
+{
+	AsMemoryTracker tracker;
+	AsScratch scratch;
+	uint32_t big = tracker.beginBuild("big", false, true, 64 * 1024, 0, false, scratch);
+	uint32_t small = tracker.beginBuild("small", false, true, 64 * 1024, 0, false, scratch);
+	uint32_t noCompaction = tracker.beginBuild("no compaction", false, false, 64 * 1024, 0, false, scratch);
+	uint32_t unknown = tracker.beginBuild("unknown", false, true, 64 * 1024, 0, false, scratch);
+	tracker.endBuild(big);
+	tracker.endBuild(small);
+	tracker.endBuild(noCompaction);
+	tracker.endBuild(unknown);
+
+	tracker.setCompactedSize(big, 10000);
+	tracker.setCompactedSize(small, 64 * 1024 - kMinAsCompactionSaving + 1);
+	tracker.setCompactedSize(noCompaction, 100);
+	std::vector<uint32_t> candidates = tracker.getCompactionCandidates();
+	CHECK(candidates.size() == 1 && candidates[0] == big);
+
+	tracker.setCompacted(big);
+	CHECK(tracker.getInfo(big).resultSize == 10240);
+	CHECK(tracker.getCompactionCandidates().empty());
+	AsMemoryStats stats = tracker.getStats();
+	CHECK(stats.numCompacted == 1);
+	CHECK(stats.compactionSavedBytes == 64 * 1024 - 10240);
+	CHECK(stats.resultBytes == 3 * 64 * 1024 + 10240);
+
+	// A lower threshold makes the small saving worth it
+	tracker.setMinCompactionSaving(256);
+	candidates = tracker.getCompactionCandidates();
+	CHECK(candidates.size() == 1 && candidates[0] == small);
+}
+
+TEST(AsMemoryTracker, FreedIdsAreReused)
+{
+	AsMemoryTracker tracker;
+	AsScratch scratch;
+	uint32_t a = tracker.beginBuild("a", false, true, 256, 0, false, scratch);
+	uint32_t b = tracker.beginBuild("b", false, true, 256, 0, false, scratch);
+	tracker.free(a);
+	CHECK(!tracker.getInfo(a).live);
+	CHECK(tracker.getStats().numBottomLevel == 1);
+	uint32_t c = tracker.beginBuild("c", false, true, 512, 0, false, scratch);
+	CHECK(c == a && c != b);
+	CHECK(tracker.getInfo(c).owner == "c" && tracker.getInfo(c).live);
+	CHECK(tracker.getNumIds() == 2);
+}
+
+TEST(AsMemoryTracker, TrimScratch)
+{
+	AsMemoryTracker tracker;
+	AsScratch scratch;
+	uint32_t ids[3];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		ids[i] = tracker.beginBuild("a", false, false, 256, (i + 1) * kAsScratchGranularity, false, scratch);
+	}
+	tracker.endBuild(ids[0]);
+	tracker.endBuild(ids[2]);
+
+	// Largest idle buffer first, the one in use stays
+	std::vector<uint32_t> released = tracker.trimScratch(kAsScratchGranularity);
+	CHECK(released.size() == 1);
+	AsMemoryStats stats = tracker.getStats();
+	CHECK(stats.numScratchBuffers == 2);
+	CHECK(stats.scratchBytes == 3 * kAsScratchGranularity);
+
+	tracker.endBuild(ids[1]);
+	CHECK(tracker.trimScratch().size() == 2);
+	CHECK(tracker.getStats().scratchBytes == 0);
+}
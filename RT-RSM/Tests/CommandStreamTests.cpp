@@ -0,0 +1,83 @@
+#include "Test.h"
+#include "CommandStream.h"
+
+// A stream with a graphics root signature and pipeline bound and one buffer, ready for root arguments
+struct TestStream
+{
+	CommandStream	stream;
+	uint32_t		buffer;
+
+	TestStream()
+	{
+		uint32_t rootSignature = stream.addObject(CommandObjectType::RootSignature, "root signature");
+		uint32_t pipeline = stream.addObject(CommandObjectType::PipelineState, "pipeline");
+		buffer = stream.addObject(CommandObjectType::Resource, "buffer", 1 << 20);
+		stream.setRootSignature(CommandBindPoint::Graphics, rootSignature);
+		stream.setPipelineState(pipeline);
+	}
+
+	// Errors of a replay on the null device
+	uint32_t getNumErrors() const
+	{
+		NullCommandDevice device;
+		CHECK(stream.replay(device));
+		return device.getNumErrors();
+	}
+};
+
+static CommandAddress getAddress(uint32_t resource, uint64_t offset)
+{
+	CommandAddress address;
+	address.resource = resource;
+	address.offset = offset;
+	return address;
+}
+
+TEST(CommandStream, ValidRootArguments)
+{
+	TestStream test;
+	const uint32_t kValues[4] = { 1, 2, 3, 4 };
+	test.stream.setRoot32BitConstants(CommandBindPoint::Graphics, 0, 4, kValues, 60);
+	test.stream.setRootView(CommandBindPoint::Graphics, CommandRootView::ConstantBuffer, 1, getAddress(test.buffer, 512));
+	test.stream.setRootView(CommandBindPoint::Graphics, CommandRootView::ShaderResource, 2, getAddress(test.buffer, 4));
+	test.stream.drawInstanced(3, 1, 0, 0);
+	CHECK(test.getNumErrors() == 0);
+}
+
+TEST(CommandStream, RootConstantsPastTheRootSignature)
+{
+	const uint32_t kValues[4] = { 1, 2, 3, 4 };
+	TestStream pastTheEnd;
+	pastTheEnd.stream.setRoot32BitConstants(CommandBindPoint::Graphics, 0, 4, kValues, 61);
+	CHECK(pastTheEnd.getNumErrors() == 1);
+
+	// The end of the range must not wrap around
+	TestStream wrapping;
+	wrapping.stream.setRoot32BitConstants(CommandBindPoint::Graphics, 0, 4, kValues, 0xfffffffe);
+	CHECK(wrapping.getNumErrors() == 1);
+
+	TestStream noValues;
+	noValues.stream.setRoot32BitConstants(CommandBindPoint::Graphics, 0, 0, nullptr, 0);
+	CHECK(noValues.getNumErrors() == 1);
+
+	TestStream badParameter;
+	badParameter.stream.setRoot32BitConstants(CommandBindPoint::Graphics, 64, 1, kValues, 0);
+	CHECK(badParameter.getNumErrors() == 1);
+}
+
+TEST(CommandStream, RootArgumentsWithoutRootSignature)
+{
+	const uint32_t kValue = 1;
+	TestStream test;
+	test.stream.setRoot32BitConstants(CommandBindPoint::Compute, 0, 1, &kValue, 0);
+	test.stream.setRootView(CommandBindPoint::Compute, CommandRootView::ShaderResource, 0, getAddress(test.buffer, 0));
+	CHECK(test.getNumErrors() == 2);
+}
+
+TEST(CommandStream, UnalignedConstantBufferView)
+{
+	TestStream test;
+	test.stream.setRootView(CommandBindPoint::Graphics, CommandRootView::ConstantBuffer, 1, getAddress(test.buffer, 128));
+	test.stream.setRootView(CommandBindPoint::Graphics, CommandRootView::UnorderedAccess, 2, getAddress(test.buffer, 128));
+	CHECK(test.getNumErrors() == 1);
+}
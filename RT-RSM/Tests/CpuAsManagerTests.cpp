@@ -0,0 +1,151 @@
+#include "Test.h"
+#include "CpuAsManager.h"
+
+// A grid of size x size quads in the xy plane between 0 and size, two triangles each
+struct TestGrid
+{
+	std::vector<vec3>		positions;
+	std::vector<uint32_t>	indices;
+
+	explicit TestGrid(uint32_t size)
+	{
+		for (uint32_t y = 0; y <= size; y++)
+		{
+			for (uint32_t x = 0; x <= size; x++)
+			{
+				positions.push_back(vec3((float)x, (float)y, 0.0f));
+			}
+		}
+		for (uint32_t y = 0; y < size; y++)
+		{
+			for (uint32_t x = 0; x < size; x++)
+			{
+				uint32_t v = y * (size + 1) + x;
+				uint32_t quad[] = { v, v + 1, v + size + 2, v, v + size + 2, v + size + 1 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+	}
+
+	std::vector<MeshView> getGeometries() const
+	{
+		MeshView view;
+		view.positions = positions.data();
+		view.indices = indices.data();
+		view.vertexCount = (uint32_t)positions.size();
+		view.indexCount = (uint32_t)indices.size();
+		return std::vector<MeshView>(1, view);
+	}
+};
+
+// Primitive hit by a ray straight down at (x, y), kCpuNoHit if none
+static uint32_t traceDown(const CpuBlas& blas, float x, float y)
+{
+	CpuHit hit;
+	hit.t = 10.0f;
+	blas.intersect(vec3(x, y, 1.0f), vec3(0.0f, 0.0f, -1.0f), 0.0f, kRayFlagNone, 0, hit);
+	return hit.primitiveIndex;
+}
+
+// Which triangle of the grid contains (x, y), the first one of a quad is below its diagonal
+static uint32_t getGridPrimitive(uint32_t size, float x, float y)
+{
+	uint32_t quad = (uint32_t)y * size + (uint32_t)x;
+	return 2 * quad + (x - (uint32_t)x > y - (uint32_t)y ? 0 : 1);
+}
+
+static bool tracesGrid(const CpuBlas& blas, uint32_t size)
+{
+	bool correct = true;
+	for (uint32_t i = 0; i < 64; i++)
+	{
+		float x = 0.37f + (size - 1) * (i % 8) / 7.0f;
+		float y = 0.81f + (size - 1) * (i / 8) / 7.0f;
+		correct = correct && traceDown(blas, x, y) == getGridPrimitive(size, x, y);
+	}
+	return correct && traceDown(blas, -0.5f, 0.5f) == kCpuNoHit;
+}
+
+TEST(CpuAsManager, PrebuildSizesAreWorstCase)
+{
+	TestGrid grid(16);
+	std::vector<MeshView> geometries = grid.getGeometries();
+	CpuAsPrebuildInfo info = CpuAsManager::getBottomLevelPrebuildInfo(geometries);
+
+	CpuAsManager manager;
+	uint32_t id = manager.buildBottomLevel(geometries, "grid");
+	const AsInfo& asInfo = manager.getTracker().getInfo(id);
+	CHECK(asInfo.maxResultSize >= info.maxResultSize && asInfo.maxResultSize % kAsAlignment == 0);
+	CHECK(manager.getBlas(id).getWideBvh().getNumNodes() > 0);
+	CHECK(tracesGrid(manager.getBlas(id), 16));
+
+	// The compacted size is only known once the batch has run
+	CHECK(asInfo.compactedSize == 0);
+	manager.finishBatch();
+	CHECK(manager.getTracker().getInfo(id).compactedSize > 0);
+	CHECK(manager.getTracker().getInfo(id).compactedSize < info.maxResultSize);
+}
+
+TEST(CpuAsManager, CompactionKeepsTheHits)
+{
+	TestGrid large(32), small(1);
+	CpuAsManager manager;
+	uint32_t largeId = manager.buildBottomLevel(large.getGeometries(), "large");
+	uint32_t smallId = manager.buildBottomLevel(small.getGeometries(), "small");
+	manager.finishBatch();
+	uint64_t builtBytes = manager.getResultBytes();
+	CHECK(manager.getTracker().getStats().resultBytes == builtBytes);
+
+	// Two triangles can't save the minimum, so only the large grid is compacted
+	CHECK(manager.compact() == 1);
+	CHECK(manager.getTracker().getInfo(largeId).compacted);
+	CHECK(!manager.getTracker().getInfo(smallId).compacted);
+	CHECK(manager.getResultBytes() < builtBytes);
+	AsMemoryStats stats = manager.getTracker().getStats();
+	CHECK(stats.resultBytes == manager.getResultBytes());
+	CHECK(stats.compactionSavedBytes == builtBytes - manager.getResultBytes());
+	CHECK(tracesGrid(manager.getBlas(largeId), 32));
+	CHECK(tracesGrid(manager.getBlas(smallId), 1));
+	CHECK(manager.compact() == 0);
+}
+
+TEST(CpuAsManager, ScratchIsPooled)
+{
+	TestGrid grid(8);
+	CpuAsManager manager;
+	for (uint32_t i = 0; i < 10; i++)
+	{
+		manager.buildBottomLevel(grid.getGeometries(), "grid");
+	}
+	manager.finishBatch();
+
+	// One build at a time, so one scratch buffer for all of them, released once trimmed
+	AsMemoryStats stats = manager.getTracker().getStats();
+	CHECK(stats.numScratchBuffers == 1);
+	CHECK(stats.numScratchCreated == 1 && stats.numScratchReused == 9);
+	CHECK(stats.scratchInUseBytes == 0);
+	CHECK(manager.trimScratch().size() == 1);
+	CHECK(manager.getTracker().getStats().scratchBytes == 0);
+}
+
+TEST(CpuAsManager, FreeReleasesTheResult)
+{
+	TestGrid grid(4);
+	CpuAsManager manager;
+	uint32_t a = manager.buildBottomLevel(grid.getGeometries(), "a");
+	uint32_t b = manager.buildBottomLevel(grid.getGeometries(), "b");
+	manager.finishBatch();
+	uint64_t bytes = manager.getResultBytes();
+
+	manager.free(a);
+	CHECK(manager.getResultBytes() == bytes / 2);
+	CHECK(manager.getTracker().getStats().resultBytes == manager.getResultBytes());
+	CHECK(manager.getTracker().getStats().numBottomLevel == 1);
+	CHECK(tracesGrid(manager.getBlas(b), 4));
+
+	// The freed id is taken by the next build
+	uint32_t c = manager.buildBottomLevel(grid.getGeometries(), "c");
+	CHECK(c == a);
+	CHECK(tracesGrid(manager.getBlas(c), 4));
+	CHECK(manager.getResultBytes() == bytes);
+}
@@ -0,0 +1,124 @@
+#include "Test.h"
+#include "FrustumCulling.h"
+#include "Externals/GLM/glm/gtc/matrix_transform.hpp"
+#include <random>
+
+// The cube -1 <= x, y, z <= 1, planes in the order of extractFrustum
+static Frustum getUnitCube()
+{
+	Frustum frustum;
+	frustum.planes[0] = vec4(1.0f, 0.0f, 0.0f, 1.0f);
+	frustum.planes[1] = vec4(-1.0f, 0.0f, 0.0f, 1.0f);
+	frustum.planes[2] = vec4(0.0f, 1.0f, 0.0f, 1.0f);
+	frustum.planes[3] = vec4(0.0f, -1.0f, 0.0f, 1.0f);
+	frustum.planes[4] = vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	frustum.planes[5] = vec4(0.0f, 0.0f, -1.0f, 1.0f);
+	return frustum;
+}
+
+// Both kernels must return the same indices
+static std::vector<uint32_t> cull(const Frustum& frustum, const BoundingBoxes& boxes)
+{
+	std::vector<uint32_t> visible(boxes.size());
+	std::vector<uint32_t> reference(boxes.size());
+	uint32_t numVisible = cullBoxes(frustum, boxes, visible.data());
+	uint32_t numReference = cullBoxesScalar(frustum, boxes, reference.data());
+	visible.resize(numVisible);
+	reference.resize(numReference);
+	CHECK(visible == reference);
+	return visible;
+}
+
+static bool isVisible(const Frustum& frustum, const vec3& center, const vec3& extent)
+{
+	BoundingBoxes boxes;
+	boxes.resize(1);
+	boxes.set(0, center, extent);
+	return cull(frustum, boxes).size() == 1;
+}
+
+TEST(FrustumCulling, Empty)
+{
+	BoundingBoxes boxes;
+	CHECK(cull(getUnitCube(), boxes).empty());
+}
+
+TEST(FrustumCulling, StraddlingPlane)
+{
+	Frustum frustum = getUnitCube();
+	CHECK(isVisible(frustum, vec3(1.5f, 0.0f, 0.0f), vec3(1.0f)));
+	CHECK(isVisible(frustum, vec3(0.0f, -1.5f, 0.0f), vec3(1.0f)));
+	CHECK(isVisible(frustum, vec3(0.0f, 0.0f, 1.9f), vec3(1.0f)));
+	// Touching the plane from outside still counts as intersecting
+	CHECK(isVisible(frustum, vec3(2.0f, 0.0f, 0.0f), vec3(1.0f)));
+	CHECK(!isVisible(frustum, vec3(2.01f, 0.0f, 0.0f), vec3(1.0f)));
+	CHECK(!isVisible(frustum, vec3(0.0f, 0.0f, -2.01f), vec3(1.0f)));
+	// Larger than the frustum in every direction
+	CHECK(isVisible(frustum, vec3(0.0f), vec3(100.0f)));
+}
+
+TEST(FrustumCulling, DegenerateExtent)
+{
+	Frustum frustum = getUnitCube();
+	CHECK(isVisible(frustum, vec3(0.5f, -0.5f, 0.0f), vec3(0.0f)));
+	CHECK(isVisible(frustum, vec3(1.0f, 1.0f, 1.0f), vec3(0.0f)));
+	CHECK(!isVisible(frustum, vec3(1.01f, 0.0f, 0.0f), vec3(0.0f)));
+	// Flat boxes, such as the bounds of a single quad
+	CHECK(isVisible(frustum, vec3(0.0f, 1.5f, 0.0f), vec3(5.0f, 0.5f, 0.0f)));
+	CHECK(!isVisible(frustum, vec3(0.0f, 0.0f, 1.5f), vec3(5.0f, 5.0f, 0.0f)));
+}
+
+// Counts that are not a multiple of four go through the scalar tail of cullBoxes
+TEST(FrustumCulling, RemainderCounts)
+{
+	Frustum frustum = getUnitCube();
+	for (uint32_t count = 1; count <= 13; count++)
+	{
+		BoundingBoxes boxes;
+		boxes.resize(count);
+		std::vector<uint32_t> expected;
+		for (uint32_t b = 0; b < count; b++)
+		{
+			// Every third box is outside, including the last ones of the tail
+			bool inside = b % 3 != 1;
+			boxes.set(b, vec3(inside ? 0.0f : 5.0f, 0.1f * b, 0.0f), vec3(0.5f));
+			if (inside)
+			{
+				expected.push_back(b);
+			}
+		}
+		CHECK(cull(frustum, boxes) == expected);
+	}
+}
+
+TEST(FrustumCulling, MatchesScalar)
+{
+	mat4 viewProj = perspective(radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) * lookAt(vec3(3.0f, 2.0f, -10.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = extractFrustum(viewProj);
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+	std::uniform_real_distribution<float> size(0.0f, 4.0f);
+	BoundingBoxes boxes;
+	boxes.resize(10003);
+	for (uint32_t b = 0; b < boxes.size(); b++)
+	{
+		vec3 center(position(rng), position(rng), position(rng));
+		vec3 extent(size(rng), size(rng), size(rng));
+		boxes.set(b, center, extent);
+	}
+	std::vector<uint32_t> visible = cull(frustum, boxes);
+	CHECK(!visible.empty() && visible.size() < boxes.size());
+}
+
+TEST(FrustumCulling, ExtractFrustum)
+{
+	mat4 viewProj = perspective(radians(90.0f), 1.0f, 1.0f, 10.0f) * lookAt(vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = extractFrustum(viewProj);
+	vec3 point(0.01f);
+	CHECK(isVisible(frustum, vec3(0.0f, 0.0f, -5.0f), point));
+	CHECK(!isVisible(frustum, vec3(0.0f, 0.0f, 5.0f), point));
+	CHECK(!isVisible(frustum, vec3(0.0f, 0.0f, -0.5f), point));
+	CHECK(!isVisible(frustum, vec3(0.0f, 0.0f, -11.0f), point));
+	CHECK(isVisible(frustum, vec3(4.9f, 0.0f, -5.0f), point));
+	CHECK(!isVisible(frustum, vec3(5.2f, 0.0f, -5.0f), point));
+}
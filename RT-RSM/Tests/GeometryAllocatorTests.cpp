@@ -0,0 +1,228 @@
+#include "Test.h"
+#include "GeometryAllocator.h"
+#include <string.h>
+
+// Live allocations are aligned, inside the capacity and don't overlap
+static bool isValid(const GeometryAllocator& allocator, const std::vector<GeometryAllocation>& allocations, const std::vector<uint64_t>& alignments)
+{
+	for (size_t i = 0; i < allocations.size(); i++)
+	{
+		uint64_t offset = allocator.getOffset(allocations[i].id);
+		if (offset % alignments[i] != 0 || offset + allocations[i].size > allocator.getCapacity())
+		{
+			return false;
+		}
+		for (size_t j = 0; j < i; j++)
+		{
+			uint64_t other = allocator.getOffset(allocations[j].id);
+			if (offset < other + allocations[j].size && other < offset + allocations[i].size)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+TEST(GeometryAllocator, Alignment)
+{
+	GeometryAllocator allocator(1024 * 1024);
+	const uint64_t kAlignments[] = { 1, 4, 16, 256, 65536, 16, 1, 256 };
+	const uint64_t kSizes[] = { 3, 10, 100, 7, 1000, 33, 1, 4096 };
+	std::vector<GeometryAllocation> allocations;
+	std::vector<uint64_t> alignments;
+	for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++)
+	{
+		GeometryAllocation allocation;
+		CHECK(allocator.allocate(kSizes[i], kAlignments[i], allocation));
+		CHECK(allocation.offset % kAlignments[i] == 0);
+		CHECK(allocation.size == kSizes[i]);
+		allocations.push_back(allocation);
+		alignments.push_back(kAlignments[i]);
+	}
+	CHECK(isValid(allocator, allocations, alignments));
+
+	// Everything not handed out is either padding or free
+	GeometryAllocatorStats stats = allocator.getStats();
+	uint64_t used = 0;
+	for (uint64_t size : kSizes)
+	{
+		used += size;
+	}
+	CHECK(stats.numAllocations == (uint32_t)allocations.size());
+	CHECK(stats.usedBytes == used);
+	CHECK(stats.usedBytes + stats.paddingBytes + stats.freeBytes == stats.capacity);
+	CHECK(stats.paddingBytes > 0);
+}
+
+TEST(GeometryAllocator, OutOfSpace)
+{
+	GeometryAllocator allocator(256);
+	GeometryAllocation allocation;
+	CHECK(!allocator.allocate(257, 1, allocation));
+	CHECK(allocator.allocate(256, 1, allocation));
+	CHECK(allocation.offset == 0);
+	GeometryAllocation other;
+	CHECK(!allocator.allocate(1, 1, other));
+	CHECK(allocator.getStats().freeBytes == 0);
+
+	// An empty allocator has nothing to give
+	GeometryAllocator empty;
+	CHECK(!empty.allocate(1, 1, other));
+}
+
+TEST(GeometryAllocator, FreeMergesNeighbours)
+{
+	GeometryAllocator allocator(300);
+	GeometryAllocation a, b, c;
+	CHECK(allocator.allocate(100, 1, a));
+	CHECK(allocator.allocate(100, 1, b));
+	CHECK(allocator.allocate(100, 1, c));
+	allocator.free(b.id);
+	CHECK(allocator.getStats().numFreeBlocks == 1);
+	allocator.free(a.id);
+	CHECK(allocator.getStats().numFreeBlocks == 1);
+	CHECK(allocator.getStats().largestFreeBlock == 200);
+	allocator.free(c.id);
+	GeometryAllocatorStats stats = allocator.getStats();
+	CHECK(stats.numFreeBlocks == 1);
+	CHECK(stats.freeBytes == 300);
+	CHECK(stats.numAllocations == 0);
+	CHECK(stats.getFragmentation() == 0.0f);
+
+	// Freeing twice or an unknown id changes nothing
+	allocator.free(c.id);
+	allocator.free(1000);
+	CHECK(allocator.getStats().freeBytes == 300);
+
+	// Freed ids are handed out again
+	GeometryAllocation d;
+	CHECK(allocator.allocate(10, 1, d));
+	CHECK(d.id == c.id);
+}
+
+TEST(GeometryAllocator, PaddingIsFreedWithTheAllocation)
+{
+	GeometryAllocator allocator(1024);
+	GeometryAllocation a, b;
+	CHECK(allocator.allocate(1, 1, a));
+	CHECK(allocator.allocate(1, 256, b));
+	CHECK(b.offset == 256);
+	CHECK(allocator.getStats().paddingBytes == 255);
+	allocator.free(b.id);
+	GeometryAllocatorStats stats = allocator.getStats();
+	CHECK(stats.paddingBytes == 0);
+	CHECK(stats.freeBytes == 1023);
+	CHECK(stats.numFreeBlocks == 1);
+}
+
+TEST(GeometryAllocator, BestFit)
+{
+	GeometryAllocator allocator(1000);
+	GeometryAllocation allocations[5];
+	const uint64_t kSizes[] = { 300, 100, 100, 100, 400 };
+	for (int i = 0; i < 5; i++)
+	{
+		CHECK(allocator.allocate(kSizes[i], 1, allocations[i]));
+	}
+	// Free blocks of 300 at 0 and 100 at 500, the smaller one fits
+	allocator.free(allocations[0].id);
+	allocator.free(allocations[3].id);
+	GeometryAllocation allocation;
+	CHECK(allocator.allocate(80, 1, allocation));
+	CHECK(allocation.offset == 500);
+}
+
+TEST(GeometryAllocator, FragmentationStats)
+{
+	GeometryAllocator allocator(1000);
+	std::vector<GeometryAllocation> allocations(10);
+	for (GeometryAllocation& allocation : allocations)
+	{
+		CHECK(allocator.allocate(100, 1, allocation));
+	}
+	CHECK(allocator.getStats().getFragmentation() == 0.0f);
+	for (size_t i = 0; i < allocations.size(); i += 2)
+	{
+		allocator.free(allocations[i].id);
+	}
+	GeometryAllocatorStats stats = allocator.getStats();
+	CHECK(stats.freeBytes == 500);
+	CHECK(stats.numFreeBlocks == 5);
+	CHECK(stats.largestFreeBlock == 100);
+	CHECK(stats.getFragmentation() > 0.79f && stats.getFragmentation() < 0.81f);
+
+	// 500 bytes are free, but not in one piece
+	GeometryAllocation large;
+	CHECK(!allocator.allocate(200, 1, large));
+	CHECK(!allocator.getReport().empty());
+}
+
+TEST(GeometryAllocator, Defragment)
+{
+	const uint64_t kCapacity = 4096;
+	GeometryAllocator allocator(kCapacity);
+	std::vector<GeometryAllocation> allocations;
+	std::vector<uint64_t> alignments;
+	uint32_t seed = 7;
+	for (uint32_t i = 0; i < 24; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		GeometryAllocation allocation;
+		uint64_t alignment = 1ull << (seed >> 29);
+		CHECK(allocator.allocate(16 + (seed >> 8) % 100, alignment, allocation));
+		allocations.push_back(allocation);
+		alignments.push_back(alignment);
+	}
+
+	// Free every third one, the rest keeps its contents through the moves
+	std::vector<GeometryAllocation> live;
+	std::vector<uint64_t> liveAlignments;
+	for (size_t i = 0; i < allocations.size(); i++)
+	{
+		if (i % 3 == 0)
+		{
+			allocator.free(allocations[i].id);
+		}
+		else
+		{
+			live.push_back(allocations[i]);
+			liveAlignments.push_back(alignments[i]);
+		}
+	}
+	std::vector<uint8_t> memory(kCapacity, 0);
+	for (const GeometryAllocation& allocation : live)
+	{
+		memset(&memory[allocator.getOffset(allocation.id)], (int)(allocation.id + 1), (size_t)allocation.size);
+	}
+	CHECK(allocator.getStats().numFreeBlocks > 1);
+
+	std::vector<GeometryMove> moves = allocator.defragment();
+	CHECK(!moves.empty());
+	for (const GeometryMove& move : moves)
+	{
+		CHECK(move.dstOffset < move.srcOffset);
+		CHECK(move.dstOffset == allocator.getOffset(move.id));
+		memmove(&memory[move.dstOffset], &memory[move.srcOffset], (size_t)move.size);
+	}
+	CHECK(isValid(allocator, live, liveAlignments));
+	for (const GeometryAllocation& allocation : live)
+	{
+		uint64_t offset = allocator.getOffset(allocation.id);
+		bool same = true;
+		for (uint64_t b = 0; b < allocation.size; b++)
+		{
+			same &= memory[offset + b] == (uint8_t)(allocation.id + 1);
+		}
+		CHECK(same);
+	}
+
+	// All free memory is one block at the end
+	GeometryAllocatorStats stats = allocator.getStats();
+	CHECK(stats.numFreeBlocks == 1);
+	CHECK(stats.getFragmentation() == 0.0f);
+	CHECK(stats.usedBytes + stats.paddingBytes + stats.freeBytes == kCapacity);
+
+	// A second pass has nothing left to move
+	CHECK(allocator.defragment().empty());
+}
@@ -0,0 +1,120 @@
+#include "Test.h"
+#include "AllocationCounter.h"
+#include "SceneInstances.h"
+#include "Externals/GLM/glm/gtc/matrix_transform.hpp"
+#include <string.h>
+
+// A few models with 1 to 50 meshes, every mesh at its own offset
+static void createTestInstances(SceneInstances& instances)
+{
+	static const uint32_t kMeshesPerModel[] = { 10, 1, 7, 50 };
+	instances.clear();
+	for (uint32_t meshes : kMeshesPerModel)
+	{
+		uint32_t first = instances.addModel(meshes);
+		for (uint32_t i = 0; i < meshes; i++)
+		{
+			uint32_t instance = first + i;
+			instances.setInstance(instance, 0x1000ull * instance, 2 * instance, i % 2 ? 0x01 : 0xFF, 4, vec3((float)i, 0.5f * i, -1.0f));
+		}
+	}
+}
+
+static mat4 getTestTransform(ModelHandle model, uint32_t frame)
+{
+	return translate(mat4(), vec3(1.0f * model, 0.5f, -2.0f)) * rotate(mat4(), 0.01f * frame + model, normalize(vec3(1.0f, 2.0f, 0.5f)));
+}
+
+static bool isEqual(const std::vector<TlasInstanceDesc>& a, const std::vector<TlasInstanceDesc>& b)
+{
+	return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(TlasInstanceDesc)) == 0;
+}
+
+TEST(SceneInstances, InstanceDescs)
+{
+	SceneInstances instances;
+	createTestInstances(instances);
+	for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+	{
+		instances.setModelTransform(model, getTestTransform(model, 3));
+	}
+	std::vector<TlasInstanceDesc> descs(instances.getNumInstances());
+	instances.writeInstanceDescs(descs.data());
+
+	for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+	{
+		for (uint32_t i = 0; i < instances.getInstanceCount(model); i++)
+		{
+			uint32_t instance = instances.getFirstInstance(model) + i;
+			const TlasInstanceDesc& desc = descs[instance];
+			mat4 expected = transpose(getTestTransform(model, 3) * translate(mat4(), vec3((float)i, 0.5f * i, -1.0f)));
+			float maxError = 0.0f;
+			for (int row = 0; row < 3; row++)
+			{
+				for (int column = 0; column < 4; column++)
+				{
+					maxError = std::max(maxError, std::abs(desc.transform[row][column] - expected[row][column]));
+				}
+			}
+			CHECK(maxError < 1e-5f);
+			CHECK(desc.instanceID == i);
+			CHECK(desc.instanceMask == (i % 2 ? 0x01u : 0xFFu));
+			CHECK(desc.hitGroupIndex == 2 * instance);
+			CHECK(desc.flags == 4);
+			CHECK(desc.accelerationStructure == 0x1000ull * instance);
+		}
+	}
+}
+
+TEST(SceneInstances, DirtyInstances)
+{
+	SceneInstances instances;
+	createTestInstances(instances);
+	for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+	{
+		instances.setModelTransform(model, getTestTransform(model, 0));
+	}
+	std::vector<TlasInstanceDesc> descs(instances.getNumInstances()), reference(instances.getNumInstances());
+	CHECK(instances.writeDirtyInstanceDescs(descs.data()) == instances.getNumInstances());
+	CHECK(instances.getNumDirty() == 0);
+
+	// The same transform again is no change
+	instances.setModelTransform(2, getTestTransform(2, 0));
+	CHECK(instances.getNumDirty() == 0);
+
+	instances.setModelTransform(2, getTestTransform(2, 1));
+	CHECK(instances.getNumDirty() == instances.getInstanceCount(2));
+	CHECK(instances.writeDirtyInstanceDescs(descs.data()) == instances.getInstanceCount(2));
+	instances.writeInstanceDescs(reference.data());
+	CHECK(isEqual(descs, reference));
+}
+
+// The per-frame TLAS path of RtRsm: new transforms for every model, then the instance descs
+TEST(SceneInstances, UpdateDoesNotAllocate)
+{
+	// Adding the instances does allocate, which also shows that the allocations are counted
+	uint64_t allocationsBefore = getAllocationCount();
+	SceneInstances instances;
+	createTestInstances(instances);
+	std::vector<TlasInstanceDesc> descs(instances.getNumInstances());
+	CHECK(getAllocationCount() > allocationsBefore);
+
+	allocationsBefore = getAllocationCount();
+	for (uint32_t frame = 0; frame < 100; frame++)
+	{
+		for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+		{
+			instances.setModelTransform(model, getTestTransform(model, frame));
+		}
+		if (frame % 2)
+		{
+			instances.writeInstanceDescs(descs.data());
+			instances.clearDirty();
+		}
+		else
+		{
+			instances.writeDirtyInstanceDescs(descs.data());
+		}
+	}
+	CHECK(getAllocationCount() == allocationsBefore);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+
+/*
+	Minimal test runner for the CPU components, built by the CMake project next to RT-RSM.sln. TEST(Suite, Name) defines
+	and registers a test, CHECK records a failure with its line and carries on, in release builds too.
+	rtrsm_tests runs everything, or only the suites named on the command line.
+*/
+struct TestCase
+{
+	const char*	pSuite;
+	const char*	pName;
+	void		(*pFunction)();
+};
+
+std::vector<TestCase>& getTestCases();
+void reportTestFailure(const char* pFile, int line, const char* pExpression);
+
+struct TestRegistrar
+{
+	TestRegistrar(const char* pSuite, const char* pName, void (*pFunction)()) { getTestCases().push_back({ pSuite, pName, pFunction }); }
+};
+
+#define TEST(suite, name) \
+	static void suite##_##name(); \
+	static TestRegistrar suite##_##name##_registrar(#suite, #name, suite##_##name); \
+	static void suite##_##name()
+
+#define CHECK(expression) \
+	do \
+	{ \
+		if (!(expression)) \
+		{ \
+			reportTestFailure(__FILE__, __LINE__, #expression); \
+		} \
+	} while (0)
@@ -0,0 +1,55 @@
+#include "Test.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t gNumFailures = 0;
+
+std::vector<TestCase>& getTestCases()
+{
+	static std::vector<TestCase> testCases;
+	return testCases;
+}
+
+void reportTestFailure(const char* pFile, int line, const char* pExpression)
+{
+	printf("  %s(%d): CHECK(%s) failed\n", pFile, line, pExpression);
+	gNumFailures++;
+}
+
+static bool isSelected(const char* pSuite, int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		return true;
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], pSuite) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t numRun = 0;
+	uint32_t numFailed = 0;
+	for (const TestCase& test : getTestCases())
+	{
+		if (!isSelected(test.pSuite, argc, argv))
+		{
+			continue;
+		}
+		uint32_t failuresBefore = gNumFailures;
+		test.pFunction();
+		bool passed = gNumFailures == failuresBefore;
+		printf("[%s] %s.%s\n", passed ? "  OK  " : " FAIL ", test.pSuite, test.pName);
+		numRun++;
+		numFailed += passed ? 0 : 1;
+	}
+	printf("%u tests, %u failed\n", numRun, numFailed);
+	return numRun > 0 && numFailed == 0 ? 0 : 1;
+}
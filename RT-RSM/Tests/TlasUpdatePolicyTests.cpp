@@ -0,0 +1,99 @@
+#include "Test.h"
+#include "AllocationCounter.h"
+#include "TlasUpdatePolicy.h"
+#include "Externals/GLM/glm/gtc/matrix_transform.hpp"
+
+// One single instance model per unit box, on a line along x
+static void createTestInstances(SceneInstances& instances, uint32_t count)
+{
+	instances.clear();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t instance = instances.addModel(1);
+		instances.setInstance(instance, 0x1000ull * instance, instance, 0xFF, 0, vec3(0.0f));
+		instances.setInstanceBounds(instance, vec3(0.0f), vec3(0.5f));
+		instances.setModelTransform(instance, translate(mat4(), vec3(2.0f * i, 0.0f, 0.0f)));
+	}
+}
+
+TEST(TlasUpdatePolicy, FirstFrameRebuilds)
+{
+	SceneInstances instances;
+	createTestInstances(instances, 16);
+	TlasUpdatePolicy policy;
+	CHECK(policy.chooseBuild(instances) == TlasBuildType::Rebuild);
+	CHECK(policy.getSahCost() == policy.getRebuildSahCost());
+	instances.clearDirty();
+	CHECK(policy.chooseBuild(instances) == TlasBuildType::None);
+
+	// A new instance changes the count, that always needs a rebuild
+	instances.addModel(1);
+	CHECK(policy.chooseBuild(instances) == TlasBuildType::Rebuild);
+}
+
+TEST(TlasUpdatePolicy, StillSceneNeedsNoBuild)
+{
+	SceneInstances instances;
+	createTestInstances(instances, 16);
+	instances.clearDirty();
+	TlasUpdatePolicy policy;
+	policy.onRebuild(instances);
+	for (uint32_t frame = 0; frame < 10; frame++)
+	{
+		for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+		{
+			instances.setModelTransform(model, translate(mat4(), vec3(2.0f * model, 0.0f, 0.0f)));
+		}
+		CHECK(policy.chooseBuild(instances) == TlasBuildType::None);
+	}
+	CHECK(policy.getNumFrames(TlasBuildType::None) == 10);
+}
+
+// Small motion keeps the tree good, so every frame is a refit, and refits don't allocate
+TEST(TlasUpdatePolicy, RefitDoesNotAllocate)
+{
+	SceneInstances instances;
+	createTestInstances(instances, 64);
+	instances.clearDirty();
+	TlasUpdatePolicy policy;
+	policy.onRebuild(instances);
+
+	uint64_t allocations = 0;
+	for (uint32_t frame = 1; frame <= 50; frame++)
+	{
+		instances.setModelTransform(frame % 64, translate(mat4(), vec3(2.0f * (frame % 64), 0.01f * frame, 0.0f)));
+		uint64_t allocationsBefore = getAllocationCount();
+		TlasBuildType type = policy.chooseBuild(instances);
+		allocations += getAllocationCount() - allocationsBefore;
+		CHECK(type == TlasBuildType::Refit);
+		instances.clearDirty();
+	}
+	CHECK(allocations == 0);
+	CHECK(policy.getSahCost() <= policy.getRebuildSahCost() * kTlasRebuildCostRatio);
+}
+
+// Instances swapping places make the refitted tree worse than a rebuilt one, until the policy rebuilds it
+TEST(TlasUpdatePolicy, ScatteredInstancesRebuild)
+{
+	SceneInstances instances;
+	createTestInstances(instances, 64);
+	instances.clearDirty();
+	TlasUpdatePolicy policy;
+	policy.onRebuild(instances);
+
+	bool rebuilt = false;
+	for (uint32_t frame = 1; frame <= 20 && !rebuilt; frame++)
+	{
+		for (ModelHandle model = 0; model < instances.getNumModels(); model++)
+		{
+			// Neighbours in the tree move to far apart places on the line
+			float target = 2.0f * ((model * 37) % 64);
+			float x = mix(2.0f * model, target, frame / 20.0f);
+			instances.setModelTransform(model, translate(mat4(), vec3(x, 0.0f, 0.0f)));
+		}
+		rebuilt = policy.chooseBuild(instances) == TlasBuildType::Rebuild;
+		CHECK(policy.getSahCost() <= policy.getRebuildSahCost() * kTlasRebuildCostRatio);
+		instances.clearDirty();
+	}
+	CHECK(rebuilt);
+}
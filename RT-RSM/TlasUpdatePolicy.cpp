@@ -0,0 +1,89 @@
+#include "TlasUpdatePolicy.h"
+
+const char* getTlasBuildTypeName(TlasBuildType type)
+{
+	switch (type)
+	{
+	case TlasBuildType::None:		return "none";
+	case TlasBuildType::Refit:		return "refit";
+	case TlasBuildType::Rebuild:	return "rebuild";
+	}
+	return "";
+}
+
+void TlasUpdatePolicy::gatherBounds(const SceneInstances& instances)
+{
+	mBounds.resize(instances.getNumInstances());
+	for (uint32_t i = 0; i < instances.getNumInstances(); i++)
+	{
+		vec3 center, extent;
+		instances.getWorldBounds(i, center, extent);
+		mBounds[i].min = center - extent;
+		mBounds[i].max = center + extent;
+	}
+}
+
+void TlasUpdatePolicy::refit()
+{
+	// Children are stored after their parent, so going backwards every child is done before its parent
+	for (size_t n = mBvh.nodes.size(); n-- > 0;)
+	{
+		BvhNode& node = mBvh.nodes[n];
+		BvhBounds bounds;
+		if (node.isLeaf())
+		{
+			for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+			{
+				bounds.grow(mBounds[mBvh.primitives[p].triangle]);
+			}
+		}
+		else
+		{
+			bounds = mBvh.nodes[node.firstChildOrPrimitive].getBounds();
+			bounds.grow(mBvh.nodes[node.firstChildOrPrimitive + 1].getBounds());
+		}
+		node.boundsMin = bounds.min;
+		node.boundsMax = bounds.max;
+	}
+}
+
+void TlasUpdatePolicy::onRebuild(const SceneInstances& instances)
+{
+	gatherBounds(instances);
+	BvhBuildSettings settings;
+	settings.maxLeafSize = 1;
+	buildBvh(mBounds, settings, mBvh);
+	mRebuildSahCost = mSahCost = computeSahCost(mBvh, settings);
+}
+
+TlasBuildType TlasUpdatePolicy::chooseBuild(const SceneInstances& instances)
+{
+	TlasBuildType type;
+	if (instances.getNumInstances() > 0 && (instances.getNumInstances() != (uint32_t)mBounds.size() || mBvh.nodes.empty()))
+	{
+		type = TlasBuildType::Rebuild;
+	}
+	else if (instances.getNumDirty() == 0 || instances.getNumInstances() == 0)
+	{
+		type = TlasBuildType::None;
+	}
+	else
+	{
+		gatherBounds(instances);
+		refit();
+		BvhBuildSettings settings;
+		settings.maxLeafSize = 1;
+		mSahCost = computeSahCost(mBvh, settings);
+
+		// A degenerate scene (every instance a point) has no meaningful cost, refits are as good as rebuilds then
+		bool degraded = mRebuildSahCost > 0.0f && mSahCost > mRebuildSahCost * mRebuildCostRatio;
+		type = degraded ? TlasBuildType::Rebuild : TlasBuildType::Refit;
+	}
+
+	if (type == TlasBuildType::Rebuild)
+	{
+		onRebuild(instances);
+	}
+	mNumFrames[(uint32_t)type]++;
+	return type;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "Bvh.h"
+#include "SceneInstances.h"
+
+// Refits are used until the estimated SAH cost of the refitted TLAS grows past this times the cost right after the last rebuild
+static const float kTlasRebuildCostRatio = 1.3f;
+
+enum class TlasBuildType
+{
+	None,		// nothing changed, the TLAS is used as it is
+	Refit,		// PERFORM_UPDATE in place, same tree with new bounds
+	Rebuild,	// full build into the same buffer
+};
+
+const char* getTlasBuildTypeName(TlasBuildType type);
+
+// What one frame did to the TLAS
+struct TlasUpdateStats
+{
+	TlasBuildType	type = TlasBuildType::None;
+	uint32_t		numWritten = 0;			// instance descs
+	float			sahCost = 0.0f;			// estimated, after this update
+	float			rebuildSahCost = 0.0f;	// estimated, right after the last rebuild
+};
+
+/*
+	Picks the TLAS build of each frame. Nothing dirty means no build at all. Otherwise it is a refit for as long as the
+	tree stays good: a binned SAH tree with one instance per leaf, like the one the driver builds, is mirrored on the CPU
+	over the world bounds of the instances. It is refitted with the new bounds, and once its SAH cost has grown past
+	the rebuild ratio the TLAS and the mirror are rebuilt. The refit path doesn't allocate.
+*/
+class TlasUpdatePolicy
+{
+public:
+	// Decide how the dirty instances get into the TLAS, before their descs are written
+	TlasBuildType chooseBuild(const SceneInstances& instances);
+
+	// The TLAS was built from scratch outside chooseBuild, e.g. when it is created
+	void onRebuild(const SceneInstances& instances);
+
+	float	getSahCost() const { return mSahCost; }
+	float	getRebuildSahCost() const { return mRebuildSahCost; }
+	void	setRebuildCostRatio(float ratio) { mRebuildCostRatio = ratio; }
+
+	// Frames of each TlasBuildType since the start
+	uint32_t getNumFrames(TlasBuildType type) const { return mNumFrames[(uint32_t)type]; }
+
+private:
+	void gatherBounds(const SceneInstances& instances);
+	void refit();
+
+	Bvh						mBvh;
+	std::vector<BvhBounds>	mBounds;	// world bounds of every instance
+	float					mSahCost = 0.0f;
+	float					mRebuildSahCost = 0.0f;
+	float					mRebuildCostRatio = kTlasRebuildCostRatio;
+	uint32_t				mNumFrames[3] = {};
+};
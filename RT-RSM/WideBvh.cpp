@@ -0,0 +1,853 @@
+#include "WideBvh.h"
+#include "AsStats.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define WIDE_BVH_SSE
+#include <emmintrin.h>
+#endif
+
+// MSVC compiles AVX2 intrinsics without /arch:AVX2 and we check the CPU at run time, other compilers need -mavx2
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || defined(__AVX2__)
+#define WIDE_BVH_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Up to seven siblings wait on the stack per level
+static const uint32_t kWideStackSize = 512;
+
+// A stack entry is a node index, or a triangle block index with the triangle count in the top bits
+static const uint32_t kCountShift = 28;
+static const uint32_t kIndexMask = (1u << kCountShift) - 1;
+
+struct WideStackEntry
+{
+	uint32_t	ref;
+	float		entry;		// distance at which the ray enters the child's box
+};
+
+static uint32_t getLowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+static bool isAvx2Supported()
+{
+#if defined(WIDE_BVH_AVX2) && defined(_MSC_VER)
+	// AVX2 in CPUID leaf 7 plus OS support for the YMM state
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(WIDE_BVH_AVX2)
+	return true;
+#else
+	return false;
+#endif
+}
+
+WideBvhKernel getBestWideBvhKernel()
+{
+	static const WideBvhKernel best = isAvx2Supported() ? WideBvhKernel::Avx2 :
+#ifdef WIDE_BVH_SSE
+		WideBvhKernel::Sse;
+#else
+		WideBvhKernel::Scalar;
+#endif
+	return best;
+}
+
+const char* getWideBvhKernelName(WideBvhKernel kernel)
+{
+	switch (kernel)
+	{
+	case WideBvhKernel::Avx2: return "AVX2";
+	case WideBvhKernel::Sse: return "SSE";
+	default: return "scalar";
+	}
+}
+
+///////////////////////////////////////////
+// Kernels
+///////////////////////////////////////////
+/*
+	intersectNode returns the mask of children whose box the ray enters within [tMin, tMax] and their entry
+	distances. intersectTriangles returns the mask of the first count triangles hit within (tMin, tMax], with t,
+	barycentrics and determinant as TraversalRay::intersectTriangle, and the lanes that touch an edge in
+	single precision in edgeMask, for the caller to decide with the scalar test. All kernels do the same
+	float operations in the same order as TraversalRay, so every path finds the same hits.
+*/
+struct ScalarKernel
+{
+	struct Ray
+	{
+		const TraversalRay* pRay;
+		explicit Ray(const TraversalRay& ray) : pRay(&ray) {}
+	};
+
+	static uint32_t intersectNode(const Ray& ray, const WideBvhNode& node, float tMin, float tMax, float* pEntry)
+	{
+		uint32_t mask = 0;
+		for (uint32_t c = 0; c < node.numChildren; c++)
+		{
+			BvhNode box;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				box.boundsMin[axis] = node.origin[axis] + (float)node.qMin[axis][c] * node.scale[axis];
+				box.boundsMax[axis] = node.origin[axis] + (float)node.qMax[axis][c] * node.scale[axis];
+			}
+			pEntry[c] = ray.pRay->intersectBox(box, tMin, tMax);
+			mask |= pEntry[c] != FLT_MAX ? 1u << c : 0;
+		}
+		return mask;
+	}
+
+	static uint32_t intersectTriangles(const Ray& ray, const WideBvhTriangles& triangles, uint32_t count, float tMin, float tMax, float* pT, float* pU, float* pV, float* pDet, uint32_t& edgeMask)
+	{
+		uint32_t mask = 0;
+		edgeMask = 0;
+		for (uint32_t lane = 0; lane < count; lane++)
+		{
+			vec3 v0(triangles.v0[0][lane], triangles.v0[1][lane], triangles.v0[2][lane]);
+			vec3 v1(triangles.v1[0][lane], triangles.v1[1][lane], triangles.v1[2][lane]);
+			vec3 v2(triangles.v2[0][lane], triangles.v2[1][lane], triangles.v2[2][lane]);
+			vec2 barycentrics;
+			if (ray.pRay->intersectTriangle(v0, v1, v2, tMin, tMax, pT[lane], barycentrics, pDet[lane]))
+			{
+				pU[lane] = barycentrics.x;
+				pV[lane] = barycentrics.y;
+				mask |= 1u << lane;
+			}
+		}
+		return mask;
+	}
+};
+
+#ifdef WIDE_BVH_SSE
+// Two halves of four lanes
+struct SseKernel
+{
+	struct Ray
+	{
+		__m128		origin[3];
+		__m128		invDirection[3];
+		__m128		shear[3];
+		int			kx, ky, kz;
+
+		explicit Ray(const TraversalRay& ray)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				origin[axis] = _mm_set1_ps(ray.origin[axis]);
+				invDirection[axis] = _mm_set1_ps(ray.invDirection[axis]);
+				shear[axis] = _mm_set1_ps(ray.shear[axis]);
+			}
+			kx = ray.kx;
+			ky = ray.ky;
+			kz = ray.kz;
+		}
+	};
+
+	static __m128 loadQuantized(const uint8_t* pData)
+	{
+		int32_t bytes;
+		memcpy(&bytes, pData, sizeof(bytes));
+		__m128i zero = _mm_setzero_si128();
+		__m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+		return _mm_cvtepi32_ps(values);
+	}
+
+	static uint32_t intersectNode(const Ray& ray, const WideBvhNode& node, float tMin, float tMax, float* pEntry)
+	{
+		uint32_t mask = 0;
+		for (uint32_t half = 0; half < kWideBvhWidth; half += 4)
+		{
+			__m128 entry = _mm_set1_ps(tMin);
+			__m128 exit = _mm_set1_ps(tMax);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				__m128 origin = _mm_set1_ps(node.origin[axis]);
+				__m128 scale = _mm_set1_ps(node.scale[axis]);
+				__m128 boxMin = _mm_add_ps(origin, _mm_mul_ps(loadQuantized(&node.qMin[axis][half]), scale));
+				__m128 boxMax = _mm_add_ps(origin, _mm_mul_ps(loadQuantized(&node.qMax[axis][half]), scale));
+				__m128 t0 = _mm_mul_ps(_mm_sub_ps(boxMin, ray.origin[axis]), ray.invDirection[axis]);
+				__m128 t1 = _mm_mul_ps(_mm_sub_ps(boxMax, ray.origin[axis]), ray.invDirection[axis]);
+				entry = _mm_max_ps(entry, _mm_min_ps(t0, t1));
+				exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+			}
+			_mm_storeu_ps(pEntry + half, entry);
+			mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(entry, exit)) << half;
+		}
+		return mask & ((1u << node.numChildren) - 1);
+	}
+
+	static uint32_t intersectTriangles(const Ray& ray, const WideBvhTriangles& triangles, uint32_t count, float tMin, float tMax, float* pT, float* pU, float* pV, float* pDet, uint32_t& edgeMask)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		uint32_t mask = 0;
+		edgeMask = 0;
+		for (uint32_t half = 0; half < count; half += 4)
+		{
+			__m128 ax = _mm_sub_ps(_mm_loadu_ps(&triangles.v0[ray.kx][half]), ray.origin[ray.kx]);
+			__m128 ay = _mm_sub_ps(_mm_loadu_ps(&triangles.v0[ray.ky][half]), ray.origin[ray.ky]);
+			__m128 az = _mm_sub_ps(_mm_loadu_ps(&triangles.v0[ray.kz][half]), ray.origin[ray.kz]);
+			__m128 bx = _mm_sub_ps(_mm_loadu_ps(&triangles.v1[ray.kx][half]), ray.origin[ray.kx]);
+			__m128 by = _mm_sub_ps(_mm_loadu_ps(&triangles.v1[ray.ky][half]), ray.origin[ray.ky]);
+			__m128 bz = _mm_sub_ps(_mm_loadu_ps(&triangles.v1[ray.kz][half]), ray.origin[ray.kz]);
+			__m128 cx = _mm_sub_ps(_mm_loadu_ps(&triangles.v2[ray.kx][half]), ray.origin[ray.kx]);
+			__m128 cy = _mm_sub_ps(_mm_loadu_ps(&triangles.v2[ray.ky][half]), ray.origin[ray.ky]);
+			__m128 cz = _mm_sub_ps(_mm_loadu_ps(&triangles.v2[ray.kz][half]), ray.origin[ray.kz]);
+			ax = _mm_sub_ps(ax, _mm_mul_ps(ray.shear[0], az));
+			ay = _mm_sub_ps(ay, _mm_mul_ps(ray.shear[1], az));
+			bx = _mm_sub_ps(bx, _mm_mul_ps(ray.shear[0], bz));
+			by = _mm_sub_ps(by, _mm_mul_ps(ray.shear[1], bz));
+			cx = _mm_sub_ps(cx, _mm_mul_ps(ray.shear[0], cz));
+			cy = _mm_sub_ps(cy, _mm_mul_ps(ray.shear[1], cz));
+
+			__m128 u = _mm_sub_ps(_mm_mul_ps(cx, by), _mm_mul_ps(cy, bx));
+			__m128 v = _mm_sub_ps(_mm_mul_ps(ax, cy), _mm_mul_ps(ay, cx));
+			__m128 w = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+			__m128 negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmplt_ps(v, zero)), _mm_cmplt_ps(w, zero));
+			__m128 positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(u, zero), _mm_cmpgt_ps(v, zero)), _mm_cmpgt_ps(w, zero));
+			__m128 edge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(u, zero), _mm_cmpeq_ps(v, zero)), _mm_cmpeq_ps(w, zero));
+			__m128 det = _mm_add_ps(_mm_add_ps(u, v), w);
+			__m128 scaledT = _mm_mul_ps(ray.shear[2], _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, az), _mm_mul_ps(v, bz)), _mm_mul_ps(w, cz)));
+			__m128 t = _mm_div_ps(scaledT, det);
+			__m128 valid = _mm_andnot_ps(_mm_and_ps(negative, positive), _mm_cmpneq_ps(det, zero));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(tMin)), _mm_cmple_ps(t, _mm_set1_ps(tMax))));
+
+			_mm_storeu_ps(pT + half, t);
+			_mm_storeu_ps(pU + half, _mm_div_ps(v, det));
+			_mm_storeu_ps(pV + half, _mm_div_ps(w, det));
+			_mm_storeu_ps(pDet + half, det);
+			mask |= (uint32_t)_mm_movemask_ps(_mm_andnot_ps(edge, valid)) << half;
+			edgeMask |= (uint32_t)_mm_movemask_ps(edge) << half;
+		}
+		uint32_t laneMask = (1u << count) - 1;
+		edgeMask &= laneMask;
+		return mask & laneMask;
+	}
+};
+#endif
+
+#ifdef WIDE_BVH_AVX2
+// All eight lanes at once
+struct Avx2Kernel
+{
+	struct Ray
+	{
+		__m256		origin[3];
+		__m256		invDirection[3];
+		__m256		shear[3];
+		int			kx, ky, kz;
+
+		explicit Ray(const TraversalRay& ray)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				origin[axis] = _mm256_set1_ps(ray.origin[axis]);
+				invDirection[axis] = _mm256_set1_ps(ray.invDirection[axis]);
+				shear[axis] = _mm256_set1_ps(ray.shear[axis]);
+			}
+			kx = ray.kx;
+			ky = ray.ky;
+			kz = ray.kz;
+		}
+	};
+
+	static __m256 loadQuantized(const uint8_t* pData)
+	{
+		return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)pData)));
+	}
+
+	static uint32_t intersectNode(const Ray& ray, const WideBvhNode& node, float tMin, float tMax, float* pEntry)
+	{
+		__m256 entry = _mm256_set1_ps(tMin);
+		__m256 exit = _mm256_set1_ps(tMax);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m256 origin = _mm256_set1_ps(node.origin[axis]);
+			__m256 scale = _mm256_set1_ps(node.scale[axis]);
+			__m256 boxMin = _mm256_add_ps(origin, _mm256_mul_ps(loadQuantized(node.qMin[axis]), scale));
+			__m256 boxMax = _mm256_add_ps(origin, _mm256_mul_ps(loadQuantized(node.qMax[axis]), scale));
+			__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(boxMin, ray.origin[axis]), ray.invDirection[axis]);
+			__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(boxMax, ray.origin[axis]), ray.invDirection[axis]);
+			entry = _mm256_max_ps(entry, _mm256_min_ps(t0, t1));
+			exit = _mm256_min_ps(exit, _mm256_max_ps(t0, t1));
+		}
+		_mm256_storeu_ps(pEntry, entry);
+		uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+		return mask & ((1u << node.numChildren) - 1);
+	}
+
+	static uint32_t intersectTriangles(const Ray& ray, const WideBvhTriangles& triangles, uint32_t count, float tMin, float tMax, float* pT, float* pU, float* pV, float* pDet, uint32_t& edgeMask)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 ax = _mm256_sub_ps(_mm256_loadu_ps(triangles.v0[ray.kx]), ray.origin[ray.kx]);
+		__m256 ay = _mm256_sub_ps(_mm256_loadu_ps(triangles.v0[ray.ky]), ray.origin[ray.ky]);
+		__m256 az = _mm256_sub_ps(_mm256_loadu_ps(triangles.v0[ray.kz]), ray.origin[ray.kz]);
+		__m256 bx = _mm256_sub_ps(_mm256_loadu_ps(triangles.v1[ray.kx]), ray.origin[ray.kx]);
+		__m256 by = _mm256_sub_ps(_mm256_loadu_ps(triangles.v1[ray.ky]), ray.origin[ray.ky]);
+		__m256 bz = _mm256_sub_ps(_mm256_loadu_ps(triangles.v1[ray.kz]), ray.origin[ray.kz]);
+		__m256 cx = _mm256_sub_ps(_mm256_loadu_ps(triangles.v2[ray.kx]), ray.origin[ray.kx]);
+		__m256 cy = _mm256_sub_ps(_mm256_loadu_ps(triangles.v2[ray.ky]), ray.origin[ray.ky]);
+		__m256 cz = _mm256_sub_ps(_mm256_loadu_ps(triangles.v2[ray.kz]), ray.origin[ray.kz]);
+		ax = _mm256_sub_ps(ax, _mm256_mul_ps(ray.shear[0], az));
+		ay = _mm256_sub_ps(ay, _mm256_mul_ps(ray.shear[1], az));
+		bx = _mm256_sub_ps(bx, _mm256_mul_ps(ray.shear[0], bz));
+		by = _mm256_sub_ps(by, _mm256_mul_ps(ray.shear[1], bz));
+		cx = _mm256_sub_ps(cx, _mm256_mul_ps(ray.shear[0], cz));
+		cy = _mm256_sub_ps(cy, _mm256_mul_ps(ray.shear[1], cz));
+
+		__m256 u = _mm256_sub_ps(_mm256_mul_ps(cx, by), _mm256_mul_ps(cy, bx));
+		__m256 v = _mm256_sub_ps(_mm256_mul_ps(ax, cy), _mm256_mul_ps(ay, cx));
+		__m256 w = _mm256_sub_ps(_mm256_mul_ps(bx, ay), _mm256_mul_ps(by, ax));
+		__m256 negative = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(v, zero, _CMP_LT_OQ)), _mm256_cmp_ps(w, zero, _CMP_LT_OQ));
+		__m256 positive = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_GT_OQ), _mm256_cmp_ps(v, zero, _CMP_GT_OQ)), _mm256_cmp_ps(w, zero, _CMP_GT_OQ));
+		__m256 edge = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_EQ_OQ), _mm256_cmp_ps(v, zero, _CMP_EQ_OQ)), _mm256_cmp_ps(w, zero, _CMP_EQ_OQ));
+		__m256 det = _mm256_add_ps(_mm256_add_ps(u, v), w);
+		__m256 scaledT = _mm256_mul_ps(ray.shear[2], _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(u, az), _mm256_mul_ps(v, bz)), _mm256_mul_ps(w, cz)));
+		__m256 t = _mm256_div_ps(scaledT, det);
+		__m256 valid = _mm256_andnot_ps(_mm256_and_ps(negative, positive), _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LE_OQ)));
+
+		_mm256_storeu_ps(pT, t);
+		_mm256_storeu_ps(pU, _mm256_div_ps(v, det));
+		_mm256_storeu_ps(pV, _mm256_div_ps(w, det));
+		_mm256_storeu_ps(pDet, det);
+		uint32_t laneMask = (1u << count) - 1;
+		edgeMask = (uint32_t)_mm256_movemask_ps(edge) & laneMask;
+		return (uint32_t)_mm256_movemask_ps(_mm256_andnot_ps(edge, valid)) & laneMask;
+	}
+};
+#endif
+
+///////////////////////////////////////////
+// Build
+///////////////////////////////////////////
+static void gatherPrimitives(const Bvh& bvh, uint32_t nodeIndex, std::vector<uint32_t>& primitives)
+{
+	const BvhNode& node = bvh.nodes[nodeIndex];
+	if (node.isLeaf())
+	{
+		for (uint32_t p = node.firstChildOrPrimitive; p < node.firstChildOrPrimitive + node.primitiveCount; p++)
+		{
+			primitives.push_back(p);
+		}
+		return;
+	}
+	gatherPrimitives(bvh, node.firstChildOrPrimitive, primitives);
+	gatherPrimitives(bvh, node.firstChildOrPrimitive + 1, primitives);
+}
+
+// Smallest power of two with 253 steps covering extent, two steps of slack for the rounding of origin + q * scale
+static float getQuantizationScale(float extent)
+{
+	if (!(extent > 0.0f))
+	{
+		return 1.0f;
+	}
+	int exponent;
+	frexpf(extent / 253.0f, &exponent);
+	return ldexpf(1.0f, exponent);
+}
+
+// Grid and 8-bit boxes of the first node.numChildren children, returns the bounds of the node
+static BvhBounds quantizeChildren(const BvhBounds* pChildBounds, WideBvhNode& node)
+{
+	BvhBounds bounds;
+	for (uint32_t c = 0; c < node.numChildren; c++)
+	{
+		bounds.grow(pChildBounds[c]);
+	}
+	node.origin = bounds.min;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		node.scale[axis] = getQuantizationScale(bounds.max[axis] - bounds.min[axis]);
+	}
+
+	for (uint32_t c = 0; c < node.numChildren; c++)
+	{
+		const BvhBounds& child = pChildBounds[c];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// Round outwards, then step until the decoded value, computed like the kernels do, really is outside
+			float origin = node.origin[axis];
+			float scale = node.scale[axis];
+			int qMin = std::min(std::max((int)floorf((child.min[axis] - origin) / scale), 0), 255);
+			int qMax = std::min(std::max((int)ceilf((child.max[axis] - origin) / scale), 0), 255);
+			while (qMin > 0 && origin + (float)qMin * scale > child.min[axis])
+			{
+				qMin--;
+			}
+			while (qMax < 255 && origin + (float)qMax * scale < child.max[axis])
+			{
+				qMax++;
+			}
+			node.qMin[axis][c] = (uint8_t)qMin;
+			node.qMax[axis][c] = (uint8_t)qMax;
+		}
+	}
+	return bounds;
+}
+
+// Vertices of the triangles of a block from the geometries
+static void gatherTriangles(const std::vector<MeshView>& geometries, uint32_t count, WideBvhTriangles& triangles)
+{
+	for (uint32_t lane = 0; lane < count; lane++)
+	{
+		const MeshView& geometry = geometries[triangles.geometry[lane]];
+		const uint32_t* pIndices = geometry.indices + 3 * triangles.triangle[lane];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			triangles.v0[axis][lane] = geometry.positions[pIndices[0]][axis];
+			triangles.v1[axis][lane] = geometry.positions[pIndices[1]][axis];
+			triangles.v2[axis][lane] = geometry.positions[pIndices[2]][axis];
+		}
+	}
+}
+
+void WideBvh::clear()
+{
+	mNodes.clear();
+	mTriangles.clear();
+	mpAttachedNodes = nullptr;
+	mpAttachedTriangles = nullptr;
+	mNumAttachedNodes = 0;
+	mNumAttachedLeaves = 0;
+}
+
+void WideBvh::attach(const WideBvhNode* pNodes, uint32_t numNodes, const WideBvhTriangles* pTriangles, uint32_t numLeaves)
+{
+	clear();
+	mpAttachedNodes = pNodes;
+	mpAttachedTriangles = pTriangles;
+	mNumAttachedNodes = numNodes;
+	mNumAttachedLeaves = numLeaves;
+}
+
+void WideBvh::detach()
+{
+	if (!isAttached())
+	{
+		return;
+	}
+	std::vector<WideBvhNode> nodes(mpAttachedNodes, mpAttachedNodes + mNumAttachedNodes);
+	std::vector<WideBvhTriangles> triangles(mpAttachedTriangles, mpAttachedTriangles + mNumAttachedLeaves);
+	clear();
+	mNodes.swap(nodes);
+	mTriangles.swap(triangles);
+}
+
+void WideBvh::collapseNode(const Bvh& bvh, const std::vector<MeshView>& geometries, const std::vector<uint32_t>& subtreeCount, uint32_t binaryIndex, uint32_t wideIndex)
+{
+	// Open the largest interior child until there are eight, subtrees of up to eight triangles stay closed and become leaves
+	uint32_t children[kWideBvhWidth];
+	uint32_t numChildren = 0;
+	if (subtreeCount[binaryIndex] <= kWideBvhWidth)
+	{
+		children[numChildren++] = binaryIndex;
+	}
+	else
+	{
+		children[numChildren++] = bvh.nodes[binaryIndex].firstChildOrPrimitive;
+		children[numChildren++] = bvh.nodes[binaryIndex].firstChildOrPrimitive + 1;
+	}
+	while (numChildren < kWideBvhWidth)
+	{
+		int best = -1;
+		float bestArea = -1.0f;
+		for (uint32_t c = 0; c < numChildren; c++)
+		{
+			float area = bvh.nodes[children[c]].getBounds().getArea();
+			if (subtreeCount[children[c]] > kWideBvhWidth && area > bestArea)
+			{
+				best = (int)c;
+				bestArea = area;
+			}
+		}
+		if (best < 0)
+		{
+			break;
+		}
+		uint32_t opened = children[best];
+		assert(!bvh.nodes[opened].isLeaf());
+		children[best] = bvh.nodes[opened].firstChildOrPrimitive;
+		children[numChildren++] = bvh.nodes[opened].firstChildOrPrimitive + 1;
+	}
+
+	BvhBounds childBounds[kWideBvhWidth];
+	for (uint32_t c = 0; c < numChildren; c++)
+	{
+		childBounds[c] = bvh.nodes[children[c]].getBounds();
+	}
+
+	// Value-initialized, so the padding and the lanes past numChildren are zero too
+	WideBvhNode node = WideBvhNode();
+	node.numChildren = numChildren;
+	quantizeChildren(childBounds, node);
+
+	uint32_t interiorChildren[kWideBvhWidth];
+	uint32_t numInterior = 0;
+	for (uint32_t c = 0; c < numChildren; c++)
+	{
+		if (subtreeCount[children[c]] <= kWideBvhWidth)
+		{
+			std::vector<uint32_t> primitives;
+			gatherPrimitives(bvh, children[c], primitives);
+			WideBvhTriangles triangles;
+			memset(&triangles, 0, sizeof(triangles));
+			for (uint32_t lane = 0; lane < (uint32_t)primitives.size(); lane++)
+			{
+				triangles.geometry[lane] = bvh.primitives[primitives[lane]].geometry;
+				triangles.triangle[lane] = bvh.primitives[primitives[lane]].triangle;
+			}
+			gatherTriangles(geometries, (uint32_t)primitives.size(), triangles);
+			node.child[c] = (uint32_t)mTriangles.size();
+			node.count[c] = (uint8_t)primitives.size();
+			mTriangles.push_back(triangles);
+			assert(node.child[c] <= kIndexMask);
+		}
+		else
+		{
+			node.child[c] = (uint32_t)mNodes.size();
+			assert(node.child[c] <= kIndexMask);
+			mNodes.push_back(WideBvhNode());
+			interiorChildren[numInterior++] = c;
+		}
+	}
+	mNodes[wideIndex] = node;
+
+	for (uint32_t i = 0; i < numInterior; i++)
+	{
+		uint32_t c = interiorChildren[i];
+		collapseNode(bvh, geometries, subtreeCount, children[c], node.child[c]);
+	}
+}
+
+void WideBvh::build(const Bvh& bvh, const std::vector<MeshView>& geometries)
+{
+	clear();
+	if (bvh.nodes.empty())
+	{
+		return;
+	}
+
+	// Children come after their parent, so a backward pass sums the subtrees
+	std::vector<uint32_t> subtreeCount(bvh.nodes.size());
+	for (uint32_t n = bvh.getNumNodes(); n-- > 0;)
+	{
+		const BvhNode& node = bvh.nodes[n];
+		assert(!node.isLeaf() || node.primitiveCount <= kWideBvhWidth);
+		subtreeCount[n] = node.isLeaf() ? node.primitiveCount : subtreeCount[node.firstChildOrPrimitive] + subtreeCount[node.firstChildOrPrimitive + 1];
+	}
+
+	// Roughly one wide node per four binary interior nodes
+	mNodes.reserve(bvh.nodes.size() / 8 + 1);
+	mTriangles.reserve(bvh.primitives.size() / 4 + 1);
+	mNodes.push_back(WideBvhNode());
+	collapseNode(bvh, geometries, subtreeCount, 0, 0);
+}
+
+BvhBounds WideBvh::refit(const std::vector<MeshView>& geometries, TaskPool* pPool)
+{
+	assert(!isAttached());
+	if (mNodes.empty())
+	{
+		return BvhBounds();
+	}
+
+	// The leaf count of a block is in the node that references it, so mark every block with its count first
+	std::vector<uint8_t> blockCount(mTriangles.size(), 0);
+	for (const WideBvhNode& node : mNodes)
+	{
+		for (uint32_t c = 0; c < node.numChildren; c++)
+		{
+			if (node.count[c] > 0)
+			{
+				blockCount[node.child[c]] = node.count[c];
+			}
+		}
+	}
+	auto gatherBlocks = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t b = begin; b < end; b++)
+		{
+			gatherTriangles(geometries, blockCount[b], mTriangles[b]);
+		}
+	};
+	if (pPool)
+	{
+		pPool->parallelForRange((uint32_t)mTriangles.size(), 1024, gatherBlocks);
+	}
+	else
+	{
+		gatherBlocks(0, (uint32_t)mTriangles.size());
+	}
+
+	// Child nodes come after their parent, a backward pass has the exact bounds of every child ready
+	std::vector<BvhBounds> nodeBounds(mNodes.size());
+	for (uint32_t n = (uint32_t)mNodes.size(); n-- > 0;)
+	{
+		WideBvhNode& node = mNodes[n];
+		BvhBounds childBounds[kWideBvhWidth];
+		for (uint32_t c = 0; c < node.numChildren; c++)
+		{
+			if (node.count[c] == 0)
+			{
+				childBounds[c] = nodeBounds[node.child[c]];
+				continue;
+			}
+			const WideBvhTriangles& triangles = mTriangles[node.child[c]];
+			for (uint32_t lane = 0; lane < node.count[c]; lane++)
+			{
+				for (int axis = 0; axis < 3; axis++)
+				{
+					float v0 = triangles.v0[axis][lane], v1 = triangles.v1[axis][lane], v2 = triangles.v2[axis][lane];
+					childBounds[c].min[axis] = std::min(childBounds[c].min[axis], std::min(v0, std::min(v1, v2)));
+					childBounds[c].max[axis] = std::max(childBounds[c].max[axis], std::max(v0, std::max(v1, v2)));
+				}
+			}
+		}
+		nodeBounds[n] = quantizeChildren(childBounds, node);
+	}
+	return nodeBounds[0];
+}
+
+void WideBvh::setKernel(WideBvhKernel kernel)
+{
+	WideBvhKernel best = getBestWideBvhKernel();
+	mKernel = (uint32_t)kernel <= (uint32_t)best ? kernel : best;
+}
+
+///////////////////////////////////////////
+// Traversal
+///////////////////////////////////////////
+// Kernel triangle test, with the lanes on an edge decided by the scalar test
+template <class Kernel>
+static uint32_t intersectTriangles(const TraversalRay& ray, const typename Kernel::Ray& kernelRay, const WideBvhTriangles& triangles, uint32_t count,
+	float tMin, float tMax, float* pT, float* pU, float* pV, float* pDet)
+{
+	AS_STATS_ADD(triangles, count);
+	uint32_t edgeMask;
+	uint32_t mask = Kernel::intersectTriangles(kernelRay, triangles, count, tMin, tMax, pT, pU, pV, pDet, edgeMask);
+	while (edgeMask != 0)
+	{
+		uint32_t lane = getLowestBit(edgeMask);
+		edgeMask &= edgeMask - 1;
+		vec2 barycentrics;
+		if (ray.intersectTriangle(vec3(triangles.v0[0][lane], triangles.v0[1][lane], triangles.v0[2][lane]),
+			vec3(triangles.v1[0][lane], triangles.v1[1][lane], triangles.v1[2][lane]),
+			vec3(triangles.v2[0][lane], triangles.v2[1][lane], triangles.v2[2][lane]), tMin, tMax, pT[lane], barycentrics, pDet[lane]))
+		{
+			pU[lane] = barycentrics.x;
+			pV[lane] = barycentrics.y;
+			mask |= 1u << lane;
+		}
+	}
+	return mask;
+}
+template <class Kernel>
+bool WideBvh::intersectWith(const vec3& origin, const vec3& direction, float tMin, uint32_t rayFlags, uint32_t instanceFlags, CpuHit& hit) const
+{
+	const WideBvhNode* pNodes = getNodes();
+	const WideBvhTriangles* pTriangles = getTriangles();
+	TraversalRay ray(origin, direction);
+	typename Kernel::Ray kernelRay(ray);
+	FaceCulling culling(rayFlags, instanceFlags);
+	bool acceptFirstHit = (rayFlags & kRayFlagAcceptFirstHitAndEndSearch) != 0;
+	bool found = false;
+
+	WideStackEntry stack[kWideStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, tMin };
+	while (stackSize > 0)
+	{
+		WideStackEntry current = stack[--stackSize];
+		if (current.entry > hit.t)
+		{
+			continue;
+		}
+		uint32_t count = current.ref >> kCountShift;
+		uint32_t index = current.ref & kIndexMask;
+
+		if (count == 0)
+		{
+			// Push the children far to near, so the nearest is popped next
+			const WideBvhNode& node = pNodes[index];
+			AS_STATS_ADD(nodes, 1);
+			float entry[kWideBvhWidth];
+			uint32_t mask = Kernel::intersectNode(kernelRay, node, tMin, hit.t, entry);
+			uint32_t first = stackSize;
+			while (mask != 0)
+			{
+				uint32_t c = getLowestBit(mask);
+				mask &= mask - 1;
+				WideStackEntry child = { node.child[c] | ((uint32_t)node.count[c] << kCountShift), entry[c] };
+				assert(stackSize < kWideStackSize);
+				uint32_t slot = stackSize++;
+				while (slot > first && stack[slot - 1].entry < child.entry)
+				{
+					stack[slot] = stack[slot - 1];
+					slot--;
+				}
+				stack[slot] = child;
+			}
+			continue;
+		}
+
+		const WideBvhTriangles& triangles = pTriangles[index];
+		float t[kWideBvhWidth], u[kWideBvhWidth], v[kWideBvhWidth], det[kWideBvhWidth];
+		uint32_t mask = intersectTriangles<Kernel>(ray, kernelRay, triangles, count, tMin, hit.t, t, u, v, det);
+
+		while (mask != 0)
+		{
+			uint32_t lane = getLowestBit(mask);
+			mask &= mask - 1;
+			bool frontFace;
+			if (t[lane] > hit.t || culling.isCulled(det[lane], frontFace))
+			{
+				continue;
+			}
+			hit.t = t[lane];
+			hit.barycentrics = vec2(u[lane], v[lane]);
+			hit.primitiveIndex = triangles.triangle[lane];
+			hit.geometryIndex = triangles.geometry[lane];
+			hit.hitKind = frontFace ? kHitKindTriangleFrontFace : kHitKindTriangleBackFace;
+			found = true;
+			if (acceptFirstHit)
+			{
+				return true;
+			}
+		}
+	}
+	return found;
+}
+
+template <class Kernel>
+bool WideBvh::occludedWith(const vec3& origin, const vec3& direction, float tMin, float tMax, uint32_t rayFlags, uint32_t instanceFlags, uint32_t& leaf) const
+{
+	const WideBvhNode* pNodes = getNodes();
+	const WideBvhTriangles* pTriangles = getTriangles();
+	TraversalRay ray(origin, direction);
+	typename Kernel::Ray kernelRay(ray);
+	FaceCulling culling(rayFlags, instanceFlags);
+	auto isLeafOccluded = [&](uint32_t ref)
+	{
+		float t[kWideBvhWidth], u[kWideBvhWidth], v[kWideBvhWidth], det[kWideBvhWidth];
+		uint32_t mask = intersectTriangles<Kernel>(ray, kernelRay, pTriangles[ref & kIndexMask], ref >> kCountShift, tMin, tMax, t, u, v, det);
+		while (mask != 0)
+		{
+			uint32_t lane = getLowestBit(mask);
+			mask &= mask - 1;
+			bool frontFace;
+			if (!culling.isCulled(det[lane], frontFace))
+			{
+				leaf = ref;
+				return true;
+			}
+		}
+		return false;
+	};
+
+	if (leaf != kCpuNoHit && (leaf & kIndexMask) < getNumLeaves() && isLeafOccluded(leaf))
+	{
+		return true;
+	}
+
+	uint32_t stack[kWideStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const WideBvhNode& node = pNodes[stack[--stackSize]];
+		AS_STATS_ADD(nodes, 1);
+		float entry[kWideBvhWidth];
+		uint32_t mask = Kernel::intersectNode(kernelRay, node, tMin, tMax, entry);
+		while (mask != 0)
+		{
+			uint32_t c = getLowestBit(mask);
+			mask &= mask - 1;
+			if (node.count[c] == 0)
+			{
+				assert(stackSize < kWideStackSize);
+				stack[stackSize++] = node.child[c];
+			}
+			else if (isLeafOccluded(node.child[c] | ((uint32_t)node.count[c] << kCountShift)))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool WideBvh::intersect(const vec3& origin, const vec3& direction, float tMin, uint32_t rayFlags, uint32_t instanceFlags, CpuHit& hit) const
+{
+	if (isEmpty())
+	{
+		return false;
+	}
+	switch (mKernel)
+	{
+#ifdef WIDE_BVH_AVX2
+	case WideBvhKernel::Avx2:
+	{
+		// Leave the upper halves clean for SSE code compiled without VEX encoding
+		bool found = intersectWith<Avx2Kernel>(origin, direction, tMin, rayFlags, instanceFlags, hit);
+		_mm256_zeroupper();
+		return found;
+	}
+#endif
+#ifdef WIDE_BVH_SSE
+	case WideBvhKernel::Sse: return intersectWith<SseKernel>(origin, direction, tMin, rayFlags, instanceFlags, hit);
+#endif
+	default: return intersectWith<ScalarKernel>(origin, direction, tMin, rayFlags, instanceFlags, hit);
+	}
+}
+
+bool WideBvh::occluded(const vec3& origin, const vec3& direction, float tMin, float tMax, uint32_t rayFlags, uint32_t instanceFlags, uint32_t& leaf) const
+{
+	if (isEmpty())
+	{
+		return false;
+	}
+	switch (mKernel)
+	{
+#ifdef WIDE_BVH_AVX2
+	case WideBvhKernel::Avx2:
+	{
+		bool found = occludedWith<Avx2Kernel>(origin, direction, tMin, tMax, rayFlags, instanceFlags, leaf);
+		_mm256_zeroupper();
+		return found;
+	}
+#endif
+#ifdef WIDE_BVH_SSE
+	case WideBvhKernel::Sse: return occludedWith<SseKernel>(origin, direction, tMin, tMax, rayFlags, instanceFlags, leaf);
+#endif
+	default: return occludedWith<ScalarKernel>(origin, direction, tMin, tMax, rayFlags, instanceFlags, leaf);
+	}
+}
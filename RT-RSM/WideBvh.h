@@ -0,0 +1,104 @@
+#pragma once
+#include "CpuRay.h"
+
+///////////////////////////////////////////
+// 8-wide BVH
+///////////////////////////////////////////
+/*
+	A binary SAH tree collapsed into nodes of up to eight children, so one ray is tested against eight boxes
+	or eight triangles per step with AVX2 (SSE: two halves of four). Subtrees of at most eight triangles become
+	a leaf of one triangle block. Triangles are tested with the same watertight test as the binary tree,
+	so both trees report the same hits.
+*/
+static const uint32_t kWideBvhWidth = 8;
+
+/*
+	Child bounds are 8-bit offsets on a per-axis power of two grid starting at origin. origin + q * scale is
+	exact up to the final rounding, which the builder checks, so the decoded boxes always contain the children.
+*/
+struct WideBvhNode
+{
+	vec3		origin;
+	uint32_t	numChildren;
+	vec3		scale;
+	uint32_t	padding;
+	uint8_t		qMin[3][kWideBvhWidth];		// [axis][child]
+	uint8_t		qMax[3][kWideBvhWidth];
+	uint32_t	child[kWideBvhWidth];		// node index, or triangle block index for a leaf
+	uint8_t		count[kWideBvhWidth];		// triangles of a leaf child, 0 for an interior child
+};
+
+// Eight triangles as structure of arrays, lanes past the leaf's count are zero
+struct WideBvhTriangles
+{
+	float		v0[3][kWideBvhWidth];
+	float		v1[3][kWideBvhWidth];
+	float		v2[3][kWideBvhWidth];
+	uint32_t	geometry[kWideBvhWidth];
+	uint32_t	triangle[kWideBvhWidth];
+};
+
+enum class WideBvhKernel
+{
+	Scalar,
+	Sse,
+	Avx2,
+};
+
+// Best kernel the CPU and the build support
+WideBvhKernel getBestWideBvhKernel();
+const char* getWideBvhKernelName(WideBvhKernel kernel);
+
+class WideBvh
+{
+public:
+	// bvh must be built over geometries, with leaves of at most eight triangles
+	void build(const Bvh& bvh, const std::vector<MeshView>& geometries);
+	void clear();
+
+	// Same triangles, moved vertices: the triangle blocks are gathered again and the child boxes requantized bottom up. Not for attached trees.
+	// Returns the exact bounds of the refitted triangles, empty for an empty tree.
+	BvhBounds refit(const std::vector<MeshView>& geometries, TaskPool* pPool = nullptr);
+
+	// Use a tree stored elsewhere, e.g. in a mapped BvhCache, without copying it. The memory must outlive the tree.
+	void attach(const WideBvhNode* pNodes, uint32_t numNodes, const WideBvhTriangles* pTriangles, uint32_t numLeaves);
+
+	// Copy an attached tree into its own storage, so the memory it was attached to can go
+	void detach();
+
+	// Same contract as CpuBlas::intersect
+	bool intersect(const vec3& origin, const vec3& direction, float tMin, uint32_t rayFlags, uint32_t instanceFlags, CpuHit& hit) const;
+
+	/*
+		Any triangle in (tMin, tMax]? Children are visited in any order and leaves are tested as soon as they are
+		found, nothing is kept about the hit. leaf is a leaf to test first, kCpuNoHit for none, and is set to the blocking leaf.
+	*/
+	bool occluded(const vec3& origin, const vec3& direction, float tMin, float tMax, uint32_t rayFlags, uint32_t instanceFlags, uint32_t& leaf) const;
+
+	// Falls back to the best supported kernel
+	void setKernel(WideBvhKernel kernel);
+	WideBvhKernel getKernel() const { return mKernel; }
+
+	const WideBvhNode*		getNodes() const { return mNodes.empty() ? mpAttachedNodes : mNodes.data(); }
+	const WideBvhTriangles*	getTriangles() const { return mNodes.empty() ? mpAttachedTriangles : mTriangles.data(); }
+	uint32_t getNumNodes() const { return mNodes.empty() ? mNumAttachedNodes : (uint32_t)mNodes.size(); }
+	uint32_t getNumLeaves() const { return mNodes.empty() ? mNumAttachedLeaves : (uint32_t)mTriangles.size(); }
+	uint64_t getMemorySize() const { return getNumNodes() * sizeof(WideBvhNode) + getNumLeaves() * sizeof(WideBvhTriangles); }
+	bool isEmpty() const { return getNumNodes() == 0; }
+	bool isAttached() const { return mpAttachedNodes != nullptr; }
+
+private:
+	template <class Kernel>
+	bool intersectWith(const vec3& origin, const vec3& direction, float tMin, uint32_t rayFlags, uint32_t instanceFlags, CpuHit& hit) const;
+	template <class Kernel>
+	bool occludedWith(const vec3& origin, const vec3& direction, float tMin, float tMax, uint32_t rayFlags, uint32_t instanceFlags, uint32_t& leaf) const;
+	void collapseNode(const Bvh& bvh, const std::vector<MeshView>& geometries, const std::vector<uint32_t>& subtreeCount, uint32_t binaryIndex, uint32_t wideIndex);
+
+	std::vector<WideBvhNode>		mNodes;		// root at 0
+	std::vector<WideBvhTriangles>	mTriangles;
+	const WideBvhNode*				mpAttachedNodes = nullptr;		// used while mNodes is empty
+	const WideBvhTriangles*			mpAttachedTriangles = nullptr;
+	uint32_t						mNumAttachedNodes = 0;
+	uint32_t						mNumAttachedLeaves = 0;
+	WideBvhKernel					mKernel = getBestWideBvhKernel();
+};